@@ -0,0 +1,66 @@
+package com.example.thinpic_flutter;
+
+/**
+ * The native batch engine without Flutter, for WorkManager workers and
+ * foreground services that keep a batch going while the app is in the
+ * background. Calls run on the same worker pool and memory governor as the
+ * Dart API; the run is recorded in the native library, so Dart reads its
+ * progress with ThinPicCompress.backgroundBatchStatus when an engine
+ * attaches again. ThinpicBatchWorker wraps it for WorkManager.
+ */
+public final class ThinpicBackgroundEngine {
+    static {
+        System.loadLibrary("thinpic_flutter");
+    }
+
+    // ThinpicBackgroundState
+    public static final int STATE_IDLE = 0;
+    public static final int STATE_RUNNING = 1;
+    public static final int STATE_FINISHED = 2;
+    public static final int STATE_STOPPED = 3;
+    public static final int STATE_FAILED = 4;
+
+    // ImageFormat values used by background batches
+    public static final int FORMAT_JPEG = 0;
+    public static final int FORMAT_PNG = 1;
+    public static final int FORMAT_WEBP = 2;
+
+    private ThinpicBackgroundEngine() {
+    }
+
+    private static native int nativeCompressDirectory(String source, String outputDir, String manifestPath,
+                                                      int format, int quality, int targetWidth, int targetHeight);
+
+    private static native void nativeStop();
+
+    private static native int nativeStatus(int[] values);
+
+    /**
+     * Compresses every image of the directory (or list file) source into
+     * outputDir, skipping what the manifest already records, at background
+     * priority. Blocks the calling thread; returns how many inputs the
+     * manifest records as done, or -1 on invalid arguments, an unreadable
+     * source or while another background batch runs.
+     */
+    public static int compressDirectory(String source, String outputDir, String manifestPath, int format,
+                                        int quality, int targetWidth, int targetHeight) {
+        return nativeCompressDirectory(source, outputDir, manifestPath, format, quality, targetWidth,
+                targetHeight);
+    }
+
+    /**
+     * Stops the running batch: nothing more is started and items in flight
+     * are cancelled, left unrecorded for the next run. compressDirectory
+     * returns soon after.
+     */
+    public static void stop() {
+        nativeStop();
+    }
+
+    /** The running or last batch: {state, done, total}. */
+    public static int[] status() {
+        int[] values = new int[3];
+        nativeStatus(values);
+        return values;
+    }
+}
@@ -0,0 +1,64 @@
+package com.example.thinpic_flutter;
+
+import android.content.Context;
+
+import androidx.annotation.NonNull;
+import androidx.work.Data;
+import androidx.work.Worker;
+import androidx.work.WorkerParameters;
+
+/**
+ * A WorkManager worker that runs ThinpicBackgroundEngine.compressDirectory
+ * with the KEY_* input data. A worker the system stops asks for a retry, and
+ * the retry resumes from the manifest; run it as expedited or foreground
+ * work for long batches. Needs androidx.work:work-runtime in the app.
+ */
+public class ThinpicBatchWorker extends Worker {
+    public static final String KEY_SOURCE = "source";
+    public static final String KEY_OUTPUT_DIR = "outputDir";
+    public static final String KEY_MANIFEST = "manifestPath";
+    public static final String KEY_FORMAT = "format";
+    public static final String KEY_QUALITY = "quality";
+    public static final String KEY_TARGET_WIDTH = "targetWidth";
+    public static final String KEY_TARGET_HEIGHT = "targetHeight";
+    // Output data
+    public static final String KEY_DONE = "done";
+    public static final String KEY_TOTAL = "total";
+
+    public ThinpicBatchWorker(@NonNull Context context, @NonNull WorkerParameters parameters) {
+        super(context, parameters);
+    }
+
+    @NonNull
+    @Override
+    public Result doWork() {
+        Data input = getInputData();
+        String source = input.getString(KEY_SOURCE);
+        String outputDir = input.getString(KEY_OUTPUT_DIR);
+        String manifestPath = input.getString(KEY_MANIFEST);
+        if (source == null || outputDir == null || manifestPath == null) {
+            return Result.failure();
+        }
+        int done = ThinpicBackgroundEngine.compressDirectory(source, outputDir, manifestPath,
+                input.getInt(KEY_FORMAT, ThinpicBackgroundEngine.FORMAT_JPEG),
+                input.getInt(KEY_QUALITY, 80),
+                input.getInt(KEY_TARGET_WIDTH, 0),
+                input.getInt(KEY_TARGET_HEIGHT, 0));
+        int[] status = ThinpicBackgroundEngine.status();
+        if (status[0] == ThinpicBackgroundEngine.STATE_STOPPED || isStopped()) {
+            return Result.retry();
+        }
+        if (done < 0) {
+            return Result.failure();
+        }
+        return Result.success(new Data.Builder()
+                .putInt(KEY_DONE, done)
+                .putInt(KEY_TOTAL, status[2])
+                .build());
+    }
+
+    @Override
+    public void onStopped() {
+        ThinpicBackgroundEngine.stop();
+    }
+}
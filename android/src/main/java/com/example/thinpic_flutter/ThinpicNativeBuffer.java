@@ -0,0 +1,60 @@
+package com.example.thinpic_flutter;
+
+import java.io.Closeable;
+import java.nio.ByteBuffer;
+
+/**
+ * A compressed image still in native memory, handed over from Dart with
+ * ThinPicCompress.compressToNativeBuffer. The Dart side passes only the
+ * handle (over the app's own channel); take wraps the native bytes in a
+ * direct ByteBuffer, so an upload stack such as OkHttp writes them out
+ * without a copy through the Dart or Java heap. close frees the native
+ * memory, after which the buffer must not be touched; take and close each
+ * handle exactly once.
+ */
+public final class ThinpicNativeBuffer implements Closeable {
+    static {
+        System.loadLibrary("thinpic_flutter");
+    }
+
+    private final long handle;
+    private ByteBuffer buffer;
+
+    private ThinpicNativeBuffer(long handle, ByteBuffer buffer) {
+        this.handle = handle;
+        this.buffer = buffer;
+    }
+
+    private static native ByteBuffer nativeWrap(long handle);
+
+    private static native int nativeRelease(long handle);
+
+    /** The exported buffer behind handle, or null if it is unknown or already released. */
+    public static ThinpicNativeBuffer take(long handle) {
+        ByteBuffer buffer = nativeWrap(handle);
+        return buffer == null ? null : new ThinpicNativeBuffer(handle, buffer.asReadOnlyBuffer());
+    }
+
+    /** The encoded bytes, read-only; valid until close. */
+    public ByteBuffer buffer() {
+        if (buffer == null) {
+            throw new IllegalStateException("ThinpicNativeBuffer already closed");
+        }
+        return buffer;
+    }
+
+    /** Length of the encoded image in bytes. */
+    public int length() {
+        return buffer().capacity();
+    }
+
+    /** Frees the native memory; later calls do nothing. */
+    @Override
+    public synchronized void close() {
+        if (buffer == null) {
+            return;
+        }
+        buffer = null;
+        nativeRelease(handle);
+    }
+}
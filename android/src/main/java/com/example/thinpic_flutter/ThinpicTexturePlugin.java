@@ -0,0 +1,172 @@
+package com.example.thinpic_flutter;
+
+import android.content.ComponentCallbacks2;
+import android.content.Context;
+import android.content.res.Configuration;
+import android.os.Handler;
+import android.os.Looper;
+import android.view.Surface;
+
+import androidx.annotation.NonNull;
+
+import java.util.HashMap;
+import java.util.Map;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+
+import io.flutter.embedding.engine.plugins.FlutterPlugin;
+import io.flutter.plugin.common.MethodCall;
+import io.flutter.plugin.common.MethodChannel;
+import io.flutter.view.TextureRegistry;
+
+/**
+ * Preview textures for ThinPicCompress.createPreviewTexture. The rest of the
+ * plugin is plain FFI; this class only exists because Flutter's
+ * TextureRegistry is reachable from the embedding. Each preview is a
+ * SurfaceTexture whose Surface the native library draws the decoded image
+ * into (thinpic_render_to_window), off the platform thread. It also forwards
+ * the application's onTrimMemory and onLowMemory to
+ * thinpic_on_memory_pressure, which drops the native caches.
+ */
+public class ThinpicTexturePlugin implements FlutterPlugin, MethodChannel.MethodCallHandler {
+    static {
+        System.loadLibrary("thinpic_flutter");
+    }
+
+    private static final String CHANNEL = "thinpic_flutter/texture";
+
+    private static native int nativeRender(Surface surface, String path, int maxWidth, int maxHeight, int[] size);
+
+    private static native void nativeMemoryPressure(int trimLevel);
+
+    // Registered on the application context for as long as the engine is
+    // attached; the native side maps the trim level
+    private final ComponentCallbacks2 memoryCallbacks = new ComponentCallbacks2() {
+        @Override
+        public void onTrimMemory(int level) {
+            nativeMemoryPressure(level);
+        }
+
+        @Override
+        public void onLowMemory() {
+            nativeMemoryPressure(ComponentCallbacks2.TRIM_MEMORY_COMPLETE);
+        }
+
+        @Override
+        public void onConfigurationChanged(@NonNull Configuration configuration) {
+        }
+    };
+
+    private static final class Preview {
+        final TextureRegistry.SurfaceTextureEntry entry;
+        final Surface surface;
+
+        Preview(TextureRegistry.SurfaceTextureEntry entry) {
+            this.entry = entry;
+            this.surface = new Surface(entry.surfaceTexture());
+        }
+
+        void release() {
+            surface.release();
+            entry.release();
+        }
+    }
+
+    private final Map<Long, Preview> previews = new HashMap<>();
+    private final Handler mainHandler = new Handler(Looper.getMainLooper());
+    private ExecutorService renderer;
+    private MethodChannel channel;
+    private TextureRegistry textures;
+    private Context context;
+
+    @Override
+    public void onAttachedToEngine(@NonNull FlutterPluginBinding binding) {
+        textures = binding.getTextureRegistry();
+        renderer = Executors.newSingleThreadExecutor();
+        channel = new MethodChannel(binding.getBinaryMessenger(), CHANNEL);
+        channel.setMethodCallHandler(this);
+        context = binding.getApplicationContext();
+        context.registerComponentCallbacks(memoryCallbacks);
+    }
+
+    @Override
+    public void onDetachedFromEngine(@NonNull FlutterPluginBinding binding) {
+        context.unregisterComponentCallbacks(memoryCallbacks);
+        context = null;
+        channel.setMethodCallHandler(null);
+        channel = null;
+        renderer.shutdown();
+        renderer = null;
+        for (Preview preview : previews.values()) preview.release();
+        previews.clear();
+        textures = null;
+    }
+
+    @Override
+    public void onMethodCall(@NonNull MethodCall call, @NonNull MethodChannel.Result result) {
+        switch (call.method) {
+            case "create": {
+                String path = call.argument("path");
+                Integer maxWidth = call.argument("maxWidth");
+                Integer maxHeight = call.argument("maxHeight");
+                if (path == null) {
+                    result.error("ARGUMENT", "path is required", null);
+                    return;
+                }
+                Preview preview = new Preview(textures.createSurfaceTexture());
+                long id = preview.entry.id();
+                previews.put(id, preview);
+                render(preview, path, maxWidth == null ? 0 : maxWidth, maxHeight == null ? 0 : maxHeight, true, result);
+                break;
+            }
+            case "update": {
+                Number id = call.argument("textureId");
+                String path = call.argument("path");
+                Integer maxWidth = call.argument("maxWidth");
+                Integer maxHeight = call.argument("maxHeight");
+                Preview preview = id == null ? null : previews.get(id.longValue());
+                if (preview == null || path == null) {
+                    result.error("ARGUMENT", "unknown texture or missing path", null);
+                    return;
+                }
+                render(preview, path, maxWidth == null ? 0 : maxWidth, maxHeight == null ? 0 : maxHeight, false, result);
+                break;
+            }
+            case "dispose": {
+                Number id = call.argument("textureId");
+                Preview preview = id == null ? null : previews.remove(id.longValue());
+                if (preview != null) {
+                    // Behind any render still queued for it
+                    renderer.execute(() -> mainHandler.post(preview::release));
+                }
+                result.success(null);
+                break;
+            }
+            default:
+                result.notImplemented();
+        }
+    }
+
+    // Decodes on the render thread; the reply (texture id and drawn size, or
+    // null when the image could not be decoded) goes back on the main thread.
+    // A texture created for a failed render is released again.
+    private void render(Preview preview, String path, int maxWidth, int maxHeight, boolean created,
+                        MethodChannel.Result result) {
+        renderer.execute(() -> {
+            int[] size = new int[2];
+            int status = nativeRender(preview.surface, path, maxWidth, maxHeight, size);
+            mainHandler.post(() -> {
+                if (status != 0) {
+                    if (created && previews.remove(preview.entry.id()) != null) preview.release();
+                    result.success(null);
+                    return;
+                }
+                Map<String, Object> reply = new HashMap<>();
+                reply.put("textureId", preview.entry.id());
+                reply.put("width", size[0]);
+                reply.put("height", size[1]);
+                result.success(reply);
+            });
+        });
+    }
+}
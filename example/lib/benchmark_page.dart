@@ -0,0 +1,282 @@
+import 'dart:io';
+import 'dart:ui';
+
+import 'package:flutter/material.dart';
+import 'package:flutter/scheduler.dart';
+import 'package:image_picker/image_picker.dart';
+import 'package:thinpic_flutter/thinpic_flutter.dart';
+
+/// One way of compressing a batch of images; returns how many succeeded.
+typedef BenchmarkRun = Future<int> Function(List<String> paths);
+
+class BenchmarkCase {
+  const BenchmarkCase(this.name, this.run);
+
+  final String name;
+  final BenchmarkRun run;
+}
+
+class BenchmarkResult {
+  BenchmarkResult({
+    required this.name,
+    required this.images,
+    required this.succeeded,
+    required this.elapsed,
+    required this.frames,
+    required this.jankyFrames,
+    required this.worstBuildMs,
+    required this.worstRasterMs,
+    required this.rssDeltaMb,
+    required this.peakRssMb,
+  });
+
+  final String name;
+  final int images;
+  final int succeeded;
+  final Duration elapsed;
+  final int frames;
+  final int jankyFrames;
+  final double worstBuildMs;
+  final double worstRasterMs;
+  final double rssDeltaMb;
+  final double peakRssMb;
+
+  double get imagesPerSecond =>
+      elapsed.inMicroseconds == 0 ? 0 : images * 1e6 / elapsed.inMicroseconds;
+}
+
+/// Runs the same batch through each ThinPicCompress path and reports
+/// throughput, UI jank (frames over the display budget while the batch ran)
+/// and process memory, so a device can be checked by hand.
+class BenchmarkPage extends StatefulWidget {
+  const BenchmarkPage({super.key});
+
+  @override
+  State<BenchmarkPage> createState() => _BenchmarkPageState();
+}
+
+class _BenchmarkPageState extends State<BenchmarkPage> {
+  static const int _quality = 80;
+  static const int _frameBudgetMicros = 16667;
+
+  List<String> paths = [];
+  int repeat = 1;
+  bool running = false;
+  String status = 'Pick images to start';
+  final List<BenchmarkResult> results = [];
+
+  // Each method on its own, then the three ways of running a batch:
+  // a compute() isolate per call, native pool jobs, and one batch call
+  late final List<BenchmarkCase> cases = [
+    BenchmarkCase('compressImage (pool)', (paths) async {
+      final files = await Future.wait(
+        paths.map((p) => ThinPicCompress.compressImage(p, quality: _quality)),
+      );
+      return _count(files);
+    }),
+    BenchmarkCase('compressImageWithSizeAndFormat 1920', (paths) async {
+      final files = await Future.wait(
+        paths.map(
+          (p) => ThinPicCompress.compressImageWithSizeAndFormat(
+            p,
+            _quality,
+            1920,
+            1920,
+            ImageFormat.FORMAT_JPEG,
+          ),
+        ),
+      );
+      return _count(files);
+    }),
+    BenchmarkCase('compressThumbnail 320', (paths) async {
+      final files = await Future.wait(
+        paths.map((p) => ThinPicCompress.compressThumbnail(p)),
+      );
+      return _count(files);
+    }),
+    BenchmarkCase('compressBytes (pool)', (paths) async {
+      final outputs = await Future.wait(
+        paths.map(
+          (p) async => ThinPicCompress.compressBytes(
+            await File(p).readAsBytes(),
+            quality: _quality,
+          ),
+        ),
+      );
+      return _count(outputs);
+    }),
+    BenchmarkCase('compressWithOptions (compute per call)', (paths) async {
+      final outputs = await Future.wait(
+        paths.map(
+          (p) => ThinPicCompress.compressWithOptions(p, quality: _quality),
+        ),
+      );
+      return _count(outputs);
+    }),
+    BenchmarkCase('compressBatch (one call)', (paths) async {
+      final files = await ThinPicCompress.compressBatch(
+        paths,
+        quality: _quality,
+      );
+      return _count(files);
+    }),
+  ];
+
+  static int _count(List<Object?> outputs) =>
+      outputs.where((o) => o != null).length;
+
+  Future<void> pickImages() async {
+    final images = await ImagePicker().pickMultiImage();
+    setState(() {
+      paths = images.map((i) => i.path).toList();
+      status = '${paths.length} image(s) selected';
+      results.clear();
+    });
+  }
+
+  Future<BenchmarkResult> _measure(BenchmarkCase benchmark) async {
+    final timings = <FrameTiming>[];
+    void onTimings(List<FrameTiming> batch) => timings.addAll(batch);
+
+    final batch = [for (var i = 0; i < repeat; i++) ...paths];
+    final rssBefore = ProcessInfo.currentRss;
+    SchedulerBinding.instance.addTimingsCallback(onTimings);
+    final stopwatch = Stopwatch()..start();
+    final succeeded = await benchmark.run(batch);
+    stopwatch.stop();
+    // Frame timings are reported in batches; let the last one arrive
+    await Future<void>.delayed(const Duration(milliseconds: 200));
+    SchedulerBinding.instance.removeTimingsCallback(onTimings);
+
+    var janky = 0;
+    var worstBuild = 0.0;
+    var worstRaster = 0.0;
+    for (final timing in timings) {
+      final build = timing.buildDuration.inMicroseconds;
+      final raster = timing.rasterDuration.inMicroseconds;
+      if (build > _frameBudgetMicros || raster > _frameBudgetMicros) {
+        janky++;
+      }
+      worstBuild = build / 1000 > worstBuild ? build / 1000 : worstBuild;
+      worstRaster = raster / 1000 > worstRaster ? raster / 1000 : worstRaster;
+    }
+    return BenchmarkResult(
+      name: benchmark.name,
+      images: batch.length,
+      succeeded: succeeded,
+      elapsed: stopwatch.elapsed,
+      frames: timings.length,
+      jankyFrames: janky,
+      worstBuildMs: worstBuild,
+      worstRasterMs: worstRaster,
+      rssDeltaMb: (ProcessInfo.currentRss - rssBefore) / (1024 * 1024),
+      peakRssMb: ProcessInfo.maxRss / (1024 * 1024),
+    );
+  }
+
+  Future<void> runAll() async {
+    if (paths.isEmpty || running) return;
+    setState(() {
+      running = true;
+      results.clear();
+    });
+    for (final benchmark in cases) {
+      setState(() => status = 'Running ${benchmark.name}...');
+      final result = await _measure(benchmark);
+      setState(() => results.add(result));
+    }
+    setState(() {
+      running = false;
+      status =
+          'Done: ${results.length} runs of ${paths.length * repeat} images';
+    });
+  }
+
+  @override
+  Widget build(BuildContext context) {
+    const header = TextStyle(fontSize: 18, fontWeight: FontWeight.bold);
+    return Scaffold(
+      appBar: AppBar(
+        title: const Text('Benchmark'),
+        backgroundColor: Colors.blue,
+        foregroundColor: Colors.white,
+      ),
+      body: ListView(
+        padding: const EdgeInsets.all(16),
+        children: [
+          Row(
+            children: [
+              Expanded(
+                child: ElevatedButton(
+                  onPressed: running ? null : pickImages,
+                  child: const Text('Pick Images'),
+                ),
+              ),
+              const SizedBox(width: 8),
+              Expanded(
+                child: ElevatedButton(
+                  onPressed: running || paths.isEmpty ? null : runAll,
+                  child: const Text('Run'),
+                ),
+              ),
+            ],
+          ),
+          Row(
+            children: [
+              const Text('Repeat batch'),
+              Expanded(
+                child: Slider(
+                  value: repeat.toDouble(),
+                  min: 1,
+                  max: 10,
+                  divisions: 9,
+                  label: '$repeat',
+                  onChanged: running
+                      ? null
+                      : (value) => setState(() => repeat = value.round()),
+                ),
+              ),
+              Text('${repeat}x'),
+            ],
+          ),
+          Row(
+            children: [
+              // Keeps frames coming so jank shows up in the timings
+              if (running) const CircularProgressIndicator(),
+              if (running) const SizedBox(width: 12),
+              Expanded(child: Text(status)),
+            ],
+          ),
+          const SizedBox(height: 16),
+          for (final result in results)
+            Card(
+              child: Padding(
+                padding: const EdgeInsets.all(12),
+                child: Column(
+                  crossAxisAlignment: CrossAxisAlignment.start,
+                  children: [
+                    Text(result.name, style: header),
+                    Text(
+                      '${result.succeeded}/${result.images} ok in '
+                      '${result.elapsed.inMilliseconds} ms '
+                      '(${result.imagesPerSecond.toStringAsFixed(2)} images/s)',
+                    ),
+                    Text(
+                      'Frames: ${result.frames}, janky: ${result.jankyFrames}, '
+                      'worst build ${result.worstBuildMs.toStringAsFixed(1)} ms, '
+                      'worst raster ${result.worstRasterMs.toStringAsFixed(1)} ms',
+                    ),
+                    Text(
+                      'RSS ${result.rssDeltaMb >= 0 ? '+' : ''}'
+                      '${result.rssDeltaMb.toStringAsFixed(1)} MB, '
+                      'peak ${result.peakRssMb.toStringAsFixed(1)} MB',
+                    ),
+                  ],
+                ),
+              ),
+            ),
+        ],
+      ),
+    );
+  }
+}
@@ -6,6 +6,8 @@ import 'package:image_picker/image_picker.dart';
 import 'package:open_file/open_file.dart';
 import 'package:thinpic_flutter/thinpic_flutter.dart';
 
+import 'benchmark_page.dart';
+
 void main() {
   runApp(const MyApp());
 }
@@ -32,6 +34,8 @@ class _MyAppState extends State<MyApp> {
   @override
   void initState() {
     super.initState();
+    // Start libvips now so the first compression is not slowed by it
+    ThinPicCompress.prewarm();
   }
 
   Future<void> pickImage() async {
@@ -439,6 +443,18 @@ class _MyAppState extends State<MyApp> {
                   ],
                 ),
                 spacerMedium,
+                // Benchmark mode (needs a Navigator below MaterialApp)
+                Builder(
+                  builder: (context) => ElevatedButton(
+                    onPressed: () => Navigator.of(context).push(
+                      MaterialPageRoute<void>(
+                        builder: (_) => const BenchmarkPage(),
+                      ),
+                    ),
+                    child: const Text('Benchmark'),
+                  ),
+                ),
+                spacerMedium,
                 // Shutdown button
               ],
             ),
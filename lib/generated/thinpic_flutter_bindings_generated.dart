@@ -280,6 +280,36 @@ class ThinpicFlutterBindings {
             CompressedImageResult Function(ffi.Pointer<ffi.Char>, int, int, int)
           >();
 
+  /// smart_compress_image written to output_path: only the result that lands
+  /// in the window is written, once, atomically. max_kb <= 0 takes the
+  /// original tool's targets, 2000 KB for high and 800 KB otherwise. Metadata
+  /// follows thinpic_configure metadata_policy (the tool stripped everything:
+  /// THINPIC_STRIP_ALL). Returns a ThinpicSmartFileStatus.
+  int smart_compress_image_to_file(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ffi.Char> output_path,
+    int max_kb,
+    int high,
+  ) {
+    return _smart_compress_image_to_file(input_path, output_path, max_kb, high);
+  }
+
+  late final _smart_compress_image_to_filePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Int,
+          )
+        >
+      >('smart_compress_image_to_file');
+  late final _smart_compress_image_to_file = _smart_compress_image_to_filePtr
+      .asFunction<
+        int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<ffi.Char>, int, int)
+      >();
+
   /// Image info
   ImageInfoData get_image_info(ffi.Pointer<ffi.Char> input_path) {
     return _get_image_info(input_path);
@@ -292,6 +322,199 @@ class ThinpicFlutterBindings {
   late final _get_image_info = _get_image_infoPtr
       .asFunction<ImageInfoData Function(ffi.Pointer<ffi.Char>)>();
 
+  /// Fast header probe: parses the loader header only, takes no pipeline lock
+  /// and makes no copies. The batch form fills out[0..count) and returns the
+  /// number of successful probes, or -1 on invalid arguments.
+  ImageHeader probe_image_header(ffi.Pointer<ffi.Char> input_path) {
+    return _probe_image_header(input_path);
+  }
+
+  late final _probe_image_headerPtr =
+      _lookup<ffi.NativeFunction<ImageHeader Function(ffi.Pointer<ffi.Char>)>>(
+        'probe_image_header',
+      );
+  late final _probe_image_header = _probe_image_headerPtr
+      .asFunction<ImageHeader Function(ffi.Pointer<ffi.Char>)>();
+
+  int probe_image_headers(
+    ffi.Pointer<ffi.Pointer<ffi.Char>> input_paths,
+    int count,
+    ffi.Pointer<ImageHeader> out,
+  ) {
+    return _probe_image_headers(input_paths, count, out);
+  }
+
+  late final _probe_image_headersPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Int,
+            ffi.Pointer<ImageHeader>,
+          )
+        >
+      >('probe_image_headers');
+  late final _probe_image_headers = _probe_image_headersPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          int,
+          ffi.Pointer<ImageHeader>,
+        )
+      >();
+
+  /// Sort and group keys for a whole gallery: size, orientation, capture time
+  /// and GPS presence of each path into out[0..count), parsed from the JPEG,
+  /// PNG, WebP, HEIF/AVIF, TIFF or GIF headers and EXIF without libvips (other
+  /// formats fall back to probe_image_header), several files at a time.
+  /// Returns the number indexed, or -1 on invalid arguments.
+  int thinpic_index_images(
+    ffi.Pointer<ffi.Pointer<ffi.Char>> input_paths,
+    int count,
+    ffi.Pointer<ThinpicImageMeta> out,
+  ) {
+    return _thinpic_index_images(input_paths, count, out);
+  }
+
+  late final _thinpic_index_imagesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Int,
+            ffi.Pointer<ThinpicImageMeta>,
+          )
+        >
+      >('thinpic_index_images');
+  late final _thinpic_index_images = _thinpic_index_imagesPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          int,
+          ffi.Pointer<ThinpicImageMeta>,
+        )
+      >();
+
+  /// Pages of a multi-page TIFF or PDF (frames of an animation), 1 for other
+  /// images, or -1 when the header cannot be read
+  int probe_page_count(ffi.Pointer<ffi.Char> input_path) {
+    return _probe_page_count(input_path);
+  }
+
+  late final _probe_page_countPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ffi.Char>)>>(
+        'probe_page_count',
+      );
+  late final _probe_page_count = _probe_page_countPtr
+      .asFunction<int Function(ffi.Pointer<ffi.Char>)>();
+
+  /// Output size, time and memory of compressing input_path to format at
+  /// quality (0 = 80) fitted into max_width x max_height (0 = unbounded, never
+  /// upscaled), predicted from the header, the source's bits per pixel and the
+  /// throughput model. FORMAT_AUTO keeps the source format. As cheap as
+  /// probe_image_header; success is -1 when the header cannot be read.
+  ThinpicEstimate thinpic_estimate_output(
+    ffi.Pointer<ffi.Char> input_path,
+    ImageFormat format,
+    int quality,
+    int max_width,
+    int max_height,
+  ) {
+    return _thinpic_estimate_output(
+      input_path,
+      format.value,
+      quality,
+      max_width,
+      max_height,
+    );
+  }
+
+  late final _thinpic_estimate_outputPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ThinpicEstimate Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.UnsignedInt,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+          )
+        >
+      >('thinpic_estimate_output');
+  late final _thinpic_estimate_output = _thinpic_estimate_outputPtr
+      .asFunction<
+        ThinpicEstimate Function(ffi.Pointer<ffi.Char>, int, int, int, int)
+      >();
+
+  ExifThumbnail extract_exif_thumbnail(
+    ffi.Pointer<ffi.Char> input_path,
+    int min_size,
+  ) {
+    return _extract_exif_thumbnail(input_path, min_size);
+  }
+
+  late final _extract_exif_thumbnailPtr =
+      _lookup<
+        ffi.NativeFunction<ExifThumbnail Function(ffi.Pointer<ffi.Char>, ffi.Int)>
+      >('extract_exif_thumbnail');
+  late final _extract_exif_thumbnail = _extract_exif_thumbnailPtr
+      .asFunction<ExifThumbnail Function(ffi.Pointer<ffi.Char>, int)>();
+
+  /// Rewrites the metadata of a JPEG, PNG or WebP without decoding it: the
+  /// container is walked, EXIF edited in place and XMP dropped, and the pixel
+  /// data copied byte for byte, so it takes milliseconds and loses nothing.
+  /// output_path may be input_path; the file is replaced atomically. Returns
+  /// the output's size, or -1 (THINPIC_ERROR_INVALID_ARGUMENT for another
+  /// format, THINPIC_ERROR_DECODE for a malformed one).
+  int thinpic_rewrite_metadata(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ffi.Char> output_path,
+    int edits,
+  ) {
+    return _thinpic_rewrite_metadata(input_path, output_path, edits);
+  }
+
+  late final _thinpic_rewrite_metadataPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+          )
+        >
+      >('thinpic_rewrite_metadata');
+  late final _thinpic_rewrite_metadata = _thinpic_rewrite_metadataPtr
+      .asFunction<
+        int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<ffi.Char>, int)
+      >();
+
+  /// thinpic_rewrite_metadata on an encoded buffer. Free data with
+  /// free_compressed_buffer.
+  CompressedImageResult thinpic_rewrite_metadata_buffer(
+    ffi.Pointer<ffi.Uint8> data,
+    int length,
+    int edits,
+  ) {
+    return _thinpic_rewrite_metadata_buffer(data, length, edits);
+  }
+
+  late final _thinpic_rewrite_metadata_bufferPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Size,
+            ffi.Int,
+          )
+        >
+      >('thinpic_rewrite_metadata_buffer');
+  late final _thinpic_rewrite_metadata_buffer =
+      _thinpic_rewrite_metadata_bufferPtr
+          .asFunction<
+            CompressedImageResult Function(ffi.Pointer<ffi.Uint8>, int, int)
+          >();
+
   /// Utility
   void free_compressed_buffer(ffi.Pointer<ffi.Uint8> buffer) {
     return _free_compressed_buffer(buffer);
@@ -304,6 +527,163 @@ class ThinpicFlutterBindings {
   late final _free_compressed_buffer = _free_compressed_bufferPtr
       .asFunction<void Function(ffi.Pointer<ffi.Uint8>)>();
 
+  /// Select how concurrent calls are scheduled. VIPS initialization is always
+  /// guarded; in concurrent mode each call runs its own pipeline in parallel.
+  void set_execution_mode(ExecutionMode mode) {
+    return _set_execution_mode(mode.value);
+  }
+
+  late final _set_execution_modePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.UnsignedInt)>>(
+        'set_execution_mode',
+      );
+  late final _set_execution_mode = _set_execution_modePtr
+      .asFunction<void Function(int)>();
+
+  ExecutionMode get_execution_mode() {
+    return ExecutionMode.fromValue(_get_execution_mode());
+  }
+
+  late final _get_execution_modePtr =
+      _lookup<ffi.NativeFunction<ffi.UnsignedInt Function()>>(
+        'get_execution_mode',
+      );
+  late final _get_execution_mode = _get_execution_modePtr
+      .asFunction<int Function()>(isLeaf: true);
+
+  /// Move up to max records, oldest first, into out; returns how many. A call
+  /// with max 0 only starts recording.
+  int thinpic_drain_stats(ffi.Pointer<ThinpicTelemetryRecord> out, int max) {
+    return _thinpic_drain_stats(out, max);
+  }
+
+  late final _thinpic_drain_statsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Pointer<ThinpicTelemetryRecord>, ffi.Int)
+        >
+      >('thinpic_drain_stats');
+  late final _thinpic_drain_stats = _thinpic_drain_statsPtr
+      .asFunction<int Function(ffi.Pointer<ThinpicTelemetryRecord>, int)>();
+
+  /// Replaces the loaded presets with count entries (at most
+  /// THINPIC_PRESET_MAX, ids unique and non-zero) and makes default_id the
+  /// one jobs with preset 0 use; 0 keeps the built-in values for them. count
+  /// 0 clears the table. Jobs already running keep the values they started
+  /// with. Returns the presets loaded, or -1 (nothing changed) on invalid
+  /// entries.
+  int thinpic_presets_load(
+    ffi.Pointer<ThinpicPreset> presets,
+    int count,
+    int default_id,
+  ) {
+    return _thinpic_presets_load(presets, count, default_id);
+  }
+
+  late final _thinpic_presets_loadPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Pointer<ThinpicPreset>, ffi.Int, ffi.Int)
+        >
+      >('thinpic_presets_load');
+  late final _thinpic_presets_load = _thinpic_presets_loadPtr
+      .asFunction<int Function(ffi.Pointer<ThinpicPreset>, int, int)>();
+
+  /// Id of the loaded preset named `name`, or 0
+  int thinpic_preset_id(ffi.Pointer<ffi.Char> name) {
+    return _thinpic_preset_id(name);
+  }
+
+  late final _thinpic_preset_idPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ffi.Char>)>>(
+        'thinpic_preset_id',
+      );
+  late final _thinpic_preset_id = _thinpic_preset_idPtr
+      .asFunction<int Function(ffi.Pointer<ffi.Char>)>();
+
+  /// Apply resource limits (initializes VIPS if needed); they are re-applied
+  /// if VIPS is shut down and started again. Returns 0 on success.
+  int thinpic_configure(ffi.Pointer<ThinpicRuntimeConfig> config) {
+    return _thinpic_configure(config);
+  }
+
+  late final _thinpic_configurePtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ThinpicRuntimeConfig>)>
+      >('thinpic_configure');
+  late final _thinpic_configure = _thinpic_configurePtr
+      .asFunction<int Function(ffi.Pointer<ThinpicRuntimeConfig>)>();
+
+  /// Initialize VIPS on a background thread, for example at app start, so the
+  /// first compression does not pay for library startup. With warm 1 the
+  /// thread then runs the JPEG, PNG and WebP savers, their loaders and the
+  /// thumbnail path once on a tiny image. Compressions that start meanwhile
+  /// wait only for VIPS_INIT, not for the warm-up. Returns 0 once the thread
+  /// is started (or VIPS is already up and warm is 0), -1 if it cannot start.
+  int thinpic_prewarm(int warm) {
+    return _thinpic_prewarm(warm);
+  }
+
+  late final _thinpic_prewarmPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Int)>>('thinpic_prewarm');
+  late final _thinpic_prewarm = _thinpic_prewarmPtr
+      .asFunction<int Function(int)>();
+
+  /// Fill out with the current runtime state; returns 0, or -1 if out is NULL
+  int thinpic_get_runtime_stats(ffi.Pointer<ThinpicRuntimeStats> out) {
+    return _thinpic_get_runtime_stats(out);
+  }
+
+  late final _thinpic_get_runtime_statsPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ThinpicRuntimeStats>)>
+      >('thinpic_get_runtime_stats');
+  late final _thinpic_get_runtime_stats = _thinpic_get_runtime_statsPtr
+      .asFunction<int Function(ffi.Pointer<ThinpicRuntimeStats>)>();
+
+  /// Evict every cached operation that is not in use right now. The cache
+  /// stays enabled with its configured limits.
+  void thinpic_drop_operation_cache() {
+    return _thinpic_drop_operation_cache();
+  }
+
+  late final _thinpic_drop_operation_cachePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>(
+        'thinpic_drop_operation_cache',
+      );
+  late final _thinpic_drop_operation_cache = _thinpic_drop_operation_cachePtr
+      .asFunction<void Function()>();
+
+  /// Power-saver hint for thermal scaling, which has no native way to read it:
+  /// while set, pool jobs are scaled as on a moderately hot device. Forward
+  /// PowerManager.isPowerSaveMode changes here.
+  void thinpic_set_power_save(int enabled) {
+    return _thinpic_set_power_save(enabled);
+  }
+
+  late final _thinpic_set_power_savePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int)>>(
+        'thinpic_set_power_save',
+      );
+  late final _thinpic_set_power_save = _thinpic_set_power_savePtr
+      .asFunction<void Function(int)>();
+
+  /// Drop the operation cache, cached decodes, idle encode arenas and (critical)
+  /// the GPU context, and return the freed pages to the system. Critical
+  /// pressure also keeps queued background jobs from starting until 10 s after
+  /// the last critical call or a NORMAL one; running jobs finish. The Android
+  /// plugin forwards onTrimMemory and onLowMemory on its own.
+  void thinpic_on_memory_pressure(ThinpicMemoryPressure level) {
+    return _thinpic_on_memory_pressure(level.value);
+  }
+
+  late final _thinpic_on_memory_pressurePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.UnsignedInt)>>(
+        'thinpic_on_memory_pressure',
+      );
+  late final _thinpic_on_memory_pressure = _thinpic_on_memory_pressurePtr
+      .asFunction<void Function(int)>();
+
   void shutdown_vips() {
     return _shutdown_vips();
   }
@@ -312,6 +692,45 @@ class ThinpicFlutterBindings {
       _lookup<ffi.NativeFunction<ffi.Void Function()>>('shutdown_vips');
   late final _shutdown_vips = _shutdown_vipsPtr.asFunction<void Function()>();
 
+  /// Logging: the default sink is logcat on Android and stderr elsewhere;
+  /// passing NULL restores it
+  void thinpic_set_log_level(ThinpicLogLevel level) {
+    return _thinpic_set_log_level(level.value);
+  }
+
+  late final _thinpic_set_log_levelPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.UnsignedInt)>>(
+        'thinpic_set_log_level',
+      );
+  late final _thinpic_set_log_level = _thinpic_set_log_levelPtr
+      .asFunction<void Function(int)>();
+
+  void thinpic_set_log_sink(ThinpicLogSink sink) {
+    return _thinpic_set_log_sink(sink);
+  }
+
+  late final _thinpic_set_log_sinkPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ThinpicLogSink)>>(
+        'thinpic_set_log_sink',
+      );
+  late final _thinpic_set_log_sink = _thinpic_set_log_sinkPtr
+      .asFunction<void Function(ThinpicLogSink)>();
+
+  /// Android system tracing: with 1, pipeline stages, search iterations and pool
+  /// jobs appear as ATrace sections (Perfetto, systrace) on the thread that
+  /// runs them, whenever a trace is recording. Off by default; a no-op before
+  /// API 23 and off Android.
+  void thinpic_set_tracing(int enabled) {
+    return _thinpic_set_tracing(enabled);
+  }
+
+  late final _thinpic_set_tracingPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int)>>(
+        'thinpic_set_tracing',
+      );
+  late final _thinpic_set_tracing = _thinpic_set_tracingPtr
+      .asFunction<void Function(int)>();
+
   int test_vips_basic() {
     return _test_vips_basic();
   }
@@ -321,6 +740,116 @@ class ThinpicFlutterBindings {
   late final _test_vips_basic = _test_vips_basicPtr
       .asFunction<int Function()>();
 
+  /// Progress for pool jobs on images of 4 MP and up, at most once per
+  /// min_interval_ms (0 = 100 ms) per pipeline plus a final 100. NULL turns it
+  /// off; smaller images never enable the libvips eval signal.
+  void thinpic_set_progress_callback(
+    ThinpicProgressCallback callback,
+    int min_interval_ms,
+  ) {
+    return _thinpic_set_progress_callback(callback, min_interval_ms);
+  }
+
+  late final _thinpic_set_progress_callbackPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Void Function(ThinpicProgressCallback, ffi.Int)>
+      >('thinpic_set_progress_callback');
+  late final _thinpic_set_progress_callback = _thinpic_set_progress_callbackPtr
+      .asFunction<void Function(ThinpicProgressCallback, int)>();
+
+  /// Keep the quality/size samples measured by smart_compress_image and
+  /// smart_compress_image_with_format in a small file in directory (which must
+  /// exist), keyed by a hash of each input's first 64 KB and size, so the same
+  /// original compressed again skips straight to the right quality. NULL (the
+  /// default) turns it off.
+  void thinpic_set_curve_cache_dir(ffi.Pointer<ffi.Char> directory) {
+    return _thinpic_set_curve_cache_dir(directory);
+  }
+
+  late final _thinpic_set_curve_cache_dirPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ffi.Char>)>>(
+        'thinpic_set_curve_cache_dir',
+      );
+  late final _thinpic_set_curve_cache_dir = _thinpic_set_curve_cache_dirPtr
+      .asFunction<void Function(ffi.Pointer<ffi.Char>)>();
+
+  /// Keep this device's throughput model (see ThinpicThroughput) in a small
+  /// file in directory (which must exist): it is loaded now, so scheduling
+  /// starts from what earlier launches measured, and rewritten every 16 new
+  /// measurements. NULL (the default) keeps the model in memory only; changing
+  /// the directory first writes out what the old one has not seen yet.
+  void thinpic_set_throughput_model_dir(ffi.Pointer<ffi.Char> directory) {
+    return _thinpic_set_throughput_model_dir(directory);
+  }
+
+  late final _thinpic_set_throughput_model_dirPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ffi.Char>)>>(
+        'thinpic_set_throughput_model_dir',
+      );
+  late final _thinpic_set_throughput_model_dir =
+      _thinpic_set_throughput_model_dirPtr
+          .asFunction<void Function(ffi.Pointer<ffi.Char>)>();
+
+  /// This device's measured cost of format at effort (-1 = encoder default);
+  /// -1 for FORMAT_AUTO or NULL out
+  int thinpic_get_throughput(
+    ImageFormat format,
+    int effort,
+    ffi.Pointer<ThinpicThroughput> out,
+  ) {
+    return _thinpic_get_throughput(format.value, effort, out);
+  }
+
+  late final _thinpic_get_throughputPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.UnsignedInt,
+            ffi.Int,
+            ffi.Pointer<ThinpicThroughput>,
+          )
+        >
+      >('thinpic_get_throughput');
+  late final _thinpic_get_throughput = _thinpic_get_throughputPtr
+      .asFunction<int Function(int, int, ffi.Pointer<ThinpicThroughput>)>();
+
+  /// Keep compressed outputs in directory (which must exist), keyed by a hash
+  /// of the whole input file or buffer and the options, and return them
+  /// without decoding when the same input is compressed the same way again.
+  /// Covers thinpic_compress and every CompressOptions entry point (pool jobs,
+  /// compress_buffer, compress_fd, compress_to_file). Least recently used
+  /// entries are deleted once the total passes max_bytes. NULL or max_bytes <= 0
+  /// (the default) turns it off; the files are left in place.
+  void thinpic_set_output_cache(
+    ffi.Pointer<ffi.Char> directory,
+    int max_bytes,
+  ) {
+    return _thinpic_set_output_cache(directory, max_bytes);
+  }
+
+  late final _thinpic_set_output_cachePtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ffi.Char>, ffi.Int64)>
+      >('thinpic_set_output_cache');
+  late final _thinpic_set_output_cache = _thinpic_set_output_cachePtr
+      .asFunction<void Function(ffi.Pointer<ffi.Char>, int)>();
+
+  /// Where thinpic_configure disc_threshold_mb spills large intermediates: a
+  /// directory that must exist, such as the app's cache directory. It becomes
+  /// the process's TMPDIR, which libvips reads for every temp file, so call it
+  /// before compressing. NULL unsets TMPDIR (/tmp, which Android apps cannot
+  /// write; their renders then stay in memory).
+  void thinpic_set_spill_dir(ffi.Pointer<ffi.Char> directory) {
+    return _thinpic_set_spill_dir(directory);
+  }
+
+  late final _thinpic_set_spill_dirPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ffi.Char>)>>(
+        'thinpic_set_spill_dir',
+      );
+  late final _thinpic_set_spill_dir = _thinpic_set_spill_dirPtr
+      .asFunction<void Function(ffi.Pointer<ffi.Char>)>();
+
   /// Helper function to detect format from file extension
   ImageFormat detect_format_from_path(ffi.Pointer<ffi.Char> input_path) {
     return ImageFormat.fromValue(_detect_format_from_path(input_path));
@@ -333,7 +862,8 @@ class ThinpicFlutterBindings {
   late final _detect_format_from_path = _detect_format_from_pathPtr
       .asFunction<int Function(ffi.Pointer<ffi.Char>)>();
 
-  /// Auto-compress function that tries multiple formats to find the smallest file
+  /// Auto-compress: classifies the content (photo, screenshot, graphic,
+  /// transparent) and encodes once in the format that suits it
   CompressedImageResult auto_compress_image(
     ffi.Pointer<ffi.Char> input_path,
     int quality,
@@ -350,6 +880,120 @@ class ThinpicFlutterBindings {
   late final _auto_compress_image = _auto_compress_imagePtr
       .asFunction<CompressedImageResult Function(ffi.Pointer<ffi.Char>, int)>();
 
+  /// Without classify, or when the classified encode fails, every format is
+  /// raced concurrently from one prepared image; NULL options behave like
+  /// auto_compress_image
+  CompressedImageResult auto_compress_image_with_options(
+    ffi.Pointer<ffi.Char> input_path,
+    int quality,
+    ffi.Pointer<AutoCompressOptions> options,
+  ) {
+    return _auto_compress_image_with_options(input_path, quality, options);
+  }
+
+  late final _auto_compress_image_with_optionsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Pointer<AutoCompressOptions>,
+          )
+        >
+      >('auto_compress_image_with_options');
+  late final _auto_compress_image_with_options =
+      _auto_compress_image_with_optionsPtr
+          .asFunction<
+            CompressedImageResult Function(
+              ffi.Pointer<ffi.Char>,
+              int,
+              ffi.Pointer<AutoCompressOptions>,
+            )
+          >();
+
+  /// Several sizes of one image (thumbnail, medium, full) from a single decode:
+  /// the largest variant is decoded straight from the file, each smaller one is
+  /// resized from the previous, and the encodes run in parallel. out[i] gets
+  /// variants[i] (free each with free_compressed_buffer; failed variants have
+  /// success != 1). Returns the number written, or -1 on invalid arguments or
+  /// when the image cannot be decoded.
+  int compress_image_variants(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ThinpicVariant> variants,
+    int count,
+    ffi.Pointer<CompressedImageResult> out,
+  ) {
+    return _compress_image_variants(input_path, variants, count, out);
+  }
+
+  late final _compress_image_variantsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ThinpicVariant>,
+            ffi.Int,
+            ffi.Pointer<CompressedImageResult>,
+          )
+        >
+      >('compress_image_variants');
+  late final _compress_image_variants = _compress_image_variantsPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ThinpicVariant>,
+          int,
+          ffi.Pointer<CompressedImageResult>,
+        )
+      >();
+
+  /// Contact or sprite sheet of count inputs in one call: each is thumbnailed
+  /// with shrink-on-load on a thread of its own, the cells are joined in
+  /// memory (vips_arrayjoin) and the sheet is encoded once; no intermediate
+  /// files. cells[i] (may be NULL) gets input i's rectangle and *offsets_json
+  /// (may be NULL) the same map as JSON, {"width", "height", "cell_width",
+  /// "cell_height", "cells": [{"x", "y", "w", "h"} or null, ...]}; free the
+  /// sheet and the JSON with free_compressed_buffer. Fails only when no input
+  /// decodes or the sheet does not encode.
+  CompressedImageResult thinpic_contact_sheet(
+    ffi.Pointer<ffi.Pointer<ffi.Char>> input_paths,
+    int count,
+    ffi.Pointer<ThinpicSheetLayout> layout,
+    ffi.Pointer<ThinpicSheetCell> cells,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> offsets_json,
+  ) {
+    return _thinpic_contact_sheet(
+      input_paths,
+      count,
+      layout,
+      cells,
+      offsets_json,
+    );
+  }
+
+  late final _thinpic_contact_sheetPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Int,
+            ffi.Pointer<ThinpicSheetLayout>,
+            ffi.Pointer<ThinpicSheetCell>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('thinpic_contact_sheet');
+  late final _thinpic_contact_sheet = _thinpic_contact_sheetPtr
+      .asFunction<
+        CompressedImageResult Function(
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          int,
+          ffi.Pointer<ThinpicSheetLayout>,
+          ffi.Pointer<ThinpicSheetCell>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
   /// Fast WebP compression for speed-critical applications
   CompressedImageResult fast_webp_compress(
     ffi.Pointer<ffi.Char> input_path,
@@ -366,16 +1010,3567 @@ class ThinpicFlutterBindings {
       >('fast_webp_compress');
   late final _fast_webp_compress = _fast_webp_compressPtr
       .asFunction<CompressedImageResult Function(ffi.Pointer<ffi.Char>, int)>();
-}
 
-final class CompressedImageResult extends ffi.Struct {
-  external ffi.Pointer<ffi.Uint8> data;
+  /// Bounded-memory streaming: decodes and encodes strip by strip so panoramas
+  /// and 100MP originals need memory proportional to width, not area. Fits the
+  /// image inside target_width x target_height (0 = unconstrained, never
+  /// upscales). JPEG and PNG stream end to end; WebP holds one output frame;
+  /// other formats fall back to compress_large_image_with_format.
+  CompressedImageResult stream_compress_image(
+    ffi.Pointer<ffi.Char> input_path,
+    int quality,
+    int target_width,
+    int target_height,
+    ImageFormat format,
+  ) {
+    return _stream_compress_image(
+      input_path,
+      quality,
+      target_width,
+      target_height,
+      format.value,
+    );
+  }
 
-  @ffi.Size()
+  late final _stream_compress_imagePtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.UnsignedInt,
+          )
+        >
+      >('stream_compress_image');
+  late final _stream_compress_image = _stream_compress_imagePtr
+      .asFunction<
+        CompressedImageResult Function(ffi.Pointer<ffi.Char>, int, int, int, int)
+      >();
+
+  /// As stream_compress_image, handing the output to callback in chunks of
+  /// about 64 KB while the saver runs instead of collecting one buffer, so an
+  /// upload can start after the first strips. Non-streaming formats deliver
+  /// their whole result as one chunk. Blocks until done and returns the total
+  /// bytes delivered, or -1 on failure (after the final callback).
+  int stream_compress_image_to_callback(
+    ffi.Pointer<ffi.Char> input_path,
+    int quality,
+    int target_width,
+    int target_height,
+    ImageFormat format,
+    ThinpicChunkCallback callback,
+    int stream_id,
+  ) {
+    return _stream_compress_image_to_callback(
+      input_path,
+      quality,
+      target_width,
+      target_height,
+      format.value,
+      callback,
+      stream_id,
+    );
+  }
+
+  late final _stream_compress_image_to_callbackPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.UnsignedInt,
+            ThinpicChunkCallback,
+            ffi.Int64,
+          )
+        >
+      >('stream_compress_image_to_callback');
+  late final _stream_compress_image_to_callback =
+      _stream_compress_image_to_callbackPtr
+          .asFunction<
+            int Function(
+              ffi.Pointer<ffi.Char>,
+              int,
+              int,
+              int,
+              int,
+              ThinpicChunkCallback,
+              int,
+            )
+          >();
+
+  /// Fast previews: JPEG inputs decode through libjpeg's scaled IDCT at the
+  /// largest 1/2, 1/4 or 1/8 shrink that still covers target_width x
+  /// target_height, then a bilinear resize fits the box (never upscales).
+  /// Trades a little sharpness for speed. Non-JPEG inputs, outputs other than
+  /// JPEG/PNG/WebP and calls without a target use
+  /// compress_image_with_size_and_format.
+  CompressedImageResult thumbnail_compress_image(
+    ffi.Pointer<ffi.Char> input_path,
+    int quality,
+    int target_width,
+    int target_height,
+    ImageFormat format,
+  ) {
+    return _thumbnail_compress_image(
+      input_path,
+      quality,
+      target_width,
+      target_height,
+      format.value,
+    );
+  }
+
+  late final _thumbnail_compress_imagePtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.UnsignedInt,
+          )
+        >
+      >('thumbnail_compress_image');
+  late final _thumbnail_compress_image = _thumbnail_compress_imagePtr
+      .asFunction<
+        CompressedImageResult Function(ffi.Pointer<ffi.Char>, int, int, int, int)
+      >();
+
+  /// Raw 8-bit pixels straight to PNG through libspng, without libvips (for
+  /// Flutter ui.Image bytes). channels: 1 gray, 2 gray+alpha, 3 RGB, 4 RGBA;
+  /// stride is the row pitch in bytes (0 = width * channels). Premultiplied
+  /// alpha (ImageByteFormat.rawRgba) is undone per row. compression_level is
+  /// the zlib level 0-9; -1 = 6.
+  CompressedImageResult compress_raw_to_png(
+    ffi.Pointer<ffi.Uint8> pixels,
+    int width,
+    int height,
+    int stride,
+    int channels,
+    int premultiplied,
+    int compression_level,
+  ) {
+    return _compress_raw_to_png(
+      pixels,
+      width,
+      height,
+      stride,
+      channels,
+      premultiplied,
+      compression_level,
+    );
+  }
+
+  late final _compress_raw_to_pngPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+          )
+        >
+      >('compress_raw_to_png');
+  late final _compress_raw_to_png = _compress_raw_to_pngPtr
+      .asFunction<
+        CompressedImageResult Function(
+          ffi.Pointer<ffi.Uint8>,
+          int,
+          int,
+          int,
+          int,
+          int,
+          int,
+        )
+      >();
+
+  /// Raw 8-bit pixels straight to baseline 4:2:0 JPEG through libjpeg, without
+  /// libvips (camera frames). pitch is the row stride in bytes (0 = tightly
+  /// packed); quality 1-100. Each calling thread keeps its own compressor, so
+  /// a capture loop pays libjpeg's setup once.
+  CompressedImageResult compress_raw_to_jpeg(
+    ffi.Pointer<ffi.Uint8> pixels,
+    int width,
+    int height,
+    int pitch,
+    ThinpicPixelFormat pixel_format,
+    int quality,
+  ) {
+    return _compress_raw_to_jpeg(
+      pixels,
+      width,
+      height,
+      pitch,
+      pixel_format.value,
+      quality,
+    );
+  }
+
+  late final _compress_raw_to_jpegPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.UnsignedInt,
+            ffi.Int,
+          )
+        >
+      >('compress_raw_to_jpeg');
+  late final _compress_raw_to_jpeg = _compress_raw_to_jpegPtr
+      .asFunction<
+        CompressedImageResult Function(
+          ffi.Pointer<ffi.Uint8>,
+          int,
+          int,
+          int,
+          int,
+          int,
+        )
+      >();
+
+  /// CameraX YUV_420_888 (I420, NV12 or NV21) frames straight to 4:2:0 JPEG:
+  /// the planes go to libjpeg as raw downsampled data, with no RGB
+  /// intermediate and no colour conversion. Uses the calling thread's
+  /// compressor, like compress_raw_to_jpeg.
+  CompressedImageResult compress_yuv420_to_jpeg(
+    ffi.Pointer<ThinpicYuvPlane> y_plane,
+    ffi.Pointer<ThinpicYuvPlane> u_plane,
+    ffi.Pointer<ThinpicYuvPlane> v_plane,
+    int width,
+    int height,
+    int quality,
+  ) {
+    return _compress_yuv420_to_jpeg(
+      y_plane,
+      u_plane,
+      v_plane,
+      width,
+      height,
+      quality,
+    );
+  }
+
+  late final _compress_yuv420_to_jpegPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ThinpicYuvPlane>,
+            ffi.Pointer<ThinpicYuvPlane>,
+            ffi.Pointer<ThinpicYuvPlane>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+          )
+        >
+      >('compress_yuv420_to_jpeg');
+  late final _compress_yuv420_to_jpeg = _compress_yuv420_to_jpegPtr
+      .asFunction<
+        CompressedImageResult Function(
+          ffi.Pointer<ThinpicYuvPlane>,
+          ffi.Pointer<ThinpicYuvPlane>,
+          ffi.Pointer<ThinpicYuvPlane>,
+          int,
+          int,
+          int,
+        )
+      >();
+
+  /// Fill options with the current version's defaults: JPEG, quality 80,
+  /// encoder-default effort, Lanczos3, no size limit, keep metadata, the
+  /// default WebP profile, baseline (non-progressive) output and truecolour
+  /// PNG compressed with zlib (full-strength dither if a palette is turned on)
+  void thinpic_options_init(ffi.Pointer<ThinpicOptions> options) {
+    return _thinpic_options_init(options);
+  }
+
+  late final _thinpic_options_initPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ThinpicOptions>)>>(
+        'thinpic_options_init',
+      );
+  late final _thinpic_options_init = _thinpic_options_initPtr
+      .asFunction<void Function(ffi.Pointer<ThinpicOptions>)>(isLeaf: true);
+
+  /// Decode, fit (or fill and crop), convert to sRGB and encode one image. On success returns 0
+  /// and fills out (caller frees out->data); on failure returns -1 and out is
+  /// zeroed. With options->animated, every frame of an animated input is
+  /// resized and the output is animated; builds without a GIF saver write
+  /// animated WebP instead and report it in out->format. With options->min_ssim,
+  /// JPEG and WebP quality is searched from options->quality down, decoding each
+  /// candidate and comparing its luminance with the prepared image. With
+  /// options->latency_budget_ms, the call is planned against this device's
+  /// measured throughput for the format and effort (learned from earlier
+  /// calls, conservative defaults before that): effort is lowered first, then
+  /// HEIF, JPEG 2000 and JPEG XL on opaque images fall back to JPEG, then the
+  /// output box shrinks (not below 320 px on the long edge). out->format and
+  /// out->width/height report what was written, out->budget_met whether the
+  /// budget held. With options->jxl_lossless_jpeg and FORMAT_JXL, a JPEG input
+  /// is not decoded: libjxl recodes its DCT coefficients and keeps what is
+  /// needed to give back the original file bit for bit (about 20% smaller).
+  /// Its size, orientation and metadata are kept, so the call fails for other
+  /// inputs, a box it does not fit already, a crop, or without libjxl (see
+  /// thinpic_jxl_transcode_available). With options->perceptual_hash, a dHash
+  /// of the resized image is taken from the strips the encoder reads (no
+  /// second decode) and compared with thinpic_hash_distance; transcodes,
+  /// animations, tiled encoders and images under 9x8 report hash_valid 0, and
+  /// such calls bypass the output cache. options->placeholder works the same
+  /// way from a grid of up to 32x32 cell means: out->placeholder holds a
+  /// BlurHash or ThumbHash string, or is empty where a hash would be invalid.
+  /// options->analysis scores the same pixels on a luma plane of up to 512
+  /// cells on the long side: sharpness is the variance of its Laplacian, so
+  /// scores compare across image sizes (under about 100 is usually soft or
+  /// shaken), and brightness and the clipped fractions describe exposure.
+  /// The jpeg_* fields of version 16 need mozjpeg linked into libvips; with
+  /// libjpeg-turbo or IJG libjpeg their defaults resolve to off and explicit
+  /// requests are dropped with a warning (thinpic_jpeg_extensions_available).
+  /// smart_compress_image and the other JPEG searches use trellis, deringing
+  /// and the ImageMagick tables whenever they are there.
+  /// options->watermark_path (version 17) composites that image onto the
+  /// resized output before its one encode, at watermark_gravity inset by
+  /// watermark_margin; the pixels are made upright first whatever the strip
+  /// policy, so the mark is not turned by a viewer applying EXIF. The overlay
+  /// is decoded and scaled once per output size and kept in memory for the
+  /// next call. An animation gets it on every frame; a reversible JXL
+  /// transcode cannot carry one and fails.
+  /// Older option versions get defaults for the fields they lack; options from
+  /// a newer THINPIC_OPTIONS_VERSION are rejected.
+  int thinpic_compress(
+    ffi.Pointer<ThinpicSource> source,
+    ffi.Pointer<ThinpicOptions> options,
+    ffi.Pointer<ThinpicResult> out,
+  ) {
+    return _thinpic_compress(source, options, out);
+  }
+
+  late final _thinpic_compressPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicSource>,
+            ffi.Pointer<ThinpicOptions>,
+            ffi.Pointer<ThinpicResult>,
+          )
+        >
+      >('thinpic_compress');
+  late final _thinpic_compress = _thinpic_compressPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ThinpicSource>,
+          ffi.Pointer<ThinpicOptions>,
+          ffi.Pointer<ThinpicResult>,
+        )
+      >();
+
+  /// 1 when the linked libjpeg is mozjpeg, whose trellis quantisation and
+  /// tables make files 5-10% smaller at the same quality
+  int thinpic_jpeg_extensions_available() {
+    return _thinpic_jpeg_extensions_available();
+  }
+
+  late final _thinpic_jpeg_extensions_availablePtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function()>>(
+        'thinpic_jpeg_extensions_available',
+      );
+  late final _thinpic_jpeg_extensions_available =
+      _thinpic_jpeg_extensions_availablePtr.asFunction<int Function()>();
+
+  /// 1 when libjxl, and with it options->jxl_lossless_jpeg, is available: linked
+  /// into the process (a libvips built with JPEG XL) or shipped with the app as
+  /// libjxl plus, for multithreaded encoding, libjxl_threads
+  int thinpic_jxl_transcode_available() {
+    return _thinpic_jxl_transcode_available();
+  }
+
+  late final _thinpic_jxl_transcode_availablePtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function()>>(
+        'thinpic_jxl_transcode_available',
+      );
+  late final _thinpic_jxl_transcode_available =
+      _thinpic_jxl_transcode_availablePtr.asFunction<int Function()>();
+
+  /// Bits that differ between two perceptual hashes: 0 for the same picture,
+  /// under about 10 for resized, re-encoded or lightly edited copies
+  int thinpic_hash_distance(int a, int b) {
+    return _thinpic_hash_distance(a, b);
+  }
+
+  late final _thinpic_hash_distancePtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Uint64, ffi.Uint64)>>(
+        'thinpic_hash_distance',
+      );
+  late final _thinpic_hash_distance = _thinpic_hash_distancePtr
+      .asFunction<int Function(int, int)>();
+
+  /// Group count hashes whose distance is at most max_distance, chained: a
+  /// burst where each shot is near the next forms one group. groups[i] is set
+  /// to the first index of i's group. Compares every pair, so meant for
+  /// batches of up to a few thousand. Returns the number of groups, or -1.
+  int thinpic_group_near_duplicates(
+    ffi.Pointer<ffi.Uint64> hashes,
+    int count,
+    int max_distance,
+    ffi.Pointer<ffi.Int> groups,
+  ) {
+    return _thinpic_group_near_duplicates(hashes, count, max_distance, groups);
+  }
+
+  late final _thinpic_group_near_duplicatesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Uint64>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Pointer<ffi.Int>,
+          )
+        >
+      >('thinpic_group_near_duplicates');
+  late final _thinpic_group_near_duplicates = _thinpic_group_near_duplicatesPtr
+      .asFunction<
+        int Function(ffi.Pointer<ffi.Uint64>, int, int, ffi.Pointer<ffi.Int>)
+      >();
+
+  /// Run ops in order on source, then encode with options (format, quality and
+  /// the other encoder fields; max_width/max_height and crop are ignored, size
+  /// comes from the ops). A resize that is the first op decodes at reduced size,
+  /// which applies the EXIF orientation as thinpic_compress does; otherwise it
+  /// is applied by an AUTOROTATE op, or before encoding when options->strip
+  /// drops it. Animations are not supported: the first frame is
+  /// used. Results are not stored in the output cache. Returns as
+  /// thinpic_compress; an unknown op or an empty crop fails the call.
+  int thinpic_compress_ops(
+    ffi.Pointer<ThinpicSource> source,
+    ffi.Pointer<ThinpicOperation> ops,
+    int count,
+    ffi.Pointer<ThinpicOptions> options,
+    ffi.Pointer<ThinpicResult> out,
+  ) {
+    return _thinpic_compress_ops(source, ops, count, options, out);
+  }
+
+  late final _thinpic_compress_opsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicSource>,
+            ffi.Pointer<ThinpicOperation>,
+            ffi.Int,
+            ffi.Pointer<ThinpicOptions>,
+            ffi.Pointer<ThinpicResult>,
+          )
+        >
+      >('thinpic_compress_ops');
+  late final _thinpic_compress_ops = _thinpic_compress_opsPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ThinpicSource>,
+          ffi.Pointer<ThinpicOperation>,
+          int,
+          ffi.Pointer<ThinpicOptions>,
+          ffi.Pointer<ThinpicResult>,
+        )
+      >();
+
+  /// Persistent image handle for several calls on one image (info, then one or
+  /// more compressions or variant sets). thinpic_open reads the source once: a
+  /// path is memory-mapped and a descriptor read to the end, while a buffer is
+  /// read in place and must outlive the handle. Its header is parsed once for
+  /// thinpic_handle_info. thinpic_handle_compress works like thinpic_compress
+  /// and also keeps the decoded, shrunk image in memory when it fits
+  /// thinpic_configure handle_cache_mb. A later call whose box needs no more
+  /// pixels than that image has then resizes it instead of decoding again.
+  /// Crops and animations always decode. A handle is not thread-safe. Returns
+  /// NULL if the source cannot be read or its header parsed.
+  ffi.Pointer<ThinpicHandle> thinpic_open(ffi.Pointer<ThinpicSource> source) {
+    return _thinpic_open(source);
+  }
+
+  late final _thinpic_openPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<ThinpicHandle> Function(ffi.Pointer<ThinpicSource>)
+        >
+      >('thinpic_open');
+  late final _thinpic_open = _thinpic_openPtr
+      .asFunction<
+        ffi.Pointer<ThinpicHandle> Function(ffi.Pointer<ThinpicSource>)
+      >();
+
+  int thinpic_handle_info(
+    ffi.Pointer<ThinpicHandle> handle,
+    ffi.Pointer<ImageInfoData> out,
+  ) {
+    return _thinpic_handle_info(handle, out);
+  }
+
+  late final _thinpic_handle_infoPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicHandle>,
+            ffi.Pointer<ImageInfoData>,
+          )
+        >
+      >('thinpic_handle_info');
+  late final _thinpic_handle_info = _thinpic_handle_infoPtr
+      .asFunction<
+        int Function(ffi.Pointer<ThinpicHandle>, ffi.Pointer<ImageInfoData>)
+      >();
+
+  int thinpic_handle_compress(
+    ffi.Pointer<ThinpicHandle> handle,
+    ffi.Pointer<ThinpicOptions> options,
+    ffi.Pointer<ThinpicResult> out,
+  ) {
+    return _thinpic_handle_compress(handle, options, out);
+  }
+
+  late final _thinpic_handle_compressPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicHandle>,
+            ffi.Pointer<ThinpicOptions>,
+            ffi.Pointer<ThinpicResult>,
+          )
+        >
+      >('thinpic_handle_compress');
+  late final _thinpic_handle_compress = _thinpic_handle_compressPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ThinpicHandle>,
+          ffi.Pointer<ThinpicOptions>,
+          ffi.Pointer<ThinpicResult>,
+        )
+      >();
+
+  /// compress_image_variants on the handle's bytes
+  int thinpic_handle_variants(
+    ffi.Pointer<ThinpicHandle> handle,
+    ffi.Pointer<ThinpicVariant> variants,
+    int count,
+    ffi.Pointer<CompressedImageResult> out,
+  ) {
+    return _thinpic_handle_variants(handle, variants, count, out);
+  }
+
+  late final _thinpic_handle_variantsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicHandle>,
+            ffi.Pointer<ThinpicVariant>,
+            ffi.Int,
+            ffi.Pointer<CompressedImageResult>,
+          )
+        >
+      >('thinpic_handle_variants');
+  late final _thinpic_handle_variants = _thinpic_handle_variantsPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ThinpicHandle>,
+          ffi.Pointer<ThinpicVariant>,
+          int,
+          ffi.Pointer<CompressedImageResult>,
+        )
+      >();
+
+  void thinpic_close(ffi.Pointer<ThinpicHandle> handle) {
+    return _thinpic_close(handle);
+  }
+
+  late final _thinpic_closePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ThinpicHandle>)>>(
+        'thinpic_close',
+      );
+  late final _thinpic_close = _thinpic_closePtr
+      .asFunction<void Function(ffi.Pointer<ThinpicHandle>)>();
+
+  /// Streaming input, to compress while an image downloads. thinpic_stream_new
+  /// returns a stream; pass thinpic_stream_fd in a THINPIC_SOURCE_FD source to
+  /// thinpic_compress on a worker thread while the feeding thread posts the
+  /// bytes in order with thinpic_stream_write as they arrive. Writes copy into
+  /// a ring buffer (capacity bytes first, 0 = 256 KB; it grows rather than
+  /// block when the decoder falls behind) and return 0, or -1 after the stream
+  /// has ended. thinpic_stream_finish ends the input: failed = 0 lets the
+  /// decoder read what is left, 1 drops it (a failed download). Sequential
+  /// formats decode as the bytes come in. The descriptor can only be read
+  /// once, as for a pipe: set the format explicitly (FORMAT_AUTO writes JPEG)
+  /// and expect no shrink-on-load or multi-frame output. Loaders do not fail
+  /// on truncated input, so discard the result of a failed stream.
+  /// thinpic_stream_free after the compression has returned closes it.
+  ffi.Pointer<ThinpicStream> thinpic_stream_new(int capacity) {
+    return _thinpic_stream_new(capacity);
+  }
+
+  late final _thinpic_stream_newPtr =
+      _lookup<ffi.NativeFunction<ffi.Pointer<ThinpicStream> Function(ffi.Size)>>(
+        'thinpic_stream_new',
+      );
+  late final _thinpic_stream_new = _thinpic_stream_newPtr
+      .asFunction<ffi.Pointer<ThinpicStream> Function(int)>();
+
+  int thinpic_stream_fd(ffi.Pointer<ThinpicStream> stream) {
+    return _thinpic_stream_fd(stream);
+  }
+
+  late final _thinpic_stream_fdPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ThinpicStream>)>>(
+        'thinpic_stream_fd',
+      );
+  late final _thinpic_stream_fd = _thinpic_stream_fdPtr
+      .asFunction<int Function(ffi.Pointer<ThinpicStream>)>(isLeaf: true);
+
+  int thinpic_stream_write(
+    ffi.Pointer<ThinpicStream> stream,
+    ffi.Pointer<ffi.Uint8> data,
+    int length,
+  ) {
+    return _thinpic_stream_write(stream, data, length);
+  }
+
+  late final _thinpic_stream_writePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicStream>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Size,
+          )
+        >
+      >('thinpic_stream_write');
+  late final _thinpic_stream_write = _thinpic_stream_writePtr
+      .asFunction<
+        int Function(ffi.Pointer<ThinpicStream>, ffi.Pointer<ffi.Uint8>, int)
+      >();
+
+  void thinpic_stream_finish(ffi.Pointer<ThinpicStream> stream, int failed) {
+    return _thinpic_stream_finish(stream, failed);
+  }
+
+  late final _thinpic_stream_finishPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ThinpicStream>, ffi.Int)>
+      >('thinpic_stream_finish');
+  late final _thinpic_stream_finish = _thinpic_stream_finishPtr
+      .asFunction<void Function(ffi.Pointer<ThinpicStream>, int)>();
+
+  void thinpic_stream_free(ffi.Pointer<ThinpicStream> stream) {
+    return _thinpic_stream_free(stream);
+  }
+
+  late final _thinpic_stream_freePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ThinpicStream>)>>(
+        'thinpic_stream_free',
+      );
+  late final _thinpic_stream_free = _thinpic_stream_freePtr
+      .asFunction<void Function(ffi.Pointer<ThinpicStream>)>();
+
+  /// Decode source to fit inside max_width x max_height (0 does not constrain;
+  /// never upscales), for ui.decodeImageFromPixels or a texture upload,
+  /// without a full-size decode. JPEGs take the thumbnail_compress_image path
+  /// (libjpeg's scaled IDCT, then a bilinear resize); WebP, HEIF and pyramidal
+  /// TIFF shrink while loading through vips_thumbnail; anything else decodes in
+  /// full and is resized bilinearly. Returns 0 and fills out, or -1 with out
+  /// zeroed (thinpic_last_error says why).
+  int thinpic_decode_rgba(
+    ffi.Pointer<ThinpicSource> source,
+    int max_width,
+    int max_height,
+    ffi.Pointer<ThinpicPixels> out,
+  ) {
+    return _thinpic_decode_rgba(source, max_width, max_height, out);
+  }
+
+  late final _thinpic_decode_rgbaPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicSource>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Pointer<ThinpicPixels>,
+          )
+        >
+      >('thinpic_decode_rgba');
+  late final _thinpic_decode_rgba = _thinpic_decode_rgbaPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ThinpicSource>,
+          int,
+          int,
+          ffi.Pointer<ThinpicPixels>,
+        )
+      >();
+
+  /// Scores candidate against reference for QA and encoder A/B tests, with the
+  /// kernels the min_ssim search uses. Both are decoded upright, converted to
+  /// luma and resized to one analysis size that fits in analysis_pixels (0 =
+  /// about 1 MP) and is never larger than the smaller of the two, so an output
+  /// that was downscaled still compares. threads splits the windows (0 = one
+  /// per core). Returns 0 and fills out, or -1 (THINPIC_ERROR_INVALID_ARGUMENT
+  /// when their aspect ratios differ by more than 1%).
+  int thinpic_compare(
+    ffi.Pointer<ThinpicSource> reference,
+    ffi.Pointer<ThinpicSource> candidate,
+    int analysis_pixels,
+    int threads,
+    ffi.Pointer<ThinpicQuality> out,
+  ) {
+    return _thinpic_compare(reference, candidate, analysis_pixels, threads, out);
+  }
+
+  late final _thinpic_comparePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ThinpicSource>,
+            ffi.Pointer<ThinpicSource>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Pointer<ThinpicQuality>,
+          )
+        >
+      >('thinpic_compare');
+  late final _thinpic_compare = _thinpic_comparePtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ThinpicSource>,
+          ffi.Pointer<ThinpicSource>,
+          int,
+          int,
+          ffi.Pointer<ThinpicQuality>,
+        )
+      >();
+
+  /// Worker pool: a fixed set of native threads (one per core, at most 8) started
+  /// on first submit. Submit returns a job id, or -1 on invalid arguments.
+  /// Poll returns immediately; wait blocks. Once either reports DONE or FAILED the
+  /// result is copied to `out` (caller frees data with free_compressed_buffer)
+  /// and the job id is released.
+  int thinpic_submit_job(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _thinpic_submit_job(input_path, options);
+  }
+
+  late final _thinpic_submit_jobPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('thinpic_submit_job');
+  late final _thinpic_submit_job = _thinpic_submit_jobPtr
+      .asFunction<
+        int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<CompressOptions>)
+      >();
+
+  JobStatus thinpic_poll_job(
+    int job_id,
+    ffi.Pointer<CompressedImageResult> out,
+  ) {
+    return JobStatus.fromValue(_thinpic_poll_job(job_id, out));
+  }
+
+  late final _thinpic_poll_jobPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Int64, ffi.Pointer<CompressedImageResult>)
+        >
+      >('thinpic_poll_job');
+  late final _thinpic_poll_job = _thinpic_poll_jobPtr
+      .asFunction<int Function(int, ffi.Pointer<CompressedImageResult>)>(isLeaf: true);
+
+  JobStatus thinpic_wait_job(
+    int job_id,
+    ffi.Pointer<CompressedImageResult> out,
+  ) {
+    return JobStatus.fromValue(_thinpic_wait_job(job_id, out));
+  }
+
+  late final _thinpic_wait_jobPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Int64, ffi.Pointer<CompressedImageResult>)
+        >
+      >('thinpic_wait_job');
+  late final _thinpic_wait_job = _thinpic_wait_jobPtr
+      .asFunction<int Function(int, ffi.Pointer<CompressedImageResult>)>();
+
+  /// File jobs encode straight to output_path (written via a temp file and
+  /// renamed); the finished result has data NULL and length = bytes written.
+  int thinpic_submit_file_job(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ffi.Char> output_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _thinpic_submit_file_job(input_path, output_path, options);
+  }
+
+  late final _thinpic_submit_file_jobPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('thinpic_submit_file_job');
+  late final _thinpic_submit_file_job = _thinpic_submit_file_jobPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  /// thinpic_submit_file_job for a whole batch in one call, so a caller
+  /// across a language boundary pays the crossing and the argument setup once
+  /// rather than per item. options holds either one entry shared by every item
+  /// (options_count 1) or one per item (options_count == count). job_ids[i] is
+  /// the id of item i, or -1 where it was rejected. Returns the number of jobs
+  /// submitted, or -1 on invalid arguments.
+  int thinpic_submit_file_jobs(
+    ffi.Pointer<ffi.Pointer<ffi.Char>> input_paths,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> output_paths,
+    int count,
+    ffi.Pointer<CompressOptions> options,
+    int options_count,
+    ffi.Pointer<ffi.Int64> job_ids,
+  ) {
+    return _thinpic_submit_file_jobs(
+      input_paths,
+      output_paths,
+      count,
+      options,
+      options_count,
+      job_ids,
+    );
+  }
+
+  late final _thinpic_submit_file_jobsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Int,
+            ffi.Pointer<CompressOptions>,
+            ffi.Int,
+            ffi.Pointer<ffi.Int64>,
+          )
+        >
+      >('thinpic_submit_file_jobs');
+  late final _thinpic_submit_file_jobs = _thinpic_submit_file_jobsPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          int,
+          ffi.Pointer<CompressOptions>,
+          int,
+          ffi.Pointer<ffi.Int64>,
+        )
+      >();
+
+  int thinpic_pool_size() {
+    return _thinpic_pool_size();
+  }
+
+  late final _thinpic_pool_sizePtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function()>>('thinpic_pool_size');
+  late final _thinpic_pool_size = _thinpic_pool_sizePtr
+      .asFunction<int Function()>(isLeaf: true);
+
+  /// Cancel a pending or running job: a pending job is dropped from the queue,
+  /// a running one has its pipeline killed and its search loop stopped. The
+  /// job then reports JOB_STATUS_CANCELLED and must still be claimed by
+  /// poll/wait. Returns 0, or -1 if the job is unknown or already finished.
+  int thinpic_cancel_job(int job_id) {
+    return _thinpic_cancel_job(job_id);
+  }
+
+  late final _thinpic_cancel_jobPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Int64)>>(
+        'thinpic_cancel_job',
+      );
+  late final _thinpic_cancel_job = _thinpic_cancel_jobPtr
+      .asFunction<int Function(int)>();
+
+  /// Call callback once job_id finishes instead of polling for it: from the
+  /// worker that finished it, or right away on this thread if it already has.
+  /// The result must still be claimed by poll/wait. A later call replaces the
+  /// callback. Jobs dropped by thinpic_shutdown_pool report CANCELLED. Returns
+  /// 0, or -1 if the job is unknown or already claimed.
+  int thinpic_watch_job(int job_id, ThinpicJobCallback callback) {
+    return _thinpic_watch_job(job_id, callback);
+  }
+
+  late final _thinpic_watch_jobPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Int Function(ffi.Int64, ThinpicJobCallback)>
+      >('thinpic_watch_job');
+  late final _thinpic_watch_job = _thinpic_watch_jobPtr
+      .asFunction<int Function(int, ThinpicJobCallback)>();
+
+  /// As poll/wait, with the job's CompressionStats alongside the result
+  JobStatus thinpic_poll_job_ex(
+    int job_id,
+    ffi.Pointer<CompressedImageResultEx> out,
+  ) {
+    return JobStatus.fromValue(_thinpic_poll_job_ex(job_id, out));
+  }
+
+  late final _thinpic_poll_job_exPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Int64, ffi.Pointer<CompressedImageResultEx>)
+        >
+      >('thinpic_poll_job_ex');
+  late final _thinpic_poll_job_ex = _thinpic_poll_job_exPtr
+      .asFunction<int Function(int, ffi.Pointer<CompressedImageResultEx>)>(isLeaf: true);
+
+  JobStatus thinpic_wait_job_ex(
+    int job_id,
+    ffi.Pointer<CompressedImageResultEx> out,
+  ) {
+    return JobStatus.fromValue(_thinpic_wait_job_ex(job_id, out));
+  }
+
+  late final _thinpic_wait_job_exPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Int64, ffi.Pointer<CompressedImageResultEx>)
+        >
+      >('thinpic_wait_job_ex');
+  late final _thinpic_wait_job_ex = _thinpic_wait_job_exPtr
+      .asFunction<int Function(int, ffi.Pointer<CompressedImageResultEx>)>();
+
+  /// Why the last call on this thread failed, for the direct entry points that
+  /// return a plain CompressedImageResult (pool jobs report theirs in
+  /// CompressedImageResultEx, thinpic_compress in ThinpicResult). Read it right
+  /// after the failing call; it copies the error into out (may be NULL), clears
+  /// it and returns its code.
+  int thinpic_last_error(ffi.Pointer<ThinpicError> out) {
+    return _thinpic_last_error(out);
+  }
+
+  late final _thinpic_last_errorPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ThinpicError>)>>(
+        'thinpic_last_error',
+      );
+  late final _thinpic_last_error = _thinpic_last_errorPtr
+      .asFunction<int Function(ffi.Pointer<ThinpicError>)>(isLeaf: true);
+
+  /// Batch compression: runs every path through the worker pool with the same
+  /// options and blocks until all are done. out must hold `count` results; each
+  /// entry reports its own success and owns its data (free_compressed_buffer).
+  /// Returns the number of successful items, or -1 on invalid arguments.
+  int compress_batch(
+    ffi.Pointer<ffi.Pointer<ffi.Char>> input_paths,
+    int count,
+    ffi.Pointer<CompressOptions> options,
+    ffi.Pointer<CompressedImageResult> out,
+  ) {
+    return _compress_batch(input_paths, count, options, out);
+  }
+
+  late final _compress_batchPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Int,
+            ffi.Pointer<CompressOptions>,
+            ffi.Pointer<CompressedImageResult>,
+          )
+        >
+      >('compress_batch');
+  late final _compress_batch = _compress_batchPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          int,
+          ffi.Pointer<CompressOptions>,
+          ffi.Pointer<CompressedImageResult>,
+        )
+      >();
+
+  /// Batch over the pages first_page .. first_page + count - 1 of one
+  /// multi-page TIFF or PDF (probe_page_count gives the total): each page is
+  /// its own pool job that decodes only that page, so the memory budget bounds
+  /// how many are in memory at once. options->page is ignored; out[i] holds
+  /// page first_page + i. Returns the number of successful pages, or -1 on
+  /// invalid arguments.
+  int compress_pages(
+    ffi.Pointer<ffi.Char> input_path,
+    int first_page,
+    int count,
+    ffi.Pointer<CompressOptions> options,
+    ffi.Pointer<CompressedImageResult> out,
+  ) {
+    return _compress_pages(input_path, first_page, count, options, out);
+  }
+
+  late final _compress_pagesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Pointer<CompressOptions>,
+            ffi.Pointer<CompressedImageResult>,
+          )
+        >
+      >('compress_pages');
+  late final _compress_pages = _compress_pagesPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          int,
+          int,
+          ffi.Pointer<CompressOptions>,
+          ffi.Pointer<CompressedImageResult>,
+        )
+      >();
+
+  /// Process-wide, like the pool itself: it stops every engine's and every
+  /// isolate's jobs, so call it only when the process is done with the library.
+  void thinpic_shutdown_pool() {
+    return _thinpic_shutdown_pool();
+  }
+
+  late final _thinpic_shutdown_poolPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>(
+        'thinpic_shutdown_pool',
+      );
+  late final _thinpic_shutdown_pool = _thinpic_shutdown_poolPtr
+      .asFunction<void Function()>();
+
+  /// The pool, the libvips and output caches, thinpic_configure and the
+  /// memory governor are shared by every Flutter engine and isolate that
+  /// loads the library; they do not multiply with them. A new client id for
+  /// CompressOptions.client, one per isolate that submits work, gives each
+  /// isolate a fair share of the workers. Ids hold no resources and need no
+  /// release.
+  int thinpic_pool_client() {
+    return _thinpic_pool_client();
+  }
+
+  late final _thinpic_pool_clientPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function()>>('thinpic_pool_client');
+  late final _thinpic_pool_client = _thinpic_pool_clientPtr
+      .asFunction<int Function()>(isLeaf: true);
+
+  /// Synchronous file output: compress input_path with options and write the
+  /// result to output_path. Returns the bytes written, or -1 on failure.
+  int compress_to_file(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ffi.Char> output_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _compress_to_file(input_path, output_path, options);
+  }
+
+  late final _compress_to_filePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('compress_to_file');
+  late final _compress_to_file = _compress_to_filePtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  /// Resumable batch: compress every image of the directory `source` (or every
+  /// line of the list file `source`) into output_dir as
+  /// <name>.<extension of options->format> through the worker pool, appending
+  /// each finished input to the manifest at manifest_path. Inputs the manifest
+  /// already lists, including recorded failures, are skipped, so calling again
+  /// after the process was killed picks up where it stopped. Returns how many
+  /// inputs the manifest now records as done, or -1 on invalid arguments or an
+  /// unreadable source.
+  int compress_directory(
+    ffi.Pointer<ffi.Char> source,
+    ffi.Pointer<ffi.Char> output_dir,
+    ffi.Pointer<ffi.Char> manifest_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _compress_directory(source, output_dir, manifest_path, options);
+  }
+
+  late final _compress_directoryPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('compress_directory');
+  late final _compress_directory = _compress_directoryPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  /// Incremental folder sync: compress_directory against an index at
+  /// index_path that records each input's mtime, size and options hash next
+  /// to its output. Only inputs that are new, have changed since, were done
+  /// with other options, or whose output is missing are compressed again, so
+  /// syncing a folder that is mostly unchanged costs a stat per file. Recorded
+  /// failures are retried once the file or the options change. The index is
+  /// rewritten at the end without lines for inputs that have gone (their
+  /// outputs are left). Returns how many inputs are up to date, or -1 on
+  /// invalid arguments or an unreadable source.
+  int sync_directory(
+    ffi.Pointer<ffi.Char> source,
+    ffi.Pointer<ffi.Char> output_dir,
+    ffi.Pointer<ffi.Char> index_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _sync_directory(source, output_dir, index_path, options);
+  }
+
+  late final _sync_directoryPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('sync_directory');
+  late final _sync_directory = _sync_directoryPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  int thinpic_background_directory(
+    ffi.Pointer<ffi.Char> source,
+    ffi.Pointer<ffi.Char> output_dir,
+    ffi.Pointer<ffi.Char> manifest_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _thinpic_background_directory(
+      source,
+      output_dir,
+      manifest_path,
+      options,
+    );
+  }
+
+  late final _thinpic_background_directoryPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('thinpic_background_directory');
+  late final _thinpic_background_directory = _thinpic_background_directoryPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  void thinpic_background_stop() {
+    return _thinpic_background_stop();
+  }
+
+  late final _thinpic_background_stopPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>(
+        'thinpic_background_stop',
+      );
+  late final _thinpic_background_stop = _thinpic_background_stopPtr
+      .asFunction<void Function()>();
+
+  /// Fills out (may be NULL) with the running or last background batch and
+  /// returns its state
+  int thinpic_background_status(ffi.Pointer<ThinpicBackgroundStatus> out) {
+    return _thinpic_background_status(out);
+  }
+
+  late final _thinpic_background_statusPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Int Function(ffi.Pointer<ThinpicBackgroundStatus>)>
+      >('thinpic_background_status');
+  late final _thinpic_background_status = _thinpic_background_statusPtr
+      .asFunction<int Function(ffi.Pointer<ThinpicBackgroundStatus>)>(isLeaf: true);
+
+  /// 1 with out filled in for a motion photo, 0 for any other image, -1 when
+  /// the file cannot be read
+  int thinpic_motion_photo_probe(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ThinpicMotionPhoto> out,
+  ) {
+    return _thinpic_motion_photo_probe(input_path, out);
+  }
+
+  late final _thinpic_motion_photo_probePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<ThinpicMotionPhoto>)
+        >
+      >('thinpic_motion_photo_probe');
+  late final _thinpic_motion_photo_probe = _thinpic_motion_photo_probePtr
+      .asFunction<
+        int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<ThinpicMotionPhoto>)
+      >();
+
+  /// Zero-copy handover of encoded output to Android code. thinpic_export_buffer
+  /// takes ownership of data (a result buffer, as freed by
+  /// free_compressed_buffer) and returns a handle, or -1; Java wraps it in a
+  /// direct ByteBuffer with ThinpicNativeBuffer.take(handle) and frees it with
+  /// close(). thinpic_release_buffer frees it from this side instead (once
+  /// only, and never while Java still reads it); -1 for an unknown handle.
+  int thinpic_export_buffer(ffi.Pointer<ffi.Uint8> data, int length) {
+    return _thinpic_export_buffer(data, length);
+  }
+
+  late final _thinpic_export_bufferPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Int64 Function(ffi.Pointer<ffi.Uint8>, ffi.Size)>
+      >('thinpic_export_buffer');
+  late final _thinpic_export_buffer = _thinpic_export_bufferPtr
+      .asFunction<int Function(ffi.Pointer<ffi.Uint8>, int)>(isLeaf: true);
+
+  /// The exported bytes and their length, or NULL; valid until released
+  ffi.Pointer<ffi.Uint8> thinpic_exported_buffer(
+    int handle,
+    ffi.Pointer<ffi.Size> length,
+  ) {
+    return _thinpic_exported_buffer(handle, length);
+  }
+
+  late final _thinpic_exported_bufferPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<ffi.Uint8> Function(ffi.Int64, ffi.Pointer<ffi.Size>)
+        >
+      >('thinpic_exported_buffer');
+  late final _thinpic_exported_buffer = _thinpic_exported_bufferPtr
+      .asFunction<ffi.Pointer<ffi.Uint8> Function(int, ffi.Pointer<ffi.Size>)>(
+        isLeaf: true,
+      );
+
+  int thinpic_release_buffer(int handle) {
+    return _thinpic_release_buffer(handle);
+  }
+
+  late final _thinpic_release_bufferPtr =
+      _lookup<ffi.NativeFunction<ffi.Int Function(ffi.Int64)>>(
+        'thinpic_release_buffer',
+      );
+  late final _thinpic_release_buffer = _thinpic_release_bufferPtr
+      .asFunction<int Function(int)>(isLeaf: true);
+
+  /// Bytes held by exported buffers not yet released
+  int thinpic_exported_bytes() {
+    return _thinpic_exported_bytes();
+  }
+
+  late final _thinpic_exported_bytesPtr =
+      _lookup<ffi.NativeFunction<ffi.Size Function()>>(
+        'thinpic_exported_bytes',
+      );
+  late final _thinpic_exported_bytes = _thinpic_exported_bytesPtr
+      .asFunction<int Function()>(isLeaf: true);
+
+  /// tile_size 0 picks 256 (TIFF, rounded up to a multiple of 16 otherwise)
+  /// or 254 with a 1 px overlap (Deep Zoom). Metadata follows thinpic_configure
+  /// metadata_policy. Returns the bytes written, or -1 on failure, including
+  /// Deep Zoom on a libvips without dzsave (the bundled Android build).
+  int compress_image_to_pyramid(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ffi.Char> output_path,
+    ThinpicPyramidLayout layout,
+    int quality,
+    int tile_size,
+  ) {
+    return _compress_image_to_pyramid(
+      input_path,
+      output_path,
+      layout.value,
+      quality,
+      tile_size,
+    );
+  }
+
+  late final _compress_image_to_pyramidPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.UnsignedInt,
+            ffi.Int,
+            ffi.Int,
+          )
+        >
+      >('compress_image_to_pyramid');
+  late final _compress_image_to_pyramid = _compress_image_to_pyramidPtr
+      .asFunction<
+        int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<ffi.Char>, int, int, int)
+      >();
+
+  /// Combined output for a multi-page TIFF or PDF: pages first_page onwards
+  /// (count <= 0 for all) fitted inside max_width x max_height (0 = no limit)
+  /// and written as one multi-page TIFF, a JPEG at quality per page. The pages
+  /// stream through one at a time. libvips only joins pages that share a size;
+  /// documents that mix sizes go through compress_pages instead. PDF input
+  /// needs a libvips with pdfload (the bundled Android build has none).
+  /// Returns the bytes written, or -1 on failure.
+  int compress_pages_to_tiff(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<ffi.Char> output_path,
+    int first_page,
+    int count,
+    int quality,
+    int max_width,
+    int max_height,
+  ) {
+    return _compress_pages_to_tiff(
+      input_path,
+      output_path,
+      first_page,
+      count,
+      quality,
+      max_width,
+      max_height,
+    );
+  }
+
+  late final _compress_pages_to_tiffPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+            ffi.Int,
+          )
+        >
+      >('compress_pages_to_tiff');
+  late final _compress_pages_to_tiff = _compress_pages_to_tiffPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          int,
+          int,
+          int,
+          int,
+          int,
+        )
+      >();
+
+  /// Synchronous compression that also reports what it cost
+  CompressedImageResultEx compress_with_stats(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _compress_with_stats(input_path, options);
+  }
+
+  late final _compress_with_statsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResultEx Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('compress_with_stats');
+  late final _compress_with_stats = _compress_with_statsPtr
+      .asFunction<
+        CompressedImageResultEx Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  /// compress_with_stats with a profile of the job filled into `profile`.
+  /// Profiling is process-wide: profiled jobs run one at a time, the operation
+  /// cache is dropped first so every operation is built and counted, and work
+  /// from other jobs running meanwhile is counted too, so profile an idle
+  /// pipeline. Meant for tuning, not for production traffic.
+  CompressedImageResultEx compress_with_profile(
+    ffi.Pointer<ffi.Char> input_path,
+    ffi.Pointer<CompressOptions> options,
+    ffi.Pointer<ThinpicProfile> profile,
+  ) {
+    return _compress_with_profile(input_path, options, profile);
+  }
+
+  late final _compress_with_profilePtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResultEx Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<CompressOptions>,
+            ffi.Pointer<ThinpicProfile>,
+          )
+        >
+      >('compress_with_profile');
+  late final _compress_with_profile = _compress_with_profilePtr
+      .asFunction<
+        CompressedImageResultEx Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<CompressOptions>,
+          ffi.Pointer<ThinpicProfile>,
+        )
+      >();
+
+  /// Buffer input: the same modes run on `length` encoded bytes at `data`
+  /// (for example a Uint8List from Dart) with no intermediate file. With
+  /// FORMAT_AUTO the output keeps the sniffed input format. compress_buffer
+  /// reads data in place; the buffer job copies it, so the caller may free it
+  /// once submit returns.
+  CompressedImageResult compress_buffer(
+    ffi.Pointer<ffi.Uint8> data,
+    int length,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _compress_buffer(data, length, options);
+  }
+
+  late final _compress_bufferPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Size,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('compress_buffer');
+  late final _compress_buffer = _compress_bufferPtr
+      .asFunction<
+        CompressedImageResult Function(
+          ffi.Pointer<ffi.Uint8>,
+          int,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  int thinpic_submit_buffer_job(
+    ffi.Pointer<ffi.Uint8> data,
+    int length,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _thinpic_submit_buffer_job(data, length, options);
+  }
+
+  late final _thinpic_submit_buffer_jobPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Size,
+            ffi.Pointer<CompressOptions>,
+          )
+        >
+      >('thinpic_submit_buffer_job');
+  late final _thinpic_submit_buffer_job = _thinpic_submit_buffer_jobPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Uint8>,
+          int,
+          ffi.Pointer<CompressOptions>,
+        )
+      >();
+
+  /// Descriptor input: read an open file descriptor (for example the fd of an
+  /// Android ParcelFileDescriptor from ContentResolver) without copying the file
+  /// first. Regular files get the same shrink-on-load as paths; pipes are read
+  /// once and fall back to JPEG for FORMAT_AUTO. The caller keeps ownership of
+  /// fd; the job form works on a dup, so fd may be closed once submit returns.
+  CompressedImageResult compress_fd(
+    int fd,
+    ffi.Pointer<CompressOptions> options,
+  ) {
+    return _compress_fd(fd, options);
+  }
+
+  late final _compress_fdPtr =
+      _lookup<
+        ffi.NativeFunction<
+          CompressedImageResult Function(ffi.Int, ffi.Pointer<CompressOptions>)
+        >
+      >('compress_fd');
+  late final _compress_fd = _compress_fdPtr
+      .asFunction<
+        CompressedImageResult Function(int, ffi.Pointer<CompressOptions>)
+      >();
+
+  int thinpic_submit_fd_job(int fd, ffi.Pointer<CompressOptions> options) {
+    return _thinpic_submit_fd_job(fd, options);
+  }
+
+  late final _thinpic_submit_fd_jobPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int64 Function(ffi.Int, ffi.Pointer<CompressOptions>)
+        >
+      >('thinpic_submit_fd_job');
+  late final _thinpic_submit_fd_job = _thinpic_submit_fd_jobPtr
+      .asFunction<int Function(int, ffi.Pointer<CompressOptions>)>();
+}
+
+/// Execution modes for the compression entry points
+enum ExecutionMode {
+  /// Independent jobs run in parallel (default)
+  EXECUTION_MODE_CONCURRENT(0),
+
+  /// Every pipeline holds one global lock, one job at a time
+  EXECUTION_MODE_SERIAL(1);
+
+  final int value;
+  const ExecutionMode(this.value);
+
+  static ExecutionMode fromValue(int value) => switch (value) {
+    0 => EXECUTION_MODE_CONCURRENT,
+    1 => EXECUTION_MODE_SERIAL,
+    _ => throw ArgumentError("Unknown value for ExecutionMode: $value"),
+  };
+}
+
+/// Metadata edits for thinpic_rewrite_metadata, combined with |
+enum ThinpicMetadataEdit {
+  /// EXIF GPS IFD, and XMP packets that carry a location
+  THINPIC_METADATA_STRIP_GPS(1),
+
+  /// Every XMP packet
+  THINPIC_METADATA_STRIP_XMP(2),
+
+  /// An EXIF orientation outside 1-8 becomes 1
+  THINPIC_METADATA_NORMALIZE_ORIENTATION(4);
+
+  final int value;
+  const ThinpicMetadataEdit(this.value);
+
+  static ThinpicMetadataEdit fromValue(int value) => switch (value) {
+    1 => THINPIC_METADATA_STRIP_GPS,
+    2 => THINPIC_METADATA_STRIP_XMP,
+    4 => THINPIC_METADATA_NORMALIZE_ORIENTATION,
+    _ => throw ArgumentError("Unknown value for ThinpicMetadataEdit: $value"),
+  };
+}
+
+/// How downscales split between libvips' integer box shrink and the resize
+/// kernel (thinpic_configure resize_quality). The box shrink takes the image
+/// to within a "gap" of the output size and the kernel only resamples that
+/// residual, so a 0.1x reduction costs about as much as a 0.5x one.
+enum ThinpicResizeQuality {
+  /// Box shrink to under 2x the output, then the kernel
+  THINPIC_RESIZE_FAST(0),
+
+  /// Box shrink to 2-4x the output (libvips default)
+  THINPIC_RESIZE_BALANCED(1),
+
+  /// Box shrink to 4-8x the output: the kernel sees more of the source
+  THINPIC_RESIZE_BEST(2);
+
+  final int value;
+  const ThinpicResizeQuality(this.value);
+
+  static ThinpicResizeQuality fromValue(int value) => switch (value) {
+    0 => THINPIC_RESIZE_FAST,
+    1 => THINPIC_RESIZE_BALANCED,
+    2 => THINPIC_RESIZE_BEST,
+    _ => throw ArgumentError("Unknown value for ThinpicResizeQuality: $value"),
+  };
+}
+
+/// Process-wide resource limits for thinpic_configure. Negative fields keep
+/// the current setting.
+final class ThinpicRuntimeConfig extends ffi.Struct {
+  /// Worker pool admission budget; 0 = unlimited
+  @ffi.Int()
+  external int memory_budget_mb;
+
+  /// vips_cache_set_max_mem
+  @ffi.Int()
+  external int cache_max_mem_mb;
+
+  /// vips_cache_set_max; 0 disables the operation cache
+  @ffi.Int()
+  external int cache_max_operations;
+
+  /// vips_concurrency_set; 0 = libvips default
+  @ffi.Int()
+  external int threads_per_image;
+
+  /// Memory-map path inputs of at least this size; 0 = never
+  @ffi.Int()
+  external int mmap_input_min_mb;
+
+  /// 1 = return the original bytes when the input already has the requested format and fits the size/KB target and metadata_policy is STRIP_NONE; 0 = always re-encode
+  @ffi.Int()
+  external int skip_compliant;
+
+  /// ThinpicStripPolicy for every entry point but thinpic_compress (which takes options->strip); default THINPIC_STRIP_NONE
+  @ffi.Int()
+  external int metadata_policy;
+
+  /// 1 = run fewer pool jobs at once and lower encoder effort while the device is hot or in power saver; 0 = off (default)
+  @ffi.Int()
+  external int thermal_scaling;
+
+  /// Lanczos3 downscales of 8-bit images of at least this many megapixels run on the GPU (GLES 3.1 compute) when it is free; 0 = never (default)
+  @ffi.Int()
+  external int gpu_resize_min_mp;
+
+  /// ThinpicResizeQuality for every downscale; default THINPIC_RESIZE_BALANCED
+  @ffi.Int()
+  external int resize_quality;
+
+  /// 0xRRGGBB that alpha is flattened onto for JPEG output; default 0xFFFFFF (white)
+  @ffi.Int()
+  external int flatten_background;
+
+  /// Largest decoded image a ThinpicHandle keeps in memory; 0 = none, default 64
+  @ffi.Int()
+  external int handle_cache_mb;
+
+  /// Decoded, resized path inputs the fixed-preset functions keep across calls (LRU), so re-encoding the same file and size skips the decode; 0 = none (default)
+  @ffi.Int()
+  external int decode_cache_mb;
+
+  /// 1 = a JPEG the fixed-preset functions keep at full size and must turn upright (metadata_policy other than THINPIC_STRIP_NONE) is rotated in the DCT domain before decoding rather than as pixels; partial edge blocks (< 16 px) may be trimmed; 0 = off (default)
+  @ffi.Int()
+  external int lossless_orientation;
+
+  /// 1 = 16-bit inputs narrowed to 8 bits for JPEG, WebP and GIF output get a 4x4 ordered dither; 0 = round to nearest (default)
+  @ffi.Int()
+  external int dither_high_depth;
+
+  /// 1 = the operation cache holds nothing while no ThinpicHandle is open, so one-off compressions do not pin decoded pixels; sessions get cache_max_operations; 0 = off (default)
+  @ffi.Int()
+  external int one_shot_cache;
+
+  /// 1 = target-size JPEG and WebP searches (smart_compress_image*) low-pass the flat, least salient regions first, so detail gets the bits; 0 = off (default)
+  @ffi.Int()
+  external int adaptive_quality;
+
+  /// Images rendered whole for random access (searches, rotations, palette and SSIM passes) larger than this go to a temp file in the thinpic_set_spill_dir directory instead of memory; 0 = automatic (default): a quarter of memory_budget_mb while a budget is set, else always memory
+  @ffi.Int()
+  external int disc_threshold_mb;
+
+  /// 1 = large-image and DSLR JPEG outputs of 8 MP or more (compress_large_image*, compress_large_dslr_image*) are encoded in strips on parallel threads and joined at restart markers, with standard Huffman tables; 0 = off (default)
+  @ffi.Int()
+  external int jpeg_strip_encode;
+
+  /// Inputs whose header declares more pixels than this (all frames of an animation) fail with THINPIC_ERROR_LIMIT before any decode; 0 = unlimited (default)
+  @ffi.Int()
+  external int max_input_megapixels;
+
+  /// Inputs with more bands fail the same way; 0 = unlimited (default)
+  @ffi.Int()
+  external int max_input_bands;
+
+  /// Pool jobs still running after this long are stopped (libvips kill) and fail with THINPIC_ERROR_TIMEOUT; 0 = none (default)
+  @ffi.Int()
+  external int job_timeout_ms;
+
+  /// 1 = HEIC, HEIF and AVIF inputs are decoded by the platform (AImageDecoder on Android 11+, hardware HEVC where present) even when libvips has libheif; 0 = only when libvips cannot load them (default)
+  @ffi.Int()
+  external int platform_decode;
+
+  /// 1 = target-size JPEG searches (smart_compress_image*) on a JPEG that keeps its size, orientation and colours requantize its DCT coefficients per probe instead of decoding it, re-coding only the entropy layer; chroma subsampling stays the source's; 0 = off (default)
+  @ffi.Int()
+  external int coefficient_search;
+
+  /// 1 = the same input and options give the same bytes on every call, whatever the thread grant, throttle or timing: no thermal effort cuts, latency budget plans, GPU resizes or strip JPEG encodes, and the auto race waits for every format (the platform's HEVC decoder and encoder stay the device's own); 0 = off (default)
+  @ffi.Int()
+  external int deterministic;
+}
+
+/// Snapshot of libvips and worker pool state (thinpic_get_runtime_stats).
+/// The cache fields are 0 while VIPS is not initialized.
+final class ThinpicRuntimeStats extends ffi.Struct {
+  /// vips_cache_get_size: operations held in the cache
+  @ffi.Int()
+  external int cache_operations;
+
+  /// vips_cache_get_max
+  @ffi.Int()
+  external int cache_max_operations;
+
+  /// vips_cache_get_max_mem, in bytes
+  @ffi.Int64()
+  external int cache_max_mem;
+
+  /// vips_tracked_get_mem: bytes libvips has allocated now
+  @ffi.Int64()
+  external int tracked_mem;
+
+  /// vips_tracked_get_mem_highwater: most ever allocated at once
+  @ffi.Int64()
+  external int tracked_mem_highwater;
+
+  /// vips_tracked_get_allocs: live libvips allocations
+  @ffi.Int()
+  external int tracked_allocs;
+
+  /// vips_tracked_get_files
+  @ffi.Int()
+  external int open_files;
+
+  /// Worker pool threads; 0 before the first submit
+  @ffi.Int()
+  external int pool_workers;
+
+  /// Pool jobs (batch items included) running now
+  @ffi.Int()
+  external int active_jobs;
+
+  /// Pool jobs waiting for a worker or for memory budget
+  @ffi.Int()
+  external int queued_jobs;
+
+  /// Working-set estimates charged by the running jobs
+  @ffi.Int64()
+  external int in_flight_bytes;
+
+  /// Last AThermalStatus read; -1 while thermal scaling is off or before API 30
+  @ffi.Int()
+  external int thermal_status;
+}
+
+/// Rolling throughput of this device for one format (thinpic_get_throughput),
+/// as moving averages over real calls. The encode rate is what latency
+/// budgets plan with. A rate without samples is the built-in prior.
+final class ThinpicThroughput extends ffi.Struct {
+  /// thinpic_compress wall time per output megapixel, decode included
+  @ffi.Double()
+  external double encode_ms_per_mp;
+
+  /// Rendering a decoded image of this source format, per megapixel rendered
+  @ffi.Double()
+  external double decode_ms_per_mp;
+
+  /// Plain thinpic_compress calls measured at this format and effort
+  @ffi.Int()
+  external int encode_samples;
+
+  /// Decodes measured (smart, lossless and SSIM searches render first)
+  @ffi.Int()
+  external int decode_samples;
+}
+
+/// Runtime log filtering; levels above the compile-time THINPIC_LOG_LEVEL
+/// are compiled out and cannot be re-enabled here
+enum ThinpicLogLevel {
+  THINPIC_LOG_NONE(0),
+  THINPIC_LOG_ERROR(1),
+  THINPIC_LOG_WARN(2),
+  THINPIC_LOG_INFO(3),
+  THINPIC_LOG_DEBUG(4);
+
+  final int value;
+  const ThinpicLogLevel(this.value);
+
+  static ThinpicLogLevel fromValue(int value) => switch (value) {
+    0 => THINPIC_LOG_NONE,
+    1 => THINPIC_LOG_ERROR,
+    2 => THINPIC_LOG_WARN,
+    3 => THINPIC_LOG_INFO,
+    4 => THINPIC_LOG_DEBUG,
+    _ => throw ArgumentError("Unknown value for ThinpicLogLevel: $value"),
+  };
+}
+
+/// Receives each formatted message (no trailing newline); may be called from
+/// any thread
+typedef ThinpicLogSink =
+    ffi.Pointer<ffi.NativeFunction<ThinpicLogSinkFunction>>;
+typedef ThinpicLogSinkFunction =
+    ffi.Void Function(ffi.Int level, ffi.Pointer<ffi.Char> message);
+typedef DartThinpicLogSinkFunction =
+    void Function(int level, ffi.Pointer<ffi.Char> message);
+
+/// Progress of a running pool job, 0-100. Called from native threads.
+typedef ThinpicProgressCallback =
+    ffi.Pointer<ffi.NativeFunction<ThinpicProgressCallbackFunction>>;
+typedef ThinpicProgressCallbackFunction =
+    ffi.Void Function(ffi.Int64 job_id, ffi.Int percent);
+typedef DartThinpicProgressCallbackFunction =
+    void Function(int job_id, int percent);
+
+/// A pool job reached DONE, FAILED or CANCELLED (status is a JobStatus).
+/// Called once per watched job from a native thread (thinpic_watch_job).
+typedef ThinpicJobCallback =
+    ffi.Pointer<ffi.NativeFunction<ThinpicJobCallbackFunction>>;
+typedef ThinpicJobCallbackFunction =
+    ffi.Void Function(ffi.Int64 job_id, ffi.Int status);
+typedef DartThinpicJobCallbackFunction = void Function(int job_id, int status);
+
+/// Encoded output of stream_compress_image_to_callback, called on the saver's
+/// thread as bytes are produced. The callee owns chunk and releases it with
+/// free_compressed_buffer. The last call has chunk NULL and length set to the
+/// total bytes delivered, or -1 when the compression failed.
+typedef ThinpicChunkCallback =
+    ffi.Pointer<ffi.NativeFunction<ThinpicChunkCallbackFunction>>;
+typedef ThinpicChunkCallbackFunction =
+    ffi.Void Function(
+      ffi.Int64 stream_id,
+      ffi.Pointer<ffi.Uint8> chunk,
+      ffi.Int64 length,
+    );
+typedef DartThinpicChunkCallbackFunction =
+    void Function(int stream_id, ffi.Pointer<ffi.Uint8> chunk, int length);
+
+/// ThinpicOptions sink (version 22): consecutive slices of the finished
+/// output, borrowed for the call only, on the thread running thinpic_compress.
+/// Returning non-zero fails the call.
+typedef ThinpicSinkCallback =
+    ffi.Pointer<ffi.NativeFunction<ThinpicSinkCallbackFunction>>;
+typedef ThinpicSinkCallbackFunction =
+    ffi.Int Function(
+      ffi.Int64 sink_id,
+      ffi.Pointer<ffi.Uint8> data,
+      ffi.Size length,
+    );
+typedef DartThinpicSinkCallbackFunction =
+    int Function(int sink_id, ffi.Pointer<ffi.Uint8> data, int length);
+
+/// Compression modes dispatched by the job API
+enum CompressMode {
+  /// compress_image_with_size_and_format
+  COMPRESS_MODE_STANDARD(0),
+
+  /// compress_large_image_with_format
+  COMPRESS_MODE_LARGE(1),
+
+  /// compress_large_dslr_image_with_format
+  COMPRESS_MODE_LARGE_DSLR(2),
+
+  /// smart_compress_image_with_format
+  COMPRESS_MODE_SMART(3),
+
+  /// auto_compress_image
+  COMPRESS_MODE_AUTO(4),
+
+  /// fast_webp_compress
+  COMPRESS_MODE_FAST_WEBP(5),
+
+  /// stream_compress_image
+  COMPRESS_MODE_STREAM(6),
+
+  /// DCT-domain orientation fix and crop (JPEG input only)
+  COMPRESS_MODE_LOSSLESS_JPEG(7),
+
+  /// thumbnail_compress_image
+  COMPRESS_MODE_THUMBNAIL(8),
+
+  /// DCT-domain re-code: progressive, optimized Huffman, no metadata (JPEG input only)
+  COMPRESS_MODE_JPEG_OPTIMIZE(9);
+
+  final int value;
+  const CompressMode(this.value);
+
+  static CompressMode fromValue(int value) => switch (value) {
+    0 => COMPRESS_MODE_STANDARD,
+    1 => COMPRESS_MODE_LARGE,
+    2 => COMPRESS_MODE_LARGE_DSLR,
+    3 => COMPRESS_MODE_SMART,
+    4 => COMPRESS_MODE_AUTO,
+    5 => COMPRESS_MODE_FAST_WEBP,
+    6 => COMPRESS_MODE_STREAM,
+    7 => COMPRESS_MODE_LOSSLESS_JPEG,
+    8 => COMPRESS_MODE_THUMBNAIL,
+    9 => COMPRESS_MODE_JPEG_OPTIMIZE,
+    _ => throw ArgumentError("Unknown value for CompressMode: $value"),
+  };
+}
+
+/// Scheduling class of a pool job. Interactive jobs start ahead of every
+/// queued background job, and background jobs leave one worker free for
+/// them. Background jobs run at nice 10 on the slowest cores when the CPU
+/// has clusters of different speeds (big.LITTLE).
+enum ThinpicPriority {
+  THINPIC_PRIORITY_INTERACTIVE(0),
+  THINPIC_PRIORITY_BACKGROUND(1);
+
+  final int value;
+  const ThinpicPriority(this.value);
+
+  static ThinpicPriority fromValue(int value) => switch (value) {
+    0 => THINPIC_PRIORITY_INTERACTIVE,
+    1 => THINPIC_PRIORITY_BACKGROUND,
+    _ => throw ArgumentError("Unknown value for ThinpicPriority: $value"),
+  };
+}
+
+/// smart_compress_image_to_file results, the original tool's exit codes
+enum ThinpicSmartFileStatus {
+  THINPIC_SMART_FILE_OK(0),
+  THINPIC_SMART_FILE_LOAD_FAILED(1),
+
+  /// 2 was a failed 1.3x upscale, which high no longer does
+  THINPIC_SMART_FILE_SAVE_FAILED(3),
+
+  /// No quality lands within 20% of the target
+  THINPIC_SMART_FILE_NO_FIT(4);
+
+  final int value;
+  const ThinpicSmartFileStatus(this.value);
+
+  static ThinpicSmartFileStatus fromValue(int value) => switch (value) {
+    0 => THINPIC_SMART_FILE_OK,
+    1 => THINPIC_SMART_FILE_LOAD_FAILED,
+    3 => THINPIC_SMART_FILE_SAVE_FAILED,
+    4 => THINPIC_SMART_FILE_NO_FIT,
+    _ => throw ArgumentError("Unknown value for ThinpicSmartFileStatus: $value"),
+  };
+}
+
+/// Parameters for one compression; fields a mode does not use are ignored
+final class CompressOptions extends ffi.Struct {
+  @ffi.UnsignedInt()
+  external int modeAsInt;
+
+  CompressMode get mode => CompressMode.fromValue(modeAsInt);
+
+  @ffi.UnsignedInt()
+  external int formatAsInt;
+
+  ImageFormat get format => ImageFormat.fromValue(formatAsInt);
+
+  @ffi.Int()
+  external int quality;
+
+  @ffi.Int()
+  external int target_width;
+
+  @ffi.Int()
+  external int target_height;
+
+  @ffi.Int()
+  external int target_kb;
+
+  @ffi.Int()
+  external int smart_type;
+
+  /// COMPRESS_MODE_LOSSLESS_JPEG crop, in upright (post-orientation) pixels.
+  /// The offset is rounded down to the MCU grid and the size grows to keep
+  /// the requested area; crop_width/crop_height 0 run to the edge.
+  @ffi.Int()
+  external int crop_x;
+
+  @ffi.Int()
+  external int crop_y;
+
+  @ffi.Int()
+  external int crop_width;
+
+  @ffi.Int()
+  external int crop_height;
+
+  /// ThinpicPriority; only the worker pool uses it
+  @ffi.Int()
+  external int priority;
+
+  /// Page of a multi-page TIFF or PDF to compress, from 0; other inputs
+  /// ignore it. Later pages skip the thumbnail shrink-on-load.
+  @ffi.Int()
+  external int page;
+
+  /// Pool client (thinpic_pool_client) the job is queued for; 0 = shared.
+  /// Within a priority, the next job to start comes from the client with
+  /// the fewest jobs running, so one isolate's batch does not hold back
+  /// another's.
+  @ffi.Int()
+  external int client;
+
+  /// Tuning preset (thinpic_presets_load) by id; 0 = the loaded default,
+  /// or the built-in values when none is loaded.
+  @ffi.Int()
+  external int preset;
+}
+
+/// Remotely tuned presets for the CompressMode dispatch. The caps and
+/// quality ladders those modes were built with (6000 px on the long side,
+/// 8000 for COMPRESS_MODE_FAST_WEBP, smart qualities 85/95/60/30, size
+/// searches from 85 down to 40) are the built-in values. A preset replaces
+/// those it sets (non-zero fields) and keeps the rest. thinpic_presets_load
+/// copies the table once; a job only looks its preset up by id when it
+/// starts and never parses anything. Telemetry records report the preset a
+/// job ran with, so an experiment can compare arms.
+const int THINPIC_PRESET_MAX = 32;
+
+const int THINPIC_PRESET_NAME_MAX = 32;
+
+final class ThinpicPreset extends ffi.Struct {
+  /// Non-zero; CompressOptions.preset and ThinpicTelemetryRecord.preset
+  @ffi.Int()
+  external int id;
+
+  /// NUL-terminated, for thinpic_preset_id
+  @ffi.Array.multi([32])
+  external ffi.Array<ffi.Char> name;
+
+  /// Long-side cap of the standard, large and smart modes; 0 = 6000
+  @ffi.Int()
+  external int max_dimension;
+
+  /// COMPRESS_MODE_FAST_WEBP's cap; 0 = 8000
+  @ffi.Int()
+  external int minimal_max_dimension;
+
+  /// Smart modes' quality by smart_type 0-3; 0 = 85, 95, 60, 30
+  @ffi.Array.multi([4])
+  external ffi.Array<ffi.Int> smart_quality;
+
+  /// Highest quality a target-size search tries (smart_type 1 keeps 100); 0 = 85
+  @ffi.Int()
+  external int search_start_quality;
+
+  /// Lowest; 0 = 40
+  @ffi.Int()
+  external int search_end_quality;
+}
+
+/// Tuning for auto_compress_image_with_options
+final class AutoCompressOptions extends ffi.Struct {
+  /// Skip PNG/TIFF/GIF for photographic (JPEG/HEIF) sources
+  @ffi.Int()
+  external int skip_unlikely_formats;
+
+  /// Take the first candidate at or under this size and cancel the rest; 0 keeps the smallest
+  @ffi.Int()
+  external int accept_below_kb;
+
+  /// Encode once in the format the content classifier picks; race the rest only if that fails or is over accept_below_kb
+  @ffi.Int()
+  external int classify;
+}
+
+/// One output of compress_image_variants
+final class ThinpicVariant extends ffi.Struct {
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// FORMAT_AUTO keeps the input format
+  @ffi.UnsignedInt()
+  external int formatAsInt;
+
+  ImageFormat get format => ImageFormat.fromValue(formatAsInt);
+
+  /// 1-100
+  @ffi.Int()
+  external int quality;
+}
+
+/// Layout of a contact sheet (thinpic_contact_sheet): every input fills one
+/// cell_width x cell_height cell, upright and centre-cropped (smaller sources
+/// are centred, not upscaled), `columns` to a row (0 = as square a grid as
+/// the count allows), with `spacing` px between cells and around the edge
+final class ThinpicSheetLayout extends ffi.Struct {
+  @ffi.Int()
+  external int columns;
+
+  /// 1-THINPIC_SHEET_MAX_CELL
+  @ffi.Int()
+  external int cell_width;
+
+  @ffi.Int()
+  external int cell_height;
+
+  /// 0-256
+  @ffi.Int()
+  external int spacing;
+
+  /// FORMAT_AUTO = JPEG
+  @ffi.UnsignedInt()
+  external int formatAsInt;
+
+  ImageFormat get format => ImageFormat.fromValue(formatAsInt);
+
+  /// 1-100
+  @ffi.Int()
+  external int quality;
+}
+
+/// Where one input landed on the sheet; success is -1 for an input that
+/// could not be decoded, whose cell is left black
+final class ThinpicSheetCell extends ffi.Struct {
+  @ffi.Int()
+  external int x;
+
+  @ffi.Int()
+  external int y;
+
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  @ffi.Int()
+  external int success;
+}
+
+/// Job states reported by the worker pool
+enum JobStatus {
+  /// No such job, or its result was already claimed
+  JOB_STATUS_UNKNOWN(-1),
+  JOB_STATUS_PENDING(0),
+  JOB_STATUS_RUNNING(1),
+  JOB_STATUS_DONE(2),
+  JOB_STATUS_FAILED(3),
+
+  /// thinpic_cancel_job stopped it; the result carries no data
+  JOB_STATUS_CANCELLED(4);
+
+  final int value;
+  const JobStatus(this.value);
+
+  static JobStatus fromValue(int value) => switch (value) {
+    -1 => JOB_STATUS_UNKNOWN,
+    0 => JOB_STATUS_PENDING,
+    1 => JOB_STATUS_RUNNING,
+    2 => JOB_STATUS_DONE,
+    3 => JOB_STATUS_FAILED,
+    4 => JOB_STATUS_CANCELLED,
+    _ => throw ArgumentError("Unknown value for JobStatus: $value"),
+  };
+}
+
+final class CompressedImageResult extends ffi.Struct {
+  external ffi.Pointer<ffi.Uint8> data;
+
+  @ffi.Size()
+  external int length;
+
+  @ffi.Int()
+  external int success;
+}
+
+/// Resource use of one compression. libvips tracks memory process-wide, so
+/// the figures are exact only while one job runs at a time
+/// (EXECUTION_MODE_SERIAL or a single pool job).
+final class CompressionStats extends ffi.Struct {
+  /// Growth of vips_tracked_get_mem_highwater; 0 if under an earlier peak
+  @ffi.Int64()
+  external int peak_mem_delta;
+
+  /// vips_tracked_get_mem after minus before (memory retained)
+  @ffi.Int64()
+  external int mem_delta;
+
+  /// vips_tracked_get_allocs on return: pixel buffers still open
+  @ffi.Int()
+  external int live_allocs;
+
+  /// vips_tracked_get_files on return
+  @ffi.Int()
+  external int open_files;
+
+  @ffi.Double()
+  external double elapsed_ms;
+
+  /// Wall time per stage in microseconds. libvips evaluates lazily, so
+  /// decoding, resizing and colour conversion mostly run while the encoder
+  /// pulls pixels and are counted in encode_us; decode_us is only the time
+  /// spent rendering the image into memory first (the search modes).
+  /// Opening the input and reading its header
+  @ffi.Int64()
+  external int open_us;
+
+  /// Rendering the decoded (and shrunk) image into memory
+  @ffi.Int64()
+  external int decode_us;
+
+  /// Shrink-on-load reopen and resize setup
+  @ffi.Int64()
+  external int resize_us;
+
+  /// Orientation and sRGB conversion setup
+  @ffi.Int64()
+  external int colour_us;
+
+  /// The rest of elapsed_ms: every encode, with the lazily run stages
+  @ffi.Int64()
+  external int encode_us;
+
+  /// Copying the chosen encode out for the caller
+  @ffi.Int64()
+  external int copy_us;
+
+  /// Quality of the returned encode (the one a search chose); -1 for lossless output and libwebp-rate-controlled WebP
+  @ffi.Int()
+  external int quality;
+
+  /// ImageFormat of the returned bytes; -1 on failure
+  @ffi.Int()
+  external int format;
+
+  /// Dimensions of the returned image, from its header; 0 on failure
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// Encodes run, search probes included; 0 when the bytes came from a
+  /// cache or the input as is
+  @ffi.Int()
+  external int encode_attempts;
+}
+
+/// Why a compression failed. Each call captures its own failure on the
+/// thread running it instead of reading libvips' process-wide error buffer,
+/// so parallel jobs never see or clear each other's errors.
+enum ThinpicErrorCode {
+  THINPIC_ERROR_NONE(0),
+
+  /// Not classified further; see the message
+  THINPIC_ERROR_FAILED(1),
+
+  /// Empty input, quality or size out of range, bad options
+  THINPIC_ERROR_INVALID_ARGUMENT(2),
+
+  /// The input could not be opened or decoded
+  THINPIC_ERROR_DECODE(3),
+
+  /// Resize, orientation or colour conversion failed
+  THINPIC_ERROR_PROCESS(4),
+
+  /// The encoder failed
+  THINPIC_ERROR_ENCODE(5),
+
+  /// The output file could not be written
+  THINPIC_ERROR_IO(6),
+
+  /// thinpic_cancel_job stopped the job
+  THINPIC_ERROR_CANCELLED(7),
+
+  /// The input is larger than thinpic_configure max_input_megapixels or max_input_bands allow
+  THINPIC_ERROR_LIMIT(8),
+
+  /// The job ran past thinpic_configure job_timeout_ms and was stopped
+  THINPIC_ERROR_TIMEOUT(9);
+
+  final int value;
+  const ThinpicErrorCode(this.value);
+
+  static ThinpicErrorCode fromValue(int value) => switch (value) {
+    0 => THINPIC_ERROR_NONE,
+    1 => THINPIC_ERROR_FAILED,
+    2 => THINPIC_ERROR_INVALID_ARGUMENT,
+    3 => THINPIC_ERROR_DECODE,
+    4 => THINPIC_ERROR_PROCESS,
+    5 => THINPIC_ERROR_ENCODE,
+    6 => THINPIC_ERROR_IO,
+    7 => THINPIC_ERROR_CANCELLED,
+    8 => THINPIC_ERROR_LIMIT,
+    9 => THINPIC_ERROR_TIMEOUT,
+    _ => throw ArgumentError("Unknown value for ThinpicErrorCode: $value"),
+  };
+}
+
+const int THINPIC_ERROR_MESSAGE_MAX = 256;
+
+final class ThinpicError extends ffi.Struct {
+  /// ThinpicErrorCode; THINPIC_ERROR_NONE on success
+  @ffi.Int()
+  external int code;
+
+  /// First error logged, then libvips' detail; empty on success
+  @ffi.Array.multi([256])
+  external ffi.Array<ffi.Char> message;
+}
+
+final class CompressedImageResultEx extends ffi.Struct {
+  external CompressedImageResult result;
+
+  external CompressionStats stats;
+
+  external ThinpicError error;
+}
+
+/// Telemetry for fleet monitoring. After the first thinpic_drain_stats call,
+/// every compression through the CompressMode dispatch (pool jobs,
+/// compress_buffer, compress_fd, compress_with_stats) appends one record to a
+/// fixed ring; writers take no lock, and when nobody drains for
+/// THINPIC_TELEMETRY_RECORDS jobs the oldest records are overwritten. Before
+/// the first drain nothing is recorded.
+const int THINPIC_TELEMETRY_RECORDS = 256;
+
+enum ThinpicTelemetryError {
+  THINPIC_TELEMETRY_OK(0),
+  THINPIC_TELEMETRY_FAILED(1),
+  THINPIC_TELEMETRY_CANCELLED(2);
+
+  final int value;
+  const ThinpicTelemetryError(this.value);
+
+  static ThinpicTelemetryError fromValue(int value) => switch (value) {
+    0 => THINPIC_TELEMETRY_OK,
+    1 => THINPIC_TELEMETRY_FAILED,
+    2 => THINPIC_TELEMETRY_CANCELLED,
+    _ => throw ArgumentError("Unknown value for ThinpicTelemetryError: $value"),
+  };
+}
+
+final class ThinpicTelemetryRecord extends ffi.Struct {
+  /// One more than the previous record's; a gap counts records overwritten before a drain
+  @ffi.Int64()
+  external int sequence;
+
+  /// CompressMode of the job
+  @ffi.Int()
+  external int mode;
+
+  /// ThinpicTelemetryError
+  @ffi.Int()
+  external int error;
+
+  /// Encoded input size; 0 for pipes, -1 when unknown
+  @ffi.Int64()
+  external int input_bytes;
+
+  /// Source dimensions; 0 when the pipeline read no header of its own
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// 0 on failure
+  @ffi.Int64()
+  external int output_bytes;
+
+  /// Elapsed and per-stage time, libvips peak memory, quality and format
+  external CompressionStats stats;
+
+  /// ThinpicPreset id the job ran with; 0 = built-in values
+  @ffi.Int()
+  external int preset;
+}
+
+/// One output of compress_image_variants: the box to fit (0 leaves a side
+/// free; neither side keeps the size, capped at 6000 px), format and quality
+const int THINPIC_MAX_VARIANTS = 8;
+
+const int THINPIC_SHEET_MAX_CELLS = 4096;
+
+const int THINPIC_SHEET_MAX_CELL = 1024;
+
+/// Unified entry point (thinpic_compress). ThinpicOptions is versioned: fields
+/// are only ever appended, and the version tells the library which ones the
+/// caller knows about. Start from thinpic_options_init.
+const int THINPIC_OPTIONS_VERSION = 22;
+
+enum ThinpicSourceType {
+  THINPIC_SOURCE_PATH(0),
+
+  /// Encoded bytes, read in place
+  THINPIC_SOURCE_BUFFER(1),
+
+  /// Open descriptor; the caller keeps ownership
+  THINPIC_SOURCE_FD(2),
+
+  /// Raw 8-bit pixels at data, read in place
+  THINPIC_SOURCE_PIXELS(3);
+
+  final int value;
+  const ThinpicSourceType(this.value);
+
+  static ThinpicSourceType fromValue(int value) => switch (value) {
+    0 => THINPIC_SOURCE_PATH,
+    1 => THINPIC_SOURCE_BUFFER,
+    2 => THINPIC_SOURCE_FD,
+    3 => THINPIC_SOURCE_PIXELS,
+    _ => throw ArgumentError("Unknown value for ThinpicSourceType: $value"),
+  };
+}
+
+/// THINPIC_SOURCE_PIXELS (Flutter ui.Image toByteData, camera frames) reads
+/// width x height pixels laid out as pixel_format (a ThinpicPixelFormat) from
+/// data, stride bytes per row (0 = tightly packed), length bytes in all. The
+/// pixels go through the same resize and encode as a decoded file and are not
+/// copied when the stride is a whole number of pixels and the buffer holds
+/// stride * height bytes; they must stay valid until the call returns (until
+/// thinpic_close for a handle). premultiplied: the colour is premultiplied by
+/// alpha, as in ImageByteFormat.rawRgba. FORMAT_AUTO writes PNG when the
+/// layout has alpha and JPEG otherwise.
+final class ThinpicSource extends ffi.Struct {
+  @ffi.UnsignedInt()
+  external int typeAsInt;
+
+  ThinpicSourceType get type => ThinpicSourceType.fromValue(typeAsInt);
+
+  external ffi.Pointer<ffi.Char> path;
+
+  external ffi.Pointer<ffi.Uint8> data;
+
+  @ffi.Size()
+  external int length;
+
+  @ffi.Int()
+  external int fd;
+
+  /// THINPIC_SOURCE_PIXELS only, from here on
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  @ffi.Int()
+  external int stride;
+
+  @ffi.Int()
+  external int pixel_format;
+
+  @ffi.Int()
+  external int premultiplied;
+}
+
+/// Resampling kernel for downscaling (same order as VipsKernel)
+enum ThinpicKernel {
+  THINPIC_KERNEL_NEAREST(0),
+  THINPIC_KERNEL_LINEAR(1),
+  THINPIC_KERNEL_CUBIC(2),
+  THINPIC_KERNEL_MITCHELL(3),
+  THINPIC_KERNEL_LANCZOS2(4),
+  THINPIC_KERNEL_LANCZOS3(5);
+
+  final int value;
+  const ThinpicKernel(this.value);
+
+  static ThinpicKernel fromValue(int value) => switch (value) {
+    0 => THINPIC_KERNEL_NEAREST,
+    1 => THINPIC_KERNEL_LINEAR,
+    2 => THINPIC_KERNEL_CUBIC,
+    3 => THINPIC_KERNEL_MITCHELL,
+    4 => THINPIC_KERNEL_LANCZOS2,
+    5 => THINPIC_KERNEL_LANCZOS3,
+    _ => throw ArgumentError("Unknown value for ThinpicKernel: $value"),
+  };
+}
+
+/// Metadata written to the output. Policies that drop EXIF apply the EXIF
+/// orientation to the pixels first.
+enum ThinpicStripPolicy {
+  /// Keep all metadata
+  THINPIC_STRIP_NONE(0),
+
+  /// Keep nothing
+  THINPIC_STRIP_ALL(1),
+
+  /// Keep only the colour profile
+  THINPIC_STRIP_KEEP_ICC(2);
+
+  final int value;
+  const ThinpicStripPolicy(this.value);
+
+  static ThinpicStripPolicy fromValue(int value) => switch (value) {
+    0 => THINPIC_STRIP_NONE,
+    1 => THINPIC_STRIP_ALL,
+    2 => THINPIC_STRIP_KEEP_ICC,
+    _ => throw ArgumentError("Unknown value for ThinpicStripPolicy: $value"),
+  };
+}
+
+/// Embedded video of a motion photo (ThinpicOptions version 19; see
+/// thinpic_motion_photo_probe). The still is compressed either way.
+enum ThinpicMotionVideo {
+  /// Write the still alone (the default)
+  THINPIC_MOTION_VIDEO_STRIP(0),
+
+  /// JPEG output: copy the video after the new still, undecoded
+  THINPIC_MOTION_VIDEO_KEEP(1);
+
+  final int value;
+  const ThinpicMotionVideo(this.value);
+
+  static ThinpicMotionVideo fromValue(int value) => switch (value) {
+    0 => THINPIC_MOTION_VIDEO_STRIP,
+    1 => THINPIC_MOTION_VIDEO_KEEP,
+    _ => throw ArgumentError("Unknown value for ThinpicMotionVideo: $value"),
+  };
+}
+
+/// Ultra HDR gain map of a JPEG source (ThinpicOptions version 21): the
+/// secondary image its MPF index names, with hdrgm or ISO 21496-1 metadata
+enum ThinpicGainMap {
+  /// SDR output: the primary alone, as libvips reads it (the default)
+  THINPIC_GAIN_MAP_STRIP(0),
+
+  /// JPEG output: the gain map resized and turned with the primary and appended
+  THINPIC_GAIN_MAP_KEEP(1);
+
+  final int value;
+  const ThinpicGainMap(this.value);
+
+  static ThinpicGainMap fromValue(int value) => switch (value) {
+    0 => THINPIC_GAIN_MAP_STRIP,
+    1 => THINPIC_GAIN_MAP_KEEP,
+    _ => throw ArgumentError("Unknown value for ThinpicGainMap: $value"),
+  };
+}
+
+/// Element type of the model input tensor (ThinpicOptions version 20)
+enum ThinpicTensorType {
+  /// 0-255, as quantised models take it
+  THINPIC_TENSOR_UINT8(0),
+
+  /// (value / 255 - tensor_mean) / tensor_std per channel
+  THINPIC_TENSOR_FLOAT32(1);
+
+  final int value;
+  const ThinpicTensorType(this.value);
+
+  static ThinpicTensorType fromValue(int value) => switch (value) {
+    0 => THINPIC_TENSOR_UINT8,
+    1 => THINPIC_TENSOR_FLOAT32,
+    _ => throw ArgumentError("Unknown value for ThinpicTensorType: $value"),
+  };
+}
+
+/// Largest tensor side thinpic_compress produces
+const int THINPIC_TENSOR_MAX = 1024;
+
+/// WebP encoder presets (ThinpicOptions version 2). effort is libwebp's
+/// method; sharp YUV (libsharpyuv) sharpens chroma edges at some encode cost.
+/// FAST      method 1, plain RGB->YUV, alpha quality 80
+/// BALANCED  method 4 (the libwebp default), plain RGB->YUV, lossless alpha
+/// ARCHIVE   method 6, sharp YUV, auto-adjusted deblocking, lossless alpha
+enum ThinpicWebpProfile {
+  /// Follow effort; libvips defaults elsewhere
+  THINPIC_WEBP_PROFILE_DEFAULT(0),
+  THINPIC_WEBP_PROFILE_FAST(1),
+  THINPIC_WEBP_PROFILE_BALANCED(2),
+  THINPIC_WEBP_PROFILE_ARCHIVE(3);
+
+  final int value;
+  const ThinpicWebpProfile(this.value);
+
+  static ThinpicWebpProfile fromValue(int value) => switch (value) {
+    0 => THINPIC_WEBP_PROFILE_DEFAULT,
+    1 => THINPIC_WEBP_PROFILE_FAST,
+    2 => THINPIC_WEBP_PROFILE_BALANCED,
+    3 => THINPIC_WEBP_PROFILE_ARCHIVE,
+    _ => throw ArgumentError("Unknown value for ThinpicWebpProfile: $value"),
+  };
+}
+
+/// Progressive JPEG scan scripts (ThinpicOptions version 3). Every scan adds
+/// detail to the whole frame, so a viewer can draw a coarse picture from the
+/// first scans instead of waiting for the image to load top to bottom.
+/// DEFAULT  libjpeg's standard 10-scan progression
+/// PREVIEW  full-precision DC first (an exact 1/8-scale image), then the
+/// lowest luma frequencies: the earliest usable preview
+/// CUSTOM   the caller's scans / scan_count
+enum ThinpicScanScript {
+  THINPIC_SCAN_SCRIPT_DEFAULT(0),
+  THINPIC_SCAN_SCRIPT_PREVIEW(1),
+  THINPIC_SCAN_SCRIPT_CUSTOM(2);
+
+  final int value;
+  const ThinpicScanScript(this.value);
+
+  static ThinpicScanScript fromValue(int value) => switch (value) {
+    0 => THINPIC_SCAN_SCRIPT_DEFAULT,
+    1 => THINPIC_SCAN_SCRIPT_PREVIEW,
+    2 => THINPIC_SCAN_SCRIPT_CUSTOM,
+    _ => throw ArgumentError("Unknown value for ThinpicScanScript: $value"),
+  };
+}
+
+/// One progressive JPEG scan (libjpeg's jpeg_scan_info). DC scans (ss = se = 0)
+/// may interleave components; AC scans cover exactly one.
+final class ThinpicScan extends ffi.Struct {
+  /// 1-4
+  @ffi.Int()
+  external int component_count;
+
+  /// Component indices: 0 = Y, 1 = Cb, 2 = Cr
+  @ffi.Array.multi([4])
+  external ffi.Array<ffi.Int> components;
+
+  /// Spectral selection start, 0-63
+  @ffi.Int()
+  external int ss;
+
+  /// Spectral selection end
+  @ffi.Int()
+  external int se;
+
+  /// Successive approximation: bit position of the previous scan (0 = first)
+  @ffi.Int()
+  external int ah;
+
+  /// Bit position this scan stops at
+  @ffi.Int()
+  external int al;
+}
+
+/// Indexed (palette) PNG output (ThinpicOptions version 5). Screenshots and
+/// UI captures rarely use more than a few hundred colours; one byte or less
+/// per pixel instead of three or four shrinks them several times over.
+enum ThinpicPngPalette {
+  /// Truecolour PNG
+  THINPIC_PNG_PALETTE_OFF(0),
+
+  /// Indexed only when the image already fits the palette (lossless)
+  THINPIC_PNG_PALETTE_AUTO(1),
+
+  /// Always indexed; images with more colours are quantised (median cut)
+  THINPIC_PNG_PALETTE_ON(2);
+
+  final int value;
+  const ThinpicPngPalette(this.value);
+
+  static ThinpicPngPalette fromValue(int value) => switch (value) {
+    0 => THINPIC_PNG_PALETTE_OFF,
+    1 => THINPIC_PNG_PALETTE_AUTO,
+    2 => THINPIC_PNG_PALETTE_ON,
+    _ => throw ArgumentError("Unknown value for ThinpicPngPalette: $value"),
+  };
+}
+
+/// Pixel layouts compress_raw_to_jpeg reads. JPEG has no alpha: the fourth
+/// byte of RGBA/BGRA (or RGBX/BGRX padding) is ignored.
+enum ThinpicPixelFormat {
+  THINPIC_PIXEL_RGB(0),
+  THINPIC_PIXEL_BGR(1),
+
+  /// Android RGBA_8888 camera frames
+  THINPIC_PIXEL_RGBA(2),
+
+  /// iOS kCVPixelFormatType_32BGRA
+  THINPIC_PIXEL_BGRA(3),
+  THINPIC_PIXEL_GRAY(4);
+
+  final int value;
+  const ThinpicPixelFormat(this.value);
+
+  static ThinpicPixelFormat fromValue(int value) => switch (value) {
+    0 => THINPIC_PIXEL_RGB,
+    1 => THINPIC_PIXEL_BGR,
+    2 => THINPIC_PIXEL_RGBA,
+    3 => THINPIC_PIXEL_BGRA,
+    4 => THINPIC_PIXEL_GRAY,
+    _ => throw ArgumentError("Unknown value for ThinpicPixelFormat: $value"),
+  };
+}
+
+/// One plane of a YUV 4:2:0 frame, as Android's Image.Plane describes it.
+/// pixel_stride is 1 for planar (I420) chroma and 2 for semi-planar NV12/NV21,
+/// where u and v point one byte apart into the same interleaved plane.
+final class ThinpicYuvPlane extends ffi.Struct {
+  external ffi.Pointer<ffi.Uint8> data;
+
+  /// Bytes from one row to the next
+  @ffi.Int()
+  external int row_stride;
+
+  /// Bytes from one sample to the next
+  @ffi.Int()
+  external int pixel_stride;
+}
+
+/// Truecolour PNG compressor (ThinpicOptions version 6). Both filter every
+/// row adaptively; libdeflate then compresses the image in one pass, 2-4x
+/// faster than zlib for the same or a smaller file, at the cost of holding
+/// the filtered image in memory. Interlaced output always uses zlib.
+enum ThinpicPngDeflate {
+  /// libvips pngsave
+  THINPIC_PNG_DEFLATE_ZLIB(0),
+  THINPIC_PNG_DEFLATE_LIBDEFLATE(1),
+
+  /// libdeflate level 12 over several filter strategies in parallel; smallest kept
+  THINPIC_PNG_DEFLATE_OPTIMIZE(2);
+
+  final int value;
+  const ThinpicPngDeflate(this.value);
+
+  static ThinpicPngDeflate fromValue(int value) => switch (value) {
+    0 => THINPIC_PNG_DEFLATE_ZLIB,
+    1 => THINPIC_PNG_DEFLATE_LIBDEFLATE,
+    2 => THINPIC_PNG_DEFLATE_OPTIMIZE,
+    _ => throw ArgumentError("Unknown value for ThinpicPngDeflate: $value"),
+  };
+}
+
+/// Fill mode for the max box (ThinpicOptions version 8, same order as
+/// VipsInteresting). With a crop and both max_width and max_height set, the
+/// image is scaled to cover the box and cropped to it (square avatars, grid
+/// cells); the decoder's shrink-on-load runs first so the crop is chosen on
+/// a small intermediate. Inputs smaller than the box are cropped, not
+/// upscaled. EXIF orientation is applied before cropping. Animations are
+/// fitted, not cropped.
+enum ThinpicCrop {
+  /// Fit inside the box
+  THINPIC_CROP_NONE(0),
+
+  /// Keep the middle
+  THINPIC_CROP_CENTRE(1),
+
+  /// Keep the busiest region
+  THINPIC_CROP_ENTROPY(2),
+
+  /// Keep skin tones, saturated colour and edges
+  THINPIC_CROP_ATTENTION(3);
+
+  final int value;
+  const ThinpicCrop(this.value);
+
+  static ThinpicCrop fromValue(int value) => switch (value) {
+    0 => THINPIC_CROP_NONE,
+    1 => THINPIC_CROP_CENTRE,
+    2 => THINPIC_CROP_ENTROPY,
+    3 => THINPIC_CROP_ATTENTION,
+    _ => throw ArgumentError("Unknown value for ThinpicCrop: $value"),
+  };
+}
+
+/// Codec inside FORMAT_HEIF output (ThinpicOptions version 10). HEVC writes
+/// HEIC, through the platform's hardware encoder when there is one; AV1
+/// writes AVIF through whichever AV1 encoder libheif was built with (aom,
+/// SVT-AV1 or rav1e), always in software and several times slower.
+enum ThinpicHeifCompression {
+  THINPIC_HEIF_HEVC(0),
+  THINPIC_HEIF_AV1(1);
+
+  final int value;
+  const ThinpicHeifCompression(this.value);
+
+  static ThinpicHeifCompression fromValue(int value) => switch (value) {
+    0 => THINPIC_HEIF_HEVC,
+    1 => THINPIC_HEIF_AV1,
+    _ => throw ArgumentError("Unknown value for ThinpicHeifCompression: $value"),
+  };
+}
+
+/// Chroma subsampling of FORMAT_HEIF output (same order as
+/// VipsForeignSubsample). Hardware HEVC encoders only write 4:2:0, so 4:4:4
+/// always goes through libheif.
+enum ThinpicSubsample {
+  /// 4:2:0 below quality 90, 4:4:4 from it
+  THINPIC_SUBSAMPLE_AUTO(0),
+
+  /// Always 4:2:0: smallest, softer colour edges
+  THINPIC_SUBSAMPLE_420(1),
+
+  /// Full chroma: sharp coloured text and UI edges
+  THINPIC_SUBSAMPLE_444(2);
+
+  final int value;
+  const ThinpicSubsample(this.value);
+
+  static ThinpicSubsample fromValue(int value) => switch (value) {
+    0 => THINPIC_SUBSAMPLE_AUTO,
+    1 => THINPIC_SUBSAMPLE_420,
+    2 => THINPIC_SUBSAMPLE_444,
+    _ => throw ArgumentError("Unknown value for ThinpicSubsample: $value"),
+  };
+}
+
+/// Base quantisation tables of FORMAT_JPEG output (same order as libvips'
+/// quant_table). Only mozjpeg has more than the standard ones.
+enum ThinpicQuantTable {
+  /// ImageMagick's with mozjpeg, Annex K otherwise
+  THINPIC_QUANT_TABLE_DEFAULT(-1),
+
+  /// The JPEG standard's; what every other encoder writes
+  THINPIC_QUANT_TABLE_ANNEX_K(0),
+  THINPIC_QUANT_TABLE_FLAT(1),
+
+  /// Tuned for MS-SSIM on the Kodak set
+  THINPIC_QUANT_TABLE_MSSIM(2),
+
+  /// mozjpeg's default: smaller at equal quality for photos
+  THINPIC_QUANT_TABLE_IMAGEMAGICK(3),
+  THINPIC_QUANT_TABLE_PSNR_HVS_M(4),
+  THINPIC_QUANT_TABLE_KLEIN(5),
+  THINPIC_QUANT_TABLE_WATSON(6),
+  THINPIC_QUANT_TABLE_AHUMADA(7),
+  THINPIC_QUANT_TABLE_PETERSON(8);
+
+  final int value;
+  const ThinpicQuantTable(this.value);
+
+  static ThinpicQuantTable fromValue(int value) => switch (value) {
+    -1 => THINPIC_QUANT_TABLE_DEFAULT,
+    0 => THINPIC_QUANT_TABLE_ANNEX_K,
+    1 => THINPIC_QUANT_TABLE_FLAT,
+    2 => THINPIC_QUANT_TABLE_MSSIM,
+    3 => THINPIC_QUANT_TABLE_IMAGEMAGICK,
+    4 => THINPIC_QUANT_TABLE_PSNR_HVS_M,
+    5 => THINPIC_QUANT_TABLE_KLEIN,
+    6 => THINPIC_QUANT_TABLE_WATSON,
+    7 => THINPIC_QUANT_TABLE_AHUMADA,
+    8 => THINPIC_QUANT_TABLE_PETERSON,
+    _ => throw ArgumentError("Unknown value for ThinpicQuantTable: $value"),
+  };
+}
+
+/// Where a watermark sits (ThinpicOptions version 17, same order as
+/// VipsCompassDirection)
+enum ThinpicGravity {
+  THINPIC_GRAVITY_CENTRE(0),
+  THINPIC_GRAVITY_NORTH(1),
+  THINPIC_GRAVITY_EAST(2),
+  THINPIC_GRAVITY_SOUTH(3),
+  THINPIC_GRAVITY_WEST(4),
+  THINPIC_GRAVITY_NORTH_EAST(5),
+  THINPIC_GRAVITY_SOUTH_EAST(6),
+  THINPIC_GRAVITY_SOUTH_WEST(7),
+  THINPIC_GRAVITY_NORTH_WEST(8);
+
+  final int value;
+  const ThinpicGravity(this.value);
+
+  static ThinpicGravity fromValue(int value) => switch (value) {
+    0 => THINPIC_GRAVITY_CENTRE,
+    1 => THINPIC_GRAVITY_NORTH,
+    2 => THINPIC_GRAVITY_EAST,
+    3 => THINPIC_GRAVITY_SOUTH,
+    4 => THINPIC_GRAVITY_WEST,
+    5 => THINPIC_GRAVITY_NORTH_EAST,
+    6 => THINPIC_GRAVITY_SOUTH_EAST,
+    7 => THINPIC_GRAVITY_SOUTH_WEST,
+    8 => THINPIC_GRAVITY_NORTH_WEST,
+    _ => throw ArgumentError("Unknown value for ThinpicGravity: $value"),
+  };
+}
+
+/// Loading placeholder returned with a thinpic_compress result, computed from
+/// the pixels being encoded
+enum ThinpicPlaceholder {
+  THINPIC_PLACEHOLDER_NONE(0),
+
+  /// BlurHash, 4x3 components (3x4 portrait)
+  THINPIC_PLACEHOLDER_BLURHASH(1),
+
+  /// ThumbHash bytes as base64; keeps aspect ratio and alpha
+  THINPIC_PLACEHOLDER_THUMBHASH(2);
+
+  final int value;
+  const ThinpicPlaceholder(this.value);
+
+  static ThinpicPlaceholder fromValue(int value) => switch (value) {
+    0 => THINPIC_PLACEHOLDER_NONE,
+    1 => THINPIC_PLACEHOLDER_BLURHASH,
+    2 => THINPIC_PLACEHOLDER_THUMBHASH,
+    _ => throw ArgumentError("Unknown value for ThinpicPlaceholder: $value"),
+  };
+}
+
+/// Room for the NUL-terminated placeholder either kind writes
+const int THINPIC_PLACEHOLDER_MAX = 64;
+
+/// Most dominant colours a thinpic_compress result carries
+const int THINPIC_PALETTE_MAX = 8;
+
+final class ThinpicOptions extends ffi.Struct {
+  /// THINPIC_OPTIONS_VERSION
+  @ffi.Int()
+  external int version;
+
+  /// FORMAT_AUTO keeps the input format
+  @ffi.UnsignedInt()
+  external int formatAsInt;
+
+  ImageFormat get format => ImageFormat.fromValue(formatAsInt);
+
+  /// 1-100 (lossy formats)
+  @ffi.Int()
+  external int quality;
+
+  /// 0 fastest .. 9 smallest, scaled to each encoder; -1 = encoder default
+  @ffi.Int()
+  external int effort;
+
+  @ffi.UnsignedInt()
+  external int kernelAsInt;
+
+  ThinpicKernel get kernel => ThinpicKernel.fromValue(kernelAsInt);
+
+  /// Fit inside max_width x max_height; 0 = unconstrained, never upscales
+  @ffi.Int()
+  external int max_width;
+
+  @ffi.Int()
+  external int max_height;
+
+  @ffi.UnsignedInt()
+  external int stripAsInt;
+
+  ThinpicStripPolicy get strip => ThinpicStripPolicy.fromValue(stripAsInt);
+
+  /// libvips worker threads for this image; 0 = thinpic_configure setting
+  @ffi.Int()
+  external int threads;
+
+  /// Version 2
+  @ffi.UnsignedInt()
+  external int webp_profileAsInt;
+
+  ThinpicWebpProfile get webp_profile =>
+      ThinpicWebpProfile.fromValue(webp_profileAsInt);
+
+  /// 1 on, 0 off, -1 = profile setting
+  @ffi.Int()
+  external int webp_sharp_yuv;
+
+  /// WebP alpha plane quality 1-100; 0 = profile setting
+  @ffi.Int()
+  external int alpha_quality;
+
+  /// Version 3
+  @ffi.Int()
+  external int progressive;
+
+  @ffi.UnsignedInt()
+  external int scan_scriptAsInt;
+
+  ThinpicScanScript get scan_script =>
+      ThinpicScanScript.fromValue(scan_scriptAsInt);
+
+  /// THINPIC_SCAN_SCRIPT_CUSTOM only; read during the call
+  external ffi.Pointer<ThinpicScan> scans;
+
+  @ffi.Int()
+  external int scan_count;
+
+  /// 1 = keep every frame of animated GIF/WebP input (WebP or GIF output)
+  @ffi.Int()
+  external int animated;
+
+  /// Version 5
+  @ffi.UnsignedInt()
+  external int png_paletteAsInt;
+
+  ThinpicPngPalette get png_palette =>
+      ThinpicPngPalette.fromValue(png_paletteAsInt);
+
+  /// Bits per palette index: 1, 2, 4 or 8 (2-256 colours); 0 = smallest that fits 256
+  @ffi.Int()
+  external int png_bitdepth;
+
+  /// Floyd-Steinberg strength 0-100 when quantising
+  @ffi.Int()
+  external int dither;
+
+  /// Version 6
+  @ffi.UnsignedInt()
+  external int png_deflateAsInt;
+
+  ThinpicPngDeflate get png_deflate =>
+      ThinpicPngDeflate.fromValue(png_deflateAsInt);
+
+  /// Version 7
+  /// JPEG/WebP: lowest quality up to `quality` whose SSIM stays >= this (0-1); 0 = off
+  @ffi.Double()
+  external double min_ssim;
+
+  /// Version 8
+  /// Fill max_width x max_height and crop (both must be set)
+  @ffi.UnsignedInt()
+  external int cropAsInt;
+
+  ThinpicCrop get crop => ThinpicCrop.fromValue(cropAsInt);
+
+  /// Version 9
+  /// Aim to return within this many ms (see thinpic_compress); 0 = off
+  @ffi.Int()
+  external int latency_budget_ms;
+
+  /// Version 10
+  @ffi.UnsignedInt()
+  external int heif_compressionAsInt;
+
+  ThinpicHeifCompression get heif_compression =>
+      ThinpicHeifCompression.fromValue(heif_compressionAsInt);
+
+  @ffi.UnsignedInt()
+  external int heif_subsampleAsInt;
+
+  ThinpicSubsample get heif_subsample =>
+      ThinpicSubsample.fromValue(heif_subsampleAsInt);
+
+  /// Version 11
+  /// JPEG XL Butteraugli distance, 0.1 (visually lossless) to 25, instead of quality; 0 = from quality
+  @ffi.Double()
+  external double jxl_distance;
+
+  /// 1 = JPEG input to FORMAT_JXL as a reversible transcode (see thinpic_compress)
+  @ffi.Int()
+  external int jxl_lossless_jpeg;
+
+  /// Version 12
+  /// 1 = set out->perceptual_hash from the encoded pixels (see thinpic_compress)
+  @ffi.Int()
+  external int perceptual_hash;
+
+  /// Version 13
+  /// Set out->placeholder from the encoded pixels
+  @ffi.UnsignedInt()
+  external int placeholderAsInt;
+
+  ThinpicPlaceholder get placeholder =>
+      ThinpicPlaceholder.fromValue(placeholderAsInt);
+
+  /// Version 14
+  /// 1 = set the blur and exposure scores of out (see thinpic_compress)
+  @ffi.Int()
+  external int analysis;
+
+  /// Version 15
+  /// GIF palette entries, 2-256 (dither applies as for PNG); 0 = 256
+  @ffi.Int()
+  external int gif_colours;
+
+  /// Animated GIF: largest channel difference for a pixel to repeat the previous frame, 0-255; -1 = from quality
+  @ffi.Int()
+  external int gif_interframe;
+
+  /// Version 16: mozjpeg extensions, dropped when the libjpeg lacks them (see thinpic_compress)
+  /// Trellis quantisation: 1 on, 0 off, -1 = on unless effort is 0
+  @ffi.Int()
+  external int jpeg_trellis;
+
+  /// Less ringing on black-on-white edges; same values
+  @ffi.Int()
+  external int jpeg_overshoot_deringing;
+
+  /// Progressive: smallest split of the spectral scans; same values
+  @ffi.Int()
+  external int jpeg_optimize_scans;
+
+  @ffi.Int()
+  external int jpeg_quant_tableAsInt;
+
+  ThinpicQuantTable get jpeg_quant_table =>
+      ThinpicQuantTable.fromValue(jpeg_quant_tableAsInt);
+
+  /// Version 17: overlay drawn on the resized, upright image before the encode (see thinpic_compress)
+  /// Image to draw, usually a PNG with alpha; NULL = none. Read during the call
+  external ffi.Pointer<ffi.Char> watermark_path;
+
+  @ffi.UnsignedInt()
+  external int watermark_gravityAsInt;
+
+  ThinpicGravity get watermark_gravity =>
+      ThinpicGravity.fromValue(watermark_gravityAsInt);
+
+  /// Pixels kept between the overlay and the edges it sits against
+  @ffi.Int()
+  external int watermark_margin;
+
+  /// Overlay width as a fraction of the output's, 0-1; 0 = its own size
+  @ffi.Double()
+  external double watermark_width;
+
+  /// 0-1, multiplies the overlay's alpha
+  @ffi.Double()
+  external double watermark_opacity;
+
+  /// Dominant colours to set in out->palette, 1-THINPIC_PALETTE_MAX; 0 = none
+  @ffi.Int()
+  external int palette_colours;
+
+  /// Version 19
+  /// Google motion photos keep the video only with strip THINPIC_STRIP_NONE, which keeps the XMP that points at it
+  @ffi.UnsignedInt()
+  external int motion_videoAsInt;
+
+  ThinpicMotionVideo get motion_video =>
+      ThinpicMotionVideo.fromValue(motion_videoAsInt);
+
+  /// Version 20: RGB model input in out->tensor from the encoded pixels (see thinpic_compress)
+  /// 1-THINPIC_TENSOR_MAX, with tensor_height; 0 = none
+  @ffi.Int()
+  external int tensor_width;
+
+  @ffi.Int()
+  external int tensor_height;
+
+  @ffi.UnsignedInt()
+  external int tensor_typeAsInt;
+
+  ThinpicTensorType get tensor_type =>
+      ThinpicTensorType.fromValue(tensor_typeAsInt);
+
+  /// THINPIC_TENSOR_FLOAT32 only, in 0-1 units
+  @ffi.Array.multi([3])
+  external ffi.Array<ffi.Double> tensor_mean;
+
+  /// Same; 0 = 1
+  @ffi.Array.multi([3])
+  external ffi.Array<ffi.Double> tensor_std;
+
+  /// Version 21
+  /// Not with a crop or a kept Google motion video (see thinpic_compress)
+  @ffi.UnsignedInt()
+  external int gain_mapAsInt;
+
+  ThinpicGainMap get gain_map => ThinpicGainMap.fromValue(gain_mapAsInt);
+
+  /// Version 22: more sinks fed from the one encode, besides out->data (see thinpic_compress)
+  /// Also written here, atomically as file jobs are; NULL = none
+  external ffi.Pointer<ffi.Char> output_path;
+
+  /// Also handed the bytes in order; NULL = none
+  external ThinpicSinkCallback sink;
+
+  /// Passed to sink
+  @ffi.Int64()
+  external int sink_id;
+}
+
+final class ThinpicResult extends ffi.Struct {
+  /// Free with free_compressed_buffer
+  external ffi.Pointer<ffi.Uint8> data;
+
+  @ffi.Size()
   external int length;
 
+  /// Dimensions of the encoded image
   @ffi.Int()
-  external int success;
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// Format written (FORMAT_AUTO resolved)
+  @ffi.UnsignedInt()
+  external int formatAsInt;
+
+  ImageFormat get format => ImageFormat.fromValue(formatAsInt);
+
+  /// Wall time of the call
+  @ffi.Int()
+  external int elapsed_ms;
+
+  /// 1 within options->latency_budget_ms, 0 over it, -1 without a budget
+  @ffi.Int()
+  external int budget_met;
+
+  /// 64-bit difference hash, when hash_valid
+  @ffi.Uint64()
+  external int perceptual_hash;
+
+  /// 1 when options->perceptual_hash produced perceptual_hash
+  @ffi.Int()
+  external int hash_valid;
+
+  /// options->placeholder string; empty when none could be made
+  @ffi.Array.multi([64])
+  external ffi.Array<ffi.Char> placeholder;
+
+  /// Laplacian variance of the luma plane, when analysis_valid; low is blurry
+  @ffi.Double()
+  external double sharpness;
+
+  /// Mean luma, 0-1
+  @ffi.Double()
+  external double brightness;
+
+  /// Fraction of the plane at or below luma 8
+  @ffi.Double()
+  external double shadows_clipped;
+
+  /// Fraction of the plane at or above luma 247
+  @ffi.Double()
+  external double highlights_clipped;
+
+  /// 1 when options->analysis produced the scores above
+  @ffi.Int()
+  external int analysis_valid;
+
+  /// options->palette_colours as 0xRRGGBB, most of the image first
+  @ffi.Array.multi([8])
+  external ffi.Array<ffi.Uint32> palette;
+
+  /// Fraction of the opaque image nearest each colour
+  @ffi.Array.multi([8])
+  external ffi.Array<ffi.Double> palette_share;
+
+  /// Colours set; 0 when none were asked for or could be found
+  @ffi.Int()
+  external int palette_count;
+
+  /// Motion photo trailer copied after the still (THINPIC_MOTION_VIDEO_KEEP); 0 = none
+  @ffi.Int64()
+  external int motion_video_bytes;
+
+  /// tensor_height x tensor_width x 3 (NHWC, N = 1) of tensor_type; free with free_compressed_buffer
+  external ffi.Pointer<ffi.Uint8> tensor;
+
+  /// Bytes; 0 when none was asked for or could be made
+  @ffi.Size()
+  external int tensor_length;
+
+  /// Ultra HDR gain map appended after the primary (THINPIC_GAIN_MAP_KEEP); 0 = none
+  @ffi.Int64()
+  external int gain_map_bytes;
+
+  /// Why the call failed when it returns -1
+  external ThinpicError error;
+}
+
+final class ThinpicHandle extends ffi.Opaque {}
+
+final class ThinpicStream extends ffi.Opaque {}
+
+/// Decoded pixels for display (thinpic_decode_rgba): 8-bit sRGB RGBA with the
+/// EXIF orientation applied, rows packed (stride = width * 4). Free data with
+/// free_compressed_buffer.
+final class ThinpicPixels extends ffi.Struct {
+  external ffi.Pointer<ffi.Uint8> data;
+
+  @ffi.Size()
+  external int length;
+
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  @ffi.Int()
+  external int stride;
+}
+
+/// Quality of an output against its original (thinpic_compare), measured on
+/// luma planes of the same size
+final class ThinpicQuality extends ffi.Struct {
+  /// dB; identical planes score 100
+  @ffi.Double()
+  external double psnr;
+
+  /// Mean SSIM over 8x8 windows every 4 pixels, 1 for identical planes
+  @ffi.Double()
+  external double ssim;
+
+  /// Five-scale MS-SSIM (fewer scales for small planes)
+  @ffi.Double()
+  external double ms_ssim;
+
+  /// Analysis plane the scores were taken on
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+}
+
+/// One step of thinpic_compress_ops. Steps run in order on one lazy libvips
+/// graph: the input is decoded once and the result encoded once however many
+/// steps there are. Fields a step does not use are ignored.
+enum ThinpicOperationType {
+  /// Apply the EXIF orientation to the pixels
+  THINPIC_OP_AUTOROTATE(0),
+
+  /// Keep x, y, width x height (clipped to the image)
+  THINPIC_OP_CROP(1),
+
+  /// Fit inside width x height (0 = unconstrained), never upscales
+  THINPIC_OP_RESIZE(2),
+
+  /// Unsharp mask of radius sigma (0 = 1.0)
+  THINPIC_OP_SHARPEN(3),
+
+  /// Draw overlay_path at x, y with opacity 0-1
+  THINPIC_OP_COMPOSITE(4);
+
+  final int value;
+  const ThinpicOperationType(this.value);
+
+  static ThinpicOperationType fromValue(int value) => switch (value) {
+    0 => THINPIC_OP_AUTOROTATE,
+    1 => THINPIC_OP_CROP,
+    2 => THINPIC_OP_RESIZE,
+    3 => THINPIC_OP_SHARPEN,
+    4 => THINPIC_OP_COMPOSITE,
+    _ => throw ArgumentError("Unknown value for ThinpicOperationType: $value"),
+  };
+}
+
+final class ThinpicOperation extends ffi.Struct {
+  @ffi.UnsignedInt()
+  external int typeAsInt;
+
+  ThinpicOperationType get type => ThinpicOperationType.fromValue(typeAsInt);
+
+  @ffi.Int()
+  external int x;
+
+  @ffi.Int()
+  external int y;
+
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  @ffi.Double()
+  external double sigma;
+
+  @ffi.Double()
+  external double opacity;
+
+  /// THINPIC_OP_COMPOSITE only; read during the call
+  external ffi.Pointer<ffi.Char> overlay_path;
+}
+
+/// Multi-resolution tiled output for very large inputs, which the large
+/// modes would cap at 6000 px: every level down to one tile, each tile a
+/// JPEG at quality. The input is read once, top to bottom, and only a few
+/// rows of tiles per level are in memory at a time.
+/// Levels for thinpic_on_memory_pressure
+enum ThinpicMemoryPressure {
+  /// Pressure is over; held background jobs resume
+  THINPIC_MEMORY_PRESSURE_NORMAL(0),
+
+  /// Free idle caches
+  THINPIC_MEMORY_PRESSURE_MODERATE(1),
+
+  /// Also hold background jobs for 10 s
+  THINPIC_MEMORY_PRESSURE_CRITICAL(2);
+
+  final int value;
+  const ThinpicMemoryPressure(this.value);
+
+  static ThinpicMemoryPressure fromValue(int value) => switch (value) {
+    0 => THINPIC_MEMORY_PRESSURE_NORMAL,
+    1 => THINPIC_MEMORY_PRESSURE_MODERATE,
+    2 => THINPIC_MEMORY_PRESSURE_CRITICAL,
+    _ => throw ArgumentError("Unknown value for ThinpicMemoryPressure: $value"),
+  };
+}
+
+/// compress_directory for work that outlives the UI: an Android WorkManager
+/// worker or foreground service runs it through ThinpicBackgroundEngine
+/// (JNI), on the same worker pool and memory governor. The run is recorded
+/// for the process, so a Flutter engine that attaches later can read
+/// thinpic_background_status to show its progress or collect the outputs.
+/// thinpic_background_stop (the worker being stopped) submits nothing more
+/// and cancels the items in flight; the next call resumes from the manifest.
+/// One runs at a time: a second call while one runs returns -1.
+enum ThinpicBackgroundState {
+  /// None has run in this process
+  THINPIC_BACKGROUND_IDLE(0),
+  THINPIC_BACKGROUND_RUNNING(1),
+
+  /// Every input is recorded in the manifest
+  THINPIC_BACKGROUND_FINISHED(2),
+
+  /// thinpic_background_stop; the rest is left for the next run
+  THINPIC_BACKGROUND_STOPPED(3),
+
+  /// Invalid arguments or an unreadable source
+  THINPIC_BACKGROUND_FAILED(4);
+
+  final int value;
+  const ThinpicBackgroundState(this.value);
+
+  static ThinpicBackgroundState fromValue(int value) => switch (value) {
+    0 => THINPIC_BACKGROUND_IDLE,
+    1 => THINPIC_BACKGROUND_RUNNING,
+    2 => THINPIC_BACKGROUND_FINISHED,
+    3 => THINPIC_BACKGROUND_STOPPED,
+    4 => THINPIC_BACKGROUND_FAILED,
+    _ => throw ArgumentError(
+      "Unknown value for ThinpicBackgroundState: $value",
+    ),
+  };
+}
+
+final class ThinpicBackgroundStatus extends ffi.Struct {
+  /// ThinpicBackgroundState
+  @ffi.Int()
+  external int state;
+
+  /// Inputs the manifest records as done, resumed ones included
+  @ffi.Int()
+  external int done;
+
+  /// Inputs the source lists
+  @ffi.Int()
+  external int total;
+
+  /// Wall clock of the last start; identifies the run
+  @ffi.Int64()
+  external int started_ms;
+
+  /// 0 while it runs
+  @ffi.Int64()
+  external int finished_ms;
+}
+
+/// Motion photos: JPEGs with a video appended (Google Motion Photo and
+/// MicroVideo, Samsung motion JPEG). Found from the XMP and the Samsung SEF
+/// trailer alone, without reading the video; the output cache and the
+/// estimate count only the still's bytes.
+enum ThinpicMotionKind {
+  THINPIC_MOTION_NONE(0),
+
+  /// XMP GCamera:MicroVideoOffset or a Container MotionPhoto item
+  THINPIC_MOTION_GOOGLE(1),
+
+  /// A MotionPhoto_Data block in the SEF trailer
+  THINPIC_MOTION_SAMSUNG(2);
+
+  final int value;
+  const ThinpicMotionKind(this.value);
+
+  static ThinpicMotionKind fromValue(int value) => switch (value) {
+    0 => THINPIC_MOTION_NONE,
+    1 => THINPIC_MOTION_GOOGLE,
+    2 => THINPIC_MOTION_SAMSUNG,
+    _ => throw ArgumentError("Unknown value for ThinpicMotionKind: $value"),
+  };
+}
+
+final class ThinpicMotionPhoto extends ffi.Struct {
+  @ffi.UnsignedInt()
+  external int kindAsInt;
+
+  ThinpicMotionKind get kind => ThinpicMotionKind.fromValue(kindAsInt);
+
+  /// Bytes of the JPEG still; the trailer starts here
+  @ffi.Int64()
+  external int still_length;
+
+  /// From there to the end of the file: what THINPIC_MOTION_VIDEO_KEEP copies
+  @ffi.Int64()
+  external int trailer_length;
+
+  /// The MP4 itself
+  @ffi.Int64()
+  external int video_offset;
+
+  @ffi.Int64()
+  external int video_length;
+}
+
+enum ThinpicPyramidLayout {
+  /// One tiled pyramidal TIFF at output_path (BigTIFF past 4 GB of pixels)
+  THINPIC_PYRAMID_TIFF(0),
+
+  /// <output_path>.dzi and <output_path>_files/; needs libvips with dzsave
+  THINPIC_PYRAMID_DEEPZOOM(1);
+
+  final int value;
+  const ThinpicPyramidLayout(this.value);
+
+  static ThinpicPyramidLayout fromValue(int value) => switch (value) {
+    0 => THINPIC_PYRAMID_TIFF,
+    1 => THINPIC_PYRAMID_DEEPZOOM,
+    _ => throw ArgumentError("Unknown value for ThinpicPyramidLayout: $value"),
+  };
+}
+
+/// Per-operation profile of one job (compress_with_profile): which libvips
+/// operations it built, how many regions each computed and how long they
+/// took, slowest first. An operation's time is its own pixel code, without
+/// the time spent computing its inputs on the same thread; encoders run
+/// inside their saver's build and are timed by CompressionStats encode_us
+/// instead. Operations past THINPIC_PROFILE_MAX_OPS - 1 are summed under
+/// "(other)".
+const int THINPIC_PROFILE_MAX_OPS = 32;
+
+const int THINPIC_PROFILE_MAX_THREADS = 16;
+
+final class ThinpicProfileOp extends ffi.Struct {
+  /// libvips nickname, e.g. "resize", "colourspace"
+  @ffi.Array.multi([32])
+  external ffi.Array<ffi.Char> name;
+
+  /// Times the operation was built
+  @ffi.Int()
+  external int calls;
+
+  /// Regions its output computed
+  @ffi.Int64()
+  external int regions;
+
+  /// Own time over every thread
+  @ffi.Int64()
+  external int time_us;
+
+  /// Pixels in those regions
+  @ffi.Int64()
+  external int pixels;
+}
+
+final class ThinpicProfile extends ffi.Struct {
+  @ffi.Int()
+  external int op_count;
+
+  @ffi.Array.multi([32])
+  external ffi.Array<ThinpicProfileOp> ops;
+
+  /// Threads that computed pixels, up to the max
+  @ffi.Int()
+  external int thread_count;
+
+  @ffi.Array.multi([16])
+  external ffi.Array<ffi.Int64> thread_busy_us;
 }
 
 final class ImageInfoData extends ffi.Struct {
@@ -400,3 +4595,116 @@ final class ImageInfoData extends ffi.Struct {
   @ffi.Int()
   external int new_height;
 }
+
+/// Header-only probe result; no pixels are decoded
+final class ImageHeader extends ffi.Struct {
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  @ffi.Int()
+  external int bands;
+
+  /// EXIF orientation 1-8, 0 when absent
+  @ffi.Int()
+  external int orientation;
+
+  /// ImageFormat of the source, FORMAT_AUTO when it is none of ours
+  @ffi.Int()
+  external int format;
+
+  /// Bytes on disk
+  @ffi.Int64()
+  external int file_size;
+
+  @ffi.Int()
+  external int success;
+}
+
+/// Gallery index entry (thinpic_index_images), from the container headers
+/// and EXIF alone
+final class ThinpicImageMeta extends ffi.Struct {
+  /// As stored; HEIF and AVIF after their irot, already upright
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// EXIF orientation 1-8, 0 when absent
+  @ffi.Int()
+  external int orientation;
+
+  /// ImageFormat of the source, FORMAT_AUTO when it is none of ours
+  @ffi.Int()
+  external int format;
+
+  /// Bytes on disk
+  @ffi.Int64()
+  external int file_size;
+
+  /// DateTimeOriginal, else DateTime, as seconds since 1970 on the camera's
+  /// own clock (EXIF has no time zone); -1 when absent
+  @ffi.Int64()
+  external int capture_time;
+
+  /// 1 when the EXIF carries a GPS position
+  @ffi.Int()
+  external int has_gps;
+
+  /// 1, or -1 when the file cannot be read
+  @ffi.Int()
+  external int success;
+}
+
+/// Predicted result of one compression, from the header alone
+/// (thinpic_estimate_output); nothing is decoded
+final class ThinpicEstimate extends ffi.Struct {
+  /// Predicted output size; typically within some tens of percent
+  @ffi.Int64()
+  external int bytes;
+
+  /// Predicted wall time on this device (throughput model)
+  @ffi.Double()
+  external double encode_ms;
+
+  /// Peak memory, as the pool's memory budget charges it
+  @ffi.Int64()
+  external int working_set_bytes;
+
+  /// Output dimensions once fitted to the box
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// Encoded bits per source pixel
+  @ffi.Double()
+  external double source_bpp;
+
+  @ffi.Int()
+  external int success;
+}
+
+final class ExifThumbnail extends ffi.Struct {
+  external ffi.Pointer<ffi.Uint8> data;
+
+  @ffi.Size()
+  external int length;
+
+  @ffi.Int()
+  external int width;
+
+  @ffi.Int()
+  external int height;
+
+  /// EXIF orientation 1-8 of the main image, 0 when absent
+  @ffi.Int()
+  external int orientation;
+
+  @ffi.Int()
+  external int success;
+}
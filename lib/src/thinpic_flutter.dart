@@ -2,147 +2,2941 @@
 
 // ignore_for_file: unused_element
 
+import 'dart:async';
 import 'dart:io';
+import 'dart:typed_data';
+import 'dart:ui' as ui;
 
 import 'package:flutter/foundation.dart' show debugPrint, compute;
-import 'package:path_provider/path_provider.dart' show getTemporaryDirectory;
+import 'package:flutter/services.dart' show MethodChannel;
+import 'package:path_provider/path_provider.dart'
+    show getApplicationSupportDirectory, getTemporaryDirectory;
 import 'package:thinpic_flutter/generated/thinpic_flutter_bindings_generated.dart';
 
 import 'package:thinpic_flutter/src/file_types.dart';
 import 'package:thinpic_flutter/src/thinpic_flutter_ffi_functions.dart'
     show
-        compressImageWithFormat,
-        compressImageWithSizeAndFormat,
-        compressLargeImageWithFormat,
-        compressLargeDslrImageWithFormat,
-        smartCompressImageWithFormat,
-        autoCompressImage,
-        fastWebPCompress,
-        isCompressionSuccessful,
-        compressedResultToBytes,
-        getImageInfo;
-
-// Isolate functions for each compression operation
-Future<dynamic> _compressImageIsolate(Map<String, dynamic> params) async {
-  return compressImageWithFormat(
+        CompressionCancelToken,
+        runCompressionJobToFile,
+        runCompressionJobToFileWithInfo,
+        runCompressionJobsToFiles,
+        runCompressionJobsToFilesWithInfo,
+        runCompressionJobsFromStream,
+        ImageSource,
+        compressDirectoryResumable,
+        syncDirectoryIncremental,
+        readBackgroundBatch,
+        stopBackgroundBatchRun,
+        BackgroundBatchStatus,
+        runCompressionJobFromBytes,
+        runCompressionJobToNativeBuffer,
+        releaseNativeBufferHandle,
+        runCompressionJobFromFd,
+        measureCompressionJob,
+        profileCompressionJob,
+        CompressionProfile,
+        ProfiledOperation,
+        streamCompressedChunks,
+        compressWithOptions,
+        compressWithinBudget,
+        BudgetedCompression,
+        compressWithHash,
+        HashedCompression,
+        DominantColour,
+        perceptualHashDistance,
+        groupPerceptualHashes,
+        compressWithOperations,
+        writeImagePyramid,
+        compressPages,
+        writePagesTiff,
+        ImageOperation,
+        encodeRawJpeg,
+        encodeRawPng,
+        compressPixels,
+        decodeThumbnailPixels,
+        compareImages,
+        ImageQuality,
+        encodeYuv420Jpeg,
+        YuvPlane,
+        compressImageVariants,
+        contactSheet,
+        ImageVariant,
+        openImageHandle,
+        imageHandleInfo,
+        compressImageHandle,
+        compressImageHandleVariants,
+        closeImageHandle,
+        openImageStream,
+        writeImageStream,
+        finishImageStream,
+        freeImageStream,
+        compressImageStream,
+        getImageInfo,
+        probeImageHeader,
+        probeImageHeaders,
+        indexImages,
+        probePageCount,
+        probeMotionPhoto,
+        MotionPhotoInfo,
+        estimateOutput,
+        extractExifThumbnail,
+        EmbeddedThumbnail,
+        rewriteImageMetadata,
+        rewriteImageMetadataBytes,
+        setExecutionMode,
+        getExecutionMode,
+        setNativeLogLevel,
+        setNativeTracing,
+        setSizeCurveCacheDirectory,
+        setThroughputModelDirectory,
+        getThroughput,
+        isJpegExtensionsAvailable,
+        isJxlTranscodeAvailable,
+        setOutputCacheDirectory,
+        setSpillDirectory,
+        drainTelemetryRecords,
+        loadCompressionPresets,
+        compressionPresetId,
+        configureRuntime,
+        getRuntimeStats,
+        dropNativeOperationCache,
+        setNativePowerSave,
+        notifyNativeMemoryPressure,
+        prewarmNative;
+
+// Isolate function for the image info lookup
+Future<dynamic> _getImageInfoIsolate(Map<String, dynamic> params) async {
+  return getImageInfo(params['imagePath'] as String);
+}
+
+// Isolate function for thinpic_index_images
+Future<List<ThinpicImageMeta>> _indexImagesIsolate(Map<String, dynamic> params) async {
+  return indexImages(params['imagePaths'] as List<String>);
+}
+
+// Isolate function for compress_directory
+Future<int> _compressDirectoryIsolate(Map<String, dynamic> params) async {
+  return compressDirectoryResumable(
+    params['source'] as String,
+    params['outputDirectory'] as String,
+    params['manifestPath'] as String,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    targetWidth: params['targetWidth'] as int,
+    targetHeight: params['targetHeight'] as int,
+    priority: params['priority'] as ThinpicPriority,
+  );
+}
+
+// Isolate function for sync_directory
+Future<int> _syncDirectoryIsolate(Map<String, dynamic> params) async {
+  return syncDirectoryIncremental(
+    params['source'] as String,
+    params['outputDirectory'] as String,
+    params['indexPath'] as String,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    targetWidth: params['targetWidth'] as int,
+    targetHeight: params['targetHeight'] as int,
+    priority: params['priority'] as ThinpicPriority,
+  );
+}
+
+// Isolate function for compress_image_to_pyramid
+Future<int> _writeImagePyramidIsolate(Map<String, dynamic> params) async {
+  return writeImagePyramid(
     params['imagePath'] as String,
-    params['quality'] as int,
-    params['format'] as ImageFormat,
+    params['outputPath'] as String,
+    layout: params['layout'] as ThinpicPyramidLayout,
+    quality: params['quality'] as int,
+    tileSize: params['tileSize'] as int,
   );
 }
 
-Future<dynamic> _getImageInfoIsolate(Map<String, dynamic> params) async {
-  return getImageInfo(params['imagePath'] as String);
+// Isolate function for compress_pages; a count of 0 runs to the last page
+Future<List<Uint8List?>> _compressPagesIsolate(
+  Map<String, dynamic> params,
+) async {
+  final imagePath = params['imagePath'] as String;
+  final firstPage = params['firstPage'] as int;
+  var count = params['count'] as int;
+  if (count <= 0) {
+    count = probePageCount(imagePath) - firstPage;
+  }
+  return compressPages(
+    imagePath,
+    firstPage: firstPage,
+    count: count,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    targetWidth: params['targetWidth'] as int,
+    targetHeight: params['targetHeight'] as int,
+    priority: params['priority'] as ThinpicPriority,
+  );
+}
+
+// Isolate function for compress_pages_to_tiff
+Future<int> _writePagesTiffIsolate(Map<String, dynamic> params) async {
+  return writePagesTiff(
+    params['imagePath'] as String,
+    params['outputPath'] as String,
+    firstPage: params['firstPage'] as int,
+    count: params['count'] as int,
+    quality: params['quality'] as int,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+  );
+}
+
+// Isolate function for thinpic_compress with a latency budget
+Future<BudgetedCompression?> _compressWithinBudgetIsolate(
+  Map<String, dynamic> params,
+) async {
+  return compressWithinBudget(
+    params['imagePath'] as String,
+    params['latencyBudgetMs'] as int,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    effort: params['effort'] as int,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+    strip: params['strip'] as ThinpicStripPolicy,
+  );
+}
+
+// Isolate function for compress_with_profile
+Future<CompressionProfile?> _profileCompressionIsolate(
+  Map<String, dynamic> params,
+) async {
+  return profileCompressionJob(
+    params['imagePath'] as String,
+    quality: params['quality'] as int,
+    targetWidth: params['targetWidth'] as int,
+    targetHeight: params['targetHeight'] as int,
+    format: params['format'] as ImageFormat,
+  );
 }
 
-Future<dynamic> _compressImageWithSizeAndFormatIsolate(
+// Isolate function for thinpic_compress with a perceptual hash
+Future<HashedCompression?> _compressWithHashIsolate(
   Map<String, dynamic> params,
 ) async {
-  return compressImageWithSizeAndFormat(
+  return compressWithHash(
     params['imagePath'] as String,
-    params['quality'] as int,
-    params['targetWidth'] as int,
-    params['targetHeight'] as int,
-    params['format'] as ImageFormat,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    effort: params['effort'] as int,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+    strip: params['strip'] as ThinpicStripPolicy,
+    perceptualHash: params['perceptualHash'] as bool,
+    placeholder: params['placeholder'] as ThinpicPlaceholder,
+    analyse: params['analyse'] as bool,
+    paletteColours: params['paletteColours'] as int,
+    tensorWidth: params['tensorWidth'] as int,
+    tensorHeight: params['tensorHeight'] as int,
+    tensorType: params['tensorType'] as ThinpicTensorType,
+    tensorMean: params['tensorMean'] as List<double>,
+    tensorStd: params['tensorStd'] as List<double>,
+  );
+}
+
+// Isolate functions for ThinPicImage
+Future<int> _openImageHandleIsolate(String imagePath) async {
+  return openImageHandle(imagePath);
+}
+
+Future<Uint8List?> _compressImageHandleIsolate(
+  Map<String, dynamic> params,
+) async {
+  return compressImageHandle(
+    params['handle'] as int,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    effort: params['effort'] as int,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+    strip: params['strip'] as ThinpicStripPolicy,
+  );
+}
+
+Future<List<Uint8List?>?> _compressImageHandleVariantsIsolate(
+  Map<String, dynamic> params,
+) async {
+  return compressImageHandleVariants(
+    params['handle'] as int,
+    params['variants'] as List<ImageVariant>,
   );
 }
 
-Future<dynamic> _compressLargeImageWithFormatIsolate(
+// Isolate function for thinpic_compress_ops
+Future<Uint8List?> _compressWithOperationsIsolate(
   Map<String, dynamic> params,
 ) async {
-  return compressLargeImageWithFormat(
+  return compressWithOperations(
     params['imagePath'] as String,
-    params['quality'] as int,
-    params['format'] as ImageFormat,
+    params['operations'] as List<ImageOperation>,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    effort: params['effort'] as int,
+    kernel: params['kernel'] as ThinpicKernel,
+    strip: params['strip'] as ThinpicStripPolicy,
+    threads: params['threads'] as int,
   );
 }
 
-Future<dynamic> _compressLargeDslrImageWithFormatIsolate(
+// Isolate function for thinpic_compress
+Future<Uint8List?> _compressWithOptionsIsolate(
   Map<String, dynamic> params,
 ) async {
-  return compressLargeDslrImageWithFormat(
+  return compressWithOptions(
     params['imagePath'] as String,
-    params['quality'] as int,
-    params['format'] as ImageFormat,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    effort: params['effort'] as int,
+    kernel: params['kernel'] as ThinpicKernel,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+    strip: params['strip'] as ThinpicStripPolicy,
+    threads: params['threads'] as int,
+    webpProfile: params['webpProfile'] as ThinpicWebpProfile,
+    webpSharpYuv: params['webpSharpYuv'] as bool?,
+    alphaQuality: params['alphaQuality'] as int,
+    progressive: params['progressive'] as bool,
+    scanScript: params['scanScript'] as ThinpicScanScript,
+    scans: params['scans'] as List<ProgressiveScan>,
+    animated: params['animated'] as bool,
+    pngPalette: params['pngPalette'] as ThinpicPngPalette,
+    pngBitDepth: params['pngBitDepth'] as int,
+    dither: params['dither'] as int,
+    pngDeflate: params['pngDeflate'] as ThinpicPngDeflate,
+    gifColours: params['gifColours'] as int,
+    gifInterframe: params['gifInterframe'] as int,
+    minSsim: params['minSsim'] as double,
+    crop: params['crop'] as ThinpicCrop,
+    latencyBudgetMs: params['latencyBudgetMs'] as int,
+    heifCompression: params['heifCompression'] as ThinpicHeifCompression,
+    heifSubsample: params['heifSubsample'] as ThinpicSubsample,
+    jxlDistance: params['jxlDistance'] as double,
+    jxlLosslessJpeg: params['jxlLosslessJpeg'] as bool,
+    jpegTrellis: params['jpegTrellis'] as bool?,
+    jpegOvershootDeringing: params['jpegOvershootDeringing'] as bool?,
+    jpegOptimizeScans: params['jpegOptimizeScans'] as bool?,
+    jpegQuantTable: params['jpegQuantTable'] as ThinpicQuantTable,
+    watermarkPath: params['watermarkPath'] as String?,
+    watermarkGravity: params['watermarkGravity'] as ThinpicGravity,
+    watermarkMargin: params['watermarkMargin'] as int,
+    watermarkWidth: params['watermarkWidth'] as double,
+    watermarkOpacity: params['watermarkOpacity'] as double,
+    motionVideo: params['motionVideo'] as ThinpicMotionVideo,
+    gainMap: params['gainMap'] as ThinpicGainMap,
+    outputPath: params['outputPath'] as String?,
+  );
+}
+
+// Isolate function for the raw pixel PNG encoder
+Future<Uint8List?> _encodeRawPngIsolate(Map<String, dynamic> params) async {
+  return encodeRawPng(
+    params['pixels'] as Uint8List,
+    params['width'] as int,
+    params['height'] as int,
+    channels: params['channels'] as int,
+    stride: params['stride'] as int,
+    premultiplied: params['premultiplied'] as bool,
+    compressionLevel: params['compressionLevel'] as int,
+  );
+}
+
+// Isolate function for raw pixels through the full pipeline
+Future<Uint8List?> _compressPixelsIsolate(Map<String, dynamic> params) async {
+  return compressPixels(
+    params['pixels'] as Uint8List,
+    params['width'] as int,
+    params['height'] as int,
+    pixelFormat: params['pixelFormat'] as ThinpicPixelFormat,
+    stride: params['stride'] as int,
+    premultiplied: params['premultiplied'] as bool,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
   );
 }
 
-Future<dynamic> _smartCompressImageWithFormatIsolate(
+// Isolate function for the display decode
+Future<({Uint8List pixels, int width, int height})?> _decodeThumbnailIsolate(
   Map<String, dynamic> params,
 ) async {
-  return smartCompressImageWithFormat(
+  return decodeThumbnailPixels(
     params['imagePath'] as String,
-    params['targetKb'] as int,
-    params['type'] as int,
-    params['format'] as ImageFormat,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+  );
+}
+
+// Isolate function for thinpic_compress on a stream
+Future<Uint8List?> _compressImageStreamIsolate(
+  Map<String, dynamic> params,
+) async {
+  return compressImageStream(
+    params['stream'] as int,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
+    effort: params['effort'] as int,
+    maxWidth: params['maxWidth'] as int,
+    maxHeight: params['maxHeight'] as int,
+    strip: params['strip'] as ThinpicStripPolicy,
+  );
+}
+
+// Isolate function for thinpic_compare
+Future<ImageQuality?> _compareImagesIsolate(Map<String, dynamic> params) async {
+  return compareImages(
+    params['referencePath'] as String,
+    params['candidatePath'] as String,
+    analysisPixels: params['analysisPixels'] as int,
+    threads: params['threads'] as int,
+  );
+}
+
+// Isolate function for the raw pixel JPEG encoder
+Future<Uint8List?> _encodeRawJpegIsolate(Map<String, dynamic> params) async {
+  return encodeRawJpeg(
+    params['pixels'] as Uint8List,
+    params['width'] as int,
+    params['height'] as int,
+    pixelFormat: params['pixelFormat'] as ThinpicPixelFormat,
+    pitch: params['pitch'] as int,
+    quality: params['quality'] as int,
   );
 }
 
-Future<dynamic> _autoCompressImageIsolate(Map<String, dynamic> params) async {
-  return autoCompressImage(
+// Isolate function for the YUV camera frame encoder
+Future<Uint8List?> _encodeYuv420JpegIsolate(Map<String, dynamic> params) async {
+  return encodeYuv420Jpeg(
+    params['y'] as YuvPlane,
+    params['u'] as YuvPlane,
+    params['v'] as YuvPlane,
+    params['width'] as int,
+    params['height'] as int,
+    quality: params['quality'] as int,
+  );
+}
+
+// Isolate function for the multi-size encoder
+Future<List<Uint8List?>?> _compressImageVariantsIsolate(
+  Map<String, dynamic> params,
+) async {
+  return compressImageVariants(
     params['imagePath'] as String,
-    params['quality'] as int,
+    params['variants'] as List<ImageVariant>,
+  );
+}
+
+// Isolate function for thinpic_contact_sheet
+Future<ContactSheet?> _contactSheetIsolate(Map<String, dynamic> params) async {
+  return contactSheet(
+    params['imagePaths'] as List<String>,
+    cellWidth: params['cellWidth'] as int,
+    cellHeight: params['cellHeight'] as int,
+    columns: params['columns'] as int,
+    spacing: params['spacing'] as int,
+    format: params['format'] as ImageFormat,
+    quality: params['quality'] as int,
   );
 }
 
-Future<dynamic> _fastWebPCompressIsolate(Map<String, dynamic> params) async {
-  return fastWebPCompress(
-    params['imagePath'] as String,
-    params['quality'] as int,
-  );
-}
+/// One finished item of [ThinPicCompress.compressBatchStream].
+class CompressedBatchItem {
+  const CompressedBatchItem(this.index, this.file);
+
+  /// Position of the source in the list passed to compressBatchStream
+  final int index;
+
+  /// The compressed image, or null if this item failed
+  final File? file;
+}
+
+/// One finished item of [ThinPicCompress.compressAll].
+class CompressionResult {
+  const CompressionResult(this.index, this.source, {this.bytes, this.file});
+
+  /// Position of the source in the stream passed to compressAll
+  final int index;
+
+  final ImageSource source;
+
+  /// The encoded image, for sources without an output path
+  final Uint8List? bytes;
+
+  /// The written image, for sources with one
+  final File? file;
+
+  /// False if this item failed
+  bool get succeeded => bytes != null || file != null;
+}
+
+/// A preview drawn by [ThinPicCompress.createPreviewTexture]: the Flutter
+/// texture id and the size of the image in it.
+typedef PreviewTexture = ({int textureId, int width, int height});
+
+class ThinPicCompress {
+  /// How native compressions are scheduled.
+  ///
+  /// [ExecutionMode.EXECUTION_MODE_CONCURRENT] (the default) lets calls made
+  /// from different isolates run in parallel across cores.
+  /// [ExecutionMode.EXECUTION_MODE_SERIAL] runs one compression at a time.
+  static ExecutionMode get executionMode => getExecutionMode();
+
+  static set executionMode(ExecutionMode mode) => setExecutionMode(mode);
+
+  /// Limits native memory and threading; call once at startup on low-RAM
+  /// devices.
+  ///
+  /// [memoryBudgetMb] - estimated working set the worker pool may run at
+  /// once; further jobs wait until memory frees up (0 = unlimited)
+  /// [cacheMaxMemMb] - libvips operation cache memory ceiling
+  /// [cacheMaxOperations] - libvips operation cache size (0 disables it)
+  /// [threadsPerImage] - libvips worker threads per image (0 = default)
+  /// [mmapInputMinMb] - memory-map input files of at least this size instead
+  /// of reading them through buffered I/O (0 = never, the default)
+  /// [skipCompliant] - return the original file unchanged when it already
+  /// has the requested format and is within the target size (sized
+  /// compression) or target KB (smart compression), read from the header
+  /// and file size alone, and only while [metadataPolicy] keeps everything;
+  /// off by default
+  /// [metadataPolicy] - metadata written by every method except
+  /// [compressWithOptions] (which takes `strip`): keep everything (the
+  /// default), keep only the colour profile, or strip all. Both stripping
+  /// policies rotate the pixels upright first and drop EXIF with its
+  /// embedded preview, plus XMP and IPTC
+  /// [thermalScaling] - while the device reports moderate thermal status or
+  /// above (Android 11+), or [powerSaveMode] is set, run half as many pool
+  /// jobs at once (a quarter when severe, one when critical) and lower
+  /// WebP effort and PNG compression level, so long batches throttle less;
+  /// off by default
+  /// [gpuResizeMinMp] - Lanczos3 downscales of images of at least this many
+  /// megapixels run as GLES 3.1 compute passes when the GPU is free, falling
+  /// back to the CPU otherwise (0 = never, the default)
+  /// [resizeQuality] - how much of each downscale is an integer box shrink
+  /// before the resize kernel runs on the rest: fast shrinks to under 2x
+  /// the output, balanced (the default) to 2-4x, best to 4-8x
+  /// [flattenBackground] - 0xRRGGBB colour that transparent pixels are
+  /// flattened onto for JPEG output (white by default)
+  /// [handleCacheMb] - largest decoded image a [ThinPicImage] keeps in
+  /// memory between calls (0 = none, 64 by default)
+  /// [decodeCacheMb] - memory for decoded, resized images kept across calls
+  /// of the fixed-preset methods, least recently used first out, so
+  /// re-encoding the same file at the same size with another quality or
+  /// format skips the decode (0 = none, the default)
+  /// [losslessOrientation] - with a stripping [metadataPolicy], turn JPEGs
+  /// that stay at full size upright by moving their DCT blocks before the
+  /// decode instead of rotating the decoded pixels, which for 90 degree
+  /// orientations means holding the whole image in memory; a partial block
+  /// on a mirrored edge is trimmed (under 16 px). Off by default
+  /// [ditherHighDepth] - 16-bit inputs written as JPEG, WebP or GIF are
+  /// narrowed to 8 bits with a 4x4 ordered dither instead of rounding, which
+  /// keeps smooth gradients from banding. Off by default
+  /// [oneShotCache] - the libvips operation cache keeps nothing while no
+  /// [ThinPicImage] is open, so one-off compressions do not leave decoded
+  /// pixels pinned; while one is, [cacheMaxOperations] applies. Off by
+  /// default
+  /// [adaptiveQuality] - size-targeted JPEG and WebP compression (smart
+  /// compression, `targetKb`) softens flat regions such as sky before
+  /// searching, so faces, text and edges keep more detail at the same size.
+  /// Off by default
+  /// [discThresholdMb] - images held whole in memory for a search, rotation
+  /// or palette pass that are larger than this are written to a temp file
+  /// instead (see [enableDiskSpill]); 0 (the default) picks a quarter of
+  /// [memoryBudgetMb] when one is set and never spills otherwise
+  /// [jpegStripEncode] - large and DSLR JPEG compression of 8 MP or more
+  /// encodes horizontal strips on parallel threads and joins them into one
+  /// file, several times faster on multi-core devices; the standard Huffman
+  /// tables it needs make files a few percent larger. Off by default
+  /// [maxInputMegapixels] - inputs whose header declares more pixels (all
+  /// frames of an animation) fail at once with
+  /// [ThinpicErrorCode.THINPIC_ERROR_LIMIT] instead of being decoded; 0 (the
+  /// default) is unlimited
+  /// [maxInputBands] - the same for inputs with more bands
+  /// [jobTimeoutMs] - compressions still running after this many
+  /// milliseconds are stopped and fail with
+  /// [ThinpicErrorCode.THINPIC_ERROR_TIMEOUT], so one bad file cannot hold a
+  /// worker; 0 (the default) sets no limit
+  /// [platformDecode] - HEIC, HEIF and AVIF inputs are decoded by the
+  /// platform's image decoder (Android 11+, hardware HEVC where the device
+  /// has it) even when libvips could decode them in software. Without it the
+  /// platform decoder is used only when libvips has no HEIF support, as in
+  /// the bundled Android build. EXIF and ICC metadata of such inputs are not
+  /// carried over
+  /// [coefficientSearch] - smart compression to JPEG of a JPEG that needs no
+  /// resize, rotation or colour conversion tries each quality on the
+  /// source's own DCT coefficients, so a probe costs one entropy-coding pass
+  /// instead of a full decode and encode; the source's chroma subsampling
+  /// is kept. Off by default
+  /// [deterministic] - the same input and options always give the same
+  /// bytes, whatever the thread count, thermal state or timing, so
+  /// content-addressed caches and server-side dedupe see one file. Latency
+  /// budgets and thermal scaling then leave the settings alone, GPU resizes
+  /// and strip-parallel JPEG encodes are skipped, and auto mode waits for
+  /// every format instead of taking the first one under its size. Off by
+  /// default
+  ///
+  /// Arguments left at -1 (or null) keep their current value. Returns true
+  /// on success.
+  /// example:
+  /// ```dart
+  /// ThinPicCompress.configure(memoryBudgetMb: 512, cacheMaxMemMb: 32);
+  /// ```
+  static bool configure({
+    int memoryBudgetMb = -1,
+    int cacheMaxMemMb = -1,
+    int cacheMaxOperations = -1,
+    int threadsPerImage = -1,
+    int mmapInputMinMb = -1,
+    bool? skipCompliant,
+    ThinpicStripPolicy? metadataPolicy,
+    bool? thermalScaling,
+    int gpuResizeMinMp = -1,
+    ThinpicResizeQuality? resizeQuality,
+    int flattenBackground = -1,
+    int handleCacheMb = -1,
+    int decodeCacheMb = -1,
+    bool? losslessOrientation,
+    bool? ditherHighDepth,
+    bool? oneShotCache,
+    bool? adaptiveQuality,
+    int discThresholdMb = -1,
+    bool? jpegStripEncode,
+    int maxInputMegapixels = -1,
+    int maxInputBands = -1,
+    int jobTimeoutMs = -1,
+    bool? platformDecode,
+    bool? coefficientSearch,
+    bool? deterministic,
+  }) {
+    return configureRuntime(
+      memoryBudgetMb: memoryBudgetMb,
+      cacheMaxMemMb: cacheMaxMemMb,
+      cacheMaxOperations: cacheMaxOperations,
+      threadsPerImage: threadsPerImage,
+      mmapInputMinMb: mmapInputMinMb,
+      skipCompliant: skipCompliant,
+      metadataPolicy: metadataPolicy,
+      thermalScaling: thermalScaling,
+      gpuResizeMinMp: gpuResizeMinMp,
+      resizeQuality: resizeQuality,
+      flattenBackground: flattenBackground,
+      handleCacheMb: handleCacheMb,
+      decodeCacheMb: decodeCacheMb,
+      losslessOrientation: losslessOrientation,
+      ditherHighDepth: ditherHighDepth,
+      oneShotCache: oneShotCache,
+      adaptiveQuality: adaptiveQuality,
+      discThresholdMb: discThresholdMb,
+      jpegStripEncode: jpegStripEncode,
+      maxInputMegapixels: maxInputMegapixels,
+      maxInputBands: maxInputBands,
+      jobTimeoutMs: jobTimeoutMs,
+      platformDecode: platformDecode,
+      coefficientSearch: coefficientSearch,
+      deterministic: deterministic,
+    );
+  }
+
+  /// Starts libvips on a native background thread, so the first compression
+  /// does not pay for library startup on the critical path. Call it early,
+  /// for example in `main()` or the first screen's `initState`; it returns
+  /// immediately.
+  ///
+  /// [warmOperations] - also run the JPEG, PNG and WebP encoders and
+  /// decoders and the resize path once on a tiny image
+  ///
+  /// A compression that starts before the warm-up is done only waits for
+  /// the library itself to be ready. Returns false if the thread could not
+  /// be started; compressions then initialize on first use as before.
+  static bool prewarm({bool warmOperations = true}) =>
+      prewarmNative(warmOperations: warmOperations);
+
+  /// Current native resource usage: libvips operation cache size and
+  /// limits, libvips tracked memory (current and high-water), live
+  /// allocations and open files, and worker pool threads, running and
+  /// queued jobs. Cheap enough to poll, for example before queueing a large
+  /// batch or to check that a long session is not growing the cache.
+  static ThinpicRuntimeStats get runtimeStats => getRuntimeStats();
+
+  /// Evicts every idle operation from the libvips operation cache, releasing
+  /// the images and buffers it keeps alive. The cache keeps its limits from
+  /// [configure] and refills as new work runs.
+  static void dropOperationCache() => dropNativeOperationCache();
+
+  /// Tells thermal scaling (see [configure]) whether battery saver is on. The
+  /// native side cannot read it, so forward `PowerManager.isPowerSaveMode`,
+  /// for example from a battery plugin's stream. While set, pool jobs run as
+  /// on a moderately hot device.
+  static set powerSaveMode(bool enabled) => setNativePowerSave(enabled);
+
+  /// Frees the native caches (operations, cached decodes, encode buffers)
+  /// under memory pressure. At
+  /// [ThinpicMemoryPressure.THINPIC_MEMORY_PRESSURE_CRITICAL], queued
+  /// background jobs also wait until 10 s after the last critical call, or
+  /// until [ThinpicMemoryPressure.THINPIC_MEMORY_PRESSURE_NORMAL] is sent.
+  /// Android forwards `onTrimMemory` here on its own. On other platforms,
+  /// call it from the app's memory warning (`didHaveMemoryPressure`).
+  static void onMemoryPressure(ThinpicMemoryPressure level) =>
+      notifyNativeMemoryPressure(level);
+
+  /// Native log verbosity (logcat on Android).
+  ///
+  /// Only levels compiled into the native library can be enabled; release
+  /// builds keep errors only unless built with a higher `THINPIC_LOG_LEVEL`.
+  static set nativeLogLevel(ThinpicLogLevel level) => setNativeLogLevel(level);
+
+  /// Native trace sections in Android system traces (Perfetto, systrace).
+  ///
+  /// When true, each decode, resize, colour conversion and copy, every
+  /// smart/auto/SSIM search encode and every pool job shows up as a slice on
+  /// the native thread that ran it. Sections are only written while a trace
+  /// is recording. Needs Android 6.0 (API 23); elsewhere this does nothing.
+  static set nativeTracing(bool enabled) => setNativeTracing(enabled);
+
+  /// Remembers the quality/size samples measured by target-size compression
+  /// ([CompressMode.COMPRESS_MODE_SMART]), so compressing the same original
+  /// again (a retry, another target size) skips straight to the right
+  /// quality. Inputs are recognised by a hash of their first 64 KB and size.
+  ///
+  /// [directory] - where the cache file lives; defaults to a folder in the
+  /// app's temporary directory, which the OS may clear
+  /// [enabled] - false turns the cache off again
+  static Future<void> enableSizeCurveCache({
+    String? directory,
+    bool enabled = true,
+  }) async {
+    if (!enabled) {
+      setSizeCurveCacheDirectory(null);
+      return;
+    }
+    final cacheDirectory = Directory(
+      directory ?? '${(await getTemporaryDirectory()).path}/thinpic_curves',
+    );
+    await cacheDirectory.create(recursive: true);
+    setSizeCurveCacheDirectory(cacheDirectory.path);
+  }
+
+  /// Keeps this device's measured encode and decode throughput across
+  /// launches. Every plain [compressWithOptions] call and every decode of
+  /// the search modes update rolling per-format averages, which latency
+  /// budgets ([compressWithinBudget]) plan with and [throughput] reports;
+  /// with this enabled they are loaded now and written back every 16
+  /// measurements instead of starting from built-in figures each launch.
+  ///
+  /// [directory] - where the model file lives; defaults to a folder in the
+  /// app's support directory, which the OS does not clear
+  /// [enabled] - false keeps the model in memory only again
+  static Future<void> enableThroughputModel({
+    String? directory,
+    bool enabled = true,
+  }) async {
+    if (!enabled) {
+      setThroughputModelDirectory(null);
+      return;
+    }
+    final modelDirectory = Directory(
+      directory ??
+          '${(await getApplicationSupportDirectory()).path}/thinpic_throughput',
+    );
+    await modelDirectory.create(recursive: true);
+    setThroughputModelDirectory(modelDirectory.path);
+  }
+
+  /// What [format] at [effort] (-1 = the encoder default) costs on this
+  /// device: ms per output megapixel for a whole compression, ms per decoded
+  /// megapixel for decoding that format, and how many calls each rate is
+  /// learned from (0 = still the built-in estimate). Cheap enough to call
+  /// before choosing a format or size; null for [ImageFormat.FORMAT_AUTO].
+  static ThinpicThroughput? throughput(ImageFormat format, {int effort = -1}) =>
+      getThroughput(format, effort);
+
+  /// Keeps compressed outputs on disk, so compressing the same image with
+  /// the same options again (re-sharing a photo) returns the stored bytes
+  /// without decoding anything. Entries are keyed by a hash of the whole
+  /// input and the options, and the least recently used are deleted once
+  /// the cache grows past [maxBytes]. Every file, bytes and batch method and
+  /// [compressWithOptions] go through it.
+  ///
+  /// [directory] - where the entries live; defaults to a folder in the app's
+  /// temporary directory, which the OS may clear
+  /// [maxBytes] - size budget of the cache, 64 MB by default
+  /// [enabled] - false turns the cache off again (the files stay)
+  static Future<void> enableOutputCache({
+    String? directory,
+    int maxBytes = 64 * 1024 * 1024,
+    bool enabled = true,
+  }) async {
+    if (!enabled) {
+      setOutputCacheDirectory(null, 0);
+      return;
+    }
+    final cacheDirectory = Directory(
+      directory ?? '${(await getTemporaryDirectory()).path}/thinpic_outputs',
+    );
+    await cacheDirectory.create(recursive: true);
+    setOutputCacheDirectory(cacheDirectory.path, maxBytes);
+  }
+
+  /// Lets large intermediate images go to disk instead of memory. The
+  /// target-size searches, 90 degree rotations and palette passes hold the
+  /// whole decoded image, 300 MB for a 100 MP scan; above [thresholdMb] it
+  /// is written to an uncompressed temp file that the OS pages in and out,
+  /// and deleted when the compression ends. Call it before compressing: the
+  /// directory becomes the process's `TMPDIR`.
+  ///
+  /// [directory] - where the temp files go; defaults to a folder in the
+  /// app's temporary directory
+  /// [thresholdMb] - 0 (the default) spills above a quarter of the
+  /// `memoryBudgetMb` given to [configure], and only when one is set
+  static Future<void> enableDiskSpill({
+    String? directory,
+    int thresholdMb = 0,
+  }) async {
+    final spillDirectory = Directory(
+      directory ?? '${(await getTemporaryDirectory()).path}/thinpic_spill',
+    );
+    await spillDirectory.create(recursive: true);
+    setSpillDirectory(spillDirectory.path);
+    configureRuntime(discThresholdMb: thresholdMb);
+  }
+
+  static Future<ImageInfoData?> getImageInfo(String imagePath) async {
+    final result = await compute(_getImageInfoIsolate, {
+      'imagePath': imagePath,
+    });
+    return result;
+  }
+
+  /// Reads an image header without decoding pixels.
+  ///
+  /// Returns width, height, bands, EXIF orientation, source format and file
+  /// size; `success` is 1 when the header could be read. Runs synchronously
+  /// and is intended for per-item checks such as picker grids.
+  static ImageHeader probeImage(String imagePath) {
+    return probeImageHeader(imagePath);
+  }
+
+  /// [probeImage] for many paths in one native call, in input order.
+  static List<ImageHeader> probeImages(List<String> imagePaths) {
+    return probeImageHeaders(imagePaths);
+  }
+
+  /// Sort and group keys for a gallery, read from each file's container
+  /// headers and EXIF without opening a decoder: size, EXIF orientation,
+  /// capture time (`capture_time`, seconds since 1970 on the camera's own
+  /// clock, -1 when absent), GPS presence, source format and file size.
+  /// JPEG, PNG, WebP, HEIF/AVIF, TIFF and GIF are parsed directly; other
+  /// formats fall back to [probeImage]. Results are in input order; failed
+  /// entries have `success != 1`.
+  static Future<List<ThinpicImageMeta>> indexImages(List<String> imagePaths) async {
+    if (imagePaths.isEmpty) {
+      return const [];
+    }
+    return compute(_indexImagesIsolate, {'imagePaths': imagePaths});
+  }
+
+  /// Pages of a multi-page TIFF or PDF (frames of an animation), 1 for
+  /// other images, or -1 when the header cannot be read. Runs synchronously.
+  static int pageCount(String imagePath) {
+    return probePageCount(imagePath);
+  }
+
+  /// Where a Google or Samsung motion photo keeps its video, or null for
+  /// any other image. Reads only the metadata and the file's tail; runs
+  /// synchronously.
+  static MotionPhotoInfo? motionPhoto(String imagePath) {
+    return probeMotionPhoto(imagePath);
+  }
+
+  /// Predicts what compressing an image would produce, without encoding.
+  ///
+  /// [imagePath] - path to the source image
+  /// [format] - output format; [ImageFormat.FORMAT_AUTO] keeps the source's
+  /// [quality] - output quality (0 = 80)
+  /// [maxWidth], [maxHeight] - box the output is fitted into, never
+  /// upscaled (0 = unbounded)
+  ///
+  /// Only the header is read: the size comes from a bits-per-pixel curve for
+  /// the format and quality, scaled by how dense the source is for its own
+  /// format, and the time from this device's throughput model (see
+  /// [throughput]). Good for showing "about 450 KB" next to a quality
+  /// slider or for planning a batch's memory (`working_set_bytes`); expect
+  /// errors of some tens of percent. `success` is 1 when the header could be
+  /// read. Runs synchronously.
+  static ThinpicEstimate estimate(
+    String imagePath, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int maxWidth = 0,
+    int maxHeight = 0,
+  }) {
+    return estimateOutput(imagePath, format, quality, maxWidth, maxHeight);
+  }
+
+  /// the JPEG thumbnail a camera embedded in the EXIF data, if there is one
+  ///
+  /// [imagePath] - path to a JPEG
+  /// [minSize] - reject thumbnails whose longer side is smaller (0 takes
+  /// any; cameras store 160x120 up to a few hundred pixels)
+  ///
+  /// Only the head of the file is read and nothing is decoded, so this is
+  /// cheap enough to call synchronously per grid item. The bytes are a JPEG
+  /// for `Image.memory`; rotate by [EmbeddedThumbnail.orientation], the main
+  /// image's EXIF orientation, which the thumbnail shares. Returns null when
+  /// there is none; fall back to [decodeThumbnail] or [compressThumbnail].
+  /// example:
+  /// ```dart
+  /// final embedded = ThinPicCompress.exifThumbnail('path/to/photo.jpg');
+  /// if (embedded != null) Image.memory(embedded.bytes);
+  /// ```
+  static EmbeddedThumbnail? exifThumbnail(String imagePath, {int minSize = 0}) {
+    return extractExifThumbnail(imagePath, minSize: minSize);
+  }
+
+  /// Rewrites an image's metadata without re-encoding it.
+  ///
+  /// [imagePath] - JPEG, PNG or WebP to rewrite
+  /// [outputPath] - where to write the result; may be [imagePath], which is
+  /// then replaced atomically
+  /// [stripGps] - remove the EXIF GPS block, and XMP packets that carry a
+  /// location
+  /// [stripXmp] - remove every XMP packet
+  /// [normalizeOrientation] - set an EXIF orientation outside 1-8 to 1
+  ///
+  /// Only the container is walked: EXIF is edited in place and the pixel
+  /// data copied byte for byte, so nothing is lost and a 12 MP photo takes
+  /// milliseconds. Runs synchronously and returns the output's size, or -1
+  /// on failure (another format, or a malformed file).
+  /// example:
+  /// ```dart
+  /// ThinPicCompress.rewriteMetadata('path/to/photo.jpg', 'path/to/photo.jpg');
+  /// ```
+  static int rewriteMetadata(
+    String imagePath,
+    String outputPath, {
+    bool stripGps = true,
+    bool stripXmp = false,
+    bool normalizeOrientation = false,
+  }) {
+    return rewriteImageMetadata(
+      imagePath,
+      outputPath,
+      stripGps: stripGps,
+      stripXmp: stripXmp,
+      normalizeOrientation: normalizeOrientation,
+    );
+  }
+
+  /// [rewriteMetadata] on encoded bytes; an empty list on failure.
+  static Uint8List rewriteMetadataBytes(
+    Uint8List bytes, {
+    bool stripGps = true,
+    bool stripXmp = false,
+    bool normalizeOrientation = false,
+  }) {
+    return rewriteImageMetadataBytes(
+      bytes,
+      stripGps: stripGps,
+      stripXmp: stripXmp,
+      normalizeOrientation: normalizeOrientation,
+    );
+  }
+
+  /// compress image with format
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [format] - format of the compressed image
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [onProgress] - optional 0-100 progress, reported for images of 4 MP
+  /// and up at most 10 times a second, always ending at 100
+  /// [outputPath] - optional destination; the file is written there once,
+  /// atomically (temp file and rename), and returned as given. Without it
+  /// the result goes to a uniquely named temporary file
+  ///
+  /// Returns a [File] object if compression is successful, otherwise returns null
+  /// example:
+  /// ```dart
+  /// final result = await ThinPicCompress.compressImage(
+  ///   'path/to/image.jpg',
+  ///   quality: 80,
+  ///   format: ImageFormat.FORMAT_PNG,
+  /// );
+  /// ```
+  static Future<File?> compressImage(
+    String imagePath, {
+    int quality = 80,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+    void Function(int percent)? onProgress,
+    String? outputPath,
+  }) async {
+    try {
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(outputPath, '.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        quality: quality,
+        format: format,
+        cancelToken: cancelToken,
+        onProgress: onProgress,
+      );
+
+      if (output != null) {
+        debugPrint('Compression successful, bytes length: ${output.length}');
+        debugPrint('Compressed image saved to: ${tempFile.path}');
+
+        return _withOutputExtension(tempFile, output.format, outputPath);
+      }
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress image with size and format
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - target width of the compressed image
+  /// [targetHeight] - target height of the compressed image
+  /// [format] - format of the compressed image
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [onProgress] - optional 0-100 progress, reported for images of 4 MP
+  /// and up at most 10 times a second, always ending at 100
+  /// [outputPath] - optional destination; the file is written there once,
+  /// atomically (temp file and rename), and returned as given. Without it
+  /// the result goes to a uniquely named temporary file
+  ///  example:
+  /// ```dart
+  /// final result = await ThinPicCompress.compressImageWithSizeAndFormat(
+  ///   'path/to/image.jpg',
+  ///   quality: 80,
+  ///   targetWidth: 1024,
+  ///   targetHeight: 1024,
+  ///   format: ImageFormat.FORMAT_PNG,
+  /// );
+  /// ```
+  static Future<File?> compressImageWithSizeAndFormat(
+    String imagePath,
+    int quality,
+    int targetWidth,
+    int targetHeight,
+    ImageFormat format, {
+    CompressionCancelToken? cancelToken,
+    void Function(int percent)? onProgress,
+    String? outputPath,
+  }) async {
+    try {
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(outputPath, '.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+        onProgress: onProgress,
+      );
+
+      if (output != null) {
+        debugPrint('Compression successful, bytes length: ${output.length}');
+        debugPrint('Compressed image saved to: ${tempFile.path}');
+
+        return _withOutputExtension(tempFile, output.format, outputPath);
+      }
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress an image into a stream of encoded chunks for progressive upload
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - optional bounding width (0 does not constrain)
+  /// [targetHeight] - optional bounding height (0 does not constrain)
+  /// [format] - JPEG or PNG stream strip by strip; WebP holds one output
+  /// frame; other formats arrive as a single chunk
+  ///
+  /// Uses the same bounded-memory pipeline as [compressImageStreaming], but
+  /// the encoder hands over about 64 KB at a time as it writes, so an upload
+  /// can start before the image is fully encoded and no whole output buffer
+  /// is kept. Concatenating the chunks gives the complete file. The stream
+  /// ends with an error when compression fails.
+  /// example:
+  /// ```dart
+  /// final request = http.StreamedRequest('PUT', uploadUrl);
+  /// ThinPicCompress.compressImageChunked('path/to/photo.jpg')
+  ///     .listen(request.sink.add, onDone: request.sink.close);
+  /// ```
+  static Stream<Uint8List> compressImageChunked(
+    String imagePath, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+  }) {
+    return streamCompressedChunks(
+      imagePath,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      format: format,
+    );
+  }
+
+  /// compress a panorama or very high resolution image in bounded memory
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - optional bounding width (0 does not constrain)
+  /// [targetHeight] - optional bounding height (0 does not constrain)
+  /// [format] - JPEG or PNG stream strip by strip; WebP holds one output
+  /// frame; other formats use the regular large-image path
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [onProgress] - optional 0-100 progress, reported for images of 4 MP
+  /// and up at most 10 times a second, always ending at 100
+  /// [outputPath] - optional destination; the file is written there once,
+  /// atomically (temp file and rename), and returned as given. Without it
+  /// the result goes to a uniquely named temporary file
+  ///
+  /// The image is decoded, resized and encoded sequentially, so native memory
+  /// grows with the image width rather than its area and is never upscaled.
+  /// example:
+  /// ```dart
+  /// final file = await ThinPicCompress.compressImageStreaming(
+  ///   'path/to/panorama.jpg',
+  ///   quality: 85,
+  ///   targetWidth: 12000,
+  /// );
+  /// ```
+  static Future<File?> compressImageStreaming(
+    String imagePath, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+    void Function(int percent)? onProgress,
+    String? outputPath,
+  }) async {
+    try {
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(outputPath, '_stream.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_STREAM,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+        onProgress: onProgress,
+      );
+
+      if (output != null) {
+        debugPrint(
+          'Streaming compression successful, bytes length: ${output.length}',
+        );
+        debugPrint('Compressed image saved to: ${tempFile.path}');
+
+        return _withOutputExtension(tempFile, output.format, outputPath);
+      }
+    } catch (e, stackTrace) {
+      debugPrint('Error during streaming compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress with every trade-off chosen per call (thinpic_compress)
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [format] - output format ([ImageFormat.FORMAT_AUTO] keeps the input's)
+  /// [quality] - 1-100 for lossy formats
+  /// [effort] - 0 (fastest) to 9 (smallest), scaled to each encoder's own
+  /// range; -1 uses the encoder default
+  /// [kernel] - resampling kernel used when the image is downscaled
+  /// [maxWidth], [maxHeight] - fit inside this box (0 does not constrain);
+  /// never upscales
+  /// [strip] - metadata to drop; policies that drop EXIF rotate the pixels
+  /// upright first
+  /// [threads] - libvips worker threads for this image (0 = [configure])
+  /// [webpProfile] - WebP preset: fast (method 1, alpha quality 80),
+  /// balanced (method 4) or archive (method 6, sharp YUV, auto deblocking);
+  /// [effort], [webpSharpYuv] and [alphaQuality] override its settings
+  /// [webpSharpYuv] - sharper chroma edges via libsharpyuv (null = profile)
+  /// [alphaQuality] - WebP alpha plane quality 1-100 (0 = profile)
+  /// [progressive] - progressive JPEG or Adam7-interlaced PNG, so viewers can
+  /// draw a coarse preview from the first part of the file
+  /// [scanScript] - JPEG scan order: libjpeg's standard script, a
+  /// preview-first script, or [ThinpicScanScript.THINPIC_SCAN_SCRIPT_CUSTOM]
+  /// with [scans]
+  /// [animated] - keep every frame of an animated GIF or WebP and write an
+  /// animated WebP or GIF; each frame is fitted on its own
+  /// [pngPalette] - indexed PNG: automatic (only when the image has few
+  /// enough colours, lossless) or always (quantised when it has more)
+  /// [pngBitDepth] - bits per palette index, 1/2/4/8 (0 = smallest that fits)
+  /// [dither] - Floyd-Steinberg strength 0-100 when quantising
+  /// [pngDeflate] - compress truecolour PNG with libdeflate instead of zlib:
+  /// 2-4x faster for the same or a smaller file, using more memory;
+  /// `THINPIC_PNG_DEFLATE_OPTIMIZE` tries several filter strategies on
+  /// parallel threads and keeps the smallest, typically 10-30% smaller
+  /// [gifColours] - GIF palette size 2-256, shared by every frame; [dither]
+  /// applies
+  /// [gifInterframe] - animated GIF: pixels within this many levels
+  /// (0-255) of the previous frame are written transparent so they repeat
+  /// it, and each frame is cropped to what changed (-1 = from [quality])
+  /// [minSsim] - JPEG/WebP perceptual floor 0-1 (e.g. 0.97; 0 = off):
+  /// [quality] becomes a ceiling and the lowest quality whose SSIM against
+  /// the resized image stays at or above the floor is kept
+  /// [crop] - with both [maxWidth] and [maxHeight], cover the box and crop
+  /// to exactly that size (centre, entropy or attention) instead of
+  /// fitting inside it; the crop is picked on the shrink-on-load
+  /// intermediate, never on full-resolution pixels
+  /// [latencyBudgetMs] - aim to finish within this many milliseconds
+  /// (0 = off); see [compressWithinBudget], which also reports whether it did
+  /// [heifCompression] - [ImageFormat.FORMAT_HEIF] as HEVC (HEIC, hardware
+  /// encoded where the platform can) or AV1 (AVIF, software, slower)
+  /// [heifSubsample] - HEIF chroma: 4:2:0 for photos, 4:4:4 for screenshots
+  /// and coloured text (always software); auto switches at quality 90
+  /// [jxlDistance] - JPEG XL Butteraugli distance instead of [quality]:
+  /// 1.0 is visually lossless, larger is smaller and blurrier (0 = quality)
+  /// [jxlLosslessJpeg] - with [ImageFormat.FORMAT_JXL] and a JPEG input,
+  /// transcode it reversibly instead of re-encoding; see
+  /// [transcodeJpegToJxl]
+  /// [jpegTrellis] - JPEG trellis quantisation, 5-10% smaller at the same
+  /// quality for about twice the encode time (null = on unless [effort] is 0)
+  /// [jpegOvershootDeringing] - less ringing around black-on-white text and
+  /// lines (null = as [jpegTrellis])
+  /// [jpegOptimizeScans] - with [progressive], split the spectral scans
+  /// where it makes the file smallest (null = as [jpegTrellis])
+  /// [jpegQuantTable] - base JPEG quantisation tables; the default is
+  /// ImageMagick's where available
+  /// The four JPEG settings need mozjpeg ([jpegExtensionsAvailable]) and are
+  /// ignored with other libjpegs
+  /// [watermarkPath] - image (usually a PNG with alpha) composited onto the
+  /// resized output before it is encoded, instead of stamping it afterwards;
+  /// it is decoded and scaled once per output size and cached natively
+  /// [watermarkGravity] - corner or edge the watermark sits at
+  /// [watermarkMargin] - pixels between the watermark and those edges
+  /// [watermarkWidth] - watermark width as a fraction of the output width
+  /// (0 = its own size)
+  /// [watermarkOpacity] - 0-1, multiplies the watermark's alpha
+  /// [motionVideo] - for a motion photo ([motionPhoto]) written as JPEG,
+  /// [ThinpicMotionVideo.THINPIC_MOTION_VIDEO_KEEP] copies its video after
+  /// the new still unchanged, so galleries still play it; Google-style
+  /// files need [strip] left at THINPIC_STRIP_NONE, whose XMP locates it
+  /// [gainMap] - for an Ultra HDR JPEG written as JPEG,
+  /// [ThinpicGainMap.THINPIC_GAIN_MAP_KEEP] resizes its gain map with the
+  /// primary and appends it, so HDR screens still show the HDR rendition;
+  /// ignored with [crop] and with a kept Google motion video
+  /// [outputPath] - also writes the result to this file natively, from the
+  /// same buffer the returned bytes are, so saving to the gallery and
+  /// uploading take one encode and no copy through Dart; a failed write
+  /// fails the call
+  ///
+  /// Runs in a background isolate and returns the encoded bytes, or null on
+  /// failure.
+  /// example:
+  /// ```dart
+  /// final bytes = await ThinPicCompress.compressWithOptions(
+  ///   'path/to/image.jpg',
+  ///   format: ImageFormat.FORMAT_WEBP,
+  ///   quality: 75,
+  ///   effort: 1,
+  ///   maxWidth: 1600,
+  ///   maxHeight: 1600,
+  ///   strip: ThinpicStripPolicy.THINPIC_STRIP_KEEP_ICC,
+  /// );
+  /// ```
+  static Future<Uint8List?> compressWithOptions(
+    String imagePath, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int effort = -1,
+    ThinpicKernel kernel = ThinpicKernel.THINPIC_KERNEL_LANCZOS3,
+    int maxWidth = 0,
+    int maxHeight = 0,
+    ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+    int threads = 0,
+    ThinpicWebpProfile webpProfile =
+        ThinpicWebpProfile.THINPIC_WEBP_PROFILE_DEFAULT,
+    bool? webpSharpYuv,
+    int alphaQuality = 0,
+    bool progressive = false,
+    ThinpicScanScript scanScript =
+        ThinpicScanScript.THINPIC_SCAN_SCRIPT_DEFAULT,
+    List<ProgressiveScan> scans = const [],
+    bool animated = false,
+    ThinpicPngPalette pngPalette = ThinpicPngPalette.THINPIC_PNG_PALETTE_OFF,
+    int pngBitDepth = 0,
+    int dither = 100,
+    ThinpicPngDeflate pngDeflate = ThinpicPngDeflate.THINPIC_PNG_DEFLATE_ZLIB,
+    int gifColours = 256,
+    int gifInterframe = -1,
+    double minSsim = 0,
+    ThinpicCrop crop = ThinpicCrop.THINPIC_CROP_NONE,
+    int latencyBudgetMs = 0,
+    ThinpicHeifCompression heifCompression =
+        ThinpicHeifCompression.THINPIC_HEIF_HEVC,
+    ThinpicSubsample heifSubsample = ThinpicSubsample.THINPIC_SUBSAMPLE_AUTO,
+    double jxlDistance = 0,
+    bool jxlLosslessJpeg = false,
+    bool? jpegTrellis,
+    bool? jpegOvershootDeringing,
+    bool? jpegOptimizeScans,
+    ThinpicQuantTable jpegQuantTable =
+        ThinpicQuantTable.THINPIC_QUANT_TABLE_DEFAULT,
+    String? watermarkPath,
+    ThinpicGravity watermarkGravity = ThinpicGravity.THINPIC_GRAVITY_SOUTH_EAST,
+    int watermarkMargin = 16,
+    double watermarkWidth = 0,
+    double watermarkOpacity = 1,
+    ThinpicMotionVideo motionVideo =
+        ThinpicMotionVideo.THINPIC_MOTION_VIDEO_STRIP,
+    ThinpicGainMap gainMap = ThinpicGainMap.THINPIC_GAIN_MAP_STRIP,
+    String? outputPath,
+  }) async {
+    try {
+      return await compute(_compressWithOptionsIsolate, {
+        'imagePath': imagePath,
+        'format': format,
+        'quality': quality,
+        'effort': effort,
+        'kernel': kernel,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+        'strip': strip,
+        'threads': threads,
+        'webpProfile': webpProfile,
+        'webpSharpYuv': webpSharpYuv,
+        'alphaQuality': alphaQuality,
+        'progressive': progressive,
+        'scanScript': scanScript,
+        'scans': scans,
+        'animated': animated,
+        'pngPalette': pngPalette,
+        'pngBitDepth': pngBitDepth,
+        'dither': dither,
+        'pngDeflate': pngDeflate,
+        'gifColours': gifColours,
+        'gifInterframe': gifInterframe,
+        'minSsim': minSsim,
+        'crop': crop,
+        'latencyBudgetMs': latencyBudgetMs,
+        'heifCompression': heifCompression,
+        'heifSubsample': heifSubsample,
+        'jxlDistance': jxlDistance,
+        'jxlLosslessJpeg': jxlLosslessJpeg,
+        'jpegTrellis': jpegTrellis,
+        'jpegOvershootDeringing': jpegOvershootDeringing,
+        'jpegOptimizeScans': jpegOptimizeScans,
+        'jpegQuantTable': jpegQuantTable,
+        'watermarkPath': watermarkPath,
+        'watermarkGravity': watermarkGravity,
+        'watermarkMargin': watermarkMargin,
+        'watermarkWidth': watermarkWidth,
+        'watermarkOpacity': watermarkOpacity,
+        'motionVideo': motionVideo,
+        'gainMap': gainMap,
+        'outputPath': outputPath,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// Whether libvips is linked against mozjpeg, which the `jpeg*` settings
+  /// of [compressWithOptions] need. The JPEG size searches
+  /// ([CompressMode.COMPRESS_MODE_SMART]) also use its trellis
+  /// quantisation and tables when they are there.
+  static bool get jpegExtensionsAvailable => isJpegExtensionsAvailable();
+
+  /// Whether the native side found libjxl, which [transcodeJpegToJxl] and
+  /// `compressWithOptions(jxlLosslessJpeg: true)` need. The bundled libvips
+  /// has no JPEG XL support; ship libjxl (and libjxl_threads for
+  /// multithreaded encoding) with the app to enable it.
+  static bool get jxlTranscodeAvailable => isJxlTranscodeAvailable();
+
+  /// recompress a JPEG into JPEG XL without decoding it to pixels
+  ///
+  /// [imagePath] - path to a JPEG
+  /// [effort] - 0 (fastest) to 9 (smallest), libjxl effort 1-9; -1 = 7
+  /// [threads] - libjxl encoder threads (0 = [configure] setting)
+  ///
+  /// libjxl re-codes the JPEG's DCT coefficients and stores what a JPEG XL
+  /// decoder needs to give back the original file bit for bit, so nothing
+  /// is lost and the output is typically about 20% smaller. Size,
+  /// orientation and metadata are kept as they are. Returns null for inputs
+  /// that are not JPEG, when libjxl is missing ([jxlTranscodeAvailable]) or
+  /// on failure.
+  /// example:
+  /// ```dart
+  /// final jxl = await ThinPicCompress.transcodeJpegToJxl(path, effort: 7);
+  /// ```
+  static Future<Uint8List?> transcodeJpegToJxl(
+    String imagePath, {
+    int effort = -1,
+    int threads = 0,
+  }) => compressWithOptions(
+    imagePath,
+    format: ImageFormat.FORMAT_JXL,
+    effort: effort,
+    threads: threads,
+    jxlLosslessJpeg: true,
+  );
+
+  /// compress for interactive sharing, trading size for a deadline
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [latencyBudgetMs] - how long the call may take, e.g. 300
+  /// [format], [quality], [effort], [maxWidth], [maxHeight], [strip] - what
+  /// to produce when the budget allows it, as for [compressWithOptions]
+  ///
+  /// The native side keeps this device's measured throughput (ms per output
+  /// megapixel for each format and effort, learned from every plain
+  /// [compressWithOptions] call) and plans the call against it before
+  /// decoding anything: it lowers [effort] first, then writes JPEG instead
+  /// of HEIF, JPEG 2000 or JPEG XL for opaque images, then shrinks the
+  /// output (never below 320 px on the long edge). The result carries the
+  /// bytes, what was written, the elapsed time and whether the budget held,
+  /// or null on failure.
+  /// example:
+  /// ```dart
+  /// final result = await ThinPicCompress.compressWithinBudget(
+  ///   path,
+  ///   300,
+  ///   format: ImageFormat.FORMAT_WEBP,
+  ///   maxWidth: 2048,
+  ///   maxHeight: 2048,
+  /// );
+  /// if (result != null && !result.budgetMet) debugPrint('${result.elapsedMs} ms');
+  /// ```
+  static Future<BudgetedCompression?> compressWithinBudget(
+    String imagePath,
+    int latencyBudgetMs, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int effort = -1,
+    int maxWidth = 0,
+    int maxHeight = 0,
+    ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+  }) async {
+    try {
+      return await compute(_compressWithinBudgetIsolate, {
+        'imagePath': imagePath,
+        'latencyBudgetMs': latencyBudgetMs,
+        'format': format,
+        'quality': quality,
+        'effort': effort,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+        'strip': strip,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress and fingerprint the result for near-duplicate detection
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [format], [quality], [effort], [maxWidth], [maxHeight], [strip] - as
+  /// for [compressWithOptions]
+  /// [perceptualHash] - whether to compute the perceptual hash
+  /// [placeholder] - a BlurHash or ThumbHash to return for feeds to show
+  /// while the image loads
+  /// [analyse] - whether to score blur and exposure, so a batch can flag
+  /// soft or badly exposed photos
+  /// [paletteColours] - how many dominant colours to return, up to 8, for
+  /// tinting a card while the image loads (0 = none)
+  /// [tensorWidth], [tensorHeight] - size of an RGB model input to return
+  /// as well, up to 1024 a side (0 = none), so on-device classification
+  /// does not decode the image again
+  /// [tensorType] - uint8 as is, or float32 normalised per channel as
+  /// (value / 255 - [tensorMean]) / [tensorStd]
+  ///
+  /// Alongside the bytes, returns a 64-bit difference hash of the resized
+  /// image, taken from the pixels on their way to the encoder (no second
+  /// decode). Copies that were resized, re-encoded or lightly edited hash a
+  /// few bits apart; compare with [hashDistance] or cluster a batch with
+  /// [groupNearDuplicates]. The placeholder comes from a 32-cell colour
+  /// grid averaged from the same pixels, as is the palette (median cut
+  /// refined by k-means, largest share first), and the analysis from a luma
+  /// plane of up to 512 cells on the long side. The tensor is the centre of
+  /// the encoded image cropped to its aspect and box-averaged to its size.
+  /// perceptualHash is null for images under 9x8 pixels, and all five are
+  /// null for encoders that read tiles; the result is null on failure.
+  /// example:
+  /// ```dart
+  /// final result = await ThinPicCompress.compressWithHash(
+  ///   path,
+  ///   maxWidth: 1600,
+  ///   maxHeight: 1600,
+  ///   placeholder: ThinpicPlaceholder.THINPIC_PLACEHOLDER_BLURHASH,
+  /// );
+  /// final hash = result?.perceptualHash;
+  /// final blurHash = result?.placeholder;
+  /// ```
+  static Future<HashedCompression?> compressWithHash(
+    String imagePath, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int effort = -1,
+    int maxWidth = 0,
+    int maxHeight = 0,
+    ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+    bool perceptualHash = true,
+    ThinpicPlaceholder placeholder =
+        ThinpicPlaceholder.THINPIC_PLACEHOLDER_NONE,
+    bool analyse = false,
+    int paletteColours = 0,
+    int tensorWidth = 0,
+    int tensorHeight = 0,
+    ThinpicTensorType tensorType = ThinpicTensorType.THINPIC_TENSOR_UINT8,
+    List<double> tensorMean = const [0, 0, 0],
+    List<double> tensorStd = const [1, 1, 1],
+  }) async {
+    try {
+      return await compute(_compressWithHashIsolate, {
+        'imagePath': imagePath,
+        'format': format,
+        'quality': quality,
+        'effort': effort,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+        'strip': strip,
+        'perceptualHash': perceptualHash,
+        'placeholder': placeholder,
+        'analyse': analyse,
+        'paletteColours': paletteColours,
+        'tensorWidth': tensorWidth,
+        'tensorHeight': tensorHeight,
+        'tensorType': tensorType,
+        'tensorMean': tensorMean,
+        'tensorStd': tensorStd,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// bits that differ between two perceptual hashes from [compressWithHash]
+  ///
+  /// 0 for the same picture, under about 10 for near duplicates.
+  static int hashDistance(int a, int b) => perceptualHashDistance(a, b);
+
+  /// cluster perceptual hashes into near-duplicate groups
+  ///
+  /// [hashes] - perceptual hashes from [compressWithHash]
+  /// [maxDistance] - most bits two hashes may differ by to be grouped
+  ///
+  /// Groups are chained, so a burst where each shot is close to the next
+  /// forms one group. Element i of the result is the index of the first
+  /// hash in i's group; every pair is compared, so keep batches to a few
+  /// thousand.
+  /// example:
+  /// ```dart
+  /// final groups = ThinPicCompress.groupNearDuplicates(hashes);
+  /// final duplicates = [for (var i = 0; i < groups.length; i++) if (groups[i] != i) i];
+  /// ```
+  static List<int> groupNearDuplicates(
+    List<int> hashes, {
+    int maxDistance = 10,
+  }) => groupPerceptualHashes(hashes, maxDistance: maxDistance);
+
+  /// run an ordered list of operations and encode once (thinpic_compress_ops)
+  ///
+  /// [imagePath] - path to the image to edit
+  /// [operations] - steps applied in order: [ImageOperation.autorotate],
+  /// [ImageOperation.crop], [ImageOperation.resize],
+  /// [ImageOperation.sharpen] and [ImageOperation.composite]
+  /// [format], [quality], [effort], [kernel], [strip], [threads] - as for
+  /// [compressWithOptions]; the size comes from the resize steps
+  ///
+  /// Every step only extends one lazy libvips graph, so the image is decoded
+  /// once and encoded once however many steps there are. A resize given
+  /// first decodes at reduced size. Runs in a background isolate and returns
+  /// the encoded bytes, or null on failure (including a crop outside the
+  /// image or an overlay that cannot be read).
+  /// example:
+  /// ```dart
+  /// final bytes = await ThinPicCompress.compressWithOperations(
+  ///   'path/to/image.jpg',
+  ///   const [
+  ///     ImageOperation.resize(width: 1600, height: 1600),
+  ///     ImageOperation.crop(0, 0, 1600, 900),
+  ///     ImageOperation.sharpen(sigma: 0.8),
+  ///     ImageOperation.composite('path/to/logo.png', x: 16, y: 16, opacity: 0.6),
+  ///   ],
+  ///   format: ImageFormat.FORMAT_WEBP,
+  ///   quality: 75,
+  /// );
+  /// ```
+  static Future<Uint8List?> compressWithOperations(
+    String imagePath,
+    List<ImageOperation> operations, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int effort = -1,
+    ThinpicKernel kernel = ThinpicKernel.THINPIC_KERNEL_LANCZOS3,
+    ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+    int threads = 0,
+  }) async {
+    try {
+      return await compute(_compressWithOperationsIsolate, {
+        'imagePath': imagePath,
+        'operations': operations,
+        'format': format,
+        'quality': quality,
+        'effort': effort,
+        'kernel': kernel,
+        'strip': strip,
+        'threads': threads,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// write a very large image as a tiled multi-resolution pyramid
+  /// (compress_image_to_pyramid)
+  ///
+  /// [imagePath] - path to the source image (gigapixel scans and the like)
+  /// [outputPath] - the TIFF file to write, or the Deep Zoom base name
+  /// (`<outputPath>.dzi` and `<outputPath>_files/`)
+  /// [layout] - one pyramidal TIFF (the default), or Deep Zoom tiles, which
+  /// need a libvips built with dzsave (not the bundled Android build)
+  /// [quality] - JPEG quality of every tile
+  /// [tileSize] - tile edge in pixels (0 = 256 for TIFF, 254 for Deep Zoom)
+  ///
+  /// Keeps the full resolution instead of capping at 6000 px like the large
+  /// modes: the source is read once, top to bottom, and every smaller level
+  /// is built from the one above as rows arrive, so a viewer can load only
+  /// the tiles it shows. Runs in a background isolate and returns the bytes
+  /// written, or -1 on failure.
+  /// example:
+  /// ```dart
+  /// final bytes = await ThinPicCompress.compressToPyramid(
+  ///   'path/to/scan.tif',
+  ///   '${dir.path}/scan_pyramid.tif',
+  ///   quality: 85,
+  /// );
+  /// ```
+  static Future<int> compressToPyramid(
+    String imagePath,
+    String outputPath, {
+    ThinpicPyramidLayout layout = ThinpicPyramidLayout.THINPIC_PYRAMID_TIFF,
+    int quality = 80,
+    int tileSize = 0,
+  }) async {
+    try {
+      return await compute(_writeImagePyramidIsolate, {
+        'imagePath': imagePath,
+        'outputPath': outputPath,
+        'layout': layout,
+        'quality': quality,
+        'tileSize': tileSize,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during pyramid output: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return -1;
+  }
+
+  /// compress the pages of a multi-page TIFF or PDF one by one
+  /// (compress_pages)
+  ///
+  /// [imagePath] - path to the document (scans, faxes, PDF with a libvips
+  /// that has pdfload)
+  /// [firstPage] - first page to compress, from 0
+  /// [pageCount] - how many pages (0 = through the last one)
+  /// [quality] - quality of every page
+  /// [targetWidth] - optional target width (0 keeps the page size)
+  /// [targetHeight] - optional target height (0 keeps the page size)
+  /// [format] - format of the compressed pages
+  /// [priority] - pool priority of the pages, as in [compressBatch]
+  ///
+  /// Each page is its own job on the native worker pool and decodes only
+  /// that page, so a long document never sits in memory whole; the memory
+  /// budget decides how many pages decode at once. Returns one entry per
+  /// page in page order, null for pages that failed.
+  /// example:
+  /// ```dart
+  /// final pages = await ThinPicCompress.compressPages(
+  ///   'path/to/scan.tif',
+  ///   quality: 75,
+  ///   targetWidth: 1600,
+  /// );
+  /// ```
+  static Future<List<Uint8List?>> compressPages(
+    String imagePath, {
+    int firstPage = 0,
+    int pageCount = 0,
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+  }) async {
+    try {
+      return await compute(_compressPagesIsolate, {
+        'imagePath': imagePath,
+        'firstPage': firstPage,
+        'count': pageCount,
+        'format': format,
+        'quality': quality,
+        'targetWidth': targetWidth,
+        'targetHeight': targetHeight,
+        'priority': priority,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during page compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return const [];
+  }
+
+  /// write the pages of a multi-page TIFF or PDF as one multi-page TIFF
+  /// (compress_pages_to_tiff)
+  ///
+  /// [imagePath] - path to the document
+  /// [outputPath] - the TIFF file to write
+  /// [firstPage] - first page to keep, from 0
+  /// [pageCount] - how many pages (0 = through the last one)
+  /// [quality] - JPEG quality of every page
+  /// [maxWidth] - optional box every page is fitted into (0 = no limit)
+  /// [maxHeight] - optional box every page is fitted into (0 = no limit)
+  ///
+  /// The pages stream through one after another, so memory stays at a few
+  /// rows of one page. All pages must share a size; use [compressPages] for
+  /// documents that mix them. Runs in a background isolate and returns the
+  /// bytes written, or -1 on failure.
+  static Future<int> compressPagesToTiff(
+    String imagePath,
+    String outputPath, {
+    int firstPage = 0,
+    int pageCount = 0,
+    int quality = 80,
+    int maxWidth = 0,
+    int maxHeight = 0,
+  }) async {
+    try {
+      return await compute(_writePagesTiffIsolate, {
+        'imagePath': imagePath,
+        'outputPath': outputPath,
+        'firstPage': firstPage,
+        'count': pageCount,
+        'quality': quality,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during multi-page output: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return -1;
+  }
+
+  /// encode raw pixels as PNG without going through libvips
+  ///
+  /// [pixels] - 8-bit samples, row by row
+  /// [width], [height] - image size in pixels
+  /// [channels] - 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA)
+  /// [stride] - bytes per row (0 = `width * channels`)
+  /// [premultiplied] - true for `ui.ImageByteFormat.rawRgba` data
+  /// [compressionLevel] - zlib level, 0 (stored, fastest) to 9 (smallest)
+  ///
+  /// libspng writes into one output buffer sized up front from the input,
+  /// so nothing is decoded or resampled and the pixels come back exactly.
+  /// Returns the PNG bytes, or null on failure.
+  static Future<Uint8List?> encodeRawPng(
+    Uint8List pixels,
+    int width,
+    int height, {
+    int channels = 4,
+    int stride = 0,
+    bool premultiplied = false,
+    int compressionLevel = 6,
+  }) async {
+    try {
+      return await compute(_encodeRawPngIsolate, {
+        'pixels': pixels,
+        'width': width,
+        'height': height,
+        'channels': channels,
+        'stride': stride,
+        'premultiplied': premultiplied,
+        'compressionLevel': compressionLevel,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during PNG encoding: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// encode a raw camera frame as JPEG without going through libvips
+  ///
+  /// [pixels] - 8-bit samples, row by row
+  /// [width], [height] - frame size in pixels
+  /// [pixelFormat] - byte layout: RGBA (Android `RGBA_8888`), BGRA (iOS
+  /// `kCVPixelFormatType_32BGRA`), RGB, BGR or gray; alpha is ignored
+  /// [pitch] - bytes per row as the camera delivers it (0 = tightly packed)
+  /// [quality] - JPEG quality 1-100
+  ///
+  /// Writes baseline 4:2:0 JPEG straight from the pixels, with no PNG or
+  /// temporary file in between. Returns the JPEG bytes, or null on failure.
+  /// example:
+  /// ```dart
+  /// final plane = cameraImage.planes.first;
+  /// final jpeg = await ThinPicCompress.encodeRawJpeg(
+  ///   plane.bytes,
+  ///   cameraImage.width,
+  ///   cameraImage.height,
+  ///   pixelFormat: ThinpicPixelFormat.THINPIC_PIXEL_BGRA,
+  ///   pitch: plane.bytesPerRow,
+  /// );
+  /// ```
+  static Future<Uint8List?> encodeRawJpeg(
+    Uint8List pixels,
+    int width,
+    int height, {
+    ThinpicPixelFormat pixelFormat = ThinpicPixelFormat.THINPIC_PIXEL_RGBA,
+    int pitch = 0,
+    int quality = 80,
+  }) async {
+    try {
+      return await compute(_encodeRawJpegIsolate, {
+        'pixels': pixels,
+        'width': width,
+        'height': height,
+        'pixelFormat': pixelFormat,
+        'pitch': pitch,
+        'quality': quality,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during JPEG encoding: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// encode a YUV_420_888 camera frame as JPEG without converting it to RGB
+  ///
+  /// [y], [u], [v] - the frame's planes with their row and pixel strides;
+  /// I420, NV12 and NV21 layouts all arrive this way from CameraX
+  /// [width], [height] - frame size in pixels
+  /// [quality] - JPEG quality 1-100
+  ///
+  /// libjpeg takes the planes as already-downsampled 4:2:0 data, so the
+  /// frame skips colour conversion and chroma downsampling entirely.
+  /// Returns the JPEG bytes, or null on failure.
+  /// example:
+  /// ```dart
+  /// YuvPlane plane(Plane p) =>
+  ///     (bytes: p.bytes, rowStride: p.bytesPerRow, pixelStride: p.bytesPerPixel ?? 1);
+  /// final jpeg = await ThinPicCompress.encodeYuv420Jpeg(
+  ///   plane(image.planes[0]),
+  ///   plane(image.planes[1]),
+  ///   plane(image.planes[2]),
+  ///   image.width,
+  ///   image.height,
+  /// );
+  /// ```
+  static Future<Uint8List?> encodeYuv420Jpeg(
+    YuvPlane y,
+    YuvPlane u,
+    YuvPlane v,
+    int width,
+    int height, {
+    int quality = 80,
+  }) async {
+    try {
+      return await compute(_encodeYuv420JpegIsolate, {
+        'y': y,
+        'u': u,
+        'v': v,
+        'width': width,
+        'height': height,
+        'quality': quality,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during JPEG encoding: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress several sizes of one image (thumbnail, medium, full) from a
+  /// single decode
+  ///
+  /// [variants] - up to 8 outputs, each a box to fit (0 leaves a side free),
+  /// a format and a quality
+  ///
+  /// The original is decoded once at the largest size needed, each smaller
+  /// variant is resized from the previous one, and all of them are encoded in
+  /// parallel. Returns one entry per variant, in order (null where it
+  /// failed), or null when the image could not be read.
+  /// example:
+  /// ```dart
+  /// final sizes = await ThinPicCompress.compressVariants(path, [
+  ///   (width: 0, height: 0, format: ImageFormat.FORMAT_JPEG, quality: 85),
+  ///   (width: 1280, height: 1280, format: ImageFormat.FORMAT_WEBP, quality: 80),
+  ///   (width: 320, height: 320, format: ImageFormat.FORMAT_WEBP, quality: 70),
+  /// ]);
+  /// ```
+  static Future<List<Uint8List?>?> compressVariants(
+    String imagePath,
+    List<ImageVariant> variants,
+  ) async {
+    try {
+      return await compute(_compressImageVariantsIsolate, {
+        'imagePath': imagePath,
+        'variants': variants,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// Builds a contact or sprite sheet of [imagePaths] in one native call,
+  /// for album previews and scrubbing strips.
+  ///
+  /// Each image is thumbnailed with shrink-on-load into a [cellWidth] x
+  /// [cellHeight] cell, upright and centre-cropped, on several threads; the
+  /// cells are joined in memory, [columns] to a row (0 for as square a grid
+  /// as the count allows) with [spacing] px between them and around the
+  /// edge, and the sheet is encoded once as [format]. No intermediate files
+  /// are written. Returns the sheet with each input's cell (null where the
+  /// input could not be decoded) and the same offsets as JSON, or null on
+  /// failure.
+  /// example:
+  /// ```dart
+  /// final sheet = await ThinPicCompress.contactSheet(
+  ///   albumPaths,
+  ///   cellWidth: 160,
+  ///   cellHeight: 160,
+  ///   format: ImageFormat.FORMAT_WEBP,
+  /// );
+  /// ```
+  static Future<ContactSheet?> contactSheet(
+    List<String> imagePaths, {
+    required int cellWidth,
+    required int cellHeight,
+    int columns = 0,
+    int spacing = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+  }) async {
+    try {
+      return await compute(_contactSheetIsolate, {
+        'imagePaths': imagePaths,
+        'cellWidth': cellWidth,
+        'cellHeight': cellHeight,
+        'columns': columns,
+        'spacing': spacing,
+        'format': format,
+        'quality': quality,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during contact sheet: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// encode a Flutter [ui.Image] (a screenshot, a `RepaintBoundary` capture,
+  /// a canvas drawing) as PNG
+  ///
+  /// [compressionLevel] - zlib level, 0 (stored, fastest) to 9 (smallest)
+  ///
+  /// Reads the image as straight-alpha RGBA and encodes it with
+  /// [encodeRawPng]. Returns the PNG bytes, or null on failure.
+  /// example:
+  /// ```dart
+  /// final image = await boundary.toImage(pixelRatio: 2);
+  /// final png = await ThinPicCompress.encodeImagePng(image);
+  /// ```
+  static Future<Uint8List?> encodeImagePng(
+    ui.Image image, {
+    int compressionLevel = 6,
+  }) async {
+    try {
+      final byteData = await image.toByteData(
+        format: ui.ImageByteFormat.rawStraightRgba,
+      );
+      if (byteData == null) {
+        return null;
+      }
+      return await encodeRawPng(
+        byteData.buffer.asUint8List(
+          byteData.offsetInBytes,
+          byteData.lengthInBytes,
+        ),
+        image.width,
+        image.height,
+        compressionLevel: compressionLevel,
+      );
+    } catch (e, stackTrace) {
+      debugPrint('Error during PNG encoding: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress raw pixels through the full pipeline, into any format
+  ///
+  /// [pixels] - 8-bit samples, row by row
+  /// [width], [height] - image size in pixels
+  /// [pixelFormat] - byte layout: RGBA, BGRA, RGB, BGR or gray
+  /// [stride] - bytes per row (0 = tightly packed)
+  /// [premultiplied] - true for `ui.ImageByteFormat.rawRgba` data
+  /// [format] - output format; [ImageFormat.FORMAT_AUTO] writes PNG when
+  /// the layout has alpha and JPEG otherwise
+  /// [quality] - quality of the compressed image
+  /// [maxWidth], [maxHeight] - optional bounding box (0 does not constrain)
+  ///
+  /// Unlike [encodeRawPng] and [encodeRawJpeg], the pixels are resized,
+  /// converted and encoded exactly as a decoded file would be, so an edited
+  /// image needs no intermediate PNG before it is compressed. Natively the
+  /// buffer is read in place. Returns the encoded bytes, or null on failure.
+  static Future<Uint8List?> compressPixels(
+    Uint8List pixels,
+    int width,
+    int height, {
+    ThinpicPixelFormat pixelFormat = ThinpicPixelFormat.THINPIC_PIXEL_RGBA,
+    int stride = 0,
+    bool premultiplied = false,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int maxWidth = 0,
+    int maxHeight = 0,
+  }) async {
+    try {
+      return await compute(_compressPixelsIsolate, {
+        'pixels': pixels,
+        'width': width,
+        'height': height,
+        'pixelFormat': pixelFormat,
+        'stride': stride,
+        'premultiplied': premultiplied,
+        'format': format,
+        'quality': quality,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during pixel compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress a Flutter [ui.Image] (an editor result, a canvas drawing)
+  /// into any format
+  ///
+  /// Reads the image as straight-alpha RGBA and passes it to
+  /// [compressPixels]; the other arguments are the same.
+  /// example:
+  /// ```dart
+  /// final edited = await recorder.endRecording().toImage(width, height);
+  /// final webp = await ThinPicCompress.compressUiImage(
+  ///   edited,
+  ///   format: ImageFormat.FORMAT_WEBP,
+  ///   maxWidth: 2048,
+  /// );
+  /// ```
+  static Future<Uint8List?> compressUiImage(
+    ui.Image image, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int maxWidth = 0,
+    int maxHeight = 0,
+  }) async {
+    try {
+      final byteData = await image.toByteData(
+        format: ui.ImageByteFormat.rawStraightRgba,
+      );
+      if (byteData == null) {
+        return null;
+      }
+      return await compressPixels(
+        byteData.buffer.asUint8List(
+          byteData.offsetInBytes,
+          byteData.lengthInBytes,
+        ),
+        image.width,
+        image.height,
+        format: format,
+        quality: quality,
+        maxWidth: maxWidth,
+        maxHeight: maxHeight,
+      );
+    } catch (e, stackTrace) {
+      debugPrint('Error during image compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// decode an image for display at grid-cell size instead of in full
+  ///
+  /// [imagePath] - path to the image to decode
+  /// [maxWidth], [maxHeight] - bounding box in pixels (0 does not
+  /// constrain); the image is never upscaled
+  ///
+  /// JPEGs are decoded by libjpeg at 1/2, 1/4 or 1/8 size and finished with
+  /// a bilinear resize, as in [compressThumbnail]; WebP and HEIF shrink
+  /// while decoding too. The pixels are upright and in sRGB, so a gallery
+  /// grid never holds full-size originals in memory. Returns null on
+  /// failure.
+  /// example:
+  /// ```dart
+  /// final image = await ThinPicCompress.decodeThumbnail(
+  ///   'path/to/photo.jpg',
+  ///   maxWidth: 256,
+  ///   maxHeight: 256,
+  /// );
+  /// if (image != null) RawImage(image: image);
+  /// ```
+  static Future<ui.Image?> decodeThumbnail(
+    String imagePath, {
+    int maxWidth = 256,
+    int maxHeight = 256,
+  }) async {
+    try {
+      final decoded = await compute(_decodeThumbnailIsolate, {
+        'imagePath': imagePath,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+      });
+      if (decoded == null) {
+        return null;
+      }
+      final image = Completer<ui.Image>();
+      ui.decodeImageFromPixels(
+        decoded.pixels,
+        decoded.width,
+        decoded.height,
+        ui.PixelFormat.rgba8888,
+        image.complete,
+      );
+      return await image.future;
+    } catch (e, stackTrace) {
+      debugPrint('Error during thumbnail decode: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress an image while it downloads
+  ///
+  /// [bytes] - the encoded image in order, e.g. an HTTP response body
+  /// [format] - output format; the input is read once, so FORMAT_AUTO is
+  /// not resolved from it and writes JPEG
+  /// [maxWidth], [maxHeight], [quality], [effort], [strip] - as for
+  /// [compressWithOptions]
+  ///
+  /// Each chunk is copied into a native ring buffer as it arrives, and a
+  /// background isolate decodes from it, so JPEG, PNG and GIF rows are
+  /// decoded while the rest is still downloading instead of after it. The
+  /// input cannot be shrunk on load or rewound, so animations give their
+  /// first frame. Returns null on failure, also when [bytes] ends with an
+  /// error (a truncated image is not encoded).
+  /// example:
+  /// ```dart
+  /// final response = await HttpClient().getUrl(uri).then((r) => r.close());
+  /// final jpeg = await ThinPicCompress.compressStream(response, maxWidth: 1920);
+  /// ```
+  static Future<Uint8List?> compressStream(
+    Stream<List<int>> bytes, {
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int effort = -1,
+    int maxWidth = 0,
+    int maxHeight = 0,
+    ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+  }) async {
+    final stream = openImageStream();
+    if (stream == 0) {
+      return null;
+    }
+    var failed = false;
+    try {
+      // Handled now: the isolate can fail while chunks are still coming in
+      final compressed = compute(_compressImageStreamIsolate, {
+        'stream': stream,
+        'format': format,
+        'quality': quality,
+        'effort': effort,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+        'strip': strip,
+      }).then<Uint8List?>(
+        (result) => result,
+        onError: (Object e, StackTrace stackTrace) {
+          debugPrint('Error during stream compression: $e');
+          debugPrint('Stack trace: $stackTrace');
+          return null;
+        },
+      );
+      try {
+        await for (final chunk in bytes) {
+          if (!writeImageStream(stream, chunk)) {
+            break;
+          }
+        }
+      } catch (e) {
+        failed = true;
+        debugPrint('Error while reading the image stream: $e');
+      }
+      finishImageStream(stream, failed: failed);
+      final result = await compressed;
+      return failed ? null : result;
+    } finally {
+      freeImageStream(stream);
+    }
+  }
+
+  /// measure the quality lost between an original and a compressed output
+  ///
+  /// [referencePath] - the original
+  /// [candidatePath] - the output to score, at any size with the same
+  /// aspect ratio
+  /// [analysisPixels] - size of the planes compared (0 = about 1 MP)
+  /// [threads] - threads the windows are split over (0 = one per core)
+  ///
+  /// Both images are decoded upright, converted to luma and resized to the
+  /// same analysis size, no larger than the smaller of the two, then scored
+  /// with the NEON kernels of the `minSsim` search: PSNR, SSIM over 8x8
+  /// windows and five-scale MS-SSIM. Meant for QA and A/B tests of encoder
+  /// settings on the device. Returns null on failure or when the aspect
+  /// ratios differ by more than 1%.
+  /// example:
+  /// ```dart
+  /// final quality = await ThinPicCompress.compareImages(original, compressed);
+  /// print('SSIM ${quality?.ssim}, PSNR ${quality?.psnr} dB');
+  /// ```
+  static Future<ImageQuality?> compareImages(
+    String referencePath,
+    String candidatePath, {
+    int analysisPixels = 0,
+    int threads = 0,
+  }) async {
+    try {
+      return await compute(_compareImagesIsolate, {
+        'referencePath': referencePath,
+        'candidatePath': candidatePath,
+        'analysisPixels': analysisPixels,
+        'threads': threads,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during image comparison: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  static const MethodChannel _textureChannel =
+      MethodChannel('thinpic_flutter/texture');
+
+  static PreviewTexture? _previewTexture(Map<Object?, Object?>? reply) {
+    if (reply == null) {
+      return null;
+    }
+    return (
+      textureId: reply['textureId'] as int,
+      width: reply['width'] as int,
+      height: reply['height'] as int,
+    );
+  }
+
+  /// decode an image straight into a Flutter texture (Android)
+  ///
+  /// [imagePath] - path to the image, e.g. a compressed output
+  /// [maxWidth], [maxHeight] - bounding box in pixels (0 does not
+  /// constrain); the image is never upscaled
+  ///
+  /// The image is decoded natively as in [decodeThumbnail] and drawn into a
+  /// SurfaceTexture registered with Flutter's TextureRegistry, so the pixels
+  /// never cross the Dart heap. Show it with `Texture(textureId: ...)` sized
+  /// to the returned width and height, and release it with
+  /// [disposePreviewTexture]. Returns null on failure and on platforms
+  /// without texture support.
+  /// example:
+  /// ```dart
+  /// final preview = await ThinPicCompress.createPreviewTexture(
+  ///   compressed.path,
+  ///   maxWidth: 1080,
+  ///   maxHeight: 1080,
+  /// );
+  /// if (preview != null) {
+  ///   AspectRatio(
+  ///     aspectRatio: preview.width / preview.height,
+  ///     child: Texture(textureId: preview.textureId),
+  ///   );
+  /// }
+  /// ```
+  static Future<PreviewTexture?> createPreviewTexture(
+    String imagePath, {
+    int maxWidth = 0,
+    int maxHeight = 0,
+  }) async {
+    if (!Platform.isAndroid) {
+      return null;
+    }
+    try {
+      final reply = await _textureChannel
+          .invokeMethod<Map<Object?, Object?>>('create', {
+        'path': imagePath,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+      });
+      return _previewTexture(reply);
+    } catch (e, stackTrace) {
+      debugPrint('Error during preview texture creation: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// redraw a preview texture with another image, e.g. after recompressing
+  ///
+  /// The texture keeps its id; the returned size is that of the new image.
+  /// Returns null if the image could not be drawn (the texture then still
+  /// shows the previous one).
+  static Future<PreviewTexture?> updatePreviewTexture(
+    int textureId,
+    String imagePath, {
+    int maxWidth = 0,
+    int maxHeight = 0,
+  }) async {
+    if (!Platform.isAndroid) {
+      return null;
+    }
+    try {
+      final reply = await _textureChannel
+          .invokeMethod<Map<Object?, Object?>>('update', {
+        'textureId': textureId,
+        'path': imagePath,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+      });
+      return _previewTexture(reply);
+    } catch (e, stackTrace) {
+      debugPrint('Error during preview texture update: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// release a texture from [createPreviewTexture]
+  static Future<void> disposePreviewTexture(int textureId) async {
+    if (!Platform.isAndroid) {
+      return;
+    }
+    await _textureChannel
+        .invokeMethod<void>('dispose', {'textureId': textureId});
+  }
+
+  /// compress a small preview, e.g. for a grid view
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - bounding width of the preview (0 does not constrain)
+  /// [targetHeight] - bounding height of the preview (0 does not constrain)
+  /// [format] - JPEG, PNG or WebP; other formats use
+  /// [compressImageWithSizeAndFormat]
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [outputPath] - optional destination; the file is written there once,
+  /// atomically (temp file and rename), and returned as given. Without it
+  /// the result goes to a uniquely named temporary file
+  ///
+  /// JPEGs are decoded by libjpeg at 1/2, 1/4 or 1/8 size and finished with
+  /// a bilinear resize, which is much faster than a full decode for small
+  /// targets at a slight cost in sharpness. Never upscales.
+  /// example:
+  /// ```dart
+  /// final preview = await ThinPicCompress.compressThumbnail(
+  ///   'path/to/photo.jpg',
+  ///   targetWidth: 320,
+  ///   targetHeight: 320,
+  /// );
+  /// ```
+  static Future<File?> compressThumbnail(
+    String imagePath, {
+    int quality = 75,
+    int targetWidth = 320,
+    int targetHeight = 320,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+    String? outputPath,
+  }) async {
+    try {
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(outputPath, '_thumb.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_THUMBNAIL,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+      );
+
+      if (output != null) {
+        debugPrint(
+          'Thumbnail compression successful, bytes length: ${output.length}',
+        );
+        debugPrint('Thumbnail saved to: ${tempFile.path}');
+
+        return _withOutputExtension(tempFile, output.format, outputPath);
+      }
+    } catch (e, stackTrace) {
+      debugPrint('Error during thumbnail compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// rotate and crop a JPEG without re-encoding it
+  ///
+  /// [imagePath] - path to a JPEG image
+  /// [cropX], [cropY] - top-left of the crop in the upright image; rounded
+  /// down to the 8 or 16 pixel block grid
+  /// [cropWidth], [cropHeight] - crop size (0 runs to the edge); grows by
+  /// whatever the offset lost to the rounding
+  /// [cancelToken] - optional token to abandon the transform natively
+  /// [outputPath] - optional destination; the file is written there once,
+  /// atomically (temp file and rename), and returned as given. Without it
+  /// the result goes to a uniquely named temporary file
+  ///
+  /// The EXIF orientation is applied by moving the compressed DCT blocks and
+  /// the tag is reset to 1, so there is no generational quality loss and the
+  /// decode/encode cost is skipped. Partial blocks on an edge that has to be
+  /// mirrored cannot move and are trimmed (at most 15 pixels). Returns null
+  /// for non-JPEG input.
+  /// example:
+  /// ```dart
+  /// final upright = await ThinPicCompress.transformJpegLossless(
+  ///   'path/to/photo.jpg',
+  ///   cropX: 100,
+  ///   cropY: 100,
+  ///   cropWidth: 1080,
+  ///   cropHeight: 1080,
+  /// );
+  /// ```
+  static Future<File?> transformJpegLossless(
+    String imagePath, {
+    int cropX = 0,
+    int cropY = 0,
+    int cropWidth = 0,
+    int cropHeight = 0,
+    CompressionCancelToken? cancelToken,
+    String? outputPath,
+  }) async {
+    try {
+      final tempFile = await _outputFile(outputPath, '_lossless.jpg');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_LOSSLESS_JPEG,
+        cropX: cropX,
+        cropY: cropY,
+        cropWidth: cropWidth,
+        cropHeight: cropHeight,
+        cancelToken: cancelToken,
+      );
+
+      if (output != null) {
+        debugPrint(
+          'Lossless transform successful, bytes length: ${output.length}',
+        );
+        debugPrint('Transformed image saved to: ${tempFile.path}');
+
+        return _withOutputExtension(tempFile, output.format, outputPath);
+      }
+    } catch (e, stackTrace) {
+      debugPrint('Error during lossless transform: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// shrink a JPEG without touching its pixels
+  ///
+  /// [imagePath] - path to a JPEG image
+  /// [cancelToken] - optional token to abandon the re-code natively
+  /// [outputPath] - optional destination; the file is written there once,
+  /// atomically (temp file and rename), and returned as given. Without it
+  /// the result goes to a uniquely named temporary file
+  ///
+  /// The quantized DCT coefficients are kept as they are and only the
+  /// entropy coding is redone, like `jpegtran -optimize -progressive
+  /// -copy none`: Huffman tables computed for this image, progressive scans
+  /// and no metadata (EXIF, XMP, ICC and comments all go). The EXIF
+  /// orientation is applied to the blocks first, so the image stays
+  /// upright. Returns null for non-JPEG input.
+  /// example:
+  /// ```dart
+  /// final smaller = await ThinPicCompress.optimizeJpegLossless(
+  ///   'path/to/photo.jpg',
+  /// );
+  /// ```
+  static Future<File?> optimizeJpegLossless(
+    String imagePath, {
+    CompressionCancelToken? cancelToken,
+    String? outputPath,
+  }) async {
+    try {
+      final tempFile = await _outputFile(outputPath, '_optimized.jpg');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_JPEG_OPTIMIZE,
+        cancelToken: cancelToken,
+      );
+
+      if (output != null) {
+        debugPrint(
+          'Lossless optimize successful, bytes length: ${output.length}',
+        );
+        debugPrint('Optimized image saved to: ${tempFile.path}');
+
+        return _withOutputExtension(tempFile, output.format, outputPath);
+      }
+    } catch (e, stackTrace) {
+      debugPrint('Error during lossless optimize: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress a list of images on the native worker pool
+  ///
+  /// [imagePaths] - paths to the images to compress
+  /// [quality] - quality of the compressed images
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed images
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [priority] - [ThinpicPriority.THINPIC_PRIORITY_BACKGROUND] for batches
+  /// nobody is waiting on: every other compression starts ahead of the
+  /// queued items, one worker stays free for them, and the items run at a
+  /// lower thread priority on the efficiency cores
+  /// [outputPaths] - optional destination per input, in the same order;
+  /// each is written once, atomically. Without them every result goes to
+  /// a uniquely named temporary file
+  ///
+  /// Returns one entry per input path, in the same order; entries are null
+  /// for images that failed to compress.
+  /// example:
+  /// ```dart
+  /// final files = await ThinPicCompress.compressBatch(
+  ///   ['path/to/a.jpg', 'path/to/b.jpg'],
+  ///   quality: 80,
+  ///   targetWidth: 1920,
+  /// );
+  /// ```
+  static Future<List<File?>> compressBatch(
+    List<String> imagePaths, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+    ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+    List<String>? outputPaths,
+  }) async {
+    if (imagePaths.isEmpty) {
+      return const [];
+    }
+    _checkOutputPaths(imagePaths, outputPaths);
+    try {
+      final extension = _getFileExtension(format);
+      final tempFiles = await Future.wait([
+        for (var i = 0; i < imagePaths.length; i++)
+          _outputFile(outputPaths?[i], '_$i.$extension'),
+      ]);
+      // Every item is its own file job, all submitted in one native call;
+      // the native pool does the fan-out
+      final outputs = await runCompressionJobsToFilesWithInfo(
+        imagePaths,
+        [for (final file in tempFiles) file.path],
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+        priority: priority,
+      );
+      final files = await Future.wait([
+        for (var i = 0; i < imagePaths.length; i++)
+          () async {
+            final output = outputs[i];
+            return output == null
+                ? null
+                : _withOutputExtension(
+                    tempFiles[i],
+                    output.format,
+                    outputPaths?[i],
+                  );
+          }(),
+      ]);
+      debugPrint(
+        'Batch compression finished: '
+        '${files.where((f) => f != null).length}/${files.length} succeeded',
+      );
+      return files;
+    } catch (e, stackTrace) {
+      debugPrint('Error during batch compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return List<File?>.filled(imagePaths.length, null);
+  }
 
-class ThinPicCompress {
-  static Future<ImageInfoData?> getImageInfo(String imagePath) async {
-    final result = await compute(_getImageInfoIsolate, {
-      'imagePath': imagePath,
+  /// compress a list of images, handing each one over as soon as it is done
+  ///
+  /// [imagePaths] - paths to the images to compress
+  /// [quality] - quality of the compressed images
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed images
+  /// [lookAhead] - how many images may be compressing, or done and waiting
+  /// for the listener, at once
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [priority] - pool priority of the items, as in [compressBatch]
+  /// [outputPaths] - optional destination per input, as in [compressBatch]
+  ///
+  /// Items arrive in the order they finish, tagged with their index. While
+  /// the listener is busy with one item (for example uploading it inside an
+  /// `await for`), at most [lookAhead] more compress in the background, so
+  /// the network and the CPU are busy at the same time without the whole
+  /// batch piling up in temporary files. Cancelling the subscription drops
+  /// the items still queued.
+  /// example:
+  /// ```dart
+  /// await for (final item in ThinPicCompress.compressBatchStream(
+  ///   paths,
+  ///   targetWidth: 1920,
+  ///   lookAhead: 3,
+  /// )) {
+  ///   if (item.file != null) await upload(item.file!);
+  /// }
+  /// ```
+  static Stream<CompressedBatchItem> compressBatchStream(
+    List<String> imagePaths, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int lookAhead = 2,
+    CompressionCancelToken? cancelToken,
+    ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+    List<String>? outputPaths,
+  }) async* {
+    if (imagePaths.isEmpty) {
+      return;
+    }
+    _checkOutputPaths(imagePaths, outputPaths);
+    final extension = _getFileExtension(format);
+    final paths = outputPaths ??
+        [
+          for (var i = 0; i < imagePaths.length; i++)
+            (await _outputFile(null, '_$i.$extension')).path,
+        ];
+    await for (final item in runCompressionJobsToFiles(
+      imagePaths,
+      paths,
+      lookAhead: lookAhead,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      format: format,
+      cancelToken: cancelToken,
+      priority: priority,
+    )) {
+      yield CompressedBatchItem(
+        item.index,
+        item.length >= 0 ? File(paths[item.index]) : null,
+      );
+    }
+  }
+
+  /// compress every image a stream delivers, in constant memory
+  ///
+  /// [sources] - the images, as [ImageSource.file] or [ImageSource.bytes];
+  /// a source with an `outputPath` is written there, any other comes back
+  /// as bytes
+  /// [quality] - quality of the compressed images
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed images
+  /// [maxInFlight] - how many images may be compressing, or done and
+  /// waiting for the listener, at once
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [priority] - pool priority of the items, as in [compressBatch]
+  ///
+  /// Items run on the native worker pool and arrive in the order they
+  /// finish, tagged with the source's index. The next source is read from
+  /// [sources] only when fewer than [maxInFlight] items are outstanding, so
+  /// a paused listener pauses the source too, and hundreds of images need
+  /// no more memory than [maxInFlight] of them. Cancelling the subscription
+  /// drops the items still queued.
+  /// example:
+  /// ```dart
+  /// final sources = Stream.fromIterable(
+  ///   [for (final path in paths) ImageSource.file(path)],
+  /// );
+  /// await for (final result in ThinPicCompress.compressAll(
+  ///   sources,
+  ///   targetWidth: 1920,
+  /// )) {
+  ///   if (result.succeeded) await upload(result.bytes!);
+  /// }
+  /// ```
+  static Stream<CompressionResult> compressAll(
+    Stream<ImageSource> sources, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int maxInFlight = 4,
+    CompressionCancelToken? cancelToken,
+    ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+  }) async* {
+    // The index is the source's position; keep each source only until its
+    // result is handed over
+    final taken = <int, ImageSource>{};
+    var count = 0;
+    final tagged = sources.map((source) {
+      taken[count++] = source;
+      return source;
     });
-    return result;
+    await for (final item in runCompressionJobsFromStream(
+      tagged,
+      maxInFlight: maxInFlight,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      format: format,
+      cancelToken: cancelToken,
+      priority: priority,
+    )) {
+      final source = taken.remove(item.index)!;
+      final outputPath = source.outputPath;
+      yield CompressionResult(
+        item.index,
+        source,
+        bytes: item.bytes,
+        file: item.length >= 0 && outputPath != null ? File(outputPath) : null,
+      );
+    }
   }
 
-  /// compress image with format
+  /// compress a whole directory so that a killed app resumes the batch
   ///
-  /// [imagePath] - path to the image to compress
-  /// [quality] - quality of the compressed image
-  /// [format] - format of the compressed image
+  /// [source] - a directory (every image in it, by name) or a text file
+  /// listing one image path per line
+  /// [outputDirectory] - where `<name>.<format extension>` files are written
+  /// (created if missing; input names must differ by more than extension)
+  /// [manifestPath] - append-only record of finished inputs; keep it across
+  /// launches, for example next to the outputs
+  /// [quality] - quality of the compressed images
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed images
+  /// [priority] - pool priority of the items, as in [compressBatch]
   ///
-  /// Returns a [File] object if compression is successful, otherwise returns null
+  /// Items run on the native worker pool, a few ahead of the one being
+  /// recorded, and each finished or failed input is appended to the
+  /// manifest and synced to disk. Calling again with the same manifest
+  /// skips everything it lists, so after Android kills the app mid-batch
+  /// the next call continues instead of restarting. Runs in a background
+  /// isolate and returns how many inputs the manifest records as done, or
+  /// -1 when the source cannot be read.
   /// example:
   /// ```dart
-  /// final result = await ThinPicCompress.compressImage(
-  ///   'path/to/image.jpg',
-  ///   quality: 80,
-  ///   format: ImageFormat.FORMAT_PNG,
+  /// final done = await ThinPicCompress.compressDirectory(
+  ///   '${docs.path}/originals',
+  ///   '${docs.path}/compressed',
+  ///   '${docs.path}/compressed/manifest.tsv',
+  ///   targetWidth: 1920,
+  ///   priority: ThinpicPriority.THINPIC_PRIORITY_BACKGROUND,
   /// );
   /// ```
-  static Future<File?> compressImage(
-    String imagePath, {
+  static Future<int> compressDirectory(
+    String source,
+    String outputDirectory,
+    String manifestPath, {
     int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
     ImageFormat format = ImageFormat.FORMAT_JPEG,
+    ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
   }) async {
     try {
-      final result = await compute(_compressImageIsolate, {
-        'imagePath': imagePath,
+      return await compute(_compressDirectoryIsolate, {
+        'source': source,
+        'outputDirectory': outputDirectory,
+        'manifestPath': manifestPath,
+        'format': format,
         'quality': quality,
+        'targetWidth': targetWidth,
+        'targetHeight': targetHeight,
+        'priority': priority,
+      });
+    } catch (e, stackTrace) {
+      debugPrint('Error during directory compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return -1;
+  }
+
+  /// compress only what changed in a folder since the last sync
+  ///
+  /// [source] - a directory (every image in it, by name) or a text file
+  /// listing one image path per line
+  /// [outputDirectory] - where `<name>.<format extension>` files are written,
+  /// as in [compressDirectory]
+  /// [indexPath] - the sync index; keep it across runs, for example next to
+  /// the outputs
+  /// [quality] - quality of the compressed images
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed images
+  /// [priority] - pool priority of the items, as in [compressBatch]
+  ///
+  /// The index records each input's modification time, size and a hash of
+  /// the options next to its output. A sync stats every input and compresses
+  /// only those that are new or changed, were done with other options, or
+  /// whose output was deleted, through the same native pool as
+  /// [compressDirectory]; a folder of ten thousand unchanged photos syncs in
+  /// the time the stats take. Entries for inputs that have gone are dropped
+  /// from the index, their outputs are left. Runs in a background isolate
+  /// and returns how many inputs are up to date, or -1 when the source
+  /// cannot be read.
+  /// example:
+  /// ```dart
+  /// final upToDate = await ThinPicCompress.syncDirectory(
+  ///   '${docs.path}/camera',
+  ///   '${docs.path}/synced',
+  ///   '${docs.path}/synced/index.tsv',
+  ///   targetWidth: 2048,
+  /// );
+  /// ```
+  static Future<int> syncDirectory(
+    String source,
+    String outputDirectory,
+    String indexPath, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+  }) async {
+    try {
+      return await compute(_syncDirectoryIsolate, {
+        'source': source,
+        'outputDirectory': outputDirectory,
+        'indexPath': indexPath,
         'format': format,
+        'quality': quality,
+        'targetWidth': targetWidth,
+        'targetHeight': targetHeight,
+        'priority': priority,
       });
+    } catch (e, stackTrace) {
+      debugPrint('Error during directory sync: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return -1;
+  }
 
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
-        debugPrint('Compression successful, bytes length: ${bytes.length}');
+  /// the batch an Android WorkManager worker or foreground service runs
+  ///
+  /// `ThinpicBatchWorker` (or `ThinpicBackgroundEngine.compressDirectory`
+  /// from a service) runs [compressDirectory] on the native engine without a
+  /// Flutter isolate, so a large batch keeps going while the app is in the
+  /// background, on the same worker pool and memory governor. Call this when
+  /// the app attaches again, for example at start-up or on resume, to show
+  /// its progress or collect the outputs; `started` identifies the run. A
+  /// process started fresh reports
+  /// [ThinpicBackgroundState.THINPIC_BACKGROUND_IDLE]; the manifest still
+  /// records what earlier processes finished.
+  /// example:
+  /// ```dart
+  /// final batch = ThinPicCompress.backgroundBatchStatus();
+  /// if (batch.state == ThinpicBackgroundState.THINPIC_BACKGROUND_RUNNING) {
+  ///   showProgress(batch.done, batch.total);
+  /// }
+  /// ```
+  static BackgroundBatchStatus backgroundBatchStatus() {
+    return readBackgroundBatch();
+  }
 
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file with appropriate extension
-        final extension = _getFileExtension(format);
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}.$extension',
-        );
-        await tempFile.writeAsBytes(bytes);
-        debugPrint('Compressed image saved to: ${tempFile.path}');
+  /// stop the running background batch: nothing more is started, items in
+  /// flight are cancelled and left for the next run of the same manifest
+  static void stopBackgroundBatch() {
+    stopBackgroundBatchRun();
+  }
 
-        return tempFile;
-      }
+  /// measure what compressing an image costs natively
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed image
+  ///
+  /// Runs the compression, discards the output and returns its
+  /// [CompressionStats] (latency, libvips peak memory growth, buffers still
+  /// open), or null on failure. Memory is tracked process-wide, so measure
+  /// with no other compression in flight.
+  static Future<CompressionStats?> measureCompression(
+    String imagePath, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+  }) async {
+    try {
+      return await measureCompressionJob(
+        imagePath,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+      );
     } catch (e, stackTrace) {
       debugPrint('Error during compression: $e');
       debugPrint('Stack trace: $stackTrace');
@@ -150,55 +2944,226 @@ class ThinPicCompress {
     return null;
   }
 
-  /// compress image with size and format
+  /// profile which libvips operations compressing an image spends its time in
   ///
   /// [imagePath] - path to the image to compress
   /// [quality] - quality of the compressed image
-  /// [targetWidth] - target width of the compressed image
-  /// [targetHeight] - target height of the compressed image
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
   /// [format] - format of the compressed image
-  ///  example:
-  /// ```dart
-  /// final result = await ThinPicCompress.compressImageWithSizeAndFormat(
-  ///   'path/to/image.jpg',
-  ///   quality: 80,
-  ///   targetWidth: 1024,
-  ///   targetHeight: 1024,
-  ///   format: ImageFormat.FORMAT_PNG,
-  /// );
-  /// ```
-  static Future<File?> compressImageWithSizeAndFormat(
-    String imagePath,
-    int quality,
-    int targetWidth,
-    int targetHeight,
-    ImageFormat format,
-  ) async {
+  ///
+  /// Runs the compression with operation profiling on, discards the output
+  /// and returns a [CompressionProfile]: each libvips operation built
+  /// (calls, regions, own time, pixels) slowest first, each worker thread's
+  /// busy time, and the job's elapsed and encode time, or null on failure.
+  /// Profiling is process-wide and clears the libvips operation cache, so
+  /// profile with no other compression in flight, and not in production.
+  static Future<CompressionProfile?> profileCompression(
+    String imagePath, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+  }) async {
     try {
-      final result = await compute(_compressImageWithSizeAndFormatIsolate, {
+      return await compute(_profileCompressionIsolate, {
         'imagePath': imagePath,
         'quality': quality,
         'targetWidth': targetWidth,
         'targetHeight': targetHeight,
         'format': format,
       });
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
 
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
-        debugPrint('Compression successful, bytes length: ${bytes.length}');
+  /// Per-job telemetry collected natively since the last call, oldest first.
+  ///
+  /// One record per pool, bytes and descriptor compression: mode, input and
+  /// output size, source dimensions, [CompressionStats] (stage timings, peak
+  /// memory, chosen quality and format) and a [ThinpicTelemetryError]. The
+  /// first call starts recording and returns an empty list; until then the
+  /// native side records nothing. Poll for example once a minute and upload
+  /// the batch; the native ring keeps the last [THINPIC_TELEMETRY_RECORDS]
+  /// jobs, and gaps in `sequence` count any that were overwritten.
+  static List<ThinpicTelemetryRecord> drainTelemetry() {
+    return drainTelemetryRecords();
+  }
 
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file with appropriate extension
-        final extension = _getFileExtension(format);
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}.$extension',
-        );
-        await tempFile.writeAsBytes(bytes);
-        debugPrint('Compressed image saved to: ${tempFile.path}');
+  /// load the tuning presets of a remote config
+  ///
+  /// [json] - `{"default": name, "presets": [...]}`, each preset with an
+  /// `id`, a `name` and any of `maxDimension`, `minimalMaxDimension`,
+  /// `smartQuality` (four qualities by smart type), `searchStartQuality`
+  /// and `searchEndQuality`
+  ///
+  /// The caps and quality ladders of the compression modes (6000 px on the
+  /// long side, 8000 for fast WebP (`COMPRESS_MODE_FAST_WEBP`), smart
+  /// qualities 85/95/60/30, size searches from 85 down to 40) come from the
+  /// default preset from then on; keys a preset leaves out keep those
+  /// built-in values. The JSON is parsed once into a fixed native table,
+  /// which jobs read one entry of when they start, so reloading never
+  /// touches a running job. Every
+  /// [drainTelemetry] record carries the `preset` id its job ran with.
+  /// Returns how many presets were loaded, or -1 (nothing changes) when the
+  /// config is invalid.
+  /// example:
+  /// ```dart
+  /// ThinPicCompress.loadPresets(remoteConfig.getString('thinpic_presets'));
+  /// ```
+  static int loadPresets(String json) {
+    return loadCompressionPresets(json);
+  }
+
+  /// id of the loaded preset called [name], or 0; telemetry records report
+  /// presets by id
+  static int presetId(String name) {
+    return compressionPresetId(name);
+  }
+
+  /// compress an already-encoded image held in memory
+  ///
+  /// [bytes] - encoded image (for example from a network response or picker)
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed image
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [onProgress] - optional 0-100 progress, reported for images of 4 MP
+  /// and up at most 10 times a second, always ending at 100
+  ///
+  /// The bytes go straight to the native decoder, so no temporary input file
+  /// is written. Returns the compressed bytes, or null on failure.
+  /// example:
+  /// ```dart
+  /// final compressed = await ThinPicCompress.compressBytes(
+  ///   response.bodyBytes,
+  ///   quality: 75,
+  ///   targetWidth: 1280,
+  /// );
+  /// ```
+  static Future<Uint8List?> compressBytes(
+    Uint8List bytes, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+    void Function(int percent)? onProgress,
+  }) async {
+    try {
+      final result = await runCompressionJobFromBytes(
+        bytes,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+        onProgress: onProgress,
+      );
+      if (result != null) {
+        debugPrint('Compression successful, bytes length: ${result.length}');
+      }
+      return result;
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// compress an image for Android code to send, without a copy in Dart
+  ///
+  /// [imagePath] - path to the image to compress
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed image
+  /// [cancelToken] - optional token to abandon the compression natively
+  ///
+  /// The encoded bytes stay in native memory. Pass the returned handle to
+  /// Java over your own platform channel; there
+  /// `ThinpicNativeBuffer.take(handle)` wraps them in a direct `ByteBuffer`
+  /// (for example an OkHttp request body) and `close()` frees them. Release
+  /// a handle that never reaches Java with [releaseNativeBuffer]. Returns
+  /// the handle, or null on failure.
+  /// example:
+  /// ```dart
+  /// final handle = await ThinPicCompress.compressToNativeBuffer(path);
+  /// if (handle != null) await uploadChannel.invokeMethod('upload', handle);
+  /// ```
+  static Future<int?> compressToNativeBuffer(
+    String imagePath, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+  }) async {
+    try {
+      return await runCompressionJobToNativeBuffer(
+        imagePath,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+      );
+    } catch (e, stackTrace) {
+      debugPrint('Error during compression: $e');
+      debugPrint('Stack trace: $stackTrace');
+    }
+    return null;
+  }
+
+  /// frees a [compressToNativeBuffer] result that was not handed to Java;
+  /// false if the handle is unknown or already released
+  static bool releaseNativeBuffer(int handle) {
+    return releaseNativeBufferHandle(handle);
+  }
 
-        return tempFile;
+  /// compress an image read from an open file descriptor
+  ///
+  /// [fd] - descriptor of the encoded image, for example
+  /// `ParcelFileDescriptor.getFd()` / `detachFd()` for a `content://` URI
+  /// [quality] - quality of the compressed image
+  /// [targetWidth] - optional target width (0 keeps the original size)
+  /// [targetHeight] - optional target height (0 keeps the original size)
+  /// [format] - format of the compressed image
+  /// [cancelToken] - optional token to abandon the compression natively
+  /// [onProgress] - optional 0-100 progress, reported for images of 4 MP
+  /// and up at most 10 times a second, always ending at 100
+  ///
+  /// libvips streams from the descriptor directly, so picker results do not
+  /// need to be copied into the cache directory first. The native side works
+  /// on its own duplicate; closing [fd] stays with the caller.
+  /// Returns the compressed bytes, or null on failure.
+  static Future<Uint8List?> compressFileDescriptor(
+    int fd, {
+    int quality = 80,
+    int targetWidth = 0,
+    int targetHeight = 0,
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    CompressionCancelToken? cancelToken,
+    void Function(int percent)? onProgress,
+  }) async {
+    try {
+      final result = await runCompressionJobFromFd(
+        fd,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        format: format,
+        cancelToken: cancelToken,
+        onProgress: onProgress,
+      );
+      if (result != null) {
+        debugPrint('Compression successful, bytes length: ${result.length}');
       }
+      return result;
     } catch (e, stackTrace) {
       debugPrint('Error during compression: $e');
       debugPrint('Stack trace: $stackTrace');
@@ -212,27 +3177,21 @@ class ThinPicCompress {
     ImageFormat format,
   ) async {
     try {
-      final result = await compute(_compressLargeImageWithFormatIsolate, {
-        'imagePath': imagePath,
-        'quality': quality,
-        'format': format,
-      });
-
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
-        debugPrint('Compression successful, bytes length: ${bytes.length}');
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(null, '.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_LARGE,
+        quality: quality,
+        format: format,
+      );
 
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file with appropriate extension
-        final extension = _getFileExtension(format);
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}.$extension',
-        );
-        await tempFile.writeAsBytes(bytes);
+      if (output != null) {
+        debugPrint('Compression successful, bytes length: ${output.length}');
         debugPrint('Compressed image saved to: ${tempFile.path}');
 
-        return tempFile;
+        return _withOutputExtension(tempFile, output.format, null);
       }
     } catch (e, stackTrace) {
       debugPrint('Error during compression: $e');
@@ -247,27 +3206,21 @@ class ThinPicCompress {
     ImageFormat format,
   ) async {
     try {
-      final result = await compute(_compressLargeDslrImageWithFormatIsolate, {
-        'imagePath': imagePath,
-        'quality': quality,
-        'format': format,
-      });
-
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
-        debugPrint('Compression successful, bytes length: ${bytes.length}');
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(null, '.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_LARGE_DSLR,
+        quality: quality,
+        format: format,
+      );
 
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file with appropriate extension
-        final extension = _getFileExtension(format);
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}.$extension',
-        );
-        await tempFile.writeAsBytes(bytes);
+      if (output != null) {
+        debugPrint('Compression successful, bytes length: ${output.length}');
         debugPrint('Compressed image saved to: ${tempFile.path}');
 
-        return tempFile;
+        return _withOutputExtension(tempFile, output.format, null);
       }
     } catch (e, stackTrace) {
       debugPrint('Error during compression: $e');
@@ -283,28 +3236,22 @@ class ThinPicCompress {
     ImageFormat format,
   ) async {
     try {
-      final result = await compute(_smartCompressImageWithFormatIsolate, {
-        'imagePath': imagePath,
-        'targetKb': targetKb,
-        'type': type,
-        'format': format,
-      });
+      final extension = _getFileExtension(format);
+      final tempFile = await _outputFile(null, '.$extension');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_SMART,
+        targetKb: targetKb,
+        smartType: type,
+        format: format,
+      );
 
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
-        debugPrint('Compression successful, bytes length: ${bytes.length}');
-
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file with appropriate extension
-        final extension = _getFileExtension(format);
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}.$extension',
-        );
-        await tempFile.writeAsBytes(bytes);
+      if (output != null) {
+        debugPrint('Compression successful, bytes length: ${output.length}');
         debugPrint('Compressed image saved to: ${tempFile.path}');
 
-        return tempFile;
+        return _withOutputExtension(tempFile, output.format, null);
       }
     } catch (e, stackTrace) {
       debugPrint('Error during compression: $e');
@@ -316,29 +3263,25 @@ class ThinPicCompress {
   static Future<File?> _autoCompressImage(
     String imagePath, {
     int quality = 80,
+    int acceptBelowKb = 0,
   }) async {
     try {
-      final result = await compute(_autoCompressImageIsolate, {
-        'imagePath': imagePath,
-        'quality': quality,
-      });
+      final tempFile = await _outputFile(null, '_auto');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_AUTO,
+        quality: quality,
+        targetKb: acceptBelowKb,
+      );
 
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
+      if (output != null) {
         debugPrint(
-          'Auto-compression successful, bytes length: ${bytes.length}',
-        );
-
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file with auto-detected extension
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}_auto',
+          'Auto-compression successful, bytes length: ${output.length}',
         );
-        await tempFile.writeAsBytes(bytes);
         debugPrint('Auto-compressed image saved to: ${tempFile.path}');
 
-        return tempFile;
+        return _withOutputExtension(tempFile, output.format, null);
       }
     } catch (e, stackTrace) {
       debugPrint('Error during auto-compression: $e');
@@ -352,27 +3295,21 @@ class ThinPicCompress {
     int quality = 80,
   }) async {
     try {
-      final result = await compute(_fastWebPCompressIsolate, {
-        'imagePath': imagePath,
-        'quality': quality,
-      });
+      final tempFile = await _outputFile(null, '_fast.webp');
+      final output = await runCompressionJobToFileWithInfo(
+        imagePath,
+        tempFile.path,
+        mode: CompressMode.COMPRESS_MODE_FAST_WEBP,
+        quality: quality,
+      );
 
-      if (isCompressionSuccessful(result)) {
-        final bytes = compressedResultToBytes(result);
+      if (output != null) {
         debugPrint(
-          'Fast WebP compression successful, bytes length: ${bytes.length}',
+          'Fast WebP compression successful, bytes length: ${output.length}',
         );
-
-        // temp path
-        final tempPath = await getTemporaryDirectory();
-        // save to temp file
-        final tempFile = File(
-          '${tempPath.path}/ ${DateTime.now().millisecondsSinceEpoch}_fast.webp',
-        );
-        await tempFile.writeAsBytes(bytes);
         debugPrint('Fast WebP compressed image saved to: ${tempFile.path}');
 
-        return tempFile;
+        return _withOutputExtension(tempFile, output.format, null);
       }
     } catch (e, stackTrace) {
       debugPrint('Error during fast WebP compression: $e');
@@ -381,27 +3318,165 @@ class ThinPicCompress {
     return null;
   }
 
+  static int _outputSequence = 0;
+
+  // The caller's destination, or a temp file no other call in this or any
+  // other process can be handed: pid, time and a per-process sequence
+  static Future<File> _outputFile(String? outputPath, String suffix) async {
+    if (outputPath != null) {
+      return File(outputPath);
+    }
+    final tempPath = await getTemporaryDirectory();
+    final stamp = DateTime.now().microsecondsSinceEpoch;
+    return File(
+      '${tempPath.path}/thinpic_${pid}_${stamp}_${_outputSequence++}$suffix',
+    );
+  }
+
+  static void _checkOutputPaths(
+    List<String> imagePaths,
+    List<String>? outputPaths,
+  ) {
+    if (outputPaths != null && outputPaths.length != imagePaths.length) {
+      throw ArgumentError.value(
+        outputPaths.length,
+        'outputPaths',
+        'must have one path per input (${imagePaths.length})',
+      );
+    }
+  }
+
+  // Renames a written temp file to the extension of the format actually
+  // encoded; FORMAT_AUTO and fallbacks can differ from the one guessed. A
+  // caller's outputPath is never renamed
+  static Future<File> _withOutputExtension(
+    File file,
+    ImageFormat format,
+    String? outputPath,
+  ) async {
+    if (outputPath != null || format == ImageFormat.FORMAT_AUTO) {
+      return file;
+    }
+    final extension = _getFileExtension(format);
+    final path = file.path;
+    if (path.endsWith('.$extension')) {
+      return file;
+    }
+    final slash = path.lastIndexOf('/');
+    final dot = path.lastIndexOf('.');
+    final stem = dot > slash ? path.substring(0, dot) : path;
+    return file.rename('$stem.$extension');
+  }
+
   // Helper function to get file extension based on format
   static String _getFileExtension(ImageFormat format) {
     switch (format) {
       case ImageFormat.FORMAT_JPEG:
         return 'jpg';
-      // case ImageFormat.FORMAT_PNG:
-      //   return 'png';
+      case ImageFormat.FORMAT_PNG:
+        return 'png';
       case ImageFormat.FORMAT_WEBP:
         return 'webp';
-      // case ImageFormat.FORMAT_TIFF:
-      //   return 'tiff';
-      // case ImageFormat.FORMAT_HEIF:
-      //   return 'heif';
-      // case ImageFormat.FORMAT_JP2K:
-      //   return 'jp2';
-      // case ImageFormat.FORMAT_JXL:
-      //   return 'jxl';
-      // case ImageFormat.FORMAT_GIF:
-      // return 'gif';
+      case ImageFormat.FORMAT_TIFF:
+        return 'tiff';
+      case ImageFormat.FORMAT_HEIF:
+        return 'heif';
+      case ImageFormat.FORMAT_JP2K:
+        return 'jp2';
+      case ImageFormat.FORMAT_JXL:
+        return 'jxl';
+      case ImageFormat.FORMAT_GIF:
+        return 'gif';
       case ImageFormat.FORMAT_AUTO:
         return 'jpg'; // Default to jpg for auto
+      case ImageFormat.FORMAT_AVIF:
+        return 'avif';
     }
   }
 }
+
+/// An image opened once for several operations, for flows that read its
+/// info and then compress it once or more.
+///
+/// [open] maps the file and parses its header once; [info], [compress] and
+/// [compressVariants] then reuse them instead of reopening the file. The
+/// decoded, shrunk image of a [compress] is kept in memory (up to
+/// `configure(handleCacheMb:)`, 64 MB by default). A later call for the same
+/// box or a smaller one resizes it instead of decoding again. Calls on one
+/// image run one at a time, and [close] releases the native memory.
+/// example:
+/// ```dart
+/// final image = await ThinPicImage.open(path);
+/// if (image != null) {
+///   final info = await image.info();
+///   final full = await image.compress(maxWidth: 2048, maxHeight: 2048);
+///   final thumb = await image.compress(maxWidth: 320, maxHeight: 320);
+///   await image.close();
+/// }
+/// ```
+class ThinPicImage {
+  ThinPicImage._(this._handle);
+
+  int _handle;
+  // Native handles are not thread-safe: each call waits for the one before
+  Future<void> _last = Future.value();
+
+  /// Opens [imagePath], or returns null if it cannot be read.
+  static Future<ThinPicImage?> open(String imagePath) async {
+    final handle = await compute(_openImageHandleIsolate, imagePath);
+    return handle == 0 ? null : ThinPicImage._(handle);
+  }
+
+  Future<T?> _run<T>(Future<T?> Function(int handle) call) {
+    final result = _last.then<T?>((_) => _handle == 0 ? null : call(_handle));
+    _last = result.then((_) {}, onError: (_) {});
+    return result;
+  }
+
+  /// The header read by [open]; no file access.
+  Future<ImageInfoData?> info() =>
+      _run((handle) async => imageHandleInfo(handle));
+
+  /// Compresses the image; arguments as for
+  /// [ThinPicCompress.compressWithOptions]. Returns null on failure.
+  Future<Uint8List?> compress({
+    ImageFormat format = ImageFormat.FORMAT_JPEG,
+    int quality = 80,
+    int effort = -1,
+    int maxWidth = 0,
+    int maxHeight = 0,
+    ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+  }) {
+    return _run(
+      (handle) => compute(_compressImageHandleIsolate, {
+        'handle': handle,
+        'format': format,
+        'quality': quality,
+        'effort': effort,
+        'maxWidth': maxWidth,
+        'maxHeight': maxHeight,
+        'strip': strip,
+      }),
+    );
+  }
+
+  /// [ThinPicCompress.compressVariants] on this image.
+  Future<List<Uint8List?>?> compressVariants(List<ImageVariant> variants) {
+    return _run(
+      (handle) => compute(_compressImageHandleVariantsIsolate, {
+        'handle': handle,
+        'variants': variants,
+      }),
+    );
+  }
+
+  /// Releases the image; later calls return null.
+  Future<void> close() async {
+    await _run((handle) async {
+      closeImageHandle(handle);
+      _handle = 0;
+      return null;
+    });
+  }
+}
+
@@ -1,5 +1,8 @@
+import 'dart:async';
+import 'dart:convert';
 import 'dart:ffi';
 import 'dart:io';
+import 'dart:isolate';
 import 'dart:typed_data';
 
 import 'package:ffi/ffi.dart';
@@ -23,6 +26,10 @@ final DynamicLibrary _dylib = () {
 
 final ThinpicFlutterBindings _bindings = ThinpicFlutterBindings(_dylib);
 
+/// free_compressed_buffer, run by the GC once a result view is unreachable.
+final Pointer<NativeFinalizerFunction> _freeCompressedBufferFinalizer = _dylib
+    .lookup<NativeFinalizerFunction>('free_compressed_buffer');
+
 CompressedImageResult compressImage(String inputPath, int quality) {
   final inputPathPtr = inputPath.toNativeUtf8();
   try {
@@ -207,20 +214,3280 @@ ImageInfoData getImageInfo(String inputPath) {
   }
 }
 
+/// Reads dimensions, orientation, format and file size from the image header
+/// without decoding pixels. Cheap enough to call synchronously per grid item.
+ImageHeader probeImageHeader(String inputPath) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  try {
+    return _bindings.probe_image_header(inputPathPtr.cast<Char>());
+  } finally {
+    malloc.free(inputPathPtr);
+  }
+}
+
+/// Number of pages of a multi-page TIFF or PDF (frames of an animation), 1
+/// for other images, or -1 when the header cannot be read.
+int probePageCount(String inputPath) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  try {
+    return _bindings.probe_page_count(inputPathPtr.cast<Char>());
+  } finally {
+    malloc.free(inputPathPtr);
+  }
+}
+
+/// Where a motion photo keeps its video: the [kind] of file, the
+/// [stillLength] bytes of JPEG before it and the MP4's own [videoOffset] and
+/// [videoLength] within the file.
+typedef MotionPhotoInfo = ({
+  ThinpicMotionKind kind,
+  int stillLength,
+  int videoOffset,
+  int videoLength,
+});
+
+/// Finds the video of a Google or Samsung motion photo from its XMP and SEF
+/// trailer, without reading the video; null for any other image or when the
+/// file cannot be read.
+MotionPhotoInfo? probeMotionPhoto(String inputPath) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final out = calloc<ThinpicMotionPhoto>();
+  try {
+    if (_bindings.thinpic_motion_photo_probe(inputPathPtr.cast<Char>(), out) !=
+        1) {
+      return null;
+    }
+    return (
+      kind: out.ref.kind,
+      stillLength: out.ref.still_length,
+      videoOffset: out.ref.video_offset,
+      videoLength: out.ref.video_length,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(out);
+  }
+}
+
+/// Predicts the output size, time and memory of compressing [inputPath]
+/// from its header alone; `success != 1` when the header cannot be read.
+ThinpicEstimate estimateOutput(
+  String inputPath,
+  ImageFormat format,
+  int quality,
+  int maxWidth,
+  int maxHeight,
+) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  try {
+    return _bindings.thinpic_estimate_output(
+      inputPathPtr.cast<Char>(),
+      format,
+      quality,
+      maxWidth,
+      maxHeight,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+  }
+}
+
+typedef EmbeddedThumbnail = ({
+  Uint8List bytes,
+  int width,
+  int height,
+  int orientation,
+});
+
+/// The JPEG thumbnail embedded in the EXIF of [inputPath], as stored, read
+/// from the head of the file without decoding anything. [orientation] is
+/// the main image's EXIF orientation (0 when absent), which the thumbnail
+/// shares. Returns null when there is none, or when its longer side is
+/// under [minSize].
+EmbeddedThumbnail? extractExifThumbnail(String inputPath, {int minSize = 0}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  try {
+    final thumbnail = _bindings.extract_exif_thumbnail(
+      inputPathPtr.cast<Char>(),
+      minSize,
+    );
+    if (thumbnail.success != 1) {
+      return null;
+    }
+    return (
+      bytes: thumbnail.data.asTypedList(
+        thumbnail.length,
+        finalizer: _freeCompressedBufferFinalizer,
+      ),
+      width: thumbnail.width,
+      height: thumbnail.height,
+      orientation: thumbnail.orientation,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+  }
+}
+
+int _metadataEdits(bool stripGps, bool stripXmp, bool normalizeOrientation) {
+  return (stripGps ? ThinpicMetadataEdit.THINPIC_METADATA_STRIP_GPS.value : 0) |
+      (stripXmp ? ThinpicMetadataEdit.THINPIC_METADATA_STRIP_XMP.value : 0) |
+      (normalizeOrientation
+          ? ThinpicMetadataEdit.THINPIC_METADATA_NORMALIZE_ORIENTATION.value
+          : 0);
+}
+
+/// Rewrites the metadata of the JPEG, PNG or WebP at [inputPath] into
+/// [outputPath] (which may be [inputPath]) without re-encoding: the GPS
+/// block goes with [stripGps], XMP packets with [stripXmp], and an invalid
+/// EXIF orientation becomes 1 with [normalizeOrientation]. Returns the
+/// output's size, or -1 on failure.
+int rewriteImageMetadata(
+  String inputPath,
+  String outputPath, {
+  bool stripGps = true,
+  bool stripXmp = false,
+  bool normalizeOrientation = false,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final outputPathPtr = outputPath.toNativeUtf8();
+  try {
+    return _bindings.thinpic_rewrite_metadata(
+      inputPathPtr.cast<Char>(),
+      outputPathPtr.cast<Char>(),
+      _metadataEdits(stripGps, stripXmp, normalizeOrientation),
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    malloc.free(outputPathPtr);
+  }
+}
+
+/// [rewriteImageMetadata] on encoded [bytes]; an empty list on failure.
+Uint8List rewriteImageMetadataBytes(
+  Uint8List bytes, {
+  bool stripGps = true,
+  bool stripXmp = false,
+  bool normalizeOrientation = false,
+}) {
+  final data = malloc<Uint8>(bytes.length);
+  try {
+    data.asTypedList(bytes.length).setAll(0, bytes);
+    return compressedResultToBytes(
+      _bindings.thinpic_rewrite_metadata_buffer(
+        data,
+        bytes.length,
+        _metadataEdits(stripGps, stripXmp, normalizeOrientation),
+      ),
+    );
+  } finally {
+    malloc.free(data);
+  }
+}
+
+/// [strings] as NUL-terminated UTF-8 in one native allocation, behind a
+/// table of pointers to them and, in front of that, [slots] 64-bit result
+/// slots. A batch call then costs one allocation and one free however many
+/// paths it carries, instead of one [StringUtf8Pointer.toNativeUtf8] each.
+/// Free [arena] with [malloc].
+({Pointer<Uint8> arena, Pointer<Int64> slots, Pointer<Pointer<Char>> strings})
+_packStrings(List<String> strings, {int slots = 0}) {
+  final encoded = [for (final string in strings) utf8.encode(string)];
+  var textBytes = 0;
+  for (final bytes in encoded) {
+    textBytes += bytes.length + 1;
+  }
+  final slotBytes = slots * sizeOf<Int64>();
+  final tableBytes = slotBytes + strings.length * sizeOf<Pointer<Char>>();
+  final arena = malloc<Uint8>(tableBytes + textBytes);
+  final table = (arena + slotBytes).cast<Pointer<Char>>();
+  final text = arena + tableBytes;
+  final view = text.asTypedList(textBytes);
+  var offset = 0;
+  for (var i = 0; i < encoded.length; i++) {
+    table[i] = (text + offset).cast<Char>();
+    view.setAll(offset, encoded[i]);
+    offset += encoded[i].length;
+    view[offset++] = 0;
+  }
+  return (arena: arena, slots: arena.cast<Int64>(), strings: table);
+}
+
+/// [probeImageHeader] for a list of paths in one native call; the result
+/// matches [inputPaths] by index, failed entries have `success != 1`.
+List<ImageHeader> probeImageHeaders(List<String> inputPaths) {
+  final count = inputPaths.length;
+  if (count == 0) {
+    return const [];
+  }
+
+  final packed = _packStrings(inputPaths);
+  final out = calloc<ImageHeader>(count);
+  try {
+    _bindings.probe_image_headers(packed.strings, count, out);
+
+    // Copy into Dart-owned structs so the results outlive `out`
+    return List<ImageHeader>.generate(count, (i) {
+      final source = out[i];
+      return Struct.create<ImageHeader>()
+        ..width = source.width
+        ..height = source.height
+        ..bands = source.bands
+        ..orientation = source.orientation
+        ..format = source.format
+        ..file_size = source.file_size
+        ..success = source.success;
+    });
+  } finally {
+    malloc.free(packed.arena);
+    calloc.free(out);
+  }
+}
+
+/// Gallery sort and group keys for [inputPaths] from their headers and
+/// EXIF alone (thinpic_index_images); matches [inputPaths] by index, failed
+/// entries have `success != 1`.
+List<ThinpicImageMeta> indexImages(List<String> inputPaths) {
+  final count = inputPaths.length;
+  if (count == 0) {
+    return const [];
+  }
+
+  final packed = _packStrings(inputPaths);
+  final out = calloc<ThinpicImageMeta>(count);
+  try {
+    _bindings.thinpic_index_images(packed.strings, count, out);
+
+    return List<ThinpicImageMeta>.generate(count, (i) {
+      final source = out[i];
+      return Struct.create<ThinpicImageMeta>()
+        ..width = source.width
+        ..height = source.height
+        ..orientation = source.orientation
+        ..format = source.format
+        ..file_size = source.file_size
+        ..capture_time = source.capture_time
+        ..has_gps = source.has_gps
+        ..success = source.success;
+    });
+  } finally {
+    malloc.free(packed.arena);
+    calloc.free(out);
+  }
+}
+
 void freeCompressedBuffer(Pointer<Uint8> buffer) {
   _bindings.free_compressed_buffer(buffer);
 }
 
-void shutdownVips() => _bindings.shutdown_vips();
+/// This isolate's pool client ([thinpic_pool_client]), taken on its first
+/// pool job. Top-level finals are per isolate, so each `compute` isolate and
+/// each engine's isolates queue separately and share the workers fairly.
+final int _poolClient = _bindings.thinpic_pool_client();
 
-int testVipsBasic() => _bindings.test_vips_basic();
+void _writeCompressOptions(
+  CompressOptions options, {
+  required CompressMode mode,
+  required ImageFormat format,
+  required int quality,
+  required int targetWidth,
+  required int targetHeight,
+  required int targetKb,
+  required int smartType,
+  int cropX = 0,
+  int cropY = 0,
+  int cropWidth = 0,
+  int cropHeight = 0,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) {
+  options
+    ..modeAsInt = mode.value
+    ..formatAsInt = format.value
+    ..quality = quality
+    ..target_width = targetWidth
+    ..target_height = targetHeight
+    ..target_kb = targetKb
+    ..smart_type = smartType
+    ..crop_x = cropX
+    ..crop_y = cropY
+    ..crop_width = cropWidth
+    ..crop_height = cropHeight
+    ..priority = priority.value
+    ..client = _poolClient;
+}
+
+/// Cancels native compressions that are no longer wanted, for example when
+/// the user scrolls away from a photo.
+///
+/// Pass the same token to any number of compression calls; [cancel] drops
+/// their queued jobs and kills the running pipelines, and those calls then
+/// complete with null (or -1 for file output).
+class CompressionCancelToken {
+  bool _cancelled = false;
+  final Set<int> _jobIds = {};
+  final Set<CompressionCancelToken> _children = {};
+
+  bool get isCancelled => _cancelled;
+
+  void cancel() {
+    if (_cancelled) {
+      return;
+    }
+    _cancelled = true;
+    for (final jobId in _jobIds) {
+      _bindings.thinpic_cancel_job(jobId);
+    }
+    for (final child in _children) {
+      child.cancel();
+    }
+  }
+
+  /// A token cancelled along with this one that can also be cancelled alone.
+  CompressionCancelToken _child() {
+    final child = CompressionCancelToken();
+    if (_cancelled) {
+      child.cancel();
+    } else {
+      _children.add(child);
+    }
+    return child;
+  }
+
+  void _attach(int jobId) {
+    _jobIds.add(jobId);
+    if (_cancelled) {
+      _bindings.thinpic_cancel_job(jobId);
+    }
+  }
+
+  void _detach(int jobId) => _jobIds.remove(jobId);
+}
+
+/// Per-job progress listeners, keyed by native job id.
+final Map<int, void Function(int percent)> _progressListeners = {};
+NativeCallable<ThinpicProgressCallbackFunction>? _progressCallable;
+
+void _onNativeProgress(int jobId, int percent) {
+  _progressListeners[jobId]?.call(percent);
+}
+
+/// Installs the native progress callback on first use. It posts to this
+/// isolate from the native threads, so the encode never waits on Dart.
+void _ensureProgressCallback() {
+  if (_progressCallable != null) {
+    return;
+  }
+  final callable = NativeCallable<ThinpicProgressCallbackFunction>.listener(
+    _onNativeProgress,
+  );
+  // Progress alone should not keep the isolate running
+  callable.keepIsolateAlive = false;
+  _progressCallable = callable;
+  _bindings.thinpic_set_progress_callback(callable.nativeFunction, 100);
+}
+
+/// Completers of watched pool jobs, keyed by native job id.
+final Map<int, Completer<void>> _jobWaiters = {};
+NativeCallable<ThinpicJobCallbackFunction>? _jobCallable;
+
+void _onNativeJobFinished(int jobId, int status) {
+  _jobWaiters.remove(jobId)?.complete();
+  _jobCallable?.keepIsolateAlive = _jobWaiters.isNotEmpty;
+}
+
+/// Completes once [jobId] has finished. The worker that finishes it posts to
+/// this isolate through a listener callback, so nothing polls and no thread
+/// blocks; each isolate has its own callback, so jobs submitted from helper
+/// isolates report back to them.
+Future<void> _jobFinished(int jobId) {
+  final callable = _jobCallable ??=
+      NativeCallable<ThinpicJobCallbackFunction>.listener(
+        _onNativeJobFinished,
+      );
+  final completer = Completer<void>();
+  _jobWaiters[jobId] = completer;
+  // Pending jobs keep the isolate alive, as the poll timers used to
+  callable.keepIsolateAlive = true;
+  if (_bindings.thinpic_watch_job(jobId, callable.nativeFunction) != 0) {
+    // Already claimed; the caller's poll reports it as unknown
+    _jobWaiters.remove(jobId);
+    callable.keepIsolateAlive = _jobWaiters.isNotEmpty;
+    completer.complete();
+  }
+  return completer.future;
+}
+
+/// Streams the encoded output of [inputPath] in chunks of about 64 KB as the
+/// native saver produces them (stream_compress_image_to_callback).
+///
+/// The blocking native call runs on a helper isolate and posts each chunk
+/// back through a listener callback; every chunk is a view of its native
+/// buffer, released with free_compressed_buffer once unreachable. Chunks
+/// arrive in output order whether or not the stream is paused. The stream
+/// ends with an error if the compression fails, possibly after some chunks.
+Stream<Uint8List> streamCompressedChunks(
+  String inputPath, {
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+}) {
+  final controller = StreamController<Uint8List>();
+  late final NativeCallable<ThinpicChunkCallbackFunction> callable;
+  void finish(Object? error, [StackTrace? stackTrace]) {
+    if (controller.isClosed) {
+      return;
+    }
+    callable.close();
+    if (error != null) {
+      controller.addError(error, stackTrace);
+    }
+    controller.close();
+  }
+
+  callable = NativeCallable<ThinpicChunkCallbackFunction>.listener((
+    int streamId,
+    Pointer<Uint8> chunk,
+    int length,
+  ) {
+    if (chunk != nullptr) {
+      controller.add(
+        chunk.asTypedList(length, finalizer: _freeCompressedBufferFinalizer),
+      );
+      return;
+    }
+    finish(length < 0 ? StateError('Chunked compression failed') : null);
+  });
+  _runChunkedCompression(
+    inputPath,
+    quality,
+    targetWidth,
+    targetHeight,
+    format,
+    callable.nativeFunction.address,
+  ).then((_) {}, onError: finish);
+  return controller.stream;
+}
+
+// Kept apart so the isolate closure captures only sendable arguments
+Future<int> _runChunkedCompression(
+  String inputPath,
+  int quality,
+  int targetWidth,
+  int targetHeight,
+  ImageFormat format,
+  int callbackAddress,
+) {
+  return Isolate.run(() {
+    final inputPathPtr = inputPath.toNativeUtf8();
+    try {
+      return _bindings.stream_compress_image_to_callback(
+        inputPathPtr.cast<Char>(),
+        quality,
+        targetWidth,
+        targetHeight,
+        format,
+        Pointer<NativeFunction<ThinpicChunkCallbackFunction>>.fromAddress(
+          callbackAddress,
+        ),
+        0,
+      );
+    } finally {
+      malloc.free(inputPathPtr);
+    }
+  });
+}
+
+/// Waits for [jobId] to leave the pool, leaving the final result in [out].
+Future<JobStatus> _awaitJob(
+  int jobId,
+  Pointer<CompressedImageResultEx> out, {
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+}) async {
+  cancelToken?._attach(jobId);
+  var lastPercent = -1;
+  if (onProgress != null) {
+    _ensureProgressCallback();
+    _progressListeners[jobId] = (percent) {
+      lastPercent = percent;
+      onProgress(percent);
+    };
+  }
+  try {
+    await _jobFinished(jobId);
+    final status = _bindings.thinpic_poll_job_ex(jobId, out);
+    // Small images report nothing, and the last native event may still be
+    // queued; always finish a listener at 100
+    if (status == JobStatus.JOB_STATUS_DONE &&
+        onProgress != null &&
+        lastPercent < 100) {
+      onProgress(100);
+    }
+    return status;
+  } finally {
+    cancelToken?._detach(jobId);
+    _progressListeners.remove(jobId);
+  }
+}
+
+/// Runs one compression on the native worker pool and returns the encoded
+/// bytes, or null on failure.
+///
+/// The job is queued on a native thread, which posts back to the calling
+/// isolate when it finishes; the isolate is never blocked by the encode.
+Future<Uint8List?> runCompressionJob(
+  String inputPath, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  final int jobId;
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+      priority: priority,
+    );
+    jobId = _bindings.thinpic_submit_job(inputPathPtr.cast<Char>(), options);
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(options);
+  }
+  return _awaitJobBytes(jobId, cancelToken, onProgress);
+}
+
+/// Waits for a buffer-producing job and takes ownership of its bytes.
+Future<Uint8List?> _awaitJobBytes(
+  int jobId,
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+) async {
+  if (jobId < 0) {
+    return null;
+  }
+
+  final out = calloc<CompressedImageResultEx>();
+  try {
+    final status = await _awaitJob(
+      jobId,
+      out,
+      cancelToken: cancelToken,
+      onProgress: onProgress,
+    );
+    switch (status) {
+      case JobStatus.JOB_STATUS_DONE:
+        return compressedResultToBytes(out.ref.result);
+      case JobStatus.JOB_STATUS_FAILED:
+        if (out.ref.result.data != nullptr) {
+          _bindings.free_compressed_buffer(out.ref.result.data);
+        }
+        return null;
+      default:
+        return null;
+    }
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// Runs one compression on the native worker pool and keeps the encoded
+/// bytes in native memory for Android code to take without a copy: returns
+/// the handle that `ThinpicNativeBuffer.take` accepts on the Java side, or
+/// null on failure. Whoever ends up with the handle frees it once, Java
+/// with `close()` or Dart with [releaseNativeBufferHandle].
+Future<int?> runCompressionJobToNativeBuffer(
+  String inputPath, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  CompressionCancelToken? cancelToken,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  final int jobId;
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+      priority: priority,
+    );
+    jobId = _bindings.thinpic_submit_job(inputPathPtr.cast<Char>(), options);
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(options);
+  }
+  if (jobId < 0) {
+    return null;
+  }
+
+  final out = calloc<CompressedImageResultEx>();
+  try {
+    final status = await _awaitJob(jobId, out, cancelToken: cancelToken);
+    final result = out.ref.result;
+    if (status != JobStatus.JOB_STATUS_DONE || result.success != 1) {
+      if (result.data != nullptr) {
+        _bindings.free_compressed_buffer(result.data);
+      }
+      return null;
+    }
+    // The export table owns the buffer from here, even when this fails
+    final handle = _bindings.thinpic_export_buffer(result.data, result.length);
+    if (handle < 0) {
+      _bindings.free_compressed_buffer(result.data);
+      return null;
+    }
+    return handle;
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// Frees a buffer from [runCompressionJobToNativeBuffer] that was not
+/// handed to Java. Returns false for an unknown or already released handle.
+bool releaseNativeBufferHandle(int handle) =>
+    _bindings.thinpic_release_buffer(handle) == 0;
+
+/// Runs one compression of already-encoded [bytes] on the native worker pool,
+/// with no temporary input file. Returns the encoded result, or null on
+/// failure.
+///
+/// The native job keeps its own copy of the input, so [bytes] is only read
+/// while submitting.
+Future<Uint8List?> runCompressionJobFromBytes(
+  Uint8List bytes, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  if (bytes.isEmpty) {
+    return null;
+  }
+
+  final data = malloc<Uint8>(bytes.length);
+  final options = calloc<CompressOptions>();
+  final int jobId;
+  try {
+    data.asTypedList(bytes.length).setAll(0, bytes);
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+      priority: priority,
+    );
+    jobId = _bindings.thinpic_submit_buffer_job(data, bytes.length, options);
+  } finally {
+    malloc.free(data);
+    calloc.free(options);
+  }
+  return _awaitJobBytes(jobId, cancelToken, onProgress);
+}
+
+/// Runs one compression reading from the open file descriptor [fd] on the
+/// native worker pool. Returns the encoded result, or null on failure.
+///
+/// The native job works on its own duplicate, so the caller may close [fd]
+/// as soon as this returns its future.
+Future<Uint8List?> runCompressionJobFromFd(
+  int fd, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  if (fd < 0) {
+    return null;
+  }
+
+  final options = calloc<CompressOptions>();
+  final int jobId;
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+      priority: priority,
+    );
+    jobId = _bindings.thinpic_submit_fd_job(fd, options);
+  } finally {
+    calloc.free(options);
+  }
+  return _awaitJobBytes(jobId, cancelToken, onProgress);
+}
+
+/// What a file job wrote: its length in bytes, the format actually encoded
+/// (the one [ImageFormat.FORMAT_AUTO] picked), the final dimensions, the
+/// quality chosen (-1 for lossless output), how many encodes it took and the
+/// total time.
+typedef CompressionOutput = ({
+  int length,
+  ImageFormat format,
+  int width,
+  int height,
+  int quality,
+  int encodeAttempts,
+  double elapsedMs,
+});
+
+/// Runs one compression on the native worker pool and writes the result to
+/// [outputPath] natively, so the encoded bytes never cross into Dart.
+///
+/// The crop arguments apply to [CompressMode.COMPRESS_MODE_LOSSLESS_JPEG].
+///
+/// Returns the number of bytes written, or -1 on failure.
+Future<int> runCompressionJobToFile(
+  String inputPath,
+  String outputPath, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  int cropX = 0,
+  int cropY = 0,
+  int cropWidth = 0,
+  int cropHeight = 0,
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  final output = await runCompressionJobToFileWithInfo(
+    inputPath,
+    outputPath,
+    mode: mode,
+    format: format,
+    quality: quality,
+    targetWidth: targetWidth,
+    targetHeight: targetHeight,
+    targetKb: targetKb,
+    smartType: smartType,
+    cropX: cropX,
+    cropY: cropY,
+    cropWidth: cropWidth,
+    cropHeight: cropHeight,
+    cancelToken: cancelToken,
+    onProgress: onProgress,
+    priority: priority,
+  );
+  return output?.length ?? -1;
+}
+
+/// [runCompressionJobToFile], reporting what was written instead of just
+/// its length, so callers need no get_image_info pass afterwards. Returns
+/// null on failure.
+Future<CompressionOutput?> runCompressionJobToFileWithInfo(
+  String inputPath,
+  String outputPath, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  int cropX = 0,
+  int cropY = 0,
+  int cropWidth = 0,
+  int cropHeight = 0,
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final outputPathPtr = outputPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  final int jobId;
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+      cropX: cropX,
+      cropY: cropY,
+      cropWidth: cropWidth,
+      cropHeight: cropHeight,
+      priority: priority,
+    );
+    jobId = _bindings.thinpic_submit_file_job(
+      inputPathPtr.cast<Char>(),
+      outputPathPtr.cast<Char>(),
+      options,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    malloc.free(outputPathPtr);
+    calloc.free(options);
+  }
+  if (jobId < 0) {
+    return null;
+  }
+  return _awaitFileJob(
+    jobId,
+    format,
+    cancelToken: cancelToken,
+    onProgress: onProgress,
+  );
+}
+
+/// The [CompressionOutput] of file job [jobId] once it finishes, or null if
+/// it failed; [format] stands in when the stats record none.
+Future<CompressionOutput?> _awaitFileJob(
+  int jobId,
+  ImageFormat format, {
+  CompressionCancelToken? cancelToken,
+  void Function(int percent)? onProgress,
+}) async {
+  final out = calloc<CompressedImageResultEx>();
+  try {
+    final status = await _awaitJob(
+      jobId,
+      out,
+      cancelToken: cancelToken,
+      onProgress: onProgress,
+    );
+    if (status != JobStatus.JOB_STATUS_DONE) {
+      return null;
+    }
+    final stats = out.ref.stats;
+    return (
+      length: out.ref.result.length,
+      format: stats.format < 0 ? format : ImageFormat.fromValue(stats.format),
+      width: stats.width,
+      height: stats.height,
+      quality: stats.quality,
+      encodeAttempts: stats.encode_attempts,
+      elapsedMs: stats.elapsed_ms,
+    );
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// [runCompressionJobToFileWithInfo] for a whole batch with the same
+/// options: every path goes into one native allocation and every job is
+/// submitted in one native call, so the per-item cost on the isolate is the
+/// wait alone. The result matches [inputPaths] by index; an entry is null
+/// where that item failed.
+Future<List<CompressionOutput?>> runCompressionJobsToFilesWithInfo(
+  List<String> inputPaths,
+  List<String> outputPaths, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  CompressionCancelToken? cancelToken,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async {
+  final count = inputPaths.length;
+  if (count == 0) {
+    return const [];
+  }
+  if (outputPaths.length != count) {
+    throw ArgumentError.value(
+      outputPaths.length,
+      'outputPaths',
+      'must match inputPaths ($count)',
+    );
+  }
+
+  final packed = _packStrings([...inputPaths, ...outputPaths], slots: count);
+  final options = calloc<CompressOptions>();
+  final List<int> jobIds;
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      priority: priority,
+    );
+    _bindings.thinpic_submit_file_jobs(
+      packed.strings,
+      packed.strings + count,
+      count,
+      options,
+      1,
+      packed.slots,
+    );
+    jobIds = List<int>.of(packed.slots.asTypedList(count));
+  } finally {
+    malloc.free(packed.arena);
+    calloc.free(options);
+  }
+
+  return Future.wait([
+    for (final jobId in jobIds)
+      jobId < 0
+          ? Future<CompressionOutput?>.value()
+          : _awaitFileJob(jobId, format, cancelToken: cancelToken),
+  ]);
+}
+
+/// Runs every input through the native pool into the matching output path
+/// and emits `(index, length)` as each one finishes, in completion order;
+/// length is -1 for failed items.
+///
+/// At most [lookAhead] items are compressing or finished but not yet taken
+/// by the listener, so a consumer that pauses on each item (an `await for`
+/// that uploads it) keeps that many compressions running behind it and no
+/// more. Cancelling the subscription cancels the items still outstanding.
+Stream<({int index, int length})> runCompressionJobsToFiles(
+  List<String> inputPaths,
+  List<String> outputPaths, {
+  int lookAhead = 2,
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  CompressionCancelToken? cancelToken,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async* {
+  final count = inputPaths.length;
+  final window = lookAhead < 1 ? 1 : lookAhead;
+  final token = cancelToken?._child() ?? CompressionCancelToken();
+  final ready = StreamController<({int index, int length})>();
+  final finished = StreamIterator(ready.stream);
+  var next = 0;
+  var outstanding = 0;
+
+  void refill() {
+    while (next < count && outstanding < window) {
+      final index = next++;
+      outstanding++;
+      runCompressionJobToFile(
+        inputPaths[index],
+        outputPaths[index],
+        mode: mode,
+        format: format,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        cancelToken: token,
+        priority: priority,
+      ).then(
+        (length) => ready.add((index: index, length: length)),
+        onError: (Object _) => ready.add((index: index, length: -1)),
+      );
+    }
+  }
+
+  try {
+    refill();
+    for (var delivered = 0; delivered < count; delivered++) {
+      await finished.moveNext();
+      outstanding--;
+      // Start the next item before handing this one over, so the window
+      // stays full while the listener works on it
+      refill();
+      yield finished.current;
+    }
+  } finally {
+    // Only reached with work outstanding when the listener left early
+    token.cancel();
+    cancelToken?._children.remove(token);
+    await finished.cancel();
+  }
+}
+
+/// One input of [runCompressionJobsFromStream]: an image file or encoded
+/// bytes, and optionally where to write the result.
+class ImageSource {
+  /// The image at [path]; with [outputPath] the native job writes the
+  /// result there and the bytes never cross into Dart.
+  const ImageSource.file(String this.path, {this.outputPath}) : bytes = null;
+
+  /// An already-encoded image (a download, a picked asset); the native job
+  /// takes its own copy when it is submitted.
+  const ImageSource.bytes(Uint8List this.bytes, {this.outputPath})
+      : path = null;
+
+  final String? path;
+  final Uint8List? bytes;
+
+  /// Destination file, or null to hand the encoded bytes back
+  final String? outputPath;
+}
+
+/// Runs every source from [sources] through the native pool as it arrives
+/// and emits each result in completion order, tagged with the source's
+/// position in the stream. `length` is the encoded size, -1 for failed
+/// items; `bytes` holds the encoded image for sources without an
+/// `outputPath`.
+///
+/// At most [maxInFlight] items are compressing or finished but not yet
+/// taken by the listener. Further sources are only read from [sources] when
+/// one of those slots frees, so the source stream is paused meanwhile and a
+/// batch of any length runs in constant memory. Cancelling the subscription
+/// cancels the items still outstanding; an error from [sources] ends the
+/// batch once the items started before it are delivered.
+Stream<({int index, int length, Uint8List? bytes})>
+    runCompressionJobsFromStream(
+  Stream<ImageSource> sources, {
+  int maxInFlight = 4,
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  CompressionCancelToken? cancelToken,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) async* {
+  final window = maxInFlight < 1 ? 1 : maxInFlight;
+  final token = cancelToken?._child() ?? CompressionCancelToken();
+  final ready = StreamController<({int index, int length, Uint8List? bytes})>();
+  final finished = StreamIterator(ready.stream);
+  final pending = StreamIterator(sources);
+  var next = 0;
+  // Submitted and not yet finished natively, and not yet taken by the
+  // listener; the window counts the second
+  var running = 0;
+  var outstanding = 0;
+  var exhausted = false;
+  Completer<void>? slotFreed;
+  (Object, StackTrace)? sourceError;
+
+  void closeIfDone() {
+    if (exhausted && running == 0 && !ready.isClosed) {
+      ready.close();
+    }
+  }
+
+  Future<({int length, Uint8List? bytes})> compress(ImageSource source) async {
+    final path = source.path;
+    final outputPath = source.outputPath;
+    if (path != null && outputPath != null) {
+      final length = await runCompressionJobToFile(
+        path,
+        outputPath,
+        mode: mode,
+        format: format,
+        quality: quality,
+        targetWidth: targetWidth,
+        targetHeight: targetHeight,
+        cancelToken: token,
+        priority: priority,
+      );
+      return (length: length, bytes: null);
+    }
+    final bytes = path != null
+        ? await runCompressionJob(
+            path,
+            mode: mode,
+            format: format,
+            quality: quality,
+            targetWidth: targetWidth,
+            targetHeight: targetHeight,
+            cancelToken: token,
+            priority: priority,
+          )
+        : await runCompressionJobFromBytes(
+            source.bytes!,
+            mode: mode,
+            format: format,
+            quality: quality,
+            targetWidth: targetWidth,
+            targetHeight: targetHeight,
+            cancelToken: token,
+            priority: priority,
+          );
+    if (bytes == null) {
+      return (length: -1, bytes: null);
+    }
+    if (outputPath == null) {
+      return (length: bytes.length, bytes: bytes);
+    }
+    await File(outputPath).writeAsBytes(bytes, flush: true);
+    return (length: bytes.length, bytes: null);
+  }
+
+  void start(ImageSource source) {
+    final index = next++;
+    running++;
+    outstanding++;
+    compress(source).then(
+      (output) {
+        if (!ready.isClosed) {
+          ready.add((index: index, length: output.length, bytes: output.bytes));
+        }
+      },
+      onError: (Object _) {
+        if (!ready.isClosed) {
+          ready.add((index: index, length: -1, bytes: null));
+        }
+      },
+    ).whenComplete(() {
+      running--;
+      closeIfDone();
+    });
+  }
+
+  // Reads the next source only when the window has room, independently of
+  // the listener, so a slow source never holds back finished items
+  Future<void> feed() async {
+    try {
+      while (!token.isCancelled && await pending.moveNext()) {
+        if (token.isCancelled) {
+          break;
+        }
+        start(pending.current);
+        while (outstanding >= window && !token.isCancelled) {
+          slotFreed = Completer<void>();
+          await slotFreed!.future;
+        }
+      }
+    } catch (error, stackTrace) {
+      sourceError = (error, stackTrace);
+    }
+    exhausted = true;
+    closeIfDone();
+  }
+
+  final feeding = feed();
+  try {
+    while (await finished.moveNext()) {
+      outstanding--;
+      final freed = slotFreed;
+      if (freed != null && !freed.isCompleted) {
+        freed.complete();
+      }
+      yield finished.current;
+    }
+    await feeding;
+    final error = sourceError;
+    if (error != null) {
+      Error.throwWithStackTrace(error.$1, error.$2);
+    }
+  } finally {
+    // Only reached with work outstanding when the listener left early
+    token.cancel();
+    cancelToken?._children.remove(token);
+    final freed = slotFreed;
+    if (freed != null && !freed.isCompleted) {
+      freed.complete();
+    }
+    await pending.cancel();
+    await finished.cancel();
+  }
+}
+
+/// Runs one compression on the native worker pool and returns only what it
+/// cost (the encoded bytes are freed natively), or null on failure.
+///
+/// Intended for tuning thresholds such as the large-image auto-resize limit;
+/// run it with nothing else in flight for exact memory figures.
+Future<CompressionStats?> measureCompressionJob(
+  String inputPath, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+}) async {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  final int jobId;
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+    );
+    jobId = _bindings.thinpic_submit_job(inputPathPtr.cast<Char>(), options);
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(options);
+  }
+  if (jobId < 0) {
+    return null;
+  }
+
+  final out = calloc<CompressedImageResultEx>();
+  try {
+    await _jobFinished(jobId);
+    final status = _bindings.thinpic_poll_job_ex(jobId, out);
+    if (out.ref.result.data != nullptr) {
+      _bindings.free_compressed_buffer(out.ref.result.data);
+    }
+    if (status != JobStatus.JOB_STATUS_DONE) {
+      return null;
+    }
+
+    // Copy into a Dart-owned struct so the stats outlive `out`
+    final stats = out.ref.stats;
+    return Struct.create<CompressionStats>()
+      ..peak_mem_delta = stats.peak_mem_delta
+      ..mem_delta = stats.mem_delta
+      ..live_allocs = stats.live_allocs
+      ..open_files = stats.open_files
+      ..elapsed_ms = stats.elapsed_ms
+      ..open_us = stats.open_us
+      ..decode_us = stats.decode_us
+      ..resize_us = stats.resize_us
+      ..colour_us = stats.colour_us
+      ..encode_us = stats.encode_us
+      ..copy_us = stats.copy_us
+      ..quality = stats.quality
+      ..format = stats.format
+      ..width = stats.width
+      ..height = stats.height
+      ..encode_attempts = stats.encode_attempts;
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// One libvips operation in a [CompressionProfile]: times it was built
+/// ([calls]), regions its output computed, its own time in microseconds
+/// (without computing its inputs) and the pixels in those regions.
+typedef ProfiledOperation = ({
+  String name,
+  int calls,
+  int regions,
+  int timeUs,
+  int pixels,
+});
+
+/// What [profileCompressionJob] measured: the job's [elapsedMs] and
+/// [encodeUs] (encoders are not libvips operations and show up only here),
+/// its [operations] slowest first, and the pixel time each worker thread
+/// put in ([threadBusyUs]).
+typedef CompressionProfile = ({
+  int elapsedMs,
+  int encodeUs,
+  List<ProfiledOperation> operations,
+  List<int> threadBusyUs,
+});
+
+/// Runs one compression on the calling thread with libvips operation
+/// profiling on, discards the encoded bytes and returns the profile, or
+/// null on failure.
+///
+/// Profiled jobs run one at a time and anything else compressing meanwhile
+/// is counted too, so profile with nothing else in flight. Blocks until the
+/// image is encoded; call it from a background isolate.
+CompressionProfile? profileCompressionJob(
+  String inputPath, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  final profile = calloc<ThinpicProfile>();
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+    );
+    final out = _bindings.compress_with_profile(
+      inputPathPtr.cast<Char>(),
+      options,
+      profile,
+    );
+    if (out.result.data != nullptr) {
+      _bindings.free_compressed_buffer(out.result.data);
+    }
+    if (out.result.success != 1) {
+      return null;
+    }
+
+    final operations = <ProfiledOperation>[];
+    for (var i = 0; i < profile.ref.op_count; i++) {
+      final op = profile.ref.ops[i];
+      final name = StringBuffer();
+      for (var c = 0; c < 32 && op.name[c] != 0; c++) {
+        name.writeCharCode(op.name[c] & 0xFF);
+      }
+      operations.add((
+        name: name.toString(),
+        calls: op.calls,
+        regions: op.regions,
+        timeUs: op.time_us,
+        pixels: op.pixels,
+      ));
+    }
+    return (
+      elapsedMs: out.stats.elapsed_ms,
+      encodeUs: out.stats.encode_us,
+      operations: operations,
+      threadBusyUs: [
+        for (var i = 0; i < profile.ref.thread_count; i++)
+          profile.ref.thread_busy_us[i],
+      ],
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(options);
+    calloc.free(profile);
+  }
+}
+
+/// Takes the telemetry records collected since the last drain, oldest
+/// first. The first call starts recording and returns nothing.
+List<ThinpicTelemetryRecord> drainTelemetryRecords() {
+  final out = calloc<ThinpicTelemetryRecord>(THINPIC_TELEMETRY_RECORDS);
+  try {
+    final count = _bindings.thinpic_drain_stats(out, THINPIC_TELEMETRY_RECORDS);
+
+    // Copy into Dart-owned structs so the records outlive `out`
+    return List<ThinpicTelemetryRecord>.generate(count, (i) {
+      final source = out[i];
+      return Struct.create<ThinpicTelemetryRecord>()
+        ..sequence = source.sequence
+        ..mode = source.mode
+        ..error = source.error
+        ..input_bytes = source.input_bytes
+        ..width = source.width
+        ..height = source.height
+        ..output_bytes = source.output_bytes
+        ..stats = source.stats
+        ..preset = source.preset;
+    });
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// Loads the compression presets of a remote config, given as JSON:
+///
+/// ```json
+/// {"default": "fast",
+///  "presets": [{"id": 2, "name": "fast", "maxDimension": 4096,
+///               "minimalMaxDimension": 6000, "smartQuality": [80, 92, 55, 30],
+///               "searchStartQuality": 82, "searchEndQuality": 35}]}
+/// ```
+///
+/// The JSON is parsed here, once, into the fixed native table every job
+/// reads its caps and qualities from; missing keys keep the built-in
+/// values, and jobs use the `default` preset (the built-in values when it
+/// is absent). Returns how many presets were loaded, or -1 (the previous
+/// table stays) when the JSON or a preset is invalid.
+int loadCompressionPresets(String json) {
+  final Object? decoded;
+  try {
+    decoded = jsonDecode(json);
+  } on FormatException {
+    return -1;
+  }
+  if (decoded is! Map<String, dynamic> || decoded['presets'] is! List) {
+    return -1;
+  }
+  final entries = (decoded['presets'] as List).whereType<Map>().toList();
+  if (entries.length > THINPIC_PRESET_MAX) {
+    return -1;
+  }
+  final table = calloc<ThinpicPreset>(entries.isEmpty ? 1 : entries.length);
+  try {
+    var defaultId = 0;
+    for (var i = 0; i < entries.length; i++) {
+      final entry = entries[i];
+      final preset = table[i];
+      final name = utf8.encode('${entry['name'] ?? ''}');
+      if (name.length >= THINPIC_PRESET_NAME_MAX) {
+        return -1;
+      }
+      preset.id = _jsonInt(entry['id']);
+      for (var c = 0; c < name.length; c++) {
+        preset.name[c] = name[c];
+      }
+      preset.max_dimension = _jsonInt(entry['maxDimension']);
+      preset.minimal_max_dimension = _jsonInt(entry['minimalMaxDimension']);
+      final smartQuality = entry['smartQuality'];
+      if (smartQuality is List) {
+        for (var q = 0; q < 4 && q < smartQuality.length; q++) {
+          preset.smart_quality[q] = _jsonInt(smartQuality[q]);
+        }
+      }
+      preset.search_start_quality = _jsonInt(entry['searchStartQuality']);
+      preset.search_end_quality = _jsonInt(entry['searchEndQuality']);
+      if (entry['name'] == decoded['default']) {
+        defaultId = preset.id;
+      }
+    }
+    if (decoded['default'] != null && defaultId == 0) {
+      return -1;
+    }
+    return _bindings.thinpic_presets_load(table, entries.length, defaultId);
+  } finally {
+    calloc.free(table);
+  }
+}
+
+// A numeric JSON field as an int; anything else leaves the setting unset
+int _jsonInt(Object? value) => value is num ? value.toInt() : 0;
+
+/// Id of the loaded preset called [name] (as telemetry records report it),
+/// or 0
+int compressionPresetId(String name) {
+  final namePtr = name.toNativeUtf8();
+  try {
+    return _bindings.thinpic_preset_id(namePtr.cast<Char>());
+  } finally {
+    malloc.free(namePtr);
+  }
+}
+
+/// Compresses every path with the same options in one native call.
+///
+/// The native side spreads the items over its worker pool and blocks until
+/// all of them finish, so call this from a background isolate. The returned
+/// list matches [inputPaths] by index; failed items are null.
+List<Uint8List?> compressBatch(
+  List<String> inputPaths, {
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  int targetKb = 0,
+  int smartType = 0,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) {
+  final count = inputPaths.length;
+  if (count == 0) {
+    return const [];
+  }
+
+  final packed = _packStrings(inputPaths);
+  final options = calloc<CompressOptions>();
+  final out = calloc<CompressedImageResult>(count);
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: targetKb,
+      smartType: smartType,
+      priority: priority,
+    );
+
+    _bindings.compress_batch(packed.strings, count, options, out);
+
+    return List<Uint8List?>.generate(count, (i) {
+      final result = out[i];
+      if (!isCompressionSuccessful(result)) {
+        return null;
+      }
+      return compressedResultToBytes(result);
+    });
+  } finally {
+    malloc.free(packed.arena);
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+/// Compresses [count] pages of one multi-page TIFF or PDF from [firstPage]
+/// with the same options in one native call.
+///
+/// Every page is its own pool job that decodes only that page; the call
+/// blocks until all of them finish, so run it from a background isolate.
+/// The returned list holds page `firstPage + i` at index i; failed pages
+/// are null.
+List<Uint8List?> compressPages(
+  String inputPath, {
+  int firstPage = 0,
+  required int count,
+  CompressMode mode = CompressMode.COMPRESS_MODE_STANDARD,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) {
+  if (count <= 0) {
+    return const [];
+  }
+
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  final out = calloc<CompressedImageResult>(count);
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: mode,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: 0,
+      smartType: 0,
+      priority: priority,
+    );
+
+    _bindings.compress_pages(
+      inputPathPtr.cast<Char>(),
+      firstPage,
+      count,
+      options,
+      out,
+    );
+
+    return List<Uint8List?>.generate(count, (i) {
+      final result = out[i];
+      if (!isCompressionSuccessful(result)) {
+        return null;
+      }
+      return compressedResultToBytes(result);
+    });
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+int poolSize() => _bindings.thinpic_pool_size();
+
+void shutdownPool() => _bindings.thinpic_shutdown_pool();
+
+void setExecutionMode(ExecutionMode mode) =>
+    _bindings.set_execution_mode(mode);
+
+ExecutionMode getExecutionMode() => _bindings.get_execution_mode();
+
+/// Sets native resource limits; arguments left at -1 (or null) keep their
+/// current value. Returns true on success.
+bool configureRuntime({
+  int memoryBudgetMb = -1,
+  int cacheMaxMemMb = -1,
+  int cacheMaxOperations = -1,
+  int threadsPerImage = -1,
+  int mmapInputMinMb = -1,
+  bool? skipCompliant,
+  ThinpicStripPolicy? metadataPolicy,
+  bool? thermalScaling,
+  int gpuResizeMinMp = -1,
+  ThinpicResizeQuality? resizeQuality,
+  int flattenBackground = -1,
+  int handleCacheMb = -1,
+  int decodeCacheMb = -1,
+  bool? losslessOrientation,
+  bool? ditherHighDepth,
+  bool? oneShotCache,
+  bool? adaptiveQuality,
+  int discThresholdMb = -1,
+  bool? jpegStripEncode,
+  int maxInputMegapixels = -1,
+  int maxInputBands = -1,
+  int jobTimeoutMs = -1,
+  bool? platformDecode,
+  bool? coefficientSearch,
+  bool? deterministic,
+}) {
+  final config = calloc<ThinpicRuntimeConfig>();
+  try {
+    config.ref
+      ..memory_budget_mb = memoryBudgetMb
+      ..cache_max_mem_mb = cacheMaxMemMb
+      ..cache_max_operations = cacheMaxOperations
+      ..threads_per_image = threadsPerImage
+      ..mmap_input_min_mb = mmapInputMinMb
+      ..skip_compliant = skipCompliant == null ? -1 : (skipCompliant ? 1 : 0)
+      ..metadata_policy = metadataPolicy?.value ?? -1
+      ..thermal_scaling = thermalScaling == null
+          ? -1
+          : (thermalScaling ? 1 : 0)
+      ..gpu_resize_min_mp = gpuResizeMinMp
+      ..resize_quality = resizeQuality?.value ?? -1
+      ..flatten_background = flattenBackground
+      ..handle_cache_mb = handleCacheMb
+      ..decode_cache_mb = decodeCacheMb
+      ..lossless_orientation = losslessOrientation == null
+          ? -1
+          : (losslessOrientation ? 1 : 0)
+      ..dither_high_depth = ditherHighDepth == null
+          ? -1
+          : (ditherHighDepth ? 1 : 0)
+      ..one_shot_cache = oneShotCache == null ? -1 : (oneShotCache ? 1 : 0)
+      ..adaptive_quality = adaptiveQuality == null
+          ? -1
+          : (adaptiveQuality ? 1 : 0)
+      ..disc_threshold_mb = discThresholdMb
+      ..jpeg_strip_encode = jpegStripEncode == null
+          ? -1
+          : (jpegStripEncode ? 1 : 0)
+      ..max_input_megapixels = maxInputMegapixels
+      ..max_input_bands = maxInputBands
+      ..job_timeout_ms = jobTimeoutMs
+      ..platform_decode = platformDecode == null
+          ? -1
+          : (platformDecode ? 1 : 0)
+      ..coefficient_search = coefficientSearch == null
+          ? -1
+          : (coefficientSearch ? 1 : 0)
+      ..deterministic = deterministic == null ? -1 : (deterministic ? 1 : 0);
+    return _bindings.thinpic_configure(config) == 0;
+  } finally {
+    calloc.free(config);
+  }
+}
+
+/// Starts native initialization on a background thread; returns immediately.
+bool prewarmNative({bool warmOperations = true}) =>
+    _bindings.thinpic_prewarm(warmOperations ? 1 : 0) == 0;
+
+/// Whether the linked libjpeg is mozjpeg (trellis quantisation, deringing,
+/// scan optimisation and alternative quantisation tables).
+bool isJpegExtensionsAvailable() =>
+    _bindings.thinpic_jpeg_extensions_available() == 1;
+
+/// Whether libjxl could be found for lossless JPEG to JPEG XL transcoding.
+bool isJxlTranscodeAvailable() =>
+    _bindings.thinpic_jxl_transcode_available() == 1;
+
+/// Reads the native runtime counters into a Dart-owned struct.
+ThinpicRuntimeStats getRuntimeStats() {
+  final out = calloc<ThinpicRuntimeStats>();
+  try {
+    _bindings.thinpic_get_runtime_stats(out);
+    final source = out.ref;
+    return Struct.create<ThinpicRuntimeStats>()
+      ..cache_operations = source.cache_operations
+      ..cache_max_operations = source.cache_max_operations
+      ..cache_max_mem = source.cache_max_mem
+      ..tracked_mem = source.tracked_mem
+      ..tracked_mem_highwater = source.tracked_mem_highwater
+      ..tracked_allocs = source.tracked_allocs
+      ..open_files = source.open_files
+      ..pool_workers = source.pool_workers
+      ..active_jobs = source.active_jobs
+      ..queued_jobs = source.queued_jobs
+      ..in_flight_bytes = source.in_flight_bytes
+      ..thermal_status = source.thermal_status;
+  } finally {
+    calloc.free(out);
+  }
+}
+
+void dropNativeOperationCache() => _bindings.thinpic_drop_operation_cache();
+
+void setNativePowerSave(bool enabled) =>
+    _bindings.thinpic_set_power_save(enabled ? 1 : 0);
+
+void notifyNativeMemoryPressure(ThinpicMemoryPressure level) =>
+    _bindings.thinpic_on_memory_pressure(level);
+
+void shutdownVips() => _bindings.shutdown_vips();
+
+void setNativeLogLevel(ThinpicLogLevel level) =>
+    _bindings.thinpic_set_log_level(level);
+
+void setNativeTracing(bool enabled) =>
+    _bindings.thinpic_set_tracing(enabled ? 1 : 0);
+
+/// Persists smart compression size curves under [directory]; null turns the
+/// cache off. The native side copies the path.
+void setSizeCurveCacheDirectory(String? directory) {
+  if (directory == null) {
+    _bindings.thinpic_set_curve_cache_dir(nullptr);
+    return;
+  }
+  final path = directory.toNativeUtf8();
+  try {
+    _bindings.thinpic_set_curve_cache_dir(path.cast<Char>());
+  } finally {
+    malloc.free(path);
+  }
+}
+
+/// Persists the throughput model under [directory]; null keeps it in memory
+/// only. The native side copies the path.
+void setThroughputModelDirectory(String? directory) {
+  if (directory == null) {
+    _bindings.thinpic_set_throughput_model_dir(nullptr);
+    return;
+  }
+  final path = directory.toNativeUtf8();
+  try {
+    _bindings.thinpic_set_throughput_model_dir(path.cast<Char>());
+  } finally {
+    malloc.free(path);
+  }
+}
+
+/// Reads the measured throughput of [format] at [effort] into a Dart-owned
+/// struct, or null for [ImageFormat.FORMAT_AUTO].
+ThinpicThroughput? getThroughput(ImageFormat format, int effort) {
+  final out = calloc<ThinpicThroughput>();
+  try {
+    if (_bindings.thinpic_get_throughput(format, effort, out) != 0) {
+      return null;
+    }
+    final source = out.ref;
+    return Struct.create<ThinpicThroughput>()
+      ..encode_ms_per_mp = source.encode_ms_per_mp
+      ..decode_ms_per_mp = source.decode_ms_per_mp
+      ..encode_samples = source.encode_samples
+      ..decode_samples = source.decode_samples;
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// Spills large intermediate renders under [directory]; null goes back to the
+/// system temp directory. The native side copies the path.
+void setSpillDirectory(String? directory) {
+  if (directory == null) {
+    _bindings.thinpic_set_spill_dir(nullptr);
+    return;
+  }
+  final path = directory.toNativeUtf8();
+  try {
+    _bindings.thinpic_set_spill_dir(path.cast<Char>());
+  } finally {
+    malloc.free(path);
+  }
+}
+
+/// Keeps compressed outputs under [directory], up to [maxBytes] in total;
+/// null turns the cache off. The native side copies the path.
+void setOutputCacheDirectory(String? directory, int maxBytes) {
+  if (directory == null) {
+    _bindings.thinpic_set_output_cache(nullptr, 0);
+    return;
+  }
+  final path = directory.toNativeUtf8();
+  try {
+    _bindings.thinpic_set_output_cache(path.cast<Char>(), maxBytes);
+  } finally {
+    malloc.free(path);
+  }
+}
+
+int testVipsBasic() => _bindings.test_vips_basic();
+
+/// Encodes raw 8-bit [pixels] straight to PNG with libspng, without libvips,
+/// on the calling thread. Returns the PNG bytes, or null on failure.
+///
+/// [channels] is 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA); [stride]
+/// is the row pitch in bytes (0 = `width * channels`). Set [premultiplied]
+/// for `ImageByteFormat.rawRgba` data.
+Uint8List? encodeRawPng(
+  Uint8List pixels,
+  int width,
+  int height, {
+  int channels = 4,
+  int stride = 0,
+  bool premultiplied = false,
+  int compressionLevel = 6,
+}) {
+  final rowBytes = width * channels;
+  final pitch = stride == 0 ? rowBytes : stride;
+  if (width <= 0 ||
+      height <= 0 ||
+      pitch < rowBytes ||
+      pixels.length < (height - 1) * pitch + rowBytes) {
+    return null;
+  }
+
+  final data = malloc<Uint8>(pixels.length);
+  try {
+    data.asTypedList(pixels.length).setAll(0, pixels);
+    final bytes = compressedResultToBytes(
+      _bindings.compress_raw_to_png(
+        data,
+        width,
+        height,
+        stride,
+        channels,
+        premultiplied ? 1 : 0,
+        compressionLevel,
+      ),
+    );
+    return bytes.isEmpty ? null : bytes;
+  } finally {
+    malloc.free(data);
+  }
+}
+
+/// Encodes raw 8-bit camera-frame [pixels] straight to JPEG with libjpeg,
+/// without libvips, on the calling thread. Returns the JPEG bytes, or null
+/// on failure.
+///
+/// [pitch] is the row stride in bytes (0 = tightly packed). The native
+/// compressor is kept per thread, so calling this repeatedly from one
+/// long-lived isolate reuses it for every frame.
+Uint8List? encodeRawJpeg(
+  Uint8List pixels,
+  int width,
+  int height, {
+  ThinpicPixelFormat pixelFormat = ThinpicPixelFormat.THINPIC_PIXEL_RGBA,
+  int pitch = 0,
+  int quality = 80,
+}) {
+  final pixelSize = switch (pixelFormat) {
+    ThinpicPixelFormat.THINPIC_PIXEL_RGB ||
+    ThinpicPixelFormat.THINPIC_PIXEL_BGR => 3,
+    ThinpicPixelFormat.THINPIC_PIXEL_RGBA ||
+    ThinpicPixelFormat.THINPIC_PIXEL_BGRA => 4,
+    ThinpicPixelFormat.THINPIC_PIXEL_GRAY => 1,
+  };
+  final rowBytes = width * pixelSize;
+  final rowPitch = pitch == 0 ? rowBytes : pitch;
+  if (width <= 0 ||
+      height <= 0 ||
+      rowPitch < rowBytes ||
+      pixels.length < (height - 1) * rowPitch + rowBytes) {
+    return null;
+  }
+
+  final data = malloc<Uint8>(pixels.length);
+  try {
+    data.asTypedList(pixels.length).setAll(0, pixels);
+    final bytes = compressedResultToBytes(
+      _bindings.compress_raw_to_jpeg(
+        data,
+        width,
+        height,
+        pitch,
+        pixelFormat,
+        quality,
+      ),
+    );
+    return bytes.isEmpty ? null : bytes;
+  } finally {
+    malloc.free(data);
+  }
+}
+
+/// One output of [compressImageVariants]: the box to fit inside ([width] or
+/// [height] 0 leaves that side free; both 0 keep the size, capped at 6000 px),
+/// the [format] and the [quality] 1-100.
+typedef ImageVariant = ({
+  int width,
+  int height,
+  ImageFormat format,
+  int quality,
+});
+
+/// Encodes every variant of [inputPath] from one native decode: the largest
+/// is decoded straight at its size, each smaller one is resized from the one
+/// before it, and the encodes run in parallel. Returns one entry per variant
+/// (null where that variant failed), or null when the image could not be
+/// decoded.
+List<Uint8List?>? compressImageVariants(
+  String inputPath,
+  List<ImageVariant> variants,
+) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  try {
+    return _encodeVariants(
+      variants,
+      (specs, out) => _bindings.compress_image_variants(
+        inputPathPtr.cast<Char>(),
+        specs,
+        variants.length,
+        out,
+      ),
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+  }
+}
+
+// Fills the native variant specs, runs [encode] on them and collects the
+// results of a compress_image_variants style call
+List<Uint8List?>? _encodeVariants(
+  List<ImageVariant> variants,
+  int Function(Pointer<ThinpicVariant>, Pointer<CompressedImageResult>) encode,
+) {
+  if (variants.isEmpty || variants.length > THINPIC_MAX_VARIANTS) {
+    return null;
+  }
+  final specs = calloc<ThinpicVariant>(variants.length);
+  final out = calloc<CompressedImageResult>(variants.length);
+  try {
+    for (var i = 0; i < variants.length; i++) {
+      specs[i]
+        ..width = variants[i].width
+        ..height = variants[i].height
+        ..formatAsInt = variants[i].format.value
+        ..quality = variants[i].quality;
+    }
+    if (encode(specs, out) < 0) {
+      return null;
+    }
+    return [
+      for (var i = 0; i < variants.length; i++)
+        switch (compressedResultToBytes(out[i])) {
+          final bytes when bytes.isNotEmpty => bytes,
+          _ => null,
+        },
+    ];
+  } finally {
+    calloc.free(specs);
+    calloc.free(out);
+  }
+}
+
+/// Where one input landed on a [ContactSheet], in sheet pixels.
+typedef SheetCell = ({int x, int y, int width, int height});
+
+/// A sheet from [contactSheet]: the encoded image, each input's cell by
+/// index (null where that input could not be decoded and its cell is
+/// blank), and the same map as JSON for a web or CDN consumer.
+typedef ContactSheet = ({
+  Uint8List bytes,
+  List<SheetCell?> cells,
+  String offsetsJson,
+});
+
+/// Thumbnails [inputPaths] into [cellWidth] x [cellHeight] cells, centre
+/// cropped, in parallel with shrink-on-load, and joins them into one
+/// encoded sheet, [columns] to a row (0 for a square grid), all in one
+/// native call ([thinpic_contact_sheet]). Returns null when no input
+/// decodes or the sheet does not encode.
+ContactSheet? contactSheet(
+  List<String> inputPaths, {
+  required int cellWidth,
+  required int cellHeight,
+  int columns = 0,
+  int spacing = 0,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+}) {
+  final count = inputPaths.length;
+  if (count == 0 || count > THINPIC_SHEET_MAX_CELLS) {
+    return null;
+  }
+  final packed = _packStrings(inputPaths);
+  final layout = calloc<ThinpicSheetLayout>();
+  final cells = calloc<ThinpicSheetCell>(count);
+  final json = calloc<Pointer<Char>>();
+  try {
+    layout.ref
+      ..columns = columns
+      ..cell_width = cellWidth
+      ..cell_height = cellHeight
+      ..spacing = spacing
+      ..formatAsInt = format.value
+      ..quality = quality;
+    final result = _bindings.thinpic_contact_sheet(
+      packed.strings,
+      count,
+      layout,
+      cells,
+      json,
+    );
+    final bytes = compressedResultToBytes(result);
+    String offsetsJson = '';
+    if (json.value != nullptr) {
+      offsetsJson = json.value.cast<Utf8>().toDartString();
+      _bindings.free_compressed_buffer(json.value.cast<Uint8>());
+    }
+    if (bytes.isEmpty) {
+      return null;
+    }
+    return (
+      bytes: bytes,
+      cells: [
+        for (var i = 0; i < count; i++)
+          cells[i].success == 1
+              ? (
+                  x: cells[i].x,
+                  y: cells[i].y,
+                  width: cells[i].width,
+                  height: cells[i].height,
+                )
+              : null,
+      ],
+      offsetsJson: offsetsJson,
+    );
+  } finally {
+    malloc.free(packed.arena);
+    calloc.free(layout);
+    calloc.free(cells);
+    calloc.free(json);
+  }
+}
+
+/// Opens [inputPath] for several calls ([thinpic_open]): the file is mapped
+/// and its header parsed once. Returns the handle's address, which can be
+/// sent to other isolates, or 0 on failure. Release it with
+/// [closeImageHandle].
+int openImageHandle(String inputPath) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final source = calloc<ThinpicSource>();
+  try {
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = inputPathPtr.cast<Char>();
+    return _bindings.thinpic_open(source).address;
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(source);
+  }
+}
+
+/// Pixels from [decodeThumbnailPixels]: packed 8-bit RGBA rows, ready for
+/// `ui.decodeImageFromPixels` with `ui.PixelFormat.rgba8888`.
+typedef DecodedPixels = ({Uint8List pixels, int width, int height});
+
+/// Decodes [inputPath] straight to RGBA that fits inside [maxWidth] x
+/// [maxHeight] ([thinpic_decode_rgba]), upright and in sRGB, shrinking
+/// while decoding where the format allows. Returns null on failure.
+///
+/// Blocks until the image is decoded; call it from a background isolate.
+DecodedPixels? decodeThumbnailPixels(
+  String inputPath, {
+  int maxWidth = 0,
+  int maxHeight = 0,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final source = calloc<ThinpicSource>();
+  final out = calloc<ThinpicPixels>();
+  try {
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = inputPathPtr.cast<Char>();
+    if (_bindings.thinpic_decode_rgba(source, maxWidth, maxHeight, out) != 0) {
+      return null;
+    }
+    return (
+      pixels: out.ref.data.asTypedList(
+        out.ref.length,
+        finalizer: _freeCompressedBufferFinalizer,
+      ),
+      width: out.ref.width,
+      height: out.ref.height,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(source);
+    calloc.free(out);
+  }
+}
+
+/// Scores from [compareImages]: [psnr] in dB (100 for identical images),
+/// [ssim] and [msSsim] from 0 to 1, and the [width] x [height] of the luma
+/// planes they were measured on.
+typedef ImageQuality = ({
+  double psnr,
+  double ssim,
+  double msSsim,
+  int width,
+  int height,
+});
+
+/// Compares [candidatePath] with [referencePath] ([thinpic_compare]) on
+/// upright luma planes of one size that fits in [analysisPixels] (0 = about
+/// 1 MP), with the windows split over [threads] (0 = one per core). Returns
+/// null on failure, also when the aspect ratios differ.
+///
+/// Blocks until both images are decoded and scored; call it from a
+/// background isolate.
+ImageQuality? compareImages(
+  String referencePath,
+  String candidatePath, {
+  int analysisPixels = 0,
+  int threads = 0,
+}) {
+  final referencePathPtr = referencePath.toNativeUtf8();
+  final candidatePathPtr = candidatePath.toNativeUtf8();
+  final reference = calloc<ThinpicSource>();
+  final candidate = calloc<ThinpicSource>();
+  final out = calloc<ThinpicQuality>();
+  try {
+    reference.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = referencePathPtr.cast<Char>();
+    candidate.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = candidatePathPtr.cast<Char>();
+    if (_bindings.thinpic_compare(
+          reference,
+          candidate,
+          analysisPixels,
+          threads,
+          out,
+        ) !=
+        0) {
+      return null;
+    }
+    return (
+      psnr: out.ref.psnr,
+      ssim: out.ref.ssim,
+      msSsim: out.ref.ms_ssim,
+      width: out.ref.width,
+      height: out.ref.height,
+    );
+  } finally {
+    malloc.free(referencePathPtr);
+    malloc.free(candidatePathPtr);
+    calloc.free(reference);
+    calloc.free(candidate);
+    calloc.free(out);
+  }
+}
+
+/// The header parsed by [openImageHandle], or null for an invalid handle.
+ImageInfoData? imageHandleInfo(int handle) {
+  final out = calloc<ImageInfoData>();
+  try {
+    if (_bindings.thinpic_handle_info(Pointer.fromAddress(handle), out) != 0) {
+      return null;
+    }
+    // Copy into a Dart-owned struct so the result outlives `out`
+    final source = out.ref;
+    return Struct.create<ImageInfoData>()
+      ..width = source.width
+      ..height = source.height
+      ..bands = source.bands
+      ..orientation = source.orientation
+      ..needs_resize = source.needs_resize
+      ..new_width = source.new_width
+      ..new_height = source.new_height;
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// [thinpic_handle_compress] on an open handle: options as for
+/// [compressWithOptions]. Returns the encoded bytes, or null on failure.
+///
+/// Blocks until the image is encoded; call it from a background isolate.
+Uint8List? compressImageHandle(
+  int handle, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  int maxWidth = 0,
+  int maxHeight = 0,
+  ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+}) {
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  try {
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..max_width = maxWidth
+      ..max_height = maxHeight
+      ..stripAsInt = strip.value;
+    if (_bindings.thinpic_handle_compress(
+          Pointer.fromAddress(handle),
+          options,
+          out,
+        ) !=
+        0) {
+      return null;
+    }
+    return out.ref.data.asTypedList(
+      out.ref.length,
+      finalizer: _freeCompressedBufferFinalizer,
+    );
+  } finally {
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+/// [compressImageVariants] on an open handle, without reading the file again.
+List<Uint8List?>? compressImageHandleVariants(
+  int handle,
+  List<ImageVariant> variants,
+) {
+  return _encodeVariants(
+    variants,
+    (specs, out) => _bindings.thinpic_handle_variants(
+      Pointer.fromAddress(handle),
+      specs,
+      variants.length,
+      out,
+    ),
+  );
+}
+
+/// Releases a handle from [openImageHandle] and the image it kept in memory.
+void closeImageHandle(int handle) {
+  _bindings.thinpic_close(Pointer.fromAddress(handle));
+}
+
+/// One plane of a YUV 4:2:0 camera frame, as `CameraImage.planes` reports
+/// it: the plane's [bytes], [rowStride] (bytes per row) and [pixelStride]
+/// (1 for planar chroma, 2 for interleaved NV12/NV21 chroma).
+typedef YuvPlane = ({Uint8List bytes, int rowStride, int pixelStride});
+
+/// Encodes a YUV 4:2:0 frame ([y] at full size, [u] and [v] at half width
+/// and height) straight to JPEG with libjpeg on the calling thread, without
+/// converting it to RGB. Returns the JPEG bytes, or null on failure.
+Uint8List? encodeYuv420Jpeg(
+  YuvPlane y,
+  YuvPlane u,
+  YuvPlane v,
+  int width,
+  int height, {
+  int quality = 80,
+}) {
+  final chromaWidth = (width + 1) ~/ 2;
+  final chromaHeight = (height + 1) ~/ 2;
+  bool fits(YuvPlane plane, int planeWidth, int planeHeight) =>
+      plane.pixelStride >= 1 &&
+      plane.rowStride >= (planeWidth - 1) * plane.pixelStride + 1 &&
+      plane.bytes.length >=
+          (planeHeight - 1) * plane.rowStride +
+              (planeWidth - 1) * plane.pixelStride +
+              1;
+  if (width <= 0 ||
+      height <= 0 ||
+      !fits(y, width, height) ||
+      !fits(u, chromaWidth, chromaHeight) ||
+      !fits(v, chromaWidth, chromaHeight)) {
+    return null;
+  }
+
+  final planes = calloc<ThinpicYuvPlane>(3);
+  final sources = [y, u, v];
+  try {
+    for (var i = 0; i < 3; i++) {
+      final bytes = sources[i].bytes;
+      final data = malloc<Uint8>(bytes.length);
+      data.asTypedList(bytes.length).setAll(0, bytes);
+      planes[i]
+        ..data = data
+        ..row_stride = sources[i].rowStride
+        ..pixel_stride = sources[i].pixelStride;
+    }
+    final bytes = compressedResultToBytes(
+      _bindings.compress_yuv420_to_jpeg(
+        planes,
+        planes + 1,
+        planes + 2,
+        width,
+        height,
+        quality,
+      ),
+    );
+    return bytes.isEmpty ? null : bytes;
+  } finally {
+    for (var i = 0; i < 3; i++) {
+      if (planes[i].data != nullptr) {
+        malloc.free(planes[i].data);
+      }
+    }
+    calloc.free(planes);
+  }
+}
+
+/// One scan of a custom progressive JPEG script ([ThinpicScan]): the
+/// component indices (0 = Y, 1 = Cb, 2 = Cr), spectral range [ss]..[se] and
+/// successive-approximation bit positions [ah] (previous) and [al] (this scan).
+typedef ProgressiveScan = ({
+  List<int> components,
+  int ss,
+  int se,
+  int ah,
+  int al,
+});
+
+/// Runs one [thinpic_compress] call on the calling thread and returns the
+/// encoded bytes, or null on failure.
+///
+/// Blocks until the image is encoded; call it from a background isolate.
+Uint8List? compressWithOptions(
+  String inputPath, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  ThinpicKernel kernel = ThinpicKernel.THINPIC_KERNEL_LANCZOS3,
+  int maxWidth = 0,
+  int maxHeight = 0,
+  ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+  int threads = 0,
+  ThinpicWebpProfile webpProfile =
+      ThinpicWebpProfile.THINPIC_WEBP_PROFILE_DEFAULT,
+  bool? webpSharpYuv,
+  int alphaQuality = 0,
+  bool progressive = false,
+  ThinpicScanScript scanScript = ThinpicScanScript.THINPIC_SCAN_SCRIPT_DEFAULT,
+  List<ProgressiveScan> scans = const [],
+  bool animated = false,
+  ThinpicPngPalette pngPalette = ThinpicPngPalette.THINPIC_PNG_PALETTE_OFF,
+  int pngBitDepth = 0,
+  int dither = 100,
+  ThinpicPngDeflate pngDeflate = ThinpicPngDeflate.THINPIC_PNG_DEFLATE_ZLIB,
+  int gifColours = 256,
+  int gifInterframe = -1,
+  double minSsim = 0,
+  ThinpicCrop crop = ThinpicCrop.THINPIC_CROP_NONE,
+  int latencyBudgetMs = 0,
+  ThinpicHeifCompression heifCompression =
+      ThinpicHeifCompression.THINPIC_HEIF_HEVC,
+  ThinpicSubsample heifSubsample = ThinpicSubsample.THINPIC_SUBSAMPLE_AUTO,
+  double jxlDistance = 0,
+  bool jxlLosslessJpeg = false,
+  bool? jpegTrellis,
+  bool? jpegOvershootDeringing,
+  bool? jpegOptimizeScans,
+  ThinpicQuantTable jpegQuantTable =
+      ThinpicQuantTable.THINPIC_QUANT_TABLE_DEFAULT,
+  String? watermarkPath,
+  ThinpicGravity watermarkGravity = ThinpicGravity.THINPIC_GRAVITY_SOUTH_EAST,
+  int watermarkMargin = 16,
+  double watermarkWidth = 0,
+  double watermarkOpacity = 1,
+  ThinpicMotionVideo motionVideo = ThinpicMotionVideo.THINPIC_MOTION_VIDEO_STRIP,
+  ThinpicGainMap gainMap = ThinpicGainMap.THINPIC_GAIN_MAP_STRIP,
+  String? outputPath,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final watermarkPathPtr = watermarkPath?.toNativeUtf8();
+  final outputPathPtr = outputPath?.toNativeUtf8();
+  final source = calloc<ThinpicSource>();
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  final scanArray = scans.isEmpty ? nullptr : calloc<ThinpicScan>(scans.length);
+  try {
+    for (var i = 0; i < scans.length; i++) {
+      final scan = scans[i];
+      final components = scan.components.take(4).toList();
+      scanArray[i]
+        ..component_count = components.length
+        ..ss = scan.ss
+        ..se = scan.se
+        ..ah = scan.ah
+        ..al = scan.al;
+      for (var c = 0; c < components.length; c++) {
+        scanArray[i].components[c] = components[c];
+      }
+    }
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = inputPathPtr.cast<Char>();
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..kernelAsInt = kernel.value
+      ..max_width = maxWidth
+      ..max_height = maxHeight
+      ..stripAsInt = strip.value
+      ..threads = threads
+      ..webp_profileAsInt = webpProfile.value
+      ..webp_sharp_yuv = webpSharpYuv == null ? -1 : (webpSharpYuv ? 1 : 0)
+      ..alpha_quality = alphaQuality
+      ..progressive = progressive ? 1 : 0
+      ..scan_scriptAsInt = scanScript.value
+      ..scans = scanArray
+      ..scan_count = scans.length
+      ..animated = animated ? 1 : 0
+      ..png_paletteAsInt = pngPalette.value
+      ..png_bitdepth = pngBitDepth
+      ..dither = dither
+      ..png_deflateAsInt = pngDeflate.value
+      ..gif_colours = gifColours
+      ..gif_interframe = gifInterframe
+      ..min_ssim = minSsim
+      ..cropAsInt = crop.value
+      ..latency_budget_ms = latencyBudgetMs
+      ..heif_compressionAsInt = heifCompression.value
+      ..heif_subsampleAsInt = heifSubsample.value
+      ..jxl_distance = jxlDistance
+      ..jxl_lossless_jpeg = jxlLosslessJpeg ? 1 : 0
+      ..jpeg_trellis = jpegTrellis == null ? -1 : (jpegTrellis ? 1 : 0)
+      ..jpeg_overshoot_deringing = jpegOvershootDeringing == null
+          ? -1
+          : (jpegOvershootDeringing ? 1 : 0)
+      ..jpeg_optimize_scans = jpegOptimizeScans == null
+          ? -1
+          : (jpegOptimizeScans ? 1 : 0)
+      ..jpeg_quant_tableAsInt = jpegQuantTable.value
+      ..watermark_path = watermarkPathPtr?.cast<Char>() ?? nullptr
+      ..watermark_gravityAsInt = watermarkGravity.value
+      ..watermark_margin = watermarkMargin
+      ..watermark_width = watermarkWidth
+      ..watermark_opacity = watermarkOpacity
+      ..motion_videoAsInt = motionVideo.value
+      ..gain_mapAsInt = gainMap.value
+      ..output_path = outputPathPtr?.cast<Char>() ?? nullptr;
+    if (_bindings.thinpic_compress(source, options, out) != 0) {
+      return null;
+    }
+    return out.ref.data.asTypedList(
+      out.ref.length,
+      finalizer: _freeCompressedBufferFinalizer,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    if (watermarkPathPtr != null) {
+      malloc.free(watermarkPathPtr);
+    }
+    if (outputPathPtr != null) {
+      malloc.free(outputPathPtr);
+    }
+    calloc.free(source);
+    calloc.free(options);
+    calloc.free(out);
+    if (scanArray != nullptr) {
+      calloc.free(scanArray);
+    }
+  }
+}
+
+/// Opens a native stream to compress an image while it downloads
+/// ([thinpic_stream_new]). Returns its address, which can be sent to other
+/// isolates, or 0 on failure. Feed it with [writeImageStream], end it with
+/// [finishImageStream] and release it with [freeImageStream] once
+/// [compressImageStream] has returned.
+int openImageStream({int capacity = 0}) {
+  return _bindings.thinpic_stream_new(capacity).address;
+}
+
+/// Appends [chunk] to [stream]; the bytes are copied, and the call never
+/// waits for the decoder. Returns false once the stream has ended.
+bool writeImageStream(int stream, List<int> chunk) {
+  if (chunk.isEmpty) {
+    return true;
+  }
+  final data = malloc<Uint8>(chunk.length);
+  try {
+    data.asTypedList(chunk.length).setAll(0, chunk);
+    return _bindings.thinpic_stream_write(
+          Pointer.fromAddress(stream),
+          data,
+          chunk.length,
+        ) ==
+        0;
+  } finally {
+    malloc.free(data);
+  }
+}
+
+/// Ends the input of [stream]: the decoder reads what is left, or nothing
+/// more when [failed] (a download that broke off).
+void finishImageStream(int stream, {bool failed = false}) {
+  _bindings.thinpic_stream_finish(Pointer.fromAddress(stream), failed ? 1 : 0);
+}
+
+/// Releases a stream from [openImageStream].
+void freeImageStream(int stream) {
+  _bindings.thinpic_stream_free(Pointer.fromAddress(stream));
+}
+
+/// Runs [thinpic_compress] on the bytes written to [stream] as they arrive
+/// and returns the encoded bytes, or null on failure. The input can be read
+/// only once, so give [format] explicitly.
+///
+/// Blocks until the stream is finished and the image encoded; call it from
+/// a background isolate while another one writes.
+Uint8List? compressImageStream(
+  int stream, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  int maxWidth = 0,
+  int maxHeight = 0,
+  ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+}) {
+  final source = calloc<ThinpicSource>();
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  try {
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_FD.value
+      ..fd = _bindings.thinpic_stream_fd(Pointer.fromAddress(stream));
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..max_width = maxWidth
+      ..max_height = maxHeight
+      ..stripAsInt = strip.value;
+    if (_bindings.thinpic_compress(source, options, out) != 0) {
+      return null;
+    }
+    return out.ref.data.asTypedList(
+      out.ref.length,
+      finalizer: _freeCompressedBufferFinalizer,
+    );
+  } finally {
+    calloc.free(source);
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+/// Compresses raw 8-bit [pixels] with [thinpic_compress]
+/// ([ThinpicSourceType.THINPIC_SOURCE_PIXELS]): they are resized and encoded
+/// like a decoded file, into any output format, with no PNG in between.
+/// Returns the encoded bytes, or null on failure.
+///
+/// [stride] is the row pitch in bytes (0 = tightly packed); [premultiplied]
+/// is true for `ui.ImageByteFormat.rawRgba` data. The pixels are copied once
+/// into native memory, which the native side reads in place.
+Uint8List? compressPixels(
+  Uint8List pixels,
+  int width,
+  int height, {
+  ThinpicPixelFormat pixelFormat = ThinpicPixelFormat.THINPIC_PIXEL_RGBA,
+  int stride = 0,
+  bool premultiplied = false,
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  ThinpicKernel kernel = ThinpicKernel.THINPIC_KERNEL_LANCZOS3,
+  int maxWidth = 0,
+  int maxHeight = 0,
+}) {
+  if (pixels.isEmpty) {
+    return null;
+  }
+  final data = malloc<Uint8>(pixels.length);
+  final source = calloc<ThinpicSource>();
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  try {
+    data.asTypedList(pixels.length).setAll(0, pixels);
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PIXELS.value
+      ..data = data
+      ..length = pixels.length
+      ..fd = -1
+      ..width = width
+      ..height = height
+      ..stride = stride
+      ..pixel_format = pixelFormat.value
+      ..premultiplied = premultiplied ? 1 : 0;
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..kernelAsInt = kernel.value
+      ..max_width = maxWidth
+      ..max_height = maxHeight;
+    if (_bindings.thinpic_compress(source, options, out) != 0) {
+      return null;
+    }
+    return out.ref.data.asTypedList(
+      out.ref.length,
+      finalizer: _freeCompressedBufferFinalizer,
+    );
+  } finally {
+    malloc.free(data);
+    calloc.free(source);
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+/// Output of [compressWithinBudget]: the encoded [bytes], the [width],
+/// [height] and [format] actually written, the call's [elapsedMs] and
+/// whether it stayed within the budget.
+typedef BudgetedCompression = ({
+  Uint8List bytes,
+  int width,
+  int height,
+  ImageFormat format,
+  int elapsedMs,
+  bool budgetMet,
+});
+
+/// Runs one [thinpic_compress] call with a latency budget on the calling
+/// thread, or returns null on failure. The native side plans effort, format
+/// and size against the throughput it has measured on this device.
+///
+/// Blocks until the image is encoded; call it from a background isolate.
+BudgetedCompression? compressWithinBudget(
+  String inputPath,
+  int latencyBudgetMs, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  int maxWidth = 0,
+  int maxHeight = 0,
+  ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final source = calloc<ThinpicSource>();
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  try {
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = inputPathPtr.cast<Char>();
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..max_width = maxWidth
+      ..max_height = maxHeight
+      ..stripAsInt = strip.value
+      ..latency_budget_ms = latencyBudgetMs;
+    if (_bindings.thinpic_compress(source, options, out) != 0) {
+      return null;
+    }
+    final result = out.ref;
+    return (
+      bytes: result.data.asTypedList(
+        result.length,
+        finalizer: _freeCompressedBufferFinalizer,
+      ),
+      width: result.width,
+      height: result.height,
+      format: result.format,
+      elapsedMs: result.elapsed_ms,
+      budgetMet: result.budget_met == 1,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(source);
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+/// Blur and exposure scores of an encoded image: [sharpness] is the
+/// Laplacian variance of a luma plane of up to 512 cells on the long side
+/// (under about 100 is usually soft or shaken), [brightness] the mean luma
+/// from 0 to 1, and [shadowsClipped] / [highlightsClipped] the fractions of
+/// the plane crushed to black or blown to white.
+typedef ImageAnalysis = ({
+  double sharpness,
+  double brightness,
+  double shadowsClipped,
+  double highlightsClipped,
+});
+
+/// One dominant colour of an encoded image: [rgb] as 0xRRGGBB (opaque
+/// `Color(0xFF000000 | rgb)`) and the [share] of the image nearest it.
+typedef DominantColour = ({int rgb, double share});
+
+/// A model input cut from an encoded image: [data] holds [height] x [width]
+/// x RGB in NHWC order (batch of one), a [Uint8List] for
+/// [ThinpicTensorType.THINPIC_TENSOR_UINT8] or a [Float32List] for
+/// [ThinpicTensorType.THINPIC_TENSOR_FLOAT32]; feed it to the interpreter as
+/// is.
+typedef ModelTensor = ({int width, int height, TypedData data});
+
+/// Output of [compressWithHash]: the encoded [bytes], the [width], [height]
+/// and [format] written, the 64-bit [perceptualHash] of the encoded pixels,
+/// the BlurHash or ThumbHash [placeholder], the blur and exposure
+/// [analysis], the dominant colours in [palette], largest share first, and
+/// the model input [tensor] (each null when not asked for or when none could
+/// be taken).
+typedef HashedCompression = ({
+  Uint8List bytes,
+  int width,
+  int height,
+  ImageFormat format,
+  int? perceptualHash,
+  String? placeholder,
+  ImageAnalysis? analysis,
+  List<DominantColour>? palette,
+  ModelTensor? tensor,
+});
+
+/// Runs one [thinpic_compress] call that also hashes what it encodes, or
+/// returns null on failure. The hash, placeholder, analysis and tensor are
+/// read from the strips the encoder consumes, so they cost no second decode.
+///
+/// Blocks until the image is encoded; call it from a background isolate.
+HashedCompression? compressWithHash(
+  String inputPath, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  int maxWidth = 0,
+  int maxHeight = 0,
+  ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+  bool perceptualHash = true,
+  ThinpicPlaceholder placeholder = ThinpicPlaceholder.THINPIC_PLACEHOLDER_NONE,
+  bool analyse = false,
+  int paletteColours = 0,
+  int tensorWidth = 0,
+  int tensorHeight = 0,
+  ThinpicTensorType tensorType = ThinpicTensorType.THINPIC_TENSOR_UINT8,
+  List<double> tensorMean = const [0, 0, 0],
+  List<double> tensorStd = const [1, 1, 1],
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final source = calloc<ThinpicSource>();
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  try {
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = inputPathPtr.cast<Char>();
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..max_width = maxWidth
+      ..max_height = maxHeight
+      ..stripAsInt = strip.value
+      ..perceptual_hash = perceptualHash ? 1 : 0
+      ..placeholderAsInt = placeholder.value
+      ..analysis = analyse ? 1 : 0
+      ..palette_colours = paletteColours
+      ..tensor_width = tensorWidth
+      ..tensor_height = tensorHeight
+      ..tensor_typeAsInt = tensorType.value;
+    for (var c = 0; c < 3; c++) {
+      options.ref.tensor_mean[c] = tensorMean[c];
+      options.ref.tensor_std[c] = tensorStd[c];
+    }
+    if (_bindings.thinpic_compress(source, options, out) != 0) {
+      return null;
+    }
+    final result = out.ref;
+    final floats = tensorType == ThinpicTensorType.THINPIC_TENSOR_FLOAT32;
+    return (
+      bytes: result.data.asTypedList(
+        result.length,
+        finalizer: _freeCompressedBufferFinalizer,
+      ),
+      width: result.width,
+      height: result.height,
+      format: result.format,
+      perceptualHash: result.hash_valid == 1 ? result.perceptual_hash : null,
+      placeholder: _placeholderString(result.placeholder),
+      analysis: result.analysis_valid == 1
+          ? (
+              sharpness: result.sharpness,
+              brightness: result.brightness,
+              shadowsClipped: result.shadows_clipped,
+              highlightsClipped: result.highlights_clipped,
+            )
+          : null,
+      palette: result.palette_count > 0
+          ? [
+              for (var i = 0; i < result.palette_count; i++)
+                (rgb: result.palette[i], share: result.palette_share[i]),
+            ]
+          : null,
+      tensor: result.tensor_length > 0
+          ? (
+              width: tensorWidth,
+              height: tensorHeight,
+              data: floats
+                  ? result.tensor.cast<Float>().asTypedList(
+                      result.tensor_length ~/ 4,
+                      finalizer: _freeCompressedBufferFinalizer,
+                    )
+                  : result.tensor.asTypedList(
+                      result.tensor_length,
+                      finalizer: _freeCompressedBufferFinalizer,
+                    ),
+            )
+          : null,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    calloc.free(source);
+    calloc.free(options);
+    calloc.free(out);
+  }
+}
+
+/// A native failure ([thinpic_last_error]): its [code] and the first error
+/// logged for the call, followed by libvips' detail.
+typedef CompressionError = ({ThinpicErrorCode code, String message});
+
+/// Takes the error of the last direct compression call that failed on this
+/// isolate's thread, or null when there is none. It must run synchronously
+/// after the failing call, with no `await` between them (an isolate may move
+/// threads across an await). Pool jobs and [thinpic_compress] carry their
+/// own error instead.
+CompressionError? takeLastCompressionError() {
+  final out = calloc<ThinpicError>();
+  try {
+    if (_bindings.thinpic_last_error(out) == 0) {
+      return null;
+    }
+    return _compressionError(out.ref);
+  } finally {
+    calloc.free(out);
+  }
+}
+
+CompressionError _compressionError(ThinpicError error) {
+  final message = StringBuffer();
+  for (var i = 0; i < THINPIC_ERROR_MESSAGE_MAX && error.message[i] != 0; i++) {
+    message.writeCharCode(error.message[i] & 0xFF);
+  }
+  return (
+    code: ThinpicErrorCode.fromValue(error.code),
+    message: message.toString(),
+  );
+}
+
+// The NUL-terminated ASCII in ThinpicResult.placeholder, null when empty
+String? _placeholderString(Array<Char> text) {
+  final codes = <int>[];
+  for (var i = 0; i < THINPIC_PLACEHOLDER_MAX && text[i] != 0; i++) {
+    codes.add(text[i]);
+  }
+  return codes.isEmpty ? null : String.fromCharCodes(codes);
+}
+
+/// Number of bits that differ between two perceptual hashes
+/// ([thinpic_hash_distance]).
+int perceptualHashDistance(int a, int b) =>
+    _bindings.thinpic_hash_distance(a, b);
+
+/// Groups [hashes] within [maxDistance] bits of each other with
+/// [thinpic_group_near_duplicates]: element i of the result is the index of
+/// the first hash in i's group.
+List<int> groupPerceptualHashes(List<int> hashes, {int maxDistance = 10}) {
+  if (hashes.isEmpty) return const [];
+  final hashArray = calloc<Uint64>(hashes.length);
+  final groups = calloc<Int>(hashes.length);
+  try {
+    for (var i = 0; i < hashes.length; i++) {
+      hashArray[i] = hashes[i];
+    }
+    if (_bindings.thinpic_group_near_duplicates(
+          hashArray,
+          hashes.length,
+          maxDistance,
+          groups,
+        ) <
+        0) {
+      throw ArgumentError.value(maxDistance, 'maxDistance');
+    }
+    return List<int>.generate(hashes.length, (i) => groups[i]);
+  } finally {
+    calloc.free(hashArray);
+    calloc.free(groups);
+  }
+}
+
+/// One step of [compressWithOperations] ([ThinpicOperation]).
+class ImageOperation {
+  final ThinpicOperationType type;
+  final int x;
+  final int y;
+  final int width;
+  final int height;
+  final double sigma;
+  final double opacity;
+  final String? overlayPath;
+
+  const ImageOperation._(
+    this.type, {
+    this.x = 0,
+    this.y = 0,
+    this.width = 0,
+    this.height = 0,
+    this.sigma = 0,
+    this.opacity = 1,
+    this.overlayPath,
+  });
+
+  /// Apply the EXIF orientation to the pixels.
+  const ImageOperation.autorotate()
+    : this._(ThinpicOperationType.THINPIC_OP_AUTOROTATE);
+
+  /// Keep the [width] x [height] rectangle at [x], [y] (clipped to the image).
+  const ImageOperation.crop(int x, int y, int width, int height)
+    : this._(
+        ThinpicOperationType.THINPIC_OP_CROP,
+        x: x,
+        y: y,
+        width: width,
+        height: height,
+      );
+
+  /// Fit inside [width] x [height] (0 does not constrain); never upscales.
+  const ImageOperation.resize({int width = 0, int height = 0})
+    : this._(
+        ThinpicOperationType.THINPIC_OP_RESIZE,
+        width: width,
+        height: height,
+      );
+
+  /// Unsharp mask of radius [sigma] (0 = 1.0).
+  const ImageOperation.sharpen({double sigma = 0})
+    : this._(ThinpicOperationType.THINPIC_OP_SHARPEN, sigma: sigma);
+
+  /// Draw the image at [path] with its top left at [x], [y], its alpha
+  /// scaled by [opacity] (0-1).
+  const ImageOperation.composite(
+    String path, {
+    int x = 0,
+    int y = 0,
+    double opacity = 1,
+  }) : this._(
+         ThinpicOperationType.THINPIC_OP_COMPOSITE,
+         x: x,
+         y: y,
+         opacity: opacity,
+         overlayPath: path,
+       );
+}
+
+/// Runs [operations] in order on [inputPath] and encodes the result with one
+/// [thinpic_compress_ops] call, or returns null on failure.
+///
+/// The steps only build one lazy libvips graph, so the input is decoded once
+/// and encoded once however many there are. Blocks until the image is
+/// encoded; call it from a background isolate.
+Uint8List? compressWithOperations(
+  String inputPath,
+  List<ImageOperation> operations, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int effort = -1,
+  ThinpicKernel kernel = ThinpicKernel.THINPIC_KERNEL_LANCZOS3,
+  ThinpicStripPolicy strip = ThinpicStripPolicy.THINPIC_STRIP_NONE,
+  int threads = 0,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final source = calloc<ThinpicSource>();
+  final options = calloc<ThinpicOptions>();
+  final out = calloc<ThinpicResult>();
+  final ops = calloc<ThinpicOperation>(
+    operations.isEmpty ? 1 : operations.length,
+  );
+  final overlayPaths = <Pointer<Utf8>>[];
+  try {
+    for (var i = 0; i < operations.length; i++) {
+      final operation = operations[i];
+      final overlayPath = operation.overlayPath;
+      var overlayPathPtr = nullptr.cast<Utf8>();
+      if (overlayPath != null) {
+        overlayPathPtr = overlayPath.toNativeUtf8();
+        overlayPaths.add(overlayPathPtr);
+      }
+      ops[i]
+        ..typeAsInt = operation.type.value
+        ..x = operation.x
+        ..y = operation.y
+        ..width = operation.width
+        ..height = operation.height
+        ..sigma = operation.sigma
+        ..opacity = operation.opacity
+        ..overlay_path = overlayPathPtr.cast<Char>();
+    }
+    source.ref
+      ..typeAsInt = ThinpicSourceType.THINPIC_SOURCE_PATH.value
+      ..path = inputPathPtr.cast<Char>();
+    _bindings.thinpic_options_init(options);
+    options.ref
+      ..formatAsInt = format.value
+      ..quality = quality
+      ..effort = effort
+      ..kernelAsInt = kernel.value
+      ..stripAsInt = strip.value
+      ..threads = threads;
+    if (_bindings.thinpic_compress_ops(
+          source,
+          ops,
+          operations.length,
+          options,
+          out,
+        ) !=
+        0) {
+      return null;
+    }
+    return out.ref.data.asTypedList(
+      out.ref.length,
+      finalizer: _freeCompressedBufferFinalizer,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    for (final overlayPathPtr in overlayPaths) {
+      malloc.free(overlayPathPtr);
+    }
+    calloc.free(source);
+    calloc.free(options);
+    calloc.free(out);
+    calloc.free(ops);
+  }
+}
+
+/// Compresses every image of the directory (or list file) [source] into
+/// [outputDirectory] with one blocking [compress_directory] call, recording
+/// each finished input in the manifest at [manifestPath]. Inputs already in
+/// the manifest are skipped, so a batch the OS killed resumes where it
+/// stopped. Returns how many inputs the manifest records as done, or -1.
+///
+/// Call it from a background isolate.
+int compressDirectoryResumable(
+  String source,
+  String outputDirectory,
+  String manifestPath, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) {
+  final sourcePtr = source.toNativeUtf8();
+  final outputDirectoryPtr = outputDirectory.toNativeUtf8();
+  final manifestPathPtr = manifestPath.toNativeUtf8();
+  final options = calloc<CompressOptions>();
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: CompressMode.COMPRESS_MODE_STANDARD,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: 0,
+      smartType: 0,
+      priority: priority,
+    );
+    return _bindings.compress_directory(
+      sourcePtr.cast<Char>(),
+      outputDirectoryPtr.cast<Char>(),
+      manifestPathPtr.cast<Char>(),
+      options,
+    );
+  } finally {
+    malloc.free(sourcePtr);
+    malloc.free(outputDirectoryPtr);
+    malloc.free(manifestPathPtr);
+    calloc.free(options);
+  }
+}
+
+/// [compressDirectoryResumable] for a folder that is synced again and again:
+/// one blocking [sync_directory] call against the index at [indexPath],
+/// which records each input's mtime, size and options next to its output.
+/// Only new or changed inputs, inputs last done with other options, and
+/// inputs whose output is gone are compressed. Returns how many inputs are
+/// up to date, or -1.
+///
+/// Call it from a background isolate.
+int syncDirectoryIncremental(
+  String source,
+  String outputDirectory,
+  String indexPath, {
+  ImageFormat format = ImageFormat.FORMAT_JPEG,
+  int quality = 80,
+  int targetWidth = 0,
+  int targetHeight = 0,
+  ThinpicPriority priority = ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE,
+}) {
+  final packed = _packStrings([source, outputDirectory, indexPath]);
+  final options = calloc<CompressOptions>();
+  try {
+    _writeCompressOptions(
+      options.ref,
+      mode: CompressMode.COMPRESS_MODE_STANDARD,
+      format: format,
+      quality: quality,
+      targetWidth: targetWidth,
+      targetHeight: targetHeight,
+      targetKb: 0,
+      smartType: 0,
+      priority: priority,
+    );
+    return _bindings.sync_directory(
+      packed.strings[0],
+      packed.strings[1],
+      packed.strings[2],
+      options,
+    );
+  } finally {
+    malloc.free(packed.arena);
+    calloc.free(options);
+  }
+}
+
+/// The batch a WorkManager worker or foreground service runs through
+/// `ThinpicBackgroundEngine` ([thinpic_background_status]): its [state],
+/// how many of [total] inputs the manifest records as [done], and when it
+/// started and finished (0 while it runs).
+typedef BackgroundBatchStatus = ({
+  ThinpicBackgroundState state,
+  int done,
+  int total,
+  DateTime? started,
+  DateTime? finished,
+});
+
+/// Reads the running or last background batch of this process; cheap
+/// enough for the UI isolate.
+BackgroundBatchStatus readBackgroundBatch() {
+  final out = calloc<ThinpicBackgroundStatus>();
+  try {
+    _bindings.thinpic_background_status(out);
+    DateTime? at(int ms) =>
+        ms > 0 ? DateTime.fromMillisecondsSinceEpoch(ms) : null;
+    return (
+      state: ThinpicBackgroundState.fromValue(out.ref.state),
+      done: out.ref.done,
+      total: out.ref.total,
+      started: at(out.ref.started_ms),
+      finished: at(out.ref.finished_ms),
+    );
+  } finally {
+    calloc.free(out);
+  }
+}
+
+/// Asks the running background batch to stop ([thinpic_background_stop]).
+void stopBackgroundBatchRun() {
+  _bindings.thinpic_background_stop();
+}
+
+/// Writes [inputPath] as a tiled multi-resolution pyramid to [outputPath]
+/// with one [compress_image_to_pyramid] call, reading the source once.
+/// Returns the bytes written, or -1 on failure.
+///
+/// Blocks until the pyramid is written; call it from a background isolate.
+int writeImagePyramid(
+  String inputPath,
+  String outputPath, {
+  ThinpicPyramidLayout layout = ThinpicPyramidLayout.THINPIC_PYRAMID_TIFF,
+  int quality = 80,
+  int tileSize = 0,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final outputPathPtr = outputPath.toNativeUtf8();
+  try {
+    return _bindings.compress_image_to_pyramid(
+      inputPathPtr.cast<Char>(),
+      outputPathPtr.cast<Char>(),
+      layout,
+      quality,
+      tileSize,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    malloc.free(outputPathPtr);
+  }
+}
+
+/// Writes pages [firstPage] onwards of a multi-page TIFF or PDF ([count] of
+/// them, or all when 0) to [outputPath] as one multi-page TIFF with one
+/// [compress_pages_to_tiff] call. Returns the bytes written, or -1 on
+/// failure.
+///
+/// Blocks until the file is written; call it from a background isolate.
+int writePagesTiff(
+  String inputPath,
+  String outputPath, {
+  int firstPage = 0,
+  int count = 0,
+  int quality = 80,
+  int maxWidth = 0,
+  int maxHeight = 0,
+}) {
+  final inputPathPtr = inputPath.toNativeUtf8();
+  final outputPathPtr = outputPath.toNativeUtf8();
+  try {
+    return _bindings.compress_pages_to_tiff(
+      inputPathPtr.cast<Char>(),
+      outputPathPtr.cast<Char>(),
+      firstPage,
+      count,
+      quality,
+      maxWidth,
+      maxHeight,
+    );
+  } finally {
+    malloc.free(inputPathPtr);
+    malloc.free(outputPathPtr);
+  }
+}
 
+/// Wraps the native buffer of [result] as a [Uint8List] without copying.
+///
+/// The returned list takes ownership of `result.data`: it is released with
+/// free_compressed_buffer when the list is garbage collected, so the caller
+/// must not free it again. Failed results give an empty list.
 Uint8List compressedResultToBytes(CompressedImageResult result) {
-  if (result.success == 0 || result.data == nullptr) {
+  if (result.success != 1 || result.data == nullptr) {
+    if (result.data != nullptr) {
+      _bindings.free_compressed_buffer(result.data);
+    }
     return Uint8List(0);
   }
-  final bytes = result.data.asTypedList(result.length);
-  return Uint8List.fromList(bytes);
+  return result.data.asTypedList(
+    result.length,
+    finalizer: _freeCompressedBufferFinalizer,
+  );
 }
 
 bool isCompressionSuccessful(CompressedImageResult result) {
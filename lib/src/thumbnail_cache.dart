@@ -0,0 +1,263 @@
+import 'dart:async';
+import 'dart:convert';
+import 'dart:io';
+
+import 'package:flutter/foundation.dart' show debugPrint;
+import 'package:path_provider/path_provider.dart' show getTemporaryDirectory;
+import 'package:thinpic_flutter/generated/thinpic_flutter_bindings_generated.dart'
+    show CompressMode, ThinpicPriority;
+
+import 'package:thinpic_flutter/src/file_types.dart';
+import 'package:thinpic_flutter/src/thinpic_flutter_ffi_functions.dart'
+    show CompressionCancelToken, runCompressionJobToFile, poolSize;
+
+class _ThumbnailRequest {
+  _ThumbnailRequest(this.path, this.file, this.sequence);
+
+  final String path;
+  final File file;
+  final int sequence;
+  final Completer<File?> completer = Completer<File?>();
+  CompressionCancelToken? cancelToken;
+}
+
+/// Small thumbnails for a gallery, made on the native worker pool and kept
+/// on disk.
+///
+/// Each source path maps to one file in [directory], named after the path,
+/// its size and modification time and the thumbnail settings, so an edited
+/// photo gets a new thumbnail and a hit costs one stat. Hits are returned
+/// as files for `Image.file`, which the engine reads without a Dart copy.
+/// Misses are queued and started a few at a time (at most the pool size):
+/// paths passed to [setViewport] first, in the order given, as interactive
+/// jobs; everything else after them as background jobs. Paths that scroll
+/// out of view stay queued behind the visible ones, and [cancel] drops them.
+/// Once the directory passes [maxBytes] the least recently written
+/// thumbnails are deleted.
+///
+/// example:
+/// ```dart
+/// final thumbnails = ThinPicThumbnailCache(size: 256);
+/// // In the grid's scroll listener
+/// thumbnails.setViewport(visiblePaths);
+/// // In the item builder
+/// FutureBuilder(future: thumbnails.thumbnail(path), ...);
+/// ```
+class ThinPicThumbnailCache {
+  ThinPicThumbnailCache({
+    this.size = 256,
+    this.quality = 75,
+    this.format = ImageFormat.FORMAT_WEBP,
+    this.maxBytes = 64 * 1024 * 1024,
+    String? directory,
+    int? concurrency,
+  })  : _directory = directory,
+        _concurrency = concurrency ?? poolSize().clamp(1, 8);
+
+  /// Bounding box of the thumbnails, in pixels
+  final int size;
+  final int quality;
+
+  /// JPEG, PNG or WebP
+  final ImageFormat format;
+
+  /// Disk budget of the cache directory
+  final int maxBytes;
+
+  String? _directory;
+  final int _concurrency;
+  final Map<String, _ThumbnailRequest> _pending = {};
+  final Map<String, _ThumbnailRequest> _running = {};
+  Map<String, int> _viewport = const {};
+  int _sequence = 0;
+  int _writtenSinceTrim = 0;
+
+  /// Where the thumbnails live; by default `thinpic_thumbnails` in the
+  /// temporary directory
+  Future<String> get directory async {
+    final directory = _directory ??=
+        '${(await getTemporaryDirectory()).path}/thinpic_thumbnails';
+    await Directory(directory).create(recursive: true);
+    return directory;
+  }
+
+  /// The thumbnail of [path]: straight from disk when it is cached,
+  /// otherwise once its job has run. Concurrent calls for one path share a
+  /// job. Returns null if the image could not be read or the request was
+  /// cancelled.
+  Future<File?> thumbnail(String path) async {
+    final queued = _pending[path] ?? _running[path];
+    if (queued != null) {
+      return queued.completer.future;
+    }
+    final File file;
+    try {
+      file = await _cacheFile(path);
+    } on FileSystemException {
+      return null;
+    }
+    if (await file.exists()) {
+      return file;
+    }
+    // Another call may have queued it while this one was checking
+    final raced = _pending[path] ?? _running[path];
+    if (raced != null) {
+      return raced.completer.future;
+    }
+    final request = _ThumbnailRequest(path, file, _sequence++);
+    _pending[path] = request;
+    _schedule();
+    return request.completer.future;
+  }
+
+  /// The paths now on screen, nearest first. Queued thumbnails start in
+  /// this order before any other; the rest wait as background work.
+  void setViewport(List<String> visiblePaths) {
+    final viewport = <String, int>{};
+    for (var i = 0; i < visiblePaths.length; i++) {
+      viewport.putIfAbsent(visiblePaths[i], () => i);
+    }
+    _viewport = viewport;
+  }
+
+  /// Drop the queued or running thumbnail of [path]; its future completes
+  /// with null.
+  void cancel(String path) {
+    final pending = _pending.remove(path);
+    if (pending != null) {
+      pending.completer.complete(null);
+    }
+    _running[path]?.cancelToken?.cancel();
+  }
+
+  /// Cancel everything queued and running.
+  void cancelAll() {
+    for (final path in [..._pending.keys, ..._running.keys]) {
+      cancel(path);
+    }
+  }
+
+  /// Delete every cached thumbnail.
+  Future<void> clear() async {
+    final directory = Directory(await this.directory);
+    await for (final entry in directory.list()) {
+      if (entry is File) {
+        await entry.delete();
+      }
+    }
+  }
+
+  Future<File> _cacheFile(String path) async {
+    final stat = await File(path).stat();
+    if (stat.type == FileSystemEntityType.notFound) {
+      throw FileSystemException('No such file', path);
+    }
+    final key = _fnv1a(
+      '$path\u0000${stat.size}\u0000'
+      '${stat.modified.microsecondsSinceEpoch}\u0000'
+      '$size\u0000$quality\u0000${format.value}',
+    );
+    final name = (key >>> 32).toRadixString(16).padLeft(8, '0') +
+        (key & 0xffffffff).toRadixString(16).padLeft(8, '0');
+    return File('${await directory}/$name${_extension(format)}');
+  }
+
+  // Viewport paths by position, then the rest in the order they came
+  _ThumbnailRequest? _next() {
+    _ThumbnailRequest? best;
+    int? bestRank;
+    for (final request in _pending.values) {
+      final rank = _viewport[request.path];
+      if (best == null ||
+          (rank != null && (bestRank == null || rank < bestRank)) ||
+          (rank == null && bestRank == null &&
+              request.sequence < best.sequence)) {
+        best = request;
+        bestRank = rank;
+      }
+    }
+    return best;
+  }
+
+  void _schedule() {
+    while (_running.length < _concurrency && _pending.isNotEmpty) {
+      final request = _next()!;
+      _pending.remove(request.path);
+      _running[request.path] = request;
+      unawaited(_run(request));
+    }
+  }
+
+  Future<void> _run(_ThumbnailRequest request) async {
+    final visible = _viewport.containsKey(request.path);
+    request.cancelToken = CompressionCancelToken();
+    var written = -1;
+    try {
+      written = await runCompressionJobToFile(
+        request.path,
+        request.file.path,
+        mode: CompressMode.COMPRESS_MODE_THUMBNAIL,
+        format: format,
+        quality: quality,
+        targetWidth: size,
+        targetHeight: size,
+        cancelToken: request.cancelToken,
+        priority: visible
+            ? ThinpicPriority.THINPIC_PRIORITY_INTERACTIVE
+            : ThinpicPriority.THINPIC_PRIORITY_BACKGROUND,
+      );
+    } catch (e, stackTrace) {
+      debugPrint('Error during gallery thumbnail: $e');
+      debugPrint('Stack trace: $stackTrace');
+    } finally {
+      _running.remove(request.path);
+      request.completer.complete(written >= 0 ? request.file : null);
+      if (written >= 0 && ++_writtenSinceTrim >= 32) {
+        _writtenSinceTrim = 0;
+        unawaited(_trim());
+      }
+      _schedule();
+    }
+  }
+
+  Future<void> _trim() async {
+    try {
+      final entries = <(File, FileStat)>[];
+      var total = 0;
+      await for (final entry in Directory(await directory).list()) {
+        if (entry is File) {
+          final stat = await entry.stat();
+          entries.add((entry, stat));
+          total += stat.size;
+        }
+      }
+      if (total <= maxBytes) {
+        return;
+      }
+      entries.sort((a, b) => a.$2.modified.compareTo(b.$2.modified));
+      for (final (file, stat) in entries) {
+        if (total <= maxBytes) {
+          break;
+        }
+        await file.delete();
+        total -= stat.size;
+      }
+    } on FileSystemException {
+      // Another trim or a clear got there first
+    }
+  }
+
+  static int _fnv1a(String text) {
+    var hash = 0xcbf29ce484222325;
+    for (final byte in utf8.encode(text)) {
+      hash = (hash ^ byte) * 0x100000001b3;
+    }
+    return hash;
+  }
+
+  static String _extension(ImageFormat format) => switch (format) {
+    ImageFormat.FORMAT_PNG => '.png',
+    ImageFormat.FORMAT_WEBP => '.webp',
+    _ => '.jpg',
+  };
+}
@@ -1,3 +1,59 @@
 export 'src/thinpic_flutter.dart';
 export 'src/file_types.dart';
-export 'generated/thinpic_flutter_bindings_generated.dart' show ImageInfoData;
+export 'src/thumbnail_cache.dart';
+export 'src/thinpic_flutter_ffi_functions.dart'
+    show
+        BudgetedCompression,
+        CompressionCancelToken,
+        CompressionError,
+        CompressionProfile,
+        ContactSheet,
+        EmbeddedThumbnail,
+        HashedCompression,
+        ImageAnalysis,
+        ImageSource,
+        ImageOperation,
+        ImageVariant,
+        ModelTensor,
+        MotionPhotoInfo,
+        ProfiledOperation,
+        ProgressiveScan,
+        SheetCell,
+        takeLastCompressionError,
+        YuvPlane;
+export 'generated/thinpic_flutter_bindings_generated.dart'
+    show
+        ImageInfoData,
+        ImageHeader,
+        ThinpicImageMeta,
+        ThinpicEstimate,
+        ExecutionMode,
+        ThinpicLogLevel,
+        CompressionStats,
+        ThinpicTelemetryRecord,
+        ThinpicTelemetryError,
+        ThinpicErrorCode,
+        THINPIC_TELEMETRY_RECORDS,
+        ThinpicRuntimeStats,
+        ThinpicThroughput,
+        ThinpicKernel,
+        ThinpicStripPolicy,
+        ThinpicMotionVideo,
+        ThinpicGainMap,
+        ThinpicMotionKind,
+        ThinpicPriority,
+        ThinpicMemoryPressure,
+        ThinpicWebpProfile,
+        ThinpicScanScript,
+        ThinpicPngPalette,
+        ThinpicPngDeflate,
+        ThinpicCrop,
+        ThinpicHeifCompression,
+        ThinpicSubsample,
+        ThinpicQuantTable,
+        ThinpicPlaceholder,
+        ThinpicTensorType,
+        ThinpicOperationType,
+        ThinpicPyramidLayout,
+        ThinpicResizeQuality,
+        ThinpicPixelFormat;
@@ -0,0 +1,1261 @@
+// thinpic_bench.c
+// Throughput scaling benchmark for the native engine.
+//
+// Usage (on device via adb):
+//   thinpic_bench <image> [jobs] [max_threads] [quality]
+//   thinpic_bench --corpus <dir|list> [--iterations n] [--quality q]
+//                 [--target-kb k] [--energy] [--json]
+//   thinpic_bench --stress <dir|list> [--rounds n] [--quality q]
+//                 [--target-kb k] [--json]
+//   thinpic_bench --leaks <dir|list> [--iterations n] [--rss-slack-mb m]
+//                 [--quality q] [--target-kb k] [--json]
+//
+// Runs `jobs` compressions of <image> spread over 1, 2, 4 ... max_threads
+// caller threads, once in EXECUTION_MODE_SERIAL and once in
+// EXECUTION_MODE_CONCURRENT, and prints images/second for each. A second
+// table times compress_large_image_with_format with buffered reads against
+// memory-mapped input (thinpic_configure mmap_input_min_mb). A third runs
+// the threaded round with the operation cache kept and in one-shot mode
+// (thinpic_configure one_shot_cache) and prints the cached operations and
+// resident set each leaves behind. A fourth encodes
+// WebP through thinpic_compress with each ThinpicWebpProfile and reports
+// per-image time and output size; a fifth does the same for baseline
+// against progressive JPEG (each scan script) and interlaced PNG, with
+// baseline JPEG also written without the mozjpeg extensions, and a
+// sixth compares PNG written with zlib and with libdeflate at a few efforts.
+// Then HEIF is written as HEVC (HEIC) and AV1 (AVIF), 4:2:0 and 4:4:4, at
+// efforts 0, 4 and 9; 4:2:0 HEVC goes to the hardware encoder when there
+// is one, so its effort rows show only the platform's fixed speed.
+// The next resizes the decoded <image> to 0.5x, 0.25x and 0.1x (Lanczos3)
+// with each thinpic_configure resize_quality. The last
+// resizes <image>, scaled to a range of source sizes, to a quarter
+// of its width with vips_resize (Lanczos3) and with the GPU stage behind
+// thinpic_configure gpu_resize_min_mp, to find where the GPU starts to win.
+//
+// Corpus mode runs each public API (compress_image_with_format,
+// smart_compress_image in its low and high types, auto_compress_image,
+// fast_webp_compress, get_image_info) `iterations` times on every image of a directory, or of a
+// file listing one path per line, and prints one row per image and API:
+// p50/p90/p99 latency, images/second, output bytes and the process's peak
+// RSS so far. CSV by default, JSON lines with --json. A last row submits
+// the whole corpus to the worker pool at once, as a mixed batch, and
+// reports the p50/p95/max time from submission to each job's completion.
+// With --energy each row also gets the joules one image cost, over the idle
+// draw measured before the run. On-device power rails (the ODPM energy
+// counters under /sys/bus/iio) are read where the kernel exposes them;
+// otherwise the battery's current_now and voltage_now, the counters
+// BatteryManager reports, are sampled every 10 ms and integrated. The
+// battery counts only with the device unplugged: run over adb on Wi-Fi.
+//
+// Stress mode first runs every API once on every corpus image on one
+// thread as the reference, then runs that work list `rounds` times over 1,
+// 2, 4 ... twice the core count of caller threads at once. Each level
+// reports calls per second, p50/p99 latency, peak RSS and libvips peak
+// memory, and any call whose output differs from the reference (or that
+// failed where the reference did not).
+//
+// Leak mode calls each corpus API, a pool job, compress_buffer and
+// thinpic_compress `iterations` times over the corpus and checks that,
+// with every cache dropped, libvips tracked memory, allocations, open files
+// and live objects are back at their baseline and RSS within
+// --rss-slack-mb (8 by default); it exits with 2 when any call leaked.
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../image_compressor.h"
+#include "../thinpic_internal.h"
+
+typedef struct {
+    const char* path;
+    int quality;
+    int jobs;
+    int next_job;
+    int failures;
+    pthread_mutex_t lock;
+} BenchContext;
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// A config that changes nothing: every field -1, which thinpic_configure
+// leaves alone. Initializers would set the fields they omit to 0, and every
+// field appended later with them. All fields are ints.
+static ThinpicRuntimeConfig unchanged_config() {
+    ThinpicRuntimeConfig config;
+    memset(&config, 0xFF, sizeof(config));
+    return config;
+}
+
+static void* bench_worker(void* arg) {
+    BenchContext* ctx = (BenchContext*)arg;
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        int job = ctx->next_job++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (job >= ctx->jobs) break;
+
+        CompressedImageResult result = compress_image_with_format(ctx->path, ctx->quality, FORMAT_JPEG);
+        if (result.success == 1) {
+            free_compressed_buffer(result.data);
+        } else {
+            pthread_mutex_lock(&ctx->lock);
+            ctx->failures++;
+            pthread_mutex_unlock(&ctx->lock);
+        }
+    }
+    return NULL;
+}
+
+// CPU against GPU Lanczos3 at one source size. The source is decoded to
+// memory first so only the resize is timed; gpu_ms is -1 when the GPU stage
+// declined the image.
+static void run_resize_case(VipsImage* original, double megapixels, int jobs) {
+    double pixels = (double)vips_image_get_width(original) * vips_image_get_height(original);
+    VipsImage* scaled = NULL;
+    if (vips_resize(original, &scaled, sqrt(megapixels * 1e6 / pixels), "kernel", VIPS_KERNEL_LANCZOS3, NULL)) {
+        vips_error_clear();
+        return;
+    }
+    VipsImage* source = vips_image_copy_memory(scaled);
+    g_object_unref(scaled);
+    if (!source) {
+        vips_error_clear();
+        return;
+    }
+
+    double cpu_start = now_ms();
+    for (int i = 0; i < jobs; i++) {
+        VipsImage* resized = NULL;
+        if (vips_resize(source, &resized, 0.25, "kernel", VIPS_KERNEL_LANCZOS3, NULL) == 0) {
+            VipsImage* pixels_out = vips_image_copy_memory(resized);
+            if (pixels_out) g_object_unref(pixels_out);
+            g_object_unref(resized);
+        }
+    }
+    double cpu_ms = (now_ms() - cpu_start) / jobs;
+
+    double gpu_ms = -1;
+    double gpu_start = now_ms();
+    for (int i = 0; i < jobs; i++) {
+        VipsImage* resized = NULL;
+        if (thinpic_gpu_resize(source, &resized, 0.25) != 0) break;
+        g_object_unref(resized);
+        gpu_ms = (now_ms() - gpu_start) / (i + 1);
+    }
+    printf("%.0f,%d,%d,%.1f,%.1f\n", megapixels, vips_image_get_width(source), vips_image_get_height(source),
+           cpu_ms, gpu_ms);
+    fflush(stdout);
+    g_object_unref(source);
+}
+
+// Sequential large-image compressions; returns the elapsed milliseconds
+static double run_large_round(const char* path, int quality, int jobs, int* failures) {
+    *failures = 0;
+    double start = now_ms();
+    for (int i = 0; i < jobs; i++) {
+        CompressedImageResult result = compress_large_image_with_format(path, quality, FORMAT_JPEG);
+        if (result.success == 1) {
+            free_compressed_buffer(result.data);
+        } else {
+            (*failures)++;
+        }
+    }
+    return now_ms() - start;
+}
+
+// Sequential thinpic_compress calls; returns the elapsed milliseconds and
+// the size of the last output
+static double run_options_round(const char* path, const ThinpicOptions* options, int jobs,
+                                size_t* bytes, int* failures) {
+    ThinpicSource source = {.type = THINPIC_SOURCE_PATH, .path = path, .fd = -1};
+    *bytes = 0;
+    *failures = 0;
+    double start = now_ms();
+    for (int i = 0; i < jobs; i++) {
+        ThinpicResult result;
+        if (thinpic_compress(&source, options, &result) == 0) {
+            *bytes = result.length;
+            free_compressed_buffer(result.data);
+        } else {
+            (*failures)++;
+        }
+    }
+    return now_ms() - start;
+}
+
+static double run_round(const char* path, int quality, int jobs, int threads, int* failures) {
+    BenchContext ctx = {path, quality, jobs, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+    pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+
+    double start = now_ms();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, bench_worker, &ctx);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double elapsed = now_ms() - start;
+
+    free(workers);
+    *failures = ctx.failures;
+    return elapsed;
+}
+
+#define CORPUS_MAX 4096
+
+typedef enum {
+    API_COMPRESS_WITH_FORMAT,
+    API_SMART_COMPRESS,
+    API_SMART_COMPRESS_HIGH,
+    API_AUTO_COMPRESS,
+    API_FAST_WEBP,
+    API_IMAGE_INFO,
+    API_COUNT
+} BenchApi;
+
+static const char* api_names[API_COUNT] = {
+    "compress_image_with_format",
+    "smart_compress_image",
+    "smart_compress_image_high",
+    "auto_compress_image",
+    "fast_webp_compress",
+    "get_image_info",
+};
+
+// Peak resident set in KB: VmHWM where procfs has it, else getrusage
+static long peak_rss_kb(void) {
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+        }
+        fclose(status);
+        if (kb >= 0) return kb;
+    }
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+// Current resident set in KB (VmRSS); -1 without procfs
+static long current_rss_kb(void) {
+    FILE* status = fopen("/proc/self/status", "r");
+    if (!status) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), status)) {
+        if (sscanf(line, "VmRSS: %ld kB", &kb) == 1) break;
+    }
+    fclose(status);
+    return kb;
+}
+
+static int compare_ms(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of a sorted sample
+static double percentile(const double* sorted, int count, int pct) {
+    int rank = (pct * count + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int is_regular_file(const char* path) {
+    struct stat file_stat;
+    return stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Every regular file in a directory (sorted, hidden files skipped), or every
+// non-empty line of a list file; returns the number of paths
+static int load_corpus(const char* source, char** paths) {
+    int count = 0;
+    struct stat source_stat;
+    if (stat(source, &source_stat) != 0) return 0;
+    if (S_ISDIR(source_stat.st_mode)) {
+        DIR* dir = opendir(source);
+        if (!dir) return 0;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL && count < CORPUS_MAX) {
+            if (entry->d_name[0] == '.') continue;
+            size_t length = strlen(source) + strlen(entry->d_name) + 2;
+            char* path = (char*)malloc(length);
+            snprintf(path, length, "%s/%s", source, entry->d_name);
+            if (is_regular_file(path)) {
+                paths[count++] = path;
+            } else {
+                free(path);
+            }
+        }
+        closedir(dir);
+        qsort(paths, count, sizeof(char*), compare_paths);
+        return count;
+    }
+    FILE* list = fopen(source, "r");
+    if (!list) return 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), list) && count < CORPUS_MAX) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') paths[count++] = strdup(line);
+    }
+    fclose(list);
+    return count;
+}
+
+static uint64_t fnv1a(const uint8_t* data, size_t length) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// One call of `api`; returns the output size, or -1 on failure. With `hash`
+// set it also gets a hash of the output (of the dimensions for
+// get_image_info), to compare runs.
+static long run_api_hashed(BenchApi api, const char* path, int quality, int target_kb, uint64_t* hash) {
+    CompressedImageResult result = {NULL, 0, -1};
+    switch (api) {
+        case API_COMPRESS_WITH_FORMAT:
+            result = compress_image_with_format(path, quality, FORMAT_JPEG);
+            break;
+        case API_SMART_COMPRESS:
+            result = smart_compress_image(path, target_kb, 0);
+            break;
+        case API_SMART_COMPRESS_HIGH:
+            result = smart_compress_image(path, target_kb, 1);
+            break;
+        case API_AUTO_COMPRESS:
+            result = auto_compress_image(path, quality);
+            break;
+        case API_FAST_WEBP:
+            result = fast_webp_compress(path, quality);
+            break;
+        case API_IMAGE_INFO: {
+            ImageInfo info = get_image_info(path);
+            if (hash) {
+                int dimensions[2] = {info.width, info.height};
+                *hash = fnv1a((const uint8_t*)dimensions, sizeof(dimensions));
+            }
+            return info.width > 0 ? 0 : -1;
+        }
+        default:
+            return -1;
+    }
+    if (result.success != 1) return -1;
+    long bytes = (long)result.length;
+    if (hash) *hash = fnv1a(result.data, result.length);
+    free_compressed_buffer(result.data);
+    return bytes;
+}
+
+static long run_api(BenchApi api, const char* path, int quality, int target_kb) {
+    return run_api_hashed(api, path, quality, target_kb, NULL);
+}
+
+// Every path as one pool job, submitted together; fills sorted completion
+// times in ms since submission (polled every millisecond) and returns the
+// number of jobs submitted
+static int run_batch(char** paths, int count, int quality, double* completion, int* failures) {
+    CompressOptions options = {0};
+    options.mode = COMPRESS_MODE_STANDARD;
+    options.format = FORMAT_JPEG;
+    options.quality = quality;
+    int64_t* ids = (int64_t*)malloc(sizeof(int64_t) * count);
+    *failures = 0;
+
+    double start = now_ms();
+    int submitted = 0;
+    for (int i = 0; i < count; i++) {
+        int64_t id = thinpic_submit_job(paths[i], &options);
+        if (id < 0) {
+            (*failures)++;
+        } else {
+            ids[submitted++] = id;
+        }
+    }
+    int pending = submitted;
+    while (pending > 0) {
+        for (int i = 0; i < submitted; i++) {
+            if (ids[i] < 0) continue;
+            CompressedImageResult result;
+            JobStatus status = thinpic_poll_job(ids[i], &result);
+            if (status == JOB_STATUS_PENDING || status == JOB_STATUS_RUNNING) continue;
+            completion[submitted - pending] = now_ms() - start;
+            if (status == JOB_STATUS_DONE) {
+                free_compressed_buffer(result.data);
+            } else {
+                (*failures)++;
+            }
+            ids[i] = -1;
+            pending--;
+        }
+        if (pending > 0) usleep(1000);
+    }
+    qsort(completion, submitted, sizeof(double), compare_ms);
+    free(ids);
+    return submitted;
+}
+
+#define ENERGY_SAMPLE_US 10000
+#define ENERGY_IDLE_MS 2000
+#define ODPM_DEVICES 4
+
+typedef enum {
+    ENERGY_NONE,
+    ENERGY_RAILS,                // Cumulative on-device power rail counters
+    ENERGY_BATTERY               // Sampled battery current times voltage
+} EnergySource;
+
+typedef struct {
+    EnergySource source;
+    double idle_watts;           // Draw with nothing running, taken off every reading
+    pthread_t sampler;
+    pthread_mutex_t lock;
+    int sampling;
+    double joules;               // Battery energy integrated so far
+} EnergyMeter;
+
+static const char* energy_names[] = {"none", "rails", "battery"};
+
+// One sysfs value, or 0 when unreadable
+static long long read_sysfs_value(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+    long long value = 0;
+    if (fscanf(file, "%lld", &value) != 1) value = 0;
+    fclose(file);
+    return value;
+}
+
+// Sum of every rail's energy in joules; lines look like
+// "CH0(T=1234)[S4M_VDD_CPUCL0], 5678" with the energy in microwatt-seconds.
+// Returns -1 when no device has a counter.
+static double read_rails_joules(void) {
+    double total = 0;
+    int found = 0;
+    for (int d = 0; d < ODPM_DEVICES; d++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/bus/iio/devices/iio:device%d/energy_value", d);
+        FILE* file = fopen(path, "r");
+        if (!file) continue;
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            const char* comma = strrchr(line, ',');
+            if (!comma || !strchr(line, '[')) continue;
+            total += atoll(comma + 1) / 1e6;
+            found = 1;
+        }
+        fclose(file);
+    }
+    return found ? total : -1;
+}
+
+// Battery draw in watts; current_now is in microamps and signed either way
+// by vendor
+static double read_battery_watts(void) {
+    long long current = read_sysfs_value("/sys/class/power_supply/battery/current_now");
+    long long voltage = read_sysfs_value("/sys/class/power_supply/battery/voltage_now");
+    return fabs((double)current) / 1e6 * ((double)voltage / 1e6);
+}
+
+static void* energy_sampler(void* arg) {
+    EnergyMeter* meter = (EnergyMeter*)arg;
+    double last = now_ms();
+    for (;;) {
+        usleep(ENERGY_SAMPLE_US);
+        double watts = read_battery_watts();
+        double now = now_ms();
+        pthread_mutex_lock(&meter->lock);
+        int sampling = meter->sampling;
+        meter->joules += watts * (now - last) / 1000.0;
+        pthread_mutex_unlock(&meter->lock);
+        last = now;
+        if (!sampling) break;
+    }
+    return NULL;
+}
+
+// Joules spent since the meter started; rails are read directly, so
+// `start` is what read_rails_joules returned then
+static double energy_reading(EnergyMeter* meter, double start) {
+    if (meter->source == ENERGY_RAILS) return read_rails_joules() - start;
+    pthread_mutex_lock(&meter->lock);
+    double joules = meter->joules;
+    pthread_mutex_unlock(&meter->lock);
+    return joules;
+}
+
+// Picks the best counter the device has and measures the idle draw; the
+// battery sampler keeps running until energy_stop
+static void energy_start(EnergyMeter* meter) {
+    memset(meter, 0, sizeof(*meter));
+    pthread_mutex_init(&meter->lock, NULL);
+    if (read_rails_joules() >= 0) {
+        meter->source = ENERGY_RAILS;
+    } else if (read_sysfs_value("/sys/class/power_supply/battery/voltage_now") > 0) {
+        meter->source = ENERGY_BATTERY;
+        meter->sampling = 1;
+        if (pthread_create(&meter->sampler, NULL, energy_sampler, meter) != 0) {
+            meter->source = ENERGY_NONE;
+            meter->sampling = 0;
+        }
+    }
+    if (meter->source == ENERGY_NONE) {
+        fprintf(stderr, "no power rail or battery counters; energy columns are 0\n");
+        return;
+    }
+    if (meter->source == ENERGY_BATTERY) {
+        long long status = read_sysfs_value("/sys/class/power_supply/usb/online");
+        if (status > 0) fprintf(stderr, "USB power is online; battery energy will read low\n");
+    }
+    double start = meter->source == ENERGY_RAILS ? read_rails_joules() : 0;
+    double base = energy_reading(meter, start);
+    double started = now_ms();
+    usleep(ENERGY_IDLE_MS * 1000);
+    double elapsed = now_ms() - started;
+    meter->idle_watts = (energy_reading(meter, start) - base) * 1000.0 / elapsed;
+}
+
+static void energy_stop(EnergyMeter* meter) {
+    if (meter->source == ENERGY_BATTERY) {
+        pthread_mutex_lock(&meter->lock);
+        meter->sampling = 0;
+        pthread_mutex_unlock(&meter->lock);
+        pthread_join(meter->sampler, NULL);
+    }
+    pthread_mutex_destroy(&meter->lock);
+}
+
+static void print_json_string(const char* text) {
+    putchar('"');
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') putchar('\\');
+        putchar(*c);
+    }
+    putchar('"');
+}
+
+static int run_corpus(const char* source, int iterations, int quality, int target_kb, int energy, int json) {
+    char** paths = (char**)malloc(sizeof(char*) * CORPUS_MAX);
+    int count = load_corpus(source, paths);
+    if (count == 0) {
+        fprintf(stderr, "no images in %s\n", source);
+        free(paths);
+        return 1;
+    }
+    if (test_vips_basic() != 0) {
+        fprintf(stderr, "VIPS self-test failed\n");
+        free(paths);
+        return 1;
+    }
+
+    EnergyMeter meter = {ENERGY_NONE};
+    if (energy) {
+        energy_start(&meter);
+        fprintf(stderr, "energy from %s, idle draw %.3f W\n", energy_names[meter.source], meter.idle_watts);
+    }
+
+    double* samples = (double*)malloc(sizeof(double) * iterations);
+    if (!json) {
+        printf("image,api,iterations,p50_ms,p90_ms,p99_ms,images_per_sec,bytes,failures,peak_rss_kb%s\n",
+               energy ? ",joules_per_image" : "");
+    }
+    double energy_base = meter.source == ENERGY_RAILS ? read_rails_joules() : 0;
+    for (int i = 0; i < count; i++) {
+        for (int api = 0; api < API_COUNT; api++) {
+            long bytes = 0;
+            int failures = 0;
+            double total = 0;
+            double joules_before = energy ? energy_reading(&meter, energy_base) : 0;
+            double round_start = now_ms();
+            for (int n = 0; n < iterations; n++) {
+                double start = now_ms();
+                long size = run_api((BenchApi)api, paths[i], quality, target_kb);
+                samples[n] = now_ms() - start;
+                total += samples[n];
+                if (size < 0) failures++;
+                else bytes = size;
+            }
+            double joules = 0;
+            if (meter.source != ENERGY_NONE) {
+                joules = energy_reading(&meter, energy_base) - joules_before -
+                         meter.idle_watts * (now_ms() - round_start) / 1000.0;
+                if (joules < 0) joules = 0;
+                joules /= iterations;
+            }
+            qsort(samples, iterations, sizeof(double), compare_ms);
+            double p50 = percentile(samples, iterations, 50);
+            double p90 = percentile(samples, iterations, 90);
+            double p99 = percentile(samples, iterations, 99);
+            double per_sec = total > 0 ? iterations * 1000.0 / total : 0;
+            long rss = peak_rss_kb();
+            if (json) {
+                printf("{\"image\":");
+                print_json_string(paths[i]);
+                printf(",\"api\":\"%s\",\"iterations\":%d,\"p50_ms\":%.2f,\"p90_ms\":%.2f,\"p99_ms\":%.2f,"
+                       "\"images_per_sec\":%.2f,\"bytes\":%ld,\"failures\":%d,\"peak_rss_kb\":%ld",
+                       api_names[api], iterations, p50, p90, p99, per_sec, bytes, failures, rss);
+                if (energy) printf(",\"joules_per_image\":%.4f", joules);
+                printf("}\n");
+            } else {
+                printf("%s,%s,%d,%.2f,%.2f,%.2f,%.2f,%ld,%d,%ld", paths[i], api_names[api], iterations,
+                       p50, p90, p99, per_sec, bytes, failures, rss);
+                if (energy) printf(",%.4f", joules);
+                printf("\n");
+            }
+            fflush(stdout);
+        }
+    }
+
+    free(samples);
+    if (energy) energy_stop(&meter);
+
+    double* completion = (double*)malloc(sizeof(double) * count);
+    int failures = 0;
+    int ran = run_batch(paths, count, quality, completion, &failures);
+    if (ran > 0) {
+        double p50 = percentile(completion, ran, 50);
+        double p95 = percentile(completion, ran, 95);
+        double last = completion[ran - 1];
+        if (json) {
+            printf("{\"batch\":%d,\"workers\":%d,\"p50_ms\":%.2f,\"p95_ms\":%.2f,\"max_ms\":%.2f,"
+                   "\"failures\":%d}\n", ran, thinpic_pool_size(), p50, p95, last, failures);
+        } else {
+            printf("\nbatch,workers,p50_ms,p95_ms,max_ms,failures\n%d,%d,%.2f,%.2f,%.2f,%d\n", ran,
+                   thinpic_pool_size(), p50, p95, last, failures);
+        }
+    }
+    free(completion);
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    shutdown_vips();
+    return 0;
+}
+
+// One call of the stress work list: an image and an API, with the output
+// the single-threaded reference run produced
+typedef struct {
+    const char* path;
+    BenchApi api;
+    long bytes;                  // -1 when the reference call failed
+    uint64_t hash;
+} StressItem;
+
+typedef struct {
+    const StressItem* items;
+    int item_count;
+    int calls;                   // items x rounds
+    int quality;
+    int target_kb;
+    int next;
+    int mismatches;
+    int failures;
+    double* latency;             // One per call, in call order
+    pthread_mutex_t lock;
+} StressContext;
+
+static void* stress_worker(void* arg) {
+    StressContext* ctx = (StressContext*)arg;
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        int call = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (call >= ctx->calls) break;
+
+        const StressItem* item = &ctx->items[call % ctx->item_count];
+        uint64_t hash = 0;
+        double start = now_ms();
+        long bytes = run_api_hashed(item->api, item->path, ctx->quality, ctx->target_kb, &hash);
+        ctx->latency[call] = now_ms() - start;
+        if (bytes != item->bytes || (bytes >= 0 && hash != item->hash)) {
+            pthread_mutex_lock(&ctx->lock);
+            if (bytes < 0) {
+                ctx->failures++;
+            } else {
+                ctx->mismatches++;
+                fprintf(stderr, "mismatch: %s %s (%ld bytes, reference %ld)\n", item->path,
+                        api_names[item->api], bytes, item->bytes);
+            }
+            pthread_mutex_unlock(&ctx->lock);
+        }
+    }
+    return NULL;
+}
+
+// Every API on every corpus image from 1 caller thread up to twice the
+// cores, doubling, each output checked against a single-threaded reference
+// run. Levels run in ascending order, so a jump in the process-wide peak
+// memory columns belongs to the level it first appears on.
+static int run_stress(const char* source, int rounds, int quality, int target_kb, int json) {
+    char** paths = (char**)malloc(sizeof(char*) * CORPUS_MAX);
+    int count = load_corpus(source, paths);
+    if (count == 0) {
+        fprintf(stderr, "no images in %s\n", source);
+        free(paths);
+        return 1;
+    }
+    if (test_vips_basic() != 0) {
+        fprintf(stderr, "VIPS self-test failed\n");
+        free(paths);
+        return 1;
+    }
+    set_execution_mode(EXECUTION_MODE_CONCURRENT);
+
+    int item_count = count * API_COUNT;
+    StressItem* items = (StressItem*)malloc(sizeof(StressItem) * item_count);
+    for (int i = 0; i < count; i++) {
+        for (int api = 0; api < API_COUNT; api++) {
+            StressItem* item = &items[i * API_COUNT + api];
+            item->path = paths[i];
+            item->api = (BenchApi)api;
+            item->hash = 0;
+            item->bytes = run_api_hashed((BenchApi)api, paths[i], quality, target_kb, &item->hash);
+        }
+    }
+
+    int calls = item_count * rounds;
+    double* latency = (double*)malloc(sizeof(double) * calls);
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cores > 0 ? cores * 2 : 2;
+    if (!json) printf("threads,calls,elapsed_ms,calls_per_sec,p50_ms,p99_ms,peak_rss_kb,vips_peak_mb,"
+                      "mismatches,failures\n");
+    for (int threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        StressContext ctx = {items, item_count, calls, quality, target_kb, 0, 0, 0, latency,
+                             PTHREAD_MUTEX_INITIALIZER};
+        pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+        double start = now_ms();
+        for (int t = 0; t < threads; t++) pthread_create(&workers[t], NULL, stress_worker, &ctx);
+        for (int t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+        double elapsed = now_ms() - start;
+        free(workers);
+
+        qsort(latency, calls, sizeof(double), compare_ms);
+        double p50 = percentile(latency, calls, 50);
+        double p99 = percentile(latency, calls, 99);
+        double per_sec = elapsed > 0 ? calls * 1000.0 / elapsed : 0;
+        ThinpicRuntimeStats stats;
+        thinpic_get_runtime_stats(&stats);
+        double vips_peak_mb = stats.tracked_mem_highwater / (1024.0 * 1024.0);
+        if (json) {
+            printf("{\"threads\":%d,\"calls\":%d,\"elapsed_ms\":%.1f,\"calls_per_sec\":%.2f,\"p50_ms\":%.2f,"
+                   "\"p99_ms\":%.2f,\"peak_rss_kb\":%ld,\"vips_peak_mb\":%.1f,\"mismatches\":%d,"
+                   "\"failures\":%d}\n", threads, calls, elapsed, per_sec, p50, p99, peak_rss_kb(), vips_peak_mb,
+                   ctx.mismatches, ctx.failures);
+        } else {
+            printf("%d,%d,%.1f,%.2f,%.2f,%.2f,%ld,%.1f,%d,%d\n", threads, calls, elapsed, per_sec, p50, p99,
+                   peak_rss_kb(), vips_peak_mb, ctx.mismatches, ctx.failures);
+        }
+        fflush(stdout);
+        if (threads == max_threads) break;
+    }
+
+    free(latency);
+    free(items);
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    shutdown_vips();
+    return 0;
+}
+
+// Calls the leak check runs besides the corpus APIs: the pool, buffer input
+// and the unified entry point each own their results differently
+typedef enum {
+    LEAK_POOL_JOB = API_COUNT,
+    LEAK_COMPRESS_BUFFER,
+    LEAK_THINPIC_COMPRESS,
+    LEAK_CALL_COUNT
+} LeakCall;
+
+static const char* leak_call_names[LEAK_CALL_COUNT - API_COUNT] = {
+    "thinpic_submit_job",
+    "compress_buffer",
+    "thinpic_compress",
+};
+
+static const char* leak_call_name(int call) {
+    return call < API_COUNT ? api_names[call] : leak_call_names[call - API_COUNT];
+}
+
+// One call; returns 0, or -1 when it failed
+static int run_leak_call(int call, const char* path, int quality, int target_kb) {
+    CompressOptions options = {0};
+    options.mode = COMPRESS_MODE_STANDARD;
+    options.format = FORMAT_JPEG;
+    options.quality = quality;
+    switch (call) {
+        case LEAK_POOL_JOB: {
+            int64_t id = thinpic_submit_job(path, &options);
+            if (id < 0) return -1;
+            CompressedImageResult result;
+            if (thinpic_wait_job(id, &result) != JOB_STATUS_DONE) return -1;
+            free_compressed_buffer(result.data);
+            return 0;
+        }
+        case LEAK_COMPRESS_BUFFER: {
+            gchar* data = NULL;
+            gsize length = 0;
+            if (!g_file_get_contents(path, &data, &length, NULL)) return -1;
+            CompressedImageResult result = compress_buffer((const uint8_t*)data, length, &options);
+            g_free(data);
+            if (result.success != 1) return -1;
+            free_compressed_buffer(result.data);
+            return 0;
+        }
+        case LEAK_THINPIC_COMPRESS: {
+            ThinpicOptions unified;
+            thinpic_options_init(&unified);
+            unified.format = FORMAT_WEBP;
+            unified.quality = quality;
+            ThinpicSource source = {.type = THINPIC_SOURCE_PATH, .path = path, .fd = -1};
+            ThinpicResult result;
+            if (thinpic_compress(&source, &unified, &result) != 0) return -1;
+            free_compressed_buffer(result.data);
+            return 0;
+        }
+        default:
+            return run_api((BenchApi)call, path, quality, target_kb) < 0 ? -1 : 0;
+    }
+}
+
+static void* count_object(void* object, void* a, void* b) {
+    (void)object;
+    (void)b;
+    (*(int*)a)++;
+    return NULL;
+}
+
+typedef struct {
+    int64_t tracked_mem;
+    int tracked_allocs;
+    int open_files;
+    int objects;                 // Live VipsObjects (images, operations, regions)
+    long rss_kb;
+} LeakSnapshot;
+
+// What the process holds once every cache the library keeps is emptied,
+// so what is left was not freed by someone
+static void leak_snapshot(LeakSnapshot* out) {
+    thinpic_on_memory_pressure(THINPIC_MEMORY_PRESSURE_MODERATE);
+    vips_cache_drop_all();
+    ThinpicRuntimeStats stats;
+    thinpic_get_runtime_stats(&stats);
+    out->tracked_mem = stats.tracked_mem;
+    out->tracked_allocs = stats.tracked_allocs;
+    out->open_files = stats.open_files;
+    out->objects = 0;
+    vips_object_map(count_object, &out->objects, NULL);
+    out->rss_kb = current_rss_kb();
+}
+
+// Every corpus API, the pool, buffer input and thinpic_compress called
+// `iterations` times over the corpus. Each call first runs once on every
+// image so caches, thread pools and lazily built tables exist, then the
+// baseline is taken, then the loop runs, then everything the library
+// caches is dropped and the process must be back where it started: the
+// same libvips memory, allocations, open files and live objects, and RSS
+// within rss_slack_kb. Returns 2 when any call leaked, as thinpic_rd does
+// for regressions.
+static int run_leaks(const char* source, int iterations, int quality, int target_kb, long rss_slack_kb,
+                     int json) {
+    char** paths = (char**)malloc(sizeof(char*) * CORPUS_MAX);
+    int count = load_corpus(source, paths);
+    if (count == 0) {
+        fprintf(stderr, "no images in %s\n", source);
+        free(paths);
+        return 1;
+    }
+    if (test_vips_basic() != 0) {
+        fprintf(stderr, "VIPS self-test failed\n");
+        free(paths);
+        return 1;
+    }
+
+    int leaked = 0;
+    if (!json) printf("call,calls,failures,tracked_mem_delta,allocs_delta,files_delta,objects_delta,rss_delta_kb,ok\n");
+    for (int call = 0; call < LEAK_CALL_COUNT; call++) {
+        for (int i = 0; i < count; i++) {
+            run_leak_call(call, paths[i], quality, target_kb);
+        }
+        LeakSnapshot before;
+        leak_snapshot(&before);
+        int failures = 0;
+        for (int n = 0; n < iterations; n++) {
+            for (int i = 0; i < count; i++) {
+                if (run_leak_call(call, paths[i], quality, target_kb) != 0) failures++;
+            }
+        }
+        LeakSnapshot after;
+        leak_snapshot(&after);
+
+        int64_t mem_delta = after.tracked_mem - before.tracked_mem;
+        int allocs_delta = after.tracked_allocs - before.tracked_allocs;
+        int files_delta = after.open_files - before.open_files;
+        int objects_delta = after.objects - before.objects;
+        long rss_delta = before.rss_kb >= 0 && after.rss_kb >= 0 ? after.rss_kb - before.rss_kb : 0;
+        int ok = mem_delta <= 0 && allocs_delta <= 0 && files_delta <= 0 && objects_delta <= 0 &&
+                 rss_delta <= rss_slack_kb;
+        if (!ok) leaked = 1;
+        int calls = iterations * count;
+        if (json) {
+            printf("{\"call\":\"%s\",\"calls\":%d,\"failures\":%d,\"tracked_mem_delta\":%lld,"
+                   "\"allocs_delta\":%d,\"files_delta\":%d,\"objects_delta\":%d,\"rss_delta_kb\":%ld,"
+                   "\"ok\":%s}\n", leak_call_name(call), calls, failures, (long long)mem_delta, allocs_delta,
+                   files_delta, objects_delta, rss_delta, ok ? "true" : "false");
+        } else {
+            printf("%s,%d,%d,%lld,%d,%d,%d,%ld,%s\n", leak_call_name(call), calls, failures, (long long)mem_delta,
+                   allocs_delta, files_delta, objects_delta, rss_delta, ok ? "ok" : "LEAK");
+        }
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    shutdown_vips();
+    return leaked ? 2 : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image> [jobs] [max_threads] [quality]\n"
+                        "       %s --corpus <dir|list> [--iterations n] [--quality q] [--target-kb k] [--energy]\n"
+                        "                [--json]\n"
+                        "       %s --stress <dir|list> [--rounds n] [--quality q] [--target-kb k] [--json]\n"
+                        "       %s --leaks <dir|list> [--iterations n] [--rss-slack-mb m] [--quality q]\n"
+                        "                [--target-kb k] [--json]\n",
+                argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--leaks") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "--leaks needs a directory or list file\n");
+            return 1;
+        }
+        int iterations = 50;
+        int quality = 80;
+        int target_kb = 200;
+        long rss_slack_kb = 8 * 1024;
+        int json = 0;
+        for (int a = 3; a < argc; a++) {
+            if (strcmp(argv[a], "--json") == 0) {
+                json = 1;
+            } else if (a + 1 < argc && strcmp(argv[a], "--iterations") == 0) {
+                iterations = atoi(argv[++a]);
+            } else if (a + 1 < argc && strcmp(argv[a], "--rss-slack-mb") == 0) {
+                rss_slack_kb = atol(argv[++a]) * 1024;
+            } else if (a + 1 < argc && strcmp(argv[a], "--quality") == 0) {
+                quality = atoi(argv[++a]);
+            } else if (a + 1 < argc && strcmp(argv[a], "--target-kb") == 0) {
+                target_kb = atoi(argv[++a]);
+            } else {
+                fprintf(stderr, "unknown argument %s\n", argv[a]);
+                return 1;
+            }
+        }
+        if (iterations < 1) iterations = 1;
+        return run_leaks(argv[2], iterations, quality, target_kb, rss_slack_kb, json);
+    }
+
+    if (strcmp(argv[1], "--stress") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "--stress needs a directory or list file\n");
+            return 1;
+        }
+        int rounds = 2;
+        int quality = 80;
+        int target_kb = 200;
+        int json = 0;
+        for (int a = 3; a < argc; a++) {
+            if (strcmp(argv[a], "--json") == 0) {
+                json = 1;
+            } else if (a + 1 < argc && strcmp(argv[a], "--rounds") == 0) {
+                rounds = atoi(argv[++a]);
+            } else if (a + 1 < argc && strcmp(argv[a], "--quality") == 0) {
+                quality = atoi(argv[++a]);
+            } else if (a + 1 < argc && strcmp(argv[a], "--target-kb") == 0) {
+                target_kb = atoi(argv[++a]);
+            } else {
+                fprintf(stderr, "unknown argument %s\n", argv[a]);
+                return 1;
+            }
+        }
+        if (rounds < 1) rounds = 1;
+        return run_stress(argv[2], rounds, quality, target_kb, json);
+    }
+
+    if (strcmp(argv[1], "--corpus") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "--corpus needs a directory or list file\n");
+            return 1;
+        }
+        int iterations = 10;
+        int quality = 80;
+        int target_kb = 200;
+        int energy = 0;
+        int json = 0;
+        for (int a = 3; a < argc; a++) {
+            if (strcmp(argv[a], "--json") == 0) {
+                json = 1;
+            } else if (strcmp(argv[a], "--energy") == 0) {
+                energy = 1;
+            } else if (a + 1 < argc && strcmp(argv[a], "--iterations") == 0) {
+                iterations = atoi(argv[++a]);
+            } else if (a + 1 < argc && strcmp(argv[a], "--quality") == 0) {
+                quality = atoi(argv[++a]);
+            } else if (a + 1 < argc && strcmp(argv[a], "--target-kb") == 0) {
+                target_kb = atoi(argv[++a]);
+            } else {
+                fprintf(stderr, "unknown argument %s\n", argv[a]);
+                return 1;
+            }
+        }
+        if (iterations < 1) iterations = 1;
+        return run_corpus(argv[2], iterations, quality, target_kb, energy, json);
+    }
+
+    const char* path = argv[1];
+    int jobs = argc > 2 ? atoi(argv[2]) : 16;
+    int max_threads = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int quality = argc > 4 ? atoi(argv[4]) : 80;
+    if (jobs < 1) jobs = 1;
+    if (max_threads < 1) max_threads = 1;
+
+    // Warm up VIPS so initialization is not part of the first round
+    if (test_vips_basic() != 0) {
+        fprintf(stderr, "VIPS self-test failed\n");
+        return 1;
+    }
+
+    printf("mode,threads,jobs,elapsed_ms,images_per_sec,failures\n");
+    ExecutionMode modes[] = {EXECUTION_MODE_SERIAL, EXECUTION_MODE_CONCURRENT};
+    for (int m = 0; m < 2; m++) {
+        set_execution_mode(modes[m]);
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            int failures = 0;
+            double elapsed = run_round(path, quality, jobs, threads, &failures);
+            printf("%s,%d,%d,%.1f,%.2f,%d\n",
+                   modes[m] == EXECUTION_MODE_SERIAL ? "serial" : "concurrent",
+                   threads, jobs, elapsed, jobs * 1000.0 / elapsed, failures);
+            fflush(stdout);
+        }
+    }
+
+    set_execution_mode(EXECUTION_MODE_CONCURRENT);
+
+    // Buffered reads vs mmap for the large-image path (1 MB threshold maps
+    // any realistic original); -1 leaves the other limits alone
+    printf("\ninput,jobs,elapsed_ms,images_per_sec,failures\n");
+    const char* inputs[] = {"buffered", "mmap"};
+    int thresholds[] = {0, 1};
+    for (int m = 0; m < 2; m++) {
+        ThinpicRuntimeConfig config = unchanged_config();
+        config.mmap_input_min_mb = thresholds[m];
+        thinpic_configure(&config);
+        int failures = 0;
+        double elapsed = run_large_round(path, quality, jobs, &failures);
+        printf("%s,%d,%.1f,%.2f,%d\n", inputs[m], jobs, elapsed, jobs * 1000.0 / elapsed, failures);
+        fflush(stdout);
+    }
+
+    // Operation cache against one-shot mode on the threaded legacy path
+    printf("\noperation_cache,threads,jobs,elapsed_ms,images_per_sec,cached_operations,rss_kb,failures\n");
+    const char* caches[] = {"kept", "one_shot"};
+    for (int c = 0; c < 2; c++) {
+        ThinpicRuntimeConfig config = unchanged_config();
+        config.one_shot_cache = c;
+        thinpic_configure(&config);
+        int failures = 0;
+        double elapsed = run_round(path, quality, jobs, max_threads, &failures);
+        ThinpicRuntimeStats stats;
+        thinpic_get_runtime_stats(&stats);
+        printf("%s,%d,%d,%.1f,%.2f,%d,%ld,%d\n", caches[c], max_threads, jobs, elapsed, jobs * 1000.0 / elapsed,
+               stats.cache_operations, current_rss_kb(), failures);
+        fflush(stdout);
+    }
+    ThinpicRuntimeConfig kept = unchanged_config();
+    kept.one_shot_cache = 0;
+    thinpic_configure(&kept);
+
+    // WebP profiles on the unified entry point
+    printf("\nwebp_profile,jobs,ms_per_image,bytes,failures\n");
+    const char* profiles[] = {"default", "fast", "balanced", "archive"};
+    for (int p = THINPIC_WEBP_PROFILE_DEFAULT; p <= THINPIC_WEBP_PROFILE_ARCHIVE; p++) {
+        ThinpicOptions options;
+        thinpic_options_init(&options);
+        options.format = FORMAT_WEBP;
+        options.quality = quality;
+        options.webp_profile = (ThinpicWebpProfile)p;
+        size_t bytes = 0;
+        int failures = 0;
+        double elapsed = run_options_round(path, &options, jobs, &bytes, &failures);
+        printf("%s,%d,%.1f,%zu,%d\n", profiles[p], jobs, elapsed / jobs, bytes, failures);
+        fflush(stdout);
+    }
+
+    // Progressive output: encode-time cost against baseline
+    printf("\noutput,jobs,ms_per_image,bytes,failures\n");
+    typedef struct {
+        const char* name;
+        ImageFormat format;
+        int progressive;
+        ThinpicScanScript scan_script;
+        int standard;            // No mozjpeg extensions, as libjpeg-turbo writes it
+    } OutputCase;
+    OutputCase outputs[] = {
+        {"jpeg_baseline", FORMAT_JPEG, 0, THINPIC_SCAN_SCRIPT_DEFAULT, 0},
+        {"jpeg_baseline_standard", FORMAT_JPEG, 0, THINPIC_SCAN_SCRIPT_DEFAULT, 1},
+        {"jpeg_progressive", FORMAT_JPEG, 1, THINPIC_SCAN_SCRIPT_DEFAULT, 0},
+        {"jpeg_progressive_preview", FORMAT_JPEG, 1, THINPIC_SCAN_SCRIPT_PREVIEW, 0},
+        {"png", FORMAT_PNG, 0, THINPIC_SCAN_SCRIPT_DEFAULT, 0},
+        {"png_interlaced", FORMAT_PNG, 1, THINPIC_SCAN_SCRIPT_DEFAULT, 0},
+    };
+    for (size_t o = 0; o < sizeof(outputs) / sizeof(outputs[0]); o++) {
+        ThinpicOptions options;
+        thinpic_options_init(&options);
+        options.format = outputs[o].format;
+        options.quality = quality;
+        options.progressive = outputs[o].progressive;
+        options.scan_script = outputs[o].scan_script;
+        if (outputs[o].standard) {
+            options.jpeg_trellis = 0;
+            options.jpeg_overshoot_deringing = 0;
+            options.jpeg_optimize_scans = 0;
+            options.jpeg_quant_table = THINPIC_QUANT_TABLE_ANNEX_K;
+        }
+        size_t bytes = 0;
+        int failures = 0;
+        double elapsed = run_options_round(path, &options, jobs, &bytes, &failures);
+        printf("%s,%d,%.1f,%zu,%d\n", outputs[o].name, jobs, elapsed / jobs, bytes, failures);
+        fflush(stdout);
+    }
+
+    // PNG compressor: zlib (pngsave) against libdeflate and its parallel
+    // strategy search (which ignores effort, so it runs once)
+    printf("\npng_deflate,effort,jobs,ms_per_image,bytes,failures\n");
+    const char* compressors[] = {"zlib", "libdeflate", "optimize"};
+    int efforts[] = {1, 6, 9};
+    for (int c = THINPIC_PNG_DEFLATE_ZLIB; c <= THINPIC_PNG_DEFLATE_OPTIMIZE; c++) {
+        size_t effort_count = c == THINPIC_PNG_DEFLATE_OPTIMIZE ? 1 : sizeof(efforts) / sizeof(efforts[0]);
+        for (size_t e = 0; e < effort_count; e++) {
+            ThinpicOptions options;
+            thinpic_options_init(&options);
+            options.format = FORMAT_PNG;
+            options.effort = efforts[e];
+            options.png_deflate = (ThinpicPngDeflate)c;
+            size_t bytes = 0;
+            int failures = 0;
+            double elapsed = run_options_round(path, &options, jobs, &bytes, &failures);
+            printf("%s,%d,%d,%.1f,%zu,%d\n", compressors[c], efforts[e], jobs, elapsed / jobs, bytes, failures);
+            fflush(stdout);
+        }
+    }
+
+    // HEIC and AVIF: codec, effort and chroma against time and size
+    printf("\nheif_compression,subsample,effort,jobs,ms_per_image,bytes,failures\n");
+    const char* codecs[] = {"hevc", "av1"};
+    const char* subsamples[] = {"auto", "420", "444"};
+    int heif_efforts[] = {0, 4, 9};
+    for (int c = THINPIC_HEIF_HEVC; c <= THINPIC_HEIF_AV1; c++) {
+        for (int sub = THINPIC_SUBSAMPLE_420; sub <= THINPIC_SUBSAMPLE_444; sub++) {
+            for (size_t e = 0; e < sizeof(heif_efforts) / sizeof(heif_efforts[0]); e++) {
+                ThinpicOptions options;
+                thinpic_options_init(&options);
+                options.format = FORMAT_HEIF;
+                options.quality = quality;
+                options.effort = heif_efforts[e];
+                options.heif_compression = (ThinpicHeifCompression)c;
+                options.heif_subsample = (ThinpicSubsample)sub;
+                size_t bytes = 0;
+                int failures = 0;
+                double elapsed = run_options_round(path, &options, jobs, &bytes, &failures);
+                printf("%s,%s,%d,%d,%.1f,%zu,%d\n", codecs[c], subsamples[sub], heif_efforts[e], jobs,
+                       elapsed / jobs, bytes, failures);
+                fflush(stdout);
+            }
+        }
+    }
+
+    VipsImage* original = vips_image_new_from_file(path, NULL);
+
+    // Box shrink against kernel reduce at each resize_quality, on the
+    // decoded image so only the resize is timed
+    VipsImage* decoded = original ? vips_image_copy_memory(original) : NULL;
+    if (decoded) {
+        printf("\nresize_scale,resize_quality,jobs,ms_per_image,failures\n");
+        const char* qualities[] = {"fast", "balanced", "best"};
+        double scales[] = {0.5, 0.25, 0.1};
+        for (size_t sc = 0; sc < sizeof(scales) / sizeof(scales[0]); sc++) {
+            for (int q = THINPIC_RESIZE_FAST; q <= THINPIC_RESIZE_BEST; q++) {
+                ThinpicRuntimeConfig config = unchanged_config();
+                config.resize_quality = q;
+                thinpic_configure(&config);
+                int failures = 0;
+                double start = now_ms();
+                for (int i = 0; i < jobs; i++) {
+                    VipsImage* resized = NULL;
+                    VipsImage* pixels_out = NULL;
+                    if (thinpic_resize(decoded, &resized, scales[sc], VIPS_KERNEL_LANCZOS3) == 0) {
+                        pixels_out = vips_image_copy_memory(resized);
+                        g_object_unref(resized);
+                    }
+                    if (pixels_out) {
+                        g_object_unref(pixels_out);
+                    } else {
+                        failures++;
+                        vips_error_clear();
+                    }
+                }
+                printf("%.2f,%s,%d,%.1f,%d\n", scales[sc], qualities[q], jobs, (now_ms() - start) / jobs, failures);
+                fflush(stdout);
+            }
+        }
+        ThinpicRuntimeConfig config = unchanged_config();
+        config.resize_quality = THINPIC_RESIZE_BALANCED;
+        thinpic_configure(&config);
+        g_object_unref(decoded);
+    } else {
+        vips_error_clear();
+    }
+
+    // GPU resize crossover; the first GPU call also builds the context
+    if (original) {
+        VipsImage* warm = NULL;
+        if (thinpic_gpu_resize(original, &warm, 0.5) == 0) g_object_unref(warm);
+        printf("\nresize_source_mp,width,height,cpu_ms,gpu_ms\n");
+        double sizes[] = {1, 2, 4, 8, 12, 24, 48};
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            run_resize_case(original, sizes[s], jobs);
+        }
+        g_object_unref(original);
+    } else {
+        vips_error_clear();
+    }
+
+    shutdown_vips();
+    return 0;
+}
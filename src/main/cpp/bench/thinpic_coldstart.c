@@ -0,0 +1,258 @@
+// thinpic_coldstart.c
+// Cold-start and first-call latency benchmark for the native engine.
+//
+// Usage (on device via adb):
+//   thinpic_coldstart <libthinpic_flutter.so> <image> [--runs n] [--steady n]
+//                     [--prewarm ms] [--json]
+//
+// Every run is a fresh process (this binary again, with --child), so each
+// one pays the whole startup. It dlopens the library, which brings in its
+// dependency chain, and times that along with the number of shared objects
+// it added. It then times VIPS_INIT through thinpic_configure with every
+// limit left alone, the first compress_image_with_format of <image> and the
+// median of `steady` more. With --prewarm the child calls thinpic_prewarm(1)
+// instead, waits `ms` as an app would while its first frame draws, and
+// times from there. One row per phase gives the median, p90 and max over
+// `runs`; CSV by default, JSON lines with --json. The first run reads the
+// library from storage, the rest from the page cache; drop caches as root
+// (echo 3 > /proc/sys/vm/drop_caches) to make every run cold. Pointing it
+// at each build of the library (LTO, PGO, trimmed codecs) compares their
+// startup on the same device.
+// dl_iterate_phdr on glibc; bionic always has it
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../image_compressor.h"
+
+#define COLD_MAX_RUNS 256
+#define COLD_MAX_STEADY 64
+
+typedef enum {
+    PHASE_LOAD,
+    PHASE_INIT,
+    PHASE_FIRST,
+    PHASE_STEADY,
+    PHASE_COUNT
+} ColdPhase;
+
+static const char* phase_names[PHASE_COUNT] = {"dlopen", "vips_init", "first_compress", "steady_compress"};
+
+typedef int (*ConfigureFn)(const ThinpicRuntimeConfig*);
+typedef int (*PrewarmFn)(int);
+typedef CompressedImageResult (*CompressFn)(const char*, int, ImageFormat);
+typedef void (*FreeFn)(uint8_t*);
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int compare_ms(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of a sorted sample
+static double percentile(const double* sorted, int count, int pct) {
+    int rank = (pct * count + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int count_object(struct dl_phdr_info* info, size_t size, void* data) {
+    (void)info;
+    (void)size;
+    (*(int*)data)++;
+    return 0;
+}
+
+static int loaded_objects(void) {
+    int count = 0;
+    dl_iterate_phdr(count_object, &count);
+    return count;
+}
+
+// One cold start; prints "load init first steady objects" in milliseconds
+// on stdout, or returns 1
+static int run_child(const char* library, const char* image, int steady, int prewarm_ms) {
+    int objects_before = loaded_objects();
+    double start = now_ms();
+    void* handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    double load_ms = now_ms() - start;
+    if (!handle) {
+        fprintf(stderr, "dlopen failed: %s\n", dlerror());
+        return 1;
+    }
+    int objects = loaded_objects() - objects_before;
+
+    ConfigureFn configure = (ConfigureFn)dlsym(handle, "thinpic_configure");
+    PrewarmFn prewarm = (PrewarmFn)dlsym(handle, "thinpic_prewarm");
+    CompressFn compress = (CompressFn)dlsym(handle, "compress_image_with_format");
+    FreeFn free_buffer = (FreeFn)dlsym(handle, "free_compressed_buffer");
+    if (!configure || !prewarm || !compress || !free_buffer) {
+        fprintf(stderr, "missing symbols in %s\n", library);
+        return 1;
+    }
+
+    double init_ms = 0;
+    if (prewarm_ms > 0) {
+        // The app's own startup runs meanwhile; what is left over shows up
+        // in the first compression below
+        if (prewarm(1) != 0) return 1;
+        usleep((useconds_t)prewarm_ms * 1000);
+    } else {
+        // Every field -1: change nothing, only bring VIPS up
+        ThinpicRuntimeConfig config;
+        memset(&config, 0xff, sizeof(config));
+        start = now_ms();
+        if (configure(&config) != 0) return 1;
+        init_ms = now_ms() - start;
+    }
+
+    start = now_ms();
+    CompressedImageResult result = compress(image, 80, FORMAT_JPEG);
+    double first_ms = now_ms() - start;
+    if (result.success != 1) {
+        fprintf(stderr, "compression of %s failed\n", image);
+        return 1;
+    }
+    free_buffer(result.data);
+
+    double samples[COLD_MAX_STEADY];
+    for (int n = 0; n < steady; n++) {
+        start = now_ms();
+        result = compress(image, 80, FORMAT_JPEG);
+        samples[n] = now_ms() - start;
+        if (result.success == 1) free_buffer(result.data);
+    }
+    qsort(samples, steady, sizeof(double), compare_ms);
+    printf("%.3f %.3f %.3f %.3f %d\n", load_ms, init_ms, first_ms, percentile(samples, steady, 50), objects);
+    fflush(stdout);
+    // No dlclose or shutdown: the process ends here, like an app killed in
+    // the background
+    return 0;
+}
+
+// Runs one child and parses its line; returns 0 on success
+static int spawn_child(const char* self, char** child_argv, double* phases, int* objects) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(self, child_argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE* output = fdopen(fds[0], "r");
+    int parsed = output && fscanf(output, "%lf %lf %lf %lf %d", &phases[PHASE_LOAD], &phases[PHASE_INIT],
+                                  &phases[PHASE_FIRST], &phases[PHASE_STEADY], objects) == 5;
+    if (output) fclose(output);
+    else close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return parsed && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <libthinpic_flutter.so> <image> [--runs n] [--steady n] [--prewarm ms] [--json]\n",
+                argv[0]);
+        return 1;
+    }
+    const char* library = argv[1];
+    const char* image = argv[2];
+    int runs = 10;
+    int steady = 5;
+    int prewarm_ms = 0;
+    int json = 0;
+    int child = 0;
+    for (int a = 3; a < argc; a++) {
+        if (strcmp(argv[a], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[a], "--child") == 0) {
+            child = 1;
+        } else if (a + 1 < argc && strcmp(argv[a], "--runs") == 0) {
+            runs = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--steady") == 0) {
+            steady = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--prewarm") == 0) {
+            prewarm_ms = atoi(argv[++a]);
+        } else {
+            fprintf(stderr, "unknown argument %s\n", argv[a]);
+            return 1;
+        }
+    }
+    if (runs < 1) runs = 1;
+    if (runs > COLD_MAX_RUNS) runs = COLD_MAX_RUNS;
+    if (steady < 1) steady = 1;
+    if (steady > COLD_MAX_STEADY) steady = COLD_MAX_STEADY;
+    if (child) return run_child(library, image, steady, prewarm_ms);
+
+    // The child gets the same arguments plus --child
+    char** child_argv = (char**)malloc(sizeof(char*) * (argc + 2));
+    memcpy(child_argv, argv, sizeof(char*) * argc);
+    child_argv[argc] = "--child";
+    child_argv[argc + 1] = NULL;
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length <= 0) {
+        fprintf(stderr, "cannot find this executable\n");
+        free(child_argv);
+        return 1;
+    }
+    self[length] = '\0';
+
+    double* samples[PHASE_COUNT];
+    for (int p = 0; p < PHASE_COUNT; p++) samples[p] = (double*)malloc(sizeof(double) * runs);
+    int completed = 0;
+    int failures = 0;
+    int objects = 0;
+    for (int r = 0; r < runs; r++) {
+        double phases[PHASE_COUNT];
+        if (spawn_child(self, child_argv, phases, &objects) != 0) {
+            failures++;
+            continue;
+        }
+        for (int p = 0; p < PHASE_COUNT; p++) samples[p][completed] = phases[p];
+        completed++;
+    }
+
+    if (!json) printf("phase,prewarm_ms,runs,p50_ms,p90_ms,max_ms,objects_loaded,failures\n");
+    for (int p = 0; p < PHASE_COUNT && completed > 0; p++) {
+        // The prewarm thread brought VIPS up; nothing timed it
+        if (p == PHASE_INIT && prewarm_ms > 0) continue;
+        qsort(samples[p], completed, sizeof(double), compare_ms);
+        double p50 = percentile(samples[p], completed, 50);
+        double p90 = percentile(samples[p], completed, 90);
+        double last = samples[p][completed - 1];
+        if (json) {
+            printf("{\"phase\":\"%s\",\"prewarm_ms\":%d,\"runs\":%d,\"p50_ms\":%.3f,\"p90_ms\":%.3f,"
+                   "\"max_ms\":%.3f,\"objects_loaded\":%d,\"failures\":%d}\n",
+                   phase_names[p], prewarm_ms, completed, p50, p90, last, objects, failures);
+        } else {
+            printf("%s,%d,%d,%.3f,%.3f,%.3f,%d,%d\n", phase_names[p], prewarm_ms, completed, p50, p90, last,
+                   objects, failures);
+        }
+    }
+    if (completed == 0) fprintf(stderr, "every run failed\n");
+
+    for (int p = 0; p < PHASE_COUNT; p++) free(samples[p]);
+    free(child_argv);
+    return completed > 0 ? 0 : 1;
+}
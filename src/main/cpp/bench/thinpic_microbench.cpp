@@ -0,0 +1,408 @@
+// thinpic_microbench.cpp
+// Google Benchmark microbenchmarks for single pipeline stages.
+//
+// Usage (on device via adb):
+//   thinpic_microbench [--image path]... [--benchmark_filter=regex]
+//                      [--benchmark_format=json] [other Google Benchmark flags]
+//
+// thinpic_bench times whole API calls; this times one stage at a time, so a
+// change to one of them can be checked without the rest of a job's noise.
+// Every stage runs on a synthetic 12 MP photo-like image (noise over a
+// gradient, JPEG at Q90) and on each --image given:
+//   header/*         probe_image_header of the encoded file
+//   shrink_on_load/* JPEG decode at 1/1, 1/2, 1/4 and 1/8 into memory
+//   resize/*         thinpic_resize to 0.5x and 0.25x with linear, cubic
+//                    and Lanczos3, box shrink as configured
+//   colour/*         thinpic_to_srgb of the decoded image (embedded profile
+//                    or relabel) and a LAB to sRGB conversion
+//   save/*           jpegsave, webpsave, pngsave and heifsave to memory at
+//                    common settings (skipped where the codec is missing)
+//   raw/*            compress_raw_to_jpeg and compress_raw_to_png
+//                    (png_compressor.c) on the decoded pixels
+//   small/*          libdeflate PNG (thinpic_png_deflate) of a 128x128
+//                    centre crop, cold (the thread's compressor and scratch
+//                    freed after every image, as each encode once
+//                    allocated them) and warm (kept across images)
+// Decoding and converting stages are pulled into memory inside the timed
+// loop, since libvips is lazy. Items are pixels, so Google Benchmark
+// reports pixels per second next to each time.
+
+#include <benchmark/benchmark.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../image_compressor.h"
+#include "../thinpic_internal.h"
+
+namespace {
+
+// One source every stage runs on
+struct Source {
+    std::string name;            // "synthetic" or the file's base name
+    std::string path;            // Encoded file on disk, for header reads
+    std::vector<uint8_t> jpeg;   // The same file in memory when it is a JPEG
+    VipsImage* decoded = nullptr;  // 8-bit sRGB, in memory
+    std::vector<uint8_t> rgb;    // decoded as packed RGB, for the raw encoders
+};
+
+std::vector<Source> sources;
+std::string synthetic_path;
+
+// Pulls a lazy image through its pipeline; false when it failed
+bool render(VipsImage* image) {
+    VipsImage* memory = vips_image_copy_memory(image);
+    g_object_unref(image);
+    if (!memory) {
+        vips_error_clear();
+        return false;
+    }
+    g_object_unref(memory);
+    return true;
+}
+
+int64_t pixels_of(const Source& source) {
+    return (int64_t)vips_image_get_width(source.decoded) * vips_image_get_height(source.decoded);
+}
+
+// Fills decoded and rgb from the file at source.path; false if unreadable
+bool load_source(Source& source) {
+    VipsImage* loaded = vips_image_new_from_file(source.path.c_str(), "access", VIPS_ACCESS_SEQUENTIAL, NULL);
+    if (!loaded) return false;
+    VipsImage* srgb = nullptr;
+    int failed = vips_colourspace(loaded, &srgb, VIPS_INTERPRETATION_sRGB, NULL);
+    g_object_unref(loaded);
+    if (failed) return false;
+    VipsImage* flat = srgb;
+    if (vips_image_hasalpha(srgb)) {
+        failed = vips_flatten(srgb, &flat, NULL);
+        g_object_unref(srgb);
+        if (failed) return false;
+    }
+    VipsImage* narrowed = nullptr;
+    failed = vips_cast_uchar(flat, &narrowed, NULL);
+    g_object_unref(flat);
+    if (failed) return false;
+    source.decoded = vips_image_copy_memory(narrowed);
+    g_object_unref(narrowed);
+    if (!source.decoded) return false;
+
+    const void* pixels = vips_image_get_data(source.decoded);
+    size_t length = VIPS_IMAGE_SIZEOF_IMAGE(source.decoded);
+    source.rgb.assign((const uint8_t*)pixels, (const uint8_t*)pixels + length);
+
+    gchar* contents = nullptr;
+    gsize size = 0;
+    if (g_file_get_contents(source.path.c_str(), &contents, &size, nullptr)) {
+        if (size > 2 && (uint8_t)contents[0] == 0xFF && (uint8_t)contents[1] == 0xD8) {
+            source.jpeg.assign((uint8_t*)contents, (uint8_t*)contents + size);
+        }
+        g_free(contents);
+    }
+    return true;
+}
+
+// A 4000 x 3000 photo stand-in: smooth gradients under sensor-like noise,
+// written as a JPEG so the loaders have real work
+bool make_synthetic(Source& source) {
+    VipsImage* xy = nullptr;
+    VipsImage* noise = nullptr;
+    VipsImage* joined = nullptr;
+    VipsImage* sum = nullptr;
+    VipsImage* image = nullptr;
+    int failed = vips_xyz(&xy, 4000, 3000, NULL) ||
+                 vips_gaussnoise(&noise, 4000, 3000, "sigma", 12.0, "mean", 0.0, NULL) ||
+                 vips_bandjoin2(xy, noise, &joined, NULL);
+    if (!failed) {
+        // x and y scaled into 0-255, the noise around mid-grey
+        double scale[3] = {255.0 / 4000, 255.0 / 3000, 1.0};
+        double offset[3] = {0, 0, 128};
+        failed = vips_linear(joined, &sum, scale, offset, 3, NULL) || vips_cast_uchar(sum, &image, NULL);
+    }
+    if (!failed) {
+        VipsImage* labelled = nullptr;
+        failed = vips_copy(image, &labelled, "interpretation", VIPS_INTERPRETATION_sRGB, NULL);
+        g_object_unref(image);
+        image = labelled;
+    }
+    if (xy) g_object_unref(xy);
+    if (noise) g_object_unref(noise);
+    if (joined) g_object_unref(joined);
+    if (sum) g_object_unref(sum);
+    if (failed) {
+        if (image) g_object_unref(image);
+        vips_error_clear();
+        return false;
+    }
+
+    gchar* path = nullptr;
+    int fd = g_file_open_tmp("thinpic-microbench-XXXXXX.jpg", &path, nullptr);
+    if (fd < 0) {
+        g_object_unref(image);
+        return false;
+    }
+    close(fd);
+    failed = vips_jpegsave(image, path, "Q", 90, NULL);
+    g_object_unref(image);
+    source.name = "synthetic";
+    source.path = path;
+    synthetic_path = path;
+    g_free(path);
+    return !failed && load_source(source);
+}
+
+void header_read(benchmark::State& state, const Source* source) {
+    for (auto _ : state) {
+        ImageHeader header = probe_image_header(source->path.c_str());
+        benchmark::DoNotOptimize(header);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void shrink_on_load(benchmark::State& state, const Source* source, int shrink) {
+    for (auto _ : state) {
+        VipsImage* image = nullptr;
+        if (vips_jpegload_buffer((void*)source->jpeg.data(), source->jpeg.size(), &image, "shrink", shrink,
+                                 NULL) || !render(image)) {
+            state.SkipWithError("jpeg decode failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source) / (shrink * shrink));
+    state.SetBytesProcessed(state.iterations() * (int64_t)source->jpeg.size());
+}
+
+void resize(benchmark::State& state, const Source* source, double scale, VipsKernel kernel) {
+    for (auto _ : state) {
+        VipsImage* resized = nullptr;
+        if (thinpic_resize(source->decoded, &resized, scale, kernel) || !render(resized)) {
+            state.SkipWithError("resize failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source));
+}
+
+void to_srgb(benchmark::State& state, const Source* source) {
+    for (auto _ : state) {
+        VipsImage* converted = nullptr;
+        if (thinpic_to_srgb(source->decoded, &converted) || !render(converted)) {
+            state.SkipWithError("conversion failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source));
+}
+
+void lab_to_srgb(benchmark::State& state, const Source* source) {
+    VipsImage* lab = nullptr;
+    VipsImage* lab_memory = nullptr;
+    if (vips_colourspace(source->decoded, &lab, VIPS_INTERPRETATION_LAB, NULL) == 0) {
+        lab_memory = vips_image_copy_memory(lab);
+        g_object_unref(lab);
+    }
+    if (!lab_memory) {
+        vips_error_clear();
+        state.SkipWithError("no LAB source");
+        return;
+    }
+    for (auto _ : state) {
+        VipsImage* converted = nullptr;
+        if (vips_colourspace(lab_memory, &converted, VIPS_INTERPRETATION_sRGB, NULL) || !render(converted)) {
+            state.SkipWithError("conversion failed");
+            break;
+        }
+    }
+    g_object_unref(lab_memory);
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source));
+}
+
+// Saver at its common settings, by the suffix and options
+// vips_image_write_to_buffer takes
+void save(benchmark::State& state, const Source* source, const char* suffix) {
+    size_t bytes = 0;
+    for (auto _ : state) {
+        void* buffer = nullptr;
+        size_t length = 0;
+        if (vips_image_write_to_buffer(source->decoded, suffix, &buffer, &length, NULL)) {
+            vips_error_clear();
+            state.SkipWithError("saver unavailable or failed");
+            break;
+        }
+        bytes = length;
+        g_free(buffer);
+    }
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source));
+    state.counters["output_bytes"] = (double)bytes;
+}
+
+void raw_jpeg(benchmark::State& state, const Source* source) {
+    int width = vips_image_get_width(source->decoded);
+    int height = vips_image_get_height(source->decoded);
+    for (auto _ : state) {
+        CompressedImageResult result =
+            compress_raw_to_jpeg(source->rgb.data(), width, height, width * 3, THINPIC_PIXEL_RGB, 80);
+        if (result.success != 1) {
+            state.SkipWithError("raw JPEG encode failed");
+            break;
+        }
+        free_compressed_buffer(result.data);
+    }
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source));
+}
+
+void raw_png(benchmark::State& state, const Source* source) {
+    int width = vips_image_get_width(source->decoded);
+    int height = vips_image_get_height(source->decoded);
+    for (auto _ : state) {
+        CompressedImageResult result =
+            compress_raw_to_png(source->rgb.data(), width, height, width * 3, 3, 0, 6);
+        if (result.success != 1) {
+            state.SkipWithError("raw PNG encode failed");
+            break;
+        }
+        free_compressed_buffer(result.data);
+    }
+    state.SetItemsProcessed(state.iterations() * pixels_of(*source));
+}
+
+// The per-image setup a batch of thumbnails pays: cold frees the thread's
+// encoder state after every encode, warm keeps it as workers do
+void small_png_deflate(benchmark::State& state, const Source* source, int level, bool cold) {
+    int width = vips_image_get_width(source->decoded);
+    int height = vips_image_get_height(source->decoded);
+    int side = width < 128 || height < 128 ? (width < height ? width : height) : 128;
+    VipsImage* crop = nullptr;
+    VipsImage* thumbnail = nullptr;
+    if (vips_crop(source->decoded, &crop, (width - side) / 2, (height - side) / 2, side, side, NULL) == 0) {
+        thumbnail = vips_image_copy_memory(crop);
+        g_object_unref(crop);
+    }
+    if (!thumbnail) {
+        vips_error_clear();
+        state.SkipWithError("no crop");
+        return;
+    }
+    ThinpicOptions options;
+    thinpic_options_init(&options);
+    options.png_deflate = THINPIC_PNG_DEFLATE_LIBDEFLATE;
+    thinpic_png_deflate_thread_release();
+    size_t bytes = 0;
+    for (auto _ : state) {
+        uint8_t* data = nullptr;
+        size_t length = 0;
+        if (thinpic_png_deflate(thumbnail, &options, level, &data, &length) != 1) {
+            state.SkipWithError("libdeflate PNG encode failed");
+            break;
+        }
+        bytes = length;
+        free_compressed_buffer(data);
+        if (cold) thinpic_png_deflate_thread_release();
+    }
+    thinpic_png_deflate_thread_release();
+    g_object_unref(thumbnail);
+    state.SetItemsProcessed(state.iterations() * side * side);
+    state.counters["output_bytes"] = (double)bytes;
+}
+
+void register_source(const Source* source) {
+    const std::string at = "/" + source->name;
+    benchmark::RegisterBenchmark(("header" + at).c_str(), header_read, source);
+    if (!source->jpeg.empty()) {
+        for (int shrink : {1, 2, 4, 8}) {
+            benchmark::RegisterBenchmark(("shrink_on_load/1:" + std::to_string(shrink) + at).c_str(),
+                                         shrink_on_load, source, shrink)->Unit(benchmark::kMillisecond);
+        }
+    }
+    struct Kernel {
+        const char* name;
+        VipsKernel kernel;
+    };
+    for (Kernel kernel : {Kernel{"linear", VIPS_KERNEL_LINEAR}, Kernel{"cubic", VIPS_KERNEL_CUBIC},
+                          Kernel{"lanczos3", VIPS_KERNEL_LANCZOS3}}) {
+        for (double scale : {0.5, 0.25}) {
+            char name[64];
+            snprintf(name, sizeof(name), "resize/%s/%.2f", kernel.name, scale);
+            benchmark::RegisterBenchmark((name + at).c_str(), resize, source, scale, kernel.kernel)
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+    benchmark::RegisterBenchmark(("colour/to_srgb" + at).c_str(), to_srgb, source)->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("colour/lab_to_srgb" + at).c_str(), lab_to_srgb, source)
+        ->Unit(benchmark::kMillisecond);
+    struct Saver {
+        const char* name;
+        const char* suffix;
+    };
+    for (Saver saver : {Saver{"jpeg_q80", ".jpg[Q=80]"}, Saver{"webp_q80", ".webp[Q=80]"},
+                        Saver{"png_c6", ".png[compression=6]"}, Saver{"heif_q60", ".heic[Q=60]"}}) {
+        benchmark::RegisterBenchmark(("save/" + std::string(saver.name) + at).c_str(), save, source, saver.suffix)
+            ->Unit(benchmark::kMillisecond);
+    }
+    benchmark::RegisterBenchmark(("raw/jpeg_q80" + at).c_str(), raw_jpeg, source)->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("raw/png_c6" + at).c_str(), raw_png, source)->Unit(benchmark::kMillisecond);
+    for (int level : {6, 12}) {
+        for (bool cold : {true, false}) {
+            std::string name = std::string("small/png_deflate_") + (cold ? "cold" : "warm") + "/L" +
+                               std::to_string(level);
+            benchmark::RegisterBenchmark((name + at).c_str(), small_png_deflate, source, level, cold)
+                ->Unit(benchmark::kMicrosecond);
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // Google Benchmark takes its own flags out of argv first
+    benchmark::Initialize(&argc, argv);
+    if (test_vips_basic() != 0) {
+        fprintf(stderr, "VIPS self-test failed\n");
+        return 1;
+    }
+
+    std::vector<std::string> images;
+    for (int a = 1; a < argc; a++) {
+        if (a + 1 < argc && strcmp(argv[a], "--image") == 0) {
+            images.push_back(argv[++a]);
+        } else {
+            fprintf(stderr, "unknown argument %s\n", argv[a]);
+            return 1;
+        }
+    }
+
+    // Reserved up front: the benchmarks keep pointers into the vector
+    sources.reserve(images.size() + 1);
+    sources.emplace_back();
+    if (!make_synthetic(sources.back())) {
+        fprintf(stderr, "cannot build the synthetic image\n");
+        return 1;
+    }
+    for (const std::string& image : images) {
+        Source source;
+        source.path = image;
+        const char* slash = strrchr(image.c_str(), '/');
+        source.name = slash ? slash + 1 : image;
+        if (!load_source(source)) {
+            vips_error_clear();
+            fprintf(stderr, "cannot read %s; skipped\n", image.c_str());
+            continue;
+        }
+        sources.push_back(std::move(source));
+    }
+    for (const Source& source : sources) register_source(&source);
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    for (Source& source : sources) {
+        if (source.decoded) g_object_unref(source.decoded);
+    }
+    if (!synthetic_path.empty()) g_unlink(synthetic_path.c_str());
+    shutdown_vips();
+    return 0;
+}
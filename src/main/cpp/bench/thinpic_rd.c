@@ -0,0 +1,342 @@
+// thinpic_rd.c
+// Rate-distortion regression check for the native engine.
+//
+// Usage (on device via adb):
+//   thinpic_rd <corpus_dir> [--baseline file] [--write-baseline file]
+//              [--repeat n] [--size-tolerance pct] [--time-tolerance pct]
+//              [--ssim-tolerance d]
+//
+// The corpus is a directory of category folders (photo/, screenshot/,
+// transparent/, dslr/ ...) holding the images; files directly inside it are
+// put in the "mixed" category. Every image is compressed with
+// compress_image_with_format in each format at a ladder of qualities
+// (lossless formats once) and with auto_compress_image, and one CSV row per
+// setting records the median encode time over `repeat` runs, the output
+// bytes and the SSIM of the decoded output against the source.
+//
+// --write-baseline saves the rows; commit the file next to the corpus it was
+// measured on. --baseline compares against such a file and lists every
+// setting that got larger, slower or blurrier than the tolerances allow
+// (defaults: 2% size, 15% time, 0.005 SSIM), a setting that used to succeed
+// and now fails, and exits with 2 if there was any. Times only compare on
+// the device the baseline was written on.
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../thinpic_internal.h"
+
+#define RD_MAX_IMAGES 1024
+#define RD_MAX_ROWS 65536
+#define RD_MAX_REPEAT 15
+
+typedef struct {
+    char category[64];
+    char image[256];          // Path relative to the corpus
+    char api[32];
+    int format;
+    int quality;
+    double encode_ms;
+    long bytes;               // -1 when the setting failed
+    double ssim;
+} RdRow;
+
+typedef struct {
+    char category[64];
+    char relative[256];
+    char path[1024];
+} RdImage;
+
+static const int qualities[] = {50, 70, 80, 90};
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int is_directory(const char* path) {
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+}
+
+static int compare_images(const void* a, const void* b) {
+    return strcmp(((const RdImage*)a)->relative, ((const RdImage*)b)->relative);
+}
+
+// Regular files of one folder, appended under `category`
+static int add_folder(const char* root, const char* folder, const char* category, RdImage* images, int count) {
+    char directory[1024];
+    snprintf(directory, sizeof(directory), folder ? "%s/%s" : "%s", root, folder);
+    DIR* dir = opendir(directory);
+    if (!dir) return count;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL && count < RD_MAX_IMAGES) {
+        if (entry->d_name[0] == '.') continue;
+        RdImage* image = &images[count];
+        snprintf(image->path, sizeof(image->path), "%s/%s", directory, entry->d_name);
+        if (is_directory(image->path)) continue;
+        snprintf(image->category, sizeof(image->category), "%s", category);
+        snprintf(image->relative, sizeof(image->relative), folder ? "%s/%s" : "%s%s",
+                 folder ? folder : "", entry->d_name);
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int load_corpus(const char* root, RdImage* images) {
+    int count = add_folder(root, NULL, "mixed", images, 0);
+    DIR* dir = opendir(root);
+    if (!dir) return count;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
+        if (is_directory(path)) count = add_folder(root, entry->d_name, entry->d_name, images, count);
+    }
+    closedir(dir);
+    qsort(images, count, sizeof(RdImage), compare_images);
+    return count;
+}
+
+// SSIM of the encoded output against the source, on luminance; the source
+// is scaled to the output's size when the pipeline resized. -1 if either
+// side cannot be decoded.
+static double output_ssim(const char* path, const uint8_t* data, size_t length) {
+    VipsImage* source = vips_image_new_from_file(path, "fail_on", VIPS_FAIL_ON_NONE, NULL);
+    VipsImage* output = vips_image_new_from_buffer(data, length, "", "fail_on", VIPS_FAIL_ON_NONE, NULL);
+    double score = -1;
+    if (source && output) {
+        int width = vips_image_get_width(output);
+        int height = vips_image_get_height(output);
+        VipsImage* reference = source;
+        g_object_ref(reference);
+        if (vips_image_get_width(source) != width || vips_image_get_height(source) != height) {
+            VipsImage* scaled = NULL;
+            g_object_unref(reference);
+            reference = NULL;
+            if (vips_resize(source, &scaled, (double)width / vips_image_get_width(source),
+                    "vscale", (double)height / vips_image_get_height(source),
+                    NULL) == 0) {
+                reference = scaled;
+            }
+        }
+        if (reference && vips_image_get_width(reference) == width && vips_image_get_height(reference) == height) {
+            int shrink = thinpic_luma_shrink(width, height);
+            int a_width = 0, a_height = 0, b_width = 0, b_height = 0;
+            uint8_t* a = thinpic_luma_plane(reference, shrink, &a_width, &a_height);
+            uint8_t* b = thinpic_luma_plane(output, shrink, &b_width, &b_height);
+            if (a && b && a_width == b_width && a_height == b_height) {
+                score = thinpic_ssim(a, b, a_width, a_height);
+            }
+            g_free(a);
+            g_free(b);
+        }
+        if (reference) g_object_unref(reference);
+    }
+    if (source) g_object_unref(source);
+    if (output) g_object_unref(output);
+    vips_error_clear();
+    return score;
+}
+
+static int compare_ms(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// One setting, `repeat` times: median time; size and SSIM of the last output
+static void measure(const RdImage* image, const char* api, int format, int quality, int repeat, RdRow* row) {
+    double samples[RD_MAX_REPEAT];
+    CompressedImageResult last = {NULL, 0, -1};
+    int ok = 1;
+    for (int r = 0; r < repeat && ok; r++) {
+        if (last.data) free_compressed_buffer(last.data);
+        double start = now_ms();
+        last = strcmp(api, "auto") == 0
+            ? auto_compress_image(image->path, quality)
+            : compress_image_with_format(image->path, quality, (ImageFormat)format);
+        samples[r] = now_ms() - start;
+        ok = last.success == 1;
+    }
+    snprintf(row->category, sizeof(row->category), "%s", image->category);
+    snprintf(row->image, sizeof(row->image), "%s", image->relative);
+    snprintf(row->api, sizeof(row->api), "%s", api);
+    row->format = format;
+    row->quality = quality;
+    row->encode_ms = 0;
+    row->bytes = -1;
+    row->ssim = -1;
+    if (ok) {
+        qsort(samples, repeat, sizeof(double), compare_ms);
+        row->encode_ms = samples[repeat / 2];
+        row->bytes = (long)last.length;
+        row->ssim = output_ssim(image->path, last.data, last.length);
+    }
+    if (last.data) free_compressed_buffer(last.data);
+}
+
+static void write_row(FILE* file, const RdRow* row) {
+    fprintf(file, "%s,%s,%s,%d,%d,%.2f,%ld,%.5f\n", row->category, row->image, row->api, row->format,
+            row->quality, row->encode_ms, row->bytes, row->ssim);
+}
+
+static const char* csv_header = "category,image,api,format,quality,encode_ms,bytes,ssim\n";
+
+static int load_baseline(const char* path, RdRow* rows) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    char line[1024];
+    int count = 0;
+    while (fgets(line, sizeof(line), file) && count < RD_MAX_ROWS) {
+        RdRow* row = &rows[count];
+        if (sscanf(line, "%63[^,],%255[^,],%31[^,],%d,%d,%lf,%ld,%lf", row->category, row->image, row->api,
+                   &row->format, &row->quality, &row->encode_ms, &row->bytes, &row->ssim) == 8) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static const RdRow* find_row(const RdRow* rows, int count, const RdRow* key) {
+    for (int i = 0; i < count; i++) {
+        if (rows[i].format == key->format && rows[i].quality == key->quality &&
+                strcmp(rows[i].api, key->api) == 0 && strcmp(rows[i].image, key->image) == 0) {
+            return &rows[i];
+        }
+    }
+    return NULL;
+}
+
+// Prints and counts the settings that regressed against the baseline
+static int diff_rows(const RdRow* rows, int count, const RdRow* baseline, int baseline_count,
+                     double size_tolerance, double time_tolerance, double ssim_tolerance) {
+    int regressions = 0;
+    for (int i = 0; i < count; i++) {
+        const RdRow* now = &rows[i];
+        const RdRow* then = find_row(baseline, baseline_count, now);
+        if (!then || then->bytes < 0) continue;
+        const char* what = NULL;
+        if (now->bytes < 0) {
+            what = "now fails";
+        } else if (now->bytes > then->bytes * (1 + size_tolerance)) {
+            what = "larger";
+        } else if (now->encode_ms > then->encode_ms * (1 + time_tolerance)) {
+            what = "slower";
+        } else if (then->ssim >= 0 && now->ssim < then->ssim - ssim_tolerance) {
+            what = "lower SSIM";
+        }
+        if (!what) continue;
+        regressions++;
+        fprintf(stderr, "REGRESSION %s: %s %s format %d Q%d: %.1f ms %ld B SSIM %.4f (was %.1f ms %ld B SSIM %.4f)\n",
+                what, now->image, now->api, now->format, now->quality, now->encode_ms, now->bytes, now->ssim,
+                then->encode_ms, then->bytes, then->ssim);
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <corpus_dir> [--baseline file] [--write-baseline file] [--repeat n]\n"
+                        "       [--size-tolerance pct] [--time-tolerance pct] [--ssim-tolerance d]\n", argv[0]);
+        return 1;
+    }
+    const char* corpus = argv[1];
+    const char* baseline_path = NULL;
+    const char* write_path = NULL;
+    int repeat = 3;
+    double size_tolerance = 0.02;
+    double time_tolerance = 0.15;
+    double ssim_tolerance = 0.005;
+    for (int a = 2; a < argc; a++) {
+        if (a + 1 >= argc) {
+            fprintf(stderr, "%s needs a value\n", argv[a]);
+            return 1;
+        }
+        if (strcmp(argv[a], "--baseline") == 0) baseline_path = argv[++a];
+        else if (strcmp(argv[a], "--write-baseline") == 0) write_path = argv[++a];
+        else if (strcmp(argv[a], "--repeat") == 0) repeat = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--size-tolerance") == 0) size_tolerance = atof(argv[++a]) / 100;
+        else if (strcmp(argv[a], "--time-tolerance") == 0) time_tolerance = atof(argv[++a]) / 100;
+        else if (strcmp(argv[a], "--ssim-tolerance") == 0) ssim_tolerance = atof(argv[++a]);
+        else {
+            fprintf(stderr, "unknown argument %s\n", argv[a]);
+            return 1;
+        }
+    }
+    if (repeat < 1) repeat = 1;
+    if (repeat > RD_MAX_REPEAT) repeat = RD_MAX_REPEAT;
+
+    RdImage* images = (RdImage*)malloc(sizeof(RdImage) * RD_MAX_IMAGES);
+    int image_count = load_corpus(corpus, images);
+    if (image_count == 0) {
+        fprintf(stderr, "no images in %s\n", corpus);
+        free(images);
+        return 1;
+    }
+    if (test_vips_basic() != 0) {
+        fprintf(stderr, "VIPS self-test failed\n");
+        free(images);
+        return 1;
+    }
+
+    RdRow* rows = (RdRow*)malloc(sizeof(RdRow) * RD_MAX_ROWS);
+    int count = 0;
+    printf("%s", csv_header);
+    for (int i = 0; i < image_count; i++) {
+        for (int format = FORMAT_JPEG; format <= FORMAT_AVIF; format++) {
+            if (format == FORMAT_AUTO) continue;
+            int lossless = format == FORMAT_PNG || format == FORMAT_GIF;
+            int steps = lossless ? 1 : (int)(sizeof(qualities) / sizeof(qualities[0]));
+            for (int q = 0; q < steps && count < RD_MAX_ROWS; q++) {
+                measure(&images[i], "format", format, lossless ? 80 : qualities[q], repeat, &rows[count]);
+                write_row(stdout, &rows[count++]);
+                fflush(stdout);
+            }
+        }
+        if (count < RD_MAX_ROWS) {
+            measure(&images[i], "auto", FORMAT_AUTO, 80, repeat, &rows[count]);
+            write_row(stdout, &rows[count++]);
+            fflush(stdout);
+        }
+    }
+
+    int status = 0;
+    if (write_path) {
+        FILE* file = fopen(write_path, "w");
+        if (file) {
+            fputs(csv_header, file);
+            for (int i = 0; i < count; i++) write_row(file, &rows[i]);
+            fclose(file);
+        } else {
+            fprintf(stderr, "could not write %s\n", write_path);
+            status = 1;
+        }
+    }
+    if (baseline_path) {
+        RdRow* baseline = (RdRow*)malloc(sizeof(RdRow) * RD_MAX_ROWS);
+        int baseline_count = load_baseline(baseline_path, baseline);
+        if (baseline_count < 0) {
+            fprintf(stderr, "could not read %s\n", baseline_path);
+            status = 1;
+        } else {
+            int regressions = diff_rows(rows, count, baseline, baseline_count,
+                                        size_tolerance, time_tolerance, ssim_tolerance);
+            fprintf(stderr, "%d of %d settings regressed against %s\n", regressions, count, baseline_path);
+            if (regressions > 0) status = 2;
+        }
+        free(baseline);
+    }
+
+    free(rows);
+    free(images);
+    shutdown_vips();
+    return status;
+}
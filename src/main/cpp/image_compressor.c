@@ -1,55 +1,67 @@
 
 #include <vips/vips.h>
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
 
-// Structure to hold compressed image data
-typedef struct {
-    uint8_t* data;
-    size_t length;
-    int success;
-} CompressedImageResult;
-
-// Structure to hold image information
-typedef struct {
-    int width;
-    int height;
-    int bands;
-    int orientation;
-    int needs_resize;
-    int new_width;
-    int new_height;
-} ImageInfo;
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
 
-// Supported image formats
-typedef enum {
-    FORMAT_JPEG = 0,
-    FORMAT_PNG = 1,
-    FORMAT_WEBP = 2,
-    FORMAT_TIFF = 3,
-    FORMAT_HEIF = 4,
-    FORMAT_JP2K = 5,  // JPEG 2000
-    FORMAT_JXL = 6,   // JPEG XL
-    FORMAT_GIF = 7,
-    FORMAT_AUTO = 8   // Auto-detect based on input file extension
-} ImageFormat;
-
-// Global flag to track VIPS initialization with mutex protection
+// Global flag to track VIPS initialization; vips_mutex only guards VIPS_INIT/shutdown
 static int vips_initialized = 0;
 static pthread_mutex_t vips_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Function prototypes
-CompressedImageResult compress_large_dslr_image(const char* input_path, int quality);
-CompressedImageResult compress_large_image(const char* input_path, int quality);
-CompressedImageResult smart_compress_image(const char* input_path, int target_kb, int type);
+// Serializes whole pipelines when EXECUTION_MODE_SERIAL is selected
+static int execution_mode = EXECUTION_MODE_CONCURRENT;
+static pthread_mutex_t pipeline_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Helper function to detect format from file extension
-ImageFormat detect_format_from_path(const char* input_path) {
-    if (!input_path) return FORMAT_JPEG;
-    
+// Last thinpic_configure settings, applied on every VIPS start; guarded by
+// vips_mutex. The fields pipelines read per call (mmap_input_min_mb,
+// skip_compliant, metadata_policy, gpu_resize_min_mp, resize_quality) are
+// also stored and loaded atomically so that compressions never take the mutex.
+static ThinpicRuntimeConfig runtime_config = {-1, -1, -1, -1, 0, 0, THINPIC_STRIP_NONE, 0, 0,
+                                              THINPIC_RESIZE_BALANCED, 0xFFFFFF, 64, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 0, 0, 0, 0, 0};
+// thinpic_open handles not yet closed, for one_shot_cache; guarded by vips_mutex
+static int open_handles = 0;
+// vips_cache_get_max before runtime_config first touched it
+static int library_max_operations = -1;
+
+// Log and clear what libvips reported. The buffer is process-wide, so it is
+// taken in one atomic copy-and-clear; the logged line also becomes the detail
+// of this thread's ThinpicError.
+static void log_vips_error(void) {
+    char* error = vips_error_buffer_copy();
+    if (error && strlen(error) > 0) {
+        size_t length = strlen(error);
+        while (length > 0 && error[length - 1] == '\n') error[--length] = '\0';
+        THINPIC_LOGE("VIPS error: %s", error);
+    }
+    g_free(error);
+}
+
+// The container named by the file's first bytes; FORMAT_AUTO when it cannot
+// be read or is not one we know
+static ImageFormat sniff_path(const char* input_path) {
+    int fd = open(input_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return FORMAT_AUTO;
+    ImageFormat format = thinpic_sniff_descriptor(fd);
+    close(fd);
+    return format;
+}
+
+static ImageFormat format_from_extension(const char* input_path) {
     const char* ext = strrchr(input_path, '.');
     if (!ext) return FORMAT_JPEG;
     
@@ -80,2929 +92,6328 @@ ImageFormat detect_format_from_path(const char* input_path) {
         return FORMAT_JXL;
     } else if (strcmp(lower_ext, "gif") == 0) {
         return FORMAT_GIF;
+    } else if (strcmp(lower_ext, "avif") == 0) {
+        return FORMAT_AVIF;
     }
     
     return FORMAT_JPEG; // Default to JPEG
 }
 
+// Helper function to detect format from the file's signature, then its
+// extension
+ImageFormat detect_format_from_path(const char* input_path) {
+    if (!input_path) return FORMAT_JPEG;
+    ImageFormat format = sniff_path(input_path);
+    return format != FORMAT_AUTO ? format : format_from_extension(input_path);
+}
+
+// Push runtime_config into libvips; must be called with vips_mutex held
+// after VIPS_INIT
+static void apply_runtime_config() {
+    if (library_max_operations < 0) library_max_operations = vips_cache_get_max();
+    if (runtime_config.cache_max_mem_mb >= 0) {
+        vips_cache_set_max_mem((size_t)runtime_config.cache_max_mem_mb * 1024 * 1024);
+    }
+    if (runtime_config.one_shot_cache && open_handles == 0) {
+        // Nothing kept between calls; a smaller limit trims the cache at once
+        vips_cache_set_max(0);
+    } else if (runtime_config.cache_max_operations >= 0) {
+        vips_cache_set_max(runtime_config.cache_max_operations);
+    } else {
+        vips_cache_set_max(library_max_operations);
+    }
+    if (runtime_config.threads_per_image >= 0) {
+        vips_concurrency_set(runtime_config.threads_per_image);
+    }
+}
+
+// CompressionStats.encode_attempts: a libvips saver encodes inside its
+// build, on the thread running the job, so counting the postbuild of every
+// saver covers probes, searches and final encodes alike
+static gboolean count_save(GSignalInvocationHint* hint, guint count, const GValue* params, gpointer data) {
+    (void)hint;
+    (void)data;
+    if (count > 0 && VIPS_IS_FOREIGN_SAVE(g_value_get_object(&params[0]))) thinpic_stage_encode();
+    return TRUE;
+}
+
 // Initialize VIPS if not already initialized (thread-safe)
 static int ensure_vips_initialized() {
+    // Fast path: once VIPS is up, callers never touch the mutex
+    if (__atomic_load_n(&vips_initialized, __ATOMIC_ACQUIRE)) {
+        return 1;
+    }
+    
     pthread_mutex_lock(&vips_mutex);
     
     if (!vips_initialized) {
         if (VIPS_INIT("image_compressor")) {
-            printf("[image_compressor] Error: Failed to initialize VIPS\n");
+            THINPIC_LOGE("Error: Failed to initialize VIPS");
             pthread_mutex_unlock(&vips_mutex);
             return 0;
         }
-        vips_initialized = 1;
-        printf("[image_compressor] VIPS initialized\n");
+        apply_runtime_config();
+        static gulong save_hook = 0;
+        guint postbuild = g_signal_lookup("postbuild", VIPS_TYPE_OBJECT);
+        if (!save_hook && postbuild) save_hook = g_signal_add_emission_hook(postbuild, 0, count_save, NULL, NULL);
+        static gulong profile_hook = 0;
+        if (!profile_hook && postbuild) {
+            profile_hook = g_signal_add_emission_hook(postbuild, 0, thinpic_profile_postbuild, NULL, NULL);
+        }
+        __atomic_store_n(&vips_initialized, 1, __ATOMIC_RELEASE);
+        THINPIC_LOGI("VIPS initialized");
     }
     
     pthread_mutex_unlock(&vips_mutex);
     return 1;
 }
 
-// Thread-safe image compression function optimized for DSLR images
-CompressedImageResult compress_image(const char* input_path, int quality) {
-    CompressedImageResult result = {NULL, 0, -1};
-    
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
-        return result;
-    }
-    
-    if (quality < 1 || quality > 100) {
-        printf("[image_compressor] Error: Quality must be between 1 and 100\n");
-        return result;
-    }
-    
-    // Check if file exists and get file size
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        printf("[image_compressor] Error: Cannot open file: %s\n", input_path);
-        return result;
+// Take the pipeline lock only in serial mode; returns whether it was taken
+static int pipeline_lock() {
+    if (__atomic_load_n(&execution_mode, __ATOMIC_ACQUIRE) == EXECUTION_MODE_SERIAL) {
+        pthread_mutex_lock(&pipeline_mutex);
+        return 1;
     }
-    
-    // Get file size to determine compression strategy
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fclose(file);
-    
-    printf("[image_compressor] Compressing image: %s (size: %ld bytes, quality: %d)\n", input_path, file_size, quality);
-    
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
-        return result;
+    return 0;
+}
+
+static void pipeline_unlock(int locked) {
+    if (locked) {
+        pthread_mutex_unlock(&pipeline_mutex);
     }
-    
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Clear any previous errors
-    vips_error_clear();
-    
+}
+
+void set_execution_mode(ExecutionMode mode) {
+    if (mode != EXECUTION_MODE_CONCURRENT && mode != EXECUTION_MODE_SERIAL) {
+        THINPIC_LOGE("Error: Unknown execution mode %d", mode);
+        return;
+    }
+    __atomic_store_n(&execution_mode, (int)mode, __ATOMIC_RELEASE);
+    THINPIC_LOGI("Execution mode: %s",
+           mode == EXECUTION_MODE_SERIAL ? "serial" : "concurrent");
+}
+
+ExecutionMode get_execution_mode() {
+    return (ExecutionMode)__atomic_load_n(&execution_mode, __ATOMIC_ACQUIRE);
+}
+
+// Run each bundled codec and the thumbnail path once on a tiny image, so
+// their GTypes, classes and encoder tables are set up before a real image
+static void warm_operations() {
+    static const char* suffixes[] = {".jpg", ".png", ".webp"};
+    int pipeline_locked = pipeline_lock();
     VipsImage* image = NULL;
-    VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image with error handling
-    printf("[image_compressor] Loading image...\n");
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
-    
-    if (!image) {
-        printf("[image_compressor] Error: Failed to load image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
-        }
+    if (vips_black(&image, 16, 16, "bands", 3, NULL)) {
         vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    // Validate image object
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    // Get image info
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    int bands = vips_image_get_bands(image);
-    
-    printf("[image_compressor] Image loaded: %dx%d, %d bands\n", width, height, bands);
-    
-    // Validate image dimensions
-    if (width <= 0 || height <= 0 || bands <= 0) {
-        printf("[image_compressor] Error: Invalid image dimensions\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    // Compression strategy based on dimensions only
-    int new_width = width;
-    int new_height = height;
-    int needs_resize = 0;
-    
-    // Resize if largest dimension > 6000px
-    const int max_dimension = 6000;
-    if (width > max_dimension || height > max_dimension) {
-        needs_resize = 1;
-        if (width > height) {
-            new_width = max_dimension;
-            new_height = (int)((double)height * max_dimension / width);
-        } else {
-            new_height = max_dimension;
-            new_width = (int)((double)width * max_dimension / height);
-        }
-        printf("[image_compressor] Resizing from %dx%d to %dx%d\n", width, height, new_width, new_height);
+        pipeline_unlock(pipeline_locked);
+        return;
     }
-    
-    // Process image (resize if needed and convert to sRGB)
-    vips_error_clear();
-    
-    if (needs_resize) {
-        printf("[image_compressor] Resizing image with high quality...\n");
-        double scale = 1.0;
-        if (width > height) {
-            scale = (double)max_dimension / width;
-        } else {
-            scale = (double)max_dimension / height;
-        }
-        
-        printf("[image_compressor] Scale factor: %f\n", scale);
-        
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LANCZOS3,  // High-quality kernel
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        void* buffer = NULL;
+        size_t length = 0;
+        if (vips_image_write_to_buffer(image, suffixes[i], &buffer, &length, NULL) == 0) {
+            VipsImage* thumbnail = NULL;
+            if (vips_thumbnail_buffer(buffer, length, &thumbnail, 8, NULL) == 0) {
+                // The thumbnail is lazy; decoding it runs the loader and resize
+                VipsImage* decoded = vips_image_copy_memory(thumbnail);
+                if (decoded) g_object_unref(decoded);
+                g_object_unref(thumbnail);
             }
-            vips_error_clear();
-            
-            // Try to compress original image without resizing
-            printf("[image_compressor] Trying to compress original image without resizing...\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
-        g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
-        
-        // Get new dimensions
-        width = vips_image_get_width(image);
-        height = vips_image_get_height(image);
-        printf("[image_compressor] Image resized to: %dx%d\n", width, height);
-        
-        // Validate resized image
-        if (width <= 0 || height <= 0) {
-            printf("[image_compressor] Error: Invalid dimensions after resize\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
-    }
-    
-    // Convert to sRGB for consistent color space
-    printf("[image_compressor] Converting image to sRGB...\n");
-    vips_error_clear();
-    if (vips_copy(image, &processed_image, 
-            "interpretation", VIPS_INTERPRETATION_sRGB,
-            NULL)) {
-        printf("[image_compressor] Error: Failed to convert image to sRGB\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+            g_free(buffer);
         }
         vips_error_clear();
-        
-        // Try to compress without sRGB conversion
-        printf("[image_compressor] Trying to compress image without sRGB conversion...\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
     }
-    
     g_object_unref(image);
-    image = processed_image;
-    processed_image = NULL;
-    
-    // Validate final image before compression
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image after processing\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    int final_width = vips_image_get_width(image);
-    int final_height = vips_image_get_height(image);
-    int final_bands = vips_image_get_bands(image);
-    printf("[image_compressor] Final image: %dx%d, %d bands\n", final_width, final_height, final_bands);
-    
-    // Compression with user-specified quality
-    printf("[image_compressor] Starting compression...\n");
-    vips_error_clear();
-    
-    // Use user-specified quality
-    int final_quality = quality;
-    printf("[image_compressor] Using quality: %d\n", final_quality);
-    
-    // Enhanced JPEG save options for better compression
-    int save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-        "Q", final_quality,
-        // "strip", TRUE,
-        "optimize_coding", TRUE,
-        "interlace", FALSE,  // Better for most images
-        "no_subsample", FALSE, // Allow subsampling for better compression
-        NULL);
-    
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        // Compression successful
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Compression successful: %zu bytes (quality: %d)\n", buffer_size, final_quality);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    pipeline_unlock(pipeline_locked);
+}
+
+static void* prewarm_main(void* arg) {
+    int warm = (int)(intptr_t)arg;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ensure_vips_initialized() && warm) warm_operations();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    THINPIC_LOGI("Prewarm finished in %ld ms",
+                 (long)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000));
+    return NULL;
+}
+
+int thinpic_prewarm(int warm) {
+    if (__atomic_load_n(&vips_initialized, __ATOMIC_ACQUIRE) && !warm) return 0;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int failed = pthread_create(&thread, &attributes, prewarm_main, (void*)(intptr_t)(warm ? 1 : 0));
+    pthread_attr_destroy(&attributes);
+    if (failed) {
+        THINPIC_LOGE("Error: Cannot start prewarm thread");
+        return -1;
     }
-    
-    // If enhanced compression failed, try standard approach
-    printf("[image_compressor] Enhanced compression failed, trying standard approach...\n");
-    const char* error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+    return 0;
+}
+
+int thinpic_configure(const ThinpicRuntimeConfig* config) {
+    if (!config) {
+        THINPIC_LOGE("Error: Invalid runtime config");
+        return -1;
     }
-    vips_error_clear();
-    
-    // Free any existing buffer
-    if (buffer) {
-        g_free(buffer);
-        buffer = NULL;
-        buffer_size = 0;
+    if (!ensure_vips_initialized()) {
+        return -1;
     }
     
-    // Try with standard quality
-    save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-        "Q", quality,
-        // "strip", TRUE,
-        NULL);
+    pthread_mutex_lock(&vips_mutex);
+    if (config->memory_budget_mb >= 0) runtime_config.memory_budget_mb = config->memory_budget_mb;
+    if (config->cache_max_mem_mb >= 0) runtime_config.cache_max_mem_mb = config->cache_max_mem_mb;
+    if (config->cache_max_operations >= 0) runtime_config.cache_max_operations = config->cache_max_operations;
+    if (config->threads_per_image >= 0) runtime_config.threads_per_image = config->threads_per_image;
+    if (config->mmap_input_min_mb >= 0) {
+        __atomic_store_n(&runtime_config.mmap_input_min_mb, config->mmap_input_min_mb, __ATOMIC_RELAXED);
+    }
+    if (config->skip_compliant >= 0) {
+        __atomic_store_n(&runtime_config.skip_compliant, config->skip_compliant ? 1 : 0, __ATOMIC_RELAXED);
+    }
+    if (config->metadata_policy >= THINPIC_STRIP_NONE && config->metadata_policy <= THINPIC_STRIP_KEEP_ICC) {
+        __atomic_store_n(&runtime_config.metadata_policy, config->metadata_policy, __ATOMIC_RELAXED);
+    }
+    if (config->thermal_scaling >= 0) runtime_config.thermal_scaling = config->thermal_scaling ? 1 : 0;
+    if (config->gpu_resize_min_mp >= 0) {
+        __atomic_store_n(&runtime_config.gpu_resize_min_mp, config->gpu_resize_min_mp, __ATOMIC_RELAXED);
+    }
+    if (config->resize_quality >= THINPIC_RESIZE_FAST && config->resize_quality <= THINPIC_RESIZE_BEST) {
+        __atomic_store_n(&runtime_config.resize_quality, config->resize_quality, __ATOMIC_RELAXED);
+    }
+    if (config->flatten_background >= 0) {
+        runtime_config.flatten_background = config->flatten_background & 0xFFFFFF;
+        thinpic_set_flatten_background(runtime_config.flatten_background);
+    }
+    if (config->handle_cache_mb >= 0) {
+        __atomic_store_n(&runtime_config.handle_cache_mb, config->handle_cache_mb, __ATOMIC_RELAXED);
+    }
+    if (config->decode_cache_mb >= 0) runtime_config.decode_cache_mb = config->decode_cache_mb;
+    if (config->lossless_orientation >= 0) {
+        __atomic_store_n(&runtime_config.lossless_orientation, config->lossless_orientation ? 1 : 0,
+                         __ATOMIC_RELAXED);
+    }
+    if (config->dither_high_depth >= 0) {
+        __atomic_store_n(&runtime_config.dither_high_depth, config->dither_high_depth ? 1 : 0, __ATOMIC_RELAXED);
+        thinpic_set_dither_high_depth(runtime_config.dither_high_depth);
+    }
+    if (config->one_shot_cache >= 0) runtime_config.one_shot_cache = config->one_shot_cache ? 1 : 0;
+    if (config->adaptive_quality >= 0) {
+        __atomic_store_n(&runtime_config.adaptive_quality, config->adaptive_quality ? 1 : 0, __ATOMIC_RELAXED);
+    }
+    if (config->disc_threshold_mb >= 0) runtime_config.disc_threshold_mb = config->disc_threshold_mb;
+    if (config->jpeg_strip_encode >= 0) {
+        __atomic_store_n(&runtime_config.jpeg_strip_encode, config->jpeg_strip_encode ? 1 : 0, __ATOMIC_RELAXED);
+    }
+    if (config->max_input_megapixels >= 0) runtime_config.max_input_megapixels = config->max_input_megapixels;
+    if (config->max_input_bands >= 0) runtime_config.max_input_bands = config->max_input_bands;
+    if (config->job_timeout_ms >= 0) runtime_config.job_timeout_ms = config->job_timeout_ms;
+    if (config->platform_decode >= 0) {
+        runtime_config.platform_decode = config->platform_decode ? 1 : 0;
+        thinpic_platform_decode_set(runtime_config.platform_decode);
+    }
+    if (config->coefficient_search >= 0) {
+        __atomic_store_n(&runtime_config.coefficient_search, config->coefficient_search ? 1 : 0, __ATOMIC_RELAXED);
+    }
+    if (config->deterministic >= 0) {
+        __atomic_store_n(&runtime_config.deterministic, config->deterministic ? 1 : 0, __ATOMIC_RELAXED);
+        thinpic_thermal_pin_effort(config->deterministic);
+    }
+    // Automatic: a render that would take a quarter of the budget goes to disc
+    int disc_threshold_mb = runtime_config.disc_threshold_mb > 0 ? runtime_config.disc_threshold_mb
+                                                                 : runtime_config.memory_budget_mb / 4;
+    apply_runtime_config();
+    pthread_mutex_unlock(&vips_mutex);
     
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Standard compression successful: %zu bytes\n", buffer_size);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    thinpic_spill_set_threshold((int64_t)disc_threshold_mb * 1024 * 1024);
+    thinpic_limits_set(config->max_input_megapixels, config->max_input_bands, config->job_timeout_ms);
+    
+    if (config->memory_budget_mb >= 0) {
+        thinpic_pool_set_memory_budget((int64_t)config->memory_budget_mb * 1024 * 1024);
+    }
+    if (config->thermal_scaling >= 0) {
+        thinpic_thermal_enable(config->thermal_scaling);
+    }
+    if (config->decode_cache_mb >= 0) {
+        thinpic_decode_cache_set_budget((int64_t)config->decode_cache_mb * 1024 * 1024);
+    }
+    
+    THINPIC_LOGI("Runtime config: budget %d MB, cache %d MB / %d ops, %d threads per image, mmap from %d MB, "
+                 "skip compliant %d, metadata policy %d, thermal scaling %d, GPU resize from %d MP, "
+                 "resize quality %d, background %06x, handle cache %d MB, "
+                 "decode cache %d MB, lossless orientation %d, dither high depth %d, one-shot cache %d, "
+                 "adaptive quality %d, disc threshold %d MB, JPEG strip encode %d, input limit %d MP / %d bands, "
+                 "job timeout %d ms, platform decode %d, coefficient search %d, deterministic %d",
+                 runtime_config.memory_budget_mb, runtime_config.cache_max_mem_mb,
+                 runtime_config.cache_max_operations, runtime_config.threads_per_image,
+                 runtime_config.mmap_input_min_mb, runtime_config.skip_compliant,
+                 runtime_config.metadata_policy, runtime_config.thermal_scaling,
+                 runtime_config.gpu_resize_min_mp, runtime_config.resize_quality,
+                 runtime_config.flatten_background, runtime_config.handle_cache_mb,
+                 runtime_config.decode_cache_mb, runtime_config.lossless_orientation,
+                 runtime_config.dither_high_depth, runtime_config.one_shot_cache,
+                 runtime_config.adaptive_quality, disc_threshold_mb, runtime_config.jpeg_strip_encode,
+                 runtime_config.max_input_megapixels, runtime_config.max_input_bands, runtime_config.job_timeout_ms,
+                 runtime_config.platform_decode, runtime_config.coefficient_search, runtime_config.deterministic);
+    return 0;
+}
+
+int thinpic_get_runtime_stats(ThinpicRuntimeStats* out) {
+    if (!out) {
+        THINPIC_LOGE("Error: Invalid runtime stats output");
+        return -1;
     }
+    memset(out, 0, sizeof(*out));
     
-    // All compression attempts failed
-    printf("[image_compressor] Error: All compression attempts failed\n");
-    error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+    // The operation cache only exists between VIPS_INIT and vips_shutdown
+    pthread_mutex_lock(&vips_mutex);
+    if (vips_initialized) {
+        out->cache_operations = vips_cache_get_size();
+        out->cache_max_operations = vips_cache_get_max();
+        out->cache_max_mem = (int64_t)vips_cache_get_max_mem();
     }
+    pthread_mutex_unlock(&vips_mutex);
     
-    // Cleanup
-    if (buffer) {
-        g_free(buffer);
+    out->tracked_mem = (int64_t)vips_tracked_get_mem();
+    out->tracked_mem_highwater = (int64_t)vips_tracked_get_mem_highwater();
+    out->tracked_allocs = vips_tracked_get_allocs();
+    out->open_files = vips_tracked_get_files();
+    thinpic_pool_activity(&out->pool_workers, &out->active_jobs, &out->queued_jobs, &out->in_flight_bytes);
+    out->thermal_status = thinpic_thermal_status();
+    return 0;
+}
+
+void thinpic_drop_operation_cache() {
+    pthread_mutex_lock(&vips_mutex);
+    if (vips_initialized) {
+        // vips_cache_drop_all also frees the cache table, which is only safe
+        // at shutdown; shrinking the limit to 0 trims every idle operation
+        int before = vips_cache_get_size();
+        int max_operations = vips_cache_get_max();
+        vips_cache_set_max(0);
+        vips_cache_set_max(max_operations);
+        THINPIC_LOGI("Operation cache dropped %d of %d operations",
+                     before - vips_cache_get_size(), before);
     }
-    g_object_unref(image);
-    vips_error_clear();
-    
     pthread_mutex_unlock(&vips_mutex);
-    return result;
 }
 
-// Thread-safe image compression function with format support
-CompressedImageResult compress_image_with_format(const char* input_path, int quality, ImageFormat format) {
-    CompressedImageResult result = {NULL, 0, -1};
-    
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
-        return result;
-    }
-    
-    if (quality < 1 || quality > 100) {
-        printf("[image_compressor] Error: Quality must be between 1 and 100\n");
-        return result;
-    }
-    
-    // Auto-detect format if requested
-    if (format == FORMAT_AUTO) {
-        format = detect_format_from_path(input_path);
-        printf("[image_compressor] Auto-detected format: %d\n", format);
-    }
-    
-    // Check if file exists and get file size
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        printf("[image_compressor] Error: Cannot open file: %s\n", input_path);
-        return result;
-    }
-    
-    // Get file size to determine compression strategy
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fclose(file);
-    
-    printf("[image_compressor] Compressing image: %s (size: %ld bytes, quality: %d, format: %d)\n", 
-           input_path, file_size, quality, format);
-    
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
-        return result;
+// Metadata written by the pipelines that take no ThinpicOptions
+// (thinpic_configure metadata_policy)
+static ThinpicStripPolicy metadata_policy(void) {
+    return (ThinpicStripPolicy)__atomic_load_n(&runtime_config.metadata_policy, __ATOMIC_RELAXED);
+}
+
+// The savers' "keep" flags for a policy. EXIF carries the embedded preview
+// JPEG, XMP edit history; both go unless everything is kept.
+static VipsForeignKeep keep_for_policy(ThinpicStripPolicy policy) {
+    switch (policy) {
+        case THINPIC_STRIP_ALL: return VIPS_FOREIGN_KEEP_NONE;
+        case THINPIC_STRIP_KEEP_ICC: return VIPS_FOREIGN_KEEP_ICC;
+        default: return VIPS_FOREIGN_KEEP_ALL;
     }
-    
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Clear any previous errors
-    vips_error_clear();
-    
-    VipsImage* image = NULL;
-    VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image with error handling
-    printf("[image_compressor] Loading image...\n");
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
+}
+
+static VipsForeignKeep metadata_keep(void) {
+    return keep_for_policy(thinpic_metadata_policy());
+}
+
+// GIF through thinpic_gif.c. The fixed presets keep a full dithered palette
+// and let animations repeat only pixels that did not change at all.
+static const ThinpicGifParams gif_preset = {256, 100, 0, 0};
+
+static int gif_save_target(VipsImage* image, const ThinpicGifParams* params, VipsTarget* target) {
+    uint8_t* gif = NULL;
+    size_t gif_length = 0;
+    if (thinpic_gif_save(image, params, &gif, &gif_length)) return -1;
+    int failed = vips_target_write(target, gif, gif_length) || vips_target_end(target);
+    g_free(gif);
+    return failed ? -1 : 0;
+}
+
+// Encoder settings of the pipelines that take no ThinpicOptions, one set for
+// every format; format_settings fills in the shared defaults and callers
+// change only what their mode differs in
+typedef struct {
+    int quality;                 // Q, 1-100
+    int compression;             // PNG zlib level 0-9 (png_level)
+    int optimize_coding;         // JPEG optimised Huffman tables; off when streaming
+    int smart_subsample;         // WebP sharper chroma
+    int effort;                  // WebP 0-6; -1 = libwebp's default
+    double distance;             // JPEG XL Butteraugli distance; 0 = from quality
+    const ThinpicGifParams* gif;
+} FormatSettings;
+
+// Capabilities in FormatDescriptor.caps
+#define FORMAT_CAP_ALPHA 0x01        // Stores an alpha band; the others are flattened
+#define FORMAT_CAP_ANIMATION 0x02    // Stores several frames (see animated_format)
+#define FORMAT_CAP_LOSSLESS 0x04     // Always lossless: quality sets effort or the palette
+#define FORMAT_CAP_EIGHT_BIT 0x08    // 8 bits per sample at most (see narrow_depth)
+#define FORMAT_CAP_STREAMING 0x10    // Saves in scanline order with no buffered image
+#define FORMAT_CAP_INDEXED 0x20      // Palette writer: colours and bands are left alone
+
+typedef struct {
+    const char* saver;           // libvips operation to look for (format_available); NULL = written here
+    unsigned int caps;
+    int (*save)(VipsImage* image, VipsTarget* target, const FormatSettings* settings);
+} FormatDescriptor;
+
+// 1-100 quality to a PNG zlib level, as the thermal state allows
+static int png_level(int level) {
+    if (level < 0) level = 0;
+    if (level > 9) level = 9;
+    return thinpic_thermal_effort(level, 1);
+}
+
+static FormatSettings format_settings(int quality) {
+    FormatSettings settings = {quality, png_level(9 - (quality * 9) / 100), 1, 0, -1, 0, &gif_preset};
+    return settings;
+}
+
+// libjpeg's Huffman optimisation keeps every DCT coefficient of the image
+// for its second pass, about 3 bytes a pixel at 4:2:0. Past this size the
+// first encode goes without it, rather than running out of memory on a
+// phone and being redone.
+#define JPEG_OPTIMIZE_MAX_PIXELS (48 * 1000 * 1000)
+
+static pthread_once_t jpeg_extensions_once = PTHREAD_ONCE_INIT;
+static int jpeg_extensions = 0;
+
+// mozjpeg's parameter API, which libvips drives trellis_quant and the other
+// extensions through. libjpeg-turbo and IJG libjpeg do not export it, and
+// libvips warns on every encode asked for them there.
+static void probe_jpeg_extensions(void) {
+    jpeg_extensions = dlsym(RTLD_DEFAULT, "jpeg_c_bool_param_supported") != NULL;
+    THINPIC_LOGI("mozjpeg extensions %s", jpeg_extensions ? "available" : "missing");
+}
+
+int thinpic_jpeg_extensions_available(void) {
+    pthread_once(&jpeg_extensions_once, probe_jpeg_extensions);
+    return jpeg_extensions;
+}
+
+typedef struct {
+    int trellis;
+    int overshoot_deringing;
+    int optimize_scans;
+    int quant_table;
+} JpegTuning;
+
+// Resolves the ThinpicOptions jpeg_* settings: -1 takes automatic, and
+// nothing is asked of a libjpeg that cannot do it
+static JpegTuning jpeg_tuning(int trellis, int overshoot_deringing, int optimize_scans, int quant_table,
+                              int automatic) {
+    JpegTuning tuning = {0, 0, 0, 0};
+    if (!thinpic_jpeg_extensions_available()) {
+        if (trellis > 0 || overshoot_deringing > 0 || optimize_scans > 0 || quant_table > 0) {
+            THINPIC_LOGW("mozjpeg extensions requested but not in the linked libjpeg; ignored");
+        }
+        return tuning;
+    }
+    tuning.trellis = trellis < 0 ? automatic : trellis;
+    tuning.overshoot_deringing = overshoot_deringing < 0 ? automatic : overshoot_deringing;
+    tuning.optimize_scans = optimize_scans < 0 ? automatic : optimize_scans;
+    tuning.quant_table = quant_table < 0 ? THINPIC_QUANT_TABLE_IMAGEMAGICK : quant_table;
+    return tuning;
+}
+
+// Coloured text and UI edges go 4:4:4 at every quality; everything else is
+// left to libvips, which subsamples below Q 90
+static VipsForeignSubsample jpeg_subsample(VipsImage* image) {
+    return thinpic_chroma_detail(image) ? VIPS_FOREIGN_SUBSAMPLE_OFF : VIPS_FOREIGN_SUBSAMPLE_AUTO;
+}
+
+static int save_jpeg(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    int64_t pixels = (int64_t)vips_image_get_width(image) * vips_image_get_height(image);
+    return vips_jpegsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "optimize_coding", settings->optimize_coding && pixels <= JPEG_OPTIMIZE_MAX_PIXELS,
+        "interlace", FALSE,
+        "subsample_mode", jpeg_subsample(image),
         NULL);
-    
-    if (!image) {
-        printf("[image_compressor] Error: Failed to load image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+}
+
+static int save_png(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    return vips_pngsave_target(image, target,
+        "keep", metadata_keep(),
+        "compression", settings->compression,
+        "interlace", FALSE,
+        NULL);
+}
+
+static int save_webp(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    return vips_webpsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "lossless", FALSE,
+        "near_lossless", FALSE,
+        "smart_subsample", settings->smart_subsample,
+        "effort", settings->effort >= 0 ? settings->effort : 4,
+        NULL);
+}
+
+static int save_tiff(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    return vips_tiffsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
+        "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
+        NULL);
+}
+
+// HEIF through the platform's hardware encoder where there is one (ImageIO
+// on Apple platforms, MediaCodec on Android 9+), else libheif via libvips
+static int save_heif(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    int handled = thinpic_imageio_save_target(image, FORMAT_HEIF, settings->quality, target);
+    if (handled != 1) return handled;
+    return vips_heifsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "lossless", FALSE,
+        NULL);
+}
+
+// AVIF is libheif's AV1 path; no platform encoder writes it. AV1 costs
+// several times what HEVC does, so the fixed presets run the encoder near
+// its fastest speed (aom cpu-used 7) with 4:2:0 chroma, which keeps a phone
+// CPU within about twice WebP's encode time.
+#define AVIF_FAST_EFFORT 2
+
+static int save_avif(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    return vips_heifsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1,
+        "effort", thinpic_thermal_effort(AVIF_FAST_EFFORT, 0),
+        "subsample_mode", VIPS_FOREIGN_SUBSAMPLE_ON,
+        "lossless", FALSE,
+        NULL);
+}
+
+static int save_jp2k(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    return vips_jp2ksave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "lossless", FALSE,
+        NULL);
+}
+
+static int save_jxl(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    if (settings->distance > 0) {
+        return vips_jxlsave_target(image, target,
+            "keep", metadata_keep(),
+            "distance", settings->distance,
+            "lossless", FALSE,
+            NULL);
+    }
+    return vips_jxlsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", settings->quality,
+        "lossless", FALSE,
+        NULL);
+}
+
+static int save_gif(VipsImage* image, VipsTarget* target, const FormatSettings* settings) {
+    // GIF has no quality setting
+    return gif_save_target(image, settings->gif, target);
+}
+
+static const FormatDescriptor format_table[THINPIC_FORMAT_COUNT] = {
+    [FORMAT_JPEG] = {"jpegsave_target", FORMAT_CAP_EIGHT_BIT | FORMAT_CAP_STREAMING, save_jpeg},
+    [FORMAT_PNG] = {"pngsave_target", FORMAT_CAP_ALPHA | FORMAT_CAP_LOSSLESS | FORMAT_CAP_STREAMING, save_png},
+    [FORMAT_WEBP] = {"webpsave_target",
+                     FORMAT_CAP_ALPHA | FORMAT_CAP_ANIMATION | FORMAT_CAP_EIGHT_BIT | FORMAT_CAP_STREAMING, save_webp},
+    [FORMAT_TIFF] = {"tiffsave_target", FORMAT_CAP_ALPHA, save_tiff},
+    [FORMAT_HEIF] = {"heifsave_target", FORMAT_CAP_ALPHA, save_heif},
+    [FORMAT_AVIF] = {"heifsave_target", FORMAT_CAP_ALPHA, save_avif},
+    [FORMAT_JP2K] = {"jp2ksave_target", FORMAT_CAP_ALPHA, save_jp2k},
+    [FORMAT_JXL] = {"jxlsave_target", FORMAT_CAP_ALPHA, save_jxl},
+    [FORMAT_GIF] = {NULL, FORMAT_CAP_ALPHA | FORMAT_CAP_ANIMATION | FORMAT_CAP_LOSSLESS | FORMAT_CAP_EIGHT_BIT |
+                    FORMAT_CAP_INDEXED, save_gif},
+};
+
+// Whether format (a concrete one) has every capability in caps
+static int format_has(ImageFormat format, unsigned int caps) {
+    return thinpic_concrete_format(format) && (format_table[format].caps & caps) == caps;
+}
+
+// JPEG and other formats without alpha get it flattened before the save
+static int format_flattens(ImageFormat format) {
+    return thinpic_concrete_format(format) && !format_has(format, FORMAT_CAP_ALPHA);
+}
+
+static int format_save(VipsImage* image, ImageFormat format, const FormatSettings* settings, VipsTarget* target) {
+    if (!thinpic_concrete_format(format) || !format_table[format].save) {
+        THINPIC_LOGE("Error: Unsupported format %d", format);
+        return -1;
+    }
+    return format_table[format].save(image, target, settings);
+}
+
+static pthread_once_t avif_probe_once = PTHREAD_ONCE_INIT;
+static int avif_encoder = 0;
+
+// heifsave is there whenever libheif is, often with an HEVC encoder only;
+// one tiny AV1 encode tells whether AVIF can be written
+static void probe_avif_encoder(void) {
+    VipsImage* probe = NULL;
+    if (vips_type_find("VipsOperation", "heifsave_buffer") &&
+            vips_black(&probe, 16, 16, "bands", 3, NULL) == 0) {
+        void* buffer = NULL;
+        size_t length = 0;
+        avif_encoder = vips_heifsave_buffer(probe, &buffer, &length,
+            "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1,
+            "effort", 0,
+            NULL) == 0 && length > 0;
+        g_free(buffer);
+        g_object_unref(probe);
+    }
+    vips_error_clear();
+    THINPIC_LOGI("AV1 encoder for AVIF %s", avif_encoder ? "available" : "missing");
+}
+
+// Whether this build can write format: the platform encoder, the saver
+// compiled into this libvips or one written here. Checked before the
+// decode, so a missing encoder fails at once instead of after the work.
+static int format_available(ImageFormat format) {
+    if (format == FORMAT_AVIF) {
+        pthread_once(&avif_probe_once, probe_avif_encoder);
+        return avif_encoder;
+    }
+    if (thinpic_imageio_available(format)) return 1;
+    if (!thinpic_concrete_format(format) || !format_table[format].save) return 0;
+    const char* saver = format_table[format].saver;
+    // Savers written here (GIF: thinpic_gif.c) are always there
+    if (!saver) return 1;
+    return vips_type_find("VipsOperation", saver) != 0;
+}
+
+// format_save into a new buffer (free with g_free), taken over from the
+// memory target the way vips_*save_buffer does
+static int format_save_buffer(VipsImage* image, ImageFormat format, const FormatSettings* settings,
+                              void** buffer, size_t* length) {
+    VipsTarget* target = vips_target_new_to_memory();
+    VipsBlob* blob = NULL;
+    int failed = format_save(image, format, settings, target);
+    if (!failed) g_object_get(target, "blob", &blob, NULL);
+    g_object_unref(target);
+    if (failed || !blob) return -1;
+    VipsArea* area = VIPS_AREA(blob);
+    *buffer = area->data;
+    *length = area->length;
+    area->free_fn = NULL;
+    vips_area_unref(area);
+    return 0;
+}
+
+// vips_resize "gap" for the resize_quality setting: libvips box-shrinks by
+// the largest integer that leaves at least gap x the output size, and only
+// that residual goes through the kernel
+static double resize_gap(void) {
+    switch (__atomic_load_n(&runtime_config.resize_quality, __ATOMIC_RELAXED)) {
+        case THINPIC_RESIZE_FAST:
+            return 1.0;
+        case THINPIC_RESIZE_BEST:
+            return 4.0;
+        default:
+            return 2.0;
+    }
+}
+
+// thinpic_configure deterministic: nothing that shapes the output may
+// depend on timing, the thread grant or which device runs the job
+static int deterministic_output(void) {
+    return __atomic_load_n(&runtime_config.deterministic, __ATOMIC_RELAXED);
+}
+
+// vips_resize, or the GPU stage for Lanczos3 downscales of images of at
+// least gpu_resize_min_mp megapixels (thinpic_configure). The GPU's rounding
+// is the driver's, and a busy context falls back to the CPU, so deterministic
+// output always takes vips_resize.
+static int resize_image(VipsImage* image, VipsImage** out, double scale, VipsKernel kernel) {
+    int64_t min_mp = __atomic_load_n(&runtime_config.gpu_resize_min_mp, __ATOMIC_RELAXED);
+    if (deterministic_output()) min_mp = 0;
+    int64_t pixels = (int64_t)vips_image_get_width(image) * vips_image_get_height(image);
+    if (min_mp > 0 && kernel == VIPS_KERNEL_LANCZOS3 && scale < 1.0 && pixels >= min_mp * 1000000 &&
+        thinpic_gpu_resize(image, out, scale) == 0) {
+        return 0;
+    }
+    int failed = vips_resize(image, out, scale, "kernel", kernel, "gap", resize_gap(), NULL);
+    if (failed) thinpic_error_code(THINPIC_ERROR_PROCESS);
+    return failed;
+}
+
+int thinpic_resize(VipsImage* image, VipsImage** out, double scale, VipsKernel kernel) {
+    return resize_image(image, out, scale, kernel);
+}
+
+// Input helpers: every pipeline reads through a ThinpicInput so the same code
+// serves file paths and in-memory encoded images
+
+static ImageFormat format_from_loader(const char* loader);
+static double monotonic_ms(void);
+static VipsImage* resize_frames(VipsImage* image, const ThinpicOptions* options);
+
+static ThinpicInput path_input(const char* input_path) {
+    ThinpicInput input = {.path = input_path, .fd = -1};
+    return input;
+}
+
+static int input_is_descriptor(const ThinpicInput* input) {
+    return !input->data && !input->path && !input->image;
+}
+
+static int input_valid(const ThinpicInput* input) {
+    int valid;
+    if (!input) {
+        valid = 0;
+    } else if (input->image) {
+        valid = 1;
+    } else if (input->data) {
+        valid = input->length > 0;
+    } else if (input->path) {
+        valid = strlen(input->path) > 0;
+    } else {
+        valid = input->fd >= 0;
+    }
+    if (!valid) thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+    return valid;
+}
+
+// Encoded size in bytes (0 for pipes), or -1 if the input cannot be read
+static long input_size(const ThinpicInput* input) {
+    if (input->data) return (long)input->length;
+    if (input->image) return 0;
+    
+    struct stat file_stat;
+    int failed = input->path ? stat(input->path, &file_stat) : fstat(input->fd, &file_stat);
+    if (failed != 0) return -1;
+    return S_ISREG(file_stat.st_mode) ? (long)file_stat.st_size : 0;
+}
+
+static const char* input_name(const ThinpicInput* input) {
+    if (input->path) return input->path;
+    if (input->image) return "<pixels>";
+    return input->data ? "<memory>" : "<descriptor>";
+}
+
+// A read-only file mapping standing in for a path input, or the embedded
+// JPEG preview standing in for a RAW one
+typedef struct {
+    void* address;
+    size_t length;
+    uint8_t* preview;
+} MappedInput;
+
+// Swap a RAW input of any kind for its embedded full-size JPEG preview
+// (thinpic_raw.c), and a large path input for an mmap of the file
+// (thinpic_configure mmap_input_min_mb), so the decoder reads straight from
+// the page cache and the kernel can drop clean pages under memory pressure.
+// The path stays set for logging; input is left untouched when neither
+// applies or mapping fails.
+static void map_path_input(ThinpicInput* input, MappedInput* mapping) {
+    mapping->address = NULL;
+    mapping->length = 0;
+    size_t preview_length = 0;
+    mapping->preview = input->page > 0 ? NULL : thinpic_raw_preview(input, &preview_length);
+    if (mapping->preview) {
+        input->data = mapping->preview;
+        input->length = preview_length;
+        input->fd = -1;
+        return;
+    }
+    if (!input->path || input->data) return;
+    
+    int64_t min_bytes = (int64_t)__atomic_load_n(&runtime_config.mmap_input_min_mb, __ATOMIC_RELAXED) * 1024 * 1024;
+    if (min_bytes <= 0) return;
+    
+    int fd = open(input->path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size < min_bytes) {
+        close(fd);
+        return;
+    }
+    
+    void* address = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping keeps the file referenced
+    if (address == MAP_FAILED) {
+        THINPIC_LOGW("mmap failed for %s, using buffered reads", input->path);
+        return;
+    }
+    madvise(address, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+    
+    mapping->address = address;
+    mapping->length = (size_t)file_stat.st_size;
+    input->data = address;
+    input->length = mapping->length;
+    THINPIC_LOGD("Mapped %s (%zu bytes)", input->path, mapping->length);
+}
+
+static void unmap_path_input(MappedInput* mapping) {
+    if (mapping->address) {
+        munmap(mapping->address, mapping->length);
+        mapping->address = NULL;
+    }
+    g_free(mapping->preview);
+    mapping->preview = NULL;
+}
+
+// Every VipsSource made from a descriptor shares its file offset, and the
+// loaders assume a fresh source starts at byte 0; seek the caller's fd back
+// first. Returns 0 for pipes and sockets, which can only be read once.
+static int rewind_descriptor(int fd) {
+    return lseek(fd, 0, SEEK_SET) == 0;
+}
+
+// FORMAT_AUTO resolution: the sniffed container (the extension for paths
+// whose signature is unknown), PNG or JPEG by alpha for raw pixels
+static ImageFormat detect_input_format(const ThinpicInput* input) {
+    if (input->image) {
+        return vips_image_hasalpha(input->image) ? FORMAT_PNG : FORMAT_JPEG;
+    }
+    if (input->path && !input->data) {
+        return detect_format_from_path(input->path);
+    }
+    ImageFormat sniffed = input->data ? thinpic_sniff_format(input->data, input->length)
+                                      : thinpic_sniff_descriptor(input->fd);
+    if (sniffed != FORMAT_AUTO) return sniffed;
+    if (!ensure_vips_initialized()) {
+        return FORMAT_JPEG;
+    }
+    const char* loader = NULL;
+    if (input->data) {
+        loader = vips_foreign_find_load_buffer(input->data, input->length);
+    } else if (rewind_descriptor(input->fd)) {
+        // Sniffing a pipe would consume the bytes the decoder needs
+        VipsSource* source = vips_source_new_from_descriptor(input->fd);
+        if (source) {
+            loader = vips_foreign_find_load_source(source);
+            g_object_unref(source);
         }
-        vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
     }
-    
-    // Validate image object
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object\n");
+    vips_error_clear();
+    ImageFormat format = format_from_loader(loader);
+    return format == FORMAT_AUTO ? FORMAT_JPEG : format;
+}
+
+// Open the pipeline root; a cancelled pool job kills it (thinpic_cancel.c).
+// Loaders read sequentially unless access asks for random reads.
+static VipsImage* open_input_image_with(const ThinpicInput* input, VipsAccess access) {
+    // HEIC and AVIF the platform decodes (thinpic_imagedecoder.c) arrive as pixels
+    VipsImage* image = input->page > 0 ? NULL : thinpic_platform_decode(input);
+    // A later page of a multi-page TIFF or PDF; loaders without pages ignore it
+    char page_options[32] = "";
+    if (input->page > 0) snprintf(page_options, sizeof(page_options), "page=%d", input->page);
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_OPEN);
+    if (image) {
+        // Decoded upright, in sRGB and within the input limits
+    } else if (input->image) {
+        // A copy, so a cancelled job kills its own pipeline and not the input's
+        if (vips_copy(input->image, &image, NULL)) image = NULL;
+    } else if (input->data) {
+        image = vips_image_new_from_buffer(input->data, input->length, page_options,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", access,
+            NULL);
+    } else if (input_is_descriptor(input)) {
+        rewind_descriptor(input->fd);
+        VipsSource* source = vips_source_new_from_descriptor(input->fd);
+        if (!source) {
+            thinpic_stage_end(THINPIC_STAGE_OPEN, started);
+            return NULL;
+        }
+        image = vips_image_new_from_source(source, page_options,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", access,
+            NULL);
+        g_object_unref(source);
+    } else if (input->page > 0) {
+        gchar* filename = g_strdup_printf("%s[%s]", input->path, page_options);
+        image = vips_image_new_from_file(filename,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", access,
+            NULL);
+        g_free(filename);
+    } else {
+        // The signature picks the loader, so libvips does not open the file
+        // once per loader it asks
+        const char* loader = thinpic_sniffed_loader(sniff_path(input->path));
+        if (loader) {
+            if (vips_call(loader, input->path, &image,
+                    "fail_on", VIPS_FAIL_ON_NONE,
+                    "access", access,
+                    NULL)) {
+                image = NULL;
+            }
+        } else {
+            image = vips_image_new_from_file(input->path, 
+                "fail_on", VIPS_FAIL_ON_NONE,
+                "access", access,
+                NULL);
+        }
+    }
+    thinpic_stage_end(THINPIC_STAGE_OPEN, started);
+    // The header is all libvips has read so far
+    if (image && !thinpic_input_allowed(image)) {
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        return NULL;
+    }
+    if (!image) thinpic_error_code(THINPIC_ERROR_DECODE);
+    if (image) thinpic_stage_source(vips_image_get_width(image), vips_image_get_height(image));
+    image = thinpic_threads_limit(image);
+    image = thinpic_cancel_watch_shared(image);
+    thinpic_progress_watch(image);
+    return image;
+}
+
+static VipsImage* open_input_image(const ThinpicInput* input) {
+    return open_input_image_with(input, VIPS_ACCESS_SEQUENTIAL);
+}
+
+// Inputs about to be rendered at full size anyway: a large JPEG whose
+// restart intervals allow it is decoded on the job's threads
+// (thinpic_jpeg_parallel.c) instead of by jpegload on one. A frame that
+// would spill to disc keeps the sequential load. Takes image; returns it,
+// or the decoded frame with its metadata.
+static VipsImage* decode_in_parallel(const ThinpicInput* input, VipsImage* image) {
+    const char* loader = NULL;
+    if (input->image || !vips_image_get_typeof(image, VIPS_META_LOADER) ||
+            vips_image_get_string(image, VIPS_META_LOADER, &loader) != 0 ||
+            format_from_loader(loader) != FORMAT_JPEG ||
+            thinpic_spills((int64_t)VIPS_IMAGE_SIZEOF_IMAGE(image))) {
+        return image;
+    }
+    int bound = thinpic_threads_bound();
+    VipsImage* decoded = thinpic_jpeg_parallel_decode(input, image, bound > 0 ? bound : vips_concurrency_get());
+    if (!decoded) return image;
+    g_object_unref(image);
+    // Not thinpic_threads_limit: its copy would be rendered a second time
+    if (bound > 0) vips_image_set_int(decoded, VIPS_META_CONCURRENCY, bound);
+    thinpic_cancel_watch(decoded);
+    thinpic_progress_watch(decoded);
+    return decoded;
+}
+
+// Decode straight to (about) the target box. vips_thumbnail passes a "shrink"
+// factor to the JPEG/WebP/HEIF loaders so they downscale while decoding
+// instead of producing full-resolution pixels for vips_resize.
+// Returns NULL on failure so callers can fall back to vips_resize.
+// With a crop the image covers the box instead and vips_smartcrop cuts it
+// to size on the shrunk pixels; EXIF orientation is applied first so the
+// box is upright, and nothing is upscaled.
+static VipsImage* thumbnail_on_load(const ThinpicInput* input, int box_width, int box_height,
+                                    VipsInteresting crop) {
+    VipsImage* thumbnail = NULL;
+    VipsSize size = crop == VIPS_INTERESTING_NONE ? VIPS_SIZE_BOTH : VIPS_SIZE_DOWN;
+    int no_rotate = crop == VIPS_INTERESTING_NONE;
+    int failed;
+    
+    // Raw pixels have no loader to shrink in, the platform decoder produces
+    // the full image, and vips_thumbnail opens the first page
+    if (box_width <= 0 || box_height <= 0 || input->image || input->page > 0 ||
+            thinpic_platform_decodes(input)) {
+        return NULL;
+    }
+    
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_RESIZE);
+    if (input_is_descriptor(input)) {
+        // The already-open image reads through the same file offset, so a
+        // second source would corrupt its fallback decode. Reopen the file
+        // itself instead (regular files on Linux/Android only).
+        struct stat file_stat;
+        if (fstat(input->fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
+            return NULL;
+        }
+        char fd_path[32];
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", input->fd);
+        int reopened = open(fd_path, O_RDONLY);
+        if (reopened < 0) {
+            thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
+            return NULL;
+        }
+        VipsSource* source = vips_source_new_from_descriptor(reopened);
+        close(reopened);
+        if (!source) {
+            vips_error_clear();
+            thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
+            return NULL;
+        }
+        failed = vips_thumbnail_source(source, &thumbnail, box_width,
+            "height", box_height,
+            "size", size,
+            "crop", crop,
+            "no_rotate", no_rotate,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            NULL);
+        g_object_unref(source);
+    } else if (input->data) {
+        failed = vips_thumbnail_buffer((void*)input->data, input->length, &thumbnail, box_width,
+            "height", box_height,
+            "size", size,
+            "crop", crop,
+            "no_rotate", no_rotate,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            NULL);
+    } else {
+        failed = vips_thumbnail(input->path, &thumbnail, box_width,
+            "height", box_height,
+            "size", size,
+            "crop", crop,
+            "no_rotate", no_rotate,  // Fits keep pixels as stored; orientation stays in EXIF like the resize path
+            "fail_on", VIPS_FAIL_ON_NONE,
+            NULL);
     }
+    thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
     
-    // Get image info
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    int bands = vips_image_get_bands(image);
-    
-    printf("[image_compressor] Image loaded: %dx%d, %d bands\n", width, height, bands);
-    
-    // Validate image dimensions
-    if (width <= 0 || height <= 0 || bands <= 0) {
-        printf("[image_compressor] Error: Invalid image dimensions\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    if (failed) {
+        THINPIC_LOGW("Shrink-on-load failed, falling back to full decode");
+        log_vips_error();
+        return NULL;
     }
     
-    // Compression strategy based on dimensions only
-    int new_width = width;
-    int new_height = height;
-    int needs_resize = 0;
+    THINPIC_LOGD("Shrink-on-load decoded at %dx%d (crop %d)",
+           vips_image_get_width(thumbnail), vips_image_get_height(thumbnail), crop);
+    thumbnail = thinpic_threads_limit(thumbnail);
+    thumbnail = thinpic_cancel_watch_shared(thumbnail);
+    thinpic_progress_watch(thumbnail);
+    return thumbnail;
+}
+
+static VipsImage* shrink_on_load(const ThinpicInput* input, int box_width, int box_height) {
+    return thumbnail_on_load(input, box_width, box_height, VIPS_INTERESTING_NONE);
+}
+
+// EXIF orientation from the header; libvips parses it into "orientation"
+static int read_orientation(VipsImage* image) {
+    int orientation = 0;
+    if (vips_image_get_typeof(image, VIPS_META_ORIENTATION) &&
+            vips_image_get_int(image, VIPS_META_ORIENTATION, &orientation) == 0) {
+        return orientation;
+    }
     
-    // Resize if largest dimension > 6000px
-    const int max_dimension = 6000;
-    if (width > max_dimension || height > max_dimension) {
-        needs_resize = 1;
-        if (width > height) {
-            new_width = max_dimension;
-            new_height = (int)((double)height * max_dimension / width);
-        } else {
-            new_height = max_dimension;
-            new_width = (int)((double)width * max_dimension / height);
+    const char* orientation_str = NULL;
+    if (vips_image_get_typeof(image, "exif-ifd0-Orientation") &&
+            vips_image_get_string(image, "exif-ifd0-Orientation", &orientation_str) == 0 &&
+            orientation_str) {
+        return atoi(orientation_str);
+    }
+    return 0;
+}
+
+// vips_image_copy_memory timed as the decode stage: rendering is where a
+// lazily opened image is actually decoded. Large renders go to disc
+// (thinpic_spill.c).
+static VipsImage* decode_to_memory(VipsImage* image) {
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_DECODE);
+    double start = monotonic_ms();
+    // Frames already in memory (a parallel JPEG decode) are not decoded here
+    int decodes = thinpic_needs_render(image);
+    VipsImage* memory = thinpic_render_random_access(image);
+    if (!memory) thinpic_error_code(THINPIC_ERROR_DECODE);
+    const char* loader = NULL;
+    if (memory && decodes && vips_image_get_typeof(image, VIPS_META_LOADER) &&
+            vips_image_get_string(image, VIPS_META_LOADER, &loader) == 0) {
+        thinpic_budget_record_decode(format_from_loader(loader), vips_image_get_width(memory),
+                                     vips_image_get_height(memory), monotonic_ms() - start);
+    }
+    thinpic_stage_end(THINPIC_STAGE_DECODE, started);
+    return memory;
+}
+
+// Orientation policy shared by every path that puts EXIF orientation into
+// the pixels: it runs after any shrink-on-load or resize, on the small image,
+// and an upright image (orientation 1 or none) skips vips_autorot and its
+// copy. Every orientation but the plain mirror (2) reads its source bottom
+// up or column by column, which a sequential loader refuses with an "out
+// of order read" once the encoder pulls; such a source is rendered first,
+// like vips_thumbnail does, so only this stage pays for random access and
+// the load stays sequential. Returns 0 with *out holding a reference.
+static int orient_upright(VipsImage* image, VipsImage** out) {
+    int orientation = read_orientation(image);
+    if (orientation <= 1) {
+        g_object_ref(image);
+        *out = image;
+        return 0;
+    }
+    if (orientation == 2 || !thinpic_needs_render(image)) return vips_autorot(image, out, NULL);
+    VipsImage* rendered = decode_to_memory(image);
+    if (!rendered) return -1;
+    int failed = vips_autorot(rendered, out, NULL);
+    g_object_unref(rendered);
+    return failed;
+}
+
+int thinpic_orientation(VipsImage* image) {
+    return read_orientation(image);
+}
+
+int thinpic_orient_upright(VipsImage* image, VipsImage** out) {
+    return orient_upright(image, out);
+}
+
+// Last step before the legacy pipelines save: policies that drop EXIF apply
+// its orientation to the pixels first (like thinpic_compress), then the
+// image is converted to sRGB
+static int prepare_output(VipsImage* image, VipsImage** out) {
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_COLOUR);
+    int failed;
+    VipsImage* rotated = NULL;
+    if (thinpic_metadata_policy() == THINPIC_STRIP_NONE) {
+        failed = thinpic_to_srgb(image, out);
+    } else if (orient_upright(image, &rotated)) {
+        vips_error_clear();
+        failed = thinpic_to_srgb(image, out);
+    } else {
+        failed = thinpic_to_srgb(rotated, out);
+        g_object_unref(rotated);
+    }
+    thinpic_stage_end(THINPIC_STAGE_COLOUR, started);
+    if (failed) thinpic_error_code(THINPIC_ERROR_PROCESS);
+    return failed;
+}
+
+// Formats whose savers take 8 bits per sample
+static int eight_bit_format(ImageFormat format) {
+    return format_has(format, FORMAT_CAP_EIGHT_BIT);
+}
+
+// 16-bit and HDR images narrowed once, on the resized image, for the formats
+// that store 8 bits anyway; the colour transform and flattening then run on
+// half the bytes. Returns a new reference either way (the image as it was
+// when it needs no change or the conversion fails).
+static VipsImage* narrow_depth(VipsImage* image, ImageFormat format) {
+    VipsImage* narrowed = NULL;
+    if (!eight_bit_format(format)) {
+        g_object_ref(image);
+        return image;
+    }
+    int changed = thinpic_to_8bit(image, &narrowed);
+    if (changed < 0) vips_error_clear();
+    if (changed <= 0) {
+        g_object_ref(image);
+        return image;
+    }
+    return narrowed;
+}
+
+VipsImage* thinpic_decode_to_memory(VipsImage* image) {
+    return decode_to_memory(image);
+}
+
+// Size curves searched on prefiltered pixels are kept apart from plain ones
+#define ADAPTIVE_CURVE_VARIANT 0x100
+// High smart compression used to search a 1.3x upscale; its curves differ
+#define HIGH_NATIVE_CURVE_VARIANT 0x200
+
+static int adaptive_quality(ImageFormat format) {
+    return (format == FORMAT_JPEG || format == FORMAT_WEBP) &&
+           __atomic_load_n(&runtime_config.adaptive_quality, __ATOMIC_RELAXED);
+}
+
+// thinpic_configure adaptive_quality: the memory image a target-size search
+// encodes, with its flat regions low-passed (thinpic_saliency.c). Takes
+// image; returns it unchanged when the option is off or the filter does not
+// apply.
+static VipsImage* adaptive_search_image(VipsImage* image, ImageFormat format) {
+    if (!adaptive_quality(format)) return image;
+    VipsImage* filtered = NULL;
+    int status = thinpic_saliency_prefilter(image, &filtered);
+    // Not decode_to_memory: this is filter time, not the loader's
+    VipsImage* memory = status == 1 ? thinpic_render_random_access(filtered) : NULL;
+    if (filtered) g_object_unref(filtered);
+    if (!memory) {
+        if (status != 0) {
+            THINPIC_LOGW("Saliency prefilter failed, searching the unfiltered image: %s", vips_error_buffer());
+            vips_error_clear();
         }
-        printf("[image_compressor] Resizing from %dx%d to %dx%d\n", width, height, new_width, new_height);
+        return image;
     }
-    
-    // Process image (resize if needed and convert to sRGB)
-    vips_error_clear();
-    
-    if (needs_resize) {
-        printf("[image_compressor] Resizing image with high quality...\n");
-        double scale = 1.0;
-        if (width > height) {
-            scale = (double)max_dimension / width;
-        } else {
-            scale = (double)max_dimension / height;
+    g_object_unref(image);
+    return memory;
+}
+
+// thinpic_configure coefficient_search: a target-size JPEG search over a
+// JPEG whose pixels the search pipeline would leave alone (same size, no
+// rotation, no colour profile to convert from, no saliency prefilter) runs
+// on its DCT coefficients (thinpic_jpeg_requantize_search), so a probe is
+// one entropy-coding pass instead of a decode, colour conversion and
+// forward DCT. image is the opened, undecoded input. Returns the quality
+// left in arena, -1 when none in the range fits, or -2 when the pixel
+// search must run.
+static int coefficient_search(const ThinpicInput* input, VipsImage* image, int min_quality, int max_quality,
+                              int full_chroma, size_t lower, size_t upper, EncodeArena* arena, int* encodes) {
+    const char* loader = NULL;
+    if (!__atomic_load_n(&runtime_config.coefficient_search, __ATOMIC_RELAXED) || adaptive_quality(FORMAT_JPEG) ||
+            input->image || (!input->data && !input->path) ||
+            !vips_image_get_typeof(image, VIPS_META_LOADER) ||
+            vips_image_get_string(image, VIPS_META_LOADER, &loader) != 0 ||
+            format_from_loader(loader) != FORMAT_JPEG || vips_image_get_typeof(image, VIPS_META_ICC_NAME) ||
+            (thinpic_metadata_policy() != THINPIC_STRIP_NONE && read_orientation(image) > 1)) {
+        return -2;
+    }
+    int traced = thinpic_trace_begin("thinpic coefficient search Q%d-%d", min_quality, max_quality);
+    int quality = thinpic_jpeg_requantize_search(input, min_quality, max_quality, full_chroma, lower, upper,
+                                                 arena, encodes);
+    thinpic_trace_end(traced);
+    return quality;
+}
+
+// g_malloc'd copy of the whole encoded input (regular files only)
+static uint8_t* read_input_bytes(const ThinpicInput* input, size_t length) {
+    if (input->data) return (uint8_t*)g_memdup2(input->data, length);
+    if (input->path) {
+        gchar* contents = NULL;
+        gsize read = 0;
+        if (!g_file_get_contents(input->path, &contents, &read, NULL) || read != length) {
+            g_free(contents);
+            return NULL;
         }
-        
-        printf("[image_compressor] Scale factor: %f\n", scale);
-        
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LANCZOS3,  // High-quality kernel
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
-            vips_error_clear();
-            
-            // Try to compress original image without resizing
-            printf("[image_compressor] Trying to compress original image without resizing...\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+        return (uint8_t*)contents;
+    }
+    uint8_t* bytes = (uint8_t*)g_try_malloc(length);
+    size_t done = 0;
+    while (bytes && done < length) {
+        ssize_t chunk = pread(input->fd, bytes + done, length - done, (off_t)done);
+        if (chunk <= 0) {
+            g_free(bytes);
+            return NULL;
         }
+        done += (size_t)chunk;
+    }
+    return bytes;
+}
+
+// thinpic_configure skip_compliant: when the input is already in `format`,
+// at most max_bytes (0 = any size) and inside the box (sides 0 do not
+// constrain), hand back the original bytes with no decode or encode. Only
+// the header is parsed. The original keeps all of its metadata, so any
+// metadata_policy but STRIP_NONE re-encodes. Returns 1 with result filled,
+// 0 to run the pipeline.
+static int skip_compliant_input(const ThinpicInput* input, ImageFormat format, long max_bytes,
+                                int box_width, int box_height, CompressedImageResult* result) {
+    if (!__atomic_load_n(&runtime_config.skip_compliant, __ATOMIC_RELAXED)) return 0;
+    if (thinpic_metadata_policy() != THINPIC_STRIP_NONE) return 0;
+    
+    // Pipes have no size and could not be read again for the pipeline
+    long size = input_size(input);
+    if (size <= 0 || (max_bytes > 0 && size > max_bytes)) return 0;
+    
+    VipsImage* header = open_input_image(input);
+    if (!header) {
+        vips_error_clear();
+        return 0;
+    }
+    const char* loader = NULL;
+    if (vips_image_get_typeof(header, VIPS_META_LOADER)) {
+        vips_image_get_string(header, VIPS_META_LOADER, &loader);
+    }
+    ImageFormat source_format = format_from_loader(loader);
+    int width = vips_image_get_width(header);
+    int height = vips_image_get_height(header);
+    g_object_unref(header);
+    if (source_format != format || (box_width > 0 && width > box_width) ||
+            (box_height > 0 && height > box_height)) {
+        return 0;
+    }
+    
+    uint8_t* bytes = read_input_bytes(input, (size_t)size);
+    if (!bytes) return 0;
+    result->data = bytes;
+    result->length = (size_t)size;
+    result->success = 1;
+    THINPIC_LOGI("Input already compliant (%dx%d, %ld bytes, format %d), returned unchanged",
+                 width, height, size, format);
+    return 1;
+}
+
+// Pipeline engine behind the fixed-preset entry points (compress_image and
+// its size/format variants, the large and DSLR modes and fast WebP). Each
+// mode is a Pipeline: an ordered list of steps run on the lazily loaded
+// image, then one save. Every fit step first tries shrink-on-load, so a
+// change to the load, resize or save path applies to every mode at once.
+typedef enum {
+    PIPELINE_FIT_LONGEST = 0,    // Scale the longer side to `size`
+    PIPELINE_FIT_TARGET = 1,     // Scale to width x height (aspect kept; one side may be 0)
+    PIPELINE_SRGB = 2            // prepare_output; GIF output keeps its colours
+} PipelineOp;
+
+typedef struct {
+    PipelineOp op;
+    int size;                    // FIT_LONGEST
+    int only_larger;             // FIT_LONGEST: leave images already within size alone
+    int width;                   // FIT_TARGET; this step also upscales
+    int height;
+    VipsKernel kernel;           // Fallback resize when shrink-on-load cannot apply
+} PipelineStep;
+
+// Encoder settings the entry points were tuned with
+typedef enum {
+    SAVE_PRESET_STANDARD = 0,    // PNG compression falls as quality rises; WebP effort 2
+    SAVE_PRESET_LARGE = 1,       // PNG compression rises with quality; WebP smart subsampling
+    SAVE_PRESET_FAST_WEBP = 2    // WebP effort 1, method 0
+} SavePreset;
+
+#define PIPELINE_MAX_STEPS 4
+
+typedef struct {
+    const char* name;            // Log label
+    ImageFormat format;          // FORMAT_AUTO follows the input
+    int quality;
+    SavePreset preset;
+    int skip_compliant;          // Honour thinpic_configure skip_compliant, boxed by the first fit step
+    int gif_needs_colour;        // Refuse GIF output for gray images
+    int step_count;
+    PipelineStep steps[PIPELINE_MAX_STEPS];
+} Pipeline;
+
+static PipelineStep fit_longest(int size, int only_larger, VipsKernel kernel) {
+    PipelineStep step = {PIPELINE_FIT_LONGEST, size, only_larger, 0, 0, kernel};
+    return step;
+}
+
+static PipelineStep fit_target(int width, int height) {
+    PipelineStep step = {PIPELINE_FIT_TARGET, 0, 0, width, height, VIPS_KERNEL_LANCZOS3};
+    return step;
+}
+
+static PipelineStep srgb_step(void) {
+    PipelineStep step = {PIPELINE_SRGB, 0, 0, 0, 0, VIPS_KERNEL_LANCZOS3};
+    return step;
+}
+
+
+// Output size of a fit step; returns 0 when the step leaves the image as is
+static int fit_size(const PipelineStep* step, int width, int height, int* new_width, int* new_height) {
+    double scale;
+    if (step->op == PIPELINE_FIT_LONGEST) {
+        if (step->only_larger && width <= step->size && height <= step->size) return 0;
+        scale = (double)step->size / (width > height ? width : height);
+    } else if (step->width > 0 && step->height > 0) {
+        double scale_x = (double)step->width / width;
+        double scale_y = (double)step->height / height;
+        scale = scale_x < scale_y ? scale_x : scale_y;
+    } else if (step->width > 0) {
+        scale = (double)step->width / width;
+    } else if (step->height > 0) {
+        scale = (double)step->height / height;
+    } else {
+        return 0;
+    }
+    *new_width = (int)(width * scale);
+    *new_height = (int)(height * scale);
+    if (step->op == PIPELINE_FIT_TARGET && step->width > 0 && step->height <= 0) *new_width = step->width;
+    if (step->op == PIPELINE_FIT_TARGET && step->height > 0 && step->width <= 0) *new_height = step->height;
+    if (*new_width < 1) *new_width = 1;
+    if (*new_height < 1) *new_height = 1;
+    return *new_width != width || *new_height != height;
+}
+
+// Runs one step on *image, replacing it; returns 0 on success
+static int run_step(const ThinpicInput* input, const Pipeline* pipeline, const PipelineStep* step,
+                    int* decoded_once, VipsImage** image) {
+    VipsImage* out = NULL;
+    if (step->op == PIPELINE_SRGB) {
+        if (format_has(pipeline->format, FORMAT_CAP_INDEXED)) return 0;
+        VipsImage* narrowed = narrow_depth(*image, pipeline->format);
+        int failed = prepare_output(narrowed, &out);
+        g_object_unref(narrowed);
+        if (failed) {
+            THINPIC_LOGE("Error: Failed to convert image to sRGB");
+            log_vips_error();
+            return -1;
+        }
+    } else {
+        int width = vips_image_get_width(*image);
+        int height = vips_image_get_height(*image);
+        int new_width = width;
+        int new_height = height;
+        if (!fit_size(step, width, height, &new_width, &new_height)) return 0;
+        double scale = (double)new_width / width;
+        THINPIC_LOGD("%s: resizing %dx%d to %dx%d (scale %f)", pipeline->name, width, height,
+                     new_width, new_height, scale);
+        // Decoding at the target size only works on the image as loaded
+        if (scale < 1.0 && !*decoded_once) {
+            out = shrink_on_load(input, new_width, new_height);
+        }
+        if (!out && resize_image(*image, &out, scale, step->kernel)) {
+            THINPIC_LOGE("Error: Failed to resize image");
+            log_vips_error();
+            return -1;
+        }
+        if (vips_image_get_width(out) <= 0 || vips_image_get_height(out) <= 0) {
+            THINPIC_LOGE("Error: Invalid dimensions after resize");
+            g_object_unref(out);
+            return -1;
+        }
+    }
+    *decoded_once = 1;
+    g_object_unref(*image);
+    *image = out;
+    return 0;
+}
+
+static int save_preset_buffer(VipsImage* image, ImageFormat format, int quality, SavePreset preset,
+                              void** buffer, size_t* length) {
+    FormatSettings settings = format_settings(quality);
+    switch (preset) {
+        case SAVE_PRESET_LARGE:
+            settings.compression = png_level((quality * 9) / 100);
+            settings.smart_subsample = 1;
+            // thinpic_configure jpeg_strip_encode (thinpic_jpeg_strips.c); once
+            // strips have been rendered the sequential source cannot be read
+            // again, so only an image it turns down is saved the usual way.
+            // Whether it takes one depends on the thread grant, so
+            // deterministic output never uses it.
+            if (format == FORMAT_JPEG && __atomic_load_n(&runtime_config.jpeg_strip_encode, __ATOMIC_RELAXED) &&
+                    !deterministic_output()) {
+                int bound = thinpic_threads_bound();
+                int saved = thinpic_jpeg_strip_save(image, quality, metadata_keep(),
+                                                    bound > 0 ? bound : vips_concurrency_get(), buffer, length);
+                if (saved != 0) return saved > 0 ? 0 : -1;
+            }
+            break;
+        case SAVE_PRESET_FAST_WEBP:
+            settings.effort = thinpic_thermal_effort(1, 0);
+            break;
+        default:
+            settings.effort = thinpic_thermal_effort(2, 0);
+            break;
+    }
+    return format_save_buffer(image, format, &settings, buffer, length);
+}
+
+// Bands before the encode. An image in memory whose pixels are all grey
+// becomes one band (thinpic_grey.c) and one whose alpha is opaque
+// everywhere loses that band (thinpic_alpha.c); JPEG then flattens what
+// alpha is left onto the thinpic_configure background. GIF keeps its
+// colours. Takes ownership; NULL on failure.
+static VipsImage* prepare_bands(VipsImage* image, ImageFormat format) {
+    VipsImage* out = NULL;
+    int changed = format_has(format, FORMAT_CAP_INDEXED) ? 0 : thinpic_to_grey(image, &out);
+    if (changed != 0) {
         g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
-        
-        // Get new dimensions
-        width = vips_image_get_width(image);
-        height = vips_image_get_height(image);
-        printf("[image_compressor] Image resized to: %dx%d\n", width, height);
-        
-        // Validate resized image
-        if (width <= 0 || height <= 0) {
-            printf("[image_compressor] Error: Invalid dimensions after resize\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+        if (changed < 0) return NULL;
+        image = out;
+        out = NULL;
+    }
+    changed = thinpic_drop_opaque_alpha(image, &out);
+    if (changed == 0 && format_flattens(format)) {
+        changed = thinpic_flatten_alpha(image, &out);
+    }
+    if (changed == 0) return image;
+    g_object_unref(image);
+    return changed > 0 ? out : NULL;
+}
+
+// What the image after a pipeline's steps depends on besides the file
+typedef struct {
+    int32_t step_count;
+    int32_t keeps_colours;       // GIF output skips the sRGB step
+    int32_t metadata_policy;     // prepare_output autorotates unless THINPIC_STRIP_NONE
+    int32_t resize_quality;
+    int32_t lossless_orientation;
+    int32_t narrows_depth;       // JPEG, WebP and GIF output narrow 16-bit input
+    int32_t dither_high_depth;
+    int32_t page;
+    PipelineStep steps[PIPELINE_MAX_STEPS];
+} DecodeParams;
+
+// Key for thinpic_decode_cache; 0 when the cache is off or the input is not
+// a regular file named by path
+static int pipeline_decode_key(const ThinpicInput* input, const Pipeline* pipeline, ThinpicCacheKey* key) {
+    DecodeParams params;
+    memset(&params, 0, sizeof(params));
+    params.step_count = pipeline->step_count;
+    params.keeps_colours = format_has(pipeline->format, FORMAT_CAP_INDEXED);
+    params.metadata_policy = thinpic_metadata_policy();
+    params.resize_quality = __atomic_load_n(&runtime_config.resize_quality, __ATOMIC_RELAXED);
+    params.lossless_orientation = __atomic_load_n(&runtime_config.lossless_orientation, __ATOMIC_RELAXED);
+    params.narrows_depth = eight_bit_format(pipeline->format);
+    params.dither_high_depth = __atomic_load_n(&runtime_config.dither_high_depth, __ATOMIC_RELAXED);
+    params.page = input->page;
+    memcpy(params.steps, pipeline->steps, (size_t)pipeline->step_count * sizeof(PipelineStep));
+    return thinpic_decode_cache_key(input->path, &params, sizeof(params), key);
+}
+
+static void free_with_image(VipsImage* image, gpointer data) {
+    (void)image;
+    g_free(data);
+}
+
+// thinpic_configure lossless_orientation: a JPEG that no fit step resizes
+// would otherwise be rotated at full resolution by prepare_output, and a
+// transposing rotation of a sequentially read JPEG renders the whole image
+// first. Turn it upright in the DCT domain instead (libjpeg rearranges the
+// coefficient blocks, trimming at most 15 px of partial blocks on a mirrored
+// edge) and decode the upright copy, which reads straight through. Takes
+// image; returns it, or the upright replacement.
+static VipsImage* upright_jpeg(const ThinpicInput* input, const Pipeline* pipeline, VipsImage* image) {
+    if (!__atomic_load_n(&runtime_config.lossless_orientation, __ATOMIC_RELAXED) ||
+            thinpic_metadata_policy() == THINPIC_STRIP_NONE || input->image || read_orientation(image) <= 1) {
+        return image;
+    }
+    const char* loader = NULL;
+    if (!vips_image_get_typeof(image, VIPS_META_LOADER) ||
+            vips_image_get_string(image, VIPS_META_LOADER, &loader) != 0 ||
+            format_from_loader(loader) != FORMAT_JPEG) {
+        return image;
+    }
+    // Any resize makes the rotation cheap again, and a box checked against
+    // the stored size must not see the upright one
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    for (int i = 0; i < pipeline->step_count; i++) {
+        const PipelineStep* step = &pipeline->steps[i];
+        int new_width, new_height;
+        if (step->op != PIPELINE_SRGB && (fit_size(step, width, height, &new_width, &new_height) ||
+                                          fit_size(step, height, width, &new_width, &new_height))) {
+            return image;
         }
     }
-    
-    // Convert to sRGB for consistent color space (except for GIF which should remain as-is)
-    if (format != FORMAT_GIF) {
-        printf("[image_compressor] Converting image to sRGB...\n");
+
+    CompressedImageResult upright = thinpic_jpeg_upright(input);
+    if (upright.success != 1) {
         vips_error_clear();
-        if (vips_copy(image, &processed_image, 
-                "interpretation", VIPS_INTERPRETATION_sRGB,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to convert image to sRGB\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
-            vips_error_clear();
-            
-            // Try to compress without sRGB conversion
-            printf("[image_compressor] Trying to compress image without sRGB conversion...\n");
+        return image;
+    }
+    ThinpicInput upright_input = {.data = upright.data, .length = upright.length, .fd = -1};
+    VipsImage* opened = open_input_image(&upright_input);
+    if (!opened) {
+        log_vips_error();
+        g_free(upright.data);
+        return image;
+    }
+    g_signal_connect(opened, "postclose", G_CALLBACK(free_with_image), upright.data);
+    THINPIC_LOGD("Upright in the DCT domain: %dx%d -> %dx%d", width, height,
+                 vips_image_get_width(opened), vips_image_get_height(opened));
+    g_object_unref(image);
+    return opened;
+}
+
+// Load the input and run the pipeline's steps; NULL on failure
+static VipsImage* decode_pipeline(const ThinpicInput* input, const Pipeline* pipeline) {
+    vips_error_clear();
+    VipsImage* image = open_input_image(input);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to load image: %s", input_name(input));
+        log_vips_error();
+        return NULL;
+    }
+    image = upright_jpeg(input, pipeline, image);
+    if (vips_image_get_width(image) <= 0 || vips_image_get_height(image) <= 0 || vips_image_get_bands(image) <= 0) {
+        THINPIC_LOGE("Error: Invalid image dimensions");
+        g_object_unref(image);
+        return NULL;
+    }
+    THINPIC_LOGD("Image loaded: %dx%d, %d bands", vips_image_get_width(image),
+                 vips_image_get_height(image), vips_image_get_bands(image));
+    
+    int decoded_once = 0;
+    for (int i = 0; i < pipeline->step_count; i++) {
+        if (run_step(input, pipeline, &pipeline->steps[i], &decoded_once, &image)) {
             g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+            return NULL;
         }
-        
-        g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
     }
+    return image;
+}
+
+// Render a decoded pipeline image and hand it to thinpic_decode_cache when it
+// fits the budget; an image too large stays lazy and streams into the encoder
+// as before. Takes ownership and returns the image to encode.
+static VipsImage* keep_decoded(const ThinpicCacheKey* key, VipsImage* image) {
+    if ((int64_t)VIPS_IMAGE_SIZEOF_IMAGE(image) > thinpic_decode_cache_budget()) return image;
+    VipsImage* memory = decode_to_memory(image);
+    if (!memory) {
+        vips_error_clear();
+        return image;
+    }
+    g_object_unref(image);
+    thinpic_decode_cache_store(key, memory);
+    return memory;
+}
+
+static CompressedImageResult run_pipeline(const ThinpicInput* input, const Pipeline* spec) {
+    CompressedImageResult result = {NULL, 0, -1};
+    thinpic_error_reset();
     
-    // Validate final image before compression
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image after processing\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
+    if (!input_valid(input)) {
+        THINPIC_LOGE("Error: Invalid input path");
+        return result;
+    }
+    if (spec->quality < 1 || spec->quality > 100) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Quality must be between 1 and 100");
         return result;
     }
+    Pipeline pipeline = *spec;
+    if (pipeline.format == FORMAT_AUTO) {
+        pipeline.format = detect_input_format(input);
+        THINPIC_LOGD("Auto-detected format: %d", pipeline.format);
+    }
+    THINPIC_LOGD("%s: %s (size: %ld bytes, quality: %d, format: %d)", pipeline.name, input_name(input),
+                 input_size(input), pipeline.quality, pipeline.format);
     
-    int final_width = vips_image_get_width(image);
-    int final_height = vips_image_get_height(image);
-    int final_bands = vips_image_get_bands(image);
-    printf("[image_compressor] Final image: %dx%d, %d bands\n", final_width, final_height, final_bands);
+    if (!ensure_vips_initialized()) {
+        THINPIC_LOGE("Error: VIPS initialization failed");
+        return result;
+    }
+    if (!format_available(pipeline.format)) {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: No encoder for format %d in this build", pipeline.format);
+        return result;
+    }
     
-    // Compression with format-specific settings
-    printf("[image_compressor] Starting compression with format %d...\n", format);
-    vips_error_clear();
+    if (pipeline.skip_compliant && pipeline.step_count > 0 && pipeline.steps[0].op != PIPELINE_SRGB) {
+        const PipelineStep* fit = &pipeline.steps[0];
+        int box_width = fit->op == PIPELINE_FIT_LONGEST ? fit->size : fit->width;
+        int box_height = fit->op == PIPELINE_FIT_LONGEST ? fit->size : fit->height;
+        if (skip_compliant_input(input, pipeline.format, 0, box_width, box_height, &result)) {
+            return result;
+        }
+    }
     
-    int save_result = -1;
+    int pipeline_locked = pipeline_lock();
     
-    switch (format) {
-        case FORMAT_JPEG:
-            save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "optimize_coding", TRUE,
-                "interlace", FALSE,
-                "no_subsample", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_PNG:
-            // PNG quality is 0-9, convert from 1-100
-            // For better compression, use higher compression levels for lower quality
-            int png_quality = 9 - ((quality * 9) / 100);
-            if (png_quality < 0) png_quality = 0;
-            if (png_quality > 9) png_quality = 9;
-            
-            save_result = vips_pngsave_buffer(image, &buffer, &buffer_size,
-                "compression", png_quality,
-                "interlace", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_WEBP:
-            save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                "near_lossless", FALSE,
-                "smart_subsample", FALSE,  // Disable for faster compression
-                "strip", FALSE,  // Keep orientation data
-                "effort", 2,     // Lower effort for faster compression (0-6, default is 4)
-                NULL);
-            break;
-            
-        case FORMAT_TIFF:
-            save_result = vips_tiffsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
-                "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_HEIF:
-            save_result = vips_heifsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_JP2K:
-            save_result = vips_jp2ksave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_JXL:
-            save_result = vips_jxlsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_GIF:
-            // GIF doesn't support quality, use default settings
-            save_result = vips_gifsave_buffer(image, &buffer, &buffer_size,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        default:
-            printf("[image_compressor] Error: Unsupported format %d\n", format);
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+    ThinpicCacheKey decode_key;
+    int cacheable = pipeline_decode_key(input, &pipeline, &decode_key);
+    VipsImage* image = cacheable ? thinpic_decode_cache_lookup(&decode_key) : NULL;
+    if (!image) {
+        image = decode_pipeline(input, &pipeline);
+        if (image && cacheable) image = keep_decoded(&decode_key, image);
+    }
+    if (!image) {
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
+    image = prepare_bands(image, pipeline.format);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to prepare the image bands");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return result;
     }
     
+    void* buffer = NULL;
+    size_t buffer_size = 0;
+    int save_result = -1;
+    vips_error_clear();
+    if (pipeline.format == FORMAT_GIF && pipeline.gif_needs_colour && vips_image_get_bands(image) < 3) {
+        THINPIC_LOGE("Error: GIF output needs a colour image");
+    } else {
+        save_result = save_preset_buffer(image, pipeline.format, pipeline.quality, pipeline.preset,
+                                         &buffer, &buffer_size);
+    }
     if (save_result == 0 && buffer && buffer_size > 0) {
-        // Compression successful
         result.data = (uint8_t*)buffer;
         result.length = buffer_size;
         result.success = 1;
-        printf("[image_compressor] Compression successful: %zu bytes (format: %d, quality: %d)\n", 
-               buffer_size, format, quality);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    // Compression failed
-    printf("[image_compressor] Error: Compression failed for format %d\n", format);
-    const char* error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+        THINPIC_LOGI("%s successful: %zu bytes (%dx%d, format: %d, quality: %d)", pipeline.name, buffer_size,
+                     vips_image_get_width(image), vips_image_get_height(image), pipeline.format, pipeline.quality);
+    } else {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: %s failed for format %d", pipeline.name, pipeline.format);
+        log_vips_error();
+        g_free(buffer);
     }
     
-    // Cleanup
+    g_object_unref(image);
+    pipeline_unlock(pipeline_locked);
+    return result;
+}
+
+// Thread-safe image compression function optimized for DSLR images
+static CompressedImageResult compress_image_from_input(const ThinpicInput* input, int quality) {
+    // Images over the preset's cap (6000 px built in) are brought down to it
+    Pipeline pipeline = {"Compression", FORMAT_JPEG, quality, SAVE_PRESET_STANDARD, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->max_dimension, 1, VIPS_KERNEL_LANCZOS3), srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_image(const char* input_path, int quality) {
+    ThinpicInput input = path_input(input_path);
+    return compress_image_from_input(&input, quality);
+}
+
+// Thread-safe image compression function with format support
+static CompressedImageResult compress_image_with_format_from_input(const ThinpicInput* input, int quality, ImageFormat format) {
+    Pipeline pipeline = {"Compression", format, quality, SAVE_PRESET_STANDARD, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->max_dimension, 1, VIPS_KERNEL_LANCZOS3), srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_image_with_format(const char* input_path, int quality, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    return compress_image_with_format_from_input(&input, quality, format);
+}
+
+// Thread-safe image compression function with optional size parameters
+static CompressedImageResult compress_image_with_size_from_input(const ThinpicInput* input, int quality, int target_width, int target_height) {
+    // A target is met exactly, up or down; without one the preset's cap applies
+    PipelineStep fit = target_width > 0 || target_height > 0 ? fit_target(target_width, target_height)
+                                                             : fit_longest(thinpic_tuning()->max_dimension, 1,
+                                                                           VIPS_KERNEL_LANCZOS3);
+    Pipeline pipeline = {"Sized compression", FORMAT_JPEG, quality, SAVE_PRESET_STANDARD, 0, 0, 2,
+                         {fit, srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_image_with_size(const char* input_path, int quality, int target_width, int target_height) {
+    ThinpicInput input = path_input(input_path);
+    return compress_image_with_size_from_input(&input, quality, target_width, target_height);
+}
+
+// Thread-safe image compression function with size parameters and format support
+static CompressedImageResult compress_image_with_size_and_format_from_input(const ThinpicInput* input, int quality, int target_width, int target_height, ImageFormat format) {
+    PipelineStep fit = target_width > 0 || target_height > 0 ? fit_target(target_width, target_height)
+                                                             : fit_longest(thinpic_tuning()->max_dimension, 1,
+                                                                           VIPS_KERNEL_LANCZOS3);
+    Pipeline pipeline = {"Sized compression", format, quality, SAVE_PRESET_STANDARD, 1, 1, 2,
+                         {fit, srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_image_with_size_and_format(const char* input_path, int quality, int target_width, int target_height, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    return compress_image_with_size_and_format_from_input(&input, quality, target_width, target_height, format);
+}
+
+// Function to free the compressed buffer (thread-safe)
+void free_compressed_buffer(uint8_t* buffer) {
     if (buffer) {
         g_free(buffer);
+        THINPIC_LOGD("Buffer freed");
+    }
+}
+
+// Function to shutdown VIPS (call this when app is closing)
+void shutdown_vips() {
+    pthread_mutex_lock(&vips_mutex);
+    if (vips_initialized) {
+        thinpic_decode_cache_drain();
+        vips_shutdown();
+        __atomic_store_n(&vips_initialized, 0, __ATOMIC_RELEASE);
+        thinpic_arena_drain();
+        thinpic_colour_drain();
+        thinpic_gpu_drain();
+        THINPIC_LOGI("VIPS shutdown");
     }
-    g_object_unref(image);
-    vips_error_clear();
-    
     pthread_mutex_unlock(&vips_mutex);
-    return result;
 }
 
-// Thread-safe image compression function with optional size parameters
-CompressedImageResult compress_image_with_size(const char* input_path, int quality, int target_width, int target_height) {
-    CompressedImageResult result = {NULL, 0, -1};
+// Simple test function to verify VIPS is working
+int test_vips_basic() {
+    THINPIC_LOGD("Testing basic VIPS functionality...");
     
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
-        return result;
+    // Initialize VIPS
+    if (!ensure_vips_initialized()) {
+        THINPIC_LOGD("Test failed: VIPS initialization");
+        return -1;
     }
     
-    if (quality < 1 || quality > 100) {
-        printf("[image_compressor] Error: Quality must be between 1 and 100\n");
-        return result;
-    }
+    int pipeline_locked = pipeline_lock();
     
-    // Check if file exists and get file size
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        printf("[image_compressor] Error: Cannot open file: %s\n", input_path);
-        return result;
-    }
+    // Try to create a simple 1x1 image
+    VipsImage* test_image = NULL;
+    vips_error_clear();
     
-    // Get file size to determine compression strategy
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fclose(file);
+    if (vips_black(&test_image, 1, 1, NULL)) {
+        THINPIC_LOGD("Test failed: Cannot create test image");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return -1;
+    }
     
-    printf("[image_compressor] Compressing image: %s (size: %ld bytes, quality: %d, target: %dx%d)\n", 
-           input_path, file_size, quality, target_width, target_height);
+    // Try to save it as JPEG
+    void* buffer = NULL;
+    size_t buffer_size = 0;
     
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
-        return result;
+    if (vips_jpegsave_buffer(test_image, &buffer, &buffer_size, NULL)) {
+        THINPIC_LOGD("Test failed: Cannot save test image");
+        log_vips_error();
+        g_object_unref(test_image);
+        pipeline_unlock(pipeline_locked);
+        return -1;
     }
     
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Clear any previous errors
-    vips_error_clear();
+    THINPIC_LOGI("Test successful: Created and saved %zu bytes", buffer_size);
     
-    VipsImage* image = NULL;
-    VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
+    // Cleanup
+    g_free(buffer);
+    g_object_unref(test_image);
+    pipeline_unlock(pipeline_locked);
     
-    // Load image with error handling
-    printf("[image_compressor] Loading image...\n");
-    image = vips_image_new_from_file(input_path, 
+    return 0;
+}
+
+// Function to get image information
+// Map the loader libvips picked onto our ImageFormat values
+static ImageFormat format_from_loader(const char* loader) {
+    if (!loader) return FORMAT_AUTO;
+    if (strncmp(loader, "jpegload", 8) == 0) return FORMAT_JPEG;
+    if (strncmp(loader, "pngload", 7) == 0) return FORMAT_PNG;
+    if (strncmp(loader, "webpload", 8) == 0) return FORMAT_WEBP;
+    if (strncmp(loader, "tiffload", 8) == 0) return FORMAT_TIFF;
+    if (strncmp(loader, "heifload", 8) == 0) return FORMAT_HEIF;
+    if (strncmp(loader, "jp2kload", 8) == 0) return FORMAT_JP2K;
+    if (strncmp(loader, "jxlload", 7) == 0) return FORMAT_JXL;
+    if (strncmp(loader, "gifload", 7) == 0) return FORMAT_GIF;
+    return FORMAT_AUTO;
+}
+
+// Open just the header: vips_image_new_from_file is lazy, so this parses the
+// container and metadata without starting a pixel pipeline
+static VipsImage* open_header(const char* input_path) {
+    VipsImage* image = vips_image_new_from_file(input_path, 
         "fail_on", VIPS_FAIL_ON_NONE,
         "access", VIPS_ACCESS_SEQUENTIAL,
         NULL);
     
     if (!image) {
-        printf("[image_compressor] Error: Failed to load image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
-        }
-        vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    // Validate image object
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
-    }
-    
-    // Get image info
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    int bands = vips_image_get_bands(image);
-    
-    printf("[image_compressor] Image loaded: %dx%d, %d bands\n", width, height, bands);
-    
-    // Validate image dimensions
-    if (width <= 0 || height <= 0 || bands <= 0) {
-        printf("[image_compressor] Error: Invalid image dimensions\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        THINPIC_LOGE("Error: Failed to read image header: %s", input_path);
+        log_vips_error();
     }
+    return image;
+}
+
+// ImageInfo from an opened image's header
+static ImageInfo image_info(VipsImage* image) {
+    ImageInfo info = {0, 0, 0, 0, 0, 0, 0};
+    info.width = vips_image_get_width(image);
+    info.height = vips_image_get_height(image);
+    info.bands = vips_image_get_bands(image);
+    info.orientation = read_orientation(image);
     
-    // Calculate resize parameters
-    int new_width = width;
-    int new_height = height;
-    int needs_resize = 0;
-    double scale = 1.0;
+    // Check if image needs resizing (largest side over the preset's cap)
+    const int max_dimension = thinpic_tuning()->max_dimension;
     
-    // Check if user provided target dimensions
-    if (target_width > 0 || target_height > 0) {
-        needs_resize = 1;
-        
-        if (target_width > 0 && target_height > 0) {
-            // Both dimensions provided - use the smallest to maintain aspect ratio
-            double scale_width = (double)target_width / width;
-            double scale_height = (double)target_height / height;
-            
-            if (scale_width < scale_height) {
-                // Width is the limiting factor
-                scale = scale_width;
-                new_width = target_width;
-                new_height = (int)(height * scale_width);
-            } else {
-                // Height is the limiting factor
-                scale = scale_height;
-                new_height = target_height;
-                new_width = (int)(width * scale_height);
-            }
-            printf("[image_compressor] Both dimensions provided, using smallest scale: %f\n", scale);
-        } else if (target_width > 0) {
-            // Only width provided
-            scale = (double)target_width / width;
-            new_width = target_width;
-            new_height = (int)(height * scale);
-            printf("[image_compressor] Only width provided, calculated height: %d\n", new_height);
+    if (info.width > max_dimension || info.height > max_dimension) {
+        info.needs_resize = 1;
+        if (info.width > info.height) {
+            // Landscape image
+            info.new_width = max_dimension;
+            info.new_height = (int)((double)info.height * max_dimension / info.width);
         } else {
-            // Only height provided
-            scale = (double)target_height / height;
-            new_height = target_height;
-            new_width = (int)(width * scale);
-            printf("[image_compressor] Only height provided, calculated width: %d\n", new_width);
-        }
-        
-        printf("[image_compressor] Resizing from %dx%d to %dx%d (scale: %f)\n", 
-               width, height, new_width, new_height, scale);
-    } else {
-        // No target dimensions provided - use original logic for large images
-        const int max_dimension = 6000;
-        if (width > max_dimension || height > max_dimension) {
-            needs_resize = 1;
-            if (width > height) {
-                scale = (double)max_dimension / width;
-                new_width = max_dimension;
-                new_height = (int)(height * scale);
-            } else {
-                scale = (double)max_dimension / height;
-                new_height = max_dimension;
-                new_width = (int)(width * scale);
-            }
-            printf("[image_compressor] Large image auto-resize from %dx%d to %dx%d\n", 
-                   width, height, new_width, new_height);
+            // Portrait or square image
+            info.new_height = max_dimension;
+            info.new_width = (int)((double)info.width * max_dimension / info.height);
         }
     }
     
-    // Process image (resize if needed and convert to sRGB)
-    vips_error_clear();
+    THINPIC_LOGD("Image info: %dx%d, %d bands, orientation: %d, needs_resize: %d", 
+           info.width, info.height, info.bands, info.orientation, info.needs_resize);
+    return info;
+}
+
+ImageInfo get_image_info(const char* input_path) {
+    ImageInfo info = {0, 0, 0, 0, 0, 0, 0};
     
-    if (needs_resize) {
-        printf("[image_compressor] Resizing image with high quality...\n");
-        
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LANCZOS3,  // High-quality kernel
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
-            vips_error_clear();
-            
-            // Try to compress original image without resizing
-            printf("[image_compressor] Trying to compress original image without resizing...\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
-        g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
-        
-        // Get new dimensions
-        width = vips_image_get_width(image);
-        height = vips_image_get_height(image);
-        printf("[image_compressor] Image resized to: %dx%d\n", width, height);
-        
-        // Validate resized image
-        if (width <= 0 || height <= 0) {
-            printf("[image_compressor] Error: Invalid dimensions after resize\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
+    // Input validation
+    if (!input_path || strlen(input_path) == 0) {
+        THINPIC_LOGE("Error: Invalid input path for info");
+        return info;
     }
     
-    // Convert to sRGB for consistent color space
-    printf("[image_compressor] Converting image to sRGB...\n");
-    vips_error_clear();
-    if (vips_copy(image, &processed_image, 
-            "interpretation", VIPS_INTERPRETATION_sRGB,
-            NULL)) {
-        printf("[image_compressor] Error: Failed to convert image to sRGB\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
-        }
-        vips_error_clear();
-        
-        // Try to compress without sRGB conversion
-        printf("[image_compressor] Trying to compress image without sRGB conversion...\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    // Initialize VIPS (thread-safe)
+    if (!ensure_vips_initialized()) {
+        return info;
     }
     
-    g_object_unref(image);
-    image = processed_image;
-    processed_image = NULL;
-    
-    // Validate final image before compression
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image after processing\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    // Header reads touch no shared pipeline state, so no pipeline lock
+    VipsImage* image = open_header(input_path);
+    if (!image) {
+        return info;
     }
     
-    int final_width = vips_image_get_width(image);
-    int final_height = vips_image_get_height(image);
-    int final_bands = vips_image_get_bands(image);
-    printf("[image_compressor] Final image: %dx%d, %d bands\n", final_width, final_height, final_bands);
+    info = image_info(image);
     
-    // Compression with user-specified quality
-    printf("[image_compressor] Starting compression...\n");
-    vips_error_clear();
+    // Cleanup
+    g_object_unref(image);
     
-    // Use user-specified quality
-    int final_quality = quality;
-    printf("[image_compressor] Using quality: %d\n", final_quality);
+    return info;
+}
+
+ImageHeader probe_image_header(const char* input_path) {
+    ImageHeader header = {0, 0, 0, 0, FORMAT_AUTO, 0, -1};
     
-    // Enhanced JPEG save options for better compression
-    int save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-        "Q", final_quality,
-        // "strip", TRUE,
-        "optimize_coding", TRUE,
-        "interlace", FALSE,  // Better for most images
-        "no_subsample", FALSE, // Allow subsampling for better compression
-        NULL);
+    // stat doubles as the existence check and gives the file size
+    struct stat file_stat;
+    if (!input_path || strlen(input_path) == 0 || stat(input_path, &file_stat) != 0) {
+        THINPIC_LOGE("Error: Cannot probe file: %s", input_path ? input_path : "(null)");
+        return header;
+    }
     
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        // Compression successful
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Compression successful: %zu bytes (quality: %d)\n", buffer_size, final_quality);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    if (!ensure_vips_initialized()) {
+        return header;
     }
     
-    // If enhanced compression failed, try standard approach
-    printf("[image_compressor] Enhanced compression failed, trying standard approach...\n");
-    const char* error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+    VipsImage* image = open_header(input_path);
+    if (!image) {
+        return header;
     }
-    vips_error_clear();
     
-    // Free any existing buffer
-    if (buffer) {
-        g_free(buffer);
-        buffer = NULL;
-        buffer_size = 0;
+    const char* loader = NULL;
+    if (vips_image_get_typeof(image, VIPS_META_LOADER)) {
+        vips_image_get_string(image, VIPS_META_LOADER, &loader);
     }
     
-    // Try with standard quality
-    save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-        "Q", quality,
-        // "strip", TRUE,
-        NULL);
+    header.width = vips_image_get_width(image);
+    header.height = vips_image_get_height(image);
+    header.bands = vips_image_get_bands(image);
+    header.orientation = read_orientation(image);
+    header.format = format_from_loader(loader);
+    header.file_size = (int64_t)file_stat.st_size;
+    header.success = 1;
     
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Standard compression successful: %zu bytes\n", buffer_size);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    g_object_unref(image);
+    return header;
+}
+
+int probe_page_count(const char* input_path) {
+    if (!input_path || strlen(input_path) == 0 || !ensure_vips_initialized()) {
+        THINPIC_LOGE("Error: Cannot count pages of: %s", input_path ? input_path : "(null)");
+        return -1;
     }
-    
-    // All compression attempts failed
-    printf("[image_compressor] Error: All compression attempts failed\n");
-    error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+    VipsImage* image = open_header(input_path);
+    if (!image) {
+        return -1;
+    }
+    int pages = vips_image_get_n_pages(image);
+    g_object_unref(image);
+    return pages;
+}
+
+int probe_image_headers(const char** input_paths, int count, ImageHeader* out) {
+    if (!input_paths || count <= 0 || !out) {
+        THINPIC_LOGE("Error: Invalid probe arguments");
+        return -1;
     }
     
-    // Cleanup
-    if (buffer) {
-        g_free(buffer);
+    int succeeded = 0;
+    for (int i = 0; i < count; i++) {
+        out[i] = probe_image_header(input_paths[i]);
+        if (out[i].success == 1) succeeded++;
+    }
+    return succeeded;
+}
+
+// Function to handle very large images by creating a smaller version
+static CompressedImageResult compress_large_image_from_input(const ThinpicInput* input, int quality) {
+    // The large modes always fit the longer side to the preset's cap
+    Pipeline pipeline = {"Large image compression", FORMAT_JPEG, quality, SAVE_PRESET_LARGE, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->max_dimension, 0, VIPS_KERNEL_LANCZOS3), srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_large_image(const char* input_path, int quality) {
+    ThinpicInput input = path_input(input_path);
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    CompressedImageResult result = compress_large_image_from_input(&input, quality);
+    unmap_path_input(&mapping);
+    return result;
+}
+
+// Function to handle very large DSLR images by creating a smaller version
+static CompressedImageResult compress_large_dslr_image_from_input(const ThinpicInput* input, int quality) {
+    Pipeline pipeline = {"Large DSLR image compression", FORMAT_JPEG, quality, SAVE_PRESET_LARGE, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->max_dimension, 0, VIPS_KERNEL_LANCZOS3), srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_large_dslr_image(const char* input_path, int quality) {
+    ThinpicInput input = path_input(input_path);
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    CompressedImageResult result = compress_large_dslr_image_from_input(&input, quality);
+    unmap_path_input(&mapping);
+    return result;
+}
+
+// Quality predictor for the target-size search. A small copy of the image is
+// encoded at a few qualities, and its sizes scaled by the pixel ratio give a
+// bytes-per-quality curve for the full image. Small copies carry more detail
+// per pixel, so every full encode recalibrates the curve; the search then
+// usually lands in the window within one or two full-resolution encodes.
+// Samples from the curve cache are full-size measurements and replace the
+// probes altogether.
+#define SIZE_PROBE_PIXELS (512 * 512)
+#define SIZE_PROBE_POINTS 5
+#define SIZE_PROBE_GUESSES 2        // Predicted encodes before falling back to bisection
+
+typedef struct {
+    int points;
+    int quality[THINPIC_CURVE_SAMPLES];
+    double bytes[THINPIC_CURVE_SAMPLES];  // Predicted full-size bytes
+    double calibration;               // Measured / predicted at the last full encode
+} SizeCurve;
+
+// full_chroma: 4:4:4 at every quality (libvips only turns subsampling off
+// from Q 90 by itself)
+static int jpeg_probe_encode(VipsImage* image, int quality, int full_chroma, EncodeArena* arena) {
+    VipsTarget* target = thinpic_arena_target(arena);
+    if (!target) return -1;
+    // Trellis costs each probe about twice the encode time and lets the
+    // search settle a few quality steps higher for the same bytes
+    JpegTuning tuning = jpeg_tuning(-1, -1, 0, THINPIC_QUANT_TABLE_DEFAULT, 1);
+    int save_result = vips_jpegsave_target(image, target,
+        "keep", metadata_keep(),
+        "Q", quality,
+        "optimize_coding", TRUE,
+        "subsample_mode", full_chroma ? VIPS_FOREIGN_SUBSAMPLE_OFF : VIPS_FOREIGN_SUBSAMPLE_AUTO,
+        "trellis_quant", tuning.trellis,
+        "overshoot_deringing", tuning.overshoot_deringing,
+        "quant_table", tuning.quant_table,
+        NULL);
+    g_object_unref(target);
+    return save_result == 0 && arena->length > 0 ? 0 : -1;
+}
+
+// 1 with curve filled; 0 when the image is too small for probing to beat
+// encoding it outright
+static int size_curve_build(VipsImage* image, int min_quality, int max_quality, int full_chroma,
+                            EncodeArena* arena, SizeCurve* curve) {
+    double pixels = (double)vips_image_get_width(image) * vips_image_get_height(image);
+    if (pixels < SIZE_PROBE_PIXELS * 4.0) return 0;
+    
+    VipsImage* scaled = NULL;
+    if (vips_resize(image, &scaled, sqrt(SIZE_PROBE_PIXELS / pixels), "kernel", VIPS_KERNEL_LINEAR, NULL)) {
+        vips_error_clear();
+        return 0;
+    }
+    VipsImage* probe = decode_to_memory(scaled);
+    g_object_unref(scaled);
+    if (!probe) {
+        vips_error_clear();
+        return 0;
+    }
+    double ratio = pixels / ((double)vips_image_get_width(probe) * vips_image_get_height(probe));
+    
+    int built = 1;
+    for (int i = 0; i < SIZE_PROBE_POINTS && built; i++) {
+        int quality = min_quality + (max_quality - min_quality) * i / (SIZE_PROBE_POINTS - 1);
+        built = jpeg_probe_encode(probe, quality, full_chroma, arena) == 0;
+        curve->quality[i] = quality;
+        curve->bytes[i] = arena->length * ratio;
+    }
+    g_object_unref(probe);
+    curve->points = SIZE_PROBE_POINTS;
+    curve->calibration = 1.0;
+    if (!built) vips_error_clear();
+    return built;
+}
+
+// 1 with curve filled from cached measurements (two or more)
+static int size_curve_from_samples(const ThinpicCurve* samples, SizeCurve* curve) {
+    if (samples->count < 2) return 0;
+    curve->points = samples->count;
+    for (int i = 0; i < samples->count; i++) {
+        curve->quality[i] = samples->setting[i];
+        curve->bytes[i] = samples->bytes[i] > 0 ? (double)samples->bytes[i] : 1.0;
+    }
+    curve->calibration = 1.0;
+    return 1;
+}
+
+// Curve bytes at quality, interpolated linearly in log(size)
+static double size_curve_bytes(const SizeCurve* curve, int quality) {
+    if (quality <= curve->quality[0]) return curve->bytes[0];
+    for (int i = 1; i < curve->points; i++) {
+        if (quality <= curve->quality[i]) {
+            double t = (double)(quality - curve->quality[i - 1]) / (curve->quality[i] - curve->quality[i - 1]);
+            return exp(log(curve->bytes[i - 1]) + t * (log(curve->bytes[i]) - log(curve->bytes[i - 1])));
+        }
+    }
+    return curve->bytes[curve->points - 1];
+}
+
+// Highest quality in [low, high] predicted to stay within target_bytes
+static int size_curve_quality(const SizeCurve* curve, double target_bytes, int low, int high) {
+    for (int quality = high; quality > low; quality--) {
+        if (size_curve_bytes(curve, quality) * curve->calibration <= target_bytes) return quality;
     }
-    g_object_unref(image);
-    vips_error_clear();
-    
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
+    return low;
 }
 
-// Thread-safe image compression function with size parameters and format support
-CompressedImageResult compress_image_with_size_and_format(const char* input_path, int quality, int target_width, int target_height, ImageFormat format) {
+// Smart compression function that targets a specific file size
+static CompressedImageResult smart_compress_image_from_input(const ThinpicInput* input, int target_kb, int type) {
     CompressedImageResult result = {NULL, 0, -1};
     
+    THINPIC_LOGD("Smart compression: %s (target: %d KB, type: %s)", 
+           input_name(input), target_kb, type == 1 ? "high" : "low");
+    
     // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
+    if (!input_valid(input)) {
+        THINPIC_LOGE("Error: Invalid input path");
         return result;
     }
     
-    if (quality < 1 || quality > 100) {
-        printf("[image_compressor] Error: Quality must be between 1 and 100\n");
+    if (target_kb <= 0) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid target KB");
         return result;
     }
     
-    // Auto-detect format if requested
-    if (format == FORMAT_AUTO) {
-        format = detect_format_from_path(input_path);
-        printf("[image_compressor] Auto-detected format: %d\n", format);
-    }
-    
-    // Check if file exists and get file size
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        printf("[image_compressor] Error: Cannot open file: %s\n", input_path);
+    // Check if file exists
+    if (input_size(input) < 0) {
+        THINPIC_LOGE("Error: Cannot open file: %s", input_name(input));
         return result;
     }
     
-    // Get file size to determine compression strategy
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fclose(file);
-    
-    printf("[image_compressor] Compressing image: %s (size: %ld bytes, quality: %d, target: %dx%d, format: %d)\n", 
-           input_path, file_size, quality, target_width, target_height, format);
-    
     // Initialize VIPS (thread-safe)
     if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
+        THINPIC_LOGE("Error: VIPS initialization failed");
         return result;
     }
     
+    if (skip_compliant_input(input, FORMAT_JPEG, (long)target_kb * 1024, 0, 0, &result)) {
+        return result;
+    }
+    
+    // Calculate size buffers (20% tolerance)
+    int up_size_buffer_kb = (int)(target_kb * 1.2);
+    int down_size_buffer_kb = (int)(target_kb * 0.8);
+    
+    THINPIC_LOGD("Target range: %d - %d KB", down_size_buffer_kb, up_size_buffer_kb);
+    
+    // Determine quality range based on type. High spends the budget at the
+    // native size: 4:4:4 chroma throughout and Q up to 100, where the
+    // standard tables reach all ones; scaling up by 1.3x to fill the window
+    // cost 1.7x the pixels in every probe and in memory.
+    int high = type == 1;
+    const ThinpicTuning* tuning = thinpic_tuning();
+    int start_quality = high ? 100 : tuning->search_start_quality;
+    int end_quality = tuning->search_end_quality;
+    
+    THINPIC_LOGD("Quality range: %d to %d (bisection)", start_quality, end_quality);
+    
     // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
+    int pipeline_locked = pipeline_lock();
     
-    // Clear any previous errors
     vips_error_clear();
     
     VipsImage* image = NULL;
     VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
     
-    // Load image with error handling
-    printf("[image_compressor] Loading image...\n");
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
+    // Load, prepare and decode once; every quality probe encodes the same pixels
+    image = open_input_image(input);
     
     if (!image) {
-        printf("[image_compressor] Error: Failed to load image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+        THINPIC_LOGE("Error: Failed to load image");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
+    
+    int requantize_probes = 0;
+    EncodeArena* requantized = thinpic_arena_acquire();
+    int requantized_quality = coefficient_search(input, image, end_quality, start_quality, high,
+                                                 (size_t)down_size_buffer_kb * 1024, (size_t)up_size_buffer_kb * 1024,
+                                                 requantized, &requantize_probes);
+    if (requantized_quality >= 0 && requantized->length / 1024 >= (size_t)down_size_buffer_kb) {
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
+        thinpic_stage_quality(requantized_quality);
+        result.data = thinpic_arena_copy(requantized);
+        if (result.data) {
+            result.length = requantized->length;
+            result.success = 1;
+            THINPIC_LOGI("✅ Smart compression success!");
+            THINPIC_LOGD("Final Quality: %d, Size: %zu KB (%d coefficient encodes)", requantized_quality,
+                         result.length / 1024, requantize_probes);
         }
-        vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
+        thinpic_arena_release(requantized);
         return result;
     }
+    thinpic_arena_release(requantized);
+    image = decode_in_parallel(input, image);
     
     // Validate image object
     if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object\n");
+        THINPIC_LOGE("Error: Invalid image object");
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
+        pipeline_unlock(pipeline_locked);
         return result;
     }
     
-    // Get image info
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    int bands = vips_image_get_bands(image);
-    
-    printf("[image_compressor] Image loaded: %dx%d, %d bands\n", width, height, bands);
-    
-    // Validate image dimensions
-    if (width <= 0 || height <= 0 || bands <= 0) {
-        printf("[image_compressor] Error: Invalid image dimensions\n");
+    // Convert to sRGB for consistent color space
+    vips_error_clear();
+    if (prepare_output(image, &processed_image)) {
+        THINPIC_LOGE("Error: Failed to convert to sRGB");
+        log_vips_error();
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
+        pipeline_unlock(pipeline_locked);
         return result;
     }
+    g_object_unref(image);
+    image = processed_image;
+    processed_image = NULL;
     
-    // Resize logic based on target dimensions
-    int needs_resize = 0;
-    int new_width = width;
-    int new_height = height;
+    // Render into memory so probes after the first never touch the file again
+    processed_image = decode_to_memory(image);
+    g_object_unref(image);
+    thinpic_cancel_watch(processed_image);
+    if (!processed_image) {
+        THINPIC_LOGE("Error: Failed to decode image into memory");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
+    image = prepare_bands(processed_image, FORMAT_JPEG);
+    processed_image = NULL;
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to prepare the image bands");
+        vips_error_clear();
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
+    image = adaptive_search_image(image, FORMAT_JPEG);
+    // Scanned once; every probe and the curve encode the same chroma
+    int full_chroma = high || thinpic_chroma_detail(image);
+    
+    // Search for a quality that lands in the window. With a size curve the
+    // first encodes go where it predicts the target; otherwise (and once
+    // the guesses run out) bisect for the highest quality that fits under
+    // the upper bound. JPEG size grows with Q, so bisection alone takes ~6
+    // encodes instead of up to 18.
+    int low = end_quality;
+    int top = start_quality;
+    int best_quality = -1;
+    int best_size_kb = 0;
+    int probes = 0;
+    
+    // Probes encode into a reused arena; a fitting probe swaps places with
+    // the best so far, so rejected candidates never touch the allocator
+    EncodeArena* probe_arena = thinpic_arena_acquire();
+    EncodeArena* best_arena = thinpic_arena_acquire();
+    
+    // Earlier runs on the same original know the full-size curve already
+    int variant = high ? type | HIGH_NATIVE_CURVE_VARIANT : type;
+    uint64_t cache_key = thinpic_curve_key(input, THINPIC_CURVE_SMART_JPEG, FORMAT_JPEG,
+                                           adaptive_quality(FORMAT_JPEG) ? variant | ADAPTIVE_CURVE_VARIANT : variant);
+    ThinpicCurve measured;
+    SizeCurve curve;
+    int predicted = thinpic_curve_lookup(cache_key, &measured) && size_curve_from_samples(&measured, &curve);
+    if (predicted) {
+        THINPIC_LOGD("Size curve from cache: %d samples", measured.count);
+    } else {
+        predicted = size_curve_build(image, end_quality, start_quality, full_chroma, probe_arena, &curve);
+    }
     
-    if (target_width > 0 && target_height > 0) {
-        // Both dimensions provided - use the smaller one to maintain aspect ratio
-        double scale_x = (double)target_width / width;
-        double scale_y = (double)target_height / height;
-        double scale = (scale_x < scale_y) ? scale_x : scale_y;
+    while (low <= top) {
+        if (thinpic_cancel_requested()) {
+            THINPIC_LOGI("Smart compression cancelled after %d encodes", probes);
+            break;
+        }
+        int quality = low + (top - low) / 2;
+        if (predicted && probes < SIZE_PROBE_GUESSES) {
+            quality = size_curve_quality(&curve, target_kb * 1024.0, low, top);
+        }
         
-        new_width = (int)(width * scale);
-        new_height = (int)(height * scale);
-        needs_resize = 1;
+        THINPIC_LOGD("Trying quality: %d", quality);
+        probes++;
         
-        printf("[image_compressor] Resizing to fit %dx%d: %dx%d -> %dx%d (scale: %f)\n", 
-               target_width, target_height, width, height, new_width, new_height, scale);
-    } else if (target_width > 0) {
-        // Only width provided
-        double scale = (double)target_width / width;
-        new_width = target_width;
-        new_height = (int)(height * scale);
-        needs_resize = 1;
+        vips_error_clear();
+        int traced = thinpic_trace_begin("thinpic smart probe Q%d", quality);
+        int save_result = jpeg_probe_encode(image, quality, full_chroma, probe_arena);
+        thinpic_trace_end(traced);
         
-        printf("[image_compressor] Resizing to width %d: %dx%d -> %dx%d (scale: %f)\n", 
-               target_width, width, height, new_width, new_height, scale);
-    } else if (target_height > 0) {
-        // Only height provided
-        double scale = (double)target_height / height;
-        new_width = (int)(width * scale);
-        new_height = target_height;
-        needs_resize = 1;
+        if (save_result != 0) {
+            THINPIC_LOGE("Error: Failed to compress with quality %d", quality);
+            log_vips_error();
+            break;
+        }
         
-        printf("[image_compressor] Resizing to height %d: %dx%d -> %dx%d (scale: %f)\n", 
-               target_height, width, height, new_width, new_height, scale);
-    } else {
-        // No target dimensions - use default max dimension logic
-        const int max_dimension = 6000;
-        if (width > max_dimension || height > max_dimension) {
-            needs_resize = 1;
-            if (width > height) {
-                new_width = max_dimension;
-                new_height = (int)((double)height * max_dimension / width);
-            } else {
-                new_height = max_dimension;
-                new_width = (int)((double)width * max_dimension / height);
-            }
-            printf("[image_compressor] Resizing from %dx%d to %dx%d (max dimension: %d)\n", 
-                   width, height, new_width, new_height, max_dimension);
+        int size_kb = (int)(probe_arena->length / 1024);
+        THINPIC_LOGD("Quality %d: %d KB", quality, size_kb);
+        thinpic_curve_add(&measured, quality, probe_arena->length);
+        if (predicted) {
+            curve.calibration = probe_arena->length / size_curve_bytes(&curve, quality);
+        }
+        
+        if (size_kb <= up_size_buffer_kb) {
+            // Fits; keep it and look for a higher quality that still fits
+            EncodeArena* swap = best_arena;
+            best_arena = probe_arena;
+            probe_arena = swap;
+            best_quality = quality;
+            best_size_kb = size_kb;
+            low = quality + 1;
+            // A predicted hit is already where the curve says the target is
+            if (predicted && size_kb >= down_size_buffer_kb) break;
+        } else {
+            top = quality - 1;
         }
     }
     
-    // Process image (resize if needed and convert to sRGB)
+    g_object_unref(image);
+    pipeline_unlock(pipeline_locked);
+    thinpic_curve_store(cache_key, &measured);
+    
+    if (best_quality >= 0 && best_size_kb >= down_size_buffer_kb) {
+        thinpic_stage_quality(best_quality);
+        result.data = thinpic_arena_copy(best_arena);
+        if (result.data) {
+            result.length = best_arena->length;
+            result.success = 1;
+        }
+    }
+    thinpic_arena_release(probe_arena);
+    thinpic_arena_release(best_arena);
+    
+    if (result.success == 1) {
+        THINPIC_LOGI("✅ Smart compression success!");
+        THINPIC_LOGD("Filename: %s", input_name(input));
+        THINPIC_LOGD("Final Quality: %d, Size: %d KB (%d encodes)", best_quality, best_size_kb, probes);
+        return result;
+    }
+    
+    if (best_quality >= 0) {
+        THINPIC_LOGD("Best fit at quality %d is %d KB, below %d KB",
+               best_quality, best_size_kb, down_size_buffer_kb);
+    }
+    
+    // If we get here, no quality setting achieved the target size
+    THINPIC_LOGW("❌ Smart compression failed: Could not achieve target size");
+    THINPIC_LOGD("Tried quality range: %d to %d", start_quality, end_quality);
+    
+    return result;
+}
+
+CompressedImageResult smart_compress_image(const char* input_path, int target_kb, int type) {
+    ThinpicInput input = path_input(input_path);
+    return smart_compress_image_from_input(&input, target_kb, type);
+}
+
+// Format-aware version of compress_large_image
+static CompressedImageResult compress_large_image_with_format_from_input(const ThinpicInput* input, int quality, ImageFormat format) {
+    Pipeline pipeline = {"Large image compression", format, quality, SAVE_PRESET_LARGE, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->max_dimension, 0, VIPS_KERNEL_LANCZOS3), srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_large_image_with_format(const char* input_path, int quality, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    CompressedImageResult result = compress_large_image_with_format_from_input(&input, quality, format);
+    unmap_path_input(&mapping);
+    return result;
+}
+
+// Sequential-safe save of a JPEG, PNG or WebP into target: no interlacing,
+// and no JPEG optimize_coding (libjpeg would buffer the coefficient image)
+static int save_sequential(VipsImage* image, VipsTarget* target, ImageFormat format, int quality) {
+    FormatSettings settings = format_settings(quality);
+    settings.compression = png_level((quality * 9) / 100);
+    settings.optimize_coding = 0;
+    return format_save(image, format, &settings, target);
+}
+
+// Strip-streaming compression for panoramas and 100MP originals. Every
+// step is sequential-safe: shrink-on-load (or vips_resize) into the target
+// box, a real colourspace conversion and a non-progressive save into
+// target, so libvips only ever holds a few scanline strips per thread.
+// JPEG is saved without optimize_coding, which in libjpeg would buffer the
+// whole coefficient image. libwebp encodes whole pictures, so WebP output
+// holds one (resized) frame; PNG and JPEG stay proportional to width.
+// format must be JPEG, PNG or WebP. Returns 0 on success.
+static int stream_save_from_input(const ThinpicInput* input, int quality,
+                                  int target_width, int target_height,
+                                  ImageFormat format, VipsTarget* target) {
+    if (!ensure_vips_initialized()) {
+        return -1;
+    }
+    
+    int pipeline_locked = pipeline_lock();
+    
     vips_error_clear();
+    VipsImage* image = open_input_image(input);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to load image for streaming: %s", input_name(input));
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return -1;
+    }
     
-    if (needs_resize) {
-        printf("[image_compressor] Resizing image with high quality...\n");
-        double scale = (double)new_width / width;
-        
-        printf("[image_compressor] Scale factor: %f\n", scale);
-        
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LANCZOS3,  // High-quality kernel
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
-            vips_error_clear();
-            
-            // Try to compress original image without resizing
-            printf("[image_compressor] Trying to compress original image without resizing...\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
-        g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
-        
-        // Get new dimensions
-        width = vips_image_get_width(image);
-        height = vips_image_get_height(image);
-        printf("[image_compressor] Image resized to: %dx%d\n", width, height);
-        
-        // Validate resized image
-        if (width <= 0 || height <= 0) {
-            printf("[image_compressor] Error: Invalid dimensions after resize\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    
+    // Fit inside the box; a missing side does not constrain, and we never upscale
+    int box_width = target_width > 0 ? target_width : width;
+    int box_height = target_height > 0 ? target_height : height;
+    double scale = 1.0;
+    if (box_width < width || box_height < height) {
+        double scale_x = (double)box_width / width;
+        double scale_y = (double)box_height / height;
+        scale = scale_x < scale_y ? scale_x : scale_y;
     }
+    THINPIC_LOGD("Streaming %dx%d at scale %f", width, height, scale);
     
-    // Convert to sRGB for consistent color space (except for GIF which should remain as-is)
-    if (format != FORMAT_GIF) {
-        printf("[image_compressor] Converting image to sRGB...\n");
-        vips_error_clear();
-        if (vips_copy(image, &processed_image, 
-                "interpretation", VIPS_INTERPRETATION_sRGB,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to convert image to sRGB\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
+    if (scale < 1.0) {
+        VipsImage* resized = shrink_on_load(input, box_width, box_height);
+        if (!resized && resize_image(image, &resized, scale, VIPS_KERNEL_LANCZOS3)) {
+            THINPIC_LOGE("Error: Failed to resize image for streaming");
             vips_error_clear();
-            
-            // Try to compress without sRGB conversion
-            printf("[image_compressor] Trying to compress image without sRGB conversion...\n");
             g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+            pipeline_unlock(pipeline_locked);
+            return -1;
         }
-        
         g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
+        image = resized;
     }
     
-    // Validate final image before compression
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image after processing\n");
+    VipsImage* srgb_image = NULL;
+    if (prepare_output(image, &srgb_image)) {
+        THINPIC_LOGE("Error: Failed to convert to sRGB");
+        vips_error_clear();
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        pipeline_unlock(pipeline_locked);
+        return -1;
     }
+    g_object_unref(image);
+    image = srgb_image;
     
-    int final_width = vips_image_get_width(image);
-    int final_height = vips_image_get_height(image);
-    int final_bands = vips_image_get_bands(image);
-    printf("[image_compressor] Final image: %dx%d, %d bands\n", final_width, final_height, final_bands);
+    int save_result = save_sequential(image, target, format, quality);
     
-    // Compression with format-specific settings
-    printf("[image_compressor] Starting compression with format %d...\n", format);
-    vips_error_clear();
+    g_object_unref(image);
+    pipeline_unlock(pipeline_locked);
+    
+    if (save_result != 0) {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: Streaming compression failed for format %d", format);
+        log_vips_error();
+        return -1;
+    }
+    return 0;
+}
+
+// Validates the input and resolves FORMAT_AUTO; returns 0 when the format
+// cannot stream and needs the large path
+static int stream_format(const ThinpicInput* input, ImageFormat* format) {
+    if (*format == FORMAT_AUTO) {
+        *format = detect_input_format(input);
+        THINPIC_LOGD("Auto-detected format: %d", *format);
+    }
+    if (!format_has(*format, FORMAT_CAP_STREAMING)) {
+        // The other savers need random access; take the regular large path
+        THINPIC_LOGW("Streaming supports JPEG/PNG/WebP only, using large mode for format %d", *format);
+        return 0;
+    }
+    return 1;
+}
+
+static CompressedImageResult stream_compress_image_from_input(const ThinpicInput* input, int quality,
+                                                              int target_width, int target_height,
+                                                              ImageFormat format) {
+    CompressedImageResult result = {NULL, 0, -1};
+    
+    if (!input_valid(input)) {
+        THINPIC_LOGE("Error: Invalid input");
+        return result;
+    }
+    if (!stream_format(input, &format)) {
+        return compress_large_image_with_format_from_input(input, quality, format);
+    }
     
+    EncodeArena* arena = thinpic_arena_acquire();
+    VipsTarget* target = thinpic_arena_target(arena);
     int save_result = -1;
+    if (target) {
+        save_result = stream_save_from_input(input, quality, target_width, target_height, format, target);
+        g_object_unref(target);
+    }
     
-    switch (format) {
-        case FORMAT_JPEG:
-            save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "optimize_coding", TRUE,
-                "interlace", FALSE,
-                "no_subsample", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_PNG:
-            // PNG quality is 0-9, convert from 1-100
-            // For better compression, use higher compression levels for lower quality
-            int png_quality = 9 - ((quality * 9) / 100);
-            if (png_quality < 0) png_quality = 0;
-            if (png_quality > 9) png_quality = 9;
-            
-            save_result = vips_pngsave_buffer(image, &buffer, &buffer_size,
-                "compression", png_quality,
-                "interlace", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_WEBP:
-            save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                "near_lossless", FALSE,
-                "smart_subsample", FALSE,  // Disable for faster compression
-                "strip", FALSE,  // Keep orientation data
-                "effort", 2,     // Lower effort for faster compression (0-6, default is 4)
-                NULL);
-            break;
-            
-        case FORMAT_TIFF:
-            save_result = vips_tiffsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
-                "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_HEIF:
-            save_result = vips_heifsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_JP2K:
-            save_result = vips_jp2ksave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_JXL:
-            save_result = vips_jxlsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                //"strip", FALSE,  // Keep orientation data
-                NULL);
-            break;
-            
-        case FORMAT_GIF:
-            // Only try GIF if image has multiple bands (might be animated)
-            if (final_bands >= 3) {
-                save_result = vips_gifsave_buffer(image, &buffer, &buffer_size,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-            } else {
-                save_result = -1; // Skip GIF for non-animated images
+    if (save_result == 0 && arena->length > 0) {
+        result.data = thinpic_arena_copy(arena);
+        if (result.data) {
+            result.length = arena->length;
+            result.success = 1;
+            THINPIC_LOGI("Streaming compression successful: %zu bytes (format: %d)", result.length, format);
+        }
+    }
+    thinpic_arena_release(arena);
+    return result;
+}
+
+CompressedImageResult stream_compress_image(const char* input_path, int quality,
+                                            int target_width, int target_height, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    CompressedImageResult result = stream_compress_image_from_input(&input, quality,
+                                                                    target_width, target_height, format);
+    unmap_path_input(&mapping);
+    return result;
+}
+
+int64_t stream_compress_image_to_callback(const char* input_path, int quality,
+                                          int target_width, int target_height, ImageFormat format,
+                                          ThinpicChunkCallback callback, int64_t stream_id) {
+    if (!callback) return -1;
+    
+    ThinpicInput input = path_input(input_path);
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    int64_t delivered = -1;
+    
+    if (!input_valid(&input)) {
+        THINPIC_LOGE("Error: Invalid input");
+    } else if (!stream_format(&input, &format)) {
+        // One chunk holding the whole large-mode result
+        CompressedImageResult result = compress_large_image_with_format_from_input(&input, quality, format);
+        if (result.success == 1 && result.data) {
+            callback(stream_id, result.data, (int64_t)result.length);
+            delivered = (int64_t)result.length;
+        } else if (result.data) {
+            free_compressed_buffer(result.data);
+        }
+    } else {
+        int64_t written = 0;
+        VipsTarget* target = thinpic_chunk_target(callback, stream_id, &written);
+        if (target) {
+            int save_result = stream_save_from_input(&input, quality, target_width, target_height,
+                                                     format, target);
+            g_object_unref(target);
+            if (save_result == 0 && written > 0) {
+                delivered = written;
+                THINPIC_LOGI("Chunked streaming successful: %lld bytes (format: %d)",
+                             (long long)delivered, format);
             }
-            break;
-            
-        default:
-            printf("[image_compressor] Error: Unsupported format %d\n", format);
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+        }
+    }
+    unmap_path_input(&mapping);
+    
+    callback(stream_id, NULL, delivered);
+    return delivered;
+}
+
+// Bytes under path: a file's size, or everything below a directory
+static int64_t path_bytes(const char* path) {
+    struct stat info;
+    if (stat(path, &info) != 0) return 0;
+    if (!S_ISDIR(info.st_mode)) return (int64_t)info.st_size;
+    int64_t total = 0;
+    GDir* dir = g_dir_open(path, 0, NULL);
+    const gchar* name = NULL;
+    while (dir && (name = g_dir_read_name(dir))) {
+        gchar* child = g_build_filename(path, name, NULL);
+        total += path_bytes(child);
+        g_free(child);
+    }
+    if (dir) g_dir_close(dir);
+    return total;
+}
+
+// Tiled pyramidal TIFF via a unique sibling temp file, synced and renamed
+// like the file jobs' output; libtiff wants tiles in multiples of 16, and
+// classic TIFF offsets overflow past 4 GB
+static int save_pyramid_tiff(VipsImage* image, const char* output_path, int quality, int tile_size) {
+    tile_size = (tile_size + 15) / 16 * 16;
+    int64_t raw_bytes = (int64_t)vips_image_get_width(image) * vips_image_get_height(image) *
+                        vips_image_get_bands(image);
+    char* temp_path = NULL;
+    int fd = thinpic_output_temp(output_path, &temp_path);
+    if (fd < 0) return -1;
+    int failed = vips_tiffsave(image, temp_path,
+        "tile", TRUE,
+        "tile_width", tile_size,
+        "tile_height", tile_size,
+        "pyramid", TRUE,
+        "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
+        "Q", quality,
+        "bigtiff", raw_bytes > ((int64_t)1 << 32),
+        "keep", metadata_keep(),
+        NULL);
+    int committed = thinpic_output_commit(fd, temp_path, output_path, !failed);
+    return failed || committed ? -1 : 0;
+}
+
+int64_t compress_image_to_pyramid(const char* input_path, const char* output_path,
+                                  ThinpicPyramidLayout layout, int quality, int tile_size) {
+    if (!output_path || strlen(output_path) == 0 || quality < 1 || quality > 100 ||
+            tile_size < 0 || tile_size > 8192 ||
+            (layout != THINPIC_PYRAMID_TIFF && layout != THINPIC_PYRAMID_DEEPZOOM)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid compress_image_to_pyramid arguments");
+        return -1;
     }
-    
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        // Compression successful
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Compression successful: %zu bytes (format: %d, quality: %d)\n", 
-               buffer_size, format, quality);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    ThinpicInput input = path_input(input_path);
+    if (!input_valid(&input)) {
+        THINPIC_LOGE("Error: Invalid input");
+        return -1;
     }
-    
-    // Compression failed
-    printf("[image_compressor] Error: Compression failed for format %d\n", format);
-    const char* error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+    if (!ensure_vips_initialized()) {
+        return -1;
     }
-    
-    // Cleanup
-    if (buffer) {
-        g_free(buffer);
+    // dzsave is only built into libvips with libarchive, which the bundled
+    // Android libvips lacks
+    if (layout == THINPIC_PYRAMID_DEEPZOOM && !vips_type_find("VipsOperation", "dzsave")) {
+        THINPIC_LOGE("Error: Deep Zoom output needs a libvips built with dzsave; use THINPIC_PYRAMID_TIFF");
+        return -1;
     }
-    g_object_unref(image);
+    if (tile_size == 0) tile_size = layout == THINPIC_PYRAMID_DEEPZOOM ? 254 : 256;
+    
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    int pipeline_locked = pipeline_lock();
+    
+    // The source is read once, top to bottom: each pyramid level is built
+    // from the strips of the one above as they arrive
     vips_error_clear();
+    VipsImage* image = open_input_image(&input);
+    VipsImage* prepared = NULL;
+    int failed = !image || prepare_output(image, &prepared);
+    if (image) g_object_unref(image);
+    
+    if (!failed && layout == THINPIC_PYRAMID_TIFF) {
+        failed = save_pyramid_tiff(prepared, output_path, quality, tile_size);
+    } else if (!failed) {
+        gchar* suffix = g_strdup_printf(".jpg[Q=%d]", quality);
+        failed = vips_dzsave(prepared, output_path,
+            "layout", VIPS_FOREIGN_DZ_LAYOUT_DZ,
+            "tile_size", tile_size,
+            "overlap", 1,
+            "suffix", suffix,
+            "keep", metadata_keep(),
+            NULL);
+        g_free(suffix);
+    }
+    int width = prepared ? vips_image_get_width(prepared) : 0;
+    int height = prepared ? vips_image_get_height(prepared) : 0;
+    if (prepared) g_object_unref(prepared);
+    pipeline_unlock(pipeline_locked);
+    unmap_path_input(&mapping);
+    
+    if (failed) {
+        thinpic_error_code(THINPIC_ERROR_IO);
+        THINPIC_LOGE("Error: Failed to write pyramid %s", output_path);
+        log_vips_error();
+        return -1;
+    }
     
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
+    int64_t written = 0;
+    if (layout == THINPIC_PYRAMID_TIFF) {
+        written = path_bytes(output_path);
+    } else {
+        // dzsave drops a ".dzi" suffix from the name it is given
+        gchar* base = g_str_has_suffix(output_path, ".dzi")
+                      ? g_strndup(output_path, strlen(output_path) - 4) : g_strdup(output_path);
+        gchar* descriptor = g_strconcat(base, ".dzi", NULL);
+        gchar* tiles = g_strconcat(base, "_files", NULL);
+        written = path_bytes(descriptor) + path_bytes(tiles);
+        g_free(tiles);
+        g_free(descriptor);
+        g_free(base);
+    }
+    THINPIC_LOGI("Pyramid %dx%d, %d px tiles: %lld bytes (layout %d)",
+                 width, height, tile_size, (long long)written, layout);
+    return written;
 }
 
-// Function to free the compressed buffer (thread-safe)
-void free_compressed_buffer(uint8_t* buffer) {
-    if (buffer) {
-        g_free(buffer);
-        printf("[image_compressor] Buffer freed\n");
+// Pages first_page .. first_page + count - 1 as one strip, page_height apart.
+// libvips stacks them only when they share a size.
+static VipsImage* open_pages(const char* input_path, int first_page, int count) {
+    gchar* filename = g_strdup_printf("%s[page=%d,n=%d]", input_path, first_page, count);
+    VipsImage* image = vips_image_new_from_file(filename,
+        "fail_on", VIPS_FAIL_ON_NONE,
+        "access", VIPS_ACCESS_SEQUENTIAL,
+        NULL);
+    g_free(filename);
+    if (image && !thinpic_input_allowed(image)) {
+        g_object_unref(image);
+        return NULL;
     }
+    if (!image) thinpic_error_code(THINPIC_ERROR_DECODE);
+    image = thinpic_threads_limit(image);
+    image = thinpic_cancel_watch_shared(image);
+    thinpic_progress_watch(image);
+    return image;
 }
 
-// Function to shutdown VIPS (call this when app is closing)
-void shutdown_vips() {
-    pthread_mutex_lock(&vips_mutex);
-    if (vips_initialized) {
-        vips_shutdown();
-        vips_initialized = 0;
-        printf("[image_compressor] VIPS shutdown\n");
+int64_t compress_pages_to_tiff(const char* input_path, const char* output_path, int first_page, int count,
+                               int quality, int max_width, int max_height) {
+    if (!input_path || strlen(input_path) == 0 || !output_path || strlen(output_path) == 0 ||
+            first_page < 0 || quality < 1 || quality > 100 || max_width < 0 || max_height < 0) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid compress_pages_to_tiff arguments");
+        return -1;
     }
-    pthread_mutex_unlock(&vips_mutex);
-}
-
-// Simple test function to verify VIPS is working
-int test_vips_basic() {
-    printf("[image_compressor] Testing basic VIPS functionality...\n");
-    
-    // Initialize VIPS
     if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Test failed: VIPS initialization\n");
         return -1;
     }
+    int pipeline_locked = pipeline_lock();
     
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Try to create a simple 1x1 image
-    VipsImage* test_image = NULL;
+    // The pages stream through as one tall image and tiffsave writes each
+    // as its own directory, so a few rows of one page are all that is held
     vips_error_clear();
-    
-    if (vips_black(&test_image, 1, 1, NULL)) {
-        printf("[image_compressor] Test failed: Cannot create test image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    VipsImage* image = open_pages(input_path, first_page, count > 0 ? count : -1);
+    VipsImage* prepared = NULL;
+    int failed = !image;
+    if (image && thinpic_to_srgb(image, &prepared)) {
+        thinpic_error_code(THINPIC_ERROR_PROCESS);
+        failed = 1;
+    }
+    if (image) g_object_unref(image);
+    
+    int pages = 0;
+    if (!failed) {
+        pages = vips_image_get_height(prepared) / vips_image_get_page_height(prepared);
+        ThinpicOptions options;
+        thinpic_options_init(&options);
+        options.max_width = max_width;
+        options.max_height = max_height;
+        VipsImage* resized = resize_frames(prepared, &options);
+        prepared = NULL;
+        // JPEG in TIFF takes 8-bit samples without alpha
+        VipsImage* narrowed = resized ? narrow_depth(resized, FORMAT_JPEG) : NULL;
+        if (resized) g_object_unref(resized);
+        prepared = narrowed ? prepare_bands(narrowed, FORMAT_JPEG) : NULL;
+        failed = !prepared;
+    }
+    if (!failed) {
+        int64_t raw_bytes = (int64_t)vips_image_get_width(prepared) * vips_image_get_height(prepared) *
+                            vips_image_get_bands(prepared);
+        // A unique temp file, synced before the rename, as file jobs write
+        char* temp_path = NULL;
+        int fd = thinpic_output_temp(output_path, &temp_path);
+        failed = fd < 0;
+        if (!failed) {
+            failed = vips_tiffsave(prepared, temp_path,
+                "page_height", vips_image_get_page_height(prepared),
+                "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
+                "Q", quality,
+                "bigtiff", raw_bytes > ((int64_t)1 << 32),
+                "keep", metadata_keep(),
+                NULL);
+            if (failed) thinpic_error_code(THINPIC_ERROR_IO);
+            if (thinpic_output_commit(fd, temp_path, output_path, !failed)) failed = -1;
         }
-        pthread_mutex_unlock(&vips_mutex);
+    }
+    int width = prepared ? vips_image_get_width(prepared) : 0;
+    int page_height = prepared ? vips_image_get_page_height(prepared) : 0;
+    if (prepared) g_object_unref(prepared);
+    pipeline_unlock(pipeline_locked);
+    
+    if (failed) {
+        THINPIC_LOGE("Error: Failed to write pages of %s to %s", input_path, output_path);
+        log_vips_error();
         return -1;
     }
+    int64_t written = path_bytes(output_path);
+    THINPIC_LOGI("Multi-page TIFF: %d pages of %dx%d from page %d, %lld bytes", pages, width, page_height,
+                 first_page, (long long)written);
+    return written;
+}
+
+// Largest libjpeg shrink (1, 2, 4 or 8) whose output still covers scale
+static int jpeg_shrink_factor(double scale) {
+    int shrink = 1;
+    while (shrink < 8 && scale * shrink * 2 <= 1.0) {
+        shrink *= 2;
+    }
+    return shrink;
+}
+
+// libjpeg's scaled IDCT (the jpegload "shrink" option) decodes straight at
+// 1/2, 1/4 or 1/8 size; the shrunk root is watched like open_input_image's
+static VipsImage* open_jpeg_shrunk(const ThinpicInput* input, int shrink) {
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_RESIZE);
+    VipsImage* image = NULL;
+    if (input->data) {
+        vips_jpegload_buffer((void*)input->data, input->length, &image,
+            "shrink", shrink,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", VIPS_ACCESS_SEQUENTIAL,
+            NULL);
+    } else if (input_is_descriptor(input)) {
+        if (!rewind_descriptor(input->fd)) {
+            thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
+            return NULL;
+        }
+        VipsSource* source = vips_source_new_from_descriptor(input->fd);
+        if (!source) {
+            thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
+            return NULL;
+        }
+        vips_jpegload_source(source, &image,
+            "shrink", shrink,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", VIPS_ACCESS_SEQUENTIAL,
+            NULL);
+        g_object_unref(source);
+    } else {
+        vips_jpegload(input->path, &image,
+            "shrink", shrink,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", VIPS_ACCESS_SEQUENTIAL,
+            NULL);
+    }
+    thinpic_stage_end(THINPIC_STAGE_RESIZE, started);
+    image = thinpic_threads_limit(image);
+    image = thinpic_cancel_watch_shared(image);
+    thinpic_progress_watch(image);
+    return image;
+}
+
+// Fit an opened JPEG inside the box (a side <= 0 does not constrain; never
+// upscales): the largest DCT shrink that still covers the box, then a
+// bilinear resize for the remaining (at most 2x) reduction instead of
+// Lanczos3 over a full-size decode. Takes image; NULL on failure.
+static VipsImage* jpeg_thumbnail(const ThinpicInput* input, VipsImage* image, int target_width,
+                                 int target_height) {
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
     
-    // Try to save it as JPEG
-    void* buffer = NULL;
-    size_t buffer_size = 0;
+    int box_width = target_width > 0 ? target_width : width;
+    int box_height = target_height > 0 ? target_height : height;
+    double scale = 1.0;
+    if (box_width < width || box_height < height) {
+        double scale_x = (double)box_width / width;
+        double scale_y = (double)box_height / height;
+        scale = scale_x < scale_y ? scale_x : scale_y;
+    }
     
-    if (vips_jpegsave_buffer(test_image, &buffer, &buffer_size, NULL)) {
-        printf("[image_compressor] Test failed: Cannot save test image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    int shrink = jpeg_shrink_factor(scale);
+    if (shrink > 1) {
+        g_object_unref(image);
+        image = open_jpeg_shrunk(input, shrink);
+        if (!image) {
+            THINPIC_LOGE("Error: Failed to decode JPEG at 1/%d", shrink);
+            log_vips_error();
+            return NULL;
         }
-        g_object_unref(test_image);
-        pthread_mutex_unlock(&vips_mutex);
-        return -1;
     }
     
-    printf("[image_compressor] Test successful: Created and saved %zu bytes\n", buffer_size);
-    
-    // Cleanup
-    g_free(buffer);
-    g_object_unref(test_image);
-    pthread_mutex_unlock(&vips_mutex);
+    // libjpeg rounds the shrunk size up, so rescale against what it produced
+    int shrunk_width = vips_image_get_width(image);
+    int shrunk_height = vips_image_get_height(image);
+    double residual = 1.0;
+    if (box_width < shrunk_width || box_height < shrunk_height) {
+        double residual_x = (double)box_width / shrunk_width;
+        double residual_y = (double)box_height / shrunk_height;
+        residual = residual_x < residual_y ? residual_x : residual_y;
+    }
+    THINPIC_LOGD("Thumbnail %dx%d: DCT shrink 1/%d to %dx%d, then scale %f",
+           width, height, shrink, shrunk_width, shrunk_height, residual);
     
-    return 0;
+    if (residual < 1.0) {
+        VipsImage* resized = NULL;
+        if (vips_resize(image, &resized, residual,
+                "kernel", VIPS_KERNEL_LINEAR,
+                NULL)) {
+            thinpic_error_code(THINPIC_ERROR_PROCESS);
+            THINPIC_LOGE("Error: Failed to resize thumbnail");
+            vips_error_clear();
+            g_object_unref(image);
+            return NULL;
+        }
+        g_object_unref(image);
+        image = resized;
+    }
+    return image;
 }
 
-// Function to get image information
-ImageInfo get_image_info(const char* input_path) {
-    ImageInfo info = {0, 0, 0, 0, 0, 0, 0};
+// Grid-view previews from JPEGs through jpeg_thumbnail. Other inputs and
+// formats take compress_image_with_size_and_format.
+static CompressedImageResult thumbnail_compress_image_from_input(const ThinpicInput* input, int quality,
+                                                                 int target_width, int target_height,
+                                                                 ImageFormat format) {
+    CompressedImageResult result = {NULL, 0, -1};
     
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path for info\n");
-        return info;
+    if (!input_valid(input)) {
+        THINPIC_LOGE("Error: Invalid input");
+        return result;
     }
     
-    // Check if file exists
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        printf("[image_compressor] Error: Cannot open file for info: %s\n", input_path);
-        return info;
+    if (format == FORMAT_AUTO) {
+        format = detect_input_format(input);
+        THINPIC_LOGD("Auto-detected format: %d", format);
+    }
+    // A pipe cannot be reopened at the shrunk size after the header probe
+    if ((target_width <= 0 && target_height <= 0) ||
+            !format_has(format, FORMAT_CAP_STREAMING) ||
+            (input_is_descriptor(input) && !rewind_descriptor(input->fd))) {
+        return compress_image_with_size_and_format_from_input(input, quality, target_width, target_height, format);
     }
-    fclose(file);
     
-    // Initialize VIPS (thread-safe)
     if (!ensure_vips_initialized()) {
-        return info;
+        return result;
     }
     
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
+    int pipeline_locked = pipeline_lock();
     
-    // Clear any previous errors
     vips_error_clear();
+    VipsImage* image = open_input_image(input);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to load image for thumbnail: %s", input_name(input));
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
     
-    VipsImage* image = NULL;
-    
-    // Load image with error handling
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
+    const char* loader = NULL;
+    if (vips_image_get_typeof(image, VIPS_META_LOADER)) {
+        vips_image_get_string(image, VIPS_META_LOADER, &loader);
+    }
+    if (format_from_loader(loader) != FORMAT_JPEG) {
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
+        return compress_image_with_size_and_format_from_input(input, quality, target_width, target_height, format);
+    }
     
+    image = jpeg_thumbnail(input, image, target_width, target_height);
     if (!image) {
-        printf("[image_compressor] Error: Failed to load image for info\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
-        }
-        vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
-        return info;
+        pipeline_unlock(pipeline_locked);
+        return result;
     }
     
-    // Validate image object
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object for info\n");
+    VipsImage* srgb_image = NULL;
+    if (prepare_output(image, &srgb_image)) {
+        THINPIC_LOGE("Error: Failed to convert to sRGB");
+        vips_error_clear();
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return info;
+        pipeline_unlock(pipeline_locked);
+        return result;
     }
+    g_object_unref(image);
+    image = srgb_image;
     
-    // Get image info
-    info.width = vips_image_get_width(image);
-    info.height = vips_image_get_height(image);
-    info.bands = vips_image_get_bands(image);
+    EncodeArena* arena = thinpic_arena_acquire();
+    VipsTarget* target = thinpic_arena_target(arena);
+    int save_result = -1;
+    if (target) {
+        save_result = save_sequential(image, target, format, quality);
+        g_object_unref(target);
+    }
     
-    // Get orientation from EXIF if available
-    VipsImage* orientation_image = NULL;
-    if (vips_copy(image, &orientation_image, NULL) == 0) {
-        // Try to get orientation from EXIF
-        const char* orientation_str = NULL;
-        if (vips_image_get_string(orientation_image, "exif-ifd0-Orientation", &orientation_str) == 0) {
-            if (orientation_str) {
-                info.orientation = atoi(orientation_str);
-            }
+    g_object_unref(image);
+    pipeline_unlock(pipeline_locked);
+    
+    if (save_result == 0 && arena->length > 0) {
+        result.data = thinpic_arena_copy(arena);
+        if (result.data) {
+            result.length = arena->length;
+            result.success = 1;
+            THINPIC_LOGI("Thumbnail compression successful: %zu bytes (format: %d)", result.length, format);
         }
-        g_object_unref(orientation_image);
+    } else {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: Thumbnail compression failed for format %d", format);
+        log_vips_error();
     }
-    
-    // Check if image needs resizing (largest side > 6000px)
-    const int max_dimension = 6000;
-    
-    if (info.width > max_dimension || info.height > max_dimension) {
-        info.needs_resize = 1;
-        if (info.width > info.height) {
-            // Landscape image
-            info.new_width = max_dimension;
-            info.new_height = (int)((double)info.height * max_dimension / info.width);
+    thinpic_arena_release(arena);
+    return result;
+}
+
+CompressedImageResult thumbnail_compress_image(const char* input_path, int quality,
+                                               int target_width, int target_height, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    return thumbnail_compress_image_from_input(&input, quality, target_width, target_height, format);
+}
+
+// Format-aware version of compress_large_dslr_image
+static CompressedImageResult compress_large_dslr_image_with_format_from_input(const ThinpicInput* input, int quality, ImageFormat format) {
+    Pipeline pipeline = {"Large DSLR image compression", format, quality, SAVE_PRESET_LARGE, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->max_dimension, 0, VIPS_KERNEL_LANCZOS3), srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult compress_large_dslr_image_with_format(const char* input_path, int quality, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    CompressedImageResult result = compress_large_dslr_image_with_format_from_input(&input, quality, format);
+    unmap_path_input(&mapping);
+    return result;
+}
+
+// Rate control for smart_compress_image_with_format. Each format searches
+// its own axis, starting from the best setting the smart type allows: the
+// lossy codecs bisect Q (down to RATE_MIN_QUALITY), JPEG XL bisects its
+// butteraugli distance, and PNG/GIF, which have no quality axis, bisect a
+// short ladder of smaller encodings (palettes, fewer bits per pixel).
+typedef enum {
+    RATE_QUALITY,
+    RATE_DISTANCE,
+    RATE_LADDER
+} RateAxis;
+
+#define RATE_MIN_QUALITY 10
+#define RATE_DISTANCE_STEP 0.05     // JPEG XL distance per search step
+#define RATE_MAX_DISTANCE 15.0
+#define RATE_LADDER_STEPS 3         // PNG: truecolour, 256 and 16 colours; GIF: 8, 6 and 4 bits
+
+static int rate_format_supported(ImageFormat format) {
+    return thinpic_concrete_format(format);
+}
+
+static RateAxis rate_axis(ImageFormat format) {
+    switch (format) {
+        case FORMAT_JXL: return RATE_DISTANCE;
+        case FORMAT_PNG:
+        case FORMAT_GIF: return RATE_LADDER;
+        default: return RATE_QUALITY;
+    }
+}
+
+// The Q to distance mapping jxlsave applies itself
+static double jxl_distance(int quality) {
+    return quality >= 30 ? 0.1 + (100 - quality) * 0.09
+                         : 53.0 / 3000.0 * quality * quality - 23.0 / 20.0 * quality + 25.0;
+}
+
+// Steps the search may take below the setting for quality
+static int rate_steps(ImageFormat format, int quality) {
+    switch (rate_axis(format)) {
+        case RATE_QUALITY: return quality > RATE_MIN_QUALITY ? quality - RATE_MIN_QUALITY : 0;
+        case RATE_DISTANCE: return (int)((RATE_MAX_DISTANCE - jxl_distance(quality)) / RATE_DISTANCE_STEP);
+        default: return RATE_LADDER_STEPS - 1;
+    }
+}
+
+// Encode `step` settings below quality's own into arena; every step makes
+// the output smaller (or no larger)
+static int rate_encode(VipsImage* image, ImageFormat format, int quality, int step, EncodeArena* arena) {
+    if (format == FORMAT_PNG && step > 0) {
+        ThinpicOptions options;
+        thinpic_options_init(&options);
+        options.format = FORMAT_PNG;
+        options.strip = thinpic_metadata_policy();
+        options.png_palette = THINPIC_PNG_PALETTE_ON;
+        options.png_bitdepth = step == 1 ? 8 : 4;
+        uint8_t* png = NULL;
+        size_t png_length = 0;
+        if (thinpic_png_palette(image, &options, 9, &png, &png_length) != 1) return -1;
+        VipsTarget* target = thinpic_arena_target(arena);
+        int failed = !target || vips_target_write(target, png, png_length) || vips_target_end(target);
+        if (target) g_object_unref(target);
+        g_free(png);
+        return failed || arena->length == 0 ? -1 : 0;
+    }
+    
+    // Lossy formats step Q down, JPEG XL its distance up and GIF its palette
+    FormatSettings settings = format_settings(quality - step);
+    settings.compression = png_level((quality * 9) / 100);
+    settings.smart_subsample = 1;
+    ThinpicGifParams gif = gif_preset;
+    gif.colours = 1 << (8 - step * 2);
+    settings.gif = &gif;
+    if (format == FORMAT_JXL) settings.distance = jxl_distance(quality) + step * RATE_DISTANCE_STEP;
+
+    VipsTarget* target = thinpic_arena_target(arena);
+    if (!target) return -1;
+    int save_result = format_save(image, format, &settings, target);
+    g_object_unref(target);
+    return save_result == 0 && arena->length > 0 ? 0 : -1;
+}
+
+// First step to try: the fewest steps the measured samples put under upper
+// (the top setting without any)
+static int rate_first_step(const ThinpicCurve* samples, size_t upper, int high) {
+    int step = 0;
+    for (int i = 0; i < samples->count; i++) {
+        if (samples->bytes[i] <= upper) return samples->setting[i] < high ? samples->setting[i] : high;
+        step = samples->setting[i] + 1;
+    }
+    return step < high ? step : high;
+}
+
+// Fewest steps below quality whose encode fits under upper bytes, left in
+// *arena. The top setting goes first, or where samples from an earlier run
+// say the target is, so a fit often costs one encode; after that bisection,
+// stopping at the first fit that is also above lower. Every encode is added
+// to samples. -1 when not even the last step fits (*arena then holds that
+// smallest encode), -2 on failure or cancellation.
+static int rate_search(VipsImage* image, ImageFormat format, int quality, size_t lower, size_t upper,
+                       EncodeArena** arena, int* encodes, ThinpicCurve* samples) {
+    EncodeArena* probe = thinpic_arena_acquire();
+    int low = 0;
+    int high = rate_steps(format, quality);
+    int last = high;
+    int step = rate_first_step(samples, upper, high);
+    int best = -1;
+    int status = 0;
+    while (low <= high) {
+        if (thinpic_cancel_requested()) {
+            status = -2;
+            break;
+        }
+        (*encodes)++;
+        vips_error_clear();
+        int traced = thinpic_trace_begin("thinpic rate step %d (format %d)", step, format);
+        int failed = rate_encode(image, format, quality, step, probe);
+        thinpic_trace_end(traced);
+        if (failed != 0) {
+            THINPIC_LOGE("Error: Failed to compress format %d at step %d", format, step);
+            status = -2;
+            break;
+        }
+        size_t size = probe->length;
+        THINPIC_LOGD("Format %d, step %d: %zu KB", format, step, size / 1024);
+        thinpic_curve_add(samples, step, size);
+        
+        // Fits (or is the smallest there is): keep it
+        if (size <= upper || (best < 0 && step == last)) {
+            EncodeArena* swap = *arena;
+            *arena = probe;
+            probe = swap;
+        }
+        if (size <= upper) {
+            best = step;
+            if (size >= lower) break;
+            high = step - 1;
         } else {
-            // Portrait or square image
-            info.new_height = max_dimension;
-            info.new_width = (int)((double)info.width * max_dimension / info.height);
+            low = step + 1;
         }
+        step = low + (high - low) / 2;
     }
+    thinpic_arena_release(probe);
     
-    printf("[image_compressor] Image info: %dx%d, %d bands, orientation: %d, needs_resize: %d\n", 
-           info.width, info.height, info.bands, info.orientation, info.needs_resize);
-    
-    // Cleanup
-    g_object_unref(image);
-    pthread_mutex_unlock(&vips_mutex);
-    
-    return info;
+    if (status != 0) return status;
+    return best;
 }
 
-// Function to handle very large images by creating a smaller version
-CompressedImageResult compress_large_image(const char* input_path, int quality) {
+// rate_search, except that WebP asks libwebp's rate control for the middle
+// of the window: one encode, which either fits under upper (0) or is the
+// smallest Q there is and still over (-1, left in *arena). Sets
+// *rate_controlled when it did; images libwebp cannot take are searched.
+static int target_search(VipsImage* image, ImageFormat format, int quality, size_t lower, size_t upper,
+                         EncodeArena** arena, int* encodes, ThinpicCurve* samples, int* rate_controlled) {
+    if (format == FORMAT_WEBP) {
+        uint8_t* webp = NULL;
+        size_t length = 0;
+        int traced = thinpic_trace_begin("thinpic webp rate control (%zu KB)", (lower + upper) / 2048);
+        int status = thinpic_webp_target_size(image, (lower + upper) / 2, quality, RATE_MIN_QUALITY, 4, 1,
+                                               thinpic_metadata_policy(), &webp, &length);
+        thinpic_trace_end(traced);
+        if (status != 0) {
+            (*encodes)++;
+            *rate_controlled = 1;
+            if (status < 0) return -2;
+            VipsTarget* target = thinpic_arena_target(*arena);
+            int failed = !target || vips_target_write(target, webp, length) || vips_target_end(target);
+            if (target) g_object_unref(target);
+            g_free(webp);
+            if (failed || (*arena)->length == 0) return -2;
+            THINPIC_LOGD("WebP rate control: %zu KB", length / 1024);
+            return length <= upper ? 0 : -1;
+        }
+    }
+    return rate_search(image, format, quality, lower, upper, arena, encodes, samples);
+}
+
+// Format-aware version of smart_compress_image
+static CompressedImageResult smart_compress_image_with_format_from_input(const ThinpicInput* input, int target_kb, int type, ImageFormat format) {
     CompressedImageResult result = {NULL, 0, -1};
     
-    printf("[image_compressor] Handling very large image: %s\n", input_path);
+    // Auto-detect format if requested
+    if (format == FORMAT_AUTO) {
+        format = detect_input_format(input);
+        THINPIC_LOGD("Auto-detected format: %d", format);
+    }
     
-
+    THINPIC_LOGD("Smart compression with format %d: %s (target: %d KB, type: %d)", 
+           format, input_name(input), target_kb, type);
     
     // Initialize VIPS (thread-safe)
     if (!ensure_vips_initialized()) {
         return result;
     }
     
-    pthread_mutex_lock(&vips_mutex);
+    if (target_kb > 0 && skip_compliant_input(input, format, (long)target_kb * 1024, 0, 0, &result)) {
+        return result;
+    }
+    
+    int pipeline_locked = pipeline_lock();
     
     VipsImage* image = NULL;
-    VipsImage* small_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
+    VipsImage* processed_image = NULL;
+    
+    // Load image
+    vips_error_clear();
+    image = open_input_image(input);
+    
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to load image for smart compression");
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
+    // Get dimensions
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    
+    THINPIC_LOGD("Image: %dx%d", width, height);
+    
+    // Smart compression logic based on type: standard, high, low and very
+    // low quality (85, 95, 60 and 30 built in); unknown types are standard
+    const int* smart_quality = thinpic_tuning()->smart_quality;
+    int target_quality = type >= 0 && type < 4 ? smart_quality[type] : smart_quality[0];
+    
+    if (target_kb > 0 && format == FORMAT_JPEG) {
+        // The steps below target_quality, searched in the DCT domain when
+        // the input is a JPEG that needs no pixel change
+        int encodes = 0;
+        EncodeArena* requantized = thinpic_arena_acquire();
+        int quality = coefficient_search(input, image, RATE_MIN_QUALITY, target_quality, 0,
+                                         (size_t)target_kb * 1024 * 4 / 5, (size_t)target_kb * 1024 * 6 / 5,
+                                         requantized, &encodes);
+        if (quality >= 0) {
+            g_object_unref(image);
+            pipeline_unlock(pipeline_locked);
+            thinpic_stage_quality(quality);
+            result.data = thinpic_arena_copy(requantized);
+            if (result.data) {
+                result.length = requantized->length;
+                result.success = 1;
+                THINPIC_LOGI("Smart compression successful: %zu bytes (format: %d, quality: %d, %d coefficient "
+                             "encodes)", result.length, format, quality, encodes);
+            }
+            thinpic_arena_release(requantized);
+            return result;
+        }
+        thinpic_arena_release(requantized);
+    }
+    // Only the size search renders the frame
+    if (target_kb > 0) image = decode_in_parallel(input, image);
+    
+    // Convert to sRGB (except for GIF)
+    if (format != FORMAT_GIF) {
+        VipsImage* srgb_image = NULL;
+        if (prepare_output(image, &srgb_image)) {
+            THINPIC_LOGE("Error: Failed to convert to sRGB");
+            g_object_unref(image);
+            pipeline_unlock(pipeline_locked);
+            return result;
+        }
+        
+        g_object_unref(image);
+        image = srgb_image;
+    }
     
-    // Load image
-    vips_error_clear();
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
+    if (rate_format_supported(format) == 0) {
+        THINPIC_LOGE("Error: Unsupported format %d", format);
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
     
+    image = prepare_bands(image, format);
     if (!image) {
-        printf("[image_compressor] Error: Failed to load large image\n");
-        pthread_mutex_unlock(&vips_mutex);
+        THINPIC_LOGE("Error: Failed to prepare the image bands");
+        vips_error_clear();
+        pipeline_unlock(pipeline_locked);
         return result;
     }
     
-    // Get dimensions
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    
-    printf("[image_compressor] Large image: %dx%d\n", width, height);
+    THINPIC_LOGD("Starting smart compression with format %d, quality %d...", format, target_quality);
+    vips_error_clear();
     
-    // Create a smaller version for compression (max 6000px)
-    const int max_dimension = 6000;
-    double scale = 1.0;
-    if (width > height) {
-        scale = (double)max_dimension / width;
+    EncodeArena* arena = thinpic_arena_acquire();
+    int save_result = -1;
+    int encodes = 0;
+    if (target_kb <= 0) {
+        // No size to aim for: one encode at the type's quality
+        save_result = rate_encode(image, format, target_quality, 0, arena);
+        encodes = 1;
+        thinpic_stage_quality(target_quality);
     } else {
-        scale = (double)max_dimension / height;
-    }
-    
-    printf("[image_compressor] Creating smaller version with scale: %f\n", scale);
-    
-    if (vips_resize(image, &small_image, scale, NULL)) {
-        printf("[image_compressor] Error: Failed to create smaller version\n");
+        // Searches encode the same pixels repeatedly
+        processed_image = decode_to_memory(image);
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        thinpic_cancel_watch(processed_image);
+        image = processed_image ? prepare_bands(processed_image, format) : NULL;
+        processed_image = NULL;
+        if (image) image = adaptive_search_image(image, format);
+        
+        size_t upper = (size_t)target_kb * 1024 * 6 / 5;
+        size_t lower = (size_t)target_kb * 1024 * 4 / 5;
+        uint64_t cache_key = thinpic_curve_key(input, THINPIC_CURVE_RATE_STEPS, format,
+                                               adaptive_quality(format) ? type | ADAPTIVE_CURVE_VARIANT : type);
+        ThinpicCurve samples;
+        thinpic_curve_lookup(cache_key, &samples);
+        int rate_controlled = 0;
+        int step = image ? target_search(image, format, target_quality, lower, upper, &arena, &encodes, &samples,
+                                         &rate_controlled) : -2;
+        // Only the full-size curve is worth keeping
+        if (step >= -1 && !rate_controlled) thinpic_curve_store(cache_key, &samples);
+        if (step == -1) {
+            // Even the smallest setting is over: shrink by the size ratio
+            // and search again from the top
+            double scale = fmax(0.1, sqrt((double)upper / arena->length) * 0.95);
+            THINPIC_LOGD("Smallest setting is %zu KB, resizing with scale: %f", arena->length / 1024, scale);
+            VipsImage* resized = NULL;
+            if (resize_image(image, &resized, scale, VIPS_KERNEL_LANCZOS3) == 0) {
+                processed_image = decode_to_memory(resized);
+                g_object_unref(resized);
+            }
+            if (processed_image) {
+                g_object_unref(image);
+                image = processed_image;
+                processed_image = NULL;
+                ThinpicCurve resized_samples = {0};
+                step = target_search(image, format, target_quality, lower, upper, &arena, &encodes, &resized_samples,
+                                     &rate_controlled);
+            } else {
+                vips_error_clear();
+            }
+        }
+        if (step == -1) {
+            THINPIC_LOGW("Smart compression could not reach %d KB, keeping the smallest result", target_kb);
+        } else if (step >= 0 && !rate_controlled) {
+            THINPIC_LOGD("Rate control settled %d step(s) below quality %d", step, target_quality);
+        }
+        save_result = step >= -1 ? 0 : -1;
+        if (step >= -1 && rate_controlled) {
+            // libwebp does not report the Q its rate control settled on
+            thinpic_stage_quality(-1);
+        } else if (step >= -1) {
+            thinpic_stage_quality(target_quality - (step >= 0 ? step : rate_steps(format, target_quality)));
+        }
     }
     
-    g_object_unref(image);
-    image = small_image;
+    if (save_result == 0 && arena->length > 0) {
+        result.data = thinpic_arena_copy(arena);
+        if (result.data) {
+            result.length = arena->length;
+            result.success = 1;
+            THINPIC_LOGI("Smart compression successful: %zu bytes (format: %d, quality: %d, %d encodes)", 
+                   result.length, format, target_quality, encodes);
+        }
+    } else {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: Smart compression failed for format %d", format);
+        log_vips_error();
+    }
+    thinpic_arena_release(arena);
     
-    // Convert to sRGB
-    VipsImage* srgb_image = NULL;
-    if (vips_copy(image, &srgb_image, 
-            "interpretation", VIPS_INTERPRETATION_sRGB,
-            NULL)) {
-        printf("[image_compressor] Error: Failed to convert to sRGB\n");
+    if (image) {
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    }
+    pipeline_unlock(pipeline_locked);
+    return result;
+}
+
+CompressedImageResult smart_compress_image_with_format(const char* input_path, int target_kb, int type, ImageFormat format) {
+    ThinpicInput input = path_input(input_path);
+    return smart_compress_image_with_format_from_input(&input, target_kb, type, format);
+}
+
+// Auto-compress function that tries multiple formats to find the smallest file
+// Concurrent format race used by auto_compress_image_with_options
+#define AUTO_MAX_CANDIDATES 9
+
+struct AutoRace;
+
+typedef struct {
+    struct AutoRace* race;
+    ImageFormat format;
+    VipsImage* view;   // Per-candidate copy of the shared memory image
+    pthread_t thread;
+    int started;
+    EncodeArena* arena;  // Encoded output when ok is set
+    int ok;
+    size_t size;
+} AutoCandidate;
+
+typedef struct AutoRace {
+    pthread_mutex_t lock;
+    AutoCandidate candidates[AUTO_MAX_CANDIDATES];
+    int count;
+    int quality;
+    int bands;
+    size_t accept_below;  // 0 disables early acceptance
+    int winner;           // Index of the candidate that beat accept_below, or -1
+    int ordered;          // Deterministic output: no early winner, the first format under accept_below at the end
+} AutoRace;
+
+static int encode_auto_candidate(VipsImage* image, ImageFormat format, int quality, int bands,
+                                 VipsTarget* target) {
+    // Only try GIF if image has multiple bands (might be animated)
+    if (format == FORMAT_GIF && bands < 3) return -1;
+    FormatSettings settings = format_settings(quality);
+    settings.effort = thinpic_thermal_effort(2, 0);
+    if (!format_flattens(format)) return format_save(image, format, &settings, target);
+
+    // Translucent images share the race image, so flatten a view of it
+    VipsImage* flat = NULL;
+    int flattened = thinpic_flatten_alpha(image, &flat);
+    if (flattened < 0) return -1;
+    int save_result = format_save(flattened ? flat : image, format, &settings, target);
+    if (flat) g_object_unref(flat);
+    return save_result;
+}
+
+// Lossless WebP for flat artwork, at a fast effort: lossless spends its
+// effort searching transforms that rarely pay off on UI and diagrams.
+// near_level under 100 lets libwebp nudge pixels first (anti-aliased text
+// and shadows take most of the bits in a screenshot); 100 is exact.
+static int save_webp_flat(VipsImage* image, int near_level, VipsTarget* target) {
+    if (near_level >= 100) {
+        return vips_webpsave_target(image, target,
+            "keep", metadata_keep(),
+            "lossless", TRUE,
+            "effort", thinpic_thermal_effort(2, 0),
+            NULL);
+    }
+    return vips_webpsave_target(image, target,
+        "keep", metadata_keep(),
+        "near_lossless", TRUE,
+        "Q", near_level,
+        "effort", thinpic_thermal_effort(2, 0),
+        NULL);
+}
+
+// One WebP encode for encode_classified into arena: lossless (see
+// save_webp_flat) or lossy at quality; returns 0 or -1
+static int encode_classified_webp(VipsImage* image, int flat, int near_level, int quality, int bands,
+                                  EncodeArena* arena) {
+    VipsTarget* target = thinpic_arena_target(arena);
+    if (!target) return -1;
+    int save_result = flat ? save_webp_flat(image, near_level, target)
+                           : encode_auto_candidate(image, FORMAT_WEBP, quality, bands, target);
+    g_object_unref(target);
+    return save_result == 0 && arena->length > 0 ? 0 : -1;
+}
+
+// The encodes auto_compress makes for a classified image, at most two.
+// With WebP, graphics are encoded exactly lossless (libwebp builds the
+// palette itself), screenshots near-lossless, and photos and translucent
+// images lossy. When the classifier was unsure, the other kind is encoded
+// too and the smaller kept. Without WebP, graphics get a palette PNG,
+// screenshots PNG and photos JPEG. Output goes to *arena (which may be
+// swapped for another acquired arena), or to *direct for the palette PNG;
+// returns the format written, or -1.
+static int encode_classified(VipsImage* image, ThinpicContent content, int ambiguous, int quality, int bands,
+                             EncodeArena** arena, uint8_t** direct, size_t* direct_length) {
+    int flat = content == THINPIC_CONTENT_SCREENSHOT || content == THINPIC_CONTENT_GRAPHIC;
+    if (format_available(FORMAT_WEBP)) {
+        // Graphics stay exact; a screenshot tolerates as much as quality does
+        int near_level = content == THINPIC_CONTENT_GRAPHIC ? 100 : quality < 60 ? 60 : quality;
+        int encoded = encode_classified_webp(image, flat, near_level, quality, bands, *arena) == 0;
+        if (!ambiguous) return encoded ? FORMAT_WEBP : -1;
+
+        // Second opinion in the other mode; the smaller one stays in *arena
+        vips_error_clear();
+        EncodeArena* other = thinpic_arena_acquire();
+        if (encode_classified_webp(image, !flat, near_level, quality, bands, other) == 0 &&
+                (!encoded || other->length < (*arena)->length)) {
+            THINPIC_LOGD("Ambiguous %s: %s WebP %zu bytes beat %zu", thinpic_content_name(content),
+                         flat ? "lossy" : "lossless", other->length, encoded ? (*arena)->length : 0);
+            EncodeArena* swap = *arena;
+            *arena = other;
+            other = swap;
+            encoded = 1;
+        }
+        thinpic_arena_release(other);
+        return encoded ? FORMAT_WEBP : -1;
+    }
+
+    if (content == THINPIC_CONTENT_GRAPHIC) {
+        ThinpicOptions options;
+        thinpic_options_init(&options);
+        options.format = FORMAT_PNG;
+        options.strip = thinpic_metadata_policy();
+        options.png_palette = THINPIC_PNG_PALETTE_AUTO;
+        if (thinpic_png_palette(image, &options, 6, direct, direct_length) == 1) {
+            return FORMAT_PNG;
+        }
+        // More colours at full size than in the sample: still flat artwork
+        vips_error_clear();
     }
     
-    g_object_unref(image);
-    image = srgb_image;
-    
-    // Use user-specified quality
-    int final_quality = quality;
-    printf("[image_compressor] Compressing with quality: %d\n", final_quality);
+    VipsTarget* target = thinpic_arena_target(*arena);
+    if (!target) return -1;
+    ImageFormat format = content == THINPIC_CONTENT_PHOTO ? FORMAT_JPEG : FORMAT_PNG;
+    int save_result = encode_auto_candidate(image, format, quality, bands, target);
+    g_object_unref(target);
+    return save_result == 0 && (*arena)->length > 0 ? (int)format : -1;
+}
+
+static void* auto_candidate_main(void* arg) {
+    AutoCandidate* candidate = (AutoCandidate*)arg;
+    AutoRace* race = candidate->race;
     
-    vips_error_clear();
-    int save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-        "Q", final_quality,
-        // "strip", TRUE,
-        "optimize_coding", TRUE,
-        "interlace", FALSE,
-        NULL);
+    pthread_mutex_lock(&race->lock);
+    int cancelled = race->winner >= 0;
+    pthread_mutex_unlock(&race->lock);
+    if (cancelled) {
+        return NULL;
+    }
     
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Large image compression successful: %zu bytes\n", buffer_size);
-    } else {
-        printf("[image_compressor] Error: Failed to compress large image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    THINPIC_LOGD("Trying format %d...", candidate->format);
+    int save_result = -1;
+    VipsTarget* target = thinpic_arena_target(candidate->arena);
+    if (target) {
+        int traced = thinpic_trace_begin("thinpic auto candidate (format %d)", candidate->format);
+        save_result = encode_auto_candidate(candidate->view, candidate->format,
+                                            race->quality, race->bands, target);
+        thinpic_trace_end(traced);
+        g_object_unref(target);
+    }
+    size_t size = candidate->arena->length;
+    
+    pthread_mutex_lock(&race->lock);
+    if (save_result == 0 && size > 0 && race->winner < 0) {
+        THINPIC_LOGD("Format %d successful: %zu bytes", candidate->format, size);
+        candidate->ok = 1;
+        candidate->size = size;
+        
+        if (race->accept_below > 0 && size <= race->accept_below && !race->ordered) {
+            // Good enough: stop the encoders that are still running
+            race->winner = (int)(candidate - race->candidates);
+            for (int i = 0; i < race->count; i++) {
+                if (&race->candidates[i] != candidate) {
+                    vips_image_set_kill(race->candidates[i].view, TRUE);
+                }
+            }
+            THINPIC_LOGD("Format %d under %zu bytes, cancelling the rest",
+                   candidate->format, race->accept_below);
         }
+    } else if (race->winner < 0) {
+        THINPIC_LOGD("Format %d failed", candidate->format);
     }
+    pthread_mutex_unlock(&race->lock);
     
-    g_object_unref(image);
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
+    return NULL;
 }
 
-// Function to handle very large DSLR images by creating a smaller version
-CompressedImageResult compress_large_dslr_image(const char* input_path, int quality) {
+static CompressedImageResult auto_compress_image_with_options_from_input(const ThinpicInput* input, int quality, const AutoCompressOptions* options) {
     CompressedImageResult result = {NULL, 0, -1};
     
-    printf("[image_compressor] Handling very large DSLR image: %s\n", input_path);
+    // Input validation
+    if (!input_valid(input)) {
+        THINPIC_LOGE("Error: Invalid input path");
+        return result;
+    }
+    
+    if (quality < 1 || quality > 100) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Quality must be between 1 and 100");
+        return result;
+    }
+    
+    THINPIC_LOGD("Auto-compressing image: %s (quality: %d)", input_name(input), quality);
     
-
+    AutoCompressOptions defaults = {1, 0, 1};
+    if (!options) {
+        options = &defaults;
+    }
     
     // Initialize VIPS (thread-safe)
     if (!ensure_vips_initialized()) {
+        THINPIC_LOGE("Error: VIPS initialization failed");
         return result;
     }
     
-    pthread_mutex_lock(&vips_mutex);
+    // Lock VIPS operations for this thread
+    int pipeline_locked = pipeline_lock();
+    
+    // Clear any previous errors
+    vips_error_clear();
     
     VipsImage* image = NULL;
-    VipsImage* small_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
+    VipsImage* processed_image = NULL;
     
-    // Load image
-    vips_error_clear();
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
+    // Load image with error handling
+    THINPIC_LOGD("Loading image...");
+    image = open_input_image(input);
     
     if (!image) {
-        printf("[image_compressor] Error: Failed to load large DSLR image\n");
-        pthread_mutex_unlock(&vips_mutex);
+        THINPIC_LOGE("Error: Failed to load image");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
         return result;
     }
     
-    // Get dimensions
+    // Validate image object
+    if (!VIPS_IS_IMAGE(image)) {
+        THINPIC_LOGE("Error: Invalid image object");
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
+        return result;
+    }
+    
+    // Get image info
     int width = vips_image_get_width(image);
     int height = vips_image_get_height(image);
+    int bands = vips_image_get_bands(image);
     
-    printf("[image_compressor] Large DSLR image: %dx%d\n", width, height);
-    
-    // Create a smaller version for compression (max 6000px)
-    const int max_dimension = 6000;
-    double scale = 1.0;
-    if (width > height) {
-        scale = (double)max_dimension / width;
-    } else {
-        scale = (double)max_dimension / height;
-    }
-    
-    printf("[image_compressor] Creating smaller version with scale: %f\n", scale);
+    THINPIC_LOGD("Image loaded: %dx%d, %d bands", width, height, bands);
     
-    if (vips_resize(image, &small_image, scale, NULL)) {
-        printf("[image_compressor] Error: Failed to create smaller version\n");
+    // Validate image dimensions
+    if (width <= 0 || height <= 0 || bands <= 0) {
+        THINPIC_LOGE("Error: Invalid image dimensions");
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
+        pipeline_unlock(pipeline_locked);
         return result;
     }
     
-    g_object_unref(image);
-    image = small_image;
-    
-    // Convert to sRGB
-    VipsImage* srgb_image = NULL;
-    if (vips_copy(image, &srgb_image, 
-            "interpretation", VIPS_INTERPRETATION_sRGB,
-            NULL)) {
-        printf("[image_compressor] Error: Failed to convert to sRGB\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    // Camera sources are photographic; lossless and palette formats never win on them
+    const char* loader = NULL;
+    int photographic = 0;
+    if (!vips_image_get_string(image, "vips-loader", &loader) && loader) {
+        photographic = strncmp(loader, "jpegload", 8) == 0 || strncmp(loader, "heifload", 8) == 0;
     }
     
-    g_object_unref(image);
-    image = srgb_image;
+    // Compression strategy based on dimensions only
+    int new_width = width;
+    int new_height = height;
+    int needs_resize = 0;
     
-    // Use user-specified quality
-    int final_quality = quality;
-    printf("[image_compressor] Compressing DSLR with quality: %d\n", final_quality);
+    // Resize if largest dimension is over the preset's cap
+    const int max_dimension = thinpic_tuning()->max_dimension;
+    if (width > max_dimension || height > max_dimension) {
+        needs_resize = 1;
+        if (width > height) {
+            new_width = max_dimension;
+            new_height = (int)((double)height * max_dimension / width);
+        } else {
+            new_height = max_dimension;
+            new_width = (int)((double)width * max_dimension / height);
+        }
+        THINPIC_LOGD("Resizing from %dx%d to %dx%d", width, height, new_width, new_height);
+    }
     
+    // Process image (resize if needed and convert to sRGB)
     vips_error_clear();
-    int save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-        "Q", final_quality,
-        // "strip", TRUE,
-        "optimize_coding", TRUE,
-        "interlace", FALSE,  // Better for DSLR images
-        "no_subsample", FALSE, // Allow subsampling for better compression
-        NULL);
+    // The candidates render the frame; a resized one streams into the resize
+    if (!needs_resize) image = decode_in_parallel(input, image);
     
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Large DSLR image compression successful: %zu bytes\n", buffer_size);
-    } else {
-        printf("[image_compressor] Error: Failed to compress large DSLR image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    if (needs_resize) {
+        THINPIC_LOGD("Resizing image with high quality...");
+        double scale = 1.0;
+        if (width > height) {
+            scale = (double)max_dimension / width;
+        } else {
+            scale = (double)max_dimension / height;
+        }
+        
+        THINPIC_LOGD("Scale factor: %f", scale);
+        
+        if (resize_image(image, &processed_image, scale, VIPS_KERNEL_LANCZOS3)) {
+            THINPIC_LOGE("Error: Failed to resize image");
+            log_vips_error();
+            g_object_unref(image);
+            pipeline_unlock(pipeline_locked);
+            return result;
+        }
+        g_object_unref(image);
+        image = processed_image;
+        processed_image = NULL;
+        
+        // Get new dimensions
+        width = vips_image_get_width(image);
+        height = vips_image_get_height(image);
+        THINPIC_LOGD("Image resized to: %dx%d", width, height);
+        
+        // Validate resized image
+        if (width <= 0 || height <= 0) {
+            THINPIC_LOGE("Error: Invalid dimensions after resize");
+            g_object_unref(image);
+            pipeline_unlock(pipeline_locked);
+            return result;
         }
     }
     
-    g_object_unref(image);
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
-}
-
-// Smart compression function that targets a specific file size
-CompressedImageResult smart_compress_image(const char* input_path, int target_kb, int type) {
-    CompressedImageResult result = {NULL, 0, -1};
-    
-    printf("[image_compressor] Smart compression: %s (target: %d KB, type: %s)\n", 
-           input_path, target_kb, type == 1 ? "high" : "low");
-    
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
+    // Convert to sRGB for consistent color space
+    THINPIC_LOGD("Converting image to sRGB...");
+    vips_error_clear();
+    if (prepare_output(image, &processed_image)) {
+        THINPIC_LOGE("Error: Failed to convert image to sRGB");
+        log_vips_error();
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
         return result;
     }
     
-    if (target_kb <= 0) {
-        printf("[image_compressor] Error: Invalid target KB\n");
+    g_object_unref(image);
+    image = processed_image;
+    processed_image = NULL;
+    
+    // Validate final image before compression
+    if (!VIPS_IS_IMAGE(image)) {
+        THINPIC_LOGE("Error: Invalid image after processing");
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
         return result;
     }
     
-    // Check if file exists
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        printf("[image_compressor] Error: Cannot open file: %s\n", input_path);
+    int final_width = vips_image_get_width(image);
+    int final_height = vips_image_get_height(image);
+    int final_bands = vips_image_get_bands(image);
+    THINPIC_LOGD("Final image: %dx%d, %d bands", final_width, final_height, final_bands);
+    
+    // Every candidate encodes the same pixels, so render them once; the
+    // candidate views read through it, so watching it kills them all
+    processed_image = decode_to_memory(image);
+    g_object_unref(image);
+    thinpic_cancel_watch(processed_image);
+    if (!processed_image) {
+        THINPIC_LOGE("Error: Failed to decode image into memory");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
         return result;
     }
-    fclose(file);
-    
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
+    // Bands dropped here are spared by every candidate
+    image = prepare_bands(processed_image, FORMAT_AUTO);
+    processed_image = NULL;
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to prepare the image bands");
+        vips_error_clear();
+        pipeline_unlock(pipeline_locked);
         return result;
     }
-    
-    // Calculate size buffers (20% tolerance)
-    int up_size_buffer_kb = (int)(target_kb * 1.2);
-    int down_size_buffer_kb = (int)(target_kb * 0.8);
-    
-    printf("[image_compressor] Target range: %d - %d KB\n", down_size_buffer_kb, up_size_buffer_kb);
-    
-    // Determine quality range based on type
-    int start_quality = (type == 1) ? 93 : 85;  // high = 93, low = 85
-    int end_quality = 40;
-    int quality_step = 3;
-    
-    printf("[image_compressor] Quality range: %d to %d (step: %d)\n", start_quality, end_quality, quality_step);
-    
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Try quality sweep from high to low
-    for (int quality = start_quality; quality >= end_quality; quality -= quality_step) {
-        printf("[image_compressor] Trying quality: %d\n", quality);
+    final_bands = vips_image_get_bands(image);
+    
+    size_t accept_below = options->accept_below_kb > 0 ? (size_t)options->accept_below_kb * 1024 : 0;
+    if (options->classify) {
+        int ambiguous = 0;
+        ThinpicContent content = thinpic_classify(image, &ambiguous);
+        EncodeArena* arena = thinpic_arena_acquire();
+        uint8_t* direct = NULL;
+        size_t direct_length = 0;
+        int format = encode_classified(image, content, ambiguous, quality, final_bands, &arena, &direct,
+                                       &direct_length);
+        size_t length = direct ? direct_length : arena->length;
+        if (format >= 0 && (accept_below == 0 || length <= accept_below)) {
+            result.data = direct ? direct : thinpic_arena_copy(arena);
+            if (result.data) {
+                result.length = length;
+                result.success = 1;
+            }
+        } else {
+            g_free(direct);
+        }
+        thinpic_arena_release(arena);
         
-        // Clear any previous errors
+        if (result.success == 1) {
+            THINPIC_LOGI("Auto-compression successful: %zu bytes (%s, format: %d)",
+                   result.length, thinpic_content_name(content), format);
+            g_object_unref(image);
+            pipeline_unlock(pipeline_locked);
+            return result;
+        }
         vips_error_clear();
+        THINPIC_LOGD("Classified %s encode %s, racing every format", thinpic_content_name(content),
+                     format >= 0 ? "over the threshold" : "failed");
+    }
+    
+    // Define formats to try in order of preference for size
+    ImageFormat formats_to_try[] = {
+        FORMAT_WEBP,    // Usually smallest for photos
+        FORMAT_AVIF,    // Smaller still for photos, slowest to encode
+        FORMAT_JPEG,    // Good for photos
+        FORMAT_JXL,     // Excellent compression
+        FORMAT_HEIF,    // Good compression
+        FORMAT_JP2K,    // Good compression
+        FORMAT_TIFF,    // Good for some images
+        FORMAT_PNG,     // Lossless, usually larger
+        FORMAT_GIF      // Only for animated images
+    };
+    
+    int num_formats = sizeof(formats_to_try) / sizeof(formats_to_try[0]);
+    
+    AutoRace race;
+    memset(&race, 0, sizeof(race));
+    pthread_mutex_init(&race.lock, NULL);
+    race.accept_below = accept_below;
+    race.winner = -1;
+    race.quality = quality;
+    race.bands = final_bands;
+    // Which encoder finishes first is timing; the preference order is not
+    race.ordered = deterministic_output();
+    
+    for (int i = 0; i < num_formats; i++) {
+        ImageFormat current_format = formats_to_try[i];
         
-        VipsImage* image = NULL;
-        VipsImage* processed_image = NULL;
-        void* buffer = NULL;
-        size_t buffer_size = 0;
-        
-        // Load image for this iteration
-        image = vips_image_new_from_file(input_path, 
-            "fail_on", VIPS_FAIL_ON_NONE,
-            "access", VIPS_ACCESS_SEQUENTIAL,
-
-            NULL);
+        if (!format_available(current_format)) {
+            THINPIC_LOGD("Format %d skipped: no encoder in this build", current_format);
+            continue;
+        }
+        if (options->skip_unlikely_formats && photographic &&
+                (current_format == FORMAT_PNG || current_format == FORMAT_TIFF || current_format == FORMAT_GIF)) {
+            THINPIC_LOGD("Format %d skipped for photographic source", current_format);
+            continue;
+        }
         
-        if (!image) {
-            printf("[image_compressor] Error: Failed to load image for quality %d\n", quality);
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
+        // Each candidate gets its own view so it can be killed without touching the others
+        AutoCandidate* candidate = &race.candidates[race.count];
+        if (vips_copy(image, &candidate->view, NULL)) {
             vips_error_clear();
-            continue; // Try next quality
+            continue;
         }
-        
-        // Validate image object
-        if (!VIPS_IS_IMAGE(image)) {
-            printf("[image_compressor] Error: Invalid image object for quality %d\n", quality);
-            g_object_unref(image);
-            continue; // Try next quality
+        candidate->race = &race;
+        candidate->format = current_format;
+        candidate->arena = thinpic_arena_acquire();
+        race.count++;
+    }
+    
+    for (int i = 0; i < race.count; i++) {
+        AutoCandidate* candidate = &race.candidates[i];
+        candidate->started = pthread_create(&candidate->thread, NULL, auto_candidate_main, candidate) == 0;
+        if (!candidate->started) {
+            // No thread to spare; encode inline rather than drop the format
+            auto_candidate_main(candidate);
         }
-        
-        // Get image dimensions
-        int width = vips_image_get_width(image);
-        int height = vips_image_get_height(image);
-        
-        // Apply resize for high quality type
-        if (type == 1) { // high quality
-            printf("[image_compressor] Applying high quality resize (1.3x)\n");
-            if (vips_resize(image, &processed_image, 1.3, 
-                    "kernel", VIPS_KERNEL_LANCZOS3,
-                    NULL)) {
-                printf("[image_compressor] Error: Failed to resize for high quality\n");
-                const char* error = vips_error_buffer();
-                if (error && strlen(error) > 0) {
-                    printf("[image_compressor] VIPS error: %s\n", error);
-                }
-                vips_error_clear();
-                g_object_unref(image);
-                continue; // Try next quality
-            }
-            g_object_unref(image);
-            image = processed_image;
-            processed_image = NULL;
+    }
+    
+    for (int i = 0; i < race.count; i++) {
+        if (race.candidates[i].started) {
+            pthread_join(race.candidates[i].thread, NULL);
         }
-        
-        // Convert to sRGB for consistent color space
-        vips_error_clear();
-        if (vips_copy(image, &processed_image, 
-                "interpretation", VIPS_INTERPRETATION_sRGB,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to convert to sRGB for quality %d\n", quality);
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
+    }
+    // Cancelled and unavailable encoders leave messages behind
+    vips_error_clear();
+    
+    // The early winner if one beat the threshold, otherwise the smallest
+    int best = race.winner;
+    for (int i = 0; best < 0 && race.ordered && race.accept_below > 0 && i < race.count; i++) {
+        if (race.candidates[i].ok && race.candidates[i].size <= race.accept_below) best = i;
+    }
+    if (best < 0) {
+        for (int i = 0; i < race.count; i++) {
+            if (race.candidates[i].ok &&
+                    (best < 0 || race.candidates[i].size < race.candidates[best].size)) {
+                best = i;
             }
-            vips_error_clear();
-            g_object_unref(image);
-            continue; // Try next quality
         }
-        
-        g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
-        
-        // Compress with current quality
-        vips_error_clear();
-        int save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-            "Q", quality,
-            "optimize_coding", TRUE,
-            //  "strip", TRUE,
-            NULL);
-        
-        if (save_result == 0 && buffer && buffer_size > 0) {
-            // Calculate size in KB
-            int size_kb = (int)(buffer_size / 1024);
-            printf("[image_compressor] Quality %d: %d KB\n", quality, size_kb);
-            
-            // Check if size is within target range
-            if (size_kb <= up_size_buffer_kb && size_kb >= down_size_buffer_kb) {
-                // Success! Found optimal quality
-                result.data = (uint8_t*)buffer;
-                result.length = buffer_size;
+    }
+    
+    for (int i = 0; i < race.count; i++) {
+        AutoCandidate* candidate = &race.candidates[i];
+        if (i == best) {
+            // Only the winner leaves its arena
+            result.data = thinpic_arena_copy(candidate->arena);
+            if (result.data) {
+                result.length = candidate->size;
                 result.success = 1;
-                
-                printf("[image_compressor] ✅ Smart compression success!\n");
-                printf("[image_compressor] Filename: %s\n", strrchr(input_path, '/') ? strrchr(input_path, '/') + 1 : input_path);
-                printf("[image_compressor] Final Quality: %d, Size: %d KB\n", quality, size_kb);
-                
-                g_object_unref(image);
-                pthread_mutex_unlock(&vips_mutex);
-                return result;
-            } else {
-                // Size not in range, free buffer and try next quality
-                printf("[image_compressor] Size %d KB not in range %d-%d KB, trying next quality\n", 
-                       size_kb, down_size_buffer_kb, up_size_buffer_kb);
-                g_free(buffer);
-                buffer = NULL;
-                buffer_size = 0;
-            }
-        } else {
-            printf("[image_compressor] Error: Failed to compress with quality %d\n", quality);
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
             }
-            vips_error_clear();
-        }
-        
-        // Cleanup for this iteration
-        if (buffer) {
-            g_free(buffer);
         }
-        g_object_unref(image);
+        thinpic_arena_release(candidate->arena);
+        g_object_unref(candidate->view);
     }
+    pthread_mutex_destroy(&race.lock);
+    g_object_unref(image);
     
-    // If we get here, no quality setting achieved the target size
-    printf("[image_compressor] ❌ Smart compression failed: Could not achieve target size\n");
-    printf("[image_compressor] Tried quality range: %d to %d\n", start_quality, end_quality);
+    if (result.success == 1) {
+        THINPIC_LOGI("Auto-compression successful: %zu bytes (best format: %d%s)", 
+               result.length, race.candidates[best].format, race.winner >= 0 ? ", under threshold" : "");
+    } else {
+        THINPIC_LOGE("Error: All formats failed");
+    }
     
-    pthread_mutex_unlock(&vips_mutex);
+    pipeline_unlock(pipeline_locked);
     return result;
 }
 
-// Format-aware version of compress_large_image
-CompressedImageResult compress_large_image_with_format(const char* input_path, int quality, ImageFormat format) {
-    CompressedImageResult result = {NULL, 0, -1};
-    
-    // Auto-detect format if requested
-    if (format == FORMAT_AUTO) {
-        format = detect_format_from_path(input_path);
-        printf("[image_compressor] Auto-detected format: %d\n", format);
+CompressedImageResult auto_compress_image_with_options(const char* input_path, int quality, const AutoCompressOptions* options) {
+    ThinpicInput input = path_input(input_path);
+    return auto_compress_image_with_options_from_input(&input, quality, options);
+}
+
+CompressedImageResult auto_compress_image(const char* input_path, int quality) {
+    return auto_compress_image_with_options(input_path, quality, NULL);
+}
+
+// Responsive variants from one decode. The source is decoded once at the
+// largest size any variant needs (shrink-on-load where the loader can), then
+// each smaller variant is resized from the previous one, largest first, and
+// all the encodes run concurrently.
+typedef struct {
+    VipsImage* image;   // Rendered variant, NULL when it failed
+    ImageFormat format;
+    int quality;
+    pthread_t thread;
+    int started;
+    EncodeArena* arena;
+    int ok;
+} VariantJob;
+
+// Scale of the source for one variant; the same box rules as
+// compress_image_with_size_and_format, including the default preset's cap
+// when neither side is given
+static double variant_scale(int width, int height, const ThinpicVariant* variant) {
+    if (variant->width > 0 && variant->height > 0) {
+        double scale_x = (double)variant->width / width;
+        double scale_y = (double)variant->height / height;
+        return scale_x < scale_y ? scale_x : scale_y;
+    }
+    if (variant->width > 0) return (double)variant->width / width;
+    if (variant->height > 0) return (double)variant->height / height;
+    const int max_dimension = thinpic_tuning()->max_dimension;
+    int longest = width > height ? width : height;
+    return longest > max_dimension ? (double)max_dimension / longest : 1.0;
+}
+
+static void* variant_job_main(void* arg) {
+    VariantJob* job = (VariantJob*)arg;
+    VipsImage* view = NULL;
+    // sRGB for consistent colour, except GIF which stays as-is
+    int failed = format_has(job->format, FORMAT_CAP_INDEXED)
+        ? vips_copy(job->image, &view, NULL)
+        : prepare_output(job->image, &view);
+    if (failed) return NULL;
+    VipsTarget* target = thinpic_arena_target(job->arena);
+    if (target) {
+        job->ok = encode_auto_candidate(view, job->format, job->quality, vips_image_get_bands(view),
+                                        target) == 0 && job->arena->length > 0;
+        g_object_unref(target);
+    }
+    g_object_unref(view);
+    return NULL;
+}
+
+static int compress_image_variants_from_input(const ThinpicInput* input, const ThinpicVariant* variants,
+                                              int count, CompressedImageResult* out) {
+    if (!out || !variants || count < 1 || count > THINPIC_MAX_VARIANTS || !input_valid(input)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid variant arguments");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        CompressedImageResult empty = {NULL, 0, -1};
+        out[i] = empty;
+        if (variants[i].quality < 1 || variants[i].quality > 100 || variants[i].width < 0 ||
+                variants[i].height < 0) {
+            thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+            THINPIC_LOGE("Error: Invalid variant %d", i);
+            return -1;
+        }
     }
     
-    printf("[image_compressor] Handling large image with format %d: %s\n", format, input_path);
-    
-    // Initialize VIPS (thread-safe)
     if (!ensure_vips_initialized()) {
-        return result;
+        THINPIC_LOGE("Error: VIPS initialization failed");
+        return -1;
     }
     
-    pthread_mutex_lock(&vips_mutex);
-    
-    VipsImage* image = NULL;
-    VipsImage* small_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image
+    int pipeline_locked = pipeline_lock();
     vips_error_clear();
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
     
+    VipsImage* image = open_input_image(input);
     if (!image) {
-        printf("[image_compressor] Error: Failed to load large image\n");
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        THINPIC_LOGE("Error: Failed to load image: %s", input_name(input));
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return -1;
     }
-    
-    // Get dimensions
     int width = vips_image_get_width(image);
     int height = vips_image_get_height(image);
-    
-    printf("[image_compressor] Large image: %dx%d\n", width, height);
-    
-    // Create a smaller version for compression (max 6000px)
-    const int max_dimension = 6000;
-    double scale = 1.0;
-    if (width > height) {
-        scale = (double)max_dimension / width;
-    } else {
-        scale = (double)max_dimension / height;
+    ImageFormat input_format = FORMAT_AUTO;
+    
+    // Largest first, so each variant can be resized from the one before it
+    int order[THINPIC_MAX_VARIANTS];
+    double scales[THINPIC_MAX_VARIANTS];
+    for (int i = 0; i < count; i++) {
+        scales[i] = variant_scale(width, height, &variants[i]);
+        int at = i;
+        while (at > 0 && scales[order[at - 1]] < scales[i]) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = i;
     }
     
-    printf("[image_compressor] Creating smaller version with scale: %f\n", scale);
-    
-    if (vips_resize(image, &small_image, scale, NULL)) {
-        printf("[image_compressor] Error: Failed to create smaller version\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    // One decode, straight to the largest variant when that is a reduction
+    double base_scale = scales[order[0]];
+    VipsImage* decoded = NULL;
+    if (base_scale < 1.0) {
+        decoded = shrink_on_load(input, (int)(width * base_scale + 0.5), (int)(height * base_scale + 0.5));
+        if (!decoded && resize_image(image, &decoded, base_scale, VIPS_KERNEL_LANCZOS3)) {
+            decoded = NULL;
+        }
+    } else {
+        image = decode_in_parallel(input, image);
+        g_object_ref(image);
+        decoded = image;
     }
-    
+    VipsImage* base = decoded ? decode_to_memory(decoded) : NULL;
+    if (decoded) g_object_unref(decoded);
     g_object_unref(image);
-    image = small_image;
+    thinpic_cancel_watch(base);
+    if (!base) {
+        THINPIC_LOGE("Error: Failed to decode image for variants");
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        return -1;
+    }
     
-    // Convert to sRGB (except for GIF)
-    if (format != FORMAT_GIF) {
-        VipsImage* srgb_image = NULL;
-        if (vips_copy(image, &srgb_image, 
-                "interpretation", VIPS_INTERPRETATION_sRGB,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to convert to sRGB\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+    // Resize cascade: every rendered variant is the source of the next
+    VariantJob jobs[THINPIC_MAX_VARIANTS];
+    memset(jobs, 0, sizeof(jobs));
+    VipsImage* previous = base;
+    for (int n = 0; n < count; n++) {
+        int i = order[n];
+        VariantJob* job = &jobs[i];
+        job->format = variants[i].format;
+        if (job->format == FORMAT_AUTO) {
+            if (input_format == FORMAT_AUTO) input_format = detect_input_format(input);
+            job->format = input_format;
         }
+        job->quality = variants[i].quality;
         
-        g_object_unref(image);
-        image = srgb_image;
+        int target_width = (int)(width * scales[i] + 0.5);
+        int target_height = (int)(height * scales[i] + 0.5);
+        if (target_width < 1) target_width = 1;
+        if (target_height < 1) target_height = 1;
+        int previous_width = vips_image_get_width(previous);
+        int previous_height = vips_image_get_height(previous);
+        // Shrink-on-load rounds its own way; a pixel either side is a match
+        if (abs(target_width - previous_width) <= 1 && abs(target_height - previous_height) <= 1) {
+            g_object_ref(previous);
+            job->image = previous;
+            continue;
+        }
+        VipsImage* resized = NULL;
+        if (vips_resize(previous, &resized, (double)target_width / previous_width,
+                "vscale", (double)target_height / previous_height,
+                "kernel", VIPS_KERNEL_LANCZOS3,
+                "gap", resize_gap(),
+                NULL) == 0) {
+            job->image = decode_to_memory(resized);
+            g_object_unref(resized);
+        }
+        if (!job->image) {
+            THINPIC_LOGE("Error: Failed to resize variant %d to %dx%d", i, target_width, target_height);
+            vips_error_clear();
+            continue;
+        }
+        previous = job->image;
+        THINPIC_LOGD("Variant %d: %dx%d, format %d, quality %d", i, target_width, target_height,
+                     job->format, job->quality);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (!jobs[i].image) continue;
+        jobs[i].arena = thinpic_arena_acquire();
+        jobs[i].started = pthread_create(&jobs[i].thread, NULL, variant_job_main, &jobs[i]) == 0;
+        if (!jobs[i].started) {
+            // No thread to spare; encode inline rather than drop the variant
+            variant_job_main(&jobs[i]);
+        }
+    }
+    int written = 0;
+    for (int i = 0; i < count; i++) {
+        VariantJob* job = &jobs[i];
+        if (job->started) pthread_join(job->thread, NULL);
+        if (job->ok) {
+            out[i].data = thinpic_arena_copy(job->arena);
+            if (out[i].data) {
+                out[i].length = job->arena->length;
+                out[i].success = 1;
+                written++;
+            }
+        } else if (job->image) {
+            thinpic_error_code(THINPIC_ERROR_ENCODE);
+            THINPIC_LOGE("Error: Variant %d failed to encode as format %d", i, job->format);
+        }
+        thinpic_arena_release(job->arena);
+        if (job->image) g_object_unref(job->image);
     }
-    
-    // Compression with format-specific settings
-    printf("[image_compressor] Starting compression with format %d...\n", format);
     vips_error_clear();
+    g_object_unref(base);
+    pipeline_unlock(pipeline_locked);
     
-    int save_result = -1;
-    
-    switch (format) {
-        case FORMAT_JPEG:
-            save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "optimize_coding", TRUE,
-                "interlace", FALSE,
-                "no_subsample", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_PNG:
-            // PNG quality is 0-9, convert from 1-100
-            int png_quality = (quality * 9) / 100;
-            if (png_quality < 0) png_quality = 0;
-            if (png_quality > 9) png_quality = 9;
-            
-            save_result = vips_pngsave_buffer(image, &buffer, &buffer_size,
-                "compression", png_quality,
-                "interlace", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_WEBP:
-            save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                "near_lossless", FALSE,
-                "smart_subsample", TRUE,
-                NULL);
-            break;
-            
-        case FORMAT_TIFF:
-            save_result = vips_tiffsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
-                "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
-                NULL);
-            break;
-            
-        case FORMAT_HEIF:
-            save_result = vips_heifsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_JP2K:
-            save_result = vips_jp2ksave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_JXL:
-            save_result = vips_jxlsave_buffer(image, &buffer, &buffer_size,
-                "Q", quality,
-                "lossless", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_GIF:
-            // GIF doesn't support quality, use default settings
-            save_result = vips_gifsave_buffer(image, &buffer, &buffer_size,
+    THINPIC_LOGI("Variants: %d of %d written from one %dx%d decode", written, count, width, height);
+    return written;
+}
+
+int compress_image_variants(const char* input_path, const ThinpicVariant* variants, int count,
+                            CompressedImageResult* out) {
+    ThinpicInput input = path_input(input_path);
+    return compress_image_variants_from_input(&input, variants, count, out);
+}
+
+// Contact sheets: every cell is a centre-cropped thumbnail, made with
+// shrink-on-load on its own thread, and the grid is joined in memory
+typedef struct {
+    const char** paths;
+    const ThinpicSheetLayout* layout;
+    ImageFormat format;
+    int alpha;                   // Cells carry a fourth band for the format's alpha
+    int count;
+    VipsImage** tiles;           // NULL where an input could not be decoded
+    int next;
+} SheetJob;
+
+// Drops *image for the step's result; 0 when the step failed
+static int sheet_advance(VipsImage** image, int failed, VipsImage* next) {
+    g_object_unref(*image);
+    *image = failed ? NULL : next;
+    if (failed && next) g_object_unref(next);
+    return *image != NULL;
+}
+
+// One input as an upright cell_width x cell_height 8-bit sRGB tile in memory
+static VipsImage* sheet_tile(const char* path, const ThinpicSheetLayout* layout, ImageFormat format,
+                             int alpha) {
+    ThinpicInput input = path_input(path);
+    VipsImage* image = thumbnail_on_load(&input, layout->cell_width, layout->cell_height,
+                                         VIPS_INTERESTING_CENTRE);
+    if (!image) {
+        // Platform decoders and the like: the full decode, cut down the same way
+        VipsImage* opened = open_input_image(&input);
+        if (opened && vips_thumbnail_image(opened, &image, layout->cell_width,
+                "height", layout->cell_height,
+                "size", VIPS_SIZE_DOWN,
+                "crop", VIPS_INTERESTING_CENTRE,
+                NULL)) {
+            image = NULL;
+        }
+        if (opened) g_object_unref(opened);
+        if (!image) return NULL;
+    }
+    VipsImage* next = narrow_depth(image, format);
+    g_object_unref(image);
+    image = next;
+    if (!sheet_advance(&image, thinpic_to_srgb(image, &next), next)) return NULL;
+    // Grey tiles join colour ones, so every tile has the same bands
+    if (vips_image_get_bands(image) < 3 &&
+            !sheet_advance(&image, vips_colourspace(image, &next, VIPS_INTERPRETATION_sRGB, NULL), next)) {
+        return NULL;
+    }
+    if (vips_image_get_format(image) != VIPS_FORMAT_UCHAR &&
+            !sheet_advance(&image, vips_cast_uchar(image, &next, NULL), next)) {
+        return NULL;
+    }
+    int bands = vips_image_get_bands(image);
+    if (!alpha && bands > 3) {
+        int flattened = thinpic_flatten_alpha(image, &next);
+        if (flattened != 0 && !sheet_advance(&image, flattened < 0, next)) return NULL;
+    } else if (alpha && bands == 3 &&
+               !sheet_advance(&image, vips_bandjoin_const1(image, &next, 255.0, NULL), next)) {
+        return NULL;
+    }
+    // Sources smaller than the cell are not upscaled; they sit in its centre
+    if ((vips_image_get_width(image) != layout->cell_width || vips_image_get_height(image) != layout->cell_height) &&
+            !sheet_advance(&image, vips_gravity(image, &next, VIPS_COMPASS_DIRECTION_CENTRE, layout->cell_width,
+                                                layout->cell_height, "extend", VIPS_EXTEND_BLACK, NULL), next)) {
+        return NULL;
+    }
+    next = decode_to_memory(image);
+    g_object_unref(image);
+    return next;
+}
+
+static void* sheet_worker(void* arg) {
+    SheetJob* job = (SheetJob*)arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) break;
+        job->tiles[i] = job->paths[i] ? sheet_tile(job->paths[i], job->layout, job->format, job->alpha) : NULL;
+        if (!job->tiles[i]) {
+            THINPIC_LOGW("Contact sheet: cell %d left blank (%s)", i, job->paths[i] ? job->paths[i] : "(null)");
+            vips_error_clear();
+        }
+    }
+    return NULL;
+}
+
+// The sheet's layout as JSON: its size, the cell size and each input's
+// rectangle by index (null for a blank cell)
+static char* sheet_json(int width, int height, const ThinpicSheetLayout* layout, const ThinpicSheetCell* cells,
+                        int count) {
+    GString* json = g_string_new(NULL);
+    g_string_append_printf(json, "{\"width\":%d,\"height\":%d,\"cell_width\":%d,\"cell_height\":%d,\"cells\":[",
+                           width, height, layout->cell_width, layout->cell_height);
+    for (int i = 0; i < count; i++) {
+        if (i) g_string_append_c(json, ',');
+        if (cells[i].success == 1) {
+            g_string_append_printf(json, "{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d}", cells[i].x, cells[i].y,
+                                   cells[i].width, cells[i].height);
+        } else {
+            g_string_append(json, "null");
+        }
+    }
+    g_string_append(json, "]}");
+    return g_string_free(json, FALSE);
+}
+
+CompressedImageResult thinpic_contact_sheet(const char** input_paths, int count, const ThinpicSheetLayout* layout,
+                                            ThinpicSheetCell* cells, char** offsets_json) {
+    CompressedImageResult result = {NULL, 0, -1};
+    if (offsets_json) *offsets_json = NULL;
+    if (!input_paths || count < 1 || count > THINPIC_SHEET_MAX_CELLS || !layout || layout->columns < 0 ||
+            layout->cell_width < 1 || layout->cell_height < 1 || layout->cell_width > THINPIC_SHEET_MAX_CELL ||
+            layout->cell_height > THINPIC_SHEET_MAX_CELL || layout->spacing < 0 || layout->spacing > 256 ||
+            layout->quality < 1 || layout->quality > 100 ||
+            (layout->format != FORMAT_AUTO && !thinpic_concrete_format(layout->format))) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid contact sheet arguments");
+        return result;
+    }
+    if (!ensure_vips_initialized()) {
+        THINPIC_LOGE("Error: VIPS initialization failed");
+        return result;
+    }
+    ImageFormat format = layout->format == FORMAT_AUTO ? FORMAT_JPEG : layout->format;
+    int columns = layout->columns;
+    if (columns == 0) {
+        while (columns * columns < count) columns++;
+    }
+    if (columns > count) columns = count;
+    int rows = (count + columns - 1) / columns;
+
+    int pipeline_locked = pipeline_lock();
+    vips_error_clear();
+    double start = monotonic_ms();
+    SheetJob job = {input_paths, layout, format, format_has(format, FORMAT_CAP_ALPHA), count,
+                    g_new0(VipsImage*, count), 0};
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus : 1;
+    if (workers > 8) workers = 8;
+    if (workers > count) workers = count;
+    pthread_t threads[8];
+    int started = 0;
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, sheet_worker, &job) != 0) break;
+        started++;
+    }
+    sheet_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    // Blank cells keep the grid, so every rectangle is where the index puts it
+    int placed = 0;
+    VipsImage* blank = NULL;
+    for (int i = 0; i < count; i++) {
+        if (job.tiles[i]) {
+            placed++;
+        } else if (!blank) {
+            VipsImage* black = NULL;
+            if (vips_black(&black, layout->cell_width, layout->cell_height, "bands", job.alpha ? 4 : 3, NULL) == 0) {
+                if (vips_copy(black, &blank, "format", VIPS_FORMAT_UCHAR,
+                        "interpretation", VIPS_INTERPRETATION_sRGB, NULL)) {
+                    blank = NULL;
+                }
+                g_object_unref(black);
+            }
+        }
+    }
+    VipsImage* sheet = NULL;
+    int failed = placed == 0 || (placed < count && !blank);
+    if (!failed) {
+        VipsImage** grid = g_new(VipsImage*, count);
+        for (int i = 0; i < count; i++) grid[i] = job.tiles[i] ? job.tiles[i] : blank;
+        VipsImage* joined = NULL;
+        failed = vips_arrayjoin(grid, &joined, count,
+            "across", columns,
+            "shim", layout->spacing,
+            NULL);
+        g_free(grid);
+        // The same spacing around the edge as between the cells
+        if (!failed && layout->spacing > 0) {
+            failed = vips_embed(joined, &sheet, layout->spacing, layout->spacing,
+                vips_image_get_width(joined) + 2 * layout->spacing,
+                vips_image_get_height(joined) + 2 * layout->spacing,
+                "extend", VIPS_EXTEND_BLACK,
                 NULL);
-            break;
-            
-        default:
-            printf("[image_compressor] Error: Unsupported format %d\n", format);
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+            g_object_unref(joined);
+        } else if (!failed) {
+            sheet = joined;
+        }
     }
-    
-    if (save_result == 0 && buffer && buffer_size > 0) {
+    void* buffer = NULL;
+    size_t length = 0;
+    if (!failed) {
+        FormatSettings settings = format_settings(layout->quality);
+        failed = format_save_buffer(sheet, format, &settings, &buffer, &length);
+        if (failed) thinpic_error_code(THINPIC_ERROR_ENCODE);
+    } else {
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+    }
+
+    ThinpicSheetCell* map = g_new0(ThinpicSheetCell, count);
+    for (int i = 0; i < count; i++) {
+        map[i].x = layout->spacing + (i % columns) * (layout->cell_width + layout->spacing);
+        map[i].y = layout->spacing + (i / columns) * (layout->cell_height + layout->spacing);
+        map[i].width = layout->cell_width;
+        map[i].height = layout->cell_height;
+        map[i].success = job.tiles[i] ? 1 : -1;
+    }
+    int sheet_width = columns * layout->cell_width + (columns + 1) * layout->spacing;
+    int sheet_height = rows * layout->cell_height + (rows + 1) * layout->spacing;
+    if (!failed) {
         result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
+        result.length = length;
+        result.success = 1;
+        if (cells) memcpy(cells, map, sizeof(ThinpicSheetCell) * count);
+        if (offsets_json) *offsets_json = sheet_json(sheet_width, sheet_height, layout, map, count);
+        THINPIC_LOGI("Contact sheet: %d of %d cells, %dx%d, %zu bytes in %.1f ms", placed, count, sheet_width,
+                     sheet_height, length, monotonic_ms() - start);
+    } else {
+        THINPIC_LOGE("Error: Contact sheet failed with %d of %d cells decoded", placed, count);
+        log_vips_error();
+    }
+    g_free(map);
+    if (sheet) g_object_unref(sheet);
+    if (blank) g_object_unref(blank);
+    for (int i = 0; i < count; i++) {
+        if (job.tiles[i]) g_object_unref(job.tiles[i]);
+    }
+    g_free(job.tiles);
+    vips_error_clear();
+    pipeline_unlock(pipeline_locked);
+    return result;
+}
+
+// Fast WebP compression for speed-critical applications
+static CompressedImageResult fast_webp_compress_from_input(const ThinpicInput* input, int quality) {
+    // Minimal processing: only images over the minimal cap (8000 px built
+    // in) are resized, bilinear
+    Pipeline pipeline = {"Fast WebP compression", FORMAT_WEBP, quality, SAVE_PRESET_FAST_WEBP, 0, 0, 2,
+                         {fit_longest(thinpic_tuning()->minimal_max_dimension, 1, VIPS_KERNEL_LINEAR),
+                          srgb_step()}};
+    return run_pipeline(input, &pipeline);
+}
+
+CompressedImageResult fast_webp_compress(const char* input_path, int quality) {
+    ThinpicInput input = path_input(input_path);
+    return fast_webp_compress_from_input(&input, quality);
+}
+
+static CompressedImageResult dispatch_options(const ThinpicInput* input, const CompressOptions* options) {
+    switch (options->mode) {
+        case COMPRESS_MODE_STANDARD:
+            return compress_image_with_size_and_format_from_input(input, options->quality,
+                options->target_width, options->target_height, options->format);
+        case COMPRESS_MODE_LARGE:
+            return compress_large_image_with_format_from_input(input, options->quality, options->format);
+        case COMPRESS_MODE_LARGE_DSLR:
+            return compress_large_dslr_image_with_format_from_input(input, options->quality, options->format);
+        case COMPRESS_MODE_SMART:
+            return smart_compress_image_with_format_from_input(input, options->target_kb,
+                options->smart_type, options->format);
+        case COMPRESS_MODE_AUTO: {
+            // target_kb doubles as the early-acceptance threshold: a classified
+            // encode over it falls back to the format race
+            AutoCompressOptions auto_options = {1, options->target_kb, 1};
+            return auto_compress_image_with_options_from_input(input, options->quality, &auto_options);
+        }
+        case COMPRESS_MODE_FAST_WEBP:
+            return fast_webp_compress_from_input(input, options->quality);
+        case COMPRESS_MODE_STREAM:
+            return stream_compress_image_from_input(input, options->quality,
+                options->target_width, options->target_height, options->format);
+        case COMPRESS_MODE_LOSSLESS_JPEG:
+        case COMPRESS_MODE_JPEG_OPTIMIZE:
+            if (detect_input_format(input) != FORMAT_JPEG) {
+                // Re-encoding would defeat the point of asking for lossless
+                THINPIC_LOGE("Error: Lossless mode needs a JPEG input: %s", input_name(input));
+                CompressedImageResult failed = {NULL, 0, -1};
+                return failed;
+            }
+            if (options->mode == COMPRESS_MODE_JPEG_OPTIMIZE) return thinpic_jpeg_optimize(input);
+            return thinpic_jpeg_lossless(input, options);
+        case COMPRESS_MODE_THUMBNAIL:
+            return thumbnail_compress_image_from_input(input, options->quality,
+                options->target_width, options->target_height, options->format);
+    }
+    
+    THINPIC_LOGE("Error: Unknown compress mode %d", options->mode);
+    CompressedImageResult result = {NULL, 0, -1};
+    return result;
+}
+
+// Entry points whose outputs share the cache; part of every key
+#define CACHE_KEY_OPTIONS 1
+#define CACHE_KEY_THINPIC_COMPRESS 2
+#define CACHE_KEY_THINPIC_COMPRESS_DETERMINISTIC 3  // thinpic_configure deterministic
+
+// Key over everything that shapes a CompressOptions result (priority only
+// schedules it); 0 when the output cache is off
+static int options_cache_key(const ThinpicInput* input, const CompressOptions* options, ThinpicCacheKey* key) {
+    const ThinpicTuning* tuning = thinpic_tuning();
+    int32_t params[] = {
+        CACHE_KEY_OPTIONS, options->mode, options->format, options->quality,
+        options->target_width, options->target_height, options->target_kb, options->smart_type,
+        options->crop_x, options->crop_y, options->crop_width, options->crop_height,
+        __atomic_load_n(&runtime_config.skip_compliant, __ATOMIC_RELAXED),
+        __atomic_load_n(&runtime_config.metadata_policy, __ATOMIC_RELAXED),
+        // Bytes made without it may differ from what a deterministic call writes
+        deterministic_output(),
+        // The preset by its values, so a reloaded arm misses
+        tuning->max_dimension, tuning->minimal_max_dimension, tuning->smart_quality[0], tuning->smart_quality[1],
+        tuning->smart_quality[2], tuning->smart_quality[3], tuning->search_start_quality, tuning->search_end_quality
+    };
+    return thinpic_output_cache_key(input, params, sizeof(params), key);
+}
+
+static double monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+CompressedImageResult thinpic_compress_input(const ThinpicInput* input, const CompressOptions* options,
+                                             CompressionStats* stats) {
+    // Telemetry needs the stats even when the caller did not ask for them
+    CompressionStats telemetry_stats;
+    int telemetry = thinpic_telemetry_armed();
+    if (!stats && telemetry) stats = &telemetry_stats;
+    size_t highwater_before = vips_tracked_get_mem_highwater();
+    size_t mem_before = vips_tracked_get_mem();
+    double start = monotonic_ms();
+    
+    // Modes that search for a quality report the one they settle on
+    thinpic_error_reset();
+    thinpic_stages_bind(stats);
+    thinpic_tuning_bind(options->preset);
+    int lossless = options->mode == COMPRESS_MODE_LOSSLESS_JPEG || options->mode == COMPRESS_MODE_JPEG_OPTIMIZE;
+    thinpic_stage_quality(lossless ? -1 : options->quality);
+    ThinpicInput mapped_input = *input;
+    if (options->page > 0) mapped_input.page = options->page;
+    MappedInput mapping;
+    int traced = thinpic_trace_begin("thinpic job (mode %d, format %d)", options->mode, options->format);
+    map_path_input(&mapped_input, &mapping);
+    ThinpicCacheKey cache_key;
+    int cacheable = options_cache_key(&mapped_input, options, &cache_key);
+    ThinpicCachedOutput cached;
+    CompressedImageResult result = {NULL, 0, -1};
+    if (cacheable && thinpic_output_cache_lookup(&cache_key, &cached)) {
+        result.data = cached.data;
+        result.length = cached.length;
         result.success = 1;
-        printf("[image_compressor] Large image compression successful: %zu bytes (format: %d)\n", buffer_size, format);
+        THINPIC_LOGI("Output cache hit: %zu bytes (mode %d)", result.length, options->mode);
     } else {
-        printf("[image_compressor] Error: Large image compression failed for format %d\n", format);
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+        result = dispatch_options(&mapped_input, options);
+        if (cacheable && result.success == 1) {
+            thinpic_output_cache_store(&cache_key, result.data, result.length, 0, 0, 0);
         }
-        
-        if (buffer) {
-            g_free(buffer);
+    }
+    unmap_path_input(&mapping);
+    thinpic_trace_end(traced);
+    int source_width = 0;
+    int source_height = 0;
+    thinpic_stage_source_size(&source_width, &source_height);
+    thinpic_stages_bind(NULL);
+    int preset = thinpic_tuning()->preset;
+    thinpic_tuning_unbind();
+    
+    if (stats) {
+        stats->elapsed_ms = monotonic_ms() - start;
+        int64_t staged = stats->open_us + stats->decode_us + stats->resize_us + stats->colour_us + stats->copy_us;
+        int64_t elapsed_us = (int64_t)(stats->elapsed_ms * 1000);
+        stats->encode_us = elapsed_us > staged ? elapsed_us - staged : 0;
+        stats->format = -1;
+        if (result.success == 1) {
+            const char* loader = vips_foreign_find_load_buffer(result.data, result.length);
+            stats->format = format_from_loader(loader);
+            if (format_has(stats->format, FORMAT_CAP_LOSSLESS)) stats->quality = -1;
+            // Header only: the loader parses it without decoding pixels
+            VipsImage* header = loader ? vips_image_new_from_buffer(result.data, result.length, "", NULL) : NULL;
+            if (header) {
+                stats->width = vips_image_get_width(header);
+                stats->height = vips_image_get_height(header);
+                g_object_unref(header);
+            }
+            vips_error_clear();
+        } else {
+            stats->quality = -1;
         }
+        stats->peak_mem_delta = (int64_t)vips_tracked_get_mem_highwater() - (int64_t)highwater_before;
+        stats->mem_delta = (int64_t)vips_tracked_get_mem() - (int64_t)mem_before;
+        stats->live_allocs = vips_tracked_get_allocs();
+        stats->open_files = vips_tracked_get_files();
+        THINPIC_LOGD("Stats: %.1f ms, peak +%lld bytes, retained %lld bytes, %d buffers, %d files",
+                     stats->elapsed_ms, (long long)stats->peak_mem_delta, (long long)stats->mem_delta,
+                     stats->live_allocs, stats->open_files);
+        THINPIC_LOGD("Stages (us): open %lld, decode %lld, resize %lld, colour %lld, encode %lld, copy %lld; "
+                     "format %d, quality %d, %dx%d after %d encodes", (long long)stats->open_us,
+                     (long long)stats->decode_us, (long long)stats->resize_us, (long long)stats->colour_us,
+                     (long long)stats->encode_us, (long long)stats->copy_us, stats->format, stats->quality,
+                     stats->width, stats->height, stats->encode_attempts);
+    }
+    
+    if (telemetry) {
+        ThinpicTelemetryRecord record;
+        memset(&record, 0, sizeof(record));
+        record.mode = options->mode;
+        record.error = result.success == 1 ? THINPIC_TELEMETRY_OK
+            : thinpic_cancel_requested() ? THINPIC_TELEMETRY_CANCELLED : THINPIC_TELEMETRY_FAILED;
+        record.input_bytes = input_size(input);
+        record.width = source_width;
+        record.height = source_height;
+        record.output_bytes = result.success == 1 ? (int64_t)result.length : 0;
+        record.stats = *stats;
+        record.preset = preset;
+        thinpic_telemetry_record(&record);
     }
-    
-    g_object_unref(image);
-    pthread_mutex_unlock(&vips_mutex);
     return result;
 }
 
-// Format-aware version of compress_large_dslr_image
-CompressedImageResult compress_large_dslr_image_with_format(const char* input_path, int quality, ImageFormat format) {
+CompressedImageResult compress_buffer(const uint8_t* data, size_t length, const CompressOptions* options) {
     CompressedImageResult result = {NULL, 0, -1};
-    
-    // Auto-detect format if requested
-    if (format == FORMAT_AUTO) {
-        format = detect_format_from_path(input_path);
-        printf("[image_compressor] Auto-detected format: %d\n", format);
-    }
-    
-    printf("[image_compressor] Handling very large DSLR image with format %d: %s\n", format, input_path);
-    
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        return result;
-    }
-    
-    pthread_mutex_lock(&vips_mutex);
-    
-    VipsImage* image = NULL;
-    VipsImage* small_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image
-    vips_error_clear();
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
-    
-    if (!image) {
-        printf("[image_compressor] Error: Failed to load large DSLR image\n");
-        pthread_mutex_unlock(&vips_mutex);
+    if (!data || length == 0 || !options) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid buffer arguments");
         return result;
     }
     
-    // Get dimensions
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    
-    printf("[image_compressor] Large DSLR image: %dx%d\n", width, height);
-    
-    // Create a smaller version for compression (max 6000px)
-    const int max_dimension = 6000;
-    double scale = 1.0;
-    if (width > height) {
-        scale = (double)max_dimension / width;
-    } else {
-        scale = (double)max_dimension / height;
-    }
-    
-    printf("[image_compressor] Creating smaller version with scale: %f\n", scale);
-    
-    if (vips_resize(image, &small_image, scale, NULL)) {
-        printf("[image_compressor] Error: Failed to create smaller version\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
+    ThinpicInput input = {.data = data, .length = length, .fd = -1};
+    return thinpic_compress_input(&input, options, NULL);
+}
+
+CompressedImageResult compress_fd(int fd, const CompressOptions* options) {
+    CompressedImageResult result = {NULL, 0, -1};
+    if (fd < 0 || !options) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid descriptor arguments");
         return result;
     }
     
-    g_object_unref(image);
-    image = small_image;
-    
-    // Convert to sRGB (except for GIF)
-    if (format != FORMAT_GIF) {
-        VipsImage* srgb_image = NULL;
-        if (vips_copy(image, &srgb_image, 
-                "interpretation", VIPS_INTERPRETATION_sRGB,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to convert to sRGB\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
-        
-        g_object_unref(image);
-        image = srgb_image;
-    }
-    
-    // Compression with format-specific settings
-    printf("[image_compressor] Starting DSLR compression with format %d...\n", format);
-    vips_error_clear();
-    
-    int save_result = -1;
+    ThinpicInput input = {.fd = fd};
+    return thinpic_compress_input(&input, options, NULL);
+}
+
+// Unified entry point: one pipeline whose trade-offs come from ThinpicOptions
+// instead of the presets baked into the legacy variants
+
+void thinpic_options_init(ThinpicOptions* options) {
+    if (!options) return;
+    memset(options, 0, sizeof(*options));
+    options->version = THINPIC_OPTIONS_VERSION;
+    options->format = FORMAT_JPEG;
+    options->quality = 80;
+    options->effort = -1;
+    options->kernel = THINPIC_KERNEL_LANCZOS3;
+    options->strip = THINPIC_STRIP_NONE;
+    options->webp_profile = THINPIC_WEBP_PROFILE_DEFAULT;
+    options->webp_sharp_yuv = -1;
+    options->alpha_quality = 0;
+    options->progressive = 0;
+    options->scan_script = THINPIC_SCAN_SCRIPT_DEFAULT;
+    options->scans = NULL;
+    options->scan_count = 0;
+    options->animated = 0;
+    options->png_palette = THINPIC_PNG_PALETTE_OFF;
+    options->png_bitdepth = 0;
+    options->dither = 100;
+    options->png_deflate = THINPIC_PNG_DEFLATE_ZLIB;
+    options->min_ssim = 0;
+    options->crop = THINPIC_CROP_NONE;
+    options->latency_budget_ms = 0;
+    options->heif_compression = THINPIC_HEIF_HEVC;
+    options->heif_subsample = THINPIC_SUBSAMPLE_AUTO;
+    options->jxl_distance = 0;
+    options->jxl_lossless_jpeg = 0;
+    options->perceptual_hash = 0;
+    options->placeholder = THINPIC_PLACEHOLDER_NONE;
+    options->analysis = 0;
+    options->gif_colours = 256;
+    options->gif_interframe = -1;
+    options->jpeg_trellis = -1;
+    options->jpeg_overshoot_deringing = -1;
+    options->jpeg_optimize_scans = -1;
+    options->jpeg_quant_table = THINPIC_QUANT_TABLE_DEFAULT;
+    options->watermark_path = NULL;
+    options->watermark_gravity = THINPIC_GRAVITY_SOUTH_EAST;
+    options->watermark_margin = 16;
+    options->watermark_width = 0;
+    options->watermark_opacity = 1.0;
+    options->palette_colours = 0;
+    options->tensor_width = 0;
+    options->tensor_height = 0;
+    options->tensor_type = THINPIC_TENSOR_UINT8;
+    options->gain_map = THINPIC_GAIN_MAP_STRIP;
+    options->output_path = NULL;
+    options->sink = NULL;
+    options->sink_id = 0;
+}
+
+// Bytes of ThinpicOptions a caller built against `version` actually has
+static size_t options_size(int version) {
+    if (version == 1) return offsetof(ThinpicOptions, webp_profile);
+    if (version == 2) return offsetof(ThinpicOptions, progressive);
+    if (version == 3) return offsetof(ThinpicOptions, animated);
+    if (version == 4) return offsetof(ThinpicOptions, png_palette);
+    if (version == 5) return offsetof(ThinpicOptions, png_deflate);
+    if (version == 6) return offsetof(ThinpicOptions, min_ssim);
+    if (version == 7) return offsetof(ThinpicOptions, crop);
+    if (version == 8) return offsetof(ThinpicOptions, latency_budget_ms);
+    if (version == 9) return offsetof(ThinpicOptions, heif_compression);
+    if (version == 10) return offsetof(ThinpicOptions, jxl_distance);
+    if (version == 11) return offsetof(ThinpicOptions, perceptual_hash);
+    if (version == 12) return offsetof(ThinpicOptions, placeholder);
+    if (version == 13) return offsetof(ThinpicOptions, analysis);
+    if (version == 14) return offsetof(ThinpicOptions, gif_colours);
+    if (version == 15) return offsetof(ThinpicOptions, jpeg_trellis);
+    if (version == 16) return offsetof(ThinpicOptions, watermark_path);
+    if (version == 17) return offsetof(ThinpicOptions, palette_colours);
+    if (version == 18) return offsetof(ThinpicOptions, motion_video);
+    if (version == 19) return offsetof(ThinpicOptions, tensor_width);
+    if (version == 20) return offsetof(ThinpicOptions, gain_map);
+    if (version == 21) return offsetof(ThinpicOptions, output_path);
+    return sizeof(ThinpicOptions);
+}
+
+typedef struct {
+    int effort;
+    int sharp_yuv;
+    int smart_deblock;
+    int alpha_quality;
+} WebpProfile;
+
+// Indexed by ThinpicWebpProfile; see image_compressor.h
+static const WebpProfile webp_profiles[] = {
+    {4, 0, 0, 100},  // DEFAULT
+    {1, 0, 0, 80},   // FAST
+    {4, 0, 0, 100},  // BALANCED
+    {6, 1, 1, 100},  // ARCHIVE
+};
+
+// libvips only writes libjpeg's standard progression; other scripts re-code
+// the baseline output from its coefficients
+static int rescans_jpeg(ImageFormat format, const ThinpicOptions* options) {
+    return format == FORMAT_JPEG && options->progressive &&
+           options->scan_script != THINPIC_SCAN_SCRIPT_DEFAULT;
+}
+
+// Scale the 0-9 effort onto an encoder's own range; -1 picks its default
+static int scaled_effort(int effort, int min, int max, int fallback) {
+    if (effort < 0) return fallback;
+    if (effort > 9) effort = 9;
+    int scaled = min + (effort * (max - min) + 4) / 9;
+    return scaled < min ? min : scaled;
+}
+
+static int save_with_options(VipsImage* image, VipsTarget* target, ImageFormat format,
+                             const ThinpicOptions* options) {
+    int quality = options->quality;
+    int effort = options->effort;
+    VipsForeignKeep keep = keep_for_policy(options->strip);
     
     switch (format) {
-        case FORMAT_JPEG:
-            save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
+        case FORMAT_JPEG: {
+            // A re-code builds optimal Huffman tables and its own scans anyway
+            int rescan = rescans_jpeg(format, options);
+            JpegTuning tuning = jpeg_tuning(options->jpeg_trellis, options->jpeg_overshoot_deringing,
+                                            options->progressive && !rescan ? options->jpeg_optimize_scans : 0,
+                                            options->jpeg_quant_table, effort != 0);
+            return vips_jpegsave_target(image, target,
                 "Q", quality,
-                "optimize_coding", TRUE,
-                "interlace", FALSE,
-                "no_subsample", FALSE,
+                "optimize_coding", effort > 0 && !rescan,  // A second Huffman pass; libvips skips it by default
+                "interlace", options->progressive && !rescan,
+                "subsample_mode", jpeg_subsample(image),
+                "trellis_quant", tuning.trellis,
+                "overshoot_deringing", tuning.overshoot_deringing,
+                "optimize_scans", tuning.optimize_scans,
+                "quant_table", tuning.quant_table,
+                "keep", keep,
                 NULL);
-            break;
+        }
             
         case FORMAT_PNG:
-            // PNG quality is 0-9, convert from 1-100
-            int png_quality = (quality * 9) / 100;
-            if (png_quality < 0) png_quality = 0;
-            if (png_quality > 9) png_quality = 9;
-            
-            save_result = vips_pngsave_buffer(image, &buffer, &buffer_size,
-                "compression", png_quality,
-                "interlace", FALSE,
+            return vips_pngsave_target(image, target,
+                "compression", scaled_effort(effort, 0, 9, 6),
+                "interlace", options->progressive != 0,  // Adam7
+                "keep", keep,
                 NULL);
-            break;
             
-        case FORMAT_WEBP:
-            save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
+        case FORMAT_WEBP: {
+            // The profile fills whatever the caller left at its default
+            WebpProfile profile = webp_profiles[options->webp_profile];
+            if (effort >= 0) {
+                profile.effort = scaled_effort(effort, 0, 6, profile.effort);
+            }
+            if (options->webp_sharp_yuv >= 0) {
+                profile.sharp_yuv = options->webp_sharp_yuv != 0;
+            }
+            if (options->alpha_quality > 0) {
+                profile.alpha_quality = options->alpha_quality > 100 ? 100 : options->alpha_quality;
+            }
+            return vips_webpsave_target(image, target,
                 "Q", quality,
                 "lossless", FALSE,
-                "near_lossless", FALSE,
-                "smart_subsample", TRUE,
+                "effort", profile.effort,
+                "smart_subsample", profile.sharp_yuv,  // libwebp use_sharp_yuv
+                "smart_deblock", profile.smart_deblock,
+                "alpha_q", profile.alpha_quality,
+                "keep", keep,
                 NULL);
-            break;
+        }
             
         case FORMAT_TIFF:
-            save_result = vips_tiffsave_buffer(image, &buffer, &buffer_size,
+            return vips_tiffsave_target(image, target,
                 "Q", quality,
                 "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
-                "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
+                "keep", keep,
                 NULL);
-            break;
             
-        case FORMAT_HEIF:
-            save_result = vips_heifsave_buffer(image, &buffer, &buffer_size,
+        case FORMAT_HEIF: {
+            // The hardware encoder ignores effort and keeps only the profile;
+            // it writes 4:2:0 HEVC only
+            int av1 = options->heif_compression == THINPIC_HEIF_AV1;
+            int full_chroma = options->heif_subsample == THINPIC_SUBSAMPLE_444 ||
+                              (options->heif_subsample == THINPIC_SUBSAMPLE_AUTO && quality >= 90);
+            if (!av1 && !full_chroma) {
+                int handled = thinpic_imageio_save_target(image, FORMAT_HEIF, quality, target);
+                if (handled != 1) return handled;
+            }
+            return vips_heifsave_target(image, target,
                 "Q", quality,
-                "lossless", FALSE,
+                "compression", av1 ? VIPS_FOREIGN_HEIF_COMPRESSION_AV1 : VIPS_FOREIGN_HEIF_COMPRESSION_HEVC,
+                "effort", scaled_effort(effort, 0, 9, 4),
+                "subsample_mode", (VipsForeignSubsample)options->heif_subsample,
+                "keep", keep,
+                NULL);
+        }
+            
+        case FORMAT_AVIF:
+            // Effort left at its default gets the fast preset, not libvips' 4
+            return vips_heifsave_target(image, target,
+                "Q", quality,
+                "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1,
+                "effort", scaled_effort(effort, 0, 9, thinpic_thermal_effort(AVIF_FAST_EFFORT, 0)),
+                "subsample_mode", (VipsForeignSubsample)options->heif_subsample,
+                "keep", keep,
                 NULL);
-            break;
             
         case FORMAT_JP2K:
-            save_result = vips_jp2ksave_buffer(image, &buffer, &buffer_size,
+            return vips_jp2ksave_target(image, target,
                 "Q", quality,
-                "lossless", FALSE,
+                "keep", keep,
                 NULL);
-            break;
             
         case FORMAT_JXL:
-            save_result = vips_jxlsave_buffer(image, &buffer, &buffer_size,
+            // jxlsave derives the distance from Q whenever Q is set; libjxl
+            // encodes on vips_concurrency_get() threads
+            if (options->jxl_distance > 0) {
+                return vips_jxlsave_target(image, target,
+                    "distance", options->jxl_distance,
+                    "effort", scaled_effort(effort, 1, 9, 7),
+                    "keep", keep,
+                    NULL);
+            }
+            return vips_jxlsave_target(image, target,
                 "Q", quality,
-                "lossless", FALSE,
+                "effort", scaled_effort(effort, 1, 9, 7),
+                "keep", keep,
                 NULL);
-            break;
             
-        case FORMAT_GIF:
-            // GIF doesn't support quality, use default settings
-            save_result = vips_gifsave_buffer(image, &buffer, &buffer_size,
-                NULL);
-            break;
+        case FORMAT_GIF: {
+            // Lower quality lets unchanged-looking pixels repeat the previous
+            // frame, which shrinks animations the most
+            ThinpicGifParams gif = {options->gif_colours > 0 ? options->gif_colours : 256, options->dither,
+                                    options->gif_interframe >= 0 ? options->gif_interframe : (100 - quality) / 5,
+                                    options->threads};
+            return gif_save_target(image, &gif, target);
+        }
             
         default:
-            printf("[image_compressor] Error: Unsupported format %d\n", format);
+            THINPIC_LOGE("Error: Unsupported output format %d", format);
+            return -1;
+    }
+}
+
+// Fit image inside the options' max box using their kernel. JPEG sources
+// are re-opened at the largest DCT shrink first; other sources use
+// shrink-on-load for the default Lanczos3 and vips_resize otherwise. A crop
+// always goes through vips_thumbnail (Lanczos3), from the source where it
+// can be reopened and from the open image otherwise.
+static VipsImage* resize_with_options(const ThinpicInput* input, VipsImage* image,
+                                      const ThinpicOptions* options) {
+    if (options->crop != THINPIC_CROP_NONE && options->max_width > 0 && options->max_height > 0) {
+        VipsInteresting crop = (VipsInteresting)options->crop;
+        VipsImage* cropped = thumbnail_on_load(input, options->max_width, options->max_height, crop);
+        if (!cropped && vips_thumbnail_image(image, &cropped, options->max_width,
+                "height", options->max_height,
+                "size", VIPS_SIZE_DOWN,
+                "crop", crop,
+                NULL)) {
             g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+            return NULL;
+        }
+        g_object_unref(image);
+        return cropped;
     }
     
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Large DSLR image compression successful: %zu bytes (format: %d)\n", buffer_size, format);
-    } else {
-        printf("[image_compressor] Error: Large DSLR image compression failed for format %d\n", format);
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
-        }
-        
-        if (buffer) {
-            g_free(buffer);
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    int box_width = options->max_width > 0 ? options->max_width : width;
+    int box_height = options->max_height > 0 ? options->max_height : height;
+    if (box_width >= width && box_height >= height) {
+        return image;
+    }
+    
+    double scale_x = (double)box_width / width;
+    double scale_y = (double)box_height / height;
+    double scale = scale_x < scale_y ? scale_x : scale_y;
+    VipsKernel kernel = (VipsKernel)options->kernel;
+    
+    const char* loader = NULL;
+    if (vips_image_get_typeof(image, VIPS_META_LOADER)) {
+        vips_image_get_string(image, VIPS_META_LOADER, &loader);
+    }
+    int seekable = !input_is_descriptor(input) || rewind_descriptor(input->fd);
+    int shrink = jpeg_shrink_factor(scale);
+    VipsImage* resized = NULL;
+    
+    if (format_from_loader(loader) == FORMAT_JPEG && seekable && shrink > 1) {
+        VipsImage* shrunk = open_jpeg_shrunk(input, shrink);
+        if (shrunk) {
+            g_object_unref(image);
+            image = shrunk;
+            int shrunk_width = vips_image_get_width(image);
+            int shrunk_height = vips_image_get_height(image);
+            scale_x = (double)box_width / shrunk_width;
+            scale_y = (double)box_height / shrunk_height;
+            scale = scale_x < scale_y ? scale_x : scale_y;
+            if (scale >= 1.0) {
+                return image;
+            }
+        } else {
+            vips_error_clear();
         }
+    } else if (kernel == VIPS_KERNEL_LANCZOS3 && seekable) {
+        resized = shrink_on_load(input, box_width, box_height);
     }
     
+    if (!resized && resize_image(image, &resized, scale, kernel)) {
+        g_object_unref(image);
+        return NULL;
+    }
     g_object_unref(image);
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
+    return resized;
 }
 
-// Format-aware version of smart_compress_image
-CompressedImageResult smart_compress_image_with_format(const char* input_path, int target_kb, int type, ImageFormat format) {
-    CompressedImageResult result = {NULL, 0, -1};
+// Animations are one tall image: VIPS_META_PAGE_HEIGHT rows per frame,
+// stacked top to bottom
+static int animated_format(ImageFormat format) {
+    return format_has(format, FORMAT_CAP_ANIMATION);
+}
+
+// Decoded strips up to this size are rendered before encoding (see
+// render_frames); larger ones stream through the saver
+#define ANIMATION_RENDER_LIMIT (128 * 1024 * 1024)
+
+// Reopen a multi-frame GIF/WebP with every page ("n" = -1). Takes ownership
+// of image; stills and other loaders come back unchanged, NULL on failure.
+static VipsImage* open_all_frames(const ThinpicInput* input, VipsImage* image) {
+    const char* loader = NULL;
+    if (vips_image_get_typeof(image, VIPS_META_LOADER)) {
+        vips_image_get_string(image, VIPS_META_LOADER, &loader);
+    }
+    if (!animated_format(format_from_loader(loader)) || vips_image_get_n_pages(image) <= 1 ||
+            input->page > 0) {
+        return image;
+    }
+    // Only the header has been read, so a descriptor can be rewound once
+    // this image lets go of it
+    if (input_is_descriptor(input) && lseek(input->fd, 0, SEEK_CUR) < 0) {
+        return image;
+    }
+    int pages = vips_image_get_n_pages(image);
+    g_object_unref(image);
     
-    // Auto-detect format if requested
-    if (format == FORMAT_AUTO) {
-        format = detect_format_from_path(input_path);
-        printf("[image_compressor] Auto-detected format: %d\n", format);
+    VipsImage* frames = NULL;
+    if (input->data) {
+        frames = vips_image_new_from_buffer(input->data, input->length, "",
+            "n", -1,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", VIPS_ACCESS_SEQUENTIAL,
+            NULL);
+    } else if (input_is_descriptor(input)) {
+        rewind_descriptor(input->fd);
+        VipsSource* source = vips_source_new_from_descriptor(input->fd);
+        if (!source) return NULL;
+        frames = vips_image_new_from_source(source, "",
+            "n", -1,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", VIPS_ACCESS_SEQUENTIAL,
+            NULL);
+        g_object_unref(source);
+    } else {
+        frames = vips_image_new_from_file(input->path,
+            "n", -1,
+            "fail_on", VIPS_FAIL_ON_NONE,
+            "access", VIPS_ACCESS_SEQUENTIAL,
+            NULL);
     }
-    
-    printf("[image_compressor] Smart compression with format %d: %s (target: %d KB, type: %d)\n", 
-           format, input_path, target_kb, type);
-    
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        return result;
+    if (frames && !thinpic_input_allowed(frames)) {
+        g_object_unref(frames);
+        return NULL;
     }
-    
-    pthread_mutex_lock(&vips_mutex);
-    
-    VipsImage* image = NULL;
-    VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image
-    vips_error_clear();
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
-    
-    if (!image) {
-        printf("[image_compressor] Error: Failed to load image for smart compression\n");
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    frames = thinpic_threads_limit(frames);
+    frames = thinpic_cancel_watch_shared(frames);
+    thinpic_progress_watch(frames);
+    if (frames) {
+        THINPIC_LOGD("Animation: %d frames of %dx%d", pages,
+                     vips_image_get_width(frames), vips_image_get_page_height(frames));
     }
-    
-    // Get dimensions
+    return frames;
+}
+
+// Fit every frame inside the box on its own, so no kernel reaches across a
+// frame boundary, and stack the results again. Takes ownership of image.
+static VipsImage* resize_frames(VipsImage* image, const ThinpicOptions* options) {
     int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    
-    printf("[image_compressor] Image: %dx%d\n", width, height);
-    
-    // Smart compression logic based on type
-    int target_quality = 85; // Default quality
-    int needs_resize = 0;
-    double scale = 1.0;
-    
-    switch (type) {
-        case 0: // Standard compression
-            target_quality = 85;
-            break;
-        case 1: // High quality
-            target_quality = 95;
-            break;
-        case 2: // Low quality
-            target_quality = 60;
-            break;
-        case 3: // Very low quality
-            target_quality = 30;
+    int page_height = vips_image_get_page_height(image);
+    int pages = vips_image_get_height(image) / page_height;
+    int box_width = options->max_width > 0 ? options->max_width : width;
+    int box_height = options->max_height > 0 ? options->max_height : page_height;
+    if (box_width >= width && box_height >= page_height) {
+        return image;
+    }
+    
+    double scale_x = (double)box_width / width;
+    double scale_y = (double)box_height / page_height;
+    double scale = scale_x < scale_y ? scale_x : scale_y;
+    VipsImage** frames = g_new0(VipsImage*, pages);
+    int failed = 0;
+    for (int i = 0; i < pages && !failed; i++) {
+        VipsImage* frame = NULL;
+        failed = vips_crop(image, &frame, 0, i * page_height, width, page_height, NULL) ||
+                 resize_image(frame, &frames[i], scale, (VipsKernel)options->kernel);
+        if (frame) g_object_unref(frame);
+    }
+    
+    VipsImage* joined = NULL;
+    if (!failed) {
+        failed = vips_arrayjoin(frames, &joined, pages, "across", 1, NULL);
+    }
+    for (int i = 0; i < pages; i++) {
+        if (frames[i]) g_object_unref(frames[i]);
+    }
+    g_free(frames);
+    g_object_unref(image);
+    if (failed) return NULL;
+    
+    // vips_arrayjoin carries the first frame's metadata, old page height included
+    VipsImage* resized = NULL;
+    failed = vips_copy(joined, &resized, NULL);
+    g_object_unref(joined);
+    if (failed) return NULL;
+    vips_image_set_int(resized, VIPS_META_PAGE_HEIGHT, vips_image_get_height(resized) / pages);
+    return resized;
+}
+
+// The animated savers encode frame after frame (each one diffed against the
+// last), so they pull pixels slower than the threadpool can make them.
+// Rendering the strip to memory first decodes and resizes frames on every
+// worker at once; the encoder then only waits on itself.
+static VipsImage* render_frames(VipsImage* image) {
+    double bytes = (double)VIPS_IMAGE_SIZEOF_LINE(image) * vips_image_get_height(image);
+    if (bytes > ANIMATION_RENDER_LIMIT) {
+        return image;
+    }
+    VipsImage* rendered = decode_to_memory(image);
+    g_object_unref(image);
+    return rendered;
+}
+
+// Lowest quality the min_ssim search tries
+#define SSIM_MIN_QUALITY 10
+
+static int ssim_format(ImageFormat format) {
+    return format == FORMAT_JPEG || format == FORMAT_WEBP;
+}
+
+// SSIM of an encoded candidate against the reference luma plane; -1 if it
+// cannot be decoded
+static double candidate_ssim(const EncodeArena* arena, int shrink, const uint8_t* reference,
+                             int width, int height) {
+    VipsImage* decoded = vips_image_new_from_buffer(arena->data, arena->length, "",
+        "access", VIPS_ACCESS_SEQUENTIAL,
+        NULL);
+    if (!decoded) return -1;
+    int decoded_width = 0;
+    int decoded_height = 0;
+    uint8_t* plane = thinpic_luma_plane(decoded, shrink, &decoded_width, &decoded_height);
+    g_object_unref(decoded);
+    if (!plane) return -1;
+    double score = decoded_width == width && decoded_height == height
+        ? thinpic_ssim(reference, plane, width, height) : -1;
+    g_free(plane);
+    return score;
+}
+
+// Encode at the lowest quality up to options->quality whose SSIM stays at
+// or above options->min_ssim, into *arena. The ceiling is tried first: if
+// it misses the floor nothing lower can meet it, and it is kept; otherwise
+// quality is bisected below it (~8 encodes and decodes of the in-memory
+// image), each passing candidate swapping places with the best so far.
+static int save_min_ssim(VipsImage* image, ImageFormat format, const ThinpicOptions* options,
+                         EncodeArena** arena) {
+    int shrink = thinpic_luma_shrink(vips_image_get_width(image), vips_image_get_height(image));
+    int width = 0;
+    int height = 0;
+    uint8_t* reference = thinpic_luma_plane(image, shrink, &width, &height);
+    if (!reference) return -1;
+    
+    ThinpicOptions tuned = *options;
+    EncodeArena* probe = thinpic_arena_acquire();
+    int low = SSIM_MIN_QUALITY;
+    int high = options->quality;
+    int quality = high;
+    int best_quality = -1;
+    double best_score = 0;
+    int encodes = 0;
+    int status = 0;
+    while (low <= high && !thinpic_cancel_requested()) {
+        tuned.quality = quality;
+        encodes++;
+        int traced = thinpic_trace_begin("thinpic ssim probe Q%d", quality);
+        VipsTarget* target = thinpic_arena_target(probe);
+        int failed = !target || save_with_options(image, target, format, &tuned) != 0 || probe->length == 0;
+        if (target) g_object_unref(target);
+        double score = failed ? -1 : candidate_ssim(probe, shrink, reference, width, height);
+        thinpic_trace_end(traced);
+        if (score < 0) {
+            THINPIC_LOGE("Error: SSIM search failed at quality %d", quality);
+            log_vips_error();
+            status = -1;
             break;
-        default:
-            target_quality = 85;
+        }
+        
+        int passed = score >= options->min_ssim;
+        if (passed || best_quality < 0) {
+            EncodeArena* swap = *arena;
+            *arena = probe;
+            probe = swap;
+            best_quality = quality;
+            best_score = score;
+        }
+        if (!passed && quality == options->quality) {
+            THINPIC_LOGW("SSIM %.4f at quality %d is below the %.4f floor", score, quality, options->min_ssim);
             break;
+        }
+        if (passed) {
+            high = quality - 1;
+        } else {
+            low = quality + 1;
+        }
+        quality = low + (high - low) / 2;
+    }
+    thinpic_arena_release(probe);
+    g_free(reference);
+    
+    if (best_quality < 0) status = -1;   // Cancelled before the first encode
+    if (status == 0) {
+        THINPIC_LOGD("SSIM search: quality %d, SSIM %.4f (%d encodes, %dx%d luma)",
+                     best_quality, best_score, encodes, width, height);
+    }
+    return status;
+}
+
+// The encoder thinpic_compress will call for format, as format_available
+static int options_format_available(ImageFormat format, const ThinpicOptions* options) {
+    if (format == FORMAT_HEIF && options->heif_compression == THINPIC_HEIF_AV1) {
+        return format_available(FORMAT_AVIF);
+    }
+    return format_available(format);
+}
+
+// Validated copy of a caller's ThinpicOptions; 0 when every field is usable
+static int resolve_options(const ThinpicOptions* caller_options, ThinpicOptions* resolved) {
+    // Newer callers may rely on fields this build would silently ignore
+    if (caller_options->version < 1 || caller_options->version > THINPIC_OPTIONS_VERSION) {
+        THINPIC_LOGE("Error: Unsupported ThinpicOptions version %d (this build: %d)",
+                     caller_options->version, THINPIC_OPTIONS_VERSION);
+        return -1;
+    }
+    // Older callers' structs end early: read only what they have and keep
+    // the defaults for the rest
+    thinpic_options_init(resolved);
+    memcpy(resolved, caller_options, options_size(caller_options->version));
+    const ThinpicOptions* options = resolved;
+    if (options->kernel < THINPIC_KERNEL_NEAREST || options->kernel > THINPIC_KERNEL_LANCZOS3) {
+        THINPIC_LOGE("Error: Unknown kernel %d", options->kernel);
+        return -1;
+    }
+    if (options->webp_profile < THINPIC_WEBP_PROFILE_DEFAULT || options->webp_profile > THINPIC_WEBP_PROFILE_ARCHIVE) {
+        THINPIC_LOGE("Error: Unknown WebP profile %d", options->webp_profile);
+        return -1;
+    }
+    if (options->scan_script < THINPIC_SCAN_SCRIPT_DEFAULT || options->scan_script > THINPIC_SCAN_SCRIPT_CUSTOM) {
+        THINPIC_LOGE("Error: Unknown scan script %d", options->scan_script);
+        return -1;
+    }
+    if (options->scan_script == THINPIC_SCAN_SCRIPT_CUSTOM && (!options->scans || options->scan_count < 1)) {
+        THINPIC_LOGE("Error: Custom scan script without scans");
+        return -1;
+    }
+    if (options->png_palette < THINPIC_PNG_PALETTE_OFF || options->png_palette > THINPIC_PNG_PALETTE_ON ||
+            (options->png_bitdepth != 0 && options->png_bitdepth != 1 && options->png_bitdepth != 2 &&
+             options->png_bitdepth != 4 && options->png_bitdepth != 8) ||
+            options->dither < 0 || options->dither > 100) {
+        THINPIC_LOGE("Error: Invalid PNG palette options (mode %d, %d-bit, dither %d)",
+                     options->png_palette, options->png_bitdepth, options->dither);
+        return -1;
+    }
+    if (options->png_deflate < THINPIC_PNG_DEFLATE_ZLIB || options->png_deflate > THINPIC_PNG_DEFLATE_OPTIMIZE) {
+        THINPIC_LOGE("Error: Unknown PNG compressor %d", options->png_deflate);
+        return -1;
+    }
+    if (options->gif_colours < 0 || options->gif_colours == 1 || options->gif_colours > 256 ||
+            options->gif_interframe < -1 || options->gif_interframe > 255) {
+        THINPIC_LOGE("Error: Invalid GIF options (%d colours, interframe %d)",
+                     options->gif_colours, options->gif_interframe);
+        return -1;
+    }
+    if (!(options->min_ssim >= 0 && options->min_ssim <= 1)) {
+        THINPIC_LOGE("Error: SSIM floor %f is outside 0-1", options->min_ssim);
+        return -1;
+    }
+    if (options->crop < THINPIC_CROP_NONE || options->crop > THINPIC_CROP_ATTENTION) {
+        THINPIC_LOGE("Error: Unknown crop %d", options->crop);
+        return -1;
+    }
+    if (options->latency_budget_ms < 0) {
+        THINPIC_LOGE("Error: Negative latency budget %d", options->latency_budget_ms);
+        return -1;
+    }
+    if (options->heif_compression < THINPIC_HEIF_HEVC || options->heif_compression > THINPIC_HEIF_AV1 ||
+            options->heif_subsample < THINPIC_SUBSAMPLE_AUTO || options->heif_subsample > THINPIC_SUBSAMPLE_444) {
+        THINPIC_LOGE("Error: Unknown HEIF codec %d or subsampling %d",
+                     options->heif_compression, options->heif_subsample);
+        return -1;
+    }
+    if (!(options->jxl_distance == 0 || (options->jxl_distance >= 0.1 && options->jxl_distance <= 25))) {
+        THINPIC_LOGE("Error: JPEG XL distance %f is outside 0.1-25", options->jxl_distance);
+        return -1;
+    }
+    if (options->placeholder < THINPIC_PLACEHOLDER_NONE || options->placeholder > THINPIC_PLACEHOLDER_THUMBHASH) {
+        THINPIC_LOGE("Error: Unknown placeholder %d", options->placeholder);
+        return -1;
+    }
+    if (options->palette_colours < 0 || options->palette_colours > THINPIC_PALETTE_MAX) {
+        THINPIC_LOGE("Error: Palette of %d colours is outside 0-%d", options->palette_colours, THINPIC_PALETTE_MAX);
+        return -1;
+    }
+    if (options->motion_video < THINPIC_MOTION_VIDEO_STRIP || options->motion_video > THINPIC_MOTION_VIDEO_KEEP) {
+        THINPIC_LOGE("Error: Unknown motion video mode %d", options->motion_video);
+        return -1;
+    }
+    if (options->gain_map < THINPIC_GAIN_MAP_STRIP || options->gain_map > THINPIC_GAIN_MAP_KEEP) {
+        THINPIC_LOGE("Error: Unknown gain map mode %d", options->gain_map);
+        return -1;
+    }
+    if (options->output_path && options->output_path[0] == '\0') {
+        THINPIC_LOGE("Error: Empty output path");
+        return -1;
+    }
+    int tensor_off = options->tensor_width == 0 && options->tensor_height == 0;
+    int tensor_sized = options->tensor_width > 0 && options->tensor_width <= THINPIC_TENSOR_MAX &&
+                       options->tensor_height > 0 && options->tensor_height <= THINPIC_TENSOR_MAX;
+    if ((!tensor_off && !tensor_sized) || options->tensor_type < THINPIC_TENSOR_UINT8 ||
+            options->tensor_type > THINPIC_TENSOR_FLOAT32 || !(options->tensor_std[0] >= 0) ||
+            !(options->tensor_std[1] >= 0) || !(options->tensor_std[2] >= 0)) {
+        THINPIC_LOGE("Error: Invalid tensor %dx%d (type %d)", options->tensor_width, options->tensor_height,
+                     options->tensor_type);
+        return -1;
     }
-    
-    // Resize if needed for target size
-    if (target_kb > 0) {
-        // Estimate if resize is needed based on target size
-        long estimated_size = (long)width * height * 3; // Rough estimate
-        if (estimated_size > target_kb * 1024) {
-            needs_resize = 1;
-            scale = sqrt((double)(target_kb * 1024) / estimated_size);
-            scale = fmax(0.1, fmin(1.0, scale)); // Clamp between 0.1 and 1.0
+    if (options->jpeg_trellis < -1 || options->jpeg_trellis > 1 ||
+            options->jpeg_overshoot_deringing < -1 || options->jpeg_overshoot_deringing > 1 ||
+            options->jpeg_optimize_scans < -1 || options->jpeg_optimize_scans > 1 ||
+            options->jpeg_quant_table < THINPIC_QUANT_TABLE_DEFAULT ||
+            options->jpeg_quant_table > THINPIC_QUANT_TABLE_PETERSON) {
+        THINPIC_LOGE("Error: Invalid JPEG encoder options (trellis %d, deringing %d, optimize scans %d, table %d)",
+                     options->jpeg_trellis, options->jpeg_overshoot_deringing, options->jpeg_optimize_scans,
+                     options->jpeg_quant_table);
+        return -1;
+    }
+    if (options->watermark_path && (options->watermark_gravity < THINPIC_GRAVITY_CENTRE ||
+            options->watermark_gravity > THINPIC_GRAVITY_NORTH_WEST || options->watermark_margin < 0 ||
+            !(options->watermark_width >= 0 && options->watermark_width <= 1) ||
+            !(options->watermark_opacity >= 0 && options->watermark_opacity <= 1))) {
+        THINPIC_LOGE("Error: Invalid watermark options (gravity %d, margin %d, width %f, opacity %f)",
+                     options->watermark_gravity, options->watermark_margin, options->watermark_width,
+                     options->watermark_opacity);
+        return -1;
+    }
+    return 0;
+}
+
+// THINPIC_SOURCE_PIXELS as an sRGB (or B_W) uchar image over the caller's
+// memory. Strides that are not a whole number of pixels, or a last row
+// shorter than the stride, are packed into a copy the image frees on close.
+static VipsImage* pixels_image(const ThinpicSource* source) {
+    int format = source->pixel_format;
+    if (format < THINPIC_PIXEL_RGB || format > THINPIC_PIXEL_GRAY) {
+        THINPIC_LOGE("Error: Unknown pixel format %d", format);
+        return NULL;
+    }
+    int bands = format == THINPIC_PIXEL_GRAY ? 1 : format <= THINPIC_PIXEL_BGR ? 3 : 4;
+    size_t row = (size_t)source->width * bands;
+    size_t stride = source->stride > 0 ? (size_t)source->stride : row;
+    if (!source->data || source->width <= 0 || source->height <= 0 || stride < row ||
+            source->length < stride * (size_t)(source->height - 1) + row) {
+        THINPIC_LOGE("Error: Invalid %dx%d pixel source (stride %d, %zu bytes)", source->width,
+                     source->height, source->stride, source->length);
+        return NULL;
+    }
+    
+    VipsImage* image;
+    if (stride % bands == 0 && source->length >= stride * (size_t)source->height) {
+        image = vips_image_new_from_memory(source->data, stride * (size_t)source->height,
+                                           (int)(stride / bands), source->height, bands, VIPS_FORMAT_UCHAR);
+    } else {
+        uint8_t* packed = (uint8_t*)g_try_malloc(row * (size_t)source->height);
+        if (!packed) return NULL;
+        for (int y = 0; y < source->height; y++) {
+            memcpy(packed + row * (size_t)y, source->data + stride * (size_t)y, row);
+        }
+        image = vips_image_new_from_memory(packed, row * (size_t)source->height, source->width,
+                                           source->height, bands, VIPS_FORMAT_UCHAR);
+        if (image) {
+            g_signal_connect(image, "postclose", G_CALLBACK(free_with_image), packed);
+        } else {
+            g_free(packed);
         }
     }
+    if (!image) return NULL;
     
-    if (needs_resize) {
-        printf("[image_compressor] Resizing with scale: %f\n", scale);
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LANCZOS3,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
+    // Row padding off, channels into RGB(A) order, alpha undone: all lazy
+    VipsImage* next = NULL;
+    if (vips_image_get_width(image) > source->width) {
+        int failed = vips_crop(image, &next, 0, 0, source->width, source->height, NULL);
         g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
+        if (failed) return NULL;
+        image = next;
     }
-    
-    // Convert to sRGB (except for GIF)
-    if (format != FORMAT_GIF) {
-        VipsImage* srgb_image = NULL;
-        if (vips_copy(image, &srgb_image, 
-                "interpretation", VIPS_INTERPRETATION_sRGB,
-                NULL)) {
-            printf("[image_compressor] Error: Failed to convert to sRGB\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
-        }
-        
+    int swap = format == THINPIC_PIXEL_BGR || format == THINPIC_PIXEL_BGRA;
+    int premultiplied = source->premultiplied && bands == 4;
+    if (swap || premultiplied) {
+        int failed = thinpic_swizzle_image(image, &next, swap, premultiplied);
         g_object_unref(image);
-        image = srgb_image;
+        if (failed) return NULL;
+        image = next;
     }
-    
-    // Compression with format-specific settings
-    printf("[image_compressor] Starting smart compression with format %d, quality %d...\n", format, target_quality);
-    vips_error_clear();
-    
-    int save_result = -1;
-    
-    switch (format) {
-        case FORMAT_JPEG:
-            save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-                "Q", target_quality,
-                "optimize_coding", TRUE,
-                "interlace", FALSE,
-                "no_subsample", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_PNG:
-            // PNG quality is 0-9, convert from 1-100
-            int png_quality = (target_quality * 9) / 100;
-            if (png_quality < 0) png_quality = 0;
-            if (png_quality > 9) png_quality = 9;
-            
-            save_result = vips_pngsave_buffer(image, &buffer, &buffer_size,
-                "compression", png_quality,
-                "interlace", FALSE,
-                NULL);
-            break;
-            
-        case FORMAT_WEBP:
-            save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
-                "Q", target_quality,
-                "lossless", FALSE,
-                "near_lossless", FALSE,
-                "smart_subsample", TRUE,
-                NULL);
-            break;
-            
-        case FORMAT_TIFF:
-            save_result = vips_tiffsave_buffer(image, &buffer, &buffer_size,
-                "Q", target_quality,
-                "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
-                "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
-                NULL);
-            break;
-            
-        case FORMAT_HEIF:
-            save_result = vips_heifsave_buffer(image, &buffer, &buffer_size,
-                "Q", target_quality,
-                "lossless", FALSE,
-                NULL);
+    VipsInterpretation interpretation = bands == 1 ? VIPS_INTERPRETATION_B_W : VIPS_INTERPRETATION_sRGB;
+    int failed = vips_copy(image, &next, "interpretation", interpretation, NULL);
+    g_object_unref(image);
+    return failed ? NULL : next;
+}
+
+// The ThinpicInput a ThinpicSource describes; 0 when it is usable. Pass
+// the input to release_input when done.
+static int source_input(const ThinpicSource* source, ThinpicInput* input) {
+    *input = (ThinpicInput){.fd = -1};
+    switch (source->type) {
+        case THINPIC_SOURCE_PATH:
+            input->path = source->path;
             break;
-            
-        case FORMAT_JP2K:
-            save_result = vips_jp2ksave_buffer(image, &buffer, &buffer_size,
-                "Q", target_quality,
-                "lossless", FALSE,
-                NULL);
+        case THINPIC_SOURCE_BUFFER:
+            input->data = source->data;
+            input->length = source->length;
             break;
-            
-        case FORMAT_JXL:
-            save_result = vips_jxlsave_buffer(image, &buffer, &buffer_size,
-                "Q", target_quality,
-                "lossless", FALSE,
-                NULL);
+        case THINPIC_SOURCE_FD:
+            input->fd = source->fd;
             break;
-            
-        case FORMAT_GIF:
-            // GIF doesn't support quality, use default settings
-            save_result = vips_gifsave_buffer(image, &buffer, &buffer_size,
-                NULL);
+        case THINPIC_SOURCE_PIXELS:
+            if (!ensure_vips_initialized()) {
+                return -1;
+            }
+            input->image = pixels_image(source);
+            if (!input->image) {
+                thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+                log_vips_error();
+                return -1;
+            }
             break;
-            
-        default:
-            printf("[image_compressor] Error: Unsupported format %d\n", format);
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
     }
-    
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Smart compression successful: %zu bytes (format: %d, quality: %d)\n", 
-               buffer_size, format, target_quality);
-    } else {
-        printf("[image_compressor] Error: Smart compression failed for format %d\n", format);
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
-        }
-        
-        if (buffer) {
-            g_free(buffer);
-        }
+    if (!input_valid(input)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid source (type %d)", source->type);
+        return -1;
     }
-    
-    g_object_unref(image);
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
+    return 0;
 }
 
-// Auto-compress function that tries multiple formats to find the smallest file
-CompressedImageResult auto_compress_image(const char* input_path, int quality) {
-    CompressedImageResult result = {NULL, 0, -1};
-    
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
-        return result;
+static void release_input(ThinpicInput* input) {
+    if (input->image) {
+        g_object_unref(input->image);
+        input->image = NULL;
     }
-    
-    if (quality < 1 || quality > 100) {
-        printf("[image_compressor] Error: Quality must be between 1 and 100\n");
-        return result;
+}
+
+// Shared tail of thinpic_compress and thinpic_compress_ops: orientation for
+// stripped output, sRGB, thread cap, then the encode selected by options.
+// Takes image (NULL reports the failure), releases the pipeline lock and the
+// mapping, and stores the result under cache_key unless it is NULL.
+static int encode_prepared(const ThinpicInput* input, VipsImage* image, ImageFormat format, int animated,
+                           const ThinpicOptions* options, int pipeline_locked, MappedInput* mapping,
+                           const ThinpicCacheKey* cache_key, ThinpicResult* out) {
+    // Dropping EXIF would lose the orientation, so apply it to the pixels
+    // (animations carry none, and rotating the strip would scramble frames);
+    // a watermark has to be drawn on the upright image too
+    if (image && !animated && (options->strip != THINPIC_STRIP_NONE || options->watermark_path)) {
+        VipsImage* rotated = NULL;
+        if (orient_upright(image, &rotated) == 0) {
+            g_object_unref(image);
+            image = rotated;
+        } else {
+            vips_error_clear();
+        }
     }
     
-    printf("[image_compressor] Auto-compressing image: %s (quality: %d)\n", input_path, quality);
-    
-    // Initialize VIPS (thread-safe)
-    if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
-        return result;
+    if (image) {
+        VipsImage* narrowed = narrow_depth(image, format);
+        VipsImage* srgb_image = NULL;
+        g_object_unref(image);
+        int failed = thinpic_to_srgb(narrowed, &srgb_image);
+        g_object_unref(narrowed);
+        image = failed ? NULL : srgb_image;
     }
+    image = thinpic_watermark(image, options);
     
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Clear any previous errors
-    vips_error_clear();
-    
-    VipsImage* image = NULL;
-    VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image with error handling
-    printf("[image_compressor] Loading image...\n");
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
-    
-    if (!image) {
-        printf("[image_compressor] Error: Failed to load image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    // libvips sizes each sink's thread pool from this image's "concurrency"
+    if (image && options->threads > 0) {
+        VipsImage* limited = NULL;
+        int failed = vips_copy(image, &limited, NULL);
+        g_object_unref(image);
+        image = NULL;
+        if (!failed) {
+            vips_image_set_int(limited, VIPS_META_CONCURRENCY, options->threads);
+            image = limited;
         }
-        vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
     }
     
-    // Validate image object
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object\n");
+    if (image && animated) {
+        image = render_frames(image);
+    }
+    
+    // The palette and libdeflate paths read every pixel and may still hand
+    // the image to pngsave, and the SSIM search encodes it repeatedly:
+    // render once so a sequential loader is never read twice
+    int indexed = format == FORMAT_PNG && options->png_palette != THINPIC_PNG_PALETTE_OFF && !animated;
+    int deflated = format == FORMAT_PNG && options->png_deflate != THINPIC_PNG_DEFLATE_ZLIB &&
+                   !options->progressive && !animated;
+    int ssim_search = options->min_ssim > 0 && ssim_format(format) && !animated;
+    if (image && (indexed || deflated || ssim_search)) {
+        VipsImage* rendered = decode_to_memory(image);
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        image = rendered;
+    }
+    // After the render, so a rendered image is checked for grey pixels and
+    // opaque alpha without a second decode
+    if (image && !animated) {
+        image = prepare_bands(image, format);
+    }
+    
+    // Last, so the hash sees exactly the pixels the encoder reads
+    ThinpicHashTap* hash_tap = NULL;
+    int grid_wanted = options->placeholder != THINPIC_PLACEHOLDER_NONE || options->palette_colours > 0;
+    int tensor_wanted = options->tensor_width > 0;
+    if (image && !animated && (options->perceptual_hash || grid_wanted || options->analysis || tensor_wanted)) {
+        VipsImage* tapped = NULL;
+        hash_tap = thinpic_hash_tap(image, options->perceptual_hash, grid_wanted ? THINPIC_GRID_MAX : 0,
+                                    options->analysis ? THINPIC_PLANE_MAX : 0, options->tensor_width,
+                                    options->tensor_height, &tapped);
+        if (hash_tap) {
+            g_object_unref(image);
+            image = tapped;
+        }
     }
     
-    // Get image info
-    int width = vips_image_get_width(image);
-    int height = vips_image_get_height(image);
-    int bands = vips_image_get_bands(image);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to prepare %s", input_name(input));
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        unmap_path_input(mapping);
+        return -1;
+    }
     
-    printf("[image_compressor] Image loaded: %dx%d, %d bands\n", width, height, bands);
+    // Animations report the size of one frame
+    int final_width = vips_image_get_width(image);
+    int final_height = animated ? vips_image_get_page_height(image) : vips_image_get_height(image);
     
-    // Validate image dimensions
-    if (width <= 0 || height <= 0 || bands <= 0) {
-        printf("[image_compressor] Error: Invalid image dimensions\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    uint8_t* indexed_png = NULL;
+    size_t indexed_length = 0;
+    if (indexed && thinpic_png_palette(image, options, scaled_effort(options->effort, 0, 9, 6),
+                                       &indexed_png, &indexed_length) < 0) {
+        THINPIC_LOGW("Palette PNG failed, writing truecolour");
+    }
+    if (!indexed_png && deflated && thinpic_png_deflate(image, options, scaled_effort(options->effort, 0, 12, 6),
+                                                        &indexed_png, &indexed_length) < 0) {
+        THINPIC_LOGW("libdeflate PNG failed, writing with zlib");
     }
     
-    // Compression strategy based on dimensions only
-    int new_width = width;
-    int new_height = height;
-    int needs_resize = 0;
-    
-    // Resize if largest dimension > 6000px
-    const int max_dimension = 6000;
-    if (width > max_dimension || height > max_dimension) {
-        needs_resize = 1;
-        if (width > height) {
-            new_width = max_dimension;
-            new_height = (int)((double)height * max_dimension / width);
-        } else {
-            new_height = max_dimension;
-            new_width = (int)((double)width * max_dimension / height);
+    EncodeArena* arena = thinpic_arena_acquire();
+    int save_result = -1;
+    if (!indexed_png && ssim_search) {
+        save_result = save_min_ssim(image, format, options, &arena);
+    } else if (!indexed_png) {
+        VipsTarget* target = thinpic_arena_target(arena);
+        if (target) {
+            save_result = save_with_options(image, target, format, options);
+            g_object_unref(target);
         }
-        printf("[image_compressor] Resizing from %dx%d to %dx%d\n", width, height, new_width, new_height);
     }
     
-    // Process image (resize if needed and convert to sRGB)
-    vips_error_clear();
-    
-    if (needs_resize) {
-        printf("[image_compressor] Resizing image with high quality...\n");
-        double scale = 1.0;
-        if (width > height) {
-            scale = (double)max_dimension / width;
+    g_object_unref(image);
+    pipeline_unlock(pipeline_locked);
+    unmap_path_input(mapping);
+    uint64_t hash = 0;
+    ThinpicColourGrid grid = {0};
+    ThinpicLumaPlane plane = {0};
+    ThinpicRgbPlane tensor = {0};
+    int hash_valid = thinpic_hash_tap_finish(hash_tap, &hash, &grid, &plane, &tensor);
+    
+    int status = -1;
+    if (indexed_png || (save_result == 0 && arena->length > 0)) {
+        size_t length = arena->length;
+        if (indexed_png) {
+            out->data = indexed_png;
+            length = indexed_length;
+        } else if (rescans_jpeg(format, options)) {
+            out->data = thinpic_jpeg_progressive(arena->data, arena->length, options->scan_script,
+                                                 options->scans, options->scan_count, &length);
         } else {
-            scale = (double)max_dimension / height;
+            out->data = thinpic_arena_copy(arena);
         }
-        
-        printf("[image_compressor] Scale factor: %f\n", scale);
-        
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LANCZOS3,  // High-quality kernel
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
+        if (out->data) {
+            out->length = length;
+            out->width = final_width;
+            out->height = final_height;
+            out->format = format;
+            out->perceptual_hash = hash_valid ? hash : 0;
+            out->hash_valid = hash_valid;
+            if (grid.width > 0) {
+                if (options->placeholder == THINPIC_PLACEHOLDER_BLURHASH) {
+                    thinpic_blurhash(&grid, out->placeholder, sizeof(out->placeholder));
+                } else if (options->placeholder == THINPIC_PLACEHOLDER_THUMBHASH) {
+                    thinpic_thumbhash(&grid, out->placeholder, sizeof(out->placeholder));
+                }
+                if (options->palette_colours > 0) thinpic_dominant_colours(&grid, options->palette_colours, out);
+            }
+            if (plane.width > 0) thinpic_score_plane(&plane, out);
+            if (tensor.width > 0) thinpic_tensor_fill(&tensor, options, out);
+            status = 0;
+            THINPIC_LOGI("thinpic_compress: %dx%d, %zu bytes (format %d, effort %d)",
+                         final_width, final_height, out->length, format, options->effort);
+            if (cache_key) {
+                thinpic_output_cache_store(cache_key, out->data, out->length, final_width, final_height, format);
             }
-            vips_error_clear();
-            
-            // Try to compress original image without resizing
-            printf("[image_compressor] Trying to compress original image without resizing...\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
         }
+    } else {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: Encoding failed for format %d", format);
+        log_vips_error();
+    }
+    g_free(plane.luma);
+    g_free(tensor.rgb);
+    thinpic_arena_release(arena);
+    return status;
+}
+
+// options->jxl_lossless_jpeg: libjxl recodes the JPEG's own coefficients,
+// so nothing the pipeline does to pixels can apply. image is the opened
+// header, released here like everything else encode_prepared would release.
+static int transcode_prepared(const ThinpicInput* input, VipsImage* image, const ThinpicOptions* options,
+                              int pipeline_locked, MappedInput* mapping, const ThinpicCacheKey* cache_key,
+                              ThinpicResult* out) {
+    const char* loader = NULL;
+    if (vips_image_get_typeof(image, VIPS_META_LOADER)) {
+        vips_image_get_string(image, VIPS_META_LOADER, &loader);
+    }
+    int jpeg_input = format_from_loader(loader) == FORMAT_JPEG;
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    g_object_unref(image);
+    int fits = options->crop == THINPIC_CROP_NONE && (options->max_width <= 0 || width <= options->max_width) &&
+               (options->max_height <= 0 || height <= options->max_height);
+    
+    // Pipes have no size to read the whole file by
+    long size = jpeg_input && fits && !options->watermark_path ? input_size(input) : 0;
+    uint8_t* copy = size > 0 && !input->data ? read_input_bytes(input, (size_t)size) : NULL;
+    const uint8_t* jpeg = input->data ? input->data : copy;
+    uint8_t* data = NULL;
+    size_t length = 0;
+    int status = -1;
+    if (!jpeg_input) {
+        THINPIC_LOGE("Error: Lossless JPEG XL needs a JPEG input: %s", input_name(input));
+    } else if (options->watermark_path) {
+        THINPIC_LOGE("Error: Lossless JPEG XL keeps the original pixels and cannot carry a watermark");
+    } else if (!fits) {
+        THINPIC_LOGE("Error: Lossless JPEG XL keeps the %dx%d size and cannot fit or crop it to %dx%d",
+                     width, height, options->max_width, options->max_height);
+    } else if (!jpeg || size <= 0) {
+        THINPIC_LOGE("Error: Cannot read %s", input_name(input));
+    } else {
+        int threads = options->threads > 0 ? options->threads
+                      : thinpic_threads_bound() > 0 ? thinpic_threads_bound() : vips_concurrency_get();
+        status = thinpic_jxl_transcode(jpeg, (size_t)size, scaled_effort(options->effort, 1, 9, 7), threads,
+                                       &data, &length);
+    }
+    g_free(copy);
+    pipeline_unlock(pipeline_locked);
+    unmap_path_input(mapping);
+    if (status != 0) return -1;
+    
+    out->data = data;
+    out->length = length;
+    out->width = width;
+    out->height = height;
+    out->format = FORMAT_JXL;
+    THINPIC_LOGI("thinpic_compress: JPEG transcoded to JPEG XL, %ld -> %zu bytes", size, length);
+    if (cache_key) {
+        thinpic_output_cache_store(cache_key, data, length, width, height, FORMAT_JXL);
+    }
+    return 0;
+}
+
+// Persistent handle (thinpic_open): the encoded bytes, read once, and their
+// header. decoded is the last uncropped resize rendered into memory, when
+// it fitted thinpic_configure handle_cache_mb.
+struct ThinpicHandle {
+    ThinpicInput input;          // Always in memory (or pixels); a path stays set for logging
+    MappedInput mapping;         // A mapped path input
+    uint8_t* owned;              // Or a g_malloc'd copy of the file or descriptor
+    ImageInfo info;
+    VipsImage* decoded;
+    int decoded_shrunk;          // decoded is smaller than the source
+    ThinpicKernel decoded_kernel;
+    int counted;                 // Included in open_handles
+};
+
+// One-shot mode caches operations only while some handle is open, since
+// only a session repeats them; called when the count changes
+static void count_handle(ThinpicHandle* handle, int delta) {
+    pthread_mutex_lock(&vips_mutex);
+    open_handles += delta;
+    handle->counted = delta > 0;
+    if (vips_initialized && runtime_config.one_shot_cache && open_handles == (delta > 0 ? 1 : 0)) {
+        apply_runtime_config();
+    }
+    pthread_mutex_unlock(&vips_mutex);
+}
+
+// resize_with_options for a handle: reuse its decoded image when it has at
+// least the pixels this box needs (and was shrunk with the same kernel),
+// otherwise resize from the input and keep the result if it is small enough
+static VipsImage* handle_resize(ThinpicHandle* handle, const ThinpicInput* input, VipsImage* image,
+                                const ThinpicOptions* options) {
+    if (options->crop != THINPIC_CROP_NONE && options->max_width > 0 && options->max_height > 0) {
+        return resize_with_options(input, image, options);
+    }
+    int width = handle->info.width;
+    int height = handle->info.height;
+    int box_width = options->max_width > 0 ? options->max_width : width;
+    int box_height = options->max_height > 0 ? options->max_height : height;
+    double scale = fmin(1.0, fmin((double)box_width / width, (double)box_height / height));
+    int fit_width = (int)(width * scale + 0.5);
+    int fit_height = (int)(height * scale + 0.5);
+    
+    VipsImage* decoded = handle->decoded;
+    if (decoded && vips_image_get_width(decoded) >= fit_width && vips_image_get_height(decoded) >= fit_height &&
+            (!handle->decoded_shrunk || handle->decoded_kernel == options->kernel)) {
         g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
-        
-        // Get new dimensions
-        width = vips_image_get_width(image);
-        height = vips_image_get_height(image);
-        printf("[image_compressor] Image resized to: %dx%d\n", width, height);
-        
-        // Validate resized image
-        if (width <= 0 || height <= 0) {
-            printf("[image_compressor] Error: Invalid dimensions after resize\n");
-            g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+        // Private, so a cancelled job kills its own pipeline and not the
+        // cache (a vips_copy could be handed to another job on the handle)
+        VipsImage* copy = NULL;
+        if (thinpic_private_image(decoded, &copy)) return NULL;
+        if (thinpic_threads_bound() > 0) vips_image_set_int(copy, VIPS_META_CONCURRENCY, thinpic_threads_bound());
+        thinpic_cancel_watch(copy);
+        thinpic_progress_watch(copy);
+        THINPIC_LOGD("Handle: resizing from the cached %dx%d decode", vips_image_get_width(decoded),
+                     vips_image_get_height(decoded));
+        double cached_scale = fmin((double)fit_width / vips_image_get_width(decoded),
+                                   (double)fit_height / vips_image_get_height(decoded));
+        if (cached_scale >= 1.0) return copy;
+        VipsImage* resized = NULL;
+        int failed = resize_image(copy, &resized, cached_scale, (VipsKernel)options->kernel);
+        g_object_unref(copy);
+        return failed ? NULL : resized;
+    }
+    
+    VipsImage* resized = resize_with_options(input, image, options);
+    int64_t max_bytes = (int64_t)__atomic_load_n(&runtime_config.handle_cache_mb, __ATOMIC_RELAXED) * 1024 * 1024;
+    if (!resized || (int64_t)VIPS_IMAGE_SIZEOF_IMAGE(resized) > max_bytes) {
+        return resized;
+    }
+    VipsImage* memory = decode_to_memory(resized);
+    g_object_unref(resized);
+    if (!memory) return NULL;
+    if (handle->decoded) g_object_unref(handle->decoded);
+    g_object_ref(memory);
+    handle->decoded = memory;
+    handle->decoded_shrunk = vips_image_get_width(memory) < width || vips_image_get_height(memory) < height;
+    handle->decoded_kernel = options->kernel;
+    return memory;
+}
+
+// THINPIC_GAIN_MAP_KEEP: the source's gain map rebuilt to match the new
+// primary. encode_prepared made the pixels upright when the strip policy or
+// a watermark asked for it, so the gain map is turned the same way.
+static void keep_gain_map(const ThinpicInput* input, const ThinpicOptions* options, ThinpicResult* out) {
+    ThinpicGainMapInfo gain_map;
+    if (options->gain_map != THINPIC_GAIN_MAP_KEEP || !thinpic_gain_map_find(input, &gain_map)) return;
+    ThinpicMotionPhoto motion;
+    const char* dropped = out->format != FORMAT_JPEG ? "only JPEG output carries it"
+        : options->crop != THINPIC_CROP_NONE && options->max_width > 0 && options->max_height > 0
+            ? "a crop would need the same cut of the gain map"
+        : options->motion_video == THINPIC_MOTION_VIDEO_KEEP && thinpic_motion_find(input, &motion) &&
+          motion.kind == THINPIC_MOTION_GOOGLE ? "the motion photo's XMP is kept instead" : NULL;
+    if (dropped) {
+        THINPIC_LOGW("Gain map dropped: %s", dropped);
+        return;
+    }
+    int pipeline_locked = pipeline_lock();
+    VipsImage* header = open_input_image(input);
+    if (!header) {
+        vips_error_clear();
+        pipeline_unlock(pipeline_locked);
+        return;
+    }
+    int turned = options->strip != THINPIC_STRIP_NONE || options->watermark_path;
+    int orientation = turned ? read_orientation(header) : 1;
+    int64_t bytes = thinpic_gain_map_attach(input, &gain_map, orientation, vips_image_get_width(header),
+                                            vips_image_get_height(header), out->width, out->height,
+                                            &out->data, &out->length);
+    g_object_unref(header);
+    pipeline_unlock(pipeline_locked);
+    if (bytes > 0) out->gain_map_bytes = bytes;
+}
+
+// THINPIC_MOTION_VIDEO_KEEP: the motion photo trailer after the new still.
+// Only a JPEG still can carry it, and a Google one only with its XMP kept;
+// otherwise the video is dropped as before.
+static void keep_motion_video(const ThinpicInput* input, const ThinpicOptions* options, ThinpicResult* out) {
+    ThinpicMotionPhoto motion;
+    if (options->motion_video != THINPIC_MOTION_VIDEO_KEEP || !thinpic_motion_find(input, &motion)) return;
+    if (out->format != FORMAT_JPEG ||
+            (motion.kind == THINPIC_MOTION_GOOGLE && options->strip != THINPIC_STRIP_NONE)) {
+        THINPIC_LOGW("Motion photo video dropped: %s", out->format != FORMAT_JPEG
+                     ? "only JPEG output carries it" : "the XMP pointing at it is stripped");
+        return;
+    }
+    if (thinpic_motion_append(input, &motion, &out->data, &out->length) == 0) {
+        out->motion_video_bytes = motion.trailer_length;
+    }
+}
+
+// Most bytes one options->sink call is handed, so an upload stack can start
+// sending before the whole output has passed through it
+#define SINK_SLICE (256 * 1024)
+
+// options->output_path and options->sink (version 22) from the finished
+// out->data, which stays the caller's. On a failure the result is freed.
+static int deliver_to_sinks(const ThinpicOptions* options, ThinpicResult* out) {
+    int failed = 0;
+    if (options->output_path) {
+        failed = thinpic_write_output(out->data, out->length, options->output_path) != 0;
+        if (!failed) THINPIC_LOGD("Wrote %zu bytes to %s", out->length, options->output_path);
+    }
+    for (size_t offset = 0; !failed && options->sink && offset < out->length; offset += SINK_SLICE) {
+        size_t length = out->length - offset < SINK_SLICE ? out->length - offset : SINK_SLICE;
+        if (options->sink(options->sink_id, out->data + offset, length) != 0) {
+            THINPIC_LOGE("Error: Sink %lld stopped the output at byte %zu", (long long)options->sink_id, offset);
+            failed = 1;
         }
     }
+    if (!failed) return 0;
+    thinpic_error_code(THINPIC_ERROR_IO);
+    free_compressed_buffer(out->data);
+    free_compressed_buffer(out->tensor);
+    out->data = NULL;
+    out->length = 0;
+    out->tensor = NULL;
+    out->tensor_length = 0;
+    return -1;
+}
+
+// thinpic_compress on an input, reusing the handle's decode when there is one
+static int compress_with_options(const ThinpicInput* caller_input, const ThinpicOptions* caller_options,
+                                 ThinpicHandle* handle, ThinpicResult* out) {
+    double started = monotonic_ms();
+    ThinpicOptions resolved;
+    if (resolve_options(caller_options, &resolved)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        return -1;
+    }
+    const ThinpicOptions* options = &resolved;
+    
+    if (!ensure_vips_initialized()) {
+        return -1;
+    }
+    
+    ThinpicInput input = *caller_input;
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
+    
+    // The options by value (scans by content), so a repeat skips the decode
+    ThinpicCacheKey cache_key;
+    int cacheable = 0;
+    // The cache keeps bytes only, so a hash, placeholder, analysis, palette or tensor needs the pixels
+    if (thinpic_output_cache_enabled() && !options->perceptual_hash &&
+            options->placeholder == THINPIC_PLACEHOLDER_NONE && !options->analysis && !options->palette_colours &&
+            !options->tensor_width) {
+        // Deterministic bytes are keyed apart from those a budget or throttle shaped
+        int32_t tag = deterministic_output() ? CACHE_KEY_THINPIC_COMPRESS_DETERMINISTIC : CACHE_KEY_THINPIC_COMPRESS;
+        ThinpicOptions keyed = resolved;
+        keyed.scans = NULL;
+        keyed.watermark_path = NULL;
+        // Where the bytes go does not change them
+        keyed.output_path = NULL;
+        keyed.sink = NULL;
+        keyed.sink_id = 0;
+        size_t scan_bytes = options->scans ? sizeof(ThinpicScan) * (size_t)options->scan_count : 0;
+        // The watermark by path, size and mtime, so a replaced logo misses
+        gchar* watermark = options->watermark_path ? thinpic_overlay_identity(options->watermark_path) : NULL;
+        size_t watermark_bytes = watermark ? strlen(watermark) : 0;
+        size_t params_length = sizeof(tag) + sizeof(keyed) + scan_bytes + watermark_bytes;
+        uint8_t* params = (uint8_t*)g_malloc(params_length);
+        memcpy(params, &tag, sizeof(tag));
+        memcpy(params + sizeof(tag), &keyed, sizeof(keyed));
+        if (scan_bytes) memcpy(params + sizeof(tag) + sizeof(keyed), options->scans, scan_bytes);
+        if (watermark_bytes) memcpy(params + sizeof(tag) + sizeof(keyed) + scan_bytes, watermark, watermark_bytes);
+        if (!options->watermark_path || watermark) {
+            cacheable = thinpic_output_cache_key(&input, params, params_length, &cache_key);
+        }
+        g_free(watermark);
+        g_free(params);
+    }
+    ThinpicCachedOutput cached;
+    if (cacheable && thinpic_output_cache_lookup(&cache_key, &cached)) {
+        unmap_path_input(&mapping);
+        out->data = cached.data;
+        out->length = cached.length;
+        out->width = cached.width;
+        out->height = cached.height;
+        out->format = (ImageFormat)cached.format;
+        out->elapsed_ms = (int)(monotonic_ms() - started);
+        out->budget_met = options->latency_budget_ms > 0 ? out->elapsed_ms <= options->latency_budget_ms : -1;
+        THINPIC_LOGI("thinpic_compress: output cache hit, %zu bytes", out->length);
+        // The cache holds the still; the gain map and trailer are read from this input
+        keep_gain_map(caller_input, options, out);
+        keep_motion_video(caller_input, options, out);
+        return deliver_to_sinks(options, out);
+    }
+    
+    ImageFormat format = options->format == FORMAT_AUTO ? detect_input_format(&input) : options->format;
+    int animated = options->animated && animated_format(format);
+    
+    int pipeline_locked = pipeline_lock();
     
-    // Convert to sRGB for consistent color space
-    printf("[image_compressor] Converting image to sRGB...\n");
     vips_error_clear();
-    if (vips_copy(image, &processed_image, 
-            "interpretation", VIPS_INTERPRETATION_sRGB,
-            NULL)) {
-        printf("[image_compressor] Error: Failed to convert image to sRGB\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    VipsImage* image = open_input_image(&input);
+    if (image && animated) {
+        image = open_all_frames(&input, image);
+        animated = image && vips_image_get_n_pages(image) > 1;
+    }
+    // A transcode has no settings to trade for time
+    int transcode = image && !animated && format == FORMAT_JXL && options->jxl_lossless_jpeg;
+    
+    // Planned on the header alone: nothing has been decoded yet. The plan
+    // follows this device's measured rates, so deterministic output keeps
+    // the caller's settings and only reports budget_met.
+    if (image && !animated && !transcode && options->latency_budget_ms > 0 && !deterministic_output()) {
+        ThinpicBudgetPlan plan = {format, options->effort, options->max_width, options->max_height,
+                                  options->crop != THINPIC_CROP_NONE && options->max_width > 0 &&
+                                  options->max_height > 0, 0};
+        thinpic_budget_plan(options->latency_budget_ms, vips_image_get_width(image), vips_image_get_height(image),
+                            vips_image_hasalpha(image), &plan);
+        if (plan.format != format || plan.effort != options->effort ||
+                plan.max_width != options->max_width || plan.max_height != options->max_height) {
+            THINPIC_LOGD("Latency budget %d ms: format %d -> %d, effort %d -> %d, box %dx%d -> %dx%d (%.0f ms)",
+                         options->latency_budget_ms, format, plan.format, options->effort, plan.effort,
+                         options->max_width, options->max_height, plan.max_width, plan.max_height,
+                         plan.predicted_ms);
+        }
+        format = plan.format;
+        resolved.effort = plan.effort;
+        resolved.max_width = plan.max_width;
+        resolved.max_height = plan.max_height;
+    }
+    // Only the header is open: a missing encoder fails before the decode
+    if (image && !transcode && !options_format_available(format, options)) {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: No encoder for format %d in this build", format);
+        g_object_unref(image);
+        pipeline_unlock(pipeline_locked);
+        unmap_path_input(&mapping);
+        return -1;
+    }
+    // Only plain encodes say what the format and effort cost on this device
+    int measured = !animated && options->min_ssim <= 0 && options->png_palette == THINPIC_PNG_PALETTE_OFF &&
+                   options->png_deflate == THINPIC_PNG_DEFLATE_ZLIB &&
+                   (format != FORMAT_HEIF || options->heif_compression == THINPIC_HEIF_HEVC) && !transcode;
+    
+    if (transcode) {
+        if (transcode_prepared(&input, image, options, pipeline_locked, &mapping,
+                               cacheable ? &cache_key : NULL, out) != 0) {
+            return -1;
+        }
+    } else {
+        if (image && animated) {
+            image = resize_frames(image, options);
+        } else if (image) {
+            image = handle ? handle_resize(handle, &input, image, options) : resize_with_options(&input, image, options);
+        }
+        if (encode_prepared(&input, image, format, animated, options, pipeline_locked, &mapping,
+                            cacheable ? &cache_key : NULL, out) != 0) {
+            return -1;
         }
+    }
+    double elapsed = monotonic_ms() - started;
+    if (measured) {
+        thinpic_budget_record(out->format, options->effort, out->width, out->height, elapsed);
+    }
+    keep_gain_map(caller_input, options, out);
+    keep_motion_video(caller_input, options, out);
+    int delivered = deliver_to_sinks(options, out);
+    elapsed = monotonic_ms() - started;
+    out->elapsed_ms = (int)elapsed;
+    out->budget_met = options->latency_budget_ms > 0 ? out->elapsed_ms <= options->latency_budget_ms : -1;
+    return delivered;
+}
+
+// out->error from this thread's capture when status is a failure
+static int with_error(int status, ThinpicResult* out) {
+    if (status != 0) thinpic_error_take(&out->error);
+    return status;
+}
+
+int thinpic_compress(const ThinpicSource* source, const ThinpicOptions* options, ThinpicResult* out) {
+    if (!out) {
+        THINPIC_LOGE("Error: Invalid result pointer");
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+    thinpic_error_reset();
+    if (!source || !options) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_compress arguments");
+        return with_error(-1, out);
+    }
+    ThinpicInput input;
+    if (source_input(source, &input)) {
+        return with_error(-1, out);
+    }
+    int status = compress_with_options(&input, options, NULL, out);
+    release_input(&input);
+    return with_error(status, out);
+}
+
+// Upright 8-bit sRGB with an alpha band, ready to hand out as RGBA. Takes
+// image; NULL on failure.
+static VipsImage* display_rgba(VipsImage* image) {
+    VipsImage* next = NULL;
+    if (orient_upright(image, &next) == 0) {
+        g_object_unref(image);
+        image = next;
+    } else {
         vips_error_clear();
-        
-        // Try to compress without sRGB conversion
-        printf("[image_compressor] Trying to compress image without sRGB conversion...\n");
+    }
+    if (prepare_output(image, &next)) {
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        return NULL;
     }
-    
     g_object_unref(image);
-    image = processed_image;
-    processed_image = NULL;
-    
-    // Validate final image before compression
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image after processing\n");
+    image = next;
+    // Gray and 16-bit images come out of prepare_output as they went in
+    if (vips_image_get_bands(image) < 3 || vips_image_get_format(image) != VIPS_FORMAT_UCHAR) {
+        int failed = vips_colourspace(image, &next, VIPS_INTERPRETATION_sRGB, NULL);
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        if (failed) return NULL;
+        image = next;
+    }
+    int failed = vips_image_hasalpha(image)
+                 ? vips_extract_band(image, &next, 0, "n", 4, NULL)
+                 : vips_bandjoin_const1(image, &next, 255.0, NULL);
+    g_object_unref(image);
+    return failed ? NULL : next;
+}
+
+int thinpic_decode_rgba(const ThinpicSource* source, int max_width, int max_height, ThinpicPixels* out) {
+    if (!out) {
+        THINPIC_LOGE("Error: Invalid result pointer");
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+    thinpic_error_reset();
+    if (!source || max_width < 0 || max_height < 0) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_decode_rgba arguments");
+        return -1;
+    }
+    ThinpicInput input;
+    if (source_input(source, &input)) {
+        return -1;
+    }
+    if (!ensure_vips_initialized()) {
+        release_input(&input);
+        return -1;
     }
     
-    int final_width = vips_image_get_width(image);
-    int final_height = vips_image_get_height(image);
-    int final_bands = vips_image_get_bands(image);
-    printf("[image_compressor] Final image: %dx%d, %d bands\n", final_width, final_height, final_bands);
-    
-    // Try different formats to find the smallest file
-    CompressedImageResult best_result = {NULL, 0, -1};
-    size_t best_size = SIZE_MAX;
-    ImageFormat best_format = FORMAT_JPEG;
-    
-    // Define formats to try in order of preference for size
-    ImageFormat formats_to_try[] = {
-        FORMAT_WEBP,    // Usually smallest for photos
-        FORMAT_JPEG,    // Good for photos
-        FORMAT_JXL,     // Excellent compression
-        FORMAT_HEIF,    // Good compression
-        FORMAT_JP2K,    // Good compression
-        FORMAT_TIFF,    // Good for some images
-        FORMAT_PNG,     // Lossless, usually larger
-        FORMAT_GIF      // Only for animated images
-    };
-    
-    int num_formats = sizeof(formats_to_try) / sizeof(formats_to_try[0]);
+    int pipeline_locked = pipeline_lock();
+    vips_error_clear();
+    VipsImage* image = open_input_image(&input);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to read image header: %s", input_name(&input));
+        log_vips_error();
+        pipeline_unlock(pipeline_locked);
+        release_input(&input);
+        return -1;
+    }
     
-    for (int i = 0; i < num_formats; i++) {
-        ImageFormat current_format = formats_to_try[i];
-        printf("[image_compressor] Trying format %d...\n", current_format);
-        
-        // Clear any existing buffer
-        if (buffer) {
-            g_free(buffer);
-            buffer = NULL;
-            buffer_size = 0;
-        }
-        
-        vips_error_clear();
-        int save_result = -1;
-        
-        switch (current_format) {
-            case FORMAT_JPEG:
-                save_result = vips_jpegsave_buffer(image, &buffer, &buffer_size,
-                    "Q", quality,
-                    "optimize_coding", TRUE,
-                    "interlace", FALSE,
-                    "no_subsample", FALSE,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-                break;
-                
-            case FORMAT_PNG:
-                // PNG quality is 0-9, convert from 1-100
-                int png_quality = 9 - ((quality * 9) / 100);
-                if (png_quality < 0) png_quality = 0;
-                if (png_quality > 9) png_quality = 9;
-                
-                save_result = vips_pngsave_buffer(image, &buffer, &buffer_size,
-                    "compression", png_quality,
-                    "interlace", FALSE,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-                break;
-                
-            case FORMAT_WEBP:
-                save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
-                    "Q", quality,
-                    "lossless", FALSE,
-                    "near_lossless", FALSE,
-                    "smart_subsample", FALSE,  // Disable for faster compression
-                    "strip", FALSE,  // Keep orientation data
-                    "effort", 2,     // Lower effort for faster compression (0-6, default is 4)
-                    NULL);
-                break;
-                
-            case FORMAT_TIFF:
-                save_result = vips_tiffsave_buffer(image, &buffer, &buffer_size,
-                    "Q", quality,
-                    "compression", VIPS_FOREIGN_TIFF_COMPRESSION_JPEG,
-                    "predictor", VIPS_FOREIGN_TIFF_PREDICTOR_HORIZONTAL,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-                break;
-                
-            case FORMAT_HEIF:
-                save_result = vips_heifsave_buffer(image, &buffer, &buffer_size,
-                    "Q", quality,
-                    "lossless", FALSE,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-                break;
-                
-            case FORMAT_JP2K:
-                save_result = vips_jp2ksave_buffer(image, &buffer, &buffer_size,
-                    "Q", quality,
-                    "lossless", FALSE,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-                break;
-                
-            case FORMAT_JXL:
-                save_result = vips_jxlsave_buffer(image, &buffer, &buffer_size,
-                    "Q", quality,
-                    "lossless", FALSE,
-                    //"strip", FALSE,  // Keep orientation data
-                    NULL);
-                break;
-                
-            case FORMAT_GIF:
-                // Only try GIF if image has multiple bands (might be animated)
-                if (final_bands >= 3) {
-                    save_result = vips_gifsave_buffer(image, &buffer, &buffer_size,
-                        //"strip", FALSE,  // Keep orientation data
-                        NULL);
-                } else {
-                    save_result = -1; // Skip GIF for non-animated images
-                }
-                break;
-                
-            default:
-                save_result = -1;
-                break;
-        }
-        
-        if (save_result == 0 && buffer && buffer_size > 0) {
-            printf("[image_compressor] Format %d successful: %zu bytes\n", current_format, buffer_size);
-            
-            // Check if this is the smallest so far
-            if (buffer_size < best_size) {
-                // Free previous best result
-                if (best_result.data) {
-                    g_free(best_result.data);
-                }
-                
-                // Update best result
-                best_result.data = (uint8_t*)buffer;
-                best_result.length = buffer_size;
-                best_result.success = 1;
-                best_size = buffer_size;
-                best_format = current_format;
-                
-                // Don't free buffer here, it's now owned by best_result
-                buffer = NULL;
-                buffer_size = 0;
-                
-                printf("[image_compressor] New best format: %d with %zu bytes\n", best_format, best_size);
-            } else {
-                // Free this buffer since it's not the best
-                g_free(buffer);
-                buffer = NULL;
-                buffer_size = 0;
-            }
+    // Both shrink paths work on the pixels as stored, so turn the box with them
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    int box_width = max_width > 0 ? max_width : INT32_MAX;
+    int box_height = max_height > 0 ? max_height : INT32_MAX;
+    if (vips_image_get_orientation_swap(image)) {
+        int swap = box_width;
+        box_width = box_height;
+        box_height = swap;
+    }
+    double scale = fmin(1.0, fmin((double)box_width / width, (double)box_height / height));
+    
+    const char* loader = NULL;
+    if (vips_image_get_typeof(image, VIPS_META_LOADER)) {
+        vips_image_get_string(image, VIPS_META_LOADER, &loader);
+    }
+    int seekable = !input_is_descriptor(&input) || rewind_descriptor(input.fd);
+    if (scale < 1.0 && format_from_loader(loader) == FORMAT_JPEG && seekable) {
+        image = jpeg_thumbnail(&input, image, box_width, box_height);
+    } else if (scale < 1.0) {
+        // WebP, HEIF and pyramidal TIFF shrink while decoding here
+        VipsImage* thumbnail = seekable ? shrink_on_load(&input, (int)fmax(1.0, width * scale + 0.5),
+                                                      (int)fmax(1.0, height * scale + 0.5)) : NULL;
+        if (thumbnail) {
+            g_object_unref(image);
+            image = thumbnail;
         } else {
-            printf("[image_compressor] Format %d failed\n", current_format);
-            const char* error = vips_error_buffer();
-            if (error && strlen(error) > 0) {
-                printf("[image_compressor] VIPS error: %s\n", error);
-            }
-            vips_error_clear();
+            VipsImage* resized = NULL;
+            int failed = resize_image(image, &resized, scale, VIPS_KERNEL_LINEAR);
+            g_object_unref(image);
+            image = failed ? NULL : resized;
         }
     }
+    if (image) image = display_rgba(image);
     
-    // Cleanup
-    if (buffer) {
-        g_free(buffer);
-    }
-    g_object_unref(image);
-    
-    if (best_result.success == 1) {
-        printf("[image_compressor] Auto-compression successful: %zu bytes (best format: %d)\n", 
-               best_size, best_format);
-        result = best_result;
+    size_t length = 0;
+    void* pixels = image ? vips_image_write_to_memory(image, &length) : NULL;
+    if (pixels) {
+        out->data = (uint8_t*)pixels;
+        out->length = length;
+        out->width = vips_image_get_width(image);
+        out->height = vips_image_get_height(image);
+        out->stride = out->width * 4;
     } else {
-        printf("[image_compressor] Error: All formats failed\n");
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        THINPIC_LOGE("Error: Failed to decode %s to RGBA", input_name(&input));
+        log_vips_error();
+    }
+    if (image) g_object_unref(image);
+    pipeline_unlock(pipeline_locked);
+    release_input(&input);
+    if (!pixels) return -1;
+    THINPIC_LOGI("Decoded %dx%d RGBA (%zu bytes) from %dx%d", out->width, out->height, out->length,
+                 width, height);
+    return 0;
+}
+
+// Upright luma of image at exactly width x height, for thinpic_compare;
+// takes ownership of image
+static uint8_t* comparison_plane(VipsImage* image, int width, int height) {
+    // Resized as stored and turned after, when it is small and in memory
+    int swap = vips_image_get_orientation_swap(image);
+    VipsImage* resized = NULL;
+    int failed = vips_thumbnail_image(image, &resized, swap ? height : width,
+        "height", swap ? width : height,
+        "size", VIPS_SIZE_FORCE,
+        "no_rotate", TRUE,
+        NULL);
+    g_object_unref(image);
+    if (failed) return NULL;
+    VipsImage* memory = vips_image_copy_memory(resized);
+    g_object_unref(resized);
+    VipsImage* upright = NULL;
+    failed = !memory || orient_upright(memory, &upright);
+    if (memory) g_object_unref(memory);
+    if (failed) return NULL;
+
+    int plane_width = 0;
+    int plane_height = 0;
+    uint8_t* plane = thinpic_luma_plane(upright, 1, &plane_width, &plane_height);
+    g_object_unref(upright);
+    if (plane && (plane_width != width || plane_height != height)) {
+        g_free(plane);
+        return NULL;
+    }
+    return plane;
+}
+
+static void upright_size(VipsImage* image, int* width, int* height) {
+    int swap = vips_image_get_orientation_swap(image);
+    *width = swap ? vips_image_get_height(image) : vips_image_get_width(image);
+    *height = swap ? vips_image_get_width(image) : vips_image_get_height(image);
+}
+
+// thinpic_compare on the two opened inputs; takes ownership of the images
+static int compare_images(VipsImage** images, const ThinpicInput* inputs, int analysis_pixels, int threads,
+                          ThinpicQuality* out) {
+    int widths[2];
+    int heights[2];
+    upright_size(images[0], &widths[0], &heights[0]);
+    upright_size(images[1], &widths[1], &heights[1]);
+    double aspects[2] = {(double)widths[0] / heights[0], (double)widths[1] / heights[1]};
+    if (fabs(aspects[0] - aspects[1]) > 0.01 * aspects[0]) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Cannot compare %dx%d with %dx%d: aspect ratios differ",
+                     widths[0], heights[0], widths[1], heights[1]);
+        g_object_unref(images[0]);
+        g_object_unref(images[1]);
+        return -1;
     }
-    
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
+
+    // The smaller of the two, shrunk into the analysis budget; its own
+    // shape, so a rounded downscale is not stretched
+    int smaller = (int64_t)widths[1] * heights[1] <= (int64_t)widths[0] * heights[0] ? 1 : 0;
+    double budget = analysis_pixels > 0 ? analysis_pixels : 1024.0 * 1024.0;
+    double scale = fmin(1.0, sqrt(budget / ((double)widths[smaller] * heights[smaller])));
+    int width = (int)fmax(1.0, widths[smaller] * scale + 0.5);
+    int height = (int)fmax(1.0, heights[smaller] * scale + 0.5);
+
+    uint8_t* planes[2] = {NULL, NULL};
+    for (int i = 0; i < 2; i++) {
+        planes[i] = comparison_plane(images[i], width, height);
+        if (!planes[i]) {
+            thinpic_error_code(THINPIC_ERROR_DECODE);
+            THINPIC_LOGE("Error: Failed to decode %s for comparison", input_name(&inputs[i]));
+            log_vips_error();
+            if (i == 0) g_object_unref(images[1]);
+            g_free(planes[0]);
+            return -1;
+        }
+    }
+    thinpic_compare_planes(planes[0], planes[1], width, height, threads, out);
+    THINPIC_LOGI("thinpic_compare: %dx%d, PSNR %.2f dB, SSIM %.4f, MS-SSIM %.4f", width, height,
+                 out->psnr, out->ssim, out->ms_ssim);
+    g_free(planes[0]);
+    g_free(planes[1]);
+    return 0;
 }
 
-// Fast WebP compression for speed-critical applications
-CompressedImageResult fast_webp_compress(const char* input_path, int quality) {
-    CompressedImageResult result = {NULL, 0, -1};
-    
-    // Input validation
-    if (!input_path || strlen(input_path) == 0) {
-        printf("[image_compressor] Error: Invalid input path\n");
-        return result;
+int thinpic_compare(const ThinpicSource* reference, const ThinpicSource* candidate, int analysis_pixels,
+                    int threads, ThinpicQuality* out) {
+    if (!out) {
+        THINPIC_LOGE("Error: Invalid result pointer");
+        return -1;
     }
-    
-    if (quality < 1 || quality > 100) {
-        printf("[image_compressor] Error: Quality must be between 1 and 100\n");
-        return result;
+    memset(out, 0, sizeof(*out));
+    thinpic_error_reset();
+    if (!reference || !candidate || analysis_pixels < 0 || threads < 0) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_compare arguments");
+        return -1;
+    }
+    ThinpicInput inputs[2];
+    if (source_input(reference, &inputs[0])) {
+        return -1;
+    }
+    if (source_input(candidate, &inputs[1])) {
+        release_input(&inputs[0]);
+        return -1;
     }
-    
-    printf("[image_compressor] Fast WebP compression: %s (quality: %d)\n", input_path, quality);
-    
-    // Initialize VIPS (thread-safe)
     if (!ensure_vips_initialized()) {
-        printf("[image_compressor] Error: VIPS initialization failed\n");
-        return result;
+        release_input(&inputs[0]);
+        release_input(&inputs[1]);
+        return -1;
     }
-    
-    // Lock VIPS operations for this thread
-    pthread_mutex_lock(&vips_mutex);
-    
-    // Clear any previous errors
+
+    int pipeline_locked = pipeline_lock();
     vips_error_clear();
-    
-    VipsImage* image = NULL;
-    VipsImage* processed_image = NULL;
-    void* buffer = NULL;
-    size_t buffer_size = 0;
-    
-    // Load image with error handling
-    printf("[image_compressor] Loading image...\n");
-    image = vips_image_new_from_file(input_path, 
-        "fail_on", VIPS_FAIL_ON_NONE,
-        "access", VIPS_ACCESS_SEQUENTIAL,
-        NULL);
-    
-    if (!image) {
-        printf("[image_compressor] Error: Failed to load image\n");
-        const char* error = vips_error_buffer();
-        if (error && strlen(error) > 0) {
-            printf("[image_compressor] VIPS error: %s\n", error);
+    VipsImage* images[2] = {open_input_image(&inputs[0]), open_input_image(&inputs[1])};
+    int status = -1;
+    if (images[0] && images[1]) {
+        status = compare_images(images, inputs, analysis_pixels, threads, out);
+    } else {
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        THINPIC_LOGE("Error: Failed to read image header: %s", input_name(&inputs[images[0] ? 1 : 0]));
+        log_vips_error();
+        if (images[0]) g_object_unref(images[0]);
+        if (images[1]) g_object_unref(images[1]);
+    }
+    pipeline_unlock(pipeline_locked);
+    release_input(&inputs[0]);
+    release_input(&inputs[1]);
+    return status;
+}
+
+// Whole descriptor into a g_malloc'd buffer; pipes are read to the end
+static uint8_t* read_descriptor(int fd, size_t* length) {
+    GByteArray* bytes = g_byte_array_new();
+    int seekable = rewind_descriptor(fd);
+    uint8_t chunk[64 * 1024];
+    for (;;) {
+        ssize_t count = read(fd, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            g_byte_array_free(bytes, TRUE);
+            return NULL;
         }
-        vips_error_clear();
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        if (count == 0) break;
+        g_byte_array_append(bytes, chunk, (guint)count);
     }
-    
-    // Validate image object
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image object\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    // Leave a regular file where the loaders expect it
+    if (seekable) rewind_descriptor(fd);
+    *length = bytes->len;
+    return g_byte_array_free(bytes, FALSE);
+}
+
+ThinpicHandle* thinpic_open(const ThinpicSource* source) {
+    ThinpicInput input;
+    if (!source || source_input(source, &input)) {
+        THINPIC_LOGE("Error: Invalid thinpic_open source");
+        return NULL;
     }
-    
-    // Get image info
+    if (!ensure_vips_initialized()) {
+        return NULL;
+    }
+    
+    ThinpicHandle* handle = g_new0(ThinpicHandle, 1);
+    handle->input = input;
+    if (input.path) {
+        // Like map_path_input, but for any size: every call reads it again
+        int fd = open(input.path, O_RDONLY);
+        struct stat file_stat;
+        if (fd >= 0 && fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+            void* address = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                handle->mapping.address = address;
+                handle->mapping.length = (size_t)file_stat.st_size;
+                handle->input.data = address;
+                handle->input.length = handle->mapping.length;
+            }
+        }
+        if (fd >= 0) close(fd);
+        if (!handle->input.data) {
+            gchar* contents = NULL;
+            gsize length = 0;
+            if (g_file_get_contents(input.path, &contents, &length, NULL) && length > 0) {
+                handle->owned = (uint8_t*)contents;
+                handle->input.data = handle->owned;
+                handle->input.length = length;
+            } else {
+                g_free(contents);
+            }
+        }
+    } else if (input.image) {
+        // The handle keeps the pixel image; the caller keeps the pixels valid
+    } else if (!input.data) {
+        size_t length = 0;
+        handle->owned = read_descriptor(input.fd, &length);
+        handle->input.data = handle->owned;
+        handle->input.length = length;
+    }
+    if (!handle->input.image && (!handle->input.data || handle->input.length == 0)) {
+        THINPIC_LOGE("Error: Cannot read %s", input_name(&input));
+        thinpic_close(handle);
+        return NULL;
+    }
+    size_t preview_length = 0;
+    uint8_t* preview = thinpic_raw_preview(&handle->input, &preview_length);
+    if (preview) {
+        // A RAW: the handle keeps only its embedded preview
+        unmap_path_input(&handle->mapping);
+        g_free(handle->owned);
+        handle->owned = preview;
+        handle->input.data = preview;
+        handle->input.length = preview_length;
+    }
+    handle->input.fd = -1;
+    
+    VipsImage* image = open_input_image(&handle->input);
+    if (!image) {
+        THINPIC_LOGE("Error: Failed to read image header: %s", input_name(&input));
+        log_vips_error();
+        thinpic_close(handle);
+        return NULL;
+    }
+    handle->info = image_info(image);
+    g_object_unref(image);
+    count_handle(handle, 1);
+    return handle;
+}
+
+int thinpic_handle_info(ThinpicHandle* handle, ImageInfo* out) {
+    if (!handle || !out) {
+        THINPIC_LOGE("Error: Invalid thinpic_handle_info arguments");
+        return -1;
+    }
+    *out = handle->info;
+    return 0;
+}
+
+int thinpic_handle_compress(ThinpicHandle* handle, const ThinpicOptions* options, ThinpicResult* out) {
+    if (!out) {
+        THINPIC_LOGE("Error: Invalid result pointer");
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+    thinpic_error_reset();
+    if (!handle || !options) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_handle_compress arguments");
+        return with_error(-1, out);
+    }
+    return with_error(compress_with_options(&handle->input, options, handle, out), out);
+}
+
+int thinpic_handle_variants(ThinpicHandle* handle, const ThinpicVariant* variants, int count,
+                            CompressedImageResult* out) {
+    if (!handle) {
+        THINPIC_LOGE("Error: Invalid handle for variants");
+        return -1;
+    }
+    return compress_image_variants_from_input(&handle->input, variants, count, out);
+}
+
+void thinpic_close(ThinpicHandle* handle) {
+    if (!handle) return;
+    if (handle->counted) count_handle(handle, -1);
+    if (handle->decoded) g_object_unref(handle->decoded);
+    release_input(&handle->input);
+    unmap_path_input(&handle->mapping);
+    g_free(handle->owned);
+    g_free(handle);
+}
+
+// A leading crop decodes only its region where the loader allows it
+// (thinpic_region.c: restart-marked JPEG, WebP); TIFF and JPEG 2000 are
+// reopened for random access, so only the tiles or strips under the crop
+// are read. A crop of most of the image streams as before. Takes image;
+// returns the crop, or NULL.
+static VipsImage* crop_on_load(const ThinpicInput* input, VipsImage* image, const ThinpicOperation* op) {
     int width = vips_image_get_width(image);
     int height = vips_image_get_height(image);
-    int bands = vips_image_get_bands(image);
-    
-    printf("[image_compressor] Image loaded: %dx%d, %d bands\n", width, height, bands);
-    
-    // Validate image dimensions
-    if (width <= 0 || height <= 0 || bands <= 0) {
-        printf("[image_compressor] Error: Invalid image dimensions\n");
+    int left = op->x > 0 ? op->x : 0;
+    int top = op->y > 0 ? op->y : 0;
+    int right = op->width > width - op->x ? width : op->x + op->width;
+    int bottom = op->height > height - op->y ? height : op->y + op->height;
+    if (right <= left || bottom <= top) {
+        THINPIC_LOGE("Error: Crop %dx%d+%d+%d is outside the %dx%d image", op->width, op->height, op->x, op->y,
+                     width, height);
         g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+        return NULL;
     }
+    int crop_width = right - left;
+    int crop_height = bottom - top;
     
-    // Fast compression strategy - minimal processing
-    int needs_resize = 0;
-    
-    // Only resize if absolutely necessary (very large images)
-    const int max_dimension = 8000; // Higher threshold for fast compression
-    if (width > max_dimension || height > max_dimension) {
-        needs_resize = 1;
-        double scale = 1.0;
-        if (width > height) {
-            scale = (double)max_dimension / width;
-        } else {
-            scale = (double)max_dimension / height;
-        }
-        
-        printf("[image_compressor] Fast resize with scale: %f\n", scale);
-        
-        if (vips_resize(image, &processed_image, scale, 
-                "kernel", VIPS_KERNEL_LINEAR,  // Use faster kernel
-                NULL)) {
-            printf("[image_compressor] Error: Failed to resize image\n");
+    VipsImage* source = image;
+    if ((int64_t)crop_width * crop_height * 2 <= (int64_t)width * height) {
+        int bound = thinpic_threads_bound();
+        VipsImage* region = thinpic_region_decode(input, image, left, top, crop_width, crop_height,
+                                                  bound > 0 ? bound : vips_concurrency_get());
+        if (region) {
             g_object_unref(image);
-            pthread_mutex_unlock(&vips_mutex);
-            return result;
+            if (bound > 0) vips_image_set_int(region, VIPS_META_CONCURRENCY, bound);
+            thinpic_cancel_watch(region);
+            thinpic_progress_watch(region);
+            return region;
         }
-        g_object_unref(image);
-        image = processed_image;
-        processed_image = NULL;
+        const char* loader = NULL;
+        int tiled = !input->image && vips_image_get_typeof(image, VIPS_META_LOADER) &&
+                    vips_image_get_string(image, VIPS_META_LOADER, &loader) == 0 &&
+                    (strncmp(loader, "tiffload", 8) == 0 || strncmp(loader, "jp2kload", 8) == 0);
+        // A pipe cannot be read twice
+        if (tiled && (!input_is_descriptor(input) || rewind_descriptor(input->fd))) {
+            VipsImage* random = open_input_image_with(input, VIPS_ACCESS_RANDOM);
+            if (random) {
+                THINPIC_LOGD("Crop %dx%d+%d+%d reads %s randomly", crop_width, crop_height, left, top, loader);
+                g_object_unref(image);
+                source = random;
+            }
+        }
+    }
+    VipsImage* cropped = NULL;
+    int failed = vips_extract_area(source, &cropped, left, top, crop_width, crop_height, NULL);
+    g_object_unref(source);
+    return failed ? NULL : cropped;
+}
+
+static int compress_operations(const ThinpicInput* caller_input, const ThinpicOperation* ops, int count,
+                               const ThinpicOptions* caller_options, ThinpicResult* out) {
+    double started = monotonic_ms();
+    ThinpicOptions resolved;
+    if (resolve_options(caller_options, &resolved)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        return -1;
     }
+    const ThinpicOptions* options = &resolved;
     
-    // Convert to sRGB for consistent color space
-    printf("[image_compressor] Converting image to sRGB...\n");
-    vips_error_clear();
-    if (vips_copy(image, &processed_image, 
-            "interpretation", VIPS_INTERPRETATION_sRGB,
-            NULL)) {
-        printf("[image_compressor] Error: Failed to convert image to sRGB\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    if (!ensure_vips_initialized()) {
+        return -1;
     }
     
-    g_object_unref(image);
-    image = processed_image;
-    processed_image = NULL;
+    ThinpicInput input = *caller_input;
+    MappedInput mapping;
+    map_path_input(&input, &mapping);
     
-    // Validate final image before compression
-    if (!VIPS_IS_IMAGE(image)) {
-        printf("[image_compressor] Error: Invalid image after processing\n");
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    ImageFormat format = options->format == FORMAT_AUTO ? detect_input_format(&input) : options->format;
+    if (!options_format_available(format, options)) {
+        thinpic_error_code(THINPIC_ERROR_ENCODE);
+        THINPIC_LOGE("Error: No encoder for format %d in this build", format);
+        unmap_path_input(&mapping);
+        return -1;
     }
+    int pipeline_locked = pipeline_lock();
     
-    // Fast WebP compression with optimized settings
-    printf("[image_compressor] Starting fast WebP compression...\n");
+    // Every operation only extends the graph; pixels are decoded once, as
+    // the encoder pulls them
     vips_error_clear();
-    
-    int save_result = vips_webpsave_buffer(image, &buffer, &buffer_size,
-        "Q", quality,
-        "lossless", FALSE,
-        "near_lossless", FALSE,  // Disable for speed
-        "smart_subsample", FALSE,  // Disable for speed
-        "strip", FALSE,  // Keep orientation data
-        "effort", 1,     // Minimum effort for maximum speed (0-6)
-        "method", 0,     // Fastest method (0-6)
-        NULL);
-    
-    if (save_result == 0 && buffer && buffer_size > 0) {
-        // Compression successful
-        result.data = (uint8_t*)buffer;
-        result.length = buffer_size;
-        result.success = 1;
-        printf("[image_compressor] Fast WebP compression successful: %zu bytes (quality: %d)\n", 
-               buffer_size, quality);
-        g_object_unref(image);
-        pthread_mutex_unlock(&vips_mutex);
-        return result;
+    VipsImage* image = open_input_image(&input);
+    int start = 0;
+    // Only a leading resize may decode at reduced size from input, and only
+    // a leading crop decode just its region
+    if (image && count > 0 && ops[0].type == THINPIC_OP_RESIZE) {
+        ThinpicOptions sized = *options;
+        sized.max_width = ops[0].width;
+        sized.max_height = ops[0].height;
+        sized.crop = THINPIC_CROP_NONE;
+        image = resize_with_options(&input, image, &sized);
+        if (!image) {
+            thinpic_error_code(THINPIC_ERROR_PROCESS);
+            THINPIC_LOGE("Error: Operation 0 (type %d) failed", ops[0].type);
+        }
+        start = 1;
+    } else if (image && count > 0 && ops[0].type == THINPIC_OP_CROP) {
+        image = crop_on_load(&input, image, &ops[0]);
+        if (!image) {
+            thinpic_error_code(THINPIC_ERROR_PROCESS);
+            THINPIC_LOGE("Error: Operation 0 (type %d) failed", ops[0].type);
+        }
+        start = 1;
     }
-    
-    // Compression failed
-    printf("[image_compressor] Error: Fast WebP compression failed\n");
-    const char* error = vips_error_buffer();
-    if (error && strlen(error) > 0) {
-        printf("[image_compressor] VIPS error: %s\n", error);
+    if (image && start < count) {
+        image = thinpic_apply_operations(image, ops, start, count, (VipsKernel)options->kernel);
+        if (!image) thinpic_error_code(THINPIC_ERROR_PROCESS);
     }
     
-    // Cleanup
-    if (buffer) {
-        g_free(buffer);
+    if (encode_prepared(&input, image, format, 0, options, pipeline_locked, &mapping, NULL, out) != 0) {
+        return -1;
     }
-    g_object_unref(image);
-    vips_error_clear();
-    
-    pthread_mutex_unlock(&vips_mutex);
-    return result;
-}
\ No newline at end of file
+    out->elapsed_ms = (int)(monotonic_ms() - started);
+    out->budget_met = -1;
+    return deliver_to_sinks(options, out);
+}
+
+int thinpic_compress_ops(const ThinpicSource* source, const ThinpicOperation* ops, int count,
+                         const ThinpicOptions* options, ThinpicResult* out) {
+    if (!out) {
+        THINPIC_LOGE("Error: Invalid result pointer");
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+    thinpic_error_reset();
+    if (!source || !options || count < 0 || (count > 0 && !ops)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_compress_ops arguments");
+        return with_error(-1, out);
+    }
+    ThinpicInput input;
+    if (source_input(source, &input)) {
+        return with_error(-1, out);
+    }
+    int status = compress_operations(&input, ops, count, options, out);
+    release_input(&input);
+    return with_error(status, out);
+}
@@ -18,9 +18,16 @@ typedef enum {
     FORMAT_JP2K = 5,  // JPEG 2000
     FORMAT_JXL = 6,   // JPEG XL
     FORMAT_GIF = 7,
-    FORMAT_AUTO = 8   // Auto-detect based on input file extension
+    FORMAT_AUTO = 8,  // Auto-detect from the input's signature, then its extension
+    FORMAT_AVIF = 9   // AV1 in a HEIF container; after AUTO to keep the earlier values
 } ImageFormat;
 
+// Execution modes for the compression entry points
+typedef enum {
+    EXECUTION_MODE_CONCURRENT = 0,  // Independent jobs run in parallel (default)
+    EXECUTION_MODE_SERIAL = 1       // Every pipeline holds one global lock, one job at a time
+} ExecutionMode;
+
 typedef struct {
     uint8_t* data;
     size_t length;
@@ -37,6 +44,711 @@ typedef struct {
     int new_height;
 } ImageInfo;
 
+// Header-only probe result; no pixels are decoded
+typedef struct {
+    int width;
+    int height;
+    int bands;
+    int orientation;     // EXIF orientation 1-8, 0 when absent
+    int format;          // ImageFormat of the source, FORMAT_AUTO when it is none of ours
+    int64_t file_size;   // Bytes on disk
+    int success;
+} ImageHeader;
+
+// Gallery index entry (thinpic_index_images), from the container headers
+// and EXIF alone
+typedef struct {
+    int width;               // As stored; HEIF and AVIF after their irot, already upright
+    int height;
+    int orientation;         // EXIF orientation 1-8, 0 when absent
+    int format;              // ImageFormat of the source, FORMAT_AUTO when it is none of ours
+    int64_t file_size;       // Bytes on disk
+    int64_t capture_time;    // DateTimeOriginal, else DateTime, as seconds since 1970 on the camera's
+                             // own clock (EXIF has no time zone); -1 when absent
+    int has_gps;             // 1 when the EXIF carries a GPS position
+    int success;             // 1, or -1 when the file cannot be read
+} ThinpicImageMeta;
+
+// Predicted result of one compression, from the header alone
+// (thinpic_estimate_output); nothing is decoded
+typedef struct {
+    int64_t bytes;               // Predicted output size; typically within some tens of percent
+    double encode_ms;            // Predicted wall time on this device (throughput model)
+    int64_t working_set_bytes;   // Peak memory, as the pool's memory budget charges it
+    int width;                   // Output dimensions once fitted to the box
+    int height;
+    double source_bpp;           // Encoded bits per source pixel
+    int success;
+} ThinpicEstimate;
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    int width;
+    int height;
+    int orientation;     // EXIF orientation 1-8 of the main image, 0 when absent
+    int success;
+} ExifThumbnail;
+
+// Resource use of one compression. libvips tracks memory process-wide, so
+// the figures are exact only while one job runs at a time
+// (EXECUTION_MODE_SERIAL or a single pool job).
+typedef struct {
+    int64_t peak_mem_delta;  // Growth of vips_tracked_get_mem_highwater; 0 if under an earlier peak
+    int64_t mem_delta;       // vips_tracked_get_mem after minus before (memory retained)
+    int live_allocs;         // vips_tracked_get_allocs on return: pixel buffers still open
+    int open_files;          // vips_tracked_get_files on return
+    double elapsed_ms;
+    // Wall time per stage in microseconds. libvips evaluates lazily, so
+    // decoding, resizing and colour conversion mostly run while the encoder
+    // pulls pixels and are counted in encode_us; decode_us is only the time
+    // spent rendering the image into memory first (the search modes).
+    int64_t open_us;         // Opening the input and reading its header
+    int64_t decode_us;       // Rendering the decoded (and shrunk) image into memory
+    int64_t resize_us;       // Shrink-on-load reopen and resize setup
+    int64_t colour_us;       // Orientation and sRGB conversion setup
+    int64_t encode_us;       // The rest of elapsed_ms: every encode, with the lazily run stages
+    int64_t copy_us;         // Copying the chosen encode out for the caller
+    int quality;             // Quality of the returned encode (the one a search chose); -1 for lossless output and libwebp-rate-controlled WebP
+    int format;              // ImageFormat of the returned bytes; -1 on failure
+    int width;               // Dimensions of the returned image, from its header; 0 on failure
+    int height;
+    int encode_attempts;     // Encodes run, search probes included; 0 when the bytes came from a cache or the input as is
+} CompressionStats;
+
+// Why a compression failed. Each call captures its own failure on the
+// thread running it instead of reading libvips' process-wide error buffer,
+// so parallel jobs never see or clear each other's errors.
+typedef enum {
+    THINPIC_ERROR_NONE = 0,
+    THINPIC_ERROR_FAILED = 1,            // Not classified further; see the message
+    THINPIC_ERROR_INVALID_ARGUMENT = 2,  // Empty input, quality or size out of range, bad options
+    THINPIC_ERROR_DECODE = 3,            // The input could not be opened or decoded
+    THINPIC_ERROR_PROCESS = 4,           // Resize, orientation or colour conversion failed
+    THINPIC_ERROR_ENCODE = 5,            // The encoder failed
+    THINPIC_ERROR_IO = 6,                // The output file could not be written
+    THINPIC_ERROR_CANCELLED = 7,         // thinpic_cancel_job stopped the job
+    THINPIC_ERROR_LIMIT = 8,             // The input is larger than thinpic_configure max_input_megapixels or max_input_bands allow
+    THINPIC_ERROR_TIMEOUT = 9            // The job ran past thinpic_configure job_timeout_ms and was stopped
+} ThinpicErrorCode;
+
+#define THINPIC_ERROR_MESSAGE_MAX 256
+
+typedef struct {
+    int code;                                  // ThinpicErrorCode; THINPIC_ERROR_NONE on success
+    char message[THINPIC_ERROR_MESSAGE_MAX];   // First error logged, then libvips' detail; empty on success
+} ThinpicError;
+
+typedef struct {
+    CompressedImageResult result;
+    CompressionStats stats;
+    ThinpicError error;
+} CompressedImageResultEx;
+
+// Telemetry for fleet monitoring. After the first thinpic_drain_stats call,
+// every compression through the CompressMode dispatch (pool jobs,
+// compress_buffer, compress_fd, compress_with_stats) appends one record to a
+// fixed ring; writers take no lock, and when nobody drains for
+// THINPIC_TELEMETRY_RECORDS jobs the oldest records are overwritten. Before
+// the first drain nothing is recorded.
+#define THINPIC_TELEMETRY_RECORDS 256
+
+typedef enum {
+    THINPIC_TELEMETRY_OK = 0,
+    THINPIC_TELEMETRY_FAILED = 1,
+    THINPIC_TELEMETRY_CANCELLED = 2
+} ThinpicTelemetryError;
+
+typedef struct {
+    int64_t sequence;        // One more than the previous record's; a gap counts records overwritten before a drain
+    int mode;                // CompressMode of the job
+    int error;               // ThinpicTelemetryError
+    int64_t input_bytes;     // Encoded input size; 0 for pipes, -1 when unknown
+    int width;               // Source dimensions; 0 when the pipeline read no header of its own
+    int height;
+    int64_t output_bytes;    // 0 on failure
+    CompressionStats stats;  // Elapsed and per-stage time, libvips peak memory, quality and format
+    int preset;              // ThinpicPreset id the job ran with; 0 = built-in values
+} ThinpicTelemetryRecord;
+
+// Move up to max records, oldest first, into out; returns how many. A call
+// with max 0 only starts recording.
+int thinpic_drain_stats(ThinpicTelemetryRecord* out, int max);
+
+// How downscales split between libvips' integer box shrink and the resize
+// kernel (thinpic_configure resize_quality). The box shrink takes the image
+// to within a "gap" of the output size and the kernel only resamples that
+// residual, so a 0.1x reduction costs about as much as a 0.5x one.
+typedef enum {
+    THINPIC_RESIZE_FAST = 0,      // Box shrink to under 2x the output, then the kernel
+    THINPIC_RESIZE_BALANCED = 1,  // Box shrink to 2-4x the output (libvips default)
+    THINPIC_RESIZE_BEST = 2       // Box shrink to 4-8x the output: the kernel sees more of the source
+} ThinpicResizeQuality;
+
+// Rolling throughput of this device for one format (thinpic_get_throughput),
+// as moving averages over real calls. The encode rate is what latency
+// budgets plan with. A rate without samples is the built-in prior.
+typedef struct {
+    double encode_ms_per_mp;   // thinpic_compress wall time per output megapixel, decode included
+    double decode_ms_per_mp;   // Rendering a decoded image of this source format, per megapixel rendered
+    int encode_samples;        // Plain thinpic_compress calls measured at this format and effort
+    int decode_samples;        // Decodes measured (smart, lossless and SSIM searches render first)
+} ThinpicThroughput;
+
+// Process-wide resource limits for thinpic_configure. Negative fields keep
+// the current setting.
+typedef struct {
+    int memory_budget_mb;      // Worker pool admission budget; 0 = unlimited
+    int cache_max_mem_mb;      // vips_cache_set_max_mem
+    int cache_max_operations;  // vips_cache_set_max; 0 disables the operation cache
+    int threads_per_image;     // vips_concurrency_set; 0 = libvips default
+    int mmap_input_min_mb;     // Memory-map path inputs of at least this size; 0 = never
+    int skip_compliant;        // 1 = return the original bytes when the input already has the requested format and fits the size/KB target and metadata_policy is STRIP_NONE; 0 = always re-encode
+    int metadata_policy;       // ThinpicStripPolicy for every entry point but thinpic_compress (which takes options->strip); default THINPIC_STRIP_NONE
+    int thermal_scaling;       // 1 = run fewer pool jobs at once and lower encoder effort while the device is hot or in power saver; 0 = off (default)
+    int gpu_resize_min_mp;     // Lanczos3 downscales of 8-bit images of at least this many megapixels run on the GPU (GLES 3.1 compute) when it is free; 0 = never (default)
+    int resize_quality;        // ThinpicResizeQuality for every downscale; default THINPIC_RESIZE_BALANCED
+    int flatten_background;    // 0xRRGGBB that alpha is flattened onto for JPEG output; default 0xFFFFFF (white)
+    int handle_cache_mb;       // Largest decoded image a ThinpicHandle keeps in memory; 0 = none, default 64
+    int decode_cache_mb;       // Decoded, resized path inputs the fixed-preset functions keep across calls (LRU), so re-encoding the same file and size skips the decode; 0 = none (default)
+    int lossless_orientation;  // 1 = a JPEG the fixed-preset functions keep at full size and must turn upright (metadata_policy other than THINPIC_STRIP_NONE) is rotated in the DCT domain before decoding rather than as pixels; partial edge blocks (< 16 px) may be trimmed; 0 = off (default)
+    int dither_high_depth;     // 1 = 16-bit inputs narrowed to 8 bits for JPEG, WebP and GIF output get a 4x4 ordered dither; 0 = round to nearest (default)
+    int one_shot_cache;        // 1 = the operation cache holds nothing while no ThinpicHandle is open, so one-off compressions do not pin decoded pixels; sessions get cache_max_operations; 0 = off (default)
+    int adaptive_quality;      // 1 = target-size JPEG and WebP searches (smart_compress_image*) low-pass the flat, least salient regions first, so detail gets the bits; 0 = off (default)
+    int disc_threshold_mb;     // Images rendered whole for random access (searches, rotations, palette and SSIM passes) larger than this go to a temp file in the thinpic_set_spill_dir directory instead of memory; 0 = automatic (default): a quarter of memory_budget_mb while a budget is set, else always memory
+    int jpeg_strip_encode;     // 1 = large-image and DSLR JPEG outputs of 8 MP or more (compress_large_image*, compress_large_dslr_image*) are encoded in strips on parallel threads and joined at restart markers, with standard Huffman tables; 0 = off (default)
+    int max_input_megapixels;  // Inputs whose header declares more pixels than this (all frames of an animation) fail with THINPIC_ERROR_LIMIT before any decode; 0 = unlimited (default)
+    int max_input_bands;       // Inputs with more bands fail the same way; 0 = unlimited (default)
+    int job_timeout_ms;        // Pool jobs still running after this long are stopped (libvips kill) and fail with THINPIC_ERROR_TIMEOUT; 0 = none (default)
+    int platform_decode;       // 1 = HEIC, HEIF and AVIF inputs are decoded by the platform (AImageDecoder on Android 11+, hardware HEVC where present) even when libvips has libheif; 0 = only when libvips cannot load them (default)
+    int coefficient_search;    // 1 = target-size JPEG searches (smart_compress_image*) on a JPEG that keeps its size, orientation and colours requantize its DCT coefficients per probe instead of decoding it, re-coding only the entropy layer; chroma subsampling stays the source's; 0 = off (default)
+    int deterministic;         // 1 = the same input and options give the same bytes on every call, whatever the thread grant, throttle or timing: no thermal effort cuts, latency budget plans, GPU resizes or strip JPEG encodes, and the auto race waits for every format (the platform's HEVC decoder and encoder stay the device's own); 0 = off (default)
+} ThinpicRuntimeConfig;
+
+// Snapshot of libvips and worker pool state (thinpic_get_runtime_stats).
+// The cache fields are 0 while VIPS is not initialized.
+typedef struct {
+    int cache_operations;            // vips_cache_get_size: operations held in the cache
+    int cache_max_operations;        // vips_cache_get_max
+    int64_t cache_max_mem;           // vips_cache_get_max_mem, in bytes
+    int64_t tracked_mem;             // vips_tracked_get_mem: bytes libvips has allocated now
+    int64_t tracked_mem_highwater;   // vips_tracked_get_mem_highwater: most ever allocated at once
+    int tracked_allocs;              // vips_tracked_get_allocs: live libvips allocations
+    int open_files;                  // vips_tracked_get_files
+    int pool_workers;                // Worker pool threads; 0 before the first submit
+    int active_jobs;                 // Pool jobs (batch items included) running now
+    int queued_jobs;                 // Pool jobs waiting for a worker or for memory budget
+    int64_t in_flight_bytes;         // Working-set estimates charged by the running jobs
+    int thermal_status;              // Last AThermalStatus read; -1 while thermal scaling is off or before API 30
+} ThinpicRuntimeStats;
+
+// Runtime log filtering; levels above the compile-time THINPIC_LOG_LEVEL
+// are compiled out and cannot be re-enabled here
+typedef enum {
+    THINPIC_LOG_NONE = 0,
+    THINPIC_LOG_ERROR = 1,
+    THINPIC_LOG_WARN = 2,
+    THINPIC_LOG_INFO = 3,
+    THINPIC_LOG_DEBUG = 4
+} ThinpicLogLevel;
+
+// Receives each formatted message (no trailing newline); may be called from
+// any thread
+typedef void (*ThinpicLogSink)(int level, const char* message);
+
+// Progress of a running pool job, 0-100. Called from native threads.
+typedef void (*ThinpicProgressCallback)(int64_t job_id, int percent);
+
+// A pool job reached DONE, FAILED or CANCELLED (status is a JobStatus).
+// Called once per watched job from a native thread (thinpic_watch_job).
+typedef void (*ThinpicJobCallback)(int64_t job_id, int status);
+
+// Encoded output of stream_compress_image_to_callback, called on the saver's
+// thread as bytes are produced. The callee owns chunk and releases it with
+// free_compressed_buffer. The last call has chunk NULL and length set to the
+// total bytes delivered, or -1 when the compression failed.
+typedef void (*ThinpicChunkCallback)(int64_t stream_id, uint8_t* chunk, int64_t length);
+
+// ThinpicOptions sink (version 22): consecutive slices of the finished
+// output, borrowed for the call only, on the thread running thinpic_compress.
+// Returning non-zero fails the call.
+typedef int (*ThinpicSinkCallback)(int64_t sink_id, const uint8_t* data, size_t length);
+
+// Compression modes dispatched by the job API
+typedef enum {
+    COMPRESS_MODE_STANDARD = 0,    // compress_image_with_size_and_format
+    COMPRESS_MODE_LARGE = 1,       // compress_large_image_with_format
+    COMPRESS_MODE_LARGE_DSLR = 2,  // compress_large_dslr_image_with_format
+    COMPRESS_MODE_SMART = 3,       // smart_compress_image_with_format
+    COMPRESS_MODE_AUTO = 4,        // auto_compress_image_with_options (target_kb = accept_below_kb)
+    COMPRESS_MODE_FAST_WEBP = 5,   // fast_webp_compress
+    COMPRESS_MODE_STREAM = 6,      // stream_compress_image
+    COMPRESS_MODE_LOSSLESS_JPEG = 7,  // DCT-domain orientation fix and crop (JPEG input only)
+    COMPRESS_MODE_THUMBNAIL = 8,      // thumbnail_compress_image
+    COMPRESS_MODE_JPEG_OPTIMIZE = 9   // DCT-domain re-code: progressive, optimized Huffman, no metadata (JPEG input only)
+} CompressMode;
+
+// Scheduling class of a pool job. Interactive jobs start ahead of every
+// queued background job, and background jobs leave one worker free for
+// them. Background jobs run at nice 10 on the slowest cores when the CPU
+// has clusters of different speeds (big.LITTLE).
+typedef enum {
+    THINPIC_PRIORITY_INTERACTIVE = 0,
+    THINPIC_PRIORITY_BACKGROUND = 1
+} ThinpicPriority;
+
+// smart_compress_image_to_file results, the original tool's exit codes
+typedef enum {
+    THINPIC_SMART_FILE_OK = 0,
+    THINPIC_SMART_FILE_LOAD_FAILED = 1,
+    THINPIC_SMART_FILE_SAVE_FAILED = 3,  // 2 was a failed 1.3x upscale, which high no longer does
+    THINPIC_SMART_FILE_NO_FIT = 4        // No quality lands within 20% of the target
+} ThinpicSmartFileStatus;
+
+// Parameters for one compression; fields a mode does not use are ignored
+typedef struct {
+    CompressMode mode;
+    ImageFormat format;
+    int quality;
+    int target_width;
+    int target_height;
+    int target_kb;
+    int smart_type;
+    // COMPRESS_MODE_LOSSLESS_JPEG crop, in upright (post-orientation) pixels.
+    // The offset is rounded down to the MCU grid and the size grows to keep
+    // the requested area; crop_width/crop_height 0 run to the edge.
+    int crop_x;
+    int crop_y;
+    int crop_width;
+    int crop_height;
+    int priority;       // ThinpicPriority; only the worker pool uses it
+    // Page of a multi-page TIFF or PDF to compress, from 0; other inputs
+    // ignore it. Later pages skip the thumbnail shrink-on-load.
+    int page;
+    // Pool client (thinpic_pool_client) the job is queued for; 0 = shared.
+    // Within a priority, the next job to start comes from the client with
+    // the fewest jobs running, so one isolate's batch does not hold back
+    // another's.
+    int client;
+    // Tuning preset (thinpic_presets_load) by id; 0 = the loaded default,
+    // or the built-in values when none is loaded.
+    int preset;
+} CompressOptions;
+
+// Remotely tuned presets for the CompressMode dispatch. The caps and
+// quality ladders those modes were built with (6000 px on the long side,
+// 8000 for COMPRESS_MODE_FAST_WEBP, smart qualities 85/95/60/30, size
+// searches from 85 down to 40) are the built-in values. A preset replaces
+// those it sets (non-zero fields) and keeps the rest. thinpic_presets_load
+// copies the table once; a job only looks its preset up by id when it
+// starts and never parses anything. Telemetry records report the preset a
+// job ran with, so an experiment can compare arms.
+#define THINPIC_PRESET_MAX 32
+#define THINPIC_PRESET_NAME_MAX 32
+
+typedef struct {
+    int id;                      // Non-zero; CompressOptions.preset and ThinpicTelemetryRecord.preset
+    char name[THINPIC_PRESET_NAME_MAX];  // NUL-terminated, for thinpic_preset_id
+    int max_dimension;           // Long-side cap of the standard, large and smart modes; 0 = 6000
+    int minimal_max_dimension;   // COMPRESS_MODE_FAST_WEBP's cap; 0 = 8000
+    int smart_quality[4];        // Smart modes' quality by smart_type 0-3; 0 = 85, 95, 60, 30
+    int search_start_quality;    // Highest quality a target-size search tries (smart_type 1 keeps 100); 0 = 85
+    int search_end_quality;      // Lowest; 0 = 40
+} ThinpicPreset;
+
+// Replaces the loaded presets with count entries (at most
+// THINPIC_PRESET_MAX, ids unique and non-zero) and makes default_id the
+// one jobs with preset 0 use; 0 keeps the built-in values for them. count
+// 0 clears the table. Jobs already running keep the values they started
+// with. Returns the presets loaded, or -1 (nothing changed) on invalid
+// entries.
+int thinpic_presets_load(const ThinpicPreset* presets, int count, int default_id);
+// Id of the loaded preset named `name`, or 0
+int thinpic_preset_id(const char* name);
+
+// Tuning for auto_compress_image_with_options
+typedef struct {
+    int skip_unlikely_formats;  // Skip PNG/TIFF/GIF for photographic (JPEG/HEIF) sources
+    int accept_below_kb;        // Take the first candidate at or under this size and cancel the rest; 0 keeps the smallest
+    int classify;               // Encode once in the format the content classifier picks; race the rest only if that fails or is over accept_below_kb
+} AutoCompressOptions;
+
+// One output of compress_image_variants: the box to fit (0 leaves a side
+// free; neither side keeps the size, capped at 6000 px), format and quality
+#define THINPIC_MAX_VARIANTS 8
+
+typedef struct {
+    int width;
+    int height;
+    ImageFormat format;          // FORMAT_AUTO keeps the input format
+    int quality;                 // 1-100
+} ThinpicVariant;
+
+// Layout of a contact sheet (thinpic_contact_sheet): every input fills one
+// cell_width x cell_height cell, upright and centre-cropped (smaller sources
+// are centred, not upscaled), `columns` to a row (0 = as square a grid as
+// the count allows), with `spacing` px between cells and around the edge
+#define THINPIC_SHEET_MAX_CELLS 4096
+#define THINPIC_SHEET_MAX_CELL 1024
+
+typedef struct {
+    int columns;
+    int cell_width;              // 1-THINPIC_SHEET_MAX_CELL
+    int cell_height;
+    int spacing;                 // 0-256
+    ImageFormat format;          // FORMAT_AUTO = JPEG
+    int quality;                 // 1-100
+} ThinpicSheetLayout;
+
+// Where one input landed on the sheet; success is -1 for an input that
+// could not be decoded, whose cell is left black
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+    int success;
+} ThinpicSheetCell;
+
+// Job states reported by the worker pool
+typedef enum {
+    JOB_STATUS_UNKNOWN = -1,  // No such job, or its result was already claimed
+    JOB_STATUS_PENDING = 0,
+    JOB_STATUS_RUNNING = 1,
+    JOB_STATUS_DONE = 2,
+    JOB_STATUS_FAILED = 3,
+    JOB_STATUS_CANCELLED = 4  // thinpic_cancel_job stopped it; the result carries no data
+} JobStatus;
+
+// Unified entry point (thinpic_compress). ThinpicOptions is versioned: fields
+// are only ever appended, and the version tells the library which ones the
+// caller knows about. Start from thinpic_options_init.
+#define THINPIC_OPTIONS_VERSION 22
+
+typedef enum {
+    THINPIC_SOURCE_PATH = 0,
+    THINPIC_SOURCE_BUFFER = 1,  // Encoded bytes, read in place
+    THINPIC_SOURCE_FD = 2,      // Open descriptor; the caller keeps ownership
+    THINPIC_SOURCE_PIXELS = 3   // Raw 8-bit pixels at data, read in place
+} ThinpicSourceType;
+
+// THINPIC_SOURCE_PIXELS (Flutter ui.Image toByteData, camera frames) reads
+// width x height pixels laid out as pixel_format (a ThinpicPixelFormat) from
+// data, stride bytes per row (0 = tightly packed), length bytes in all. The
+// pixels go through the same resize and encode as a decoded file and are not
+// copied when the stride is a whole number of pixels and the buffer holds
+// stride * height bytes; they must stay valid until the call returns (until
+// thinpic_close for a handle). premultiplied: the colour is premultiplied by
+// alpha, as in ImageByteFormat.rawRgba. FORMAT_AUTO writes PNG when the
+// layout has alpha and JPEG otherwise.
+typedef struct {
+    ThinpicSourceType type;
+    const char* path;
+    const uint8_t* data;
+    size_t length;
+    int fd;
+    int width;                   // THINPIC_SOURCE_PIXELS only, from here on
+    int height;
+    int stride;
+    int pixel_format;
+    int premultiplied;
+} ThinpicSource;
+
+// Resampling kernel for downscaling (same order as VipsKernel)
+typedef enum {
+    THINPIC_KERNEL_NEAREST = 0,
+    THINPIC_KERNEL_LINEAR = 1,
+    THINPIC_KERNEL_CUBIC = 2,
+    THINPIC_KERNEL_MITCHELL = 3,
+    THINPIC_KERNEL_LANCZOS2 = 4,
+    THINPIC_KERNEL_LANCZOS3 = 5
+} ThinpicKernel;
+
+// Metadata written to the output. Policies that drop EXIF apply the EXIF
+// orientation to the pixels first.
+typedef enum {
+    THINPIC_STRIP_NONE = 0,      // Keep all metadata
+    THINPIC_STRIP_ALL = 1,       // Keep nothing
+    THINPIC_STRIP_KEEP_ICC = 2   // Keep only the colour profile
+} ThinpicStripPolicy;
+
+// Embedded video of a motion photo (ThinpicOptions version 19; see
+// thinpic_motion_photo_probe). The still is compressed either way.
+typedef enum {
+    THINPIC_MOTION_VIDEO_STRIP = 0,  // Write the still alone (the default)
+    THINPIC_MOTION_VIDEO_KEEP = 1    // JPEG output: copy the video after the new still, undecoded
+} ThinpicMotionVideo;
+
+// Ultra HDR gain map of a JPEG source (ThinpicOptions version 21): the
+// secondary image its MPF index names, with hdrgm or ISO 21496-1 metadata
+typedef enum {
+    THINPIC_GAIN_MAP_STRIP = 0,  // SDR output: the primary alone, as libvips reads it (the default)
+    THINPIC_GAIN_MAP_KEEP = 1    // JPEG output: the gain map resized and turned with the primary and appended
+} ThinpicGainMap;
+
+// Element type of the model input tensor (ThinpicOptions version 20)
+typedef enum {
+    THINPIC_TENSOR_UINT8 = 0,    // 0-255, as quantised models take it
+    THINPIC_TENSOR_FLOAT32 = 1   // (value / 255 - tensor_mean) / tensor_std per channel
+} ThinpicTensorType;
+
+// Largest tensor side thinpic_compress produces
+#define THINPIC_TENSOR_MAX 1024
+
+// WebP encoder presets (ThinpicOptions version 2). effort is libwebp's
+// method; sharp YUV (libsharpyuv) sharpens chroma edges at some encode cost.
+//   FAST      method 1, plain RGB->YUV, alpha quality 80
+//   BALANCED  method 4 (the libwebp default), plain RGB->YUV, lossless alpha
+//   ARCHIVE   method 6, sharp YUV, auto-adjusted deblocking, lossless alpha
+typedef enum {
+    THINPIC_WEBP_PROFILE_DEFAULT = 0,  // Follow effort; libvips defaults elsewhere
+    THINPIC_WEBP_PROFILE_FAST = 1,
+    THINPIC_WEBP_PROFILE_BALANCED = 2,
+    THINPIC_WEBP_PROFILE_ARCHIVE = 3
+} ThinpicWebpProfile;
+
+// Progressive JPEG scan scripts (ThinpicOptions version 3). Every scan adds
+// detail to the whole frame, so a viewer can draw a coarse picture from the
+// first scans instead of waiting for the image to load top to bottom.
+//   DEFAULT  libjpeg's standard 10-scan progression
+//   PREVIEW  full-precision DC first (an exact 1/8-scale image), then the
+//            lowest luma frequencies: the earliest usable preview
+//   CUSTOM   the caller's scans / scan_count
+typedef enum {
+    THINPIC_SCAN_SCRIPT_DEFAULT = 0,
+    THINPIC_SCAN_SCRIPT_PREVIEW = 1,
+    THINPIC_SCAN_SCRIPT_CUSTOM = 2
+} ThinpicScanScript;
+
+// One progressive JPEG scan (libjpeg's jpeg_scan_info). DC scans (ss = se = 0)
+// may interleave components; AC scans cover exactly one.
+typedef struct {
+    int component_count;         // 1-4
+    int components[4];           // Component indices: 0 = Y, 1 = Cb, 2 = Cr
+    int ss;                      // Spectral selection start, 0-63
+    int se;                      // Spectral selection end
+    int ah;                      // Successive approximation: bit position of the previous scan (0 = first)
+    int al;                      // Bit position this scan stops at
+} ThinpicScan;
+
+// Indexed (palette) PNG output (ThinpicOptions version 5). Screenshots and
+// UI captures rarely use more than a few hundred colours; one byte or less
+// per pixel instead of three or four shrinks them several times over.
+typedef enum {
+    THINPIC_PNG_PALETTE_OFF = 0,   // Truecolour PNG
+    THINPIC_PNG_PALETTE_AUTO = 1,  // Indexed only when the image already fits the palette (lossless)
+    THINPIC_PNG_PALETTE_ON = 2     // Always indexed; images with more colours are quantised (median cut)
+} ThinpicPngPalette;
+
+// Truecolour PNG compressor (ThinpicOptions version 6). Both filter every
+// row adaptively; libdeflate then compresses the image in one pass, 2-4x
+// faster than zlib for the same or a smaller file, at the cost of holding
+// the filtered image in memory. Interlaced output always uses zlib.
+typedef enum {
+    THINPIC_PNG_DEFLATE_ZLIB = 0,        // libvips pngsave
+    THINPIC_PNG_DEFLATE_LIBDEFLATE = 1,
+    THINPIC_PNG_DEFLATE_OPTIMIZE = 2     // libdeflate level 12 over several filter strategies in parallel; smallest kept
+} ThinpicPngDeflate;
+
+// Fill mode for the max box (ThinpicOptions version 8, same order as
+// VipsInteresting). With a crop and both max_width and max_height set, the
+// image is scaled to cover the box and cropped to it (square avatars, grid
+// cells); the decoder's shrink-on-load runs first so the crop is chosen on
+// a small intermediate. Inputs smaller than the box are cropped, not
+// upscaled. EXIF orientation is applied before cropping. Animations are
+// fitted, not cropped.
+typedef enum {
+    THINPIC_CROP_NONE = 0,       // Fit inside the box
+    THINPIC_CROP_CENTRE = 1,     // Keep the middle
+    THINPIC_CROP_ENTROPY = 2,    // Keep the busiest region
+    THINPIC_CROP_ATTENTION = 3   // Keep skin tones, saturated colour and edges
+} ThinpicCrop;
+
+// Codec inside FORMAT_HEIF output (ThinpicOptions version 10). HEVC writes
+// HEIC, through the platform's hardware encoder when there is one; AV1
+// writes AVIF through whichever AV1 encoder libheif was built with (aom,
+// SVT-AV1 or rav1e), always in software and several times slower.
+typedef enum {
+    THINPIC_HEIF_HEVC = 0,
+    THINPIC_HEIF_AV1 = 1
+} ThinpicHeifCompression;
+
+// Chroma subsampling of FORMAT_HEIF and FORMAT_AVIF output (same order as
+// VipsForeignSubsample). Hardware HEVC encoders only write 4:2:0, so 4:4:4
+// always goes through libheif.
+typedef enum {
+    THINPIC_SUBSAMPLE_AUTO = 0,  // 4:2:0 below quality 90, 4:4:4 from it
+    THINPIC_SUBSAMPLE_420 = 1,   // Always 4:2:0: smallest, softer colour edges
+    THINPIC_SUBSAMPLE_444 = 2    // Full chroma: sharp coloured text and UI edges
+} ThinpicSubsample;
+
+// Base quantisation tables of FORMAT_JPEG output (same order as libvips'
+// quant_table). Only mozjpeg has more than the standard ones.
+typedef enum {
+    THINPIC_QUANT_TABLE_DEFAULT = -1,     // ImageMagick's with mozjpeg, Annex K otherwise
+    THINPIC_QUANT_TABLE_ANNEX_K = 0,      // The JPEG standard's; what every other encoder writes
+    THINPIC_QUANT_TABLE_FLAT = 1,
+    THINPIC_QUANT_TABLE_MSSIM = 2,        // Tuned for MS-SSIM on the Kodak set
+    THINPIC_QUANT_TABLE_IMAGEMAGICK = 3,  // mozjpeg's default: smaller at equal quality for photos
+    THINPIC_QUANT_TABLE_PSNR_HVS_M = 4,
+    THINPIC_QUANT_TABLE_KLEIN = 5,
+    THINPIC_QUANT_TABLE_WATSON = 6,
+    THINPIC_QUANT_TABLE_AHUMADA = 7,
+    THINPIC_QUANT_TABLE_PETERSON = 8
+} ThinpicQuantTable;
+
+// Where a watermark sits (ThinpicOptions version 17, same order as
+// VipsCompassDirection)
+typedef enum {
+    THINPIC_GRAVITY_CENTRE = 0,
+    THINPIC_GRAVITY_NORTH = 1,
+    THINPIC_GRAVITY_EAST = 2,
+    THINPIC_GRAVITY_SOUTH = 3,
+    THINPIC_GRAVITY_WEST = 4,
+    THINPIC_GRAVITY_NORTH_EAST = 5,
+    THINPIC_GRAVITY_SOUTH_EAST = 6,
+    THINPIC_GRAVITY_SOUTH_WEST = 7,
+    THINPIC_GRAVITY_NORTH_WEST = 8
+} ThinpicGravity;
+
+// Loading placeholder returned with a thinpic_compress result, computed from
+// the pixels being encoded
+typedef enum {
+    THINPIC_PLACEHOLDER_NONE = 0,
+    THINPIC_PLACEHOLDER_BLURHASH = 1,  // BlurHash, 4x3 components (3x4 portrait)
+    THINPIC_PLACEHOLDER_THUMBHASH = 2  // ThumbHash bytes as base64; keeps aspect ratio and alpha
+} ThinpicPlaceholder;
+
+// Room for the NUL-terminated placeholder either kind writes
+#define THINPIC_PLACEHOLDER_MAX 64
+// Most dominant colours a thinpic_compress result carries
+#define THINPIC_PALETTE_MAX 8
+
+typedef struct {
+    int version;                 // THINPIC_OPTIONS_VERSION
+    ImageFormat format;          // FORMAT_AUTO keeps the input format
+    int quality;                 // 1-100 (lossy formats)
+    int effort;                  // 0 fastest .. 9 smallest, scaled to each encoder; -1 = encoder default
+    ThinpicKernel kernel;
+    int max_width;               // Fit inside max_width x max_height; 0 = unconstrained, never upscales
+    int max_height;
+    ThinpicStripPolicy strip;
+    int threads;                 // libvips worker threads for this image; 0 = thinpic_configure setting
+    // Version 2
+    ThinpicWebpProfile webp_profile;
+    int webp_sharp_yuv;          // 1 on, 0 off, -1 = profile setting
+    int alpha_quality;           // WebP alpha plane quality 1-100; 0 = profile setting
+    // Version 3
+    int progressive;             // 1 = progressive JPEG / Adam7-interlaced PNG
+    ThinpicScanScript scan_script;
+    const ThinpicScan* scans;    // THINPIC_SCAN_SCRIPT_CUSTOM only; read during the call
+    int scan_count;
+    // Version 4
+    int animated;                // 1 = keep every frame of animated GIF/WebP input (WebP or GIF output)
+    // Version 5
+    ThinpicPngPalette png_palette;
+    int png_bitdepth;            // Bits per palette index: 1, 2, 4 or 8 (2-256 colours); 0 = smallest that fits 256
+    int dither;                  // Floyd-Steinberg strength 0-100 when quantising
+    // Version 6
+    ThinpicPngDeflate png_deflate;
+    // Version 7
+    double min_ssim;             // JPEG/WebP: lowest quality up to `quality` whose SSIM stays >= this (0-1); 0 = off
+    // Version 8
+    ThinpicCrop crop;            // Fill max_width x max_height and crop (both must be set)
+    // Version 9
+    int latency_budget_ms;       // Aim to return within this many ms (see thinpic_compress); 0 = off
+    // Version 10
+    ThinpicHeifCompression heif_compression;
+    ThinpicSubsample heif_subsample;
+    // Version 11
+    double jxl_distance;         // JPEG XL Butteraugli distance, 0.1 (visually lossless) to 25, instead of quality; 0 = from quality
+    int jxl_lossless_jpeg;       // 1 = JPEG input to FORMAT_JXL as a reversible transcode (see thinpic_compress)
+    // Version 12
+    int perceptual_hash;         // 1 = set out->perceptual_hash from the encoded pixels (see thinpic_compress)
+    // Version 13
+    ThinpicPlaceholder placeholder;  // Set out->placeholder from the encoded pixels
+    // Version 14
+    int analysis;                // 1 = set the blur and exposure scores of out (see thinpic_compress)
+    // Version 15
+    int gif_colours;             // GIF palette entries, 2-256 (dither applies as for PNG); 0 = 256
+    int gif_interframe;          // Animated GIF: largest channel difference for a pixel to repeat the previous frame, 0-255; -1 = from quality
+    // Version 16: mozjpeg extensions, dropped when the libjpeg lacks them (see thinpic_compress)
+    int jpeg_trellis;            // Trellis quantisation: 1 on, 0 off, -1 = on unless effort is 0
+    int jpeg_overshoot_deringing;  // Less ringing on black-on-white edges; same values
+    int jpeg_optimize_scans;     // Progressive: smallest split of the spectral scans; same values
+    ThinpicQuantTable jpeg_quant_table;
+    // Version 17: overlay drawn on the resized, upright image before the encode (see thinpic_compress)
+    const char* watermark_path;  // Image to draw, usually a PNG with alpha; NULL = none. Read during the call
+    ThinpicGravity watermark_gravity;
+    int watermark_margin;        // Pixels kept between the overlay and the edges it sits against
+    double watermark_width;      // Overlay width as a fraction of the output's, 0-1; 0 = its own size
+    double watermark_opacity;    // 0-1, multiplies the overlay's alpha
+    // Version 18
+    int palette_colours;         // Dominant colours to set in out->palette, 1-THINPIC_PALETTE_MAX; 0 = none
+    // Version 19
+    ThinpicMotionVideo motion_video;  // Google motion photos keep the video only with strip THINPIC_STRIP_NONE, which keeps the XMP that points at it
+    // Version 20: RGB model input in out->tensor from the encoded pixels (see thinpic_compress)
+    int tensor_width;            // 1-THINPIC_TENSOR_MAX, with tensor_height; 0 = none
+    int tensor_height;
+    ThinpicTensorType tensor_type;
+    double tensor_mean[3];       // THINPIC_TENSOR_FLOAT32 only, in 0-1 units
+    double tensor_std[3];        // Same; 0 = 1
+    // Version 21
+    ThinpicGainMap gain_map;     // Not with a crop or a kept Google motion video (see thinpic_compress)
+    // Version 22: more sinks fed from the one encode, besides out->data (see thinpic_compress)
+    const char* output_path;     // Also written here, atomically as file jobs are; NULL = none
+    ThinpicSinkCallback sink;    // Also handed the bytes in order; NULL = none
+    int64_t sink_id;             // Passed to sink
+} ThinpicOptions;
+
+typedef struct {
+    uint8_t* data;               // Free with free_compressed_buffer
+    size_t length;
+    int width;                   // Dimensions of the encoded image
+    int height;
+    ImageFormat format;          // Format written (FORMAT_AUTO resolved)
+    int elapsed_ms;              // Wall time of the call
+    int budget_met;              // 1 within options->latency_budget_ms, 0 over it, -1 without a budget
+    uint64_t perceptual_hash;    // 64-bit difference hash, when hash_valid
+    int hash_valid;              // 1 when options->perceptual_hash produced perceptual_hash
+    char placeholder[THINPIC_PLACEHOLDER_MAX];  // options->placeholder string; empty when none could be made
+    double sharpness;            // Laplacian variance of the luma plane, when analysis_valid; low is blurry
+    double brightness;           // Mean luma, 0-1
+    double shadows_clipped;      // Fraction of the plane at or below luma 8
+    double highlights_clipped;   // Fraction of the plane at or above luma 247
+    int analysis_valid;          // 1 when options->analysis produced the scores above
+    uint32_t palette[THINPIC_PALETTE_MAX];  // options->palette_colours as 0xRRGGBB, most of the image first
+    double palette_share[THINPIC_PALETTE_MAX];  // Fraction of the opaque image nearest each colour
+    int palette_count;           // Colours set; 0 when none were asked for or could be found
+    int64_t motion_video_bytes;  // Motion photo trailer copied after the still (THINPIC_MOTION_VIDEO_KEEP); 0 = none
+    uint8_t* tensor;             // tensor_height x tensor_width x 3 (NHWC, N = 1) of tensor_type; free with free_compressed_buffer
+    size_t tensor_length;        // Bytes; 0 when none was asked for or could be made
+    int64_t gain_map_bytes;      // Ultra HDR gain map appended after the primary (THINPIC_GAIN_MAP_KEEP); 0 = none
+    ThinpicError error;          // Why the call failed when it returns -1
+} ThinpicResult;
+
+// One step of thinpic_compress_ops. Steps run in order on one lazy libvips
+// graph: the input is decoded once and the result encoded once however many
+// steps there are. Fields a step does not use are ignored.
+typedef enum {
+    THINPIC_OP_AUTOROTATE = 0,   // Apply the EXIF orientation to the pixels
+    THINPIC_OP_CROP = 1,         // Keep x, y, width x height (clipped to the image)
+    THINPIC_OP_RESIZE = 2,       // Fit inside width x height (0 = unconstrained), never upscales
+    THINPIC_OP_SHARPEN = 3,      // Unsharp mask of radius sigma (0 = 1.0)
+    THINPIC_OP_COMPOSITE = 4     // Draw overlay_path at x, y with opacity 0-1
+} ThinpicOperationType;
+
+typedef struct {
+    ThinpicOperationType type;
+    int x;
+    int y;
+    int width;
+    int height;
+    double sigma;
+    double opacity;
+    const char* overlay_path;    // THINPIC_OP_COMPOSITE only; read during the call
+} ThinpicOperation;
+
 // Main compression functions with format support
 CompressedImageResult compress_image(const char* input_path, int quality);
 CompressedImageResult compress_image_with_format(const char* input_path, int quality, ImageFormat format);
@@ -52,24 +764,684 @@ CompressedImageResult compress_large_dslr_image(const char* input_path, int qual
 CompressedImageResult compress_large_dslr_image_with_format(const char* input_path, int quality, ImageFormat format);
 CompressedImageResult smart_compress_image(const char* input_path, int target_kb, int type);
 CompressedImageResult smart_compress_image_with_format(const char* input_path, int target_kb, int type, ImageFormat format);
+// smart_compress_image written to output_path: only the result that lands
+// in the window is written, once, atomically. max_kb <= 0 takes the
+// original tool's targets, 2000 KB for high and 800 KB otherwise. Metadata
+// follows thinpic_configure metadata_policy (the tool stripped everything:
+// THINPIC_STRIP_ALL). Returns a ThinpicSmartFileStatus.
+int smart_compress_image_to_file(const char* input_path, const char* output_path, int max_kb, int high);
 
 // Image info
 ImageInfo get_image_info(const char* input_path);
+// Fast header probe: parses the loader header only, takes no pipeline lock
+// and makes no copies. The batch form fills out[0..count) and returns the
+// number of successful probes, or -1 on invalid arguments.
+ImageHeader probe_image_header(const char* input_path);
+int probe_image_headers(const char** input_paths, int count, ImageHeader* out);
+// Sort and group keys for a whole gallery: size, orientation, capture time
+// and GPS presence of each path into out[0..count), parsed from the JPEG,
+// PNG, WebP, HEIF/AVIF, TIFF or GIF headers and EXIF without libvips (other
+// formats fall back to probe_image_header), several files at a time.
+// Returns the number indexed, or -1 on invalid arguments.
+int thinpic_index_images(const char** input_paths, int count, ThinpicImageMeta* out);
+// Pages of a multi-page TIFF or PDF (frames of an animation), 1 for other
+// images, or -1 when the header cannot be read
+int probe_page_count(const char* input_path);
+// Output size, time and memory of compressing input_path to format at
+// quality (0 = 80) fitted into max_width x max_height (0 = unbounded, never
+// upscaled), predicted from the header, the source's bits per pixel and the
+// throughput model. FORMAT_AUTO keeps the source format. As cheap as
+// probe_image_header; success is -1 when the header cannot be read.
+ThinpicEstimate thinpic_estimate_output(const char* input_path, ImageFormat format, int quality,
+                                        int max_width, int max_height);
+// Embedded EXIF thumbnail of a JPEG (IFD1 of its APP1 segment), as stored:
+// JPEG bytes, typically 160x120 up to a few hundred pixels. Only the head of
+// the file is read and nothing is decoded, so this is the fastest preview
+// when an approximate one is acceptable. success is 0 when the file has no
+// thumbnail, or one whose longer side is under min_size (0 takes any).
+// orientation is the main image's, which the thumbnail shares (0 when
+// absent). Free data with free_compressed_buffer.
+ExifThumbnail extract_exif_thumbnail(const char* input_path, int min_size);
+// Metadata edits for thinpic_rewrite_metadata, combined with |
+typedef enum {
+    THINPIC_METADATA_STRIP_GPS = 1,               // EXIF GPS IFD, and XMP packets that carry a location
+    THINPIC_METADATA_STRIP_XMP = 2,               // Every XMP packet
+    THINPIC_METADATA_NORMALIZE_ORIENTATION = 4    // An EXIF orientation outside 1-8 becomes 1
+} ThinpicMetadataEdit;
+
+// Rewrites the metadata of a JPEG, PNG or WebP without decoding it: the
+// container is walked, EXIF edited in place and XMP dropped, and the pixel
+// data copied byte for byte, so it takes milliseconds and loses nothing.
+// output_path may be input_path; the file is replaced atomically. Returns
+// the output's size, or -1 (THINPIC_ERROR_INVALID_ARGUMENT for another
+// format, THINPIC_ERROR_DECODE for a malformed one).
+int64_t thinpic_rewrite_metadata(const char* input_path, const char* output_path, int edits);
+// thinpic_rewrite_metadata on an encoded buffer. Free data with
+// free_compressed_buffer.
+CompressedImageResult thinpic_rewrite_metadata_buffer(const uint8_t* data, size_t length, int edits);
 
 // Utility
 void free_compressed_buffer(uint8_t* buffer);
+// Select how concurrent calls are scheduled. VIPS initialization is always
+// guarded; in concurrent mode each call runs its own pipeline in parallel.
+void set_execution_mode(ExecutionMode mode);
+ExecutionMode get_execution_mode(void);
+// Apply resource limits (initializes VIPS if needed); they are re-applied
+// if VIPS is shut down and started again. Returns 0 on success.
+int thinpic_configure(const ThinpicRuntimeConfig* config);
+// Initialize VIPS on a background thread, for example at app start, so the
+// first compression does not pay for library startup. With warm 1 the
+// thread then runs the JPEG, PNG and WebP savers, their loaders and the
+// thumbnail path once on a tiny image. Compressions that start meanwhile
+// wait only for VIPS_INIT, not for the warm-up. Returns 0 once the thread
+// is started (or VIPS is already up and warm is 0), -1 if it cannot start.
+int thinpic_prewarm(int warm);
+// Fill out with the current runtime state; returns 0, or -1 if out is NULL
+int thinpic_get_runtime_stats(ThinpicRuntimeStats* out);
+// Evict every cached operation that is not in use right now. The cache
+// stays enabled with its configured limits.
+void thinpic_drop_operation_cache(void);
+// Power-saver hint for thermal scaling, which has no native way to read it:
+// while set, pool jobs are scaled as on a moderately hot device. Forward
+// PowerManager.isPowerSaveMode changes here.
+void thinpic_set_power_save(int enabled);
+
+// Levels for thinpic_on_memory_pressure
+typedef enum {
+    THINPIC_MEMORY_PRESSURE_NORMAL = 0,     // Pressure is over; held background jobs resume
+    THINPIC_MEMORY_PRESSURE_MODERATE = 1,   // Free idle caches
+    THINPIC_MEMORY_PRESSURE_CRITICAL = 2    // Also hold background jobs for 10 s
+} ThinpicMemoryPressure;
+
+// Drop the operation cache, cached decodes, idle encode arenas and (critical)
+// the GPU context, and return the freed pages to the system. Critical
+// pressure also keeps queued background jobs from starting until 10 s after
+// the last critical call or a NORMAL one; running jobs finish. The Android
+// plugin forwards onTrimMemory and onLowMemory on its own.
+void thinpic_on_memory_pressure(ThinpicMemoryPressure level);
 void shutdown_vips(void);
+// Logging: the default sink is logcat on Android and stderr elsewhere;
+// passing NULL restores it
+void thinpic_set_log_level(ThinpicLogLevel level);
+void thinpic_set_log_sink(ThinpicLogSink sink);
+// Android system tracing: with 1, pipeline stages, search iterations and pool
+// jobs appear as ATrace sections (Perfetto, systrace) on the thread that
+// runs them, whenever a trace is recording. Off by default; a no-op before
+// API 23 and off Android.
+void thinpic_set_tracing(int enabled);
 int test_vips_basic(void);
+// Progress for pool jobs on images of 4 MP and up, at most once per
+// min_interval_ms (0 = 100 ms) per pipeline plus a final 100. NULL turns it
+// off; smaller images never enable the libvips eval signal.
+void thinpic_set_progress_callback(ThinpicProgressCallback callback, int min_interval_ms);
+// Keep the quality/size samples measured by smart_compress_image and
+// smart_compress_image_with_format in a small file in directory (which must
+// exist), keyed by a hash of each input's first 64 KB and size, so the same
+// original compressed again skips straight to the right quality. NULL (the
+// default) turns it off.
+void thinpic_set_curve_cache_dir(const char* directory);
+// Keep this device's throughput model (see ThinpicThroughput) in a small
+// file in directory (which must exist): it is loaded now, so scheduling
+// starts from what earlier launches measured, and rewritten every 16 new
+// measurements. NULL (the default) keeps the model in memory only; changing
+// the directory first writes out what the old one has not seen yet.
+void thinpic_set_throughput_model_dir(const char* directory);
+// This device's measured cost of format at effort (-1 = encoder default);
+// -1 for FORMAT_AUTO or NULL out
+int thinpic_get_throughput(ImageFormat format, int effort, ThinpicThroughput* out);
+// Keep compressed outputs in directory (which must exist), keyed by a hash
+// of the whole input file or buffer and the options, and return them
+// without decoding when the same input is compressed the same way again.
+// Covers thinpic_compress and every CompressOptions entry point (pool jobs,
+// compress_buffer, compress_fd, compress_to_file). Least recently used
+// entries are deleted once the total passes max_bytes. NULL or max_bytes <= 0
+// (the default) turns it off; the files are left in place.
+void thinpic_set_output_cache(const char* directory, int64_t max_bytes);
+// Where thinpic_configure disc_threshold_mb spills large intermediates: a
+// directory that must exist, such as the app's cache directory. It becomes
+// the process's TMPDIR, which libvips reads for every temp file, so call it
+// before compressing. NULL unsets TMPDIR (/tmp, which Android apps cannot
+// write; their renders then stay in memory).
+void thinpic_set_spill_dir(const char* directory);
 
-// Helper function to detect format from file extension
+// Helper function to detect format from the file signature, falling back to
+// the extension (JPEG when neither is known)
 ImageFormat detect_format_from_path(const char* input_path);
 
-// Auto-compress function that tries multiple formats to find the smallest file
+// Auto-compress: classifies the content (photo, screenshot, graphic,
+// transparent) and encodes once in the format that suits it: lossless WebP
+// for graphics, near-lossless for screenshots, lossy for photos. A
+// borderline classification also tries the other mode and keeps the smaller.
 CompressedImageResult auto_compress_image(const char* input_path, int quality);
+// Without classify, or when the classified encode fails, every format is
+// raced concurrently from one prepared image; NULL options behave like
+// auto_compress_image
+CompressedImageResult auto_compress_image_with_options(const char* input_path, int quality, const AutoCompressOptions* options);
+
+// Several sizes of one image (thumbnail, medium, full) from a single decode:
+// the largest variant is decoded straight from the file, each smaller one is
+// resized from the previous, and the encodes run in parallel. out[i] gets
+// variants[i] (free each with free_compressed_buffer; failed variants have
+// success != 1). Returns the number written, or -1 on invalid arguments or
+// when the image cannot be decoded.
+int compress_image_variants(const char* input_path, const ThinpicVariant* variants, int count,
+                            CompressedImageResult* out);
+
+// Contact or sprite sheet of count inputs in one call: each is thumbnailed
+// with shrink-on-load on a thread of its own, the cells are joined in
+// memory (vips_arrayjoin) and the sheet is encoded once; no intermediate
+// files. cells[i] (may be NULL) gets input i's rectangle and *offsets_json
+// (may be NULL) the same map as JSON, {"width", "height", "cell_width",
+// "cell_height", "cells": [{"x", "y", "w", "h"} or null, ...]}; free the
+// sheet and the JSON with free_compressed_buffer. Fails only when no input
+// decodes or the sheet does not encode.
+CompressedImageResult thinpic_contact_sheet(const char** input_paths, int count, const ThinpicSheetLayout* layout,
+                                            ThinpicSheetCell* cells, char** offsets_json);
 
 // Fast WebP compression for speed-critical applications
 CompressedImageResult fast_webp_compress(const char* input_path, int quality);
 
+// Bounded-memory streaming: decodes and encodes strip by strip so panoramas
+// and 100MP originals need memory proportional to width, not area. Fits the
+// image inside target_width x target_height (0 = unconstrained, never
+// upscales). JPEG and PNG stream end to end; WebP holds one output frame;
+// other formats fall back to compress_large_image_with_format.
+CompressedImageResult stream_compress_image(const char* input_path, int quality,
+                                            int target_width, int target_height, ImageFormat format);
+
+// As stream_compress_image, handing the output to callback in chunks of
+// about 64 KB while the saver runs instead of collecting one buffer, so an
+// upload can start after the first strips. Non-streaming formats deliver
+// their whole result as one chunk. Blocks until done and returns the total
+// bytes delivered, or -1 on failure (after the final callback).
+int64_t stream_compress_image_to_callback(const char* input_path, int quality,
+                                          int target_width, int target_height, ImageFormat format,
+                                          ThinpicChunkCallback callback, int64_t stream_id);
+
+// Fast previews: JPEG inputs decode through libjpeg's scaled IDCT at the
+// largest 1/2, 1/4 or 1/8 shrink that still covers target_width x
+// target_height, then a bilinear resize fits the box (never upscales).
+// Trades a little sharpness for speed. Non-JPEG inputs, outputs other than
+// JPEG/PNG/WebP and calls without a target use
+// compress_image_with_size_and_format.
+CompressedImageResult thumbnail_compress_image(const char* input_path, int quality,
+                                               int target_width, int target_height, ImageFormat format);
+
+// Raw 8-bit pixels straight to PNG through libspng, without libvips (for
+// Flutter ui.Image bytes). channels: 1 gray, 2 gray+alpha, 3 RGB, 4 RGBA;
+// stride is the row pitch in bytes (0 = width * channels). Premultiplied
+// alpha (ImageByteFormat.rawRgba) is undone per row. compression_level is
+// the zlib level 0-9; -1 = 6.
+CompressedImageResult compress_raw_to_png(const uint8_t* pixels, int width, int height, int stride,
+                                          int channels, int premultiplied, int compression_level);
+
+// Pixel layouts compress_raw_to_jpeg reads. JPEG has no alpha: the fourth
+// byte of RGBA/BGRA (or RGBX/BGRX padding) is ignored.
+typedef enum {
+    THINPIC_PIXEL_RGB = 0,
+    THINPIC_PIXEL_BGR = 1,
+    THINPIC_PIXEL_RGBA = 2,      // Android RGBA_8888 camera frames
+    THINPIC_PIXEL_BGRA = 3,      // iOS kCVPixelFormatType_32BGRA
+    THINPIC_PIXEL_GRAY = 4
+} ThinpicPixelFormat;
+
+// Raw 8-bit pixels straight to baseline 4:2:0 JPEG through libjpeg, without
+// libvips (camera frames). pitch is the row stride in bytes (0 = tightly
+// packed); quality 1-100. Each calling thread keeps its own compressor, so
+// a capture loop pays libjpeg's setup once.
+CompressedImageResult compress_raw_to_jpeg(const uint8_t* pixels, int width, int height, int pitch,
+                                           ThinpicPixelFormat pixel_format, int quality);
+
+// One plane of a YUV 4:2:0 frame, as Android's Image.Plane describes it.
+// pixel_stride is 1 for planar (I420) chroma and 2 for semi-planar NV12/NV21,
+// where u and v point one byte apart into the same interleaved plane.
+typedef struct {
+    const uint8_t* data;
+    int row_stride;              // Bytes from one row to the next
+    int pixel_stride;            // Bytes from one sample to the next
+} ThinpicYuvPlane;
+
+// CameraX YUV_420_888 (I420, NV12 or NV21) frames straight to 4:2:0 JPEG:
+// the planes go to libjpeg as raw downsampled data, with no RGB
+// intermediate and no colour conversion. Uses the calling thread's
+// compressor, like compress_raw_to_jpeg.
+CompressedImageResult compress_yuv420_to_jpeg(const ThinpicYuvPlane* y_plane, const ThinpicYuvPlane* u_plane,
+                                              const ThinpicYuvPlane* v_plane, int width, int height,
+                                              int quality);
+
+// Fill options with the current version's defaults: JPEG, quality 80,
+// encoder-default effort, Lanczos3, no size limit, keep metadata, the
+// default WebP profile, baseline (non-progressive) output and truecolour
+// PNG compressed with zlib (full-strength dither if a palette is turned on)
+void thinpic_options_init(ThinpicOptions* options);
+// Decode, fit (or fill and crop), convert to sRGB and encode one image. On success returns 0
+// and fills out (caller frees out->data); on failure returns -1 and out is
+// zeroed. With options->animated, every frame of an animated input is
+// resized and the output is animated; builds without a GIF saver write
+// animated WebP instead and report it in out->format. With options->min_ssim,
+// JPEG and WebP quality is searched from options->quality down, decoding each
+// candidate and comparing its luminance with the prepared image. With
+// options->latency_budget_ms, the call is planned against this device's
+// measured throughput for the format and effort (learned from earlier
+// calls, conservative defaults before that): effort is lowered first, then
+// HEIF, AVIF, JPEG 2000 and JPEG XL on opaque images fall back to JPEG, then the
+// output box shrinks (not below 320 px on the long edge). out->format and
+// out->width/height report what was written, out->budget_met whether the
+// budget held. With options->jxl_lossless_jpeg and FORMAT_JXL, a JPEG input
+// is not decoded: libjxl recodes its DCT coefficients and keeps what is
+// needed to give back the original file bit for bit (about 20% smaller).
+// Its size, orientation and metadata are kept, so the call fails for other
+// inputs, a box it does not fit already, a crop, or without libjxl (see
+// thinpic_jxl_transcode_available). With options->perceptual_hash, a dHash
+// of the resized image is taken from the strips the encoder reads (no
+// second decode) and compared with thinpic_hash_distance; transcodes,
+// animations, tiled encoders and images under 9x8 report hash_valid 0, and
+// such calls bypass the output cache. options->placeholder works the same
+// way from a grid of up to 32x32 cell means: out->placeholder holds a
+// BlurHash or ThumbHash string, or is empty where a hash would be invalid.
+// options->analysis scores the same pixels on a luma plane of up to 512
+// cells on the long side: sharpness is the variance of its Laplacian, so
+// scores compare across image sizes (under about 100 is usually soft or
+// shaken), and brightness and the clipped fractions describe exposure.
+// options->palette_colours reads the placeholders' grid too: median cut and
+// a few k-means rounds over its opaque cells put up to that many dominant
+// colours in out->palette, for tinting a card before the image arrives.
+// Fewer come back from images with fewer distinct colours.
+// options->tensor_width x tensor_height (version 20) fills out->tensor with
+// a model input from the same strips: the encoded image is centre-cropped
+// to the tensor's aspect and box-averaged down to it (bilinear up when it
+// is smaller), RGB in row-major NHWC order with grey spread over the three
+// channels and alpha ignored. It costs one pass over pixels already in
+// flight, not a second decode; where the hash would be invalid there is no
+// tensor either, and such calls bypass the output cache.
+// options->gain_map THINPIC_GAIN_MAP_KEEP (version 21) keeps an Ultra HDR
+// source HDR: its gain map is decoded alone, turned and scaled exactly as
+// the primary was and appended to the JPEG output under a new MPF index and
+// Ultra HDR XMP, which replaces any of the source's container XMP; the
+// gain metadata is copied as it was. Other output formats, crops and a
+// kept Google motion video (whose XMP the new one would replace) get the
+// primary alone, as with the default.
+// options->output_path and options->sink (version 22) deliver the output
+// that out->data holds to a file and a callback as well, from that one
+// buffer: no second encode, and no copy beyond the file's own writes. They
+// see the final bytes, gain map and motion video included, on output cache
+// hits too, before thinpic_compress returns. The file goes through a synced
+// temp file renamed over output_path. A failed write or a sink returning
+// non-zero fails the call with THINPIC_ERROR_IO and frees out->data;
+// neither is part of the output cache key.
+// The jpeg_* fields of version 16 need mozjpeg linked into libvips; with
+// libjpeg-turbo or IJG libjpeg their defaults resolve to off and explicit
+// requests are dropped with a warning (thinpic_jpeg_extensions_available).
+// smart_compress_image and the other JPEG searches use trellis, deringing
+// and the ImageMagick tables whenever they are there.
+// options->watermark_path (version 17) composites that image onto the
+// resized output before its one encode, at watermark_gravity inset by
+// watermark_margin; the pixels are made upright first whatever the strip
+// policy, so the mark is not turned by a viewer applying EXIF. The overlay
+// is decoded and scaled once per output size and kept in memory for the
+// next call. An animation gets it on every frame; a reversible JXL
+// transcode cannot carry one and fails.
+// Older option versions get defaults for the fields they lack; options from
+// a newer THINPIC_OPTIONS_VERSION are rejected.
+int thinpic_compress(const ThinpicSource* source, const ThinpicOptions* options, ThinpicResult* out);
+// 1 when the linked libjpeg is mozjpeg, whose trellis quantisation and
+// tables make files 5-10% smaller at the same quality
+int thinpic_jpeg_extensions_available(void);
+// 1 when libjxl, and with it options->jxl_lossless_jpeg, is available: linked
+// into the process (a libvips built with JPEG XL) or shipped with the app as
+// libjxl plus, for multithreaded encoding, libjxl_threads
+int thinpic_jxl_transcode_available(void);
+// Bits that differ between two perceptual hashes: 0 for the same picture,
+// under about 10 for resized, re-encoded or lightly edited copies
+int thinpic_hash_distance(uint64_t a, uint64_t b);
+// Group count hashes whose distance is at most max_distance, chained: a
+// burst where each shot is near the next forms one group. groups[i] is set
+// to the first index of i's group. Compares every pair, so meant for
+// batches of up to a few thousand. Returns the number of groups, or -1.
+int thinpic_group_near_duplicates(const uint64_t* hashes, int count, int max_distance, int* groups);
+// Run ops in order on source, then encode with options (format, quality and
+// the other encoder fields; max_width/max_height and crop are ignored, size
+// comes from the ops). A resize that is the first op decodes at reduced size,
+// which applies the EXIF orientation as thinpic_compress does; otherwise it
+// is applied by an AUTOROTATE op, or before encoding when options->strip
+// drops it. Animations are not supported: the first frame is
+// used. Results are not stored in the output cache; output_path and sink
+// are fed as thinpic_compress feeds them. Returns as thinpic_compress; an
+// unknown op or an empty crop fails the call.
+int thinpic_compress_ops(const ThinpicSource* source, const ThinpicOperation* ops, int count,
+                         const ThinpicOptions* options, ThinpicResult* out);
+
+// Persistent image handle for several calls on one image (info, then one or
+// more compressions or variant sets). thinpic_open reads the source once: a
+// path is memory-mapped and a descriptor read to the end, while a buffer is
+// read in place and must outlive the handle. Its header is parsed once for
+// thinpic_handle_info. thinpic_handle_compress works like thinpic_compress
+// and also keeps the decoded, shrunk image in memory when it fits
+// thinpic_configure handle_cache_mb. A later call whose box needs no more
+// pixels than that image has then resizes it instead of decoding again.
+// Crops and animations always decode. A handle is not thread-safe. Returns
+// NULL if the source cannot be read or its header parsed.
+typedef struct ThinpicHandle ThinpicHandle;
+ThinpicHandle* thinpic_open(const ThinpicSource* source);
+int thinpic_handle_info(ThinpicHandle* handle, ImageInfo* out);
+int thinpic_handle_compress(ThinpicHandle* handle, const ThinpicOptions* options, ThinpicResult* out);
+// compress_image_variants on the handle's bytes
+int thinpic_handle_variants(ThinpicHandle* handle, const ThinpicVariant* variants, int count,
+                            CompressedImageResult* out);
+void thinpic_close(ThinpicHandle* handle);
+
+// Streaming input, to compress while an image downloads. thinpic_stream_new
+// returns a stream; pass thinpic_stream_fd in a THINPIC_SOURCE_FD source to
+// thinpic_compress on a worker thread while the feeding thread posts the
+// bytes in order with thinpic_stream_write as they arrive. Writes copy into
+// a ring buffer (capacity bytes first, 0 = 256 KB; it grows rather than
+// block when the decoder falls behind) and return 0, or -1 after the stream
+// has ended. thinpic_stream_finish ends the input: failed = 0 lets the
+// decoder read what is left, 1 drops it (a failed download). Sequential
+// formats decode as the bytes come in. The descriptor can only be read
+// once, as for a pipe: set the format explicitly (FORMAT_AUTO writes JPEG)
+// and expect no shrink-on-load or multi-frame output. Loaders do not fail
+// on truncated input, so discard the result of a failed stream.
+// thinpic_stream_free after the compression has returned closes it.
+typedef struct ThinpicStream ThinpicStream;
+ThinpicStream* thinpic_stream_new(size_t capacity);
+int thinpic_stream_fd(const ThinpicStream* stream);
+int thinpic_stream_write(ThinpicStream* stream, const uint8_t* data, size_t length);
+void thinpic_stream_finish(ThinpicStream* stream, int failed);
+void thinpic_stream_free(ThinpicStream* stream);
+
+// Decoded pixels for display (thinpic_decode_rgba): 8-bit sRGB RGBA with the
+// EXIF orientation applied, rows packed (stride = width * 4). Free data with
+// free_compressed_buffer.
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    int width;
+    int height;
+    int stride;
+} ThinpicPixels;
+
+// Decode source to fit inside max_width x max_height (0 does not constrain;
+// never upscales), for ui.decodeImageFromPixels or a texture upload,
+// without a full-size decode. JPEGs take the thumbnail_compress_image path
+// (libjpeg's scaled IDCT, then a bilinear resize); WebP, HEIF and pyramidal
+// TIFF shrink while loading through vips_thumbnail; anything else decodes in
+// full and is resized bilinearly. Returns 0 and fills out, or -1 with out
+// zeroed (thinpic_last_error says why).
+int thinpic_decode_rgba(const ThinpicSource* source, int max_width, int max_height, ThinpicPixels* out);
+
+// Quality of an output against its original (thinpic_compare), measured on
+// luma planes of the same size
+typedef struct {
+    double psnr;                 // dB; identical planes score 100
+    double ssim;                 // Mean SSIM over 8x8 windows every 4 pixels, 1 for identical planes
+    double ms_ssim;              // Five-scale MS-SSIM (fewer scales for small planes)
+    int width;                   // Analysis plane the scores were taken on
+    int height;
+} ThinpicQuality;
+
+// Scores candidate against reference for QA and encoder A/B tests, with the
+// kernels the min_ssim search uses. Both are decoded upright, converted to
+// luma and resized to one analysis size that fits in analysis_pixels (0 =
+// about 1 MP) and is never larger than the smaller of the two, so an output
+// that was downscaled still compares. threads splits the windows (0 = one
+// per core). Returns 0 and fills out, or -1 (THINPIC_ERROR_INVALID_ARGUMENT
+// when their aspect ratios differ by more than 1%).
+int thinpic_compare(const ThinpicSource* reference, const ThinpicSource* candidate, int analysis_pixels,
+                    int threads, ThinpicQuality* out);
+
+// Android: decode source as thinpic_decode_rgba does and draw it into window
+// (an ANativeWindow*, such as the Surface of a SurfaceTexture registered
+// with Flutter's TextureRegistry), resizing the window's buffers to the
+// image. width and height get the drawn size. Returns 0, or -1 (always -1
+// off Android). Only the JNI glue in thinpic_texture.c calls it, so
+// ffigen.yaml excludes it from the Dart bindings.
+int thinpic_render_to_window(const ThinpicSource* source, void* window, int max_width, int max_height,
+                             int* width, int* height);
+
+// Worker pool: a fixed set of native threads (one per core, at most 8) started
+// on first submit. Submit returns a job id, or -1 on invalid arguments.
+// Within a priority, queued jobs start smallest size class first (by header
+// pixels: under 4, 16 and 48 MP, then larger), in submission order within a
+// class; a job passed by 16 smaller ones keeps its place from then on.
+// A job identical to one still pending or running (the same unchanged file
+// or bytes, options apart from priority and client, and output path) is
+// not queued again: it keeps its own id and gets a copy of that job's
+// result, with encode_attempts 0. Cancelling either leaves the other be.
+// Poll returns immediately; wait blocks. Once either reports DONE or FAILED the
+// result is copied to `out` (caller frees data with free_compressed_buffer)
+// and the job id is released.
+int64_t thinpic_submit_job(const char* input_path, const CompressOptions* options);
+JobStatus thinpic_poll_job(int64_t job_id, CompressedImageResult* out);
+JobStatus thinpic_wait_job(int64_t job_id, CompressedImageResult* out);
+// File jobs encode straight to output_path, written via a uniquely named
+// sibling temp file that is synced and renamed over it, so readers never see
+// a partial file and jobs racing to one path never share a temp file; the
+// finished result has data NULL and length = bytes written.
+int64_t thinpic_submit_file_job(const char* input_path, const char* output_path, const CompressOptions* options);
+// thinpic_submit_file_job for a whole batch in one call, so a caller
+// across a language boundary pays the crossing and the argument setup once
+// rather than per item. options holds either one entry shared by every item
+// (options_count 1) or one per item (options_count == count). job_ids[i] is
+// the id of item i, or -1 where it was rejected. Returns the number of jobs
+// submitted, or -1 on invalid arguments.
+int thinpic_submit_file_jobs(const char* const* input_paths, const char* const* output_paths, int count,
+                             const CompressOptions* options, int options_count, int64_t* job_ids);
+int thinpic_pool_size(void);
+// Cancel a pending or running job: a pending job is dropped from the queue,
+// a running one has its pipeline killed and its search loop stopped. The
+// job then reports JOB_STATUS_CANCELLED and must still be claimed by
+// poll/wait. Returns 0, or -1 if the job is unknown or already finished.
+int thinpic_cancel_job(int64_t job_id);
+// Call callback once job_id finishes instead of polling for it: from the
+// worker that finished it, or right away on this thread if it already has.
+// The result must still be claimed by poll/wait. A later call replaces the
+// callback. Jobs dropped by thinpic_shutdown_pool report CANCELLED. Returns
+// 0, or -1 if the job is unknown or already claimed.
+int thinpic_watch_job(int64_t job_id, ThinpicJobCallback callback);
+// As poll/wait, with the job's CompressionStats alongside the result
+JobStatus thinpic_poll_job_ex(int64_t job_id, CompressedImageResultEx* out);
+JobStatus thinpic_wait_job_ex(int64_t job_id, CompressedImageResultEx* out);
+// Why the last call on this thread failed, for the direct entry points that
+// return a plain CompressedImageResult (pool jobs report theirs in
+// CompressedImageResultEx, thinpic_compress in ThinpicResult). Read it right
+// after the failing call; it copies the error into out (may be NULL), clears
+// it and returns its code.
+int thinpic_last_error(ThinpicError* out);
+
+// Batch compression: runs every path through the worker pool with the same
+// options and blocks until all are done. out must hold `count` results; each
+// entry reports its own success and owns its data (free_compressed_buffer).
+// Items are queued as the calling thread probes their headers, a few ahead
+// of the workers, so parsing, read-ahead and encoding overlap.
+// Returns the number of successful items, or -1 on invalid arguments.
+int compress_batch(const char** input_paths, int count, const CompressOptions* options, CompressedImageResult* out);
+// Batch over the pages first_page .. first_page + count - 1 of one
+// multi-page TIFF or PDF (probe_page_count gives the total): each page is
+// its own pool job that decodes only that page, so the memory budget bounds
+// how many are in memory at once. options->page is ignored; out[i] holds
+// page first_page + i. Returns the number of successful pages, or -1 on
+// invalid arguments.
+int compress_pages(const char* input_path, int first_page, int count, const CompressOptions* options,
+                   CompressedImageResult* out);
+// Process-wide, like the pool itself: it stops every engine's and every
+// isolate's jobs, so call it only when the process is done with the library.
+void thinpic_shutdown_pool(void);
+// The pool, the libvips and output caches, thinpic_configure and the
+// memory governor are shared by every Flutter engine and isolate that
+// loads the library; they do not multiply with them. A new client id for
+// CompressOptions.client, one per isolate that submits work, gives each
+// isolate a fair share of the workers. Ids hold no resources and need no
+// release.
+int thinpic_pool_client(void);
+
+// Synchronous file output: compress input_path with options and write the
+// result to output_path as file jobs do. Returns the bytes written, or -1 on
+// failure.
+int64_t compress_to_file(const char* input_path, const char* output_path, const CompressOptions* options);
+// Resumable batch: compress every image of the directory `source` (or every
+// line of the list file `source`) into output_dir as
+// <name>.<extension of options->format> through the worker pool, appending
+// each finished input to the manifest at manifest_path. Inputs the manifest
+// already lists, including recorded failures, are skipped, so calling again
+// after the process was killed picks up where it stopped. Returns how many
+// inputs the manifest now records as done, or -1 on invalid arguments or an
+// unreadable source.
+int compress_directory(const char* source, const char* output_dir, const char* manifest_path,
+                       const CompressOptions* options);
+// Incremental folder sync: compress_directory against an index at
+// index_path that records each input's mtime, size and options hash next
+// to its output. Only inputs that are new, have changed since, were done
+// with other options, or whose output is missing are compressed again, so
+// syncing a folder that is mostly unchanged costs a stat per file. Recorded
+// failures are retried once the file or the options change. The index is
+// rewritten at the end without lines for inputs that have gone (their
+// outputs are left). Returns how many inputs are up to date, or -1 on
+// invalid arguments or an unreadable source.
+int sync_directory(const char* source, const char* output_dir, const char* index_path,
+                   const CompressOptions* options);
+// compress_directory for work that outlives the UI: an Android WorkManager
+// worker or foreground service runs it through ThinpicBackgroundEngine
+// (JNI), on the same worker pool and memory governor. The run is recorded
+// for the process, so a Flutter engine that attaches later can read
+// thinpic_background_status to show its progress or collect the outputs.
+// thinpic_background_stop (the worker being stopped) submits nothing more
+// and cancels the items in flight; the next call resumes from the manifest.
+// One runs at a time: a second call while one runs returns -1.
+typedef enum {
+    THINPIC_BACKGROUND_IDLE = 0,      // None has run in this process
+    THINPIC_BACKGROUND_RUNNING = 1,
+    THINPIC_BACKGROUND_FINISHED = 2,  // Every input is recorded in the manifest
+    THINPIC_BACKGROUND_STOPPED = 3,   // thinpic_background_stop; the rest is left for the next run
+    THINPIC_BACKGROUND_FAILED = 4     // Invalid arguments or an unreadable source
+} ThinpicBackgroundState;
+
+typedef struct {
+    int state;                   // ThinpicBackgroundState
+    int done;                    // Inputs the manifest records as done, resumed ones included
+    int total;                   // Inputs the source lists
+    int64_t started_ms;          // Wall clock of the last start; identifies the run
+    int64_t finished_ms;         // 0 while it runs
+} ThinpicBackgroundStatus;
+
+int thinpic_background_directory(const char* source, const char* output_dir, const char* manifest_path,
+                                 const CompressOptions* options);
+void thinpic_background_stop(void);
+// Fills out (may be NULL) with the running or last background batch and
+// returns its state
+int thinpic_background_status(ThinpicBackgroundStatus* out);
+
+// Motion photos: JPEGs with a video appended (Google Motion Photo and
+// MicroVideo, Samsung motion JPEG). Found from the XMP and the Samsung SEF
+// trailer alone, without reading the video; the output cache and the
+// estimate count only the still's bytes.
+typedef enum {
+    THINPIC_MOTION_NONE = 0,
+    THINPIC_MOTION_GOOGLE = 1,   // XMP GCamera:MicroVideoOffset or a Container MotionPhoto item
+    THINPIC_MOTION_SAMSUNG = 2   // A MotionPhoto_Data block in the SEF trailer
+} ThinpicMotionKind;
+
+typedef struct {
+    ThinpicMotionKind kind;
+    int64_t still_length;        // Bytes of the JPEG still; the trailer starts here
+    int64_t trailer_length;      // From there to the end of the file: what THINPIC_MOTION_VIDEO_KEEP copies
+    int64_t video_offset;        // The MP4 itself
+    int64_t video_length;
+} ThinpicMotionPhoto;
+
+// 1 with out filled in for a motion photo, 0 for any other image, -1 when
+// the file cannot be read
+int thinpic_motion_photo_probe(const char* input_path, ThinpicMotionPhoto* out);
+
+// Zero-copy handover of encoded output to Android code. thinpic_export_buffer
+// takes ownership of data (a result buffer, as freed by
+// free_compressed_buffer) and returns a handle, or -1; Java wraps it in a
+// direct ByteBuffer with ThinpicNativeBuffer.take(handle) and frees it with
+// close(). thinpic_release_buffer frees it from this side instead (once
+// only, and never while Java still reads it); -1 for an unknown handle.
+int64_t thinpic_export_buffer(uint8_t* data, size_t length);
+// The exported bytes and their length, or NULL; valid until released
+const uint8_t* thinpic_exported_buffer(int64_t handle, size_t* length);
+int thinpic_release_buffer(int64_t handle);
+// Bytes held by exported buffers not yet released
+size_t thinpic_exported_bytes(void);
+
+// Multi-resolution tiled output for very large inputs, which the large
+// modes would cap at 6000 px: every level down to one tile, each tile a
+// JPEG at quality. The input is read once, top to bottom, and only a few
+// rows of tiles per level are in memory at a time.
+typedef enum {
+    THINPIC_PYRAMID_TIFF = 0,      // One tiled pyramidal TIFF at output_path (BigTIFF past 4 GB of pixels)
+    THINPIC_PYRAMID_DEEPZOOM = 1   // <output_path>.dzi and <output_path>_files/; needs libvips with dzsave
+} ThinpicPyramidLayout;
+
+// tile_size 0 picks 256 (TIFF, rounded up to a multiple of 16 otherwise)
+// or 254 with a 1 px overlap (Deep Zoom). Metadata follows thinpic_configure
+// metadata_policy. Returns the bytes written, or -1 on failure, including
+// Deep Zoom on a libvips without dzsave (the bundled Android build).
+int64_t compress_image_to_pyramid(const char* input_path, const char* output_path,
+                                  ThinpicPyramidLayout layout, int quality, int tile_size);
+// Combined output for a multi-page TIFF or PDF: pages first_page onwards
+// (count <= 0 for all) fitted inside max_width x max_height (0 = no limit)
+// and written as one multi-page TIFF, a JPEG at quality per page. The pages
+// stream through one at a time. libvips only joins pages that share a size;
+// documents that mix sizes go through compress_pages instead. PDF input
+// needs a libvips with pdfload (the bundled Android build has none).
+// Returns the bytes written, or -1 on failure.
+int64_t compress_pages_to_tiff(const char* input_path, const char* output_path, int first_page, int count,
+                               int quality, int max_width, int max_height);
+// Synchronous compression that also reports what it cost
+CompressedImageResultEx compress_with_stats(const char* input_path, const CompressOptions* options);
+
+// Per-operation profile of one job (compress_with_profile): which libvips
+// operations it built, how many regions each computed and how long they
+// took, slowest first. An operation's time is its own pixel code, without
+// the time spent computing its inputs on the same thread; encoders run
+// inside their saver's build and are timed by CompressionStats encode_us
+// instead. Operations past THINPIC_PROFILE_MAX_OPS - 1 are summed under
+// "(other)".
+#define THINPIC_PROFILE_MAX_OPS 32
+#define THINPIC_PROFILE_MAX_THREADS 16
+
+typedef struct {
+    char name[32];           // libvips nickname, e.g. "resize", "colourspace"
+    int calls;               // Times the operation was built
+    int64_t regions;         // Regions its output computed
+    int64_t time_us;         // Own time over every thread
+    int64_t pixels;          // Pixels in those regions
+} ThinpicProfileOp;
+
+typedef struct {
+    int op_count;
+    ThinpicProfileOp ops[THINPIC_PROFILE_MAX_OPS];
+    int thread_count;        // Threads that computed pixels, up to the max
+    int64_t thread_busy_us[THINPIC_PROFILE_MAX_THREADS];
+} ThinpicProfile;
+
+// compress_with_stats with a profile of the job filled into `profile`.
+// Profiling is process-wide: profiled jobs run one at a time, the operation
+// cache is dropped first so every operation is built and counted, and work
+// from other jobs running meanwhile is counted too, so profile an idle
+// pipeline. Meant for tuning, not for production traffic.
+CompressedImageResultEx compress_with_profile(const char* input_path, const CompressOptions* options,
+                                              ThinpicProfile* profile);
+
+// Buffer input: the same modes run on `length` encoded bytes at `data`
+// (for example a Uint8List from Dart) with no intermediate file. With
+// FORMAT_AUTO the output keeps the sniffed input format. compress_buffer
+// reads data in place; the buffer job copies it, so the caller may free it
+// once submit returns.
+CompressedImageResult compress_buffer(const uint8_t* data, size_t length, const CompressOptions* options);
+int64_t thinpic_submit_buffer_job(const uint8_t* data, size_t length, const CompressOptions* options);
+
+// Descriptor input: read an open file descriptor (for example the fd of an
+// Android ParcelFileDescriptor from ContentResolver) without copying the file
+// first. Regular files get the same shrink-on-load as paths; pipes are read
+// once and fall back to JPEG for FORMAT_AUTO. The caller keeps ownership of
+// fd; the job form works on a dup, so fd may be closed once submit returns.
+CompressedImageResult compress_fd(int fd, const CompressOptions* options);
+int64_t thinpic_submit_fd_job(int fd, const CompressOptions* options);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,171 +1,420 @@
-#include <zlib.h>     
-#include <png.h>
-#include <turbojpeg.h>
-#include "include/png_compressor.h"
+// png_compressor.c
+// Raw pixel encoders that bypass libvips: Flutter hands over decoded
+// ui.Image bytes and camera frames, and a PNG or JPEG of them needs no
+// pipeline.
+
+// vips7compat.h would otherwise #define error_exit, a jpeg_error_mgr field
+#define VIPS_DISABLE_COMPAT
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <spng.h>
+#include <jpeglib.h>
+#include <jerror.h>
 
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Output goes straight into one g_malloc'd buffer sized from the input, so
+// typical images are written without a single reallocation
 typedef struct {
     uint8_t* data;
-    size_t size;
+    size_t length;
     size_t capacity;
-} PngBuffer;
-
-// Callback for libpng to write PNG data into memory
-static void png_write_to_memory(png_structp png_ptr, png_bytep data, png_size_t length) {
-    PngBuffer* buffer = (PngBuffer*)png_get_io_ptr(png_ptr);
-    if (buffer->size + length > buffer->capacity) {
-        size_t new_capacity = (buffer->size + length) * 2;
-        uint8_t* new_data = (uint8_t*)realloc(buffer->data, new_capacity);
-        if (!new_data) {
-            png_error(png_ptr, "Out of memory");
-            return;
-        }
-        buffer->data = new_data;
-        buffer->capacity = new_capacity;
+} PngOutput;
+
+static int png_output_write(spng_ctx* ctx, void* user, void* data, size_t length) {
+    (void)ctx;
+    PngOutput* output = (PngOutput*)user;
+    if (output->length + length > output->capacity) {
+        size_t capacity = output->capacity + output->capacity / 2;
+        if (capacity < output->length + length) capacity = output->length + length;
+        uint8_t* grown = (uint8_t*)g_try_realloc(output->data, capacity);
+        if (!grown) return SPNG_IO_ERROR;
+        output->data = grown;
+        output->capacity = capacity;
     }
-    memcpy(buffer->data + buffer->size, data, length);
-    buffer->size += length;
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+    return 0;
 }
 
-static void png_flush(png_structp png_ptr) {
-    // No-op for memory writes
+// Stored (level 0) output is the filtered rows plus a 5-byte header per
+// 64 KB deflate block; anything compressed rarely needs more than half of
+// that, and screenshots need far less
+static size_t estimate_png_size(size_t row_bytes, int height, int level) {
+    size_t raw = (row_bytes + 1) * (size_t)height;
+    size_t chunks = 1024;  // Signature, IHDR, IEND and IDAT chunk headers
+    if (level == 0) return raw + (raw / 65535 + 1) * 5 + chunks;
+    return raw / 2 + chunks;
 }
 
-PngResult compress_to_png(uint8_t* raw_data, int width, int height, int channels) {
-    PngResult result = {0, 0};
+CompressedImageResult compress_raw_to_png(const uint8_t* pixels, int width, int height, int stride,
+                                          int channels, int premultiplied, int compression_level) {
+    CompressedImageResult result = {NULL, 0, -1};
+    static const uint8_t colour_types[] = {
+        SPNG_COLOR_TYPE_GRAYSCALE, SPNG_COLOR_TYPE_GRAYSCALE_ALPHA,
+        SPNG_COLOR_TYPE_TRUECOLOR, SPNG_COLOR_TYPE_TRUECOLOR_ALPHA
+    };
 
-    // Validate input parameters
-    if (!raw_data || width <= 0 || height <= 0 || (channels != 3 && channels != 4)) {
+    if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+        THINPIC_LOGE("Error: Invalid raw PNG input (%dx%d, %d channels)", width, height, channels);
         return result;
     }
-
-    // Calculate expected data size
-    size_t expected_size = (size_t)width * (size_t)height * (size_t)channels;
-    if (expected_size == 0 || expected_size > SIZE_MAX / 2) {
-        return result; // Overflow or invalid size
+    size_t row_bytes = (size_t)width * channels;
+    if (stride == 0) stride = (int)row_bytes;
+    if (stride < 0 || (size_t)stride < row_bytes) {
+        THINPIC_LOGE("Error: Row stride %d is shorter than %zu bytes", stride, row_bytes);
+        return result;
     }
+    if (compression_level < 0 || compression_level > 9) compression_level = 6;
+    // Alpha only needs undoing where there is some
+    int unpremultiply = premultiplied && (channels == 2 || channels == 4);
 
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr) return result;
-
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        png_destroy_write_struct(&png_ptr, NULL);
+    PngOutput output = {NULL, 0, estimate_png_size(row_bytes, height, compression_level)};
+    output.data = (uint8_t*)g_try_malloc(output.capacity);
+    uint8_t* row = unpremultiply ? (uint8_t*)malloc(row_bytes) : NULL;
+    spng_ctx* ctx = spng_ctx_new(SPNG_CTX_ENCODER);
+    if (!output.data || (unpremultiply && !row) || !ctx) {
+        THINPIC_LOGE("Error: Out of memory for a %dx%d PNG", width, height);
+        g_free(output.data);
+        free(row);
+        spng_ctx_free(ctx);
         return result;
     }
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        if (result.data) free(result.data);
-        result.data = NULL;
-        result.length = 0;
-        return result;
+    struct spng_ihdr ihdr = {(uint32_t)width, (uint32_t)height, 8, colour_types[channels - 1], 0, 0,
+                             SPNG_INTERLACE_NONE};
+    spng_set_png_stream(ctx, png_output_write, &output);
+    spng_set_option(ctx, SPNG_IMG_COMPRESSION_LEVEL, compression_level);
+    if (compression_level <= 1) {
+        // Per-row filter selection costs more than it saves at the fastest
+        // levels; SUB alone keeps most of the gain on photos and UI alike
+        spng_set_option(ctx, SPNG_FILTER_CHOICE, SPNG_FILTER_CHOICE_SUB);
+    }
+    int error = spng_set_ihdr(ctx, &ihdr);
+    if (!error) {
+        error = spng_encode_image(ctx, NULL, 0, SPNG_FMT_PNG, SPNG_ENCODE_PROGRESSIVE | SPNG_ENCODE_FINALIZE);
+    }
+    for (int y = 0; y < height && !error; y++) {
+        const uint8_t* source = pixels + (size_t)y * stride;
+        if (unpremultiply) {
+            thinpic_swizzle_rgba(source, row, width, channels, 0, 1);
+            source = row;
+        }
+        error = spng_encode_row(ctx, source, row_bytes);
+        if (error == SPNG_EOI) error = 0;  // Returned for the last row
     }
+    spng_ctx_free(ctx);
+    free(row);
 
-    PngBuffer buffer = {malloc(1024), 0, 1024};
-    if (!buffer.data) {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
+    if (error) {
+        THINPIC_LOGE("Error: Raw PNG encode failed: %s", spng_strerror(error));
+        g_free(output.data);
         return result;
     }
+    THINPIC_LOGD("Raw PNG: %dx%d, %d channels, level %d, %zu bytes (%zu reserved)",
+                 width, height, channels, compression_level, output.length, output.capacity);
+
+    result.data = output.data;
+    result.length = output.length;
+    result.success = 1;
+    return result;
+}
+
+// Raw frames to JPEG through the bundled IJG libjpeg (TurboJPEG is not
+// bundled). A compressor's memory pools, tables and scratch rows are built
+// once per calling thread and survive between frames; the thread's encoder
+// is destroyed when the thread exits.
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    uint8_t* data;      // g_malloc'd; handed to the caller on success
+    size_t capacity;
+    size_t length;
+} JpegOutput;
 
-    png_set_write_fn(png_ptr, &buffer, png_write_to_memory, png_flush);
+typedef struct {
+    struct jpeg_compress_struct cinfo;  // First, so libjpeg callbacks can cast back
+    struct jpeg_error_mgr error;
+    jmp_buf escape;
+    JpegOutput output;
+    uint8_t* scratch;   // RGB row, or padded YUV rows, libjpeg cannot read in place
+    size_t scratch_capacity;
+} JpegEncoder;
 
-    int color_type = (channels == 3) ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA;
+static pthread_key_t encoder_key;
+static pthread_once_t encoder_once = PTHREAD_ONCE_INIT;
 
-    png_set_IHDR(png_ptr, info_ptr, width, height, 8,
-                 color_type, PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+static void raw_jpeg_error_exit(j_common_ptr cinfo) {
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((JpegEncoder*)cinfo)->escape, 1);
+}
 
-    // Optimize compression settings for maximum compression
-    png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-    png_set_compression_mem_level(png_ptr, 8);
-    png_set_compression_strategy(png_ptr, Z_FILTERED);
-    png_set_compression_window_bits(png_ptr, 15);
-    
-    // Use adaptive filtering for better compression
-    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_OPTIMIZED);
-    
-    // Set maximum compression for zlib
-    png_set_compression_buffer_size(png_ptr, 8192);
+static void raw_jpeg_output_message(j_common_ptr cinfo) {
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    THINPIC_LOGW("libjpeg: %s", message);
+}
 
-    png_write_info(png_ptr, info_ptr);
+static void jpeg_output_init(j_compress_ptr cinfo) {
+    JpegOutput* output = &((JpegEncoder*)cinfo)->output;
+    output->pub.next_output_byte = output->data;
+    output->pub.free_in_buffer = output->capacity;
+}
 
-    // Allocate row pointers array
-    png_bytep* row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * height);
-    if (!row_pointers) {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        free(buffer.data);
-        return result;
-    }
+// libjpeg calls this only once the whole buffer is full
+static boolean jpeg_output_grow(j_compress_ptr cinfo) {
+    JpegOutput* output = &((JpegEncoder*)cinfo)->output;
+    size_t used = output->capacity;
+    size_t capacity = used + used / 2;
+    uint8_t* grown = (uint8_t*)g_try_realloc(output->data, capacity);
+    if (!grown) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    output->data = grown;
+    output->capacity = capacity;
+    output->pub.next_output_byte = grown + used;
+    output->pub.free_in_buffer = capacity - used;
+    return TRUE;
+}
 
-    // Set up row pointers with bounds checking
-    size_t row_stride = (size_t)width * (size_t)channels;
-    for (int y = 0; y < height; y++) {
-        size_t offset = y * row_stride;
-        // Ensure we don't go beyond the expected data bounds
-        if (offset + row_stride <= expected_size) {
-            row_pointers[y] = raw_data + offset;
-        } else {
-            // If bounds check fails, use a safe fallback
-            row_pointers[y] = raw_data;
-        }
-    }
+static void jpeg_output_term(j_compress_ptr cinfo) {
+    JpegOutput* output = &((JpegEncoder*)cinfo)->output;
+    output->length = output->capacity - output->pub.free_in_buffer;
+}
 
-    png_write_image(png_ptr, row_pointers);
-    png_write_end(png_ptr, NULL);
+static void encoder_free(void* value) {
+    JpegEncoder* encoder = (JpegEncoder*)value;
+    jpeg_destroy_compress(&encoder->cinfo);
+    free(encoder->scratch);
+    free(encoder);
+}
 
-    free(row_pointers);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
+static void encoder_key_create(void) {
+    pthread_key_create(&encoder_key, encoder_free);
+}
 
-    result.data = buffer.data;
-    result.length = buffer.size;
+static JpegEncoder* thread_encoder(void) {
+    pthread_once(&encoder_once, encoder_key_create);
+    JpegEncoder* encoder = (JpegEncoder*)pthread_getspecific(encoder_key);
+    if (encoder) return encoder;
 
-    return result;
+    encoder = (JpegEncoder*)calloc(1, sizeof(JpegEncoder));
+    if (!encoder) return NULL;
+    encoder->cinfo.err = jpeg_std_error(&encoder->error);
+    encoder->error.error_exit = raw_jpeg_error_exit;
+    encoder->error.output_message = raw_jpeg_output_message;
+    if (setjmp(encoder->escape)) {
+        // jpeg_create_compress only fails for want of memory
+        free(encoder);
+        return NULL;
+    }
+    jpeg_create_compress(&encoder->cinfo);
+    encoder->output.pub.init_destination = jpeg_output_init;
+    encoder->output.pub.empty_output_buffer = jpeg_output_grow;
+    encoder->output.pub.term_destination = jpeg_output_term;
+    encoder->cinfo.dest = &encoder->output.pub;
+    pthread_setspecific(encoder_key, encoder);
+    return encoder;
 }
 
-JpegResult compress_to_jpeg(uint8_t* raw_data, int width, int height, int quality) {
-    JpegResult result = {0, 0};
+static uint8_t* encoder_scratch(JpegEncoder* encoder, size_t bytes) {
+    if (encoder->scratch_capacity < bytes) {
+        uint8_t* scratch = (uint8_t*)realloc(encoder->scratch, bytes);
+        if (!scratch) return NULL;
+        encoder->scratch = scratch;
+        encoder->scratch_capacity = bytes;
+    }
+    return encoder->scratch;
+}
+
+// A 4:2:0 frame at everyday qualities stays well under 3 bits per pixel
+static int encoder_output(JpegEncoder* encoder, int width, int height, int components) {
+    encoder->output.capacity = (size_t)width * height * components / 8 + 4096;
+    encoder->output.data = (uint8_t*)g_try_malloc(encoder->output.capacity);
+    return encoder->output.data != NULL;
+}
 
-    // Validate input parameters
-    if (!raw_data || width <= 0 || height <= 0 || quality < 1 || quality > 100) {
+static void set_frame_quality(j_compress_ptr cinfo, int quality) {
+    jpeg_set_quality(cinfo, quality, TRUE);
+    // The fast integer DCT costs visible accuracy only at high qualities;
+    // plain box downsampling of chroma matches what TurboJPEG does
+    cinfo->dct_method = quality >= 90 ? JDCT_ISLOW : JDCT_IFAST;
+    cinfo->do_fancy_downsampling = FALSE;
+}
+
+CompressedImageResult compress_raw_to_jpeg(const uint8_t* pixels, int width, int height, int pitch,
+                                           ThinpicPixelFormat pixel_format, int quality) {
+    CompressedImageResult result = {NULL, 0, -1};
+    // Bytes per pixel, indexed by ThinpicPixelFormat
+    static const int pixel_sizes[] = {3, 3, 4, 4, 1};
+
+    if (!pixels || width <= 0 || height <= 0 || width > JPEG_MAX_DIMENSION || height > JPEG_MAX_DIMENSION ||
+            pixel_format < THINPIC_PIXEL_RGB || pixel_format > THINPIC_PIXEL_GRAY ||
+            quality < 1 || quality > 100) {
+        THINPIC_LOGE("Error: Invalid raw JPEG input (%dx%d, pixel format %d, quality %d)",
+                     width, height, pixel_format, quality);
+        return result;
+    }
+    size_t row_bytes = (size_t)width * pixel_sizes[pixel_format];
+    if (pitch == 0) pitch = (int)row_bytes;
+    if (pitch < 0 || (size_t)pitch < row_bytes) {
+        THINPIC_LOGE("Error: Row pitch %d is shorter than %zu bytes", pitch, row_bytes);
         return result;
     }
 
-    // Create TurboJPEG compressor
-    tjhandle handle = tjInitCompress();
-    if (!handle) {
+    JpegEncoder* encoder = thread_encoder();
+    if (!encoder) {
+        THINPIC_LOGE("Error: Could not create a JPEG encoder");
+        return result;
+    }
+    int gray = pixel_format == THINPIC_PIXEL_GRAY;
+    // RGB and gray rows go to libjpeg as they are
+    int direct = gray || pixel_format == THINPIC_PIXEL_RGB;
+    uint8_t* scratch = direct ? NULL : encoder_scratch(encoder, (size_t)width * 3);
+    if ((!direct && !scratch) || !encoder_output(encoder, width, height, gray ? 1 : 3)) {
+        THINPIC_LOGE("Error: Out of memory for a %dx%d JPEG", width, height);
         return result;
     }
 
-    // Calculate buffer size for compressed JPEG
-    unsigned long jpeg_size = 0;
-    int success = tjCompress2(handle, raw_data, width, 0, height, 
-                             TJPF_RGB, &result.data, &jpeg_size, 
-                             TJSAMP_420, quality, TJFLAG_FASTDCT);
-    
-    if (success == 0 && result.data) {
-        result.length = jpeg_size;
-    } else {
-        if (result.data) {
-            tjFree(result.data);
-            result.data = NULL;
+    struct jpeg_compress_struct* cinfo = &encoder->cinfo;
+    if (setjmp(encoder->escape)) {
+        // Leaves the compressor ready for the next frame
+        jpeg_abort_compress(cinfo);
+        g_free(encoder->output.data);
+        encoder->output.data = NULL;
+        return result;
+    }
+    cinfo->image_width = (JDIMENSION)width;
+    cinfo->image_height = (JDIMENSION)height;
+    cinfo->input_components = gray ? 1 : 3;
+    cinfo->in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(cinfo);
+    set_frame_quality(cinfo, quality);
+    jpeg_start_compress(cinfo, TRUE);
+    while (cinfo->next_scanline < cinfo->image_height) {
+        const uint8_t* source = pixels + (size_t)cinfo->next_scanline * pitch;
+        JSAMPROW row = (JSAMPROW)source;
+        if (!direct) {
+            // BGR and 4-byte pixels to RGB; alpha and padding bytes are dropped
+            thinpic_swizzle_rgb(source, scratch, width, pixel_sizes[pixel_format],
+                                pixel_format == THINPIC_PIXEL_BGR || pixel_format == THINPIC_PIXEL_BGRA);
+            row = scratch;
         }
-        result.length = 0;
+        jpeg_write_scanlines(cinfo, &row, 1);
     }
+    jpeg_finish_compress(cinfo);
+    THINPIC_LOGD("Raw JPEG: %dx%d, pixel format %d, quality %d, %zu bytes (%zu reserved)",
+                 width, height, pixel_format, quality, encoder->output.length, encoder->output.capacity);
 
-    tjDestroy(handle);
+    result.data = encoder->output.data;
+    result.length = encoder->output.length;
+    result.success = 1;
+    encoder->output.data = NULL;
     return result;
 }
 
-void free_png_buffer(uint8_t* buffer) {
-    if (buffer) {
-        free(buffer);
+// Rows [first, first + count) of one plane for jpeg_write_raw_data. Rows
+// that already hold padded_width contiguous samples are passed in place;
+// others are copied into scratch, deinterleaving NV12/NV21 chroma and
+// repeating the last column into libjpeg's block padding. Rows past the
+// bottom repeat the last row.
+static void plane_rows(const ThinpicYuvPlane* plane, int width, int height, int padded_width,
+                       int first, int count, uint8_t* scratch, JSAMPROW* rows) {
+    for (int i = 0; i < count; i++) {
+        int y = first + i < height ? first + i : height - 1;
+        const uint8_t* source = plane->data + (size_t)y * plane->row_stride;
+        if (plane->pixel_stride == 1 && padded_width == width) {
+            rows[i] = (JSAMPROW)source;
+            continue;
+        }
+        uint8_t* row = scratch + (size_t)i * padded_width;
+        for (int x = 0; x < width; x++) {
+            row[x] = source[(size_t)x * plane->pixel_stride];
+        }
+        memset(row + width, row[width - 1], (size_t)(padded_width - width));
+        rows[i] = row;
     }
 }
 
-void free_jpeg_buffer(uint8_t* buffer) {
-    if (buffer) {
-        tjFree(buffer);
+static int plane_valid(const ThinpicYuvPlane* plane, int width) {
+    return plane && plane->data && plane->pixel_stride >= 1 &&
+           plane->row_stride >= (width - 1) * plane->pixel_stride + 1;
+}
+
+CompressedImageResult compress_yuv420_to_jpeg(const ThinpicYuvPlane* y_plane, const ThinpicYuvPlane* u_plane,
+                                              const ThinpicYuvPlane* v_plane, int width, int height,
+                                              int quality) {
+    CompressedImageResult result = {NULL, 0, -1};
+    if (width <= 0 || height <= 0 || width > JPEG_MAX_DIMENSION || height > JPEG_MAX_DIMENSION ||
+            quality < 1 || quality > 100) {
+        THINPIC_LOGE("Error: Invalid YUV frame (%dx%d, quality %d)", width, height, quality);
+        return result;
+    }
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    if (!plane_valid(y_plane, width) || !plane_valid(u_plane, chroma_width) ||
+            !plane_valid(v_plane, chroma_width)) {
+        THINPIC_LOGE("Error: Invalid YUV planes for a %dx%d frame", width, height);
+        return result;
+    }
+
+    JpegEncoder* encoder = thread_encoder();
+    if (!encoder) {
+        THINPIC_LOGE("Error: Could not create a JPEG encoder");
+        return result;
+    }
+    // libjpeg reads whole 8x8 blocks: luma rows out to a multiple of 8
+    // samples, chroma rows (one block per 16 luma columns) likewise
+    int luma_padded = (width + 7) / 8 * 8;
+    int chroma_padded = (width + 15) / 16 * 8;
+    size_t luma_bytes = (size_t)luma_padded * 2 * DCTSIZE;
+    size_t chroma_bytes = (size_t)chroma_padded * DCTSIZE;
+    uint8_t* scratch = encoder_scratch(encoder, luma_bytes + chroma_bytes * 2);
+    if (!scratch || !encoder_output(encoder, width, height, 3)) {
+        THINPIC_LOGE("Error: Out of memory for a %dx%d JPEG", width, height);
+        return result;
+    }
+
+    struct jpeg_compress_struct* cinfo = &encoder->cinfo;
+    if (setjmp(encoder->escape)) {
+        jpeg_abort_compress(cinfo);
+        g_free(encoder->output.data);
+        encoder->output.data = NULL;
+        return result;
+    }
+    cinfo->image_width = (JDIMENSION)width;
+    cinfo->image_height = (JDIMENSION)height;
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(cinfo);   // 2x2 luma, 1x1 chroma sampling: the frame's own 4:2:0
+    set_frame_quality(cinfo, quality);
+    cinfo->raw_data_in = TRUE;
+    jpeg_start_compress(cinfo, TRUE);
+
+    // One iMCU row per call: 16 luma rows, 8 of each chroma plane
+    JSAMPROW y_rows[2 * DCTSIZE];
+    JSAMPROW u_rows[DCTSIZE];
+    JSAMPROW v_rows[DCTSIZE];
+    JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+    while (cinfo->next_scanline < cinfo->image_height) {
+        int row = (int)cinfo->next_scanline;
+        plane_rows(y_plane, width, height, luma_padded, row, 2 * DCTSIZE, scratch, y_rows);
+        plane_rows(u_plane, chroma_width, chroma_height, chroma_padded, row / 2, DCTSIZE,
+                   scratch + luma_bytes, u_rows);
+        plane_rows(v_plane, chroma_width, chroma_height, chroma_padded, row / 2, DCTSIZE,
+                   scratch + luma_bytes + chroma_bytes, v_rows);
+        jpeg_write_raw_data(cinfo, planes, 2 * DCTSIZE);
     }
+    jpeg_finish_compress(cinfo);
+    THINPIC_LOGD("YUV JPEG: %dx%d, chroma pixel stride %d, quality %d, %zu bytes (%zu reserved)",
+                 width, height, u_plane->pixel_stride, quality, encoder->output.length,
+                 encoder->output.capacity);
+
+    result.data = encoder->output.data;
+    result.length = encoder->output.length;
+    result.success = 1;
+    encoder->output.data = NULL;
+    return result;
 }
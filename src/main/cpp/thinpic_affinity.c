@@ -0,0 +1,82 @@
+// Per-job scheduling class of pool workers (CompressOptions priority).
+// Background jobs drop to nice 10 and, on CPUs whose cores have different
+// top frequencies, are pinned to the slowest cluster; interactive jobs get
+// every core back at the default nice. Workers only switch when the class
+// of the next job differs from the last one.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define BACKGROUND_NICE 10
+
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static cpu_set_t efficiency_cores;
+static cpu_set_t all_cores;
+static int has_efficiency_cores = 0;
+
+// Class applied to this worker thread; -1 before its first job
+static __thread int thread_priority = -1;
+
+static long read_max_freq(int cpu) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+    long khz = 0;
+    if (fscanf(file, "%ld", &khz) != 1) khz = 0;
+    fclose(file);
+    return khz;
+}
+
+// The efficiency cluster is every core at the lowest top frequency, kept
+// only when some other core is faster
+static void read_topology(void) {
+    CPU_ZERO(&efficiency_cores);
+    CPU_ZERO(&all_cores);
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpus > CPU_SETSIZE) cpus = CPU_SETSIZE;
+    long slowest = 0, fastest = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        CPU_SET(cpu, &all_cores);
+        long khz = read_max_freq(cpu);
+        if (khz <= 0) continue;
+        if (slowest == 0 || khz < slowest) slowest = khz;
+        if (khz > fastest) fastest = khz;
+    }
+    if (slowest == 0 || slowest == fastest) return;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        if (read_max_freq(cpu) == slowest) CPU_SET(cpu, &efficiency_cores);
+    }
+    has_efficiency_cores = 1;
+    THINPIC_LOGI("Background jobs pinned to %d of %ld cores (%ld of %ld kHz)",
+                 CPU_COUNT(&efficiency_cores), cpus, slowest, fastest);
+}
+
+void thinpic_thread_set_priority(int priority) {
+    if (priority != THINPIC_PRIORITY_BACKGROUND) priority = THINPIC_PRIORITY_INTERACTIVE;
+    if (priority == thread_priority) return;
+    pthread_once(&topology_once, read_topology);
+
+    int background = priority == THINPIC_PRIORITY_BACKGROUND;
+    if (has_efficiency_cores) {
+        const cpu_set_t* cores = background ? &efficiency_cores : &all_cores;
+        if (sched_setaffinity(0, sizeof(cpu_set_t), cores) != 0) {
+            THINPIC_LOGD("Worker affinity not changed");
+        }
+    }
+    // Linux applies both to the calling thread alone
+    id_t thread = (id_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, thread, background ? BACKGROUND_NICE : 0) != 0) {
+        THINPIC_LOGD("Worker nice not changed");
+    }
+    thread_priority = priority;
+}
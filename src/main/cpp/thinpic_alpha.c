@@ -0,0 +1,96 @@
+// Alpha bands that carry nothing, and alpha for outputs that cannot keep it.
+// Screenshots and many PNG and WebP exports carry an alpha band that is at
+// its maximum everywhere; encoding it costs a fourth band of work and bytes
+// for nothing, and pushes palette and lossless paths into RGBA modes. An
+// image already rendered into memory is scanned exactly (one translucent
+// pixel keeps the band), so only the search and race paths, which render
+// anyway, pay for the check. JPEG has no alpha at all: instead of libvips'
+// black, what is left is flattened onto the thinpic_configure background.
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Pixels AND-ed together between early-out checks
+#define SCAN_CHUNK 4096
+
+static int background_rgb = 0xFFFFFF;
+
+void thinpic_set_flatten_background(int rgb) {
+    __atomic_store_n(&background_rgb, rgb & 0xFFFFFF, __ATOMIC_RELAXED);
+}
+
+// AND of the last band over count pixels. The fixed-stride loops are what
+// the compiler turns into interleaved vector loads (NEON ld2/ld4).
+static unsigned and_alpha8(const uint8_t* p, size_t count, int bands) {
+    uint8_t all = 0xFF;
+    if (bands == 4) {
+        for (size_t i = 0; i < count; i++) all &= p[i * 4 + 3];
+    } else if (bands == 2) {
+        for (size_t i = 0; i < count; i++) all &= p[i * 2 + 1];
+    } else {
+        for (size_t i = 0; i < count; i++) all &= p[i * bands + bands - 1];
+    }
+    return all;
+}
+
+static unsigned and_alpha16(const uint16_t* p, size_t count, int bands) {
+    uint16_t all = 0xFFFF;
+    if (bands == 4) {
+        for (size_t i = 0; i < count; i++) all &= p[i * 4 + 3];
+    } else if (bands == 2) {
+        for (size_t i = 0; i < count; i++) all &= p[i * 2 + 1];
+    } else {
+        for (size_t i = 0; i < count; i++) all &= p[i * bands + bands - 1];
+    }
+    return all;
+}
+
+int thinpic_alpha_opaque(VipsImage* image) {
+    // A lazy image would be decoded a second time by the scan
+    if (!image || !vips_image_hasalpha(image) || !image->data) return 0;
+    VipsBandFormat format = vips_image_get_format(image);
+    if (format != VIPS_FORMAT_UCHAR && format != VIPS_FORMAT_USHORT) return 0;
+    int bands = vips_image_get_bands(image);
+    size_t pixels = (size_t)vips_image_get_width(image) * vips_image_get_height(image);
+    for (size_t start = 0; start < pixels; start += SCAN_CHUNK) {
+        size_t count = pixels - start < SCAN_CHUNK ? pixels - start : SCAN_CHUNK;
+        int opaque = format == VIPS_FORMAT_UCHAR
+            ? and_alpha8((const uint8_t*)image->data + start * bands, count, bands) == 0xFF
+            : and_alpha16((const uint16_t*)image->data + start * bands, count, bands) == 0xFFFF;
+        if (!opaque) return 0;
+    }
+    return 1;
+}
+
+int thinpic_drop_opaque_alpha(VipsImage* image, VipsImage** out) {
+    if (!thinpic_alpha_opaque(image)) return 0;
+    int bands = vips_image_get_bands(image);
+    if (vips_extract_band(image, out, 0, "n", bands - 1, NULL)) return -1;
+    THINPIC_LOGD("Opaque alpha dropped (%dx%d, %d bands)", vips_image_get_width(image),
+                 vips_image_get_height(image), bands);
+    return 1;
+}
+
+int thinpic_flatten_alpha(VipsImage* image, VipsImage** out) {
+    if (!vips_image_hasalpha(image)) return 0;
+    int colour_bands = vips_image_get_bands(image) - 1;
+    // Anything but grey or RGB is left to the saver
+    if (colour_bands != 1 && colour_bands != 3) return 0;
+    int rgb = __atomic_load_n(&background_rgb, __ATOMIC_RELAXED);
+    int sixteen_bit = vips_image_get_format(image) == VIPS_FORMAT_USHORT;
+    double scale = sixteen_bit ? 257.0 : 1.0;
+    double colour[3] = {((rgb >> 16) & 0xFF) * scale, ((rgb >> 8) & 0xFF) * scale, (rgb & 0xFF) * scale};
+    if (colour_bands == 1) {
+        // Grey images take the background's luma
+        colour[0] = (colour[0] * 77 + colour[1] * 150 + colour[2] * 29) / 256;
+    }
+    VipsArrayDouble* background = vips_array_double_new(colour, colour_bands);
+    int failed = vips_flatten(image, out,
+        "background", background,
+        "max_alpha", sixteen_bit ? 65535.0 : 255.0,
+        NULL);
+    vips_area_unref(VIPS_AREA(background));
+    return failed ? -1 : 1;
+}
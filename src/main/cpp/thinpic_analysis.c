@@ -0,0 +1,50 @@
+// Blur and exposure scores (ThinpicOptions analysis) from the luma plane the
+// hash tap averages out of the encoder's strips, so a batch can flag soft or
+// badly exposed photos without a second pass. Sharpness is the variance of
+// the 4-neighbour Laplacian: edges make it large, blur and shake flatten it.
+// The plane is at most 512 cells on the long side, so scores of a 12 MP photo
+// and of its 1600 px resize land close together. An FFT of the plane would
+// score the same high frequencies, but needs the whole plane transformed
+// where the Laplacian is one pass over it.
+
+#include "thinpic_internal.h"
+
+// Luma at or beyond these counts as clipped
+#define SHADOW_LEVEL 8.0f
+#define HIGHLIGHT_LEVEL 247.0f
+
+void thinpic_score_plane(const ThinpicLumaPlane* plane, ThinpicResult* out) {
+    int w = plane->width;
+    int h = plane->height;
+    if (w < 3 || h < 3) return;
+    const float* luma = plane->luma;
+
+    double sum = 0;
+    size_t shadows = 0;
+    size_t highlights = 0;
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        sum += luma[i];
+        shadows += luma[i] <= SHADOW_LEVEL;
+        highlights += luma[i] >= HIGHLIGHT_LEVEL;
+    }
+
+    double lap_sum = 0;
+    double lap_squares = 0;
+    for (int y = 1; y < h - 1; y++) {
+        const float* row = luma + (size_t)y * w;
+        for (int x = 1; x < w - 1; x++) {
+            double lap = (double)row[x - 1] + row[x + 1] + row[x - w] + row[x + w] - 4.0 * row[x];
+            lap_sum += lap;
+            lap_squares += lap * lap;
+        }
+    }
+    double interior = (double)(w - 2) * (h - 2);
+    double lap_mean = lap_sum / interior;
+
+    double pixels = (double)w * h;
+    out->sharpness = lap_squares / interior - lap_mean * lap_mean;
+    out->brightness = sum / pixels / 255.0;
+    out->shadows_clipped = shadows / pixels;
+    out->highlights_clipped = highlights / pixels;
+    out->analysis_valid = 1;
+}
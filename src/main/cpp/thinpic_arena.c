@@ -0,0 +1,209 @@
+#include <vips/vips.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Arenas kept for reuse; one per pool worker plus auto-race candidates
+#define MAX_IDLE_ARENAS 8
+// Arenas that grew past this are freed instead of kept, so one huge image
+// does not pin its footprint for the life of the process
+#define MAX_RETAINED_CAPACITY (32 * 1024 * 1024)
+
+static pthread_mutex_t arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static EncodeArena* idle_arenas[MAX_IDLE_ARENAS];
+static int idle_count = 0;
+
+EncodeArena* thinpic_arena_acquire() {
+    pthread_mutex_lock(&arena_mutex);
+    EncodeArena* arena = idle_count > 0 ? idle_arenas[--idle_count] : NULL;
+    pthread_mutex_unlock(&arena_mutex);
+
+    if (!arena) {
+        arena = g_new0(EncodeArena, 1);
+    }
+    arena->length = 0;
+    arena->position = 0;
+    return arena;
+}
+
+void thinpic_arena_release(EncodeArena* arena) {
+    if (!arena) return;
+
+    if (arena->capacity <= MAX_RETAINED_CAPACITY) {
+        pthread_mutex_lock(&arena_mutex);
+        if (idle_count < MAX_IDLE_ARENAS) {
+            idle_arenas[idle_count++] = arena;
+            arena = NULL;
+        }
+        pthread_mutex_unlock(&arena_mutex);
+    }
+
+    if (arena) {
+        g_free(arena->data);
+        g_free(arena);
+    }
+}
+
+void thinpic_arena_drain() {
+    pthread_mutex_lock(&arena_mutex);
+    while (idle_count > 0) {
+        EncodeArena* arena = idle_arenas[--idle_count];
+        g_free(arena->data);
+        g_free(arena);
+    }
+    pthread_mutex_unlock(&arena_mutex);
+}
+
+static int arena_reserve(EncodeArena* arena, size_t needed) {
+    if (needed <= arena->capacity) return 1;
+
+    size_t capacity = arena->capacity ? arena->capacity : 256 * 1024;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    uint8_t* data = (uint8_t*)g_try_realloc(arena->data, capacity);
+    if (!data) return 0;
+    arena->data = data;
+    arena->capacity = capacity;
+    return 1;
+}
+
+// VipsTargetCustom handlers; savers such as TIFF also read and seek
+static gint64 arena_on_write(VipsTargetCustom* target, const void* data, gint64 length, gpointer user_data) {
+    (void)target;
+    EncodeArena* arena = (EncodeArena*)user_data;
+    if (length <= 0) return 0;
+
+    size_t end = arena->position + (size_t)length;
+    if (!arena_reserve(arena, end)) return -1;
+    memcpy(arena->data + arena->position, data, (size_t)length);
+    arena->position = end;
+    if (end > arena->length) arena->length = end;
+    return length;
+}
+
+static gint64 arena_on_read(VipsTargetCustom* target, void* buffer, gint64 length, gpointer user_data) {
+    (void)target;
+    EncodeArena* arena = (EncodeArena*)user_data;
+    if (length <= 0 || arena->position >= arena->length) return 0;
+
+    size_t available = arena->length - arena->position;
+    size_t count = (size_t)length < available ? (size_t)length : available;
+    memcpy(buffer, arena->data + arena->position, count);
+    arena->position += count;
+    return (gint64)count;
+}
+
+static gint64 arena_on_seek(VipsTargetCustom* target, gint64 offset, int whence, gpointer user_data) {
+    (void)target;
+    EncodeArena* arena = (EncodeArena*)user_data;
+    gint64 base = 0;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (gint64)arena->position; break;
+        case SEEK_END: base = (gint64)arena->length; break;
+        default: return -1;
+    }
+    if (base + offset < 0) return -1;
+    arena->position = (size_t)(base + offset);
+    return (gint64)arena->position;
+}
+
+static int arena_on_end(VipsTargetCustom* target, gpointer user_data) {
+    (void)target;
+    (void)user_data;
+    return 0;
+}
+
+VipsTarget* thinpic_arena_target(EncodeArena* arena) {
+    arena->length = 0;
+    arena->position = 0;
+
+    VipsTargetCustom* target = vips_target_custom_new();
+    if (!target) return NULL;
+    g_signal_connect(target, "write", G_CALLBACK(arena_on_write), arena);
+    g_signal_connect(target, "read", G_CALLBACK(arena_on_read), arena);
+    g_signal_connect(target, "seek", G_CALLBACK(arena_on_seek), arena);
+    g_signal_connect(target, "end", G_CALLBACK(arena_on_end), arena);
+    return VIPS_TARGET(target);
+}
+
+uint8_t* thinpic_arena_copy(const EncodeArena* arena) {
+    if (!arena->data || arena->length == 0) return NULL;
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_COPY);
+    uint8_t* copy = (uint8_t*)g_memdup2(arena->data, arena->length);
+    thinpic_stage_end(THINPIC_STAGE_COPY, started);
+    return copy;
+}
+
+// Chunks handed to a ThinpicChunkCallback; big enough that a listener in
+// Dart sees a few messages per megabyte, small enough to start an upload early
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    ThinpicChunkCallback callback;
+    int64_t stream_id;
+    int64_t* delivered;
+    uint8_t* chunk;
+    size_t fill;
+} ChunkSink;
+
+static void chunk_flush(ChunkSink* sink) {
+    if (sink->fill == 0) return;
+    // The callee owns the chunk from here
+    sink->callback(sink->stream_id, sink->chunk, (int64_t)sink->fill);
+    *sink->delivered += (int64_t)sink->fill;
+    sink->chunk = NULL;
+    sink->fill = 0;
+}
+
+static gint64 chunk_on_write(VipsTargetCustom* target, const void* data, gint64 length, gpointer user_data) {
+    (void)target;
+    ChunkSink* sink = (ChunkSink*)user_data;
+    const uint8_t* bytes = (const uint8_t*)data;
+    gint64 remaining = length;
+    while (remaining > 0) {
+        if (!sink->chunk) {
+            sink->chunk = (uint8_t*)g_try_malloc(STREAM_CHUNK_SIZE);
+            if (!sink->chunk) return -1;
+        }
+        size_t count = STREAM_CHUNK_SIZE - sink->fill;
+        if ((size_t)remaining < count) count = (size_t)remaining;
+        memcpy(sink->chunk + sink->fill, bytes, count);
+        sink->fill += count;
+        bytes += count;
+        remaining -= (gint64)count;
+        if (sink->fill == STREAM_CHUNK_SIZE) chunk_flush(sink);
+    }
+    return length;
+}
+
+static int chunk_on_end(VipsTargetCustom* target, gpointer user_data) {
+    (void)target;
+    chunk_flush((ChunkSink*)user_data);
+    return 0;
+}
+
+static void chunk_sink_free(gpointer data, GClosure* closure) {
+    (void)closure;
+    ChunkSink* sink = (ChunkSink*)data;
+    // A failed save can leave part of a chunk behind
+    g_free(sink->chunk);
+    g_free(sink);
+}
+
+VipsTarget* thinpic_chunk_target(ThinpicChunkCallback callback, int64_t stream_id, int64_t* delivered) {
+    VipsTargetCustom* target = vips_target_custom_new();
+    if (!target) return NULL;
+    ChunkSink* sink = g_new0(ChunkSink, 1);
+    sink->callback = callback;
+    sink->stream_id = stream_id;
+    sink->delivered = delivered;
+    *delivered = 0;
+    // The sink goes with the "write" handler when the target is finalized
+    g_signal_connect_data(target, "write", G_CALLBACK(chunk_on_write), sink, chunk_sink_free, 0);
+    g_signal_connect(target, "end", G_CALLBACK(chunk_on_end), sink);
+    return VIPS_TARGET(target);
+}
@@ -0,0 +1,136 @@
+// Batches that outlive the UI (thinpic_background_directory). A directory
+// batch driven from Dart stops when Android freezes or kills the app's
+// isolates; run from a WorkManager worker or a foreground service through
+// ThinpicBackgroundEngine, the same compress_directory keeps going on the
+// same worker pool, under the same memory governor and manifest, and stops
+// cleanly when the system asks the worker to. The run is recorded here for
+// the process: a Flutter engine that attaches later (the user reopens the
+// app while the worker runs, or after it finished) reads
+// thinpic_background_status to show progress or pick up the outputs. One
+// background batch runs at a time.
+
+#include <pthread.h>
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+static pthread_mutex_t background_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThinpicDirectoryProgress background_progress;
+static ThinpicBackgroundState background_state = THINPIC_BACKGROUND_IDLE;
+static int64_t background_started_ms = 0;
+static int64_t background_finished_ms = 0;
+
+int thinpic_background_directory(const char* source, const char* output_dir, const char* manifest_path,
+                                 const CompressOptions* options) {
+    pthread_mutex_lock(&background_mutex);
+    if (background_state == THINPIC_BACKGROUND_RUNNING) {
+        pthread_mutex_unlock(&background_mutex);
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: A background batch is already running");
+        return -1;
+    }
+    memset(&background_progress, 0, sizeof(background_progress));
+    background_state = THINPIC_BACKGROUND_RUNNING;
+    background_started_ms = g_get_real_time() / 1000;
+    background_finished_ms = 0;
+    pthread_mutex_unlock(&background_mutex);
+
+    THINPIC_LOGI("Background batch started: %s", source ? source : "(null)");
+    int done = thinpic_compress_directory_tracked(source, output_dir, manifest_path, options,
+                                                  &background_progress);
+
+    pthread_mutex_lock(&background_mutex);
+    if (done < 0) {
+        background_state = THINPIC_BACKGROUND_FAILED;
+    } else if (__atomic_load_n(&background_progress.stop, __ATOMIC_ACQUIRE)) {
+        background_state = THINPIC_BACKGROUND_STOPPED;
+    } else {
+        background_state = THINPIC_BACKGROUND_FINISHED;
+    }
+    background_finished_ms = g_get_real_time() / 1000;
+    pthread_mutex_unlock(&background_mutex);
+    return done;
+}
+
+void thinpic_background_stop(void) {
+    pthread_mutex_lock(&background_mutex);
+    if (background_state == THINPIC_BACKGROUND_RUNNING) {
+        __atomic_store_n(&background_progress.stop, 1, __ATOMIC_RELEASE);
+        THINPIC_LOGI("Background batch stopping");
+    }
+    pthread_mutex_unlock(&background_mutex);
+}
+
+int thinpic_background_status(ThinpicBackgroundStatus* out) {
+    pthread_mutex_lock(&background_mutex);
+    ThinpicBackgroundState state = background_state;
+    if (out) {
+        out->state = state;
+        out->done = __atomic_load_n(&background_progress.done, __ATOMIC_ACQUIRE);
+        out->total = __atomic_load_n(&background_progress.total, __ATOMIC_ACQUIRE);
+        out->started_ms = background_started_ms;
+        out->finished_ms = background_finished_ms;
+    }
+    pthread_mutex_unlock(&background_mutex);
+    return state;
+}
+
+#ifdef __ANDROID__
+#include <jni.h>
+
+// ThinpicBackgroundEngine.nativeCompressDirectory(String, String, String,
+// int, int, int, int): compress_directory at background priority on the
+// calling (worker) thread; returns the inputs done, or -1
+JNIEXPORT jint JNICALL
+Java_com_example_thinpic_1flutter_ThinpicBackgroundEngine_nativeCompressDirectory(
+        JNIEnv* env, jclass clazz, jstring source, jstring output_dir, jstring manifest_path, jint format,
+        jint quality, jint target_width, jint target_height) {
+    (void)clazz;
+    if (!source || !output_dir || !manifest_path) return -1;
+    const char* source_chars = (*env)->GetStringUTFChars(env, source, NULL);
+    const char* output_chars = (*env)->GetStringUTFChars(env, output_dir, NULL);
+    const char* manifest_chars = (*env)->GetStringUTFChars(env, manifest_path, NULL);
+    int done = -1;
+    if (source_chars && output_chars && manifest_chars) {
+        CompressOptions options;
+        memset(&options, 0, sizeof(options));
+        options.mode = COMPRESS_MODE_STANDARD;
+        options.format = (ImageFormat)format;
+        options.quality = quality;
+        options.target_width = target_width;
+        options.target_height = target_height;
+        options.priority = THINPIC_PRIORITY_BACKGROUND;
+        // Its own share of the workers next to any engine's isolates
+        options.client = thinpic_pool_client();
+        done = thinpic_background_directory(source_chars, output_chars, manifest_chars, &options);
+    }
+    if (source_chars) (*env)->ReleaseStringUTFChars(env, source, source_chars);
+    if (output_chars) (*env)->ReleaseStringUTFChars(env, output_dir, output_chars);
+    if (manifest_chars) (*env)->ReleaseStringUTFChars(env, manifest_path, manifest_chars);
+    return done;
+}
+
+// ThinpicBackgroundEngine.nativeStop()
+JNIEXPORT void JNICALL
+Java_com_example_thinpic_1flutter_ThinpicBackgroundEngine_nativeStop(JNIEnv* env, jclass clazz) {
+    (void)env;
+    (void)clazz;
+    thinpic_background_stop();
+}
+
+// ThinpicBackgroundEngine.nativeStatus(int[]): fills state, done and total;
+// returns the state
+JNIEXPORT jint JNICALL
+Java_com_example_thinpic_1flutter_ThinpicBackgroundEngine_nativeStatus(JNIEnv* env, jclass clazz,
+                                                                       jintArray values) {
+    (void)clazz;
+    ThinpicBackgroundStatus status;
+    int state = thinpic_background_status(&status);
+    if (values && (*env)->GetArrayLength(env, values) >= 3) {
+        jint filled[3] = {status.state, status.done, status.total};
+        (*env)->SetIntArrayRegion(env, values, 0, 3, filled);
+    }
+    return state;
+}
+#endif
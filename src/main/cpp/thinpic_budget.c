@@ -0,0 +1,228 @@
+// This device's throughput model and the latency budgets planned on it
+// (ThinpicOptions latency_budget_ms, thinpic_get_throughput). Every plain
+// thinpic_compress call (no SSIM search, palette or animation) feeds its
+// wall time per output megapixel into a moving average kept per output
+// format and effort; every decode rendered into memory (the search modes)
+// feeds one kept per source format. Both start from conservative mid-range
+// phone figures and, once thinpic_set_throughput_model_dir is set, are
+// loaded from and periodically written back to one small file, so a new
+// launch starts from what the last one measured. A budgeted call is planned
+// against the encode rates: the caller's settings if they fit, else lower
+// effort, else JPEG for opaque images in a slow format, else a smaller
+// output box.
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Effort -1 (encoder default) and 0-9
+#define EFFORT_SLOTS 11
+// Weight of each new measurement in the moving average
+#define RATE_SMOOTHING 0.2
+// Budgets never shrink the output below this long edge
+#define BUDGET_MIN_EDGE 320
+#define MODEL_FILE "thinpic_throughput.bin"
+#define MODEL_MAGIC 0x31545054u     // "TPT1"
+// New measurements between rewrites of the model file
+#define MODEL_SAVE_INTERVAL 16
+
+// ms per output megapixel at the encoder's default effort, indexed by
+// ImageFormat (FORMAT_AUTO is resolved before planning)
+static const double prior_ms_per_mp[THINPIC_FORMAT_COUNT] = {
+    25,   // JPEG
+    120,  // PNG
+    150,  // WebP
+    40,   // TIFF
+    600,  // HEIF
+    500,  // JPEG 2000
+    400,  // JPEG XL
+    300,  // GIF
+    0,    // (FORMAT_AUTO)
+    400,  // AVIF at the fast presets
+};
+
+// ms per decoded megapixel rendered, indexed by source ImageFormat
+static const double prior_decode_ms_per_mp[THINPIC_FORMAT_COUNT] = {
+    15,   // JPEG
+    30,   // PNG
+    25,   // WebP
+    10,   // TIFF
+    120,  // HEIF
+    150,  // JPEG 2000
+    60,   // JPEG XL
+    20,   // GIF
+    0,    // (FORMAT_AUTO)
+    80,   // AVIF
+};
+
+// The model as kept in memory and on disk
+typedef struct {
+    uint32_t magic;
+    uint32_t formats;
+    uint32_t effort_slots;
+    uint32_t reserved;
+    double encode_ms_per_mp[THINPIC_FORMAT_COUNT][EFFORT_SLOTS];
+    double decode_ms_per_mp[THINPIC_FORMAT_COUNT];
+    int32_t encode_samples[THINPIC_FORMAT_COUNT][EFFORT_SLOTS];
+    int32_t decode_samples[THINPIC_FORMAT_COUNT];
+} ThroughputModel;
+
+static pthread_mutex_t rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThroughputModel model;
+static char* model_path = NULL;     // NULL = not persisted
+static int unsaved_samples = 0;
+
+static int effort_slot(int effort) {
+    return effort < 0 ? 0 : effort > 9 ? 10 : effort + 1;
+}
+
+// Default effort costs what effort 5 does; each step is about 12% of it
+static double prior_rate(ImageFormat format, int effort) {
+    double scale = effort < 0 ? 1.0 : 0.4 + 0.12 * effort;
+    return prior_ms_per_mp[format] * scale;
+}
+
+static double rate(ImageFormat format, int effort) {
+    pthread_mutex_lock(&rate_mutex);
+    double measured = model.encode_ms_per_mp[format][effort_slot(effort)];
+    pthread_mutex_unlock(&rate_mutex);
+    return measured > 0 ? measured : prior_rate(format, effort);
+}
+
+// Called with rate_mutex held; a missing or foreign file is an empty model
+static void model_load(void) {
+    memset(&model, 0, sizeof(model));
+    FILE* file = fopen(model_path, "rb");
+    if (!file) return;
+    if (fread(&model, sizeof(model), 1, file) != 1 || model.magic != MODEL_MAGIC ||
+            model.formats != THINPIC_FORMAT_COUNT || model.effort_slots != EFFORT_SLOTS) {
+        THINPIC_LOGW("Throughput model %s is unreadable, starting from the priors", model_path);
+        memset(&model, 0, sizeof(model));
+    }
+    fclose(file);
+}
+
+// Called with rate_mutex held
+static void model_save(void) {
+    unsaved_samples = 0;
+    model.magic = MODEL_MAGIC;
+    model.formats = THINPIC_FORMAT_COUNT;
+    model.effort_slots = EFFORT_SLOTS;
+    char* temp_path = g_strconcat(model_path, ".tmp", NULL);
+    FILE* file = fopen(temp_path, "wb");
+    int written = 0;
+    if (file) {
+        written = fwrite(&model, sizeof(model), 1, file) == 1;
+        written = fclose(file) == 0 && written;
+    }
+    if (!written || rename(temp_path, model_path) != 0) {
+        THINPIC_LOGW("Throughput model %s could not be written", model_path);
+        unlink(temp_path);
+    }
+    g_free(temp_path);
+}
+
+// Called with rate_mutex held: fold one measurement into a moving average
+static void model_add(double* average, int32_t* samples, double ms_per_mp) {
+    *average = *samples > 0 && *average > 0 ? *average + RATE_SMOOTHING * (ms_per_mp - *average) : ms_per_mp;
+    if (*samples < INT32_MAX) (*samples)++;
+    if (model_path && ++unsaved_samples >= MODEL_SAVE_INTERVAL) model_save();
+}
+
+void thinpic_set_throughput_model_dir(const char* directory) {
+    pthread_mutex_lock(&rate_mutex);
+    // Measurements since the last write belong to the model being left
+    if (model_path && unsaved_samples > 0) model_save();
+    g_free(model_path);
+    model_path = directory && directory[0] ? g_build_filename(directory, MODEL_FILE, NULL) : NULL;
+    unsaved_samples = 0;
+    if (model_path) model_load();
+    pthread_mutex_unlock(&rate_mutex);
+}
+
+int thinpic_get_throughput(ImageFormat format, int effort, ThinpicThroughput* out) {
+    if (!out || !thinpic_concrete_format(format)) return -1;
+    int slot = effort_slot(effort);
+    pthread_mutex_lock(&rate_mutex);
+    out->encode_samples = model.encode_samples[format][slot];
+    out->decode_samples = model.decode_samples[format];
+    out->encode_ms_per_mp = out->encode_samples > 0 ? model.encode_ms_per_mp[format][slot]
+                                                    : prior_rate(format, effort);
+    out->decode_ms_per_mp = out->decode_samples > 0 ? model.decode_ms_per_mp[format]
+                                                    : prior_decode_ms_per_mp[format];
+    pthread_mutex_unlock(&rate_mutex);
+    return 0;
+}
+
+void thinpic_budget_record(ImageFormat format, int effort, int width, int height, double elapsed_ms) {
+    if (!thinpic_concrete_format(format) || width <= 0 || height <= 0 || elapsed_ms <= 0) return;
+    double ms_per_mp = elapsed_ms / ((double)width * height / 1e6);
+    int slot = effort_slot(effort);
+    pthread_mutex_lock(&rate_mutex);
+    model_add(&model.encode_ms_per_mp[format][slot], &model.encode_samples[format][slot], ms_per_mp);
+    pthread_mutex_unlock(&rate_mutex);
+}
+
+void thinpic_budget_record_decode(ImageFormat format, int width, int height, double elapsed_ms) {
+    if (!thinpic_concrete_format(format) || width <= 0 || height <= 0 || elapsed_ms <= 0) return;
+    double ms_per_mp = elapsed_ms / ((double)width * height / 1e6);
+    pthread_mutex_lock(&rate_mutex);
+    model_add(&model.decode_ms_per_mp[format], &model.decode_samples[format], ms_per_mp);
+    pthread_mutex_unlock(&rate_mutex);
+}
+
+static int slow_format(ImageFormat format) {
+    return format == FORMAT_HEIF || format == FORMAT_AVIF || format == FORMAT_JP2K || format == FORMAT_JXL;
+}
+
+void thinpic_budget_plan(int budget_ms, int width, int height, int has_alpha, ThinpicBudgetPlan* plan) {
+    if (!thinpic_concrete_format(plan->format) || width <= 0 || height <= 0) return;
+    // The output box the caller asked for, as fitted without upscaling
+    double scale = 1.0;
+    if (plan->max_width > 0 && plan->max_width < width) scale = (double)plan->max_width / width;
+    if (plan->max_height > 0 && plan->max_height < height) scale = fmin(scale, (double)plan->max_height / height);
+    double megapixels = (double)width * height * scale * scale / 1e6;
+    if (plan->crop) megapixels = (double)plan->max_width * plan->max_height / 1e6;
+
+    plan->predicted_ms = megapixels * rate(plan->format, plan->effort);
+    if (plan->predicted_ms <= budget_ms) return;
+
+    // Lower effort first: it gives up some size, not pixels
+    for (int effort = plan->effort < 0 ? 4 : plan->effort - 1; effort >= 0; effort--) {
+        double predicted = megapixels * rate(plan->format, effort);
+        if (predicted <= budget_ms) {
+            plan->effort = effort;
+            plan->predicted_ms = predicted;
+            return;
+        }
+    }
+    plan->effort = 0;
+    if (slow_format(plan->format) && !has_alpha) {
+        plan->format = FORMAT_JPEG;
+        plan->effort = -1;
+    }
+    plan->predicted_ms = megapixels * rate(plan->format, plan->effort);
+    if (plan->predicted_ms <= budget_ms) return;
+
+    // Cost is linear in output pixels, so shrink both sides by the root
+    double shrink = sqrt(budget_ms / plan->predicted_ms);
+    double fitted_edge = fmax(width, height) * scale;
+    if (plan->crop) fitted_edge = fmax(plan->max_width, plan->max_height);
+    shrink = fmax(shrink, fmin(1.0, BUDGET_MIN_EDGE / fitted_edge));
+    if (plan->crop) {
+        // A filled box keeps its shape
+        plan->max_width = (int)(plan->max_width * shrink);
+        plan->max_height = (int)(plan->max_height * shrink);
+    } else {
+        int long_edge = (int)(fitted_edge * shrink);
+        plan->max_width = width >= height ? long_edge : 0;
+        plan->max_height = width >= height ? 0 : long_edge;
+    }
+    plan->predicted_ms *= shrink * shrink;
+}
@@ -0,0 +1,256 @@
+#include <vips/vips.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Pipeline roots watched per job: a private pass-through of the loaded image
+// or shrink-on-load thumbnail, and the in-memory copy the search modes
+// encode from. Loader results can be shared through the operation cache
+// with other jobs on the same file (vips_copy of them too), so the kill
+// never goes on those.
+#define MAX_WATCHED_IMAGES 8
+
+struct ThinpicCancelToken {
+    pthread_mutex_t lock;
+    int cancelled;
+    VipsImage* watched[MAX_WATCHED_IMAGES];  // Weak references
+    int watched_count;
+    int timed_out;                    // Cancelled by the watchdog rather than the caller
+    // Watchdog list; guarded by watchdog_mutex
+    struct timespec deadline;
+    int armed;
+    struct ThinpicCancelToken* next_armed;
+};
+
+// One thread for every armed job deadline (thinpic_configure job_timeout_ms).
+// It sleeps until the earliest one and cancels that job like
+// thinpic_cancel_job would, so a decode stuck in a malformed file or a
+// 900 MP PNG stops at its next region request. Deadlines are realtime, as
+// the condition variable times out against that clock.
+static pthread_mutex_t watchdog_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchdog_wake = PTHREAD_COND_INITIALIZER;
+static ThinpicCancelToken* armed_tokens = NULL;
+static int watchdog_running = 0;
+
+// Token of the job running on this thread; NULL outside pool jobs
+static __thread ThinpicCancelToken* current_token = NULL;
+
+ThinpicCancelToken* thinpic_cancel_token_new() {
+    ThinpicCancelToken* token = g_new0(ThinpicCancelToken, 1);
+    pthread_mutex_init(&token->lock, NULL);
+    return token;
+}
+
+// Weak-ref notify: the image is being disposed, forget it
+static void watched_image_gone(gpointer data, GObject* object) {
+    ThinpicCancelToken* token = (ThinpicCancelToken*)data;
+    pthread_mutex_lock(&token->lock);
+    for (int i = 0; i < token->watched_count; i++) {
+        if (token->watched[i] == (VipsImage*)object) {
+            token->watched[i] = token->watched[--token->watched_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&token->lock);
+}
+
+// Drop the weak refs of images that outlive the job (held by the operation
+// cache, for example) and clear their kill flag so a later job can reuse them
+static void release_watched(ThinpicCancelToken* token) {
+    pthread_mutex_lock(&token->lock);
+    for (int i = 0; i < token->watched_count; i++) {
+        if (token->cancelled) {
+            vips_image_set_kill(token->watched[i], FALSE);
+        }
+        g_object_weak_unref(G_OBJECT(token->watched[i]), watched_image_gone, token);
+    }
+    token->watched_count = 0;
+    pthread_mutex_unlock(&token->lock);
+}
+
+void thinpic_cancel_token_free(ThinpicCancelToken* token) {
+    if (!token) return;
+    thinpic_cancel_disarm(token);
+    release_watched(token);
+    pthread_mutex_destroy(&token->lock);
+    g_free(token);
+}
+
+void thinpic_cancel_bind(ThinpicCancelToken* token) {
+    if (!token && current_token) {
+        release_watched(current_token);
+    }
+    current_token = token;
+}
+
+void thinpic_cancel_request(ThinpicCancelToken* token) {
+    pthread_mutex_lock(&token->lock);
+    token->cancelled = 1;
+    for (int i = 0; i < token->watched_count; i++) {
+        vips_image_set_kill(token->watched[i], TRUE);
+    }
+    pthread_mutex_unlock(&token->lock);
+}
+
+int thinpic_cancel_is_set(ThinpicCancelToken* token) {
+    pthread_mutex_lock(&token->lock);
+    int cancelled = token->cancelled;
+    pthread_mutex_unlock(&token->lock);
+    return cancelled;
+}
+
+int thinpic_cancel_requested() {
+    return current_token ? thinpic_cancel_is_set(current_token) : 0;
+}
+
+void thinpic_cancel_watch(VipsImage* image) {
+    ThinpicCancelToken* token = current_token;
+    if (!token || !image) return;
+
+    pthread_mutex_lock(&token->lock);
+    if (token->watched_count < MAX_WATCHED_IMAGES) {
+        token->watched[token->watched_count++] = image;
+        g_object_weak_ref(G_OBJECT(image), watched_image_gone, token);
+    } else {
+        THINPIC_LOGW("Cancel token full, image not watched");
+    }
+    if (token->cancelled) {
+        // Cancelled before this stage started
+        vips_image_set_kill(image, TRUE);
+    }
+    pthread_mutex_unlock(&token->lock);
+}
+
+// Every region of the pass-through is the same region of its input
+static int private_generate(VipsRegion* out, void* seq, void* a, void* b, gboolean* stop) {
+    (void)a;
+    (void)b;
+    (void)stop;
+    VipsRegion* in = (VipsRegion*)seq;
+    VipsRect* rect = &out->valid;
+    if (vips_region_prepare(in, rect)) return -1;
+    return vips_region_region(out, in, rect, rect->left, rect->top);
+}
+
+int thinpic_private_image(VipsImage* in, VipsImage** out) {
+    *out = NULL;
+    VipsImage* image = vips_image_new();
+    if (vips_image_pipelinev(image, VIPS_DEMAND_STYLE_ANY, in, NULL) ||
+            vips_image_generate(image, vips_start_one, private_generate, vips_stop_one, in, NULL)) {
+        g_object_unref(image);
+        return -1;
+    }
+    // Unreffed with the pass-through
+    g_object_ref(in);
+    vips_object_local(image, in);
+    *out = image;
+    return 0;
+}
+
+VipsImage* thinpic_cancel_watch_shared(VipsImage* image) {
+    if (!image || !current_token) return image;
+    VipsImage* job_image = NULL;
+    if (thinpic_private_image(image, &job_image)) {
+        // Unwatched rather than the kill reaching other jobs
+        vips_error_clear();
+        THINPIC_LOGW("Cannot isolate the input from the operation cache, not watched");
+        return image;
+    }
+    g_object_unref(image);
+    thinpic_cancel_watch(job_image);
+    return job_image;
+}
+
+static int deadline_passed(const struct timespec* deadline, const struct timespec* now) {
+    return now->tv_sec > deadline->tv_sec ||
+           (now->tv_sec == deadline->tv_sec && now->tv_nsec >= deadline->tv_nsec);
+}
+
+static void* watchdog_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&watchdog_mutex);
+    for (;;) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        ThinpicCancelToken* earliest = NULL;
+        ThinpicCancelToken** link = &armed_tokens;
+        while (*link) {
+            ThinpicCancelToken* token = *link;
+            if (!deadline_passed(&token->deadline, &now)) {
+                if (!earliest || deadline_passed(&earliest->deadline, &token->deadline)) earliest = token;
+                link = &token->next_armed;
+                continue;
+            }
+            *link = token->next_armed;
+            token->armed = 0;
+            pthread_mutex_lock(&token->lock);
+            token->timed_out = 1;
+            pthread_mutex_unlock(&token->lock);
+            thinpic_cancel_request(token);
+            THINPIC_LOGW("Job ran past its time limit, stopping it");
+        }
+        if (earliest) {
+            pthread_cond_timedwait(&watchdog_wake, &watchdog_mutex, &earliest->deadline);
+        } else {
+            pthread_cond_wait(&watchdog_wake, &watchdog_mutex);
+        }
+    }
+    return NULL;
+}
+
+void thinpic_cancel_arm(ThinpicCancelToken* token, int timeout_ms) {
+    if (!token || timeout_ms <= 0) return;
+    pthread_mutex_lock(&watchdog_mutex);
+    if (!watchdog_running) {
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        watchdog_running = pthread_create(&thread, &attributes, watchdog_main, NULL) == 0;
+        pthread_attr_destroy(&attributes);
+        if (!watchdog_running) {
+            pthread_mutex_unlock(&watchdog_mutex);
+            THINPIC_LOGE("Error: Cannot start the job watchdog; time limits are off");
+            return;
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, &token->deadline);
+    token->deadline.tv_sec += timeout_ms / 1000;
+    token->deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (token->deadline.tv_nsec >= 1000000000) {
+        token->deadline.tv_sec++;
+        token->deadline.tv_nsec -= 1000000000;
+    }
+    if (!token->armed) {
+        token->armed = 1;
+        token->next_armed = armed_tokens;
+        armed_tokens = token;
+    }
+    pthread_cond_signal(&watchdog_wake);
+    pthread_mutex_unlock(&watchdog_mutex);
+}
+
+void thinpic_cancel_disarm(ThinpicCancelToken* token) {
+    if (!token) return;
+    pthread_mutex_lock(&watchdog_mutex);
+    if (token->armed) {
+        for (ThinpicCancelToken** link = &armed_tokens; *link; link = &(*link)->next_armed) {
+            if (*link == token) {
+                *link = token->next_armed;
+                break;
+            }
+        }
+        token->armed = 0;
+    }
+    pthread_mutex_unlock(&watchdog_mutex);
+}
+
+int thinpic_cancel_timed_out(ThinpicCancelToken* token) {
+    pthread_mutex_lock(&token->lock);
+    int timed_out = token->timed_out;
+    pthread_mutex_unlock(&token->lock);
+    return timed_out;
+}
@@ -0,0 +1,172 @@
+// Content classifier for auto_compress_image. A ~64x64 point sample keeps
+// exact pixel values (a filtered thumbnail would blend flat colours and text
+// into gradients); colour count, alpha use and neighbour differences on it
+// label the image so auto picks one format instead of racing every encoder.
+// A sample that lands near the line between photo and flat artwork is also
+// flagged ambiguous, and auto then encodes it both lossy and lossless.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define SAMPLE_SIZE 64
+#define COLOUR_SLOT_BITS 13         // 8192 slots for at most 64 * 64 colours
+#define GRAPHIC_COLOURS 256         // At most a palette's worth
+#define EDGE_STEP 48                // Neighbour luma difference counted as an edge
+#define GRADIENT_STEP 8             // Non-zero differences up to this are smooth shading
+#define AMBIGUOUS_COLOURS 1024      // Photo with few enough colours to be artwork
+
+static uint32_t colour_slot(uint32_t key) {
+    return (key * 2654435761u) >> (32 - COLOUR_SLOT_BITS);
+}
+
+// 8-bit point sample of at most SAMPLE_SIZE pixels a side
+static uint8_t* sample_pixels(VipsImage* image, int* width, int* height, int* bands) {
+    int xfac = vips_image_get_width(image) / SAMPLE_SIZE;
+    int yfac = vips_image_get_height(image) / SAMPLE_SIZE;
+    VipsImage* steps[2] = {NULL, NULL};
+    int failed = vips_subsample(image, &steps[0], xfac > 1 ? xfac : 1, yfac > 1 ? yfac : 1,
+                                "point", TRUE,
+                                NULL);
+    if (!failed) {
+        // 16-bit samples keep their high byte; a plain cast would clip them
+        failed = vips_image_get_format(steps[0]) == VIPS_FORMAT_USHORT
+            ? vips_rshift_const1(steps[0], &steps[1], 8, NULL)
+            : vips_copy(steps[0], &steps[1], NULL);
+    }
+    if (steps[0]) g_object_unref(steps[0]);
+    if (failed) {
+        if (steps[1]) g_object_unref(steps[1]);
+        return NULL;
+    }
+    VipsImage* sample = NULL;
+    failed = vips_cast_uchar(steps[1], &sample, NULL);
+    g_object_unref(steps[1]);
+    if (failed) return NULL;
+
+    *width = vips_image_get_width(sample);
+    *height = vips_image_get_height(sample);
+    *bands = vips_image_get_bands(sample);
+    size_t size = 0;
+    uint8_t* pixels = (uint8_t*)vips_image_write_to_memory(sample, &size);
+    g_object_unref(sample);
+    return pixels;
+}
+
+// Distinct colours (alpha ignored), counting stops once every slot could fill
+static int colour_count(const uint8_t* pixels, size_t count, int bands) {
+    uint32_t* keys = (uint32_t*)malloc(sizeof(uint32_t) << COLOUR_SLOT_BITS);
+    uint8_t* used = (uint8_t*)calloc(1, 1 << COLOUR_SLOT_BITS);
+    if (!keys || !used) {
+        free(keys);
+        free(used);
+        return -1;
+    }
+    int colours = bands >= 3 ? 3 : 1;
+    int distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* p = pixels + i * bands;
+        uint32_t key = colours == 3 ? p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 : p[0];
+        uint32_t slot = colour_slot(key);
+        while (used[slot] && keys[slot] != key) {
+            slot = (slot + 1) & ((1 << COLOUR_SLOT_BITS) - 1);
+        }
+        if (!used[slot]) {
+            used[slot] = 1;
+            keys[slot] = key;
+            distinct++;
+        }
+    }
+    free(keys);
+    free(used);
+    return distinct;
+}
+
+static int luma(const uint8_t* p, int bands) {
+    return bands >= 3 ? (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8 : p[0];
+}
+
+const char* thinpic_content_name(ThinpicContent content) {
+    switch (content) {
+        case THINPIC_CONTENT_SCREENSHOT: return "screenshot";
+        case THINPIC_CONTENT_GRAPHIC: return "graphic";
+        case THINPIC_CONTENT_TRANSPARENT: return "transparent";
+        default: return "photo";
+    }
+}
+
+ThinpicContent thinpic_classify(VipsImage* image, int* ambiguous) {
+    if (ambiguous) *ambiguous = 0;
+    int width = 0;
+    int height = 0;
+    int bands = 0;
+    uint8_t* pixels = sample_pixels(image, &width, &height, &bands);
+    if (!pixels) {
+        // Photo settings are the safe default for anything unreadable
+        vips_error_clear();
+        return THINPIC_CONTENT_PHOTO;
+    }
+    size_t count = (size_t)width * height;
+
+    // Alpha that is actually used, not just an opaque fourth band
+    size_t translucent = 0;
+    if (bands == 2 || bands == 4) {
+        for (size_t i = 0; i < count; i++) {
+            if (pixels[i * bands + bands - 1] < 250) translucent++;
+        }
+    }
+
+    // Horizontal and vertical neighbours: exact repeats mark flat fills,
+    // large steps mark edges and small ones smooth shading
+    size_t pairs = 0;
+    size_t flat = 0;
+    size_t edges = 0;
+    size_t gradients = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t* p = pixels + ((size_t)y * width + x) * bands;
+            int value = luma(p, bands);
+            for (int n = 0; n < 2; n++) {
+                if (n == 0 ? x + 1 >= width : y + 1 >= height) continue;
+                const uint8_t* q = n == 0 ? p + bands : p + (size_t)width * bands;
+                int step = abs(luma(q, bands) - value);
+                pairs++;
+                if (step == 0) flat++;
+                else if (step <= GRADIENT_STEP) gradients++;
+                if (step >= EDGE_STEP) edges++;
+            }
+        }
+    }
+    int colours = colour_count(pixels, count, bands);
+    g_free(pixels);
+
+    double flat_share = pairs ? (double)flat / pairs : 1;
+    double edge_share = pairs ? (double)edges / pairs : 0;
+    double gradient_share = pairs ? (double)gradients / pairs : 0;
+    ThinpicContent content = THINPIC_CONTENT_PHOTO;
+    if (translucent * 100 > count) {
+        content = THINPIC_CONTENT_TRANSPARENT;
+    } else if (colours >= 0 && colours <= GRAPHIC_COLOURS && gradient_share < 0.25) {
+        content = THINPIC_CONTENT_GRAPHIC;
+    } else if (flat_share >= 0.5 && edge_share >= 0.02) {
+        content = THINPIC_CONTENT_SCREENSHOT;
+    }
+    // Close to the other side of a threshold: a photo full of flat fills or
+    // with few colours, or artwork with photographic areas in it
+    int borderline = 0;
+    if (content == THINPIC_CONTENT_PHOTO) {
+        borderline = (colours >= 0 && colours <= AMBIGUOUS_COLOURS && gradient_share < 0.35) ||
+                     (flat_share >= 0.35 && edge_share >= 0.01);
+    } else if (content == THINPIC_CONTENT_SCREENSHOT) {
+        borderline = flat_share < 0.65 || gradient_share >= 0.15;
+    } else if (content == THINPIC_CONTENT_GRAPHIC) {
+        borderline = gradient_share >= 0.15;
+    }
+    if (ambiguous) *ambiguous = borderline;
+    THINPIC_LOGD("Classified %dx%d sample as %s%s: %d colours, %.2f flat, %.2f edges, %.2f gradients, "
+                 "%zu translucent", width, height, thinpic_content_name(content), borderline ? " (ambiguous)" : "",
+                 colours, flat_share, edge_share, gradient_share, translucent);
+    return content;
+}
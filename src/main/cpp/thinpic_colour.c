@@ -0,0 +1,262 @@
+// Conversion to sRGB for every pipeline (thinpic_to_srgb). An embedded
+// profile that already describes sRGB only relabels the image; 8-bit RGB(A)
+// in another RGB space (Display P3 from iPhones, Adobe RGB from cameras)
+// goes through an lcms2 transform built once per profile and kept, so a
+// batch of P3 photos pays for one profile build instead of one per image.
+// Everything else (CMYK, 16-bit, unusual profiles) is left to
+// vips_icc_transform and vips_colourspace. The common camera and phone case,
+// 8-bit sRGB with no profile or an sRGB one, returns the image itself: no
+// copy, no relabel, no colour stage in the pipeline at all.
+
+#include <pthread.h>
+#include <string.h>
+#include <lcms2.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define TRANSFORM_SLOTS 8           // Distinct profiles whose transforms are kept
+
+typedef struct {
+    uint64_t key;                   // Hash of the profile bytes; 0 = free
+    size_t length;
+    int is_srgb;
+    cmsHTRANSFORM rgb;              // Built on first use, one per band layout
+    cmsHTRANSFORM rgba;
+} ProfileSlot;
+
+static pthread_mutex_t colour_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ProfileSlot slots[TRANSFORM_SLOTS];
+static void* srgb_profile = NULL;   // Written into converted images' metadata
+static cmsUInt32Number srgb_profile_length = 0;
+
+static uint64_t profile_key(const uint8_t* data, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3ull;
+    }
+    hash ^= (uint64_t)length;
+    return hash ? hash : 1;
+}
+
+// Called with colour_mutex held
+static int load_srgb_profile(void) {
+    if (srgb_profile) return 1;
+    cmsHPROFILE profile = cmsCreate_sRGBProfile();
+    cmsUInt32Number length = 0;
+    if (!profile || !cmsSaveProfileToMem(profile, NULL, &length) || length == 0) {
+        if (profile) cmsCloseProfile(profile);
+        return 0;
+    }
+    void* bytes = g_malloc(length);
+    if (!cmsSaveProfileToMem(profile, bytes, &length)) {
+        g_free(bytes);
+        cmsCloseProfile(profile);
+        return 0;
+    }
+    cmsCloseProfile(profile);
+    srgb_profile = bytes;
+    srgb_profile_length = length;
+    return 1;
+}
+
+// The profile's own description is the cheapest reliable test: camera and
+// phone sRGB profiles differ byte for byte but all call themselves sRGB
+static int describes_srgb(cmsHPROFILE profile) {
+    char description[256];
+    if (cmsGetProfileInfoASCII(profile, cmsInfoDescription, "en", "US", description, sizeof(description)) == 0) {
+        return 0;
+    }
+    return strstr(description, "sRGB") != NULL;
+}
+
+// Called with colour_mutex held; NULL when the profile cannot be parsed or
+// is not an RGB space, or every slot is taken
+static ProfileSlot* profile_slot(const uint8_t* data, size_t length, int bands) {
+    uint64_t key = profile_key(data, length);
+    ProfileSlot* slot = NULL;
+    for (int i = 0; i < TRANSFORM_SLOTS; i++) {
+        if (slots[i].key == key && slots[i].length == length) {
+            slot = &slots[i];
+            break;
+        }
+        if (!slot && slots[i].key == 0) slot = &slots[i];
+    }
+    if (!slot) return NULL;
+
+    cmsHTRANSFORM* transform = bands == 4 ? &slot->rgba : &slot->rgb;
+    if (slot->key == key && (slot->is_srgb || *transform)) return slot;
+
+    cmsHPROFILE source = cmsOpenProfileFromMem(data, (cmsUInt32Number)length);
+    if (!source) return NULL;
+    if (cmsGetColorSpace(source) != cmsSigRgbData) {
+        cmsCloseProfile(source);
+        return NULL;
+    }
+    int is_srgb = describes_srgb(source);
+    if (!is_srgb) {
+        cmsHPROFILE target = cmsCreate_sRGBProfile();
+        cmsUInt32Number format = bands == 4 ? TYPE_RGBA_8 : TYPE_RGB_8;
+        // No 1-pixel cache: libvips workers share the transform
+        cmsUInt32Number flags = cmsFLAGS_NOCACHE | (bands == 4 ? cmsFLAGS_COPY_ALPHA : 0);
+        *transform = target
+            ? cmsCreateTransform(source, format, target, format, INTENT_RELATIVE_COLORIMETRIC, flags) : NULL;
+        if (target) cmsCloseProfile(target);
+    }
+    cmsCloseProfile(source);
+    if (!is_srgb && !*transform) return NULL;
+
+    slot->key = key;
+    slot->length = length;
+    slot->is_srgb = is_srgb;
+    THINPIC_LOGD("Colour: %zu-byte profile is %s", length, is_srgb ? "sRGB" : "cached for sRGB transform");
+    return slot;
+}
+
+static int transform_generate(VipsRegion* out_region, void* seq, void* a, void* b, gboolean* stop) {
+    VipsRegion* in_region = (VipsRegion*)seq;
+    cmsHTRANSFORM transform = (cmsHTRANSFORM)b;
+    VipsRect* rect = &out_region->valid;
+    (void)a;
+    (void)stop;
+    if (vips_region_prepare(in_region, rect)) return -1;
+    for (int y = 0; y < rect->height; y++) {
+        cmsDoTransform(transform,
+                       VIPS_REGION_ADDR(in_region, rect->left, rect->top + y),
+                       VIPS_REGION_ADDR(out_region, rect->left, rect->top + y),
+                       (cmsUInt32Number)rect->width);
+    }
+    return 0;
+}
+
+// Lazy per-region transform; the output carries the sRGB profile
+static int apply_transform(VipsImage* in, VipsImage** out, cmsHTRANSFORM transform) {
+    VipsImage* image = vips_image_new();
+    if (vips_image_pipelinev(image, VIPS_DEMAND_STYLE_THINSTRIP, in, NULL)) {
+        g_object_unref(image);
+        return -1;
+    }
+    image->Type = VIPS_INTERPRETATION_sRGB;
+    vips_image_set_blob_copy(image, VIPS_META_ICC_NAME, srgb_profile, srgb_profile_length);
+    if (vips_image_generate(image, vips_start_one, transform_generate, vips_stop_one, in, transform)) {
+        g_object_unref(image);
+        return -1;
+    }
+    // Keep the input alive as long as the output reads from it
+    g_object_ref(in);
+    vips_object_local(image, in);
+    *out = image;
+    return 0;
+}
+
+// 8-bit layouts that are already RGB and only need labelling
+static int srgb_like(VipsInterpretation interpretation) {
+    return interpretation == VIPS_INTERPRETATION_sRGB || interpretation == VIPS_INTERPRETATION_RGB ||
+           interpretation == VIPS_INTERPRETATION_MULTIBAND;
+}
+
+// The image itself, with a reference for the caller
+static int unchanged(VipsImage* image, VipsImage** out) {
+    g_object_ref(image);
+    *out = image;
+    return 0;
+}
+
+// RGB-like pixels that are not 8-bit into uchar: 16-bit by its top byte,
+// float and double (0-255 as libvips' sRGB loaders produce them) clamped.
+// Both are single arithmetic passes.
+static int to_uchar(VipsImage* image, VipsImage** out) {
+    VipsImage* shifted = NULL;
+    int failed;
+    if (vips_image_get_format(image) == VIPS_FORMAT_USHORT) {
+        failed = vips_rshift_const1(image, &shifted, 8, NULL) ||
+                 vips_cast_uchar(shifted, out, NULL);
+        if (shifted) g_object_unref(shifted);
+    } else {
+        failed = vips_cast_uchar(image, out, NULL);
+    }
+    if (failed) return -1;
+    VipsImage* labelled = NULL;
+    if (vips_copy(*out, &labelled, "interpretation", VIPS_INTERPRETATION_sRGB, NULL)) {
+        g_object_unref(*out);
+        *out = NULL;
+        return -1;
+    }
+    g_object_unref(*out);
+    *out = labelled;
+    return 0;
+}
+
+int thinpic_to_srgb(VipsImage* image, VipsImage** out) {
+    *out = NULL;
+    int bands = vips_image_get_bands(image);
+    VipsBandFormat format = vips_image_get_format(image);
+    VipsInterpretation interpretation = vips_image_get_interpretation(image);
+    const void* icc = NULL;
+    size_t icc_length = 0;
+    if (vips_image_get_typeof(image, VIPS_META_ICC_NAME) &&
+            vips_image_get_blob(image, VIPS_META_ICC_NAME, &icc, &icc_length) != 0) {
+        vips_error_clear();
+        icc = NULL;
+    }
+
+    // Gray stays gray (with or without a profile) and unprofiled RGB keeps
+    // its pixels; CMYK, Lab and 16-bit RGB are converted without a profile
+    if (interpretation == VIPS_INTERPRETATION_B_W || interpretation == VIPS_INTERPRETATION_GREY16) {
+        return unchanged(image, out);
+    }
+    if (!icc || bands < 3) {
+        if (srgb_like(interpretation) && format != VIPS_FORMAT_UCHAR && format != VIPS_FORMAT_CHAR) {
+            return to_uchar(image, out);
+        }
+        if (interpretation == VIPS_INTERPRETATION_sRGB) {
+            return unchanged(image, out);
+        }
+        if (srgb_like(interpretation) || !vips_colourspace_issupported(image)) {
+            return vips_copy(image, out, "interpretation", VIPS_INTERPRETATION_sRGB, NULL);
+        }
+        return vips_colourspace(image, out, VIPS_INTERPRETATION_sRGB, NULL);
+    }
+
+    if (format == VIPS_FORMAT_UCHAR && (bands == 3 || bands == 4) && interpretation != VIPS_INTERPRETATION_CMYK) {
+        pthread_mutex_lock(&colour_mutex);
+        ProfileSlot* slot = load_srgb_profile() ? profile_slot((const uint8_t*)icc, icc_length, bands) : NULL;
+        int is_srgb = slot && slot->is_srgb;
+        cmsHTRANSFORM transform = slot ? (bands == 4 ? slot->rgba : slot->rgb) : NULL;
+        pthread_mutex_unlock(&colour_mutex);
+        if (is_srgb) {
+            if (interpretation == VIPS_INTERPRETATION_sRGB) return unchanged(image, out);
+            return vips_copy(image, out, "interpretation", VIPS_INTERPRETATION_sRGB, NULL);
+        }
+        if (transform) {
+            return apply_transform(image, out, transform);
+        }
+    }
+
+    // Builds the transform per image, but handles CMYK, 16-bit and profiles
+    // lcms2 could not pair with the cache
+    int depth = format == VIPS_FORMAT_USHORT ? 16 : 8;
+    if (vips_icc_transform(image, out, "srgb",
+            "embedded", TRUE,
+            "intent", VIPS_INTENT_RELATIVE,
+            "depth", depth,
+            NULL) == 0) {
+        return 0;
+    }
+    THINPIC_LOGW("Colour: embedded profile could not be applied, labelling as sRGB: %s", vips_error_buffer());
+    vips_error_clear();
+    return vips_copy(image, out, "interpretation", VIPS_INTERPRETATION_sRGB, NULL);
+}
+
+void thinpic_colour_drain(void) {
+    pthread_mutex_lock(&colour_mutex);
+    for (int i = 0; i < TRANSFORM_SLOTS; i++) {
+        if (slots[i].rgb) cmsDeleteTransform(slots[i].rgb);
+        if (slots[i].rgba) cmsDeleteTransform(slots[i].rgba);
+        memset(&slots[i], 0, sizeof(slots[i]));
+    }
+    g_free(srgb_profile);
+    srgb_profile = NULL;
+    srgb_profile_length = 0;
+    pthread_mutex_unlock(&colour_mutex);
+}
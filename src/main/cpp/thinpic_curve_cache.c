@@ -0,0 +1,202 @@
+// On-disk quality/size samples for the target-size searches
+// (thinpic_set_curve_cache_dir). Re-compressing the same original, for a
+// retry or a different target, starts from what the last run measured
+// instead of probing again. One small file of fixed records, loaded once
+// and rewritten through a temporary file and rename on every update; the
+// least recently used record makes room.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define CURVE_FILE "thinpic_curves.bin"
+#define CURVE_MAGIC 0x31435054u     // "TPC1"
+#define CURVE_RECORDS 256
+#define HASH_HEADER_BYTES 65536     // Encoded bytes hashed from the start of the input
+
+typedef struct {
+    uint64_t key;
+    uint64_t used;                  // Stamp of the last lookup or store; 0 = free
+    int32_t count;
+    int32_t setting[THINPIC_CURVE_SAMPLES];
+    uint32_t bytes[THINPIC_CURVE_SAMPLES];
+} CurveRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t records;
+    uint64_t clock;
+} CurveFileHeader;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char* cache_path = NULL;     // NULL = disabled
+static int cache_loaded = 0;
+static uint64_t cache_clock = 0;
+static CurveRecord cache[CURVE_RECORDS];
+
+void thinpic_set_curve_cache_dir(const char* directory) {
+    pthread_mutex_lock(&cache_mutex);
+    g_free(cache_path);
+    cache_path = directory && directory[0] ? g_build_filename(directory, CURVE_FILE, NULL) : NULL;
+    cache_loaded = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// Called with cache_mutex held; a missing or foreign file is an empty cache
+static void cache_load(void) {
+    if (cache_loaded) return;
+    cache_loaded = 1;
+    memset(cache, 0, sizeof(cache));
+    cache_clock = 0;
+    FILE* file = fopen(cache_path, "rb");
+    if (!file) return;
+    CurveFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CURVE_MAGIC ||
+            header.records != CURVE_RECORDS || fread(cache, sizeof(cache), 1, file) != 1) {
+        THINPIC_LOGW("Curve cache %s is unreadable, starting empty", cache_path);
+        memset(cache, 0, sizeof(cache));
+    } else {
+        cache_clock = header.clock;
+    }
+    fclose(file);
+}
+
+// Called with cache_mutex held
+static void cache_save(void) {
+    char* temp_path = g_strconcat(cache_path, ".tmp", NULL);
+    FILE* file = fopen(temp_path, "wb");
+    int written = 0;
+    if (file) {
+        CurveFileHeader header = {CURVE_MAGIC, CURVE_RECORDS, cache_clock};
+        written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(cache, sizeof(cache), 1, file) == 1;
+        written = fclose(file) == 0 && written;
+    }
+    if (!written || rename(temp_path, cache_path) != 0) {
+        THINPIC_LOGW("Curve cache %s could not be written", cache_path);
+        unlink(temp_path);
+    }
+    g_free(temp_path);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t thinpic_curve_key(const ThinpicInput* input, int kind, int format, int variant) {
+    pthread_mutex_lock(&cache_mutex);
+    int enabled = cache_path != NULL;
+    pthread_mutex_unlock(&cache_mutex);
+    if (!enabled) return 0;
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    int64_t size = 0;
+    if (input->data) {
+        size = (int64_t)input->length;
+        hash = fnv1a(hash, input->data, input->length < HASH_HEADER_BYTES ? input->length : HASH_HEADER_BYTES);
+    } else {
+        // pread leaves a descriptor's offset for the loader; pipes are not cached
+        int fd = input->path ? open(input->path, O_RDONLY | O_CLOEXEC) : input->fd;
+        struct stat file_stat;
+        uint8_t* header = NULL;
+        ssize_t length = -1;
+        if (fd >= 0 && fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+                (header = (uint8_t*)malloc(HASH_HEADER_BYTES)) != NULL) {
+            size = (int64_t)file_stat.st_size;
+            length = pread(fd, header, HASH_HEADER_BYTES, 0);
+        }
+        if (length > 0) hash = fnv1a(hash, header, (size_t)length);
+        free(header);
+        if (input->path && fd >= 0) close(fd);
+        if (length <= 0) return 0;
+    }
+    int32_t tail[3] = {kind, format, variant};
+    hash = fnv1a(hash, &size, sizeof(size));
+    // Pages share the file's bytes; the first keeps its key from before pages
+    if (input->page > 0) hash = fnv1a(hash, &input->page, sizeof(input->page));
+    hash = fnv1a(hash, tail, sizeof(tail));
+    return hash ? hash : 1;
+}
+
+int thinpic_curve_lookup(uint64_t key, ThinpicCurve* curve) {
+    memset(curve, 0, sizeof(*curve));
+    if (!key) return 0;
+    pthread_mutex_lock(&cache_mutex);
+    int found = 0;
+    if (cache_path) {
+        cache_load();
+        for (int i = 0; i < CURVE_RECORDS && !found; i++) {
+            CurveRecord* record = &cache[i];
+            if (record->used == 0 || record->key != key) continue;
+            record->used = ++cache_clock;
+            curve->count = record->count < THINPIC_CURVE_SAMPLES ? record->count : THINPIC_CURVE_SAMPLES;
+            for (int s = 0; s < curve->count; s++) {
+                curve->setting[s] = record->setting[s];
+                curve->bytes[s] = record->bytes[s];
+            }
+            found = curve->count > 0;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+void thinpic_curve_store(uint64_t key, const ThinpicCurve* curve) {
+    if (!key || curve->count <= 0) return;
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_path) {
+        cache_load();
+        // This key's record, else a free one, else the least recently used
+        CurveRecord* record = NULL;
+        CurveRecord* oldest = &cache[0];
+        for (int i = 0; i < CURVE_RECORDS; i++) {
+            if (cache[i].used != 0 && cache[i].key == key) {
+                record = &cache[i];
+                break;
+            }
+            if (cache[i].used < oldest->used) oldest = &cache[i];
+        }
+        if (!record) record = oldest;
+        record->key = key;
+        record->used = ++cache_clock;
+        record->count = curve->count;
+        for (int s = 0; s < curve->count; s++) {
+            record->setting[s] = curve->setting[s];
+            record->bytes[s] = curve->bytes[s] > UINT32_MAX ? UINT32_MAX : (uint32_t)curve->bytes[s];
+        }
+        cache_save();
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void thinpic_curve_add(ThinpicCurve* curve, int setting, size_t bytes) {
+    int at = 0;
+    while (at < curve->count && curve->setting[at] < setting) at++;
+    if (at < curve->count && curve->setting[at] == setting) {
+        curve->bytes[at] = bytes;
+        return;
+    }
+    if (curve->count == THINPIC_CURVE_SAMPLES) {
+        // Full: give up the sample farthest from the new one
+        int drop = setting - curve->setting[0] > curve->setting[curve->count - 1] - setting ? 0 : curve->count - 1;
+        memmove(&curve->setting[drop], &curve->setting[drop + 1], sizeof(int) * (curve->count - drop - 1));
+        memmove(&curve->bytes[drop], &curve->bytes[drop + 1], sizeof(size_t) * (curve->count - drop - 1));
+        curve->count--;
+        if (drop < at) at--;
+    }
+    memmove(&curve->setting[at + 1], &curve->setting[at], sizeof(int) * (curve->count - at));
+    memmove(&curve->bytes[at + 1], &curve->bytes[at], sizeof(size_t) * (curve->count - at));
+    curve->setting[at] = setting;
+    curve->bytes[at] = bytes;
+    curve->count++;
+}
@@ -0,0 +1,181 @@
+// In-memory cache of decoded pipeline intermediates (thinpic_configure
+// decode_cache_mb). An editor that re-encodes the same photo at every
+// quality slider step would otherwise decode and resize the original each
+// time; the legacy pipelines instead render the image after their resize
+// and colour steps once, keep it here, and later calls with the same file
+// and steps only pay the encode. Entries are keyed by the path, the file's
+// device, inode, size and mtime (an edited file misses), and the caller's
+// params; the least recently used go once the total passes the byte budget.
+// Cached images are only read, so one can back any number of calls at once.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+typedef struct {
+    ThinpicCacheKey key;
+    VipsImage* image;               // Rendered to memory; the cache holds one reference
+    int64_t bytes;
+    uint64_t used;                  // Value of use_counter at the last hit or store
+} CacheEntry;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t cache_budget = 0;    // 0 = disabled
+static CacheEntry* entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+static int64_t total_bytes = 0;
+static uint64_t use_counter = 0;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static uint64_t avalanche(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// Entries are unreferenced outside the mutex by the callers of these
+static void entry_remove(int index, VipsImage** dropped) {
+    *dropped = entries[index].image;
+    total_bytes -= entries[index].bytes;
+    entries[index] = entries[--entry_count];
+}
+
+static int entry_find(const ThinpicCacheKey* key) {
+    for (int i = 0; i < entry_count; i++) {
+        if (entries[i].key.high == key->high && entries[i].key.low == key->low) return i;
+    }
+    return -1;
+}
+
+// Least recently used out until the total fits; returns how many images went
+// into dropped (which has room for entry_count of them)
+static int cache_evict(VipsImage** dropped) {
+    int count = 0;
+    while (entry_count > 0 && total_bytes > cache_budget) {
+        int oldest = 0;
+        for (int i = 1; i < entry_count; i++) {
+            if (entries[i].used < entries[oldest].used) oldest = i;
+        }
+        entry_remove(oldest, &dropped[count++]);
+    }
+    return count;
+}
+
+static void unref_all(VipsImage** images, int count) {
+    for (int i = 0; i < count; i++) g_object_unref(images[i]);
+    g_free(images);
+}
+
+void thinpic_decode_cache_set_budget(int64_t max_bytes) {
+    if (max_bytes < 0) max_bytes = 0;
+    pthread_mutex_lock(&cache_mutex);
+    cache_budget = max_bytes;
+    VipsImage** dropped = g_new(VipsImage*, entry_count + 1);
+    int count = cache_evict(dropped);
+    pthread_mutex_unlock(&cache_mutex);
+    unref_all(dropped, count);
+    THINPIC_LOGI("Decode cache: %lld bytes", (long long)max_bytes);
+}
+
+int64_t thinpic_decode_cache_budget(void) {
+    pthread_mutex_lock(&cache_mutex);
+    int64_t budget = cache_budget;
+    pthread_mutex_unlock(&cache_mutex);
+    return budget;
+}
+
+int thinpic_decode_cache_key(const char* path, const void* params, size_t params_length,
+                             ThinpicCacheKey* key) {
+    memset(key, 0, sizeof(*key));
+    struct stat file_stat;
+    if (!path || thinpic_decode_cache_budget() <= 0 || stat(path, &file_stat) != 0 ||
+            !S_ISREG(file_stat.st_mode)) {
+        return 0;
+    }
+    int64_t identity[5] = {(int64_t)file_stat.st_dev, (int64_t)file_stat.st_ino,
+                           (int64_t)file_stat.st_size, (int64_t)file_stat.st_mtim.tv_sec,
+                           (int64_t)file_stat.st_mtim.tv_nsec};
+    uint64_t high = fnv1a(0xCBF29CE484222325ull, path, strlen(path) + 1);
+    high = fnv1a(high, params, params_length);
+    uint64_t low = fnv1a(0x84222325CBF29CE4ull, identity, sizeof(identity));
+    low = fnv1a(low, &params_length, sizeof(params_length));
+    key->high = avalanche(high);
+    key->low = avalanche(low ^ key->high);
+    return 1;
+}
+
+VipsImage* thinpic_decode_cache_lookup(const ThinpicCacheKey* key) {
+    if (!key->high && !key->low) return NULL;
+    VipsImage* image = NULL;
+    pthread_mutex_lock(&cache_mutex);
+    int index = entry_find(key);
+    if (index >= 0) {
+        entries[index].used = ++use_counter;
+        image = entries[index].image;
+        g_object_ref(image);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (image) {
+        THINPIC_LOGD("Decode cache hit: %dx%d", vips_image_get_width(image), vips_image_get_height(image));
+    }
+    return image;
+}
+
+void thinpic_decode_cache_store(const ThinpicCacheKey* key, VipsImage* image) {
+    if ((!key->high && !key->low) || !image) return;
+    int64_t bytes = (int64_t)VIPS_IMAGE_SIZEOF_IMAGE(image);
+    pthread_mutex_lock(&cache_mutex);
+    if (bytes > cache_budget) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+    VipsImage** dropped = g_new(VipsImage*, entry_count + 2);
+    int count = 0;
+    int index = entry_find(key);
+    if (index >= 0) entry_remove(index, &dropped[count++]);
+    if (entry_count == entry_capacity) {
+        int capacity = entry_capacity ? entry_capacity * 2 : 8;
+        CacheEntry* grown = (CacheEntry*)realloc(entries, (size_t)capacity * sizeof(CacheEntry));
+        if (!grown) {
+            pthread_mutex_unlock(&cache_mutex);
+            unref_all(dropped, count);
+            return;
+        }
+        entries = grown;
+        entry_capacity = capacity;
+    }
+    g_object_ref(image);
+    entries[entry_count].key = *key;
+    entries[entry_count].image = image;
+    entries[entry_count].bytes = bytes;
+    entries[entry_count].used = ++use_counter;
+    entry_count++;
+    total_bytes += bytes;
+    count += cache_evict(dropped + count);
+    pthread_mutex_unlock(&cache_mutex);
+    unref_all(dropped, count);
+}
+
+void thinpic_decode_cache_drain(void) {
+    pthread_mutex_lock(&cache_mutex);
+    VipsImage** dropped = g_new(VipsImage*, entry_count + 1);
+    int count = 0;
+    while (entry_count > 0) entry_remove(entry_count - 1, &dropped[count++]);
+    pthread_mutex_unlock(&cache_mutex);
+    unref_all(dropped, count);
+}
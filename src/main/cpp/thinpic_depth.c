@@ -0,0 +1,168 @@
+// 16-bit and HDR inputs brought down to 8 bits (thinpic_to_8bit) for the
+// formats that only store 8: DSLR TIFFs and 16-bit PNGs otherwise go
+// through the colour transform, flattening and the saver's implicit cast
+// as ushort, twice the bytes per stage. The conversion runs once, after
+// the resize, as a plain loop per region the compiler vectorizes. Values
+// round to nearest, or (thinpic_configure dither_high_depth) through a 4x4
+// ordered dither that keeps smooth skies from banding. Linear float input
+// (scRGB, from EXR-like TIFFs) whose highlights pass 1.0 gets a soft knee
+// above 0.8 instead of being clipped by vips_colourspace; SDR content
+// below the knee is untouched.
+
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define KNEE 0.8f
+
+static int dither_enabled = 0;
+
+// Bayer thresholds, (2b + 1) in 32nds of one output step
+static const uint8_t bayer[4][4] = {
+    {1, 17, 5, 21},
+    {25, 9, 29, 13},
+    {7, 23, 3, 19},
+    {31, 15, 27, 11},
+};
+
+void thinpic_set_dither_high_depth(int enabled) {
+    __atomic_store_n(&dither_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static int narrow_generate(VipsRegion* out_region, void* seq, void* a, void* b, gboolean* stop) {
+    VipsRegion* in_region = (VipsRegion*)seq;
+    int dither = (int)(intptr_t)b;
+    VipsRect* rect = &out_region->valid;
+    int bands = out_region->im->Bands;
+    (void)a;
+    (void)stop;
+    if (vips_region_prepare(in_region, rect)) return -1;
+    int samples = rect->width * bands;
+    for (int y = 0; y < rect->height; y++) {
+        const uint16_t* in = (const uint16_t*)VIPS_REGION_ADDR(in_region, rect->left, rect->top + y);
+        uint8_t* out = (uint8_t*)VIPS_REGION_ADDR(out_region, rect->left, rect->top + y);
+        if (!dither) {
+            // v / 257 to nearest; 65535 lands on 255
+            for (int i = 0; i < samples; i++) out[i] = (uint8_t)(((uint32_t)in[i] + 128) / 257);
+            continue;
+        }
+        const uint8_t* row = bayer[(rect->top + y) & 3];
+        for (int x = 0; x < rect->width; x++) {
+            uint32_t threshold = (uint32_t)row[(rect->left + x) & 3] * 257;
+            for (int c = 0; c < bands; c++) {
+                int i = x * bands + c;
+                out[i] = (uint8_t)(((uint32_t)in[i] * 32 + threshold) / (257 * 32));
+            }
+        }
+    }
+    return 0;
+}
+
+static int knee_generate(VipsRegion* out_region, void* seq, void* a, void* b, gboolean* stop) {
+    VipsRegion* in_region = (VipsRegion*)seq;
+    float peak = *(const float*)b;
+    VipsRect* rect = &out_region->valid;
+    int bands = out_region->im->Bands;
+    // Colour channels only; a fourth band is alpha
+    int colours = bands > 3 ? 3 : bands;
+    // v = KNEE + u / (1 + b u) for u = v - KNEE: slope 1 at the knee, 1.0 at
+    // the peak
+    float b_coefficient = 1.0f / (1.0f - KNEE) - 1.0f / (peak - KNEE);
+    (void)a;
+    (void)stop;
+    if (vips_region_prepare(in_region, rect)) return -1;
+    for (int y = 0; y < rect->height; y++) {
+        const float* in = (const float*)VIPS_REGION_ADDR(in_region, rect->left, rect->top + y);
+        float* out = (float*)VIPS_REGION_ADDR(out_region, rect->left, rect->top + y);
+        for (int x = 0; x < rect->width; x++) {
+            for (int c = 0; c < bands; c++) {
+                float v = in[x * bands + c];
+                if (c < colours && v > KNEE) {
+                    float u = v - KNEE;
+                    v = KNEE + u / (1.0f + b_coefficient * u);
+                    if (v > 1.0f) v = 1.0f;
+                }
+                out[x * bands + c] = v;
+            }
+        }
+    }
+    return 0;
+}
+
+int thinpic_pipe_image(VipsImage* in, VipsImage** out, VipsBandFormat format, VipsInterpretation interpretation,
+                       VipsGenerateFn generate, void* argument) {
+    VipsImage* image = vips_image_new();
+    if (vips_image_pipelinev(image, VIPS_DEMAND_STYLE_THINSTRIP, in, NULL)) {
+        g_object_unref(image);
+        return -1;
+    }
+    image->BandFmt = format;
+    image->Type = interpretation;
+    if (vips_image_generate(image, vips_start_one, generate, vips_stop_one, in, argument)) {
+        g_object_unref(image);
+        return -1;
+    }
+    *out = image;
+    return 0;
+}
+
+static void free_peak(VipsImage* image, gpointer peak) {
+    (void)image;
+    g_free(peak);
+}
+
+int thinpic_to_8bit(VipsImage* image, VipsImage** out) {
+    VipsBandFormat format = vips_image_get_format(image);
+    VipsInterpretation interpretation = vips_image_get_interpretation(image);
+
+    if (format == VIPS_FORMAT_USHORT) {
+        VipsInterpretation narrowed;
+        switch (interpretation) {
+            case VIPS_INTERPRETATION_RGB16: narrowed = VIPS_INTERPRETATION_sRGB; break;
+            case VIPS_INTERPRETATION_GREY16: narrowed = VIPS_INTERPRETATION_B_W; break;
+            case VIPS_INTERPRETATION_sRGB:
+            case VIPS_INTERPRETATION_RGB:
+            case VIPS_INTERPRETATION_B_W:
+            case VIPS_INTERPRETATION_CMYK:
+            case VIPS_INTERPRETATION_MULTIBAND: narrowed = interpretation; break;
+            default: return 0;  // Lab and friends are not plain 0-65535 ranges
+        }
+        int dither = __atomic_load_n(&dither_enabled, __ATOMIC_RELAXED);
+        if (thinpic_pipe_image(image, out, VIPS_FORMAT_UCHAR, narrowed, narrow_generate, (void*)(intptr_t)dither)) {
+            return -1;
+        }
+        THINPIC_LOGD("Depth: 16-bit %dx%d narrowed to 8 (dither %d)", vips_image_get_width(image),
+                     vips_image_get_height(image), dither);
+        return 1;
+    }
+
+    if (format == VIPS_FORMAT_FLOAT && interpretation == VIPS_INTERPRETATION_scRGB) {
+        // One pass over the resized image for the brightest colour
+        VipsImage* colours = NULL;
+        double peak = 0;
+        int bands = vips_image_get_bands(image);
+        if (vips_extract_band(image, &colours, 0, "n", bands > 3 ? 3 : bands, NULL) ||
+                vips_max(colours, &peak, NULL)) {
+            if (colours) g_object_unref(colours);
+            vips_error_clear();
+            return 0;
+        }
+        g_object_unref(colours);
+        if (peak <= 1.0) return 0;
+
+        float* knee_peak = g_new(float, 1);
+        *knee_peak = (float)peak;
+        VipsImage* mapped = NULL;
+        if (thinpic_pipe_image(image, &mapped, VIPS_FORMAT_FLOAT, VIPS_INTERPRETATION_scRGB, knee_generate, knee_peak)) {
+            g_free(knee_peak);
+            return -1;
+        }
+        g_signal_connect(mapped, "postclose", G_CALLBACK(free_peak), knee_peak);
+        int failed = vips_colourspace(mapped, out, VIPS_INTERPRETATION_sRGB, NULL);
+        g_object_unref(mapped);
+        if (failed) return -1;
+        THINPIC_LOGD("Depth: HDR peak %.2f tone-mapped to 8-bit sRGB", peak);
+        return 1;
+    }
+    return 0;
+}
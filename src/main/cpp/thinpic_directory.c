@@ -0,0 +1,464 @@
+// Resumable directory compression (compress_directory). Every image of a
+// directory, or every line of a list file, goes through the worker pool as
+// a file job; each finished item is appended to a manifest as one
+// "<bytes>\t<input path>\n" line (bytes -1 for a failure) and synced, so a
+// process killed mid-batch resumes from the manifest on the next call. A
+// line cut short by the kill has no newline and is ignored; outputs are
+// written through a temp file and rename, so none is ever half written.
+//
+// sync_directory runs the same batch against an index instead, for a folder
+// that is synced again and again: each line also carries the input's mtime,
+// size and a hash of the options, so an input is redone only when it is new,
+// has changed, was compressed with other options, or its output is gone. A
+// repeated sync of an unchanged folder costs one stat per file. The index is
+// appended to as items finish, like the manifest, and rewritten at the end
+// without the lines a newer one replaced or whose input has gone.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Jobs submitted ahead of the one being waited on: enough to keep every
+// pool worker busy without queueing the whole directory
+#define DIRECTORY_WINDOW 16
+
+static const char* image_extensions[] = {
+    "jpg", "jpeg", "png", "webp", "tif", "tiff", "heic", "heif", "jp2", "j2k", "jxl", "gif", "avif",
+};
+
+// Extension written for each ImageFormat (FORMAT_AUTO keeps the input's)
+static const char* format_extensions[THINPIC_FORMAT_COUNT] = {
+    "jpg", "png", "webp", "tiff", "heic", "jp2", "jxl", "gif", NULL, "avif",
+};
+
+static int has_image_extension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (!dot) return 0;
+    for (size_t i = 0; i < sizeof(image_extensions) / sizeof(image_extensions[0]); i++) {
+        if (g_ascii_strcasecmp(dot + 1, image_extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Images of a directory (sorted, hidden files skipped) or the non-empty
+// lines of a list file; NULL if source cannot be read
+static GPtrArray* list_inputs(const char* source) {
+    struct stat info;
+    if (stat(source, &info) != 0) return NULL;
+    GPtrArray* paths = g_ptr_array_new_with_free_func(g_free);
+    if (S_ISDIR(info.st_mode)) {
+        GDir* dir = g_dir_open(source, 0, NULL);
+        if (!dir) {
+            g_ptr_array_unref(paths);
+            return NULL;
+        }
+        const gchar* name = NULL;
+        while ((name = g_dir_read_name(dir))) {
+            if (name[0] == '.' || !has_image_extension(name)) continue;
+            gchar* path = g_build_filename(source, name, NULL);
+            if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+                g_ptr_array_add(paths, path);
+            } else {
+                g_free(path);
+            }
+        }
+        g_dir_close(dir);
+        g_ptr_array_sort(paths, compare_paths);
+        return paths;
+    }
+    gchar* contents = NULL;
+    if (!g_file_get_contents(source, &contents, NULL, NULL)) {
+        g_ptr_array_unref(paths);
+        return NULL;
+    }
+    gchar** lines = g_strsplit(contents, "\n", -1);
+    for (gchar** line = lines; *line; line++) {
+        g_strchomp(*line);
+        if ((*line)[0] != '\0') g_ptr_array_add(paths, g_strdup(*line));
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    return paths;
+}
+
+// Inputs the manifest already records, finished or failed; a missing
+// manifest is an empty one
+static GHashTable* read_manifest(const char* manifest_path, int* done) {
+    GHashTable* recorded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    *done = 0;
+    gchar* contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(manifest_path, &contents, &length, NULL)) return recorded;
+    char* line = contents;
+    char* end = contents + length;
+    while (line < end) {
+        char* newline = memchr(line, '\n', (size_t)(end - line));
+        if (!newline) break;
+        *newline = '\0';
+        char* tab = strchr(line, '\t');
+        if (tab && tab[1] != '\0') {
+            if (strtoll(line, NULL, 10) >= 0) (*done)++;
+            g_hash_table_add(recorded, g_strdup(tab + 1));
+        }
+        line = newline + 1;
+    }
+    g_free(contents);
+    return recorded;
+}
+
+// output_dir/<input name without its extension>.<format extension>
+static gchar* output_path_for(const char* input_path, const char* output_dir, ImageFormat format) {
+    gchar* name = g_path_get_basename(input_path);
+    char* dot = strrchr(name, '.');
+    const char* extension = thinpic_concrete_format(format) ? format_extensions[format]
+                            : dot ? dot + 1 : "jpg";
+    gchar* stem = dot ? g_strndup(name, (gsize)(dot - name)) : g_strdup(name);
+    gchar* file_name = g_strconcat(stem, ".", extension, NULL);
+    gchar* path = g_build_filename(output_dir, file_name, NULL);
+    g_free(file_name);
+    g_free(stem);
+    g_free(name);
+    return path;
+}
+
+// Appends "<bytes>\t[<stamp>\t]<input path>\n"; stamp carries the fields
+// an index records between the two
+static int append_record(int fd, const char* input_path, int64_t bytes, const char* stamp) {
+    gchar* line = stamp ? g_strdup_printf("%lld\t%s\t%s\n", (long long)bytes, stamp, input_path)
+                        : g_strdup_printf("%lld\t%s\n", (long long)bytes, input_path);
+    size_t length = strlen(line);
+    ssize_t written = write(fd, line, length);
+    g_free(line);
+    // The record must outlive a kill that follows it
+    return written == (ssize_t)length && fsync(fd) == 0 ? 0 : -1;
+}
+
+typedef enum {
+    ITEM_RUN = 0,
+    ITEM_SKIP,          // Recorded already; counted (or not) before the run
+    ITEM_UP_TO_DATE     // Left as it is and counted as done
+} ItemAction;
+
+// What a run does with each input: the manifest's and the index's rules
+typedef struct {
+    // ITEM_RUN sets *stamp (g_free'd once recorded) or leaves it NULL
+    ItemAction (*decide)(void* data, const char* input_path, const char* output_path, gchar** stamp);
+    void* data;
+} ItemFilter;
+
+typedef struct {
+    int64_t job_id;
+    const char* input_path;
+    gchar* stamp;
+} PendingItem;
+
+// Wait for the oldest pending item and record it; returns 1 if it succeeded
+static int finish_item(PendingItem* item, int record_fd, int* record_failed) {
+    CompressedImageResult result = {NULL, 0, -1};
+    JobStatus status = thinpic_wait_job(item->job_id, &result);
+    if (result.data) free_compressed_buffer(result.data);
+    int succeeded = status == JOB_STATUS_DONE && result.success == 1;
+    if (!succeeded) THINPIC_LOGW("Directory item failed: %s", item->input_path);
+    // Cancelled jobs are left unrecorded so the next run retries them
+    if (status != JOB_STATUS_CANCELLED && !*record_failed &&
+            append_record(record_fd, item->input_path, succeeded ? (int64_t)result.length : -1, item->stamp) != 0) {
+        THINPIC_LOGE("Error: Cannot append to the record (%s); later items will be redone", strerror(errno));
+        *record_failed = 1;
+    }
+    g_free(item->stamp);
+    item->stamp = NULL;
+    return succeeded;
+}
+
+static int stop_requested(ThinpicDirectoryProgress* progress) {
+    return progress && __atomic_load_n(&progress->stop, __ATOMIC_ACQUIRE);
+}
+
+// Every input the filter passes goes through the pool, DIRECTORY_WINDOW at
+// a time, and is recorded to record_fd as it finishes; returns the inputs
+// done, counting from `done`
+static int run_inputs(GPtrArray* inputs, const char* output_dir, const CompressOptions* options, int record_fd,
+                      const ItemFilter* filter, int done, ThinpicDirectoryProgress* progress, int* submitted) {
+    PendingItem window[DIRECTORY_WINDOW];
+    int head = 0, pending = 0, record_failed = 0;
+    *submitted = 0;
+    for (guint i = 0; i <= inputs->len; i++) {
+        // A stop submits nothing more and cancels what is pending, which
+        // the record leaves for the next run
+        int stopping = stop_requested(progress);
+        const char* input_path = i < inputs->len && !stopping ? (const char*)g_ptr_array_index(inputs, i) : NULL;
+        gchar* output_path = NULL;
+        gchar* stamp = NULL;
+        // Paths with a newline cannot be recorded, so they are not started
+        if (input_path) {
+            if (strchr(input_path, '\n')) continue;
+            output_path = output_path_for(input_path, output_dir, options->format);
+            ItemAction action = filter->decide(filter->data, input_path, output_path, &stamp);
+            if (action != ITEM_RUN) {
+                g_free(output_path);
+                if (action == ITEM_UP_TO_DATE) {
+                    done++;
+                    if (progress) __atomic_store_n(&progress->done, done, __ATOMIC_RELEASE);
+                }
+                continue;
+            }
+        }
+
+        while (pending > 0 && (pending == DIRECTORY_WINDOW || !input_path)) {
+            if (stopping) thinpic_cancel_job(window[head].job_id);
+            done += finish_item(&window[head], record_fd, &record_failed);
+            if (progress) __atomic_store_n(&progress->done, done, __ATOMIC_RELEASE);
+            head = (head + 1) % DIRECTORY_WINDOW;
+            pending--;
+        }
+        if (!input_path) break;
+
+        int64_t job_id = thinpic_submit_file_job(input_path, output_path, options);
+        g_free(output_path);
+        if (job_id < 0) {
+            THINPIC_LOGW("Directory item not started: %s", input_path);
+            g_free(stamp);
+            continue;
+        }
+        window[(head + pending) % DIRECTORY_WINDOW] = (PendingItem){job_id, input_path, stamp};
+        pending++;
+        (*submitted)++;
+    }
+    return done;
+}
+
+static int check_arguments(const char* source, const char* output_dir, const char* record_path,
+                           const CompressOptions* options) {
+    return source && output_dir && record_path && options && strlen(source) > 0 && strlen(output_dir) > 0 &&
+           strlen(record_path) > 0;
+}
+
+// The inputs of source, with output_dir created; NULL on failure
+static GPtrArray* prepare_inputs(const char* source, const char* output_dir) {
+    GPtrArray* inputs = list_inputs(source);
+    if (!inputs) {
+        THINPIC_LOGE("Error: Cannot read inputs from %s", source);
+        return NULL;
+    }
+    if (g_mkdir_with_parents(output_dir, 0755) != 0) {
+        THINPIC_LOGE("Error: Cannot create output directory %s", output_dir);
+        g_ptr_array_unref(inputs);
+        return NULL;
+    }
+    return inputs;
+}
+
+static ItemAction manifest_decide(void* data, const char* input_path, const char* output_path, gchar** stamp) {
+    (void)output_path;
+    (void)stamp;
+    return g_hash_table_contains((GHashTable*)data, input_path) ? ITEM_SKIP : ITEM_RUN;
+}
+
+int thinpic_compress_directory_tracked(const char* source, const char* output_dir, const char* manifest_path,
+                                       const CompressOptions* options, ThinpicDirectoryProgress* progress) {
+    if (!check_arguments(source, output_dir, manifest_path, options)) {
+        THINPIC_LOGE("Error: Invalid compress_directory arguments");
+        return -1;
+    }
+    GPtrArray* inputs = prepare_inputs(source, output_dir);
+    if (!inputs) return -1;
+    int done = 0;
+    GHashTable* recorded = read_manifest(manifest_path, &done);
+    int manifest_fd = open(manifest_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (manifest_fd < 0) {
+        THINPIC_LOGE("Error: Cannot open manifest %s", manifest_path);
+        g_hash_table_unref(recorded);
+        g_ptr_array_unref(inputs);
+        return -1;
+    }
+    int resumed = (int)g_hash_table_size(recorded);
+    if (progress) {
+        __atomic_store_n(&progress->done, done, __ATOMIC_RELEASE);
+        __atomic_store_n(&progress->total, (int)inputs->len, __ATOMIC_RELEASE);
+    }
+
+    ItemFilter filter = {manifest_decide, recorded};
+    int submitted = 0;
+    done = run_inputs(inputs, output_dir, options, manifest_fd, &filter, done, progress, &submitted);
+    close(manifest_fd);
+
+    THINPIC_LOGI("compress_directory: %d of %u inputs done (%d resumed from the manifest, %d run now)%s",
+                 done, inputs->len, resumed, submitted, stop_requested(progress) ? ", stopped" : "");
+    g_hash_table_unref(recorded);
+    g_ptr_array_unref(inputs);
+    return done;
+}
+
+int compress_directory(const char* source, const char* output_dir, const char* manifest_path,
+                       const CompressOptions* options) {
+    return thinpic_compress_directory_tracked(source, output_dir, manifest_path, options, NULL);
+}
+
+// One index line: "<bytes>\t<mtime ns>\t<size>\t<options hash>\t<input path>"
+typedef struct {
+    int64_t bytes;      // -1 for a recorded failure
+    gchar* stamp;       // "<mtime ns>\t<size>\t<options hash>"
+} IndexEntry;
+
+static void free_index_entry(gpointer data) {
+    IndexEntry* entry = data;
+    g_free(entry->stamp);
+    g_free(entry);
+}
+
+// The index by input path, the later of two lines for one path winning;
+// *lines counts every complete line read, so the caller can tell how much
+// of the file has been superseded
+static GHashTable* read_index(const char* index_path, int* lines) {
+    GHashTable* index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_index_entry);
+    *lines = 0;
+    gchar* contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(index_path, &contents, &length, NULL)) return index;
+    char* line = contents;
+    char* end = contents + length;
+    while (line < end) {
+        char* newline = memchr(line, '\n', (size_t)(end - line));
+        if (!newline) break;
+        *newline = '\0';
+        // bytes, then the three stamp fields, then the path
+        char* fields[4];
+        char* cursor = line;
+        int found = 0;
+        for (; found < 4; found++) {
+            fields[found] = strchr(cursor, '\t');
+            if (!fields[found]) break;
+            cursor = fields[found] + 1;
+        }
+        if (found == 4 && cursor[0] != '\0') {
+            IndexEntry* entry = g_new0(IndexEntry, 1);
+            entry->bytes = strtoll(line, NULL, 10);
+            entry->stamp = g_strndup(fields[0] + 1, (gsize)(fields[3] - fields[0] - 1));
+            g_hash_table_replace(index, g_strdup(cursor), entry);
+            (*lines)++;
+        }
+        line = newline + 1;
+    }
+    g_free(contents);
+    return index;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Only what changes the output: priority and client decide when a job
+// runs, not what it writes
+static uint64_t options_hash(const CompressOptions* options) {
+    CompressOptions key = *options;
+    key.priority = 0;
+    key.client = 0;
+    return fnv1a(0xCBF29CE484222325ull, &key, sizeof(key));
+}
+
+typedef struct {
+    GHashTable* index;
+    uint64_t options_hash;
+} SyncFilter;
+
+static ItemAction sync_decide(void* data, const char* input_path, const char* output_path, gchar** stamp) {
+    SyncFilter* sync = data;
+    struct stat info;
+    // Gone since it was listed; nothing to do and nothing to record
+    if (stat(input_path, &info) != 0) return ITEM_SKIP;
+    gchar* current = g_strdup_printf("%lld\t%lld\t%016llx",
+                                     (long long)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec,
+                                     (long long)info.st_size, (unsigned long long)sync->options_hash);
+    IndexEntry* entry = g_hash_table_lookup(sync->index, input_path);
+    if (entry && strcmp(entry->stamp, current) == 0) {
+        if (entry->bytes < 0) {
+            // The same file failed with the same options before
+            g_free(current);
+            return ITEM_SKIP;
+        }
+        if (g_file_test(output_path, G_FILE_TEST_IS_REGULAR)) {
+            g_free(current);
+            return ITEM_UP_TO_DATE;
+        }
+    }
+    *stamp = current;
+    return ITEM_RUN;
+}
+
+// Rewrites the index with one line per input still listed, through a temp
+// file and rename so a kill mid-way leaves the old one
+static void compact_index(const char* index_path, GPtrArray* inputs) {
+    int lines = 0;
+    GHashTable* index = read_index(index_path, &lines);
+    GString* contents = g_string_new(NULL);
+    int kept = 0;
+    for (guint i = 0; i < inputs->len; i++) {
+        const char* input_path = g_ptr_array_index(inputs, i);
+        IndexEntry* entry = g_hash_table_lookup(index, input_path);
+        if (!entry) continue;
+        g_string_append_printf(contents, "%lld\t%s\t%s\n", (long long)entry->bytes, entry->stamp, input_path);
+        kept++;
+    }
+    if (kept < lines) {
+        gchar* temp_path = g_strdup_printf("%s.%d.tmp", index_path, (int)getpid());
+        int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        int written = fd >= 0 && write(fd, contents->str, contents->len) == (ssize_t)contents->len &&
+                      fsync(fd) == 0;
+        if (fd >= 0) close(fd);
+        if (!written || rename(temp_path, index_path) != 0) {
+            THINPIC_LOGW("Sync index %s could not be compacted", index_path);
+            unlink(temp_path);
+        } else {
+            THINPIC_LOGD("Sync index compacted from %d to %d lines", lines, kept);
+        }
+        g_free(temp_path);
+    }
+    g_string_free(contents, TRUE);
+    g_hash_table_unref(index);
+}
+
+int sync_directory(const char* source, const char* output_dir, const char* index_path,
+                   const CompressOptions* options) {
+    if (!check_arguments(source, output_dir, index_path, options)) {
+        THINPIC_LOGE("Error: Invalid sync_directory arguments");
+        return -1;
+    }
+    GPtrArray* inputs = prepare_inputs(source, output_dir);
+    if (!inputs) return -1;
+    int lines = 0;
+    SyncFilter sync = {read_index(index_path, &lines), options_hash(options)};
+    int index_fd = open(index_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (index_fd < 0) {
+        THINPIC_LOGE("Error: Cannot open sync index %s", index_path);
+        g_hash_table_unref(sync.index);
+        g_ptr_array_unref(inputs);
+        return -1;
+    }
+
+    ItemFilter filter = {sync_decide, &sync};
+    int submitted = 0;
+    int done = run_inputs(inputs, output_dir, options, index_fd, &filter, 0, NULL, &submitted);
+    close(index_fd);
+    g_hash_table_unref(sync.index);
+    compact_index(index_path, inputs);
+
+    THINPIC_LOGI("sync_directory: %d of %u inputs up to date (%d run now)", done, inputs->len, submitted);
+    g_ptr_array_unref(inputs);
+    return done;
+}
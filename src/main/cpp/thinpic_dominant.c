@@ -0,0 +1,121 @@
+// Dominant colours (ThinpicOptions palette_colours) from the colour grid the
+// hash tap averages out of the encoder's strips, so a feed can tint its
+// cards without decoding each image again in Dart. The grid is at most 32
+// cells on the long side: each cell is already a mean of the resized image,
+// which is what a dominant colour should be taken from, and its thousand
+// cells make a palette search take microseconds. Median cut seeds the
+// clusters (the PNG quantizer's, thinpic_png_palette.c) and k-means rounds
+// settle them on the colours the cells actually gather around, which the
+// box means of a plain median cut tend to fall between. Cells count by their
+// alpha, so a logo's transparent surround does not end up in its palette.
+
+#include <string.h>
+
+#include "thinpic_internal.h"
+
+#define KMEANS_ROUNDS 8
+// Cells fainter than this are left out of the palette
+#define MIN_ALPHA 32
+
+typedef struct {
+    double centre[3];
+    double sum[3];
+    double weight;
+} Cluster;
+
+static int nearest_cluster(const Cluster* clusters, int count, const uint8_t* rgb) {
+    int best = 0;
+    double best_distance = -1;
+    for (int k = 0; k < count; k++) {
+        double distance = 0;
+        for (int c = 0; c < 3; c++) {
+            double d = rgb[c] - clusters[k].centre[c];
+            distance += d * d;
+        }
+        if (best_distance < 0 || distance < best_distance) {
+            best_distance = distance;
+            best = k;
+        }
+    }
+    return best;
+}
+
+void thinpic_dominant_colours(const ThinpicColourGrid* grid, int colours, ThinpicResult* out) {
+    out->palette_count = 0;
+    if (colours > THINPIC_PALETTE_MAX) colours = THINPIC_PALETTE_MAX;
+    int cells = grid->width * grid->height;
+
+    // Opaque cells as median-cut samples, alpha packed as 255 so it is
+    // never the channel a box is split along
+    uint32_t samples[THINPIC_GRID_MAX * THINPIC_GRID_MAX];
+    int sample_count = 0;
+    for (int i = 0; i < cells; i++) {
+        const uint8_t* cell = grid->rgba + i * 4;
+        if (cell[3] < MIN_ALPHA) continue;
+        samples[sample_count++] = (uint32_t)cell[0] | ((uint32_t)cell[1] << 8) | ((uint32_t)cell[2] << 16) |
+                                  0xFF000000u;
+    }
+    if (sample_count == 0 || colours < 1) return;
+
+    uint32_t seeds[THINPIC_PALETTE_MAX];
+    int count = thinpic_median_cut(samples, sample_count, colours, seeds);
+    Cluster clusters[THINPIC_PALETTE_MAX];
+    memset(clusters, 0, sizeof(clusters));
+    for (int k = 0; k < count; k++) {
+        for (int c = 0; c < 3; c++) clusters[k].centre[c] = (seeds[k] >> (c * 8)) & 0xFF;
+    }
+
+    for (int round = 0; round < KMEANS_ROUNDS; round++) {
+        for (int k = 0; k < count; k++) {
+            memset(clusters[k].sum, 0, sizeof(clusters[k].sum));
+            clusters[k].weight = 0;
+        }
+        for (int i = 0; i < cells; i++) {
+            const uint8_t* cell = grid->rgba + i * 4;
+            if (cell[3] < MIN_ALPHA) continue;
+            Cluster* cluster = &clusters[nearest_cluster(clusters, count, cell)];
+            double weight = cell[3] / 255.0;
+            for (int c = 0; c < 3; c++) cluster->sum[c] += cell[c] * weight;
+            cluster->weight += weight;
+        }
+        // Stop once no centre moves by a level; an empty cluster keeps its
+        // centre and drops out below
+        double moved = 0;
+        for (int k = 0; k < count; k++) {
+            if (clusters[k].weight <= 0) continue;
+            for (int c = 0; c < 3; c++) {
+                double centre = clusters[k].sum[c] / clusters[k].weight;
+                double d = centre > clusters[k].centre[c] ? centre - clusters[k].centre[c]
+                                                          : clusters[k].centre[c] - centre;
+                if (d > moved) moved = d;
+                clusters[k].centre[c] = centre;
+            }
+        }
+        if (moved < 1.0) break;
+    }
+
+    double total = 0;
+    for (int k = 0; k < count; k++) total += clusters[k].weight;
+    if (total <= 0) return;
+
+    // Largest share first; a handful of entries, so insertion sort
+    int order[THINPIC_PALETTE_MAX];
+    int kept = 0;
+    for (int k = 0; k < count; k++) {
+        if (clusters[k].weight <= 0) continue;
+        int at = kept++;
+        while (at > 0 && clusters[order[at - 1]].weight < clusters[k].weight) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = k;
+    }
+    for (int i = 0; i < kept; i++) {
+        const Cluster* cluster = &clusters[order[i]];
+        uint32_t rgb = 0;
+        for (int c = 0; c < 3; c++) rgb = (rgb << 8) | (uint32_t)(cluster->centre[c] + 0.5);
+        out->palette[i] = rgb;
+        out->palette_share[i] = cluster->weight / total;
+    }
+    out->palette_count = kept;
+}
@@ -0,0 +1,75 @@
+// Per-thread failure capture for ThinpicError. libvips keeps one error
+// buffer for the whole process, so with jobs running in parallel one job's
+// vips_error_clear wipes another's message and a failing job can read a
+// neighbour's text. Instead every error-level log line also lands in a
+// thread-local record (first line, then the detail lines after it), the
+// helpers that know why they failed set a code, and the job copies the
+// record into its result when it finishes. Nothing here takes a lock.
+
+#include <string.h>
+
+#include "thinpic_internal.h"
+
+static __thread ThinpicError current;
+static __thread size_t message_length = 0;
+
+void thinpic_error_reset(void) {
+    current.code = THINPIC_ERROR_NONE;
+    current.message[0] = '\0';
+    message_length = 0;
+}
+
+void thinpic_error_code(ThinpicErrorCode code) {
+    if (current.code == THINPIC_ERROR_NONE) current.code = code;
+}
+
+void thinpic_error_note(const char* message) {
+    size_t room = sizeof(current.message) - 1 - message_length;
+    if (message_length > 0) {
+        // Later lines are detail for the first ("VIPS error: ...")
+        if (room < 3) return;
+        memcpy(current.message + message_length, "; ", 2);
+        message_length += 2;
+        room -= 2;
+    }
+    size_t length = strlen(message);
+    if (length > room) length = room;
+    memcpy(current.message + message_length, message, length);
+    message_length += length;
+    current.message[message_length] = '\0';
+}
+
+static const char* code_message(int code) {
+    switch (code) {
+        case THINPIC_ERROR_INVALID_ARGUMENT: return "Invalid argument";
+        case THINPIC_ERROR_DECODE: return "Input could not be decoded";
+        case THINPIC_ERROR_PROCESS: return "Image processing failed";
+        case THINPIC_ERROR_ENCODE: return "Encoding failed";
+        case THINPIC_ERROR_IO: return "Output could not be written";
+        case THINPIC_ERROR_CANCELLED: return "Cancelled";
+        case THINPIC_ERROR_LIMIT: return "Input exceeds the configured limits";
+        case THINPIC_ERROR_TIMEOUT: return "Timed out";
+        default: return "Compression failed";
+    }
+}
+
+void thinpic_error_take(ThinpicError* out) {
+    *out = current;
+    if (out->code == THINPIC_ERROR_NONE) out->code = THINPIC_ERROR_FAILED;
+    if (out->message[0] == '\0') {
+        strncpy(out->message, code_message(out->code), sizeof(out->message) - 1);
+        out->message[sizeof(out->message) - 1] = '\0';
+    }
+    thinpic_error_reset();
+}
+
+int thinpic_last_error(ThinpicError* out) {
+    if (current.code == THINPIC_ERROR_NONE && message_length == 0) {
+        if (out) memset(out, 0, sizeof(*out));
+        return THINPIC_ERROR_NONE;
+    }
+    ThinpicError taken;
+    thinpic_error_take(&taken);
+    if (out) *out = taken;
+    return taken.code;
+}
@@ -0,0 +1,149 @@
+// Output size and cost predicted from the header alone
+// (thinpic_estimate_output), for a UI that shows "about 450 KB" before
+// anything is encoded and a scheduler that plans a batch's memory. Size is
+// output pixels times a bits-per-pixel curve for the format and quality,
+// measured on typical phone photos, scaled by how dense the source is
+// against what its own format usually takes for such a photo: a noisy
+// night shot or foliage is dense in every format, a screenshot saved as
+// PNG is sparse in every format. Downscaling packs more detail into each
+// pixel, so the rate grows as the output shrinks. Time comes from this
+// device's throughput model and memory from the same working-set model
+// the pool's budget charges. Expect errors of some tens of percent; the
+// target-size modes remain the way to hit a size.
+
+#include <math.h>
+#include <string.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// JPEG bits per pixel of a typical photo at quality 0, 10, ... 100,
+// 4:2:0 with optimized tables
+static const double jpeg_bpp[11] = {0.15, 0.25, 0.4, 0.52, 0.63, 0.74, 0.86, 1.05, 1.4, 2.3, 5.0};
+
+// Output rate against JPEG at the same quality, indexed by ImageFormat;
+// PNG and GIF are lossless or paletted and take their own rate below
+static const double format_ratio[THINPIC_FORMAT_COUNT] = {
+    1.0,   // JPEG
+    0,     // PNG
+    0.72,  // WebP
+    1.05,  // TIFF (JPEG-compressed tiles)
+    0.55,  // HEIF
+    0.8,   // JPEG 2000
+    0.65,  // JPEG XL
+    0,     // GIF
+    0,     // (FORMAT_AUTO)
+    0.5,   // AVIF
+};
+
+// What a typical photo takes in each source format, bits per pixel; the
+// source's own rate over this is its density
+static const double typical_source_bpp[THINPIC_FORMAT_COUNT] = {
+    2.4,   // JPEG, camera quality around 92
+    12.0,  // PNG, truecolour photo
+    1.3,   // WebP
+    16.0,  // TIFF, mostly uncompressed or deflated
+    1.0,   // HEIF
+    1.6,   // JPEG 2000
+    1.3,   // JPEG XL
+    4.0,   // GIF
+    2.4,   // (unknown source)
+    0.8,   // AVIF
+};
+
+#define PNG_PHOTO_BPP 12.0        // Truecolour photo, per three bands
+#define GIF_PHOTO_BPP 3.5         // Dithered 256-colour photo
+#define DENSITY_MIN 0.3           // Density is clamped to this range
+#define DENSITY_MAX 3.0
+#define DOWNSCALE_EXPONENT 0.3    // Rate grows as scale^-0.3 when shrinking
+#define CONTAINER_BYTES 600       // Headers, tables and segment markers
+
+static double lossy_bpp(int quality) {
+    double position = quality / 10.0;
+    int index = (int)position;
+    if (index >= 10) return jpeg_bpp[10];
+    return jpeg_bpp[index] + (jpeg_bpp[index + 1] - jpeg_bpp[index]) * (position - index);
+}
+
+static int keeps_alpha(ImageFormat format) {
+    return format != FORMAT_JPEG && format != FORMAT_JP2K;
+}
+
+ThinpicEstimate thinpic_estimate_output(const char* input_path, ImageFormat format, int quality,
+                                        int max_width, int max_height) {
+    ThinpicEstimate estimate;
+    memset(&estimate, 0, sizeof(estimate));
+    estimate.success = -1;
+
+    ImageHeader header = probe_image_header(input_path);
+    if (header.success != 1 || header.width <= 0 || header.height <= 0) return estimate;
+    // FORMAT_AUTO keeps the source's format, as thinpic_compress does
+    if (format == FORMAT_AUTO) format = thinpic_concrete_format(header.format) ? header.format : FORMAT_JPEG;
+    if (!thinpic_concrete_format(format)) {
+        THINPIC_LOGE("Error: Cannot estimate format %d", format);
+        return estimate;
+    }
+    if (quality <= 0 || quality > 100) quality = quality <= 0 ? 80 : 100;
+
+    // The box as the fixed-preset functions fit it: no upscaling
+    double scale = 1.0;
+    if (max_width > 0 && max_width < header.width) scale = (double)max_width / header.width;
+    if (max_height > 0 && max_height < header.height) scale = fmin(scale, (double)max_height / header.height);
+    estimate.width = (int)lround(header.width * scale);
+    estimate.height = (int)lround(header.height * scale);
+    if (estimate.width < 1) estimate.width = 1;
+    if (estimate.height < 1) estimate.height = 1;
+
+    double source_pixels = (double)header.width * header.height;
+    // A motion photo's video says nothing about the still's density
+    int64_t source_bytes = header.file_size;
+    ThinpicMotionPhoto motion;
+    if (header.format == FORMAT_JPEG && thinpic_motion_photo_probe(input_path, &motion) == 1) {
+        source_bytes = motion.still_length;
+    }
+    // Nor does an Ultra HDR gain map, which sits between the two
+    ThinpicInput input = {.path = input_path, .fd = -1};
+    ThinpicGainMapInfo gain_map;
+    if (header.format == FORMAT_JPEG && thinpic_gain_map_find(&input, &gain_map) &&
+            gain_map.offset + gain_map.length <= source_bytes) {
+        source_bytes -= gain_map.length;
+    }
+    estimate.source_bpp = source_bytes * 8.0 / source_pixels;
+    int source_format = thinpic_concrete_format(header.format) ? header.format : FORMAT_AUTO;
+    double density = estimate.source_bpp / typical_source_bpp[source_format];
+    density = fmin(DENSITY_MAX, fmax(DENSITY_MIN, density));
+
+    int alpha = (header.bands == 2 || header.bands == 4) && keeps_alpha(format);
+    double bpp;
+    if (format == FORMAT_PNG) {
+        bpp = PNG_PHOTO_BPP * (alpha ? 4.0 : 3.0) / 3.0;
+    } else if (format == FORMAT_GIF) {
+        bpp = GIF_PHOTO_BPP;
+    } else {
+        // An alpha plane costs a tenth more in the lossy formats that keep one
+        bpp = lossy_bpp(quality) * format_ratio[format] * (alpha ? 1.1 : 1.0);
+    }
+    bpp *= density * pow(scale, -DOWNSCALE_EXPONENT);
+
+    double output_pixels = (double)estimate.width * estimate.height;
+    estimate.bytes = (int64_t)(output_pixels * bpp / 8.0) + CONTAINER_BYTES;
+
+    ThinpicThroughput throughput;
+    if (thinpic_get_throughput(format, -1, &throughput) == 0) {
+        estimate.encode_ms = output_pixels / 1e6 * throughput.encode_ms_per_mp;
+    }
+    CompressOptions options = {0};
+    options.mode = COMPRESS_MODE_STANDARD;
+    options.format = format;
+    options.target_width = max_width;
+    options.target_height = max_height;
+    estimate.working_set_bytes = thinpic_pool_working_set(header.width, header.height, header.bands,
+                                                          header.format, &options);
+    estimate.success = 1;
+
+    THINPIC_LOGD("Estimate: %dx%d %.2f bpp -> %dx%d format %d q%d, %lld bytes, %.0f ms",
+                 header.width, header.height, estimate.source_bpp, estimate.width, estimate.height,
+                 format, quality, (long long)estimate.bytes, estimate.encode_ms);
+    return estimate;
+}
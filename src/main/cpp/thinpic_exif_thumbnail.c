@@ -0,0 +1,179 @@
+// Embedded EXIF thumbnails (extract_exif_thumbnail): most camera JPEGs carry
+// a small JPEG in IFD1 of their APP1 segment, 160x120 and up. Finding it
+// takes a few reads at the head of the file and no decoding and no libvips,
+// so it is the cheapest preview there is when an approximate one will do.
+// The thumbnail is returned as stored; it shares the main image's EXIF
+// orientation, reported alongside it.
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define APP1_MAX 65535
+#define MARKERS_MAX 32              // Segments looked at before giving up on an APP1
+
+#define TAG_ORIENTATION 0x0112
+#define TAG_THUMBNAIL_OFFSET 0x0201      // JPEGInterchangeFormat
+#define TAG_THUMBNAIL_LENGTH 0x0202      // JPEGInterchangeFormatLength
+
+static unsigned int read_u16(const uint8_t* p, int big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t read_u32(const uint8_t* p, int big_endian) {
+    return big_endian
+        ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+        : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static int read_fully(int fd, uint8_t* buffer, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t got = pread(fd, buffer + done, length - done, offset + (off_t)done);
+        if (got <= 0) return 0;
+        done += (size_t)got;
+    }
+    return 1;
+}
+
+// The EXIF APP1 payload after "Exif\0\0" (a TIFF structure) into buffer;
+// returns its length, or 0 when the file has none before the first scan
+static size_t read_exif_segment(int fd, uint8_t* buffer) {
+    uint8_t head[4];
+    if (!read_fully(fd, head, 2, 0) || head[0] != 0xFF || head[1] != 0xD8) return 0;
+    off_t offset = 2;
+    for (int i = 0; i < MARKERS_MAX; i++) {
+        if (!read_fully(fd, head, 4, offset) || head[0] != 0xFF) return 0;
+        int marker = head[1];
+        size_t length = ((size_t)head[2] << 8) | head[3];
+        // Start of scan or frame: the APP segments are behind us
+        if (marker == 0xDA || (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 &&
+                               marker != 0xCC) || length < 2) {
+            return 0;
+        }
+        if (marker == 0xE1 && length > 8) {
+            size_t payload = length - 2;
+            if (!read_fully(fd, buffer, payload, offset + 4)) return 0;
+            if (memcmp(buffer, "Exif\0\0", 6) == 0) {
+                memmove(buffer, buffer + 6, payload - 6);
+                return payload - 6;
+            }
+        }
+        offset += 2 + (off_t)length;
+    }
+    return 0;
+}
+
+// Entry count of the IFD at ifd, or -1 when it does not fit
+static int ifd_entries(const uint8_t* tiff, size_t length, uint32_t ifd, int big_endian) {
+    if ((size_t)ifd + 2 > length) return -1;
+    int entries = (int)read_u16(tiff + ifd, big_endian);
+    if ((size_t)ifd + 2 + (size_t)entries * 12 + 4 > length) return -1;
+    return entries;
+}
+
+// Entry value as SHORT or LONG; 0 for other types
+static uint32_t entry_value(const uint8_t* entry, int big_endian) {
+    switch (read_u16(entry + 2, big_endian)) {
+        case 3: return read_u16(entry + 8, big_endian);
+        case 4: return read_u32(entry + 8, big_endian);
+        default: return 0;
+    }
+}
+
+// Size from the first SOF of a JPEG held in memory
+static int jpeg_dimensions(const uint8_t* data, size_t length, int* width, int* height) {
+    size_t offset = 2;
+    while (offset + 4 <= length) {
+        if (data[offset] != 0xFF) return 0;
+        int marker = data[offset + 1];
+        if (marker == 0xFF) {
+            offset++;
+            continue;
+        }
+        size_t segment = ((size_t)data[offset + 2] << 8) | data[offset + 3];
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (offset + 9 > length) return 0;
+            *height = (data[offset + 5] << 8) | data[offset + 6];
+            *width = (data[offset + 7] << 8) | data[offset + 8];
+            return *width > 0 && *height > 0;
+        }
+        if (marker == 0xDA || segment < 2) return 0;
+        offset += 2 + segment;
+    }
+    return 0;
+}
+
+ExifThumbnail extract_exif_thumbnail(const char* input_path, int min_size) {
+    ExifThumbnail thumbnail = {NULL, 0, 0, 0, 0, 0};
+    if (!input_path) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        return thumbnail;
+    }
+    int fd = open(input_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        THINPIC_LOGE("EXIF thumbnail: cannot open %s", input_path);
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        return thumbnail;
+    }
+    uint8_t* tiff = g_malloc(APP1_MAX);
+    size_t length = read_exif_segment(fd, tiff);
+    close(fd);
+
+    int big_endian = length >= 8 && memcmp(tiff, "MM", 2) == 0;
+    if (length < 8 || (!big_endian && memcmp(tiff, "II", 2) != 0)) {
+        THINPIC_LOGD("EXIF thumbnail: no EXIF in %s", input_path);
+        g_free(tiff);
+        return thumbnail;
+    }
+
+    uint32_t ifd0 = read_u32(tiff + 4, big_endian);
+    int entries = ifd_entries(tiff, length, ifd0, big_endian);
+    uint32_t ifd1 = 0;
+    if (entries >= 0) {
+        for (int i = 0; i < entries; i++) {
+            const uint8_t* entry = tiff + ifd0 + 2 + i * 12;
+            if (read_u16(entry, big_endian) == TAG_ORIENTATION) {
+                uint32_t orientation = entry_value(entry, big_endian);
+                if (orientation >= 1 && orientation <= 8) thumbnail.orientation = (int)orientation;
+            }
+        }
+        ifd1 = read_u32(tiff + ifd0 + 2 + entries * 12, big_endian);
+    }
+
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    entries = ifd1 ? ifd_entries(tiff, length, ifd1, big_endian) : -1;
+    for (int i = 0; i < entries; i++) {
+        const uint8_t* entry = tiff + ifd1 + 2 + i * 12;
+        unsigned int tag = read_u16(entry, big_endian);
+        if (tag == TAG_THUMBNAIL_OFFSET) offset = entry_value(entry, big_endian);
+        else if (tag == TAG_THUMBNAIL_LENGTH) size = entry_value(entry, big_endian);
+    }
+
+    if (offset == 0 || size < 4 || (size_t)offset + size > length ||
+            tiff[offset] != 0xFF || tiff[offset + 1] != 0xD8 ||
+            !jpeg_dimensions(tiff + offset, size, &thumbnail.width, &thumbnail.height)) {
+        THINPIC_LOGD("EXIF thumbnail: none embedded in %s", input_path);
+        g_free(tiff);
+        return thumbnail;
+    }
+    int longest = thumbnail.width > thumbnail.height ? thumbnail.width : thumbnail.height;
+    if (longest < min_size) {
+        THINPIC_LOGD("EXIF thumbnail: %dx%d is under %d px", thumbnail.width, thumbnail.height, min_size);
+        g_free(tiff);
+        thumbnail.width = thumbnail.height = 0;
+        return thumbnail;
+    }
+
+    thumbnail.data = g_memdup2(tiff + offset, size);
+    thumbnail.length = size;
+    thumbnail.success = 1;
+    g_free(tiff);
+    THINPIC_LOGD("EXIF thumbnail: %dx%d, %u bytes", thumbnail.width, thumbnail.height, size);
+    return thumbnail;
+}
@@ -0,0 +1,104 @@
+// Encoded outputs handed to Android code without a copy
+// (thinpic_export_buffer). An app whose upload stack is Java (OkHttp and
+// the like) would otherwise copy every result into the Dart heap and back
+// out through a platform channel. Instead Dart parks the job's own buffer
+// here and passes the handle, a plain integer, over its channel; Java takes
+// it with ThinpicNativeBuffer, which wraps the same memory in a direct
+// ByteBuffer, and closing that frees it. A buffer nobody takes stays until
+// thinpic_release_buffer, so every handle must be released by one side.
+
+#include <pthread.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+typedef struct {
+    uint8_t* data;    // Freed with free_compressed_buffer
+    size_t length;
+} ExportedBuffer;
+
+static pthread_mutex_t export_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable* exported = NULL;  // Handle -> ExportedBuffer
+static int64_t next_handle = 1;
+static size_t exported_bytes = 0;
+
+int64_t thinpic_export_buffer(uint8_t* data, size_t length) {
+    if (!data || length == 0) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Nothing to export");
+        return -1;
+    }
+    ExportedBuffer* entry = g_new(ExportedBuffer, 1);
+    entry->data = data;
+    entry->length = length;
+    pthread_mutex_lock(&export_mutex);
+    if (!exported) exported = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+    int64_t* key = g_new(int64_t, 1);
+    *key = next_handle++;
+    g_hash_table_insert(exported, key, entry);
+    exported_bytes += length;
+    int64_t handle = *key;
+    pthread_mutex_unlock(&export_mutex);
+    THINPIC_LOGD("Exported buffer %lld: %zu bytes", (long long)handle, length);
+    return handle;
+}
+
+const uint8_t* thinpic_exported_buffer(int64_t handle, size_t* length) {
+    pthread_mutex_lock(&export_mutex);
+    ExportedBuffer* entry = exported ? g_hash_table_lookup(exported, &handle) : NULL;
+    const uint8_t* data = entry ? entry->data : NULL;
+    if (length) *length = entry ? entry->length : 0;
+    pthread_mutex_unlock(&export_mutex);
+    return data;
+}
+
+int thinpic_release_buffer(int64_t handle) {
+    pthread_mutex_lock(&export_mutex);
+    ExportedBuffer* entry = exported ? g_hash_table_lookup(exported, &handle) : NULL;
+    uint8_t* data = entry ? entry->data : NULL;
+    if (entry) {
+        exported_bytes -= entry->length;
+        g_hash_table_remove(exported, &handle);
+    }
+    pthread_mutex_unlock(&export_mutex);
+    if (!data) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGW("Release of unknown buffer %lld", (long long)handle);
+        return -1;
+    }
+    free_compressed_buffer(data);
+    return 0;
+}
+
+size_t thinpic_exported_bytes(void) {
+    pthread_mutex_lock(&export_mutex);
+    size_t bytes = exported_bytes;
+    pthread_mutex_unlock(&export_mutex);
+    return bytes;
+}
+
+#ifdef __ANDROID__
+#include <jni.h>
+
+// ThinpicNativeBuffer.nativeWrap(long): a direct ByteBuffer over the
+// exported bytes, or null for an unknown handle. The buffer stays valid
+// until nativeRelease.
+JNIEXPORT jobject JNICALL
+Java_com_example_thinpic_1flutter_ThinpicNativeBuffer_nativeWrap(JNIEnv* env, jclass clazz, jlong handle) {
+    (void)clazz;
+    size_t length = 0;
+    const uint8_t* data = thinpic_exported_buffer(handle, &length);
+    if (!data) return NULL;
+    // Read-only to Java by contract (asReadOnlyBuffer on that side); the
+    // memory is ours until released
+    return (*env)->NewDirectByteBuffer(env, (void*)data, (jlong)length);
+}
+
+// ThinpicNativeBuffer.nativeRelease(long)
+JNIEXPORT jint JNICALL
+Java_com_example_thinpic_1flutter_ThinpicNativeBuffer_nativeRelease(JNIEnv* env, jclass clazz, jlong handle) {
+    (void)env;
+    (void)clazz;
+    return thinpic_release_buffer(handle);
+}
+#endif
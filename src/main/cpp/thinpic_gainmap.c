@@ -0,0 +1,443 @@
+// Ultra HDR gain maps: a JPEG whose MPF index (an APP2 "MPF" segment) names
+// a second, smaller JPEG after the primary, carrying the hdrgm XMP or ISO
+// 21496-1 metadata that tells an HDR display how far to brighten each
+// region. libvips reads the primary alone, so every output used to be SDR
+// whatever the source. With THINPIC_GAIN_MAP_KEEP the gain map is decoded
+// on its own (a quarter of the primary's side or less, so a few hundred
+// thousand pixels), turned and resized with the same orientation and scale
+// as the primary, encoded again and appended to the new primary under a
+// fresh MPF index and Ultra HDR XMP. Its gain metadata (the hdrgm XMP and
+// ISO segments) does not depend on the size and is copied unchanged. The
+// default drops it, which costs nothing: the primary is all libvips reads.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define XMP_NAMESPACE "http://ns.adobe.com/xap/1.0/"
+#define ISO_NAMESPACE "urn:iso:std:iso:ts:21496:-1"
+#define MARKER_LIMIT 64             // Segments walked before the first scan
+#define GAIN_MAP_MAX (32 << 20)     // Larger secondary images are not gain maps
+#define GAIN_MAP_QUALITY 90         // Blocking in a gain map shows as banding in the highlights
+#define MPF_PAYLOAD 86              // "MPF\0", TIFF header, a three-entry IFD and two MP entries
+#define MP_PRIMARY 0x20030000u      // Representative image, baseline MP primary
+#define TAG_MPF_VERSION 0xB000
+#define TAG_MPF_IMAGES 0xB001
+#define TAG_MPF_ENTRIES 0xB002
+
+// A ThinpicInput read at offsets, without moving a caller's descriptor
+typedef struct {
+    const uint8_t* data;
+    int fd;
+    int owned;
+    int64_t size;
+} GainReader;
+
+static int reader_open(const ThinpicInput* input, GainReader* reader) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+    if (input->image) return -1;
+    if (input->data) {
+        reader->data = (const uint8_t*)input->data;
+        reader->size = (int64_t)input->length;
+        return 0;
+    }
+    reader->fd = input->path ? open(input->path, O_RDONLY | O_CLOEXEC) : input->fd;
+    reader->owned = input->path != NULL;
+    struct stat file_stat;
+    if (reader->fd < 0 || fstat(reader->fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        if (reader->owned && reader->fd >= 0) close(reader->fd);
+        reader->fd = -1;
+        return -1;
+    }
+    reader->size = (int64_t)file_stat.st_size;
+    return 0;
+}
+
+static void reader_close(GainReader* reader) {
+    if (reader->owned && reader->fd >= 0) close(reader->fd);
+    reader->fd = -1;
+}
+
+// Reads exactly length bytes at offset; 0 or -1
+static int reader_read(const GainReader* reader, int64_t offset, void* buffer, size_t length) {
+    if (offset < 0 || offset + (int64_t)length > reader->size) return -1;
+    if (reader->data) {
+        memcpy(buffer, reader->data + offset, length);
+        return 0;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t count = pread(reader->fd, (uint8_t*)buffer + done, length - done, (off_t)(offset + done));
+        if (count <= 0) return -1;
+        done += (size_t)count;
+    }
+    return 0;
+}
+
+static unsigned int read_u16(const uint8_t* p, int big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t read_u32(const uint8_t* p, int big_endian) {
+    return big_endian
+        ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+        : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static void write_u16(uint8_t* p, unsigned int value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static void write_u32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// needle anywhere in binary data, NULs included
+static int contains(const uint8_t* data, size_t length, const char* needle) {
+    size_t needle_length = strlen(needle);
+    for (size_t i = 0; i + needle_length <= length; i++) {
+        if (data[i] == (uint8_t)needle[0] && memcmp(data + i, needle, needle_length) == 0) return 1;
+    }
+    return 0;
+}
+
+static int has_prefix(const uint8_t* payload, size_t length, const char* prefix) {
+    size_t prefix_length = strlen(prefix) + 1;
+    return length >= prefix_length && memcmp(payload, prefix, prefix_length) == 0;
+}
+
+// The second image of an MPF index segment's payload (after "MPF\0"), as a
+// file offset and length; 0 or -1
+static int mpf_secondary(const uint8_t* payload, size_t length, int64_t tiff_start, ThinpicGainMapInfo* info) {
+    if (length < 8) return -1;
+    int big_endian = payload[0] == 'M';
+    if (read_u16(payload + 2, big_endian) != 42) return -1;
+    uint32_t ifd = read_u32(payload + 4, big_endian);
+    if (ifd + 2 > length) return -1;
+    unsigned int count = read_u16(payload + ifd, big_endian);
+    for (unsigned int i = 0; i < count && ifd + 2 + (i + 1) * 12 <= length; i++) {
+        const uint8_t* entry = payload + ifd + 2 + i * 12;
+        if (read_u16(entry, big_endian) != TAG_MPF_ENTRIES) continue;
+        uint32_t bytes = read_u32(entry + 4, big_endian);
+        uint32_t at = read_u32(entry + 8, big_endian);
+        if (bytes < 32 || at + 32 > length) return -1;
+        // Entries are attribute, size, offset from the TIFF header, dependents
+        const uint8_t* second = payload + at + 16;
+        uint32_t size = read_u32(second + 4, big_endian);
+        uint32_t offset = read_u32(second + 8, big_endian);
+        if (size == 0 || offset == 0) return -1;
+        info->offset = tiff_start + offset;
+        info->length = size;
+        return 0;
+    }
+    return -1;
+}
+
+// Calls visit on each marker segment of the JPEG in data up to its first
+// scan, with the payload after the length; returns where the scan starts
+static size_t walk_segments(const uint8_t* data, size_t length,
+                            void (*visit)(int marker, const uint8_t* payload, size_t payload_length,
+                                          size_t start, void* context),
+                            void* context) {
+    size_t offset = 2;
+    for (int n = 0; n < MARKER_LIMIT * 4 && offset + 4 <= length; n++) {
+        if (data[offset] != 0xFF) return 0;
+        int marker = data[offset + 1];
+        if (marker == 0xFF) {
+            offset++;
+            continue;
+        }
+        if (marker == 0xDA) return offset;
+        size_t segment = (size_t)(data[offset + 2] << 8 | data[offset + 3]);
+        if (segment < 2 || offset + 2 + segment > length) return 0;
+        visit(marker, data + offset + 4, segment - 2, offset, context);
+        offset += 2 + segment;
+    }
+    return 0;
+}
+
+int thinpic_gain_map_find(const ThinpicInput* input, ThinpicGainMapInfo* info) {
+    memset(info, 0, sizeof(*info));
+    GainReader reader;
+    if (reader_open(input, &reader)) return 0;
+    uint8_t soi[2];
+    int found = 0;
+    int64_t offset = 2;
+    if (reader_read(&reader, 0, soi, sizeof(soi)) || soi[0] != 0xFF || soi[1] != 0xD8) offset = -1;
+    for (int n = 0; offset > 0 && n < MARKER_LIMIT && !found; n++) {
+        uint8_t marker[8];
+        if (reader_read(&reader, offset, marker, 4) || marker[0] != 0xFF) break;
+        if (marker[1] == 0xDA || marker[1] == 0xD9) break;
+        int length = marker[2] << 8 | marker[3];
+        if (length < 2) break;
+        if (marker[1] == 0xE2 && length > 12 && reader_read(&reader, offset + 4, marker + 4, 4) == 0 &&
+                memcmp(marker + 4, "MPF\0", 4) == 0) {
+            uint8_t* payload = (uint8_t*)g_malloc((size_t)length - 6);
+            found = reader_read(&reader, offset + 8, payload, (size_t)length - 6) == 0 &&
+                    mpf_secondary(payload, (size_t)length - 6, offset + 8, info) == 0;
+            g_free(payload);
+            if (!found) break;
+        }
+        offset += 2 + length;
+    }
+    // The secondary image is a gain map only with gain metadata; an MPF
+    // index alone is as often a camera's preview
+    if (found) {
+        found = 0;
+        size_t head_length = info->length < 65536 ? (size_t)info->length : 65536;
+        uint8_t* head = info->length > 4 && info->length <= GAIN_MAP_MAX ? (uint8_t*)g_malloc(head_length) : NULL;
+        if (head && reader_read(&reader, info->offset, head, head_length) == 0 && head[0] == 0xFF &&
+                head[1] == 0xD8) {
+            found = contains(head, head_length, "hdrgm:") || contains(head, head_length, ISO_NAMESPACE);
+        }
+        g_free(head);
+        if (!found) memset(info, 0, sizeof(*info));
+    }
+    reader_close(&reader);
+    if (found) {
+        THINPIC_LOGD("Ultra HDR gain map: %lld bytes at %lld", (long long)info->length, (long long)info->offset);
+    }
+    return found;
+}
+
+// Gain metadata segments of the old gain map, copied whole into the new one
+typedef struct {
+    GByteArray* kept;
+    int iso;                     // An ISO 21496-1 segment was among them
+} CarriedSegments;
+
+static void carry_segment(int marker, const uint8_t* payload, size_t payload_length, size_t start, void* context) {
+    (void)start;
+    CarriedSegments* carried = (CarriedSegments*)context;
+    int xmp = marker == 0xE1 && has_prefix(payload, payload_length, XMP_NAMESPACE);
+    int iso = marker == 0xE2 && has_prefix(payload, payload_length, ISO_NAMESPACE);
+    if (!xmp && !iso) return;
+    uint8_t header[4] = {0xFF, (uint8_t)marker, 0, 0};
+    write_u16(header + 2, (unsigned int)payload_length + 2);
+    g_byte_array_append(carried->kept, header, sizeof(header));
+    g_byte_array_append(carried->kept, payload, (guint)payload_length);
+    carried->iso |= iso;
+}
+
+// Segments of the new primary that described the old container
+typedef struct {
+    size_t starts[MARKER_LIMIT];
+    size_t lengths[MARKER_LIMIT];
+    int count;
+} DroppedSegments;
+
+static void drop_segment(int marker, const uint8_t* payload, size_t payload_length, size_t start, void* context) {
+    DroppedSegments* dropped = (DroppedSegments*)context;
+    int stale = (marker == 0xE2 && payload_length >= 4 && memcmp(payload, "MPF\0", 4) == 0) ||
+                (marker == 0xE2 && has_prefix(payload, payload_length, ISO_NAMESPACE)) ||
+                (marker == 0xE1 && has_prefix(payload, payload_length, XMP_NAMESPACE) &&
+                 (contains(payload, payload_length, "hdrgm") || contains(payload, payload_length, "Container:Directory")));
+    if (!stale || dropped->count == MARKER_LIMIT) return;
+    dropped->starts[dropped->count] = start;
+    dropped->lengths[dropped->count] = payload_length + 4;
+    dropped->count++;
+}
+
+// The gain map decoded, turned like the primary and resized to match a
+// width x height primary; encoded into *jpeg (g_malloc'd). 0 or -1
+static int rescale_gain_map(const uint8_t* data, size_t length, int orientation, int source_width,
+                            int source_height, int width, int height, void** jpeg, size_t* jpeg_length) {
+    VipsImage* image = NULL;
+    if (vips_jpegload_buffer((void*)data, length, &image, "access", VIPS_ACCESS_SEQUENTIAL, NULL)) return -1;
+    int stored_width = vips_image_get_width(image);
+    int stored_height = vips_image_get_height(image);
+    VipsImage* next = NULL;
+    if (orientation > 1) {
+        // The primary's EXIF orientation, which the gain map never carries itself
+        VipsImage* tagged = NULL;
+        int failed = vips_copy(image, &tagged, NULL);
+        if (!failed) {
+            vips_image_set_int(tagged, VIPS_META_ORIENTATION, orientation);
+            failed = thinpic_orient_upright(tagged, &next);
+            g_object_unref(tagged);
+        }
+        g_object_unref(image);
+        if (failed) return -1;
+        image = next;
+    }
+    int turned = orientation >= 5 && orientation <= 8;
+    double scale_x = (double)(turned ? stored_height : stored_width) / (turned ? source_height : source_width);
+    double scale_y = (double)(turned ? stored_width : stored_height) / (turned ? source_width : source_height);
+    int target_width = (int)(width * scale_x + 0.5);
+    int target_height = (int)(height * scale_y + 0.5);
+    if (target_width < 1) target_width = 1;
+    if (target_height < 1) target_height = 1;
+    int failed = vips_resize(image, &next, (double)target_width / vips_image_get_width(image),
+        "vscale", (double)target_height / vips_image_get_height(image),
+        NULL);
+    g_object_unref(image);
+    if (failed) return -1;
+    failed = vips_jpegsave_buffer(next, jpeg, jpeg_length,
+        "Q", GAIN_MAP_QUALITY,
+        "keep", VIPS_FOREIGN_KEEP_NONE,
+        NULL);
+    THINPIC_LOGD("Gain map %dx%d -> %dx%d", stored_width, stored_height, target_width, target_height);
+    g_object_unref(next);
+    return failed ? -1 : 0;
+}
+
+// The Ultra HDR primary XMP: the hdrgm version and the container directory
+static GByteArray* primary_xmp(size_t gain_map_length) {
+    gchar* packet = g_strdup_printf(
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">"
+        "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+        "<rdf:Description rdf:about=\"\""
+        " xmlns:Container=\"http://ns.google.com/photos/1.0/container/\""
+        " xmlns:Item=\"http://ns.google.com/photos/1.0/container/item/\""
+        " xmlns:hdrgm=\"http://ns.adobe.com/hdr-gain-map/1.0/\" hdrgm:Version=\"1.0\">"
+        "<Container:Directory><rdf:Seq>"
+        "<rdf:li rdf:parseType=\"Resource\"><Container:Item Item:Semantic=\"Primary\" Item:Mime=\"image/jpeg\"/></rdf:li>"
+        "<rdf:li rdf:parseType=\"Resource\"><Container:Item Item:Semantic=\"GainMap\" Item:Mime=\"image/jpeg\""
+        " Item:Length=\"%zu\"/></rdf:li>"
+        "</rdf:Seq></Container:Directory></rdf:Description></rdf:RDF></x:xmpmeta>",
+        gain_map_length);
+    size_t packet_length = strlen(packet);
+    GByteArray* segment = g_byte_array_new();
+    uint8_t header[4] = {0xFF, 0xE1, 0, 0};
+    write_u16(header + 2, (unsigned int)(2 + sizeof(XMP_NAMESPACE) + packet_length));
+    g_byte_array_append(segment, header, sizeof(header));
+    g_byte_array_append(segment, (const uint8_t*)XMP_NAMESPACE, sizeof(XMP_NAMESPACE));
+    g_byte_array_append(segment, (const uint8_t*)packet, (guint)packet_length);
+    g_free(packet);
+    return segment;
+}
+
+// A big-endian MPF index of the primary and the gain map after it
+static void fill_mpf(uint8_t* segment, size_t primary_length, size_t tiff_start, size_t gain_map_length) {
+    memset(segment, 0, 4 + MPF_PAYLOAD);
+    segment[0] = 0xFF;
+    segment[1] = 0xE2;
+    write_u16(segment + 2, MPF_PAYLOAD + 2);
+    uint8_t* payload = segment + 4;
+    memcpy(payload, "MPF\0MM\0\x2A", 8);
+    uint8_t* tiff = payload + 4;
+    write_u32(tiff + 4, 8);
+    write_u16(tiff + 8, 3);
+    uint8_t* entry = tiff + 10;
+    write_u16(entry, TAG_MPF_VERSION);
+    write_u16(entry + 2, 7);
+    write_u32(entry + 4, 4);
+    memcpy(entry + 8, "0100", 4);
+    entry += 12;
+    write_u16(entry, TAG_MPF_IMAGES);
+    write_u16(entry + 2, 4);
+    write_u32(entry + 4, 1);
+    write_u32(entry + 8, 2);
+    entry += 12;
+    write_u16(entry, TAG_MPF_ENTRIES);
+    write_u16(entry + 2, 7);
+    write_u32(entry + 4, 32);
+    write_u32(entry + 8, 50);
+    // Next IFD 0, then the entries at 50: the primary at 0, the gain map
+    // right after it
+    uint8_t* images = tiff + 50;
+    write_u32(images, MP_PRIMARY);
+    write_u32(images + 4, (uint32_t)primary_length);
+    write_u32(images + 20, (uint32_t)gain_map_length);
+    write_u32(images + 24, (uint32_t)(primary_length - tiff_start));
+}
+
+int64_t thinpic_gain_map_attach(const ThinpicInput* input, const ThinpicGainMapInfo* info, int orientation,
+                                int source_width, int source_height, int width, int height, uint8_t** data,
+                                size_t* length) {
+    if (info->length <= 0 || info->length > GAIN_MAP_MAX || *length < 4 || source_width < 1 || source_height < 1) {
+        return -1;
+    }
+    GainReader reader;
+    if (reader_open(input, &reader)) return -1;
+    uint8_t* source = (uint8_t*)g_try_malloc((size_t)info->length);
+    int readable = source && reader_read(&reader, info->offset, source, (size_t)info->length) == 0;
+    reader_close(&reader);
+    void* encoded = NULL;
+    size_t encoded_length = 0;
+    CarriedSegments carried = {g_byte_array_new(), 0};
+    if (readable) walk_segments(source, (size_t)info->length, carry_segment, &carried);
+    if (!readable || rescale_gain_map(source, (size_t)info->length, orientation, source_width, source_height,
+                                      width, height, &encoded, &encoded_length) != 0 || encoded_length < 4) {
+        g_free(source);
+        g_byte_array_free(carried.kept, TRUE);
+        g_free(encoded);
+        vips_error_clear();
+        THINPIC_LOGW("Gain map could not be rescaled; writing SDR only");
+        return -1;
+    }
+    g_free(source);
+
+    // The new gain map: SOI, its gain metadata, then the fresh encode
+    size_t gain_map_length = encoded_length + carried.kept->len;
+    // The new primary: SOI, Ultra HDR XMP, MPF (and the ISO version marker
+    // when the gain map has ISO metadata), then the encode without the
+    // segments that described the source's container
+    DroppedSegments dropped;
+    memset(&dropped, 0, sizeof(dropped));
+    size_t scan = walk_segments(*data, *length, drop_segment, &dropped);
+    GByteArray* xmp = primary_xmp(gain_map_length);
+    static const uint8_t iso_version[] = {0, 0, 0, 0};  // Minimum and writer version 0
+    size_t iso_length = carried.iso ? 4 + sizeof(ISO_NAMESPACE) + sizeof(iso_version) : 0;
+    size_t dropped_bytes = 0;
+    for (int i = 0; i < dropped.count; i++) dropped_bytes += dropped.lengths[i];
+    size_t primary_length = *length + xmp->len + iso_length + 4 + MPF_PAYLOAD - dropped_bytes;
+    uint8_t* output = scan ? (uint8_t*)g_try_malloc(primary_length + gain_map_length) : NULL;
+    if (!output) {
+        g_free(encoded);
+        g_byte_array_free(carried.kept, TRUE);
+        g_byte_array_free(xmp, TRUE);
+        THINPIC_LOGW("Gain map not attached: %s", scan ? "out of memory" : "the output has no scan");
+        return -1;
+    }
+    size_t at = 0;
+    output[at++] = 0xFF;
+    output[at++] = 0xD8;
+    memcpy(output + at, xmp->data, xmp->len);
+    at += xmp->len;
+    if (iso_length) {
+        uint8_t header[4] = {0xFF, 0xE2, 0, 0};
+        write_u16(header + 2, (unsigned int)iso_length - 2);
+        memcpy(output + at, header, 4);
+        memcpy(output + at + 4, ISO_NAMESPACE, sizeof(ISO_NAMESPACE));
+        memcpy(output + at + 4 + sizeof(ISO_NAMESPACE), iso_version, sizeof(iso_version));
+        at += iso_length;
+    }
+    size_t mpf_at = at;
+    at += 4 + MPF_PAYLOAD;
+    size_t from = 2;
+    for (int i = 0; i < dropped.count; i++) {
+        memcpy(output + at, *data + from, dropped.starts[i] - from);
+        at += dropped.starts[i] - from;
+        from = dropped.starts[i] + dropped.lengths[i];
+    }
+    memcpy(output + at, *data + from, *length - from);
+    at += *length - from;
+    // Offsets in the index count from its TIFF header, after "MPF\0"
+    fill_mpf(output + mpf_at, primary_length, mpf_at + 8, gain_map_length);
+
+    uint8_t* gain_map = output + primary_length;
+    gain_map[0] = 0xFF;
+    gain_map[1] = 0xD8;
+    memcpy(gain_map + 2, carried.kept->data, carried.kept->len);
+    memcpy(gain_map + 2 + carried.kept->len, (uint8_t*)encoded + 2, encoded_length - 2);
+
+    g_free(encoded);
+    g_byte_array_free(carried.kept, TRUE);
+    g_byte_array_free(xmp, TRUE);
+    g_free(*data);
+    *data = output;
+    *length = primary_length + gain_map_length;
+    THINPIC_LOGD("Ultra HDR output: %zu byte primary, %zu byte gain map", primary_length, gain_map_length);
+    return (int64_t)gain_map_length;
+}
@@ -0,0 +1,470 @@
+// GIF output for FORMAT_GIF. gifsave quantises frame after frame on one
+// thread, and this libvips has no libimagequant for it to use. Here one
+// global palette is built the way indexed PNGs get theirs (exact for
+// low-colour images, median cut over a sample of every frame otherwise), so
+// colours do not shift between frames. Frames are then mapped to it
+// (Floyd-Steinberg at the requested strength) and LZW coded on parallel
+// threads. With an interframe tolerance, pixels within that distance of what
+// the previous frames left on screen become transparent and each frame is
+// cropped to the area that changed, which is most of an animation's saving.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define GIF_COLOURS_MAX 256
+#define GIF_DIMENSION_MAX 65535
+#define GIF_SAMPLES 65536               // Pixels the median cut works from, over all frames
+#define GIF_DEFAULT_DELAY_CS 10         // Frames without a "delay" entry
+#define LZW_CODES 4096
+#define LZW_HASH_BITS 13
+
+typedef struct {
+    uint8_t* data;                      // g_malloc'd, so it can be handed out as is
+    size_t length;
+    size_t capacity;
+    int failed;
+} GifBuffer;
+
+static void put_bytes(GifBuffer* buffer, const void* bytes, size_t length) {
+    if (buffer->failed) return;
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->length + length) capacity *= 2;
+        uint8_t* grown = (uint8_t*)g_try_realloc(buffer->data, capacity);
+        if (!grown) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+static void put_byte(GifBuffer* buffer, uint8_t value) {
+    put_bytes(buffer, &value, 1);
+}
+
+static void put_u16(GifBuffer* buffer, int value) {
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    put_bytes(buffer, bytes, 2);
+}
+
+// LZW coder state for one frame at a time
+
+typedef struct {
+    GifBuffer* out;
+    uint8_t block[255];                 // Data sub-block being filled
+    int block_length;
+    uint32_t bits;
+    int bit_count;
+    int min_code_size;
+    int clear_code;
+    int code_size;
+    int next_code;
+    int max_code;
+    int32_t keys[1 << LZW_HASH_BITS];   // (prefix << 8 | index) + 1; 0 = empty slot
+    int16_t codes[1 << LZW_HASH_BITS];
+} LzwEncoder;
+
+static void lzw_byte(LzwEncoder* lzw, uint8_t value) {
+    lzw->block[lzw->block_length++] = value;
+    if (lzw->block_length == 255) {
+        put_byte(lzw->out, 255);
+        put_bytes(lzw->out, lzw->block, 255);
+        lzw->block_length = 0;
+    }
+}
+
+static void lzw_reset(LzwEncoder* lzw) {
+    lzw->code_size = lzw->min_code_size + 1;
+    lzw->max_code = 1 << lzw->code_size;
+    lzw->next_code = lzw->clear_code + 2;
+    memset(lzw->keys, 0, sizeof(lzw->keys));
+}
+
+// Codes widen once the next free code no longer fits, as giflib does it
+static void lzw_emit(LzwEncoder* lzw, int code) {
+    lzw->bits |= (uint32_t)code << lzw->bit_count;
+    lzw->bit_count += lzw->code_size;
+    while (lzw->bit_count >= 8) {
+        lzw_byte(lzw, (uint8_t)lzw->bits);
+        lzw->bits >>= 8;
+        lzw->bit_count -= 8;
+    }
+    if (lzw->next_code >= lzw->max_code && lzw->code_size < 12) {
+        lzw->code_size++;
+        lzw->max_code = 1 << lzw->code_size;
+    }
+}
+
+// Image data for the left, top, width x height part of a frame's indices
+static void lzw_encode(LzwEncoder* lzw, GifBuffer* out, const uint8_t* indices, int stride, int left, int top,
+                       int width, int height, int min_code_size) {
+    const uint32_t mask = (1u << LZW_HASH_BITS) - 1;
+    lzw->out = out;
+    lzw->block_length = 0;
+    lzw->bits = 0;
+    lzw->bit_count = 0;
+    lzw->min_code_size = min_code_size;
+    lzw->clear_code = 1 << min_code_size;
+    put_byte(out, (uint8_t)min_code_size);
+    lzw_reset(lzw);
+    lzw_emit(lzw, lzw->clear_code);
+
+    int prefix = -1;
+    for (int y = top; y < top + height; y++) {
+        const uint8_t* row = indices + (size_t)y * stride;
+        for (int x = left; x < left + width; x++) {
+            int index = row[x];
+            if (prefix < 0) {
+                prefix = index;
+                continue;
+            }
+            int32_t key = ((prefix << 8) | index) + 1;
+            uint32_t slot = ((uint32_t)key * 2654435761u) >> (32 - LZW_HASH_BITS);
+            while (lzw->keys[slot] && lzw->keys[slot] != key) slot = (slot + 1) & mask;
+            if (lzw->keys[slot]) {
+                prefix = lzw->codes[slot];
+                continue;
+            }
+            lzw_emit(lzw, prefix);
+            if (lzw->next_code >= LZW_CODES - 1) {
+                lzw_emit(lzw, lzw->clear_code);
+                lzw_reset(lzw);
+            } else {
+                lzw->keys[slot] = key;
+                lzw->codes[slot] = (int16_t)lzw->next_code++;
+            }
+            prefix = index;
+        }
+    }
+    lzw_emit(lzw, prefix);
+    lzw_emit(lzw, lzw->clear_code + 1);
+    if (lzw->bit_count > 0) lzw_byte(lzw, (uint8_t)lzw->bits);
+    if (lzw->block_length > 0) {
+        put_byte(out, (uint8_t)lzw->block_length);
+        put_bytes(out, lzw->block, (size_t)lzw->block_length);
+    }
+    put_byte(out, 0);
+}
+
+typedef struct {
+    int left;                           // Area that changed since the previous frame
+    int top;
+    int width;
+    int height;
+    int delay;                          // Centiseconds
+    GifBuffer data;                     // Image data sub-blocks
+} GifFrame;
+
+// Frames mapped and coded by the worker threads
+typedef struct {
+    const uint8_t* pixels;
+    int width;
+    int page_height;
+    int bands;
+    const uint32_t* palette;
+    int palette_size;
+    int exact;                          // indices already filled by thinpic_exact_palette
+    int dither;
+    uint8_t* indices;
+    const uint8_t* repeat;              // 1 where a pixel repeats the previous frame; NULL for none
+    int transparent;
+    int min_code_size;
+    GifFrame* frames;
+    int frame_count;
+    int next;                           // Next frame to code (atomic)
+    int failed;
+} GifJob;
+
+static void* frame_worker(void* arg) {
+    GifJob* job = (GifJob*)arg;
+    LzwEncoder* lzw = (LzwEncoder*)malloc(sizeof(LzwEncoder));
+    if (!lzw) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    size_t page = (size_t)job->width * job->page_height;
+    for (;;) {
+        int f = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (f >= job->frame_count) break;
+        uint8_t* indices = job->indices + page * f;
+        if (!job->exact && thinpic_palette_map(job->pixels + page * f * job->bands, job->width, job->page_height,
+                                               job->bands, job->palette, job->palette_size, job->dither,
+                                               indices) != 0) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (job->repeat) {
+            const uint8_t* repeat = job->repeat + page * f;
+            for (size_t i = 0; i < page; i++) {
+                if (repeat[i]) indices[i] = (uint8_t)job->transparent;
+            }
+        }
+        GifFrame* frame = &job->frames[f];
+        lzw_encode(lzw, &frame->data, indices, job->width, frame->left, frame->top, frame->width, frame->height,
+                   job->min_code_size);
+        if (frame->data.failed) __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    free(lzw);
+    return NULL;
+}
+
+// Marks every pixel of frames after the first that is within tolerance of
+// what is on screen, and crops each frame to the pixels that are not
+static void find_repeats(const uint8_t* pixels, int width, int page_height, int bands, int frame_count,
+                         int tolerance, uint8_t* repeat, uint8_t* shown, GifFrame* frames) {
+    size_t page = (size_t)width * page_height;
+    memcpy(shown, pixels, page * bands);
+    for (int f = 1; f < frame_count; f++) {
+        const uint8_t* frame = pixels + page * f * bands;
+        uint8_t* marks = repeat + page * f;
+        int left = width, top = page_height, right = -1, bottom = -1;
+        for (int y = 0; y < page_height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t i = (size_t)y * width + x;
+                const uint8_t* p = frame + i * bands;
+                uint8_t* s = shown + i * bands;
+                int same = 1;
+                for (int c = 0; c < bands; c++) {
+                    int difference = p[c] - s[c];
+                    if (difference > tolerance || difference < -tolerance) {
+                        same = 0;
+                        break;
+                    }
+                }
+                marks[i] = (uint8_t)same;
+                if (same) continue;
+                memcpy(s, p, (size_t)bands);
+                if (x < left) left = x;
+                if (x > right) right = x;
+                if (y < top) top = y;
+                if (y > bottom) bottom = y;
+            }
+        }
+        // An unchanged frame still has to hold its delay: one clear pixel
+        if (right < 0) left = top = right = bottom = 0;
+        frames[f].left = left;
+        frames[f].top = top;
+        frames[f].width = right - left + 1;
+        frames[f].height = bottom - top + 1;
+    }
+}
+
+// Global palette for every frame; fills indices as well when it is exact.
+// Returns the palette size, or -1.
+static int build_palette(const uint8_t* pixels, size_t count, int bands, int colours, int needs_transparent,
+                         uint32_t* palette, int* exact, uint8_t* indices) {
+    // Fully transparent pixels pack to 0, which counts as one of the colours
+    int reserve = needs_transparent && bands == 3;
+    int palette_size = 0;
+    if (thinpic_exact_palette(pixels, count, bands, colours - reserve, palette, &palette_size, indices)) {
+        *exact = 1;
+        if (reserve) palette[palette_size++] = 0;
+        return palette_size;
+    }
+    *exact = 0;
+
+    uint32_t* samples = (uint32_t*)malloc(sizeof(uint32_t) * GIF_SAMPLES);
+    if (!samples) return -1;
+    int sample_count = 0;
+    double stride = count > GIF_SAMPLES ? (double)count / GIF_SAMPLES : 1.0;
+    for (int i = 0; i < GIF_SAMPLES && (size_t)(i * stride) < count; i++) {
+        const uint8_t* p = pixels + (size_t)(i * stride) * bands;
+        if (bands == 4 && p[3] == 0) continue;
+        samples[sample_count++] = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | 0xFFu << 24;
+    }
+    if (sample_count > 0) {
+        palette_size = thinpic_median_cut(samples, sample_count, colours - (needs_transparent ? 1 : 0), palette);
+    }
+    free(samples);
+    if (needs_transparent) palette[palette_size++] = 0;
+    return palette_size;
+}
+
+int thinpic_gif_save(VipsImage* image, const ThinpicGifParams* params, uint8_t** out, size_t* out_length) {
+    *out = NULL;
+    *out_length = 0;
+    int colours = params->colours < 2 ? 2 : (params->colours > GIF_COLOURS_MAX ? GIF_COLOURS_MAX : params->colours);
+    VipsImage* input = thinpic_palette_input(image);
+    if (!input) return -1;
+
+    int width = vips_image_get_width(input);
+    int height = vips_image_get_height(input);
+    int page_height = vips_image_get_page_height(input);
+    int bands = vips_image_get_bands(input);
+    int frame_count = height / page_height;
+    if (width > GIF_DIMENSION_MAX || page_height > GIF_DIMENSION_MAX) {
+        THINPIC_LOGE("Error: %dx%d is too large for GIF", width, page_height);
+        g_object_unref(input);
+        return -1;
+    }
+
+    GifFrame* frames = (GifFrame*)calloc((size_t)frame_count, sizeof(GifFrame));
+    if (!frames) {
+        g_object_unref(input);
+        return -1;
+    }
+    int* delays = NULL;
+    int delay_count = 0;
+    if (!vips_image_get_typeof(input, "delay") ||
+            vips_image_get_array_int(input, "delay", &delays, &delay_count) != 0) {
+        delay_count = 0;
+    }
+    for (int f = 0; f < frame_count; f++) {
+        frames[f].width = width;
+        frames[f].height = page_height;
+        frames[f].delay = f < delay_count ? (delays[f] + 5) / 10 : GIF_DEFAULT_DELAY_CS;
+    }
+    int loop = 0;
+    if (vips_image_get_typeof(input, "loop")) vips_image_get_int(input, "loop", &loop);
+
+    size_t size = 0;
+    uint8_t* pixels = (uint8_t*)vips_image_write_to_memory(input, &size);
+    g_object_unref(input);
+    size_t count = (size_t)width * height;
+    uint8_t* indices = pixels ? (uint8_t*)malloc(count) : NULL;
+    if (!indices) {
+        g_free(pixels);
+        free(frames);
+        return -1;
+    }
+
+    // GIF transparency is one bit: alpha is thresholded
+    int has_transparent = 0;
+    if (bands == 4) {
+        for (size_t i = 0; i < count; i++) {
+            uint8_t* p = pixels + i * 4;
+            if (p[3] < 128) {
+                memset(p, 0, 4);
+                has_transparent = 1;
+            } else {
+                p[3] = 255;
+            }
+        }
+    }
+
+    // Transparent pixels cannot be drawn over a previous frame, so
+    // animations with alpha clear each frame instead of repeating pixels
+    int interframe = params->interframe >= 0 && frame_count > 1 && bands == 3;
+    uint8_t* repeat = NULL;
+    if (interframe) {
+        repeat = (uint8_t*)calloc(count, 1);
+        uint8_t* shown = repeat ? (uint8_t*)malloc((size_t)width * page_height * bands) : NULL;
+        if (shown) {
+            find_repeats(pixels, width, page_height, bands, frame_count, params->interframe, repeat, shown, frames);
+        } else {
+            free(repeat);
+            repeat = NULL;
+            interframe = 0;
+        }
+        free(shown);
+    }
+
+    uint32_t palette[GIF_COLOURS_MAX];
+    int exact = 0;
+    int palette_size = build_palette(pixels, count, bands, colours, has_transparent || interframe, palette, &exact,
+                                     indices);
+    int transparent = -1;
+    for (int i = 0; i < palette_size; i++) {
+        if (palette[i] == 0) transparent = i;
+    }
+    int table_bits = 1;
+    while ((1 << table_bits) < palette_size) table_bits++;
+
+    GifJob job;
+    memset(&job, 0, sizeof(job));
+    job.pixels = pixels;
+    job.width = width;
+    job.page_height = page_height;
+    job.bands = bands;
+    job.palette = palette;
+    job.palette_size = palette_size;
+    job.exact = exact;
+    job.dither = params->dither;
+    job.indices = indices;
+    job.repeat = repeat;
+    job.transparent = transparent;
+    job.min_code_size = table_bits < 2 ? 2 : table_bits;
+    job.frames = frames;
+    job.frame_count = frame_count;
+    job.failed = palette_size < 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = params->threads > 0 ? params->threads : (cpus > 0 ? (int)cpus : 1);
+    if (workers > frame_count) workers = frame_count;
+    pthread_t threads[16];
+    if (workers > 16) workers = 16;
+    int started = 0;
+    if (!job.failed) {
+        for (int i = 1; i < workers; i++) {
+            if (pthread_create(&threads[started], NULL, frame_worker, &job) != 0) break;
+            started++;
+        }
+        // The caller codes frames too, and all of them without a spare thread
+        frame_worker(&job);
+        for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    }
+    g_free(pixels);
+    free(indices);
+    free(repeat);
+
+    GifBuffer gif = {NULL, 0, 0, 0};
+    if (!job.failed) {
+        put_bytes(&gif, "GIF89a", 6);
+        put_u16(&gif, width);
+        put_u16(&gif, page_height);
+        put_byte(&gif, (uint8_t)(0x80 | 0x70 | (table_bits - 1)));  // Global table, 8-bit source
+        put_byte(&gif, 0);                                          // Background index
+        put_byte(&gif, 0);                                          // Square pixels
+        for (int i = 0; i < (1 << table_bits); i++) {
+            uint32_t colour = i < palette_size ? palette[i] : 0;
+            uint8_t rgb[3] = {(uint8_t)colour, (uint8_t)(colour >> 8), (uint8_t)(colour >> 16)};
+            put_bytes(&gif, rgb, 3);
+        }
+        if (frame_count > 1) {
+            put_bytes(&gif, "\x21\xFF\x0BNETSCAPE2.0\x03\x01", 16);
+            put_u16(&gif, loop);
+            put_byte(&gif, 0);
+        }
+        // Repeating frames leave the last one in place; with alpha, clear it
+        int disposal = frame_count > 1 ? (interframe ? 1 : 2) : 0;
+        for (int f = 0; f < frame_count; f++) {
+            if (frame_count > 1 || transparent >= 0) {
+                put_bytes(&gif, "\x21\xF9\x04", 3);
+                put_byte(&gif, (uint8_t)(disposal << 2 | (transparent >= 0 ? 1 : 0)));
+                put_u16(&gif, frames[f].delay);
+                put_byte(&gif, (uint8_t)(transparent >= 0 ? transparent : 0));
+                put_byte(&gif, 0);
+            }
+            put_byte(&gif, 0x2C);
+            put_u16(&gif, frames[f].left);
+            put_u16(&gif, frames[f].top);
+            put_u16(&gif, frames[f].width);
+            put_u16(&gif, frames[f].height);
+            put_byte(&gif, 0);                                      // No local table, not interlaced
+            put_bytes(&gif, frames[f].data.data, frames[f].data.length);
+        }
+        put_byte(&gif, 0x3B);
+    }
+    for (int f = 0; f < frame_count; f++) g_free(frames[f].data.data);
+    free(frames);
+
+    if (job.failed || gif.failed) {
+        THINPIC_LOGE("Error: GIF encoding failed");
+        g_free(gif.data);
+        return -1;
+    }
+    *out = gif.data;
+    *out_length = gif.length;
+    THINPIC_LOGD("GIF: %dx%d, %d frames, %d colours%s, %d threads, %zu bytes", width, page_height, frame_count,
+                 palette_size, exact ? " (exact)" : "", started + 1, gif.length);
+    return 0;
+}
@@ -0,0 +1,318 @@
+// GPU resize stage (thinpic_configure gpu_resize_min_mp): Lanczos3
+// downscales of large 8-bit images run as two GLES 3.1 compute passes,
+// horizontal then vertical, each storing 8-bit results like vips_reduceh and
+// vips_reducev. The full window is applied at every scale rather than a box
+// shrink followed by a short reduce. There is one EGL context for the
+// process; a job that finds it busy, or an image the GPU cannot take, gets
+// "not handled" and stays on vips_resize.
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#ifdef __ANDROID__
+#include <pthread.h>
+#include <EGL/egl.h>
+#include <GLES3/gl31.h>
+
+#ifndef EGL_OPENGL_ES3_BIT_KHR
+#define EGL_OPENGL_ES3_BIT_KHR 0x0040
+#endif
+#define EGL_CONTEXT_MINOR_VERSION 0x30FB
+
+#define WORKGROUP 16
+
+static const char* const shader_body =
+    "precision highp float;\n"
+    "layout(local_size_x = 16, local_size_y = 16) in;\n"
+    "uniform highp sampler2D source;\n"
+    "layout(rgba8, binding = 0) writeonly uniform highp image2D target;\n"
+    "uniform float scale;\n"
+    "uniform int source_length;\n"
+    "uniform ivec2 target_size;\n"
+    "float lanczos3(float x) {\n"
+    "    x = abs(x);\n"
+    "    if (x < 1e-5) return 1.0;\n"
+    "    if (x >= 3.0) return 0.0;\n"
+    "    float px = 3.14159265 * x;\n"
+    "    return 3.0 * sin(px) * sin(px / 3.0) / (px * px);\n"
+    "}\n"
+    "void main() {\n"
+    "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    if (pos.x >= target_size.x || pos.y >= target_size.y) return;\n"
+    "#ifdef HORIZONTAL\n"
+    "    int along = pos.x;\n"
+    "#else\n"
+    "    int along = pos.y;\n"
+    "#endif\n"
+    "    float center = (float(along) + 0.5) / scale - 0.5;\n"
+    "    float support = 3.0 / scale;\n"
+    "    int first = int(floor(center - support)) + 1;\n"
+    "    int last = int(floor(center + support));\n"
+    "    vec4 sum = vec4(0.0);\n"
+    "    float total = 0.0;\n"
+    "    for (int i = first; i <= last; i++) {\n"
+    "        float weight = lanczos3((float(i) - center) * scale);\n"
+    "        int s = clamp(i, 0, source_length - 1);\n"
+    "#ifdef HORIZONTAL\n"
+    "        sum += weight * texelFetch(source, ivec2(s, pos.y), 0);\n"
+    "#else\n"
+    "        sum += weight * texelFetch(source, ivec2(pos.x, s), 0);\n"
+    "#endif\n"
+    "        total += weight;\n"
+    "    }\n"
+    "    imageStore(target, pos, sum / total);\n"
+    "}\n";
+
+// All GL state below is guarded by gpu_mutex and only touched with the
+// context current on the calling thread
+static pthread_mutex_t gpu_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int gpu_state = 0;           // 0 = not tried, 1 = ready, -1 = unavailable
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+static GLuint passes[2];            // Horizontal, vertical
+static GLint max_texture_size = 0;
+
+static GLuint build_pass(int horizontal) {
+    const char* sources[] = {
+        "#version 310 es\n",
+        horizontal ? "#define HORIZONTAL 1\n" : "\n",
+        shader_body,
+    };
+    GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 3, sources, NULL);
+    glCompileShader(shader);
+    GLint ok = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        THINPIC_LOGW("GPU resize shader failed: %s", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// Called with gpu_mutex held; leaves the context current on success
+static int create_context(void) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) return 0;
+    const EGLint config_attributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint configs = 0;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &configs) || configs < 1) return 0;
+    const EGLint context_attributes[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 1,
+        EGL_NONE,
+    };
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+    if (context == EGL_NO_CONTEXT) return 0;
+    // Compute needs no drawable, but not every driver has surfaceless contexts
+    const EGLint surface_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    surface = eglCreatePbufferSurface(display, config, surface_attributes);
+    if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context)) return 0;
+
+    passes[0] = build_pass(1);
+    passes[1] = build_pass(0);
+    if (!passes[0] || !passes[1]) return 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    THINPIC_LOGI("GPU resize ready on %s (max texture %d)", (const char*)glGetString(GL_RENDERER),
+                 max_texture_size);
+    return 1;
+}
+
+static void destroy_context(void) {
+    if (display == EGL_NO_DISPLAY) return;
+    if (context != EGL_NO_CONTEXT && eglMakeCurrent(display, surface, surface, context)) {
+        for (int i = 0; i < 2; i++) {
+            if (passes[i]) glDeleteProgram(passes[i]);
+            passes[i] = 0;
+        }
+    }
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+    if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+    context = EGL_NO_CONTEXT;
+    surface = EGL_NO_SURFACE;
+}
+
+// Called with gpu_mutex held
+static int make_current(void) {
+    if (gpu_state == 0) {
+        gpu_state = create_context() ? 1 : -1;
+        if (gpu_state < 0) {
+            THINPIC_LOGI("GPU resize unavailable (no GLES 3.1 compute)");
+            destroy_context();
+        }
+        return gpu_state > 0;
+    }
+    return gpu_state > 0 && eglMakeCurrent(display, surface, surface, context);
+}
+
+static GLuint new_texture(GLenum internal_format, int width, int height) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return texture;
+}
+
+static void run_pass(GLuint program, GLuint source, GLuint target, double scale, int source_length,
+                     int target_width, int target_height) {
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glUniform1i(glGetUniformLocation(program, "source"), 0);
+    glUniform1f(glGetUniformLocation(program, "scale"), (GLfloat)scale);
+    glUniform1i(glGetUniformLocation(program, "source_length"), source_length);
+    glUniform2i(glGetUniformLocation(program, "target_size"), target_width, target_height);
+    glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glDispatchCompute((GLuint)(target_width + WORKGROUP - 1) / WORKGROUP,
+                      (GLuint)(target_height + WORKGROUP - 1) / WORKGROUP, 1);
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+}
+
+// Uploads pixels, runs both passes and reads the RGBA result into rgba.
+// Called with the context current.
+static int resize_on_gpu(const uint8_t* pixels, int bands, int width, int height, double scale,
+                         int out_width, int out_height, uint8_t* rgba) {
+    static const GLenum internal_formats[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    GLuint source = new_texture(internal_formats[bands - 1], width, height);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, formats[bands - 1], GL_UNSIGNED_BYTE, pixels);
+    GLuint middle = new_texture(GL_RGBA8, out_width, height);
+    GLuint target = new_texture(GL_RGBA8, out_width, out_height);
+
+    run_pass(passes[0], source, middle, scale, width, out_width, height);
+    run_pass(passes[1], middle, target, scale, height, out_width, out_height);
+
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+    int complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (complete) {
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, out_width, out_height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    GLuint textures[] = {source, middle, target};
+    glDeleteTextures(3, textures);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) THINPIC_LOGW("GPU resize failed: GL error 0x%x", error);
+    return complete && error == GL_NO_ERROR;
+}
+
+// Memory image of the resized pixels with the input's header fields
+static VipsImage* result_image(VipsImage* image, const uint8_t* rgba, int bands, int width, int height) {
+    VipsImage* out = vips_image_new_memory();
+    if (vips_image_pipelinev(out, VIPS_DEMAND_STYLE_THINSTRIP, image, NULL)) {
+        g_object_unref(out);
+        return NULL;
+    }
+    out->Xsize = width;
+    out->Ysize = height;
+    uint8_t* row = g_malloc((gsize)width * bands);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = rgba + (size_t)y * width * 4;
+        for (int x = 0; x < width; x++) {
+            memcpy(row + (size_t)x * bands, in + (size_t)x * 4, (size_t)bands);
+        }
+        if (vips_image_write_line(out, y, row)) {
+            g_free(row);
+            g_object_unref(out);
+            return NULL;
+        }
+    }
+    g_free(row);
+    return out;
+}
+
+int thinpic_gpu_resize(VipsImage* image, VipsImage** out, double scale) {
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    int bands = vips_image_get_bands(image);
+    if (scale >= 1.0 || scale <= 0.0 || vips_image_get_format(image) != VIPS_FORMAT_UCHAR ||
+        bands < 1 || bands > 4 || vips_image_get_n_pages(image) > 1) {
+        return 1;
+    }
+    int out_width = (int)(width * scale + 0.5);
+    int out_height = (int)(height * scale + 0.5);
+    if (out_width < 1) out_width = 1;
+    if (out_height < 1) out_height = 1;
+
+    // One context for the process; a busy GPU sends the job back to the CPU
+    if (pthread_mutex_trylock(&gpu_mutex) != 0) return 1;
+    if (!make_current()) {
+        pthread_mutex_unlock(&gpu_mutex);
+        return 1;
+    }
+    if (width > max_texture_size || height > max_texture_size) {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        pthread_mutex_unlock(&gpu_mutex);
+        return 1;
+    }
+
+    int traced = thinpic_trace_begin("thinpic gpu resize %dx%d -> %dx%d", width, height, out_width, out_height);
+    int status = 1;
+    size_t size = 0;
+    void* pixels = vips_image_write_to_memory(image, &size);
+    uint8_t* rgba = pixels ? g_malloc((gsize)out_width * out_height * 4) : NULL;
+    int resized = rgba && resize_on_gpu(pixels, bands, width, height, scale, out_width, out_height, rgba);
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    pthread_mutex_unlock(&gpu_mutex);
+    g_free(pixels);
+
+    if (resized) {
+        *out = result_image(image, rgba, bands, out_width, out_height);
+        status = *out ? 0 : 1;
+    } else {
+        vips_error_clear();
+    }
+    g_free(rgba);
+    thinpic_trace_end(traced);
+    return status;
+}
+
+void thinpic_gpu_drain(void) {
+    pthread_mutex_lock(&gpu_mutex);
+    destroy_context();
+    // The next resize may build it again
+    gpu_state = 0;
+    pthread_mutex_unlock(&gpu_mutex);
+}
+#else
+int thinpic_gpu_resize(VipsImage* image, VipsImage** out, double scale) {
+    (void)image;
+    (void)out;
+    (void)scale;
+    return 1;
+}
+
+void thinpic_gpu_drain(void) {
+}
+#endif
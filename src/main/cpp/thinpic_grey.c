@@ -0,0 +1,71 @@
+// Grey content in colour clothing. Scanned documents and black-and-white
+// photos arrive as 3-band sRGB (JPEG decoders and phone scanners rarely
+// write greyscale), and every encoder then carries two chroma planes of
+// noise. A pass over an image already rendered into memory measures how
+// far each pixel's red and blue stray from its green: one clearly coloured
+// pixel rejects the image, and the mean squared deviation has to stay
+// within JPEG's chroma noise. Grey images are re-rendered as one band
+// (plus alpha), which JPEG and PNG write as greyscale files.
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Pixels scanned between early-out checks
+#define SCAN_CHUNK 4096
+// A pixel whose red or blue is further than this from its green is colour
+#define GREY_MAX_DEVIATION 12
+// Mean squared deviation allowed over the whole image
+#define GREY_MAX_MEAN_SQUARE 2.0
+
+// Largest deviation in the chunk, with the sum of squares added to *squares.
+// Fixed-stride loops the compiler vectorises (NEON ld3/ld4).
+static int chunk_deviation(const uint8_t* p, size_t count, int bands, uint64_t* squares) {
+    int largest = 0;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* pixel = p + i * bands;
+        int red = pixel[0] - pixel[1];
+        int blue = pixel[2] - pixel[1];
+        int red_deviation = red < 0 ? -red : red;
+        int blue_deviation = blue < 0 ? -blue : blue;
+        largest = red_deviation > largest ? red_deviation : largest;
+        largest = blue_deviation > largest ? blue_deviation : largest;
+        sum += (uint32_t)(red * red + blue * blue);
+    }
+    *squares += sum;
+    return largest;
+}
+
+int thinpic_grey_content(VipsImage* image) {
+    // A lazy image would be decoded a second time by the scan
+    if (!image || !image->data || vips_image_get_format(image) != VIPS_FORMAT_UCHAR ||
+            vips_image_get_interpretation(image) != VIPS_INTERPRETATION_sRGB) {
+        return 0;
+    }
+    int bands = vips_image_get_bands(image);
+    if (bands != 3 && bands != 4) return 0;
+    size_t pixels = (size_t)vips_image_get_width(image) * vips_image_get_height(image);
+    uint64_t squares = 0;
+    for (size_t start = 0; start < pixels; start += SCAN_CHUNK) {
+        size_t count = pixels - start < SCAN_CHUNK ? pixels - start : SCAN_CHUNK;
+        const uint8_t* chunk = (const uint8_t*)image->data + start * bands;
+        if (chunk_deviation(chunk, count, bands, &squares) > GREY_MAX_DEVIATION) return 0;
+    }
+    // Two chroma differences per pixel
+    return pixels > 0 && (double)squares / (2.0 * pixels) <= GREY_MAX_MEAN_SQUARE;
+}
+
+int thinpic_to_grey(VipsImage* image, VipsImage** out) {
+    if (!thinpic_grey_content(image)) return 0;
+    VipsImage* grey = NULL;
+    if (vips_colourspace(image, &grey, VIPS_INTERPRETATION_B_W, NULL)) return -1;
+    // Rendered like its source, so later scans and repeated encodes read memory
+    *out = vips_image_copy_memory(grey);
+    g_object_unref(grey);
+    if (!*out) return -1;
+    // An sRGB profile does not describe one band
+    vips_image_remove(*out, VIPS_META_ICC_NAME);
+    THINPIC_LOGD("Grey content encoded as %d band(s) (%dx%d)", vips_image_get_bands(*out),
+                 vips_image_get_width(image), vips_image_get_height(image));
+    return 1;
+}
@@ -0,0 +1,216 @@
+// HEIC, HEIF and AVIF inputs through the platform's image decoder on
+// Android 11+ (AImageDecoder, libjnigraphics), which drives the hardware
+// HEVC decoder where the device has one and the system AV1 decoder for
+// AVIF on Android 12+. The bundled libvips has no libheif, so without this
+// a phone's own photos fail to open; a libvips that does have it decodes in
+// software, several times slower (thinpic_configure platform_decode makes
+// the platform the first choice there too). The whole image is decoded
+// once, upright and converted to sRGB by the platform, into 8-bit RGBA that
+// becomes a memory image; it carries no orientation, and the pipeline's
+// "vips-loader" is heifload as before. The source's EXIF and ICC profile
+// are not carried over. Anything the platform cannot decode goes to
+// libvips.
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+static int prefer_platform = 0;
+
+void thinpic_platform_decode_set(int prefer) {
+    __atomic_store_n(&prefer_platform, prefer ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+#ifdef __ANDROID__
+#include <android/api-level.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Constants from <android/imagedecoder.h>, <android/bitmap.h> and
+// <android/data_space.h>
+#define DECODER_SUCCESS 0
+#define BITMAP_FORMAT_RGBA_8888 1
+#define BITMAP_FLAGS_ALPHA_OPAQUE 1
+#define DATASPACE_SRGB 142671872
+
+static struct {
+    int (*create_from_fd)(int fd, void** decoder);
+    int (*create_from_buffer)(const void* buffer, size_t length, void** decoder);
+    void (*delete_decoder)(void* decoder);
+    const void* (*get_header_info)(const void* decoder);
+    int32_t (*header_width)(const void* info);
+    int32_t (*header_height)(const void* info);
+    int (*header_alpha_flags)(const void* info);
+    int (*set_bitmap_format)(void* decoder, int32_t format);
+    int (*set_unpremultiplied)(void* decoder, bool required);
+    int (*set_data_space)(void* decoder, int32_t data_space);
+    size_t (*minimum_stride)(void* decoder);
+    int (*decode_image)(void* decoder, void* pixels, size_t stride, size_t size);
+} decoder_api;
+
+static pthread_once_t decoder_once = PTHREAD_ONCE_INIT;
+static int decoder_loaded = 0;
+
+static int load_jnigraphics(void) {
+    void* library = dlopen("libjnigraphics.so", RTLD_NOW | RTLD_LOCAL);
+    if (!library) return 0;
+#define LOAD(field, symbol) \
+    if (!(*(void**)&decoder_api.field = dlsym(library, symbol))) return 0
+    LOAD(create_from_fd, "AImageDecoder_createFromFd");
+    LOAD(create_from_buffer, "AImageDecoder_createFromBuffer");
+    LOAD(delete_decoder, "AImageDecoder_delete");
+    LOAD(get_header_info, "AImageDecoder_getHeaderInfo");
+    LOAD(header_width, "AImageDecoderHeaderInfo_getWidth");
+    LOAD(header_height, "AImageDecoderHeaderInfo_getHeight");
+    LOAD(header_alpha_flags, "AImageDecoderHeaderInfo_getAlphaFlags");
+    LOAD(set_bitmap_format, "AImageDecoder_setAndroidBitmapFormat");
+    LOAD(set_unpremultiplied, "AImageDecoder_setUnpremultipliedRequired");
+    LOAD(set_data_space, "AImageDecoder_setDataSpace");
+    LOAD(minimum_stride, "AImageDecoder_getMinimumStride");
+    LOAD(decode_image, "AImageDecoder_decodeImage");
+#undef LOAD
+    return 1;
+}
+
+static void find_image_decoder(void) {
+    decoder_loaded = android_get_device_api_level() >= 30 && load_jnigraphics();
+    THINPIC_LOGI("AImageDecoder HEIF decode: %s", decoder_loaded ? "available" : "none");
+}
+
+// The format a path, descriptor or buffer input sniffs as; a path is
+// opened into *opened, which the caller closes
+static ImageFormat input_format(const ThinpicInput* input, int* opened) {
+    *opened = -1;
+    if (input->data) return thinpic_sniff_format(input->data, input->length);
+    int fd = input->fd;
+    if (input->path) {
+        fd = *opened = open(input->path, O_RDONLY | O_CLOEXEC);
+    }
+    // AImageDecoder seeks; a pipe would lose the bytes libvips needs
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) return FORMAT_AUTO;
+    return thinpic_sniff_descriptor(fd);
+}
+
+static int wanted(ImageFormat format) {
+    if (format != FORMAT_HEIF && format != FORMAT_AVIF) return 0;
+    pthread_once(&decoder_once, find_image_decoder);
+    if (!decoder_loaded) return 0;
+    return __atomic_load_n(&prefer_platform, __ATOMIC_RELAXED) ||
+           !vips_type_find("VipsOperation", "heifload_buffer");
+}
+
+int thinpic_platform_decodes(const ThinpicInput* input) {
+    if (!input || input->image) return 0;
+    int opened;
+    ImageFormat format = input_format(input, &opened);
+    if (opened >= 0) close(opened);
+    return wanted(format);
+}
+
+static void free_with_image(VipsImage* image, gpointer data) {
+    (void)image;
+    g_free(data);
+}
+
+// RGBA rows from the decoder as an sRGB memory image, alpha dropped when
+// the source is opaque
+static VipsImage* decode(void* decoder, ImageFormat format) {
+    const void* info = decoder_api.get_header_info(decoder);
+    int width = decoder_api.header_width(info);
+    int height = decoder_api.header_height(info);
+    int opaque = decoder_api.header_alpha_flags(info) == BITMAP_FLAGS_ALPHA_OPAQUE;
+    if (width <= 0 || height <= 0 || !thinpic_input_size_allowed(width, height, opaque ? 3 : 4) ||
+            decoder_api.set_bitmap_format(decoder, BITMAP_FORMAT_RGBA_8888) != DECODER_SUCCESS ||
+            decoder_api.set_unpremultiplied(decoder, true) != DECODER_SUCCESS) {
+        return NULL;
+    }
+    // Wide-gamut and HDR sources are mapped into sRGB by the platform
+    decoder_api.set_data_space(decoder, DATASPACE_SRGB);
+
+    size_t stride = decoder_api.minimum_stride(decoder);
+    size_t size = stride * (size_t)height;
+    uint8_t* pixels = g_try_malloc(size);
+    if (!pixels) return NULL;
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_DECODE);
+    int traced = thinpic_trace_begin("AImageDecoder %dx%d", width, height);
+    int status = decoder_api.decode_image(decoder, pixels, stride, size);
+    thinpic_trace_end(traced);
+    thinpic_stage_end(THINPIC_STAGE_DECODE, started);
+    if (status != DECODER_SUCCESS || thinpic_cancel_requested()) {
+        g_free(pixels);
+        return NULL;
+    }
+
+    // The decoder pads rows to its stride; pack them for the memory image
+    size_t row = (size_t)width * 4;
+    if (stride != row) {
+        for (int y = 1; y < height; y++) memmove(pixels + (size_t)y * row, pixels + (size_t)y * stride, row);
+    }
+    VipsImage* image = vips_image_new_from_memory(pixels, row * (size_t)height, width, height, 4,
+                                                  VIPS_FORMAT_UCHAR);
+    if (!image) {
+        g_free(pixels);
+        return NULL;
+    }
+    g_signal_connect(image, "postclose", G_CALLBACK(free_with_image), pixels);
+    VipsImage* next = NULL;
+    int failed = opaque ? vips_extract_band(image, &next, 0, "n", 3, NULL)
+                        : vips_copy(image, &next, NULL);
+    g_object_unref(image);
+    if (failed) return NULL;
+    image = next;
+    if (vips_copy(image, &next, "interpretation", VIPS_INTERPRETATION_sRGB, NULL)) {
+        g_object_unref(image);
+        return NULL;
+    }
+    g_object_unref(image);
+    vips_image_set_string(next, VIPS_META_LOADER, "heifload");
+    THINPIC_LOGD("AImageDecoder: %s %dx%d%s", format == FORMAT_AVIF ? "AVIF" : "HEIF", width, height,
+                 opaque ? "" : " with alpha");
+    return next;
+}
+
+VipsImage* thinpic_platform_decode(const ThinpicInput* input) {
+    if (!input || input->image) return NULL;
+    int opened;
+    ImageFormat format = input_format(input, &opened);
+    VipsImage* image = NULL;
+    if (wanted(format)) {
+        void* decoder = NULL;
+        int created;
+        if (input->data) {
+            created = decoder_api.create_from_buffer(input->data, input->length, &decoder);
+        } else {
+            int fd = opened >= 0 ? opened : input->fd;
+            // The decoder reads from the current offset
+            created = lseek(fd, 0, SEEK_SET) == 0 ? decoder_api.create_from_fd(fd, &decoder) : -1;
+        }
+        if (created == DECODER_SUCCESS && decoder) {
+            image = decode(decoder, format);
+            decoder_api.delete_decoder(decoder);
+        }
+        if (!image) {
+            vips_error_clear();
+            THINPIC_LOGW("AImageDecoder could not decode the input; using libvips");
+        }
+    }
+    if (opened >= 0) close(opened);
+    return image;
+}
+#else
+int thinpic_platform_decodes(const ThinpicInput* input) {
+    (void)input;
+    return 0;
+}
+
+VipsImage* thinpic_platform_decode(const ThinpicInput* input) {
+    (void)input;
+    return NULL;
+}
+#endif
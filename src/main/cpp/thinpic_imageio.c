@@ -0,0 +1,141 @@
+// HEIC through Apple's ImageIO, which drives the hardware HEVC encoder on
+// iOS and Apple silicon; libheif in software is several times slower on a
+// phone. The pixels are rendered once to 8-bit memory and handed to
+// CGImageDestination with the image's ICC profile; other metadata is not
+// carried over. On other platforms the calls go to MediaCodec instead; when
+// the system has no HEIC encoder every call reports "not handled" and the
+// caller uses the libvips saver.
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreGraphics/CoreGraphics.h>
+#include <ImageIO/ImageIO.h>
+#include <pthread.h>
+
+#define HEIC_TYPE CFSTR("public.heic")
+
+static pthread_once_t heic_once = PTHREAD_ONCE_INIT;
+static int heic_encoder = 0;
+
+static void find_heic_encoder(void) {
+    CFArrayRef types = CGImageDestinationCopyTypeIdentifiers();
+    if (!types) return;
+    heic_encoder = CFArrayContainsValue(types, CFRangeMake(0, CFArrayGetCount(types)), HEIC_TYPE);
+    CFRelease(types);
+    THINPIC_LOGI("ImageIO HEIC encoder %s", heic_encoder ? "available" : "missing");
+}
+
+int thinpic_imageio_available(ImageFormat format) {
+    if (format != FORMAT_HEIF) return 0;
+    pthread_once(&heic_once, find_heic_encoder);
+    return heic_encoder;
+}
+
+static void release_pixels(void* info, const void* data, size_t size) {
+    (void)info;
+    (void)size;
+    g_free((void*)data);
+}
+
+// The image's own profile when it carries one, else sRGB (or gray)
+static CGColorSpaceRef image_colour_space(VipsImage* image, int gray) {
+    const void* icc = NULL;
+    size_t icc_length = 0;
+    if (vips_image_get_typeof(image, VIPS_META_ICC_NAME) &&
+        vips_image_get_blob(image, VIPS_META_ICC_NAME, &icc, &icc_length) == 0 && icc_length > 0) {
+        CFDataRef data = CFDataCreate(NULL, (const UInt8*)icc, (CFIndex)icc_length);
+        CGColorSpaceRef space = data ? CGColorSpaceCreateWithICCData(data) : NULL;
+        if (data) CFRelease(data);
+        if (space && CGColorSpaceGetNumberOfComponents(space) == (gray ? 1 : 3)) return space;
+        if (space) CGColorSpaceRelease(space);
+    }
+    return CGColorSpaceCreateWithName(gray ? kCGColorSpaceGenericGrayGamma2_2 : kCGColorSpaceSRGB);
+}
+
+static CGImageRef image_to_cgimage(VipsImage* image) {
+    int bands = vips_image_get_bands(image);
+    if (vips_image_get_format(image) != VIPS_FORMAT_UCHAR || (bands != 1 && bands != 3 && bands != 4)) {
+        return NULL;
+    }
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    size_t size = 0;
+    void* pixels = vips_image_write_to_memory(image, &size);
+    if (!pixels) return NULL;
+
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, pixels, size, release_pixels);
+    if (!provider) {
+        g_free(pixels);
+        return NULL;
+    }
+    CGColorSpaceRef space = image_colour_space(image, bands == 1);
+    CGBitmapInfo info = bands == 4 ? (CGBitmapInfo)kCGImageAlphaLast : (CGBitmapInfo)kCGImageAlphaNone;
+    CGImageRef cgimage = space ? CGImageCreate(width, height, 8, 8 * bands, (size_t)width * bands, space, info,
+                                               provider, NULL, false, kCGRenderingIntentDefault)
+                               : NULL;
+    if (space) CGColorSpaceRelease(space);
+    CGDataProviderRelease(provider);
+    return cgimage;
+}
+
+int thinpic_imageio_save(VipsImage* image, ImageFormat format, int quality, void** buffer, size_t* length) {
+    if (!thinpic_imageio_available(format)) return 1;
+    CGImageRef cgimage = image_to_cgimage(image);
+    if (!cgimage) return 1;
+
+    int traced = thinpic_trace_begin("thinpic imageio heic Q%d", quality);
+    thinpic_stage_encode();
+    int status = -1;
+    CFMutableDataRef data = CFDataCreateMutable(NULL, 0);
+    CGImageDestinationRef destination = data ? CGImageDestinationCreateWithData(data, HEIC_TYPE, 1, NULL) : NULL;
+    if (destination) {
+        float lossy = (quality < 1 ? 1 : quality > 100 ? 100 : quality) / 100.0f;
+        CFNumberRef number = CFNumberCreate(NULL, kCFNumberFloatType, &lossy);
+        const void* keys[] = {kCGImageDestinationLossyCompressionQuality};
+        const void* values[] = {number};
+        CFDictionaryRef properties = CFDictionaryCreate(NULL, keys, values, 1, &kCFTypeDictionaryKeyCallBacks,
+                                                        &kCFTypeDictionaryValueCallBacks);
+        CGImageDestinationAddImage(destination, cgimage, properties);
+        if (CGImageDestinationFinalize(destination)) {
+            // Callers release results with g_free (free_compressed_buffer)
+            CFIndex encoded = CFDataGetLength(data);
+            *buffer = g_malloc((gsize)encoded);
+            memcpy(*buffer, CFDataGetBytePtr(data), (size_t)encoded);
+            *length = (size_t)encoded;
+            status = 0;
+        } else {
+            THINPIC_LOGW("ImageIO HEIC encode failed; using libvips");
+        }
+        if (properties) CFRelease(properties);
+        if (number) CFRelease(number);
+        CFRelease(destination);
+    }
+    if (data) CFRelease(data);
+    CGImageRelease(cgimage);
+    thinpic_trace_end(traced);
+    return status == 0 ? 0 : 1;
+}
+#else
+// Everywhere else the platform encoder is MediaCodec (thinpic_mediacodec.c)
+int thinpic_imageio_available(ImageFormat format) {
+    return thinpic_mediacodec_available(format);
+}
+
+int thinpic_imageio_save(VipsImage* image, ImageFormat format, int quality, void** buffer, size_t* length) {
+    return thinpic_mediacodec_save(image, format, quality, buffer, length);
+}
+#endif
+
+int thinpic_imageio_save_target(VipsImage* image, ImageFormat format, int quality, VipsTarget* target) {
+    void* buffer = NULL;
+    size_t length = 0;
+    if (thinpic_imageio_save(image, format, quality, &buffer, &length) != 0) return 1;
+    int failed = vips_target_write(target, buffer, length) || vips_target_end(target);
+    g_free(buffer);
+    return failed ? -1 : 0;
+}
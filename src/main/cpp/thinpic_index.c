@@ -0,0 +1,623 @@
+// Gallery index (thinpic_index_images): size, orientation, capture time and
+// GPS presence for thousands of files, read from the container headers and
+// the EXIF alone. Sorting and grouping a camera roll through
+// get_image_info opened every file through its libvips loader, which for
+// HEIC means libheif parsing the whole item graph, and still left the
+// capture date unread. Here each file costs one read of its first
+// HEAD_BYTES, which nearly always holds everything, and a few preads at
+// offsets the headers give when it does not (a WebP's EXIF after its
+// bitstream, a HEIF Exif item in mdat):
+//  - JPEG: APP1 EXIF and the SOF dimensions, stopping at the first scan
+//  - PNG: IHDR and an eXIf chunk before the first IDAT
+//  - WebP: VP8X, VP8 or VP8L dimensions and the EXIF chunk
+//  - HEIF/AVIF: the primary item's ispe and irot and its Exif item; the
+//    size is reported upright, as the decoders apply irot themselves
+//  - TIFF: IFD0 and its EXIF and GPS IFDs in place; GIF: the screen size
+// Anything else, or a header these walks cannot make sense of, falls back
+// to probe_image_header. Files are spread over a few threads, as the work
+// is mostly waiting on storage.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define HEAD_BYTES 65536
+#define MARKERS_MAX 64              // Segments or chunks walked before giving up
+#define IFD_ENTRIES_MAX 512         // More than any real IFD; past this the block is malformed
+#define HEIF_META_MAX (1 << 20)     // Larger meta boxes are not a photo's
+#define PROPERTIES_MAX 256          // ipco entries kept for the primary item's lookup
+#define INDEX_WORKERS_MAX 16
+
+#define TAG_IMAGE_WIDTH 0x0100
+#define TAG_IMAGE_LENGTH 0x0101
+#define TAG_ORIENTATION 0x0112
+#define TAG_DATE_TIME 0x0132
+#define TAG_EXIF_IFD 0x8769
+#define TAG_GPS_IFD 0x8825
+#define TAG_DATE_TIME_ORIGINAL 0x9003
+#define TAG_GPS_LATITUDE 0x0002
+
+#define FOURCC(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+
+typedef struct {
+    int fd;
+    int64_t size;
+    uint8_t* head;               // The first head_length bytes of the file
+    size_t head_length;
+} IndexFile;
+
+static unsigned int read_u16(const uint8_t* p, int big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t read_u32(const uint8_t* p, int big_endian) {
+    return big_endian
+        ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+        : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static uint64_t read_u64_be(const uint8_t* p) {
+    return (uint64_t)read_u32(p, 1) << 32 | read_u32(p + 4, 1);
+}
+
+// iloc fields are 0, 4 or 8 bytes wide
+static uint64_t read_sized(const uint8_t* p, int size) {
+    return size == 8 ? read_u64_be(p) : size == 4 ? read_u32(p, 1) : 0;
+}
+
+// Exactly length bytes at offset, from the head when they are in it; 0 or -1
+static int file_read(const IndexFile* file, int64_t offset, void* buffer, size_t length) {
+    if (offset < 0 || offset + (int64_t)length > file->size) return -1;
+    if (offset + (int64_t)length <= (int64_t)file->head_length) {
+        memcpy(buffer, file->head + offset, length);
+        return 0;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t count = pread(file->fd, (uint8_t*)buffer + done, length - done, (off_t)(offset + done));
+        if (count <= 0) return -1;
+        done += (size_t)count;
+    }
+    return 0;
+}
+
+// Days from 1970-01-01 to a proleptic Gregorian date
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// "YYYY:MM:DD HH:MM:SS" as seconds since 1970, or -1 for blanks and zeros
+static int64_t parse_exif_time(const char* text) {
+    int year, month, day, hour, minute, second;
+    if (sscanf(text, "%4d:%2d:%2d %2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) != 6) return -1;
+    if (year < 1800 || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 ||
+            second > 60) {
+        return -1;
+    }
+    return days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+typedef struct {
+    const IndexFile* file;
+    int64_t base;                // File offset of the TIFF header
+    int64_t length;
+    int big_endian;
+} TiffBlock;
+
+// The entries of the IFD at offset into a g_malloc'd array; their count, or 0
+static int read_ifd(const TiffBlock* tiff, uint32_t offset, uint8_t** entries) {
+    uint8_t count_bytes[2];
+    *entries = NULL;
+    if (offset < 8 || offset + 2 > tiff->length || file_read(tiff->file, tiff->base + offset, count_bytes, 2)) {
+        return 0;
+    }
+    unsigned int count = read_u16(count_bytes, tiff->big_endian);
+    if (count == 0 || count > IFD_ENTRIES_MAX || offset + 2 + count * 12 > tiff->length) return 0;
+    *entries = (uint8_t*)g_malloc(count * 12);
+    if (file_read(tiff->file, tiff->base + offset + 2, *entries, count * 12)) {
+        g_free(*entries);
+        *entries = NULL;
+        return 0;
+    }
+    return (int)count;
+}
+
+// A SHORT or LONG entry's first value
+static uint32_t entry_value(const TiffBlock* tiff, const uint8_t* entry) {
+    unsigned int type = read_u16(entry + 2, tiff->big_endian);
+    return type == 3 ? read_u16(entry + 8, tiff->big_endian) : read_u32(entry + 8, tiff->big_endian);
+}
+
+static int64_t entry_time(const TiffBlock* tiff, const uint8_t* entry) {
+    uint32_t count = read_u32(entry + 4, tiff->big_endian);
+    uint32_t offset = read_u32(entry + 8, tiff->big_endian);
+    char text[20];
+    if (read_u16(entry + 2, tiff->big_endian) != 2 || count < 19 || offset + 19 > tiff->length ||
+            file_read(tiff->file, tiff->base + offset, text, 19)) {
+        return -1;
+    }
+    text[19] = '\0';
+    return parse_exif_time(text);
+}
+
+// A GPS IFD that holds a latitude other than 0/1, 0/1, 0/1: some cameras
+// write the IFD without a fix
+static int has_position(const TiffBlock* tiff, uint32_t offset) {
+    uint8_t* entries = NULL;
+    int count = read_ifd(tiff, offset, &entries);
+    int found = 0;
+    for (int i = 0; i < count && !found; i++) {
+        const uint8_t* entry = entries + i * 12;
+        if (read_u16(entry, tiff->big_endian) != TAG_GPS_LATITUDE) continue;
+        uint32_t values = read_u32(entry + 8, tiff->big_endian);
+        uint8_t rationals[24];
+        if (values + 24 > tiff->length || file_read(tiff->file, tiff->base + values, rationals, 24)) break;
+        for (int r = 0; r < 3; r++) found |= read_u32(rationals + r * 8, tiff->big_endian) != 0;
+    }
+    g_free(entries);
+    return found;
+}
+
+// EXIF (a TIFF block) at base: orientation, capture time and GPS presence,
+// and with `sized` the IFD0 dimensions of a TIFF file. 0 or -1
+static int parse_tiff(const IndexFile* file, int64_t base, int64_t length, int sized, ThinpicImageMeta* meta) {
+    uint8_t header[8];
+    if (length < 8 || file_read(file, base, header, sizeof(header))) return -1;
+    TiffBlock tiff = {file, base, length, header[0] == 'M'};
+    if ((header[0] != 'M' || header[1] != 'M') && (header[0] != 'I' || header[1] != 'I')) return -1;
+    if (read_u16(header + 2, tiff.big_endian) != 42) return -1;
+
+    uint8_t* entries = NULL;
+    int count = read_ifd(&tiff, read_u32(header + 4, tiff.big_endian), &entries);
+    uint32_t exif_ifd = 0;
+    uint32_t gps_ifd = 0;
+    int64_t date_time = -1;
+    for (int i = 0; i < count; i++) {
+        const uint8_t* entry = entries + i * 12;
+        unsigned int tag = read_u16(entry, tiff.big_endian);
+        if (tag == TAG_ORIENTATION) {
+            uint32_t orientation = entry_value(&tiff, entry);
+            if (orientation >= 1 && orientation <= 8) meta->orientation = (int)orientation;
+        } else if (tag == TAG_DATE_TIME) {
+            date_time = entry_time(&tiff, entry);
+        } else if (tag == TAG_EXIF_IFD) {
+            exif_ifd = read_u32(entry + 8, tiff.big_endian);
+        } else if (tag == TAG_GPS_IFD) {
+            gps_ifd = read_u32(entry + 8, tiff.big_endian);
+        } else if (sized && tag == TAG_IMAGE_WIDTH) {
+            meta->width = (int)entry_value(&tiff, entry);
+        } else if (sized && tag == TAG_IMAGE_LENGTH) {
+            meta->height = (int)entry_value(&tiff, entry);
+        }
+    }
+    g_free(entries);
+    if (count == 0) return -1;
+
+    // The shutter time when there is one; DateTime is when the file last changed
+    count = exif_ifd ? read_ifd(&tiff, exif_ifd, &entries) : 0;
+    for (int i = 0; i < count; i++) {
+        const uint8_t* entry = entries + i * 12;
+        if (read_u16(entry, tiff.big_endian) == TAG_DATE_TIME_ORIGINAL) {
+            meta->capture_time = entry_time(&tiff, entry);
+        }
+    }
+    if (count) g_free(entries);
+    if (meta->capture_time < 0) meta->capture_time = date_time;
+    if (gps_ifd) meta->has_gps = has_position(&tiff, gps_ifd);
+    return 0;
+}
+
+// An EXIF payload that may still carry its "Exif\0\0" prefix (WebP, HEIF)
+static void parse_exif_payload(const IndexFile* file, int64_t offset, int64_t length, ThinpicImageMeta* meta) {
+    uint8_t prefix[6];
+    if (length > 6 && file_read(file, offset, prefix, sizeof(prefix)) == 0 &&
+            memcmp(prefix, "Exif\0\0", 6) == 0) {
+        offset += 6;
+        length -= 6;
+    }
+    parse_tiff(file, offset, length, 0, meta);
+}
+
+static int index_jpeg(const IndexFile* file, ThinpicImageMeta* meta) {
+    int64_t offset = 2;
+    for (int n = 0; n < MARKERS_MAX; n++) {
+        uint8_t marker[4];
+        if (file_read(file, offset, marker, sizeof(marker)) || marker[0] != 0xFF) return -1;
+        if (marker[1] == 0xFF) {
+            // Fill byte before a marker
+            offset++;
+            continue;
+        }
+        if (marker[1] == 0xDA || marker[1] == 0xD9) return -1;
+        int length = marker[2] << 8 | marker[3];
+        if (length < 2) return -1;
+        int sof = marker[1] >= 0xC0 && marker[1] <= 0xCF && marker[1] != 0xC4 && marker[1] != 0xC8 &&
+                  marker[1] != 0xCC;
+        if (sof) {
+            // EXIF comes before the frame header, so this is the last segment needed
+            uint8_t frame[5];
+            if (length < 7 || file_read(file, offset + 4, frame, sizeof(frame))) return -1;
+            meta->height = frame[1] << 8 | frame[2];
+            meta->width = frame[3] << 8 | frame[4];
+            return meta->width > 0 && meta->height > 0 ? 0 : -1;
+        }
+        uint8_t signature[6];
+        if (marker[1] == 0xE1 && meta->capture_time < 0 && meta->orientation == 0 && length > 8 &&
+                file_read(file, offset + 4, signature, sizeof(signature)) == 0 &&
+                memcmp(signature, "Exif\0\0", 6) == 0) {
+            parse_tiff(file, offset + 10, length - 8, 0, meta);
+        }
+        offset += 2 + length;
+    }
+    return -1;
+}
+
+static int index_png(const IndexFile* file, ThinpicImageMeta* meta) {
+    uint8_t ihdr[8];
+    if (file_read(file, 16, ihdr, sizeof(ihdr))) return -1;
+    meta->width = (int)read_u32(ihdr, 1);
+    meta->height = (int)read_u32(ihdr + 4, 1);
+    int64_t offset = 8;
+    for (int n = 0; n < MARKERS_MAX; n++) {
+        uint8_t chunk[8];
+        if (file_read(file, offset, chunk, sizeof(chunk))) break;
+        uint32_t length = read_u32(chunk, 1);
+        uint32_t type = read_u32(chunk + 4, 1);
+        // eXIf must come before the image data
+        if (type == FOURCC('I', 'D', 'A', 'T') || type == FOURCC('I', 'E', 'N', 'D')) break;
+        if (type == FOURCC('e', 'X', 'I', 'f')) parse_tiff(file, offset + 8, length, 0, meta);
+        offset += 12 + (int64_t)length;
+    }
+    return meta->width > 0 && meta->height > 0 ? 0 : -1;
+}
+
+static int index_webp(const IndexFile* file, ThinpicImageMeta* meta) {
+    int64_t offset = 12;
+    for (int n = 0; n < MARKERS_MAX; n++) {
+        uint8_t chunk[18];
+        if (file_read(file, offset, chunk, 8)) break;
+        uint32_t type = read_u32(chunk, 1);
+        uint32_t length = read_u32(chunk + 4, 0);
+        if (type == FOURCC('V', 'P', '8', 'X') && length >= 10 && file_read(file, offset + 8, chunk + 8, 10) == 0) {
+            meta->width = 1 + (int)(chunk[12] | chunk[13] << 8 | chunk[14] << 16);
+            meta->height = 1 + (int)(chunk[15] | chunk[16] << 8 | chunk[17] << 16);
+        } else if (type == FOURCC('V', 'P', '8', ' ') && meta->width == 0 && length >= 10 &&
+                   file_read(file, offset + 8, chunk + 8, 10) == 0) {
+            if (chunk[11] == 0x9D && chunk[12] == 0x01 && chunk[13] == 0x2A) {
+                meta->width = (int)(read_u16(chunk + 14, 0) & 0x3FFF);
+                meta->height = (int)(read_u16(chunk + 16, 0) & 0x3FFF);
+            }
+        } else if (type == FOURCC('V', 'P', '8', 'L') && meta->width == 0 && length >= 5 &&
+                   file_read(file, offset + 8, chunk + 8, 5) == 0) {
+            if (chunk[8] == 0x2F) {
+                uint32_t bits = read_u32(chunk + 9, 0);
+                meta->width = (int)(bits & 0x3FFF) + 1;
+                meta->height = (int)((bits >> 14) & 0x3FFF) + 1;
+            }
+        } else if (type == FOURCC('E', 'X', 'I', 'F')) {
+            parse_exif_payload(file, offset + 8, length, meta);
+        }
+        offset += 8 + (int64_t)length + (length & 1);
+    }
+    return meta->width > 0 && meta->height > 0 ? 0 : -1;
+}
+
+// One ISO base media box at *offset in data, moved past; 0 at the end or on
+// a malformed box
+static int next_box(const uint8_t* data, size_t length, size_t* offset, uint32_t* type, size_t* body,
+                    size_t* body_length) {
+    if (*offset + 8 > length) return 0;
+    uint64_t size = read_u32(data + *offset, 1);
+    *type = read_u32(data + *offset + 4, 1);
+    size_t header = 8;
+    if (size == 1) {
+        if (*offset + 16 > length) return 0;
+        size = read_u64_be(data + *offset + 8);
+        header = 16;
+    } else if (size == 0) {
+        size = length - *offset;
+    }
+    if (size < header || size > length - *offset) return 0;
+    *body = *offset + header;
+    *body_length = (size_t)size - header;
+    *offset += (size_t)size;
+    return 1;
+}
+
+typedef struct {
+    uint32_t primary;
+    uint32_t exif_item;
+    int64_t exif_offset;         // File offset and length of the Exif item's first extent
+    int64_t exif_length;
+    int property_count;
+    uint32_t property_type[PROPERTIES_MAX];
+    size_t property_body[PROPERTIES_MAX];
+    size_t property_length[PROPERTIES_MAX];
+} HeifMeta;
+
+static void heif_item_infos(const uint8_t* box, size_t length, HeifMeta* heif) {
+    if (length < 6) return;
+    size_t offset = box[0] == 0 ? 6 : 8;
+    uint32_t type;
+    size_t body, body_length;
+    while (next_box(box, length, &offset, &type, &body, &body_length)) {
+        const uint8_t* infe = box + body;
+        if (type != FOURCC('i', 'n', 'f', 'e') || body_length < 12 || infe[0] < 2) continue;
+        int wide = infe[0] >= 3;
+        if (body_length < (size_t)(wide ? 14 : 12)) continue;
+        uint32_t id = wide ? read_u32(infe + 4, 1) : read_u16(infe + 4, 1);
+        uint32_t item_type = read_u32(infe + (wide ? 10 : 8), 1);
+        if (item_type == FOURCC('E', 'x', 'i', 'f')) heif->exif_item = id;
+    }
+}
+
+// The Exif item's location, from iloc (file offsets only, construction method 0)
+static void heif_locations(const uint8_t* box, size_t length, HeifMeta* heif) {
+    if (length < 8 || !heif->exif_item) return;
+    int version = box[0];
+    int offset_size = box[4] >> 4;
+    int length_size = box[4] & 15;
+    int base_offset_size = box[5] >> 4;
+    int index_size = version >= 1 ? box[5] & 15 : 0;
+    size_t at = 6;
+    uint32_t items = version < 2 ? read_u16(box + at, 1) : read_u32(box + at, 1);
+    at += version < 2 ? 2 : 4;
+    for (uint32_t i = 0; i < items; i++) {
+        size_t fixed = (version < 2 ? 2 : 4) + (version >= 1 ? 2 : 0) + 2 + base_offset_size + 2;
+        if (at + fixed > length) return;
+        uint32_t id = version < 2 ? read_u16(box + at, 1) : read_u32(box + at, 1);
+        at += version < 2 ? 2 : 4;
+        int method = version >= 1 ? box[at + 1] & 15 : 0;
+        at += version >= 1 ? 2 : 0;
+        at += 2;  // Data reference index
+        uint64_t base_offset = read_sized(box + at, base_offset_size);
+        at += base_offset_size;
+        unsigned int extents = read_u16(box + at, 1);
+        at += 2;
+        size_t extent_size = (size_t)index_size + offset_size + length_size;
+        if (at + extents * extent_size > length) return;
+        if (id == heif->exif_item && method == 0 && extents > 0) {
+            heif->exif_offset = (int64_t)(base_offset + read_sized(box + at + index_size, offset_size));
+            heif->exif_length = (int64_t)read_sized(box + at + index_size + offset_size, length_size);
+            return;
+        }
+        at += extents * extent_size;
+    }
+}
+
+// Size and rotation from the properties ipma associates with the primary item
+static int heif_properties(const uint8_t* meta, size_t length, HeifMeta* heif, ThinpicImageMeta* out) {
+    size_t offset = 0;
+    uint32_t type;
+    size_t body, body_length;
+    const uint8_t* ipma = NULL;
+    size_t ipma_length = 0;
+    while (next_box(meta, length, &offset, &type, &body, &body_length)) {
+        if (type == FOURCC('i', 'p', 'c', 'o')) {
+            size_t property = body;
+            size_t property_body, property_length;
+            while (heif->property_count < PROPERTIES_MAX &&
+                   next_box(meta, body + body_length, &property, &type, &property_body, &property_length)) {
+                heif->property_type[heif->property_count] = type;
+                heif->property_body[heif->property_count] = property_body;
+                heif->property_length[heif->property_count] = property_length;
+                heif->property_count++;
+            }
+        } else if (type == FOURCC('i', 'p', 'm', 'a')) {
+            ipma = meta + body;
+            ipma_length = body_length;
+        }
+    }
+    if (!ipma || ipma_length < 8) return -1;
+    int version = ipma[0];
+    int large_index = ipma[3] & 1;
+    uint32_t entries = read_u32(ipma + 4, 1);
+    size_t at = 8;
+    int angle = 0;
+    for (uint32_t e = 0; e < entries; e++) {
+        if (at + (version < 1 ? 3 : 5) > ipma_length) return -1;
+        uint32_t id = version < 1 ? read_u16(ipma + at, 1) : read_u32(ipma + at, 1);
+        at += version < 1 ? 2 : 4;
+        int associations = ipma[at++];
+        if (at + (size_t)associations * (large_index ? 2 : 1) > ipma_length) return -1;
+        for (int a = 0; a < associations; a++) {
+            int index = large_index ? (int)(read_u16(ipma + at, 1) & 0x7FFF) : ipma[at] & 0x7F;
+            at += large_index ? 2 : 1;
+            if (id != heif->primary || index < 1 || index > heif->property_count) continue;
+            const uint8_t* property = meta + heif->property_body[index - 1];
+            size_t property_length = heif->property_length[index - 1];
+            if (heif->property_type[index - 1] == FOURCC('i', 's', 'p', 'e') && property_length >= 12) {
+                out->width = (int)read_u32(property + 4, 1);
+                out->height = (int)read_u32(property + 8, 1);
+            } else if (heif->property_type[index - 1] == FOURCC('i', 'r', 'o', 't') && property_length >= 1) {
+                angle = property[0] & 3;
+            }
+        }
+        if (id == heif->primary) break;
+    }
+    if (angle == 1 || angle == 3) {
+        int width = out->width;
+        out->width = out->height;
+        out->height = width;
+    }
+    return out->width > 0 && out->height > 0 ? 0 : -1;
+}
+
+static int index_heif(const IndexFile* file, ThinpicImageMeta* meta) {
+    // The top-level boxes, read header by header, until meta
+    int64_t offset = 0;
+    uint64_t meta_size = 0;
+    for (int n = 0; n < MARKERS_MAX && !meta_size; n++) {
+        uint8_t header[16];
+        if (file_read(file, offset, header, 8)) return -1;
+        uint64_t size = read_u32(header, 1);
+        size_t header_size = 8;
+        if (size == 1) {
+            if (file_read(file, offset + 8, header + 8, 8)) return -1;
+            size = read_u64_be(header + 8);
+            header_size = 16;
+        }
+        if (size < header_size) return -1;
+        if (read_u32(header + 4, 1) == FOURCC('m', 'e', 't', 'a')) {
+            meta_size = size - header_size;
+            offset += header_size;
+        } else {
+            offset += (int64_t)size;
+        }
+    }
+    if (meta_size < 4 || meta_size > HEIF_META_MAX) return -1;
+    uint8_t* box = (uint8_t*)g_malloc((size_t)meta_size);
+    HeifMeta* heif = g_new0(HeifMeta, 1);
+    int status = -1;
+    if (file_read(file, offset, box, (size_t)meta_size) == 0) {
+        // A full box: its children follow the version and flags
+        const uint8_t* children = box + 4;
+        size_t length = (size_t)meta_size - 4;
+        size_t at = 0;
+        uint32_t type;
+        size_t body, body_length;
+        while (next_box(children, length, &at, &type, &body, &body_length)) {
+            const uint8_t* child = children + body;
+            if (type == FOURCC('p', 'i', 't', 'm') && body_length >= 6) {
+                heif->primary = child[0] == 0 ? read_u16(child + 4, 1)
+                              : body_length >= 8 ? read_u32(child + 4, 1) : 0;
+            } else if (type == FOURCC('i', 'i', 'n', 'f')) {
+                heif_item_infos(child, body_length, heif);
+            }
+        }
+        at = 0;
+        while (next_box(children, length, &at, &type, &body, &body_length)) {
+            if (type == FOURCC('i', 'l', 'o', 'c')) heif_locations(children + body, body_length, heif);
+            if (type == FOURCC('i', 'p', 'r', 'p')) {
+                status = heif_properties(children + body, body_length, heif, meta);
+            }
+        }
+        if (status == 0 && heif->exif_length > 4) {
+            uint8_t skip[4];
+            if (file_read(file, heif->exif_offset, skip, sizeof(skip)) == 0) {
+                int64_t tiff = 4 + (int64_t)read_u32(skip, 1);
+                if (tiff < heif->exif_length) {
+                    parse_exif_payload(file, heif->exif_offset + tiff, heif->exif_length - tiff, meta);
+                }
+            }
+            // libheif applies irot; the decoded image has nothing left to turn
+            meta->orientation = 0;
+        }
+    }
+    g_free(heif);
+    g_free(box);
+    return status;
+}
+
+static int index_gif(const IndexFile* file, ThinpicImageMeta* meta) {
+    uint8_t screen[4];
+    if (file_read(file, 6, screen, sizeof(screen))) return -1;
+    meta->width = (int)read_u16(screen, 0);
+    meta->height = (int)read_u16(screen + 2, 0);
+    return meta->width > 0 && meta->height > 0 ? 0 : -1;
+}
+
+// head holds HEAD_BYTES of the worker's own
+static void index_one(const char* path, uint8_t* head, ThinpicImageMeta* meta) {
+    memset(meta, 0, sizeof(*meta));
+    meta->format = FORMAT_AUTO;
+    meta->capture_time = -1;
+    meta->success = -1;
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        if (fd >= 0) close(fd);
+        THINPIC_LOGD("Index: cannot read %s", path ? path : "(null)");
+        return;
+    }
+    IndexFile file = {fd, (int64_t)file_stat.st_size, head, 0};
+    ssize_t count = pread(fd, head, HEAD_BYTES, 0);
+    file.head_length = count > 0 ? (size_t)count : 0;
+    meta->file_size = file.size;
+    meta->format = thinpic_sniff_format(head, file.head_length);
+
+    int parsed = -1;
+    switch (meta->format) {
+        case FORMAT_JPEG: parsed = index_jpeg(&file, meta); break;
+        case FORMAT_PNG: parsed = index_png(&file, meta); break;
+        case FORMAT_WEBP: parsed = index_webp(&file, meta); break;
+        case FORMAT_HEIF:
+        case FORMAT_AVIF: parsed = index_heif(&file, meta); break;
+        case FORMAT_GIF: parsed = index_gif(&file, meta); break;
+        case FORMAT_TIFF:
+            parsed = parse_tiff(&file, 0, file.size, 1, meta) == 0 && meta->width > 0 && meta->height > 0 ? 0 : -1;
+            break;
+        default: break;
+    }
+    close(fd);
+    if (parsed == 0) {
+        meta->success = 1;
+        return;
+    }
+    // Formats without a walk here, and headers it did not follow
+    ImageHeader header = probe_image_header(path);
+    if (header.success != 1) return;
+    meta->width = header.width;
+    meta->height = header.height;
+    if (meta->orientation == 0) meta->orientation = header.orientation;
+    meta->format = header.format;
+    meta->success = 1;
+}
+
+typedef struct {
+    const char** paths;
+    int count;
+    ThinpicImageMeta* out;
+    int next;
+    int succeeded;
+} IndexJob;
+
+static void* index_worker(void* arg) {
+    IndexJob* job = (IndexJob*)arg;
+    uint8_t* head = (uint8_t*)g_malloc(HEAD_BYTES);
+    for (;;) {
+        int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) break;
+        index_one(job->paths[i], head, &job->out[i]);
+        if (job->out[i].success == 1) __atomic_fetch_add(&job->succeeded, 1, __ATOMIC_RELAXED);
+    }
+    g_free(head);
+    return NULL;
+}
+
+int thinpic_index_images(const char** input_paths, int count, ThinpicImageMeta* out) {
+    if (!input_paths || count <= 0 || !out) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_index_images arguments");
+        return -1;
+    }
+    IndexJob job = {input_paths, count, out, 0, 0};
+    // Twice the cores: the threads mostly wait on storage
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus * 2 : 2;
+    if (workers > INDEX_WORKERS_MAX) workers = INDEX_WORKERS_MAX;
+    if (workers > count) workers = count;
+    pthread_t threads[INDEX_WORKERS_MAX];
+    int started = 0;
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, index_worker, &job) != 0) break;
+        started++;
+    }
+    // The caller indexes too, and all of them without a spare thread
+    index_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    THINPIC_LOGD("Indexed %d/%d images on %d threads", job.succeeded, count, started + 1);
+    return job.succeeded;
+}
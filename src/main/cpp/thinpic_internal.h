@@ -0,0 +1,746 @@
+#ifndef THINPIC_INTERNAL_H
+#define THINPIC_INTERNAL_H
+
+// Hooks shared between the native translation units; not part of the
+// public (ffigen) API in image_compressor.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vips/vips.h>
+
+#include "image_compressor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where a pipeline reads its encoded input from: `length` bytes at `data`,
+// else the file at `path`, else the open descriptor `fd` (when both are NULL).
+// Memory and descriptors must outlive the call; fd is never closed here.
+// `image` instead holds decoded pixels (THINPIC_SOURCE_PIXELS), with data,
+// path and fd unset; whoever made the input owns its reference. `page`
+// picks one page of a multi-page TIFF or PDF (0, the first, by default).
+typedef struct {
+    const char* path;
+    const void* data;
+    size_t length;
+    int fd;
+    VipsImage* image;
+    int page;
+} ThinpicInput;
+
+// Size of the tables indexed by ImageFormat; FORMAT_AUTO's slot is unused
+#define THINPIC_FORMAT_COUNT (FORMAT_AVIF + 1)
+
+// A format that names an encoder (not FORMAT_AUTO or out of range)
+static inline int thinpic_concrete_format(int format) {
+    return format >= FORMAT_JPEG && format < THINPIC_FORMAT_COUNT && format != FORMAT_AUTO;
+}
+
+// Run one set of options against an input (the CompressMode dispatch shared
+// by the path, buffer and job entry points). stats may be NULL.
+CompressedImageResult thinpic_compress_input(const ThinpicInput* input, const CompressOptions* options,
+                                             CompressionStats* stats);
+
+// ThinpicError capture (thinpic_error.c), per thread. Jobs reset it when
+// they start and take it when they fail; thinpic_log_write notes every
+// error-level line, and helpers that know why they failed set a code (the
+// first one set wins). thinpic_error_take fills in a generic code or message
+// when none was recorded.
+void thinpic_error_reset(void);
+void thinpic_error_code(ThinpicErrorCode code);
+void thinpic_error_note(const char* message);
+void thinpic_error_take(ThinpicError* out);
+
+// Tuning presets (thinpic_presets.c). thinpic_compress_input binds the
+// job's CompressOptions.preset to the thread for the length of its
+// dispatch, resolved once against the loaded table; the mode functions
+// read their caps and qualities from thinpic_tuning(). On a thread with
+// nothing bound it returns the loaded default.
+typedef struct {
+    int preset;                  // Id the values came from; 0 = built-in
+    int max_dimension;
+    int minimal_max_dimension;
+    int smart_quality[4];
+    int search_start_quality;
+    int search_end_quality;
+} ThinpicTuning;
+
+void thinpic_tuning_bind(int preset);
+void thinpic_tuning_unbind(void);
+const ThinpicTuning* thinpic_tuning(void);
+
+// Operation profiling (thinpic_profile.c). thinpic_profile_postbuild is
+// installed next to the encode counter and does nothing unless a profile is
+// active; begin waits for any other profiled job, clears `profile` and makes
+// it the one being filled, end stops filling it and sorts it.
+gboolean thinpic_profile_postbuild(GSignalInvocationHint* hint, guint count, const GValue* params, gpointer data);
+void thinpic_profile_begin(ThinpicProfile* profile);
+void thinpic_profile_end(void);
+
+// Stage timing for CompressionStats (thinpic_stages.c). thinpic_compress_input
+// binds its stats to the thread (NULL unbinds); helpers wrap their stage in
+// thinpic_stage_begin / thinpic_stage_end, and searches report the quality
+// they settle on. All are no-ops on threads with nothing bound.
+typedef enum {
+    THINPIC_STAGE_OPEN = 0,      // Opening the input and reading its header
+    THINPIC_STAGE_DECODE = 1,    // Rendering the pipeline into memory
+    THINPIC_STAGE_RESIZE = 2,    // Shrink-on-load reopen and resize setup
+    THINPIC_STAGE_COLOUR = 3,    // Orientation and sRGB conversion setup
+    THINPIC_STAGE_COPY = 4       // Copying the encoded output for the caller
+} ThinpicStage;
+
+// Begin/end pairs also emit the stage as a trace section (thinpic_trace_begin)
+typedef struct {
+    int64_t started;     // 0 when no stats were bound
+    int traced;
+} ThinpicStageMark;
+
+void thinpic_stages_bind(CompressionStats* stats);
+ThinpicStageMark thinpic_stage_begin(ThinpicStage stage);
+void thinpic_stage_end(ThinpicStage stage, ThinpicStageMark mark);
+void thinpic_stage_quality(int quality);
+// One encode ran (libvips savers are counted by a hook; other encoders call it)
+void thinpic_stage_encode(void);
+// Dimensions of the first image opened while bound, for telemetry; read
+// them before unbinding
+void thinpic_stage_source(int width, int height);
+void thinpic_stage_source_size(int* width, int* height);
+
+// Trace sections (thinpic_trace.c) around pipeline stages, search
+// iterations and jobs; the name is printf-formatted only while a trace is
+// recording. Pass begin's return value to the matching end.
+int thinpic_trace_begin(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void thinpic_trace_end(int traced);
+
+// Thermal scaling (thinpic_thermal.c). The level is 0 (cool) to 3 (critical)
+// from the cached AThermal status and the power-save hint, and always 0 while
+// scaling is off. The pool caps running jobs with worker_cap and binds the
+// level on the worker; thinpic_thermal_effort then lowers a fixed encoder
+// effort for that job, never below floor. pin_effort (thinpic_configure
+// deterministic) keeps the cap but leaves every effort as asked.
+void thinpic_thermal_enable(int enabled);
+void thinpic_thermal_pin_effort(int pinned);
+int thinpic_thermal_status(void);
+int thinpic_thermal_level(void);
+int thinpic_thermal_worker_cap(int level, int workers);
+void thinpic_thermal_bind(int level);
+int thinpic_thermal_effort(int effort, int floor);
+
+// Job thread grants (thinpic_threads.c). The pool sizes a starting job's
+// share of its thread budget with thinpic_thread_grant (free_threads not yet
+// granted, contenders the jobs that could start after it) and binds it on
+// the worker; thinpic_threads_limit hands a pipeline root back as a copy
+// whose libvips concurrency is the grant, or unchanged when none is bound.
+int thinpic_thread_grant(int64_t pixels, int free_threads, int contenders);
+void thinpic_threads_bind(int threads);
+int thinpic_threads_bound(void);
+VipsImage* thinpic_threads_limit(VipsImage* image);
+
+// Alpha before an encode (thinpic_alpha.c). thinpic_alpha_opaque is 1 when
+// an image rendered into memory has an alpha band at its maximum everywhere
+// (0 for lazy images, which are never scanned). drop_opaque_alpha and
+// flatten_alpha return 1 with *out set, 0 when image needs no change and -1
+// on failure; flatten_alpha composites onto the thinpic_configure
+// background (0xRRGGBB, white until set).
+int thinpic_alpha_opaque(VipsImage* image);
+int thinpic_drop_opaque_alpha(VipsImage* image, VipsImage** out);
+int thinpic_flatten_alpha(VipsImage* image, VipsImage** out);
+void thinpic_set_flatten_background(int rgb);
+
+// Grey detection (thinpic_grey.c) on an 8-bit sRGB image rendered into
+// memory: thinpic_grey_content is 1 when no pixel strays far from grey and
+// the chroma left is noise. thinpic_to_grey returns 1 with *out the image as
+// one band (plus alpha) in memory, 0 for colour or lazy images, -1 on
+// failure.
+int thinpic_grey_content(VipsImage* image);
+int thinpic_to_grey(VipsImage* image, VipsImage** out);
+
+// Chroma detail (thinpic_chroma.c) on an 8-bit sRGB image that can be read
+// out of order: 1 when enough of its 2x2 blocks hold coloured edges that
+// JPEG 4:2:0 would smear, so it should be encoded 4:4:4. 0 for photos,
+// other formats and sequential sources.
+int thinpic_chroma_detail(VipsImage* image);
+
+// Container sniffing (thinpic_sniff.c) over the first SNIFF_BYTES of an
+// encoded image: FORMAT_AUTO when no known signature matches.
+// thinpic_sniff_descriptor preads them without moving fd's offset.
+// thinpic_sniffed_loader names the libvips loader for a sniffed format, NULL
+// when this build lacks it.
+#define SNIFF_BYTES 64
+ImageFormat thinpic_sniff_format(const uint8_t* head, size_t length);
+ImageFormat thinpic_sniff_descriptor(int fd);
+const char* thinpic_sniffed_loader(ImageFormat format);
+
+// Bit depth for 8-bit-only encoders (thinpic_depth.c): thinpic_to_8bit
+// returns 1 with *out a lazy 8-bit image for 16-bit RGB, grey, CMYK or
+// multiband input and for scRGB float (tone-mapped when brighter than 1.0),
+// 0 when image is already 8 bits or in another space, -1 on failure.
+// Rounding is to nearest unless thinpic_configure turned dithering on.
+int thinpic_to_8bit(VipsImage* image, VipsImage** out);
+void thinpic_set_dither_high_depth(int enabled);
+// A lazy image over in with its geometry and the format and interpretation
+// given; generate (with vips_start_one) reads in region by region. 0 on
+// success.
+int thinpic_pipe_image(VipsImage* in, VipsImage** out, VipsBandFormat format, VipsInterpretation interpretation,
+                       VipsGenerateFn generate, void* argument);
+
+// Raw pixel rows (thinpic_swizzle.c; NEON on arm64). thinpic_swizzle_rgb
+// writes 3-byte RGB from 3- or 4-byte pixels, dropping the fourth byte;
+// thinpic_swizzle_rgba keeps bands (2, 3 or 4) and undoes premultiplied
+// alpha for 2 and 4. swap exchanges the first and third byte (BGR order).
+// thinpic_swizzle_image does the latter lazily over a uchar image.
+void thinpic_swizzle_rgb(const uint8_t* in, uint8_t* out, int width, int bands, int swap);
+void thinpic_swizzle_rgba(const uint8_t* in, uint8_t* out, int width, int bands, int swap, int premultiplied);
+int thinpic_swizzle_image(VipsImage* image, VipsImage** out, int swap, int premultiplied);
+
+// Saliency prefilter for target-size searches (thinpic_saliency.c): 1 with
+// *out a lazy copy of an 8-bit RGB(A) image whose flat regions are blurred,
+// 0 when the image is too small or not 8-bit RGB(A), -1 on failure.
+int thinpic_saliency_prefilter(VipsImage* image, VipsImage** out);
+
+// Perceptual hash (thinpic_phash.c). thinpic_hash_tap sets *out to image
+// with a pass-through node that folds the full-width strips an encoder
+// pulls into the 9x8 luma grid of the hash (when hash is set), into a
+// colour grid of up to `grid` cells on the long side (when grid > 0) and
+// into a luma plane of up to `plane` cells (when plane > 0). An image in
+// memory is summed at once, *out is then image with a new reference. NULL
+// for formats other than 8 or 16 bit, or when none is wanted (images under
+// 9x8 get no hash). thinpic_hash_tap_finish, after the encode, needs every
+// row to have been seen: it returns 1 with *hash set when the hash was
+// taken, fills *grid, *plane and *tensor when they were asked for (their
+// width stays 0 otherwise; plane->luma and tensor->rgb are the caller's to
+// g_free), and releases the tap either way. The tensor plane covers the
+// centre crop at tensor_width:tensor_height, at that size or the crop's
+// own when it is smaller.
+#define THINPIC_GRID_MAX 32
+#define THINPIC_PLANE_MAX 512
+
+typedef struct {
+    int width;
+    int height;
+    uint8_t rgba[THINPIC_GRID_MAX * THINPIC_GRID_MAX * 4];  // Cell means, straight alpha
+} ThinpicColourGrid;
+
+typedef struct {
+    int width;
+    int height;
+    float* luma;                 // Cell means, 0-255
+} ThinpicLumaPlane;
+
+typedef struct {
+    int width;
+    int height;
+    float* rgb;                  // Cell means, 0-255, interleaved
+} ThinpicRgbPlane;
+
+typedef struct ThinpicHashTap ThinpicHashTap;
+ThinpicHashTap* thinpic_hash_tap(VipsImage* image, int hash, int grid, int plane, int tensor_width,
+                                 int tensor_height, VipsImage** out);
+int thinpic_hash_tap_finish(ThinpicHashTap* tap, uint64_t* hash, ThinpicColourGrid* grid, ThinpicLumaPlane* plane,
+                            ThinpicRgbPlane* tensor);
+
+// Placeholders from a colour grid (thinpic_placeholder.c): a BlurHash with
+// 4x3 components (3x4 for portrait) or a base64 ThumbHash, written
+// NUL-terminated to out (THINPIC_PLACEHOLDER_MAX bytes). Return 0, or -1 if
+// out is too small.
+int thinpic_blurhash(const ThinpicColourGrid* grid, char* out, size_t size);
+int thinpic_thumbhash(const ThinpicColourGrid* grid, char* out, size_t size);
+
+// Blur and exposure scores of a luma plane (thinpic_analysis.c): sets
+// out->sharpness, brightness, shadows_clipped, highlights_clipped and
+// analysis_valid; a plane under 3x3 is left unscored
+void thinpic_score_plane(const ThinpicLumaPlane* plane, ThinpicResult* out);
+
+// Dominant colours of a colour grid (thinpic_dominant.c): sets up to
+// `colours` entries of out->palette and palette_share, and palette_count;
+// a grid with no opaque cell sets none
+void thinpic_dominant_colours(const ThinpicColourGrid* grid, int colours, ThinpicResult* out);
+
+// Model input from a tensor plane (thinpic_tensor.c): options->tensor_width
+// x tensor_height x RGB of tensor_type in out->tensor, resampled from the
+// plane when it is smaller. Returns 0, or -1 when out of memory.
+int thinpic_tensor_fill(const ThinpicRgbPlane* plane, const ThinpicOptions* options, ThinpicResult* out);
+
+// Telemetry ring (thinpic_telemetry.c): armed by the first
+// thinpic_drain_stats call; recording takes no lock
+int thinpic_telemetry_armed(void);
+void thinpic_telemetry_record(const ThinpicTelemetryRecord* record);
+
+// COMPRESS_MODE_LOSSLESS_JPEG: apply the EXIF orientation and crop directly
+// to the quantized DCT coefficients and re-code only the entropy layer, so
+// no pixel is decoded and nothing is re-quantized (thinpic_jpeg_lossless.c).
+CompressedImageResult thinpic_jpeg_lossless(const ThinpicInput* input, const CompressOptions* options);
+// The same transform with no crop, keeping every marker (the ICC profile is
+// still needed for the sRGB conversion): an upright copy of a JPEG for
+// pipelines that decode it anyway (thinpic_configure lossless_orientation).
+CompressedImageResult thinpic_jpeg_upright(const ThinpicInput* input);
+// COMPRESS_MODE_JPEG_OPTIMIZE: the same re-code written progressive with
+// optimized Huffman tables and no markers at all; the orientation is applied
+// to the blocks first, since the EXIF that carried it is dropped.
+CompressedImageResult thinpic_jpeg_optimize(const ThinpicInput* input);
+
+// Re-code an encoded JPEG as progressive with the given scan script, again
+// from its DCT coefficients (thinpic_jpeg_lossless.c). scans is read only for
+// THINPIC_SCAN_SCRIPT_CUSTOM. Returns a buffer for free_compressed_buffer, or
+// NULL if the input or the script is rejected.
+uint8_t* thinpic_jpeg_progressive(const uint8_t* data, size_t length, ThinpicScanScript script,
+                                  const ThinpicScan* scans, int scan_count, size_t* out_length);
+
+// Indexed PNG for options->png_palette (thinpic_png_palette.c); compression
+// is the zlib level. Returns 1 with a buffer for free_compressed_buffer, 0 when
+// THINPIC_PNG_PALETTE_AUTO finds more colours than fit (write truecolour
+// instead), or -1 on failure.
+int thinpic_png_palette(VipsImage* image, const ThinpicOptions* options, int compression,
+                        uint8_t** out, size_t* out_length);
+
+// Lossy WebP aimed at target_bytes by libwebp's own rate control, Q kept
+// within min_quality..max_quality (thinpic_webp_rate.c); effort is the
+// libwebp method 0-6 and sharp_yuv its sharper chroma conversion. One
+// encoder call, which may land somewhat over the target, or at min_quality
+// above it. Returns 1 with a buffer for free_compressed_buffer, 0 for an
+// image libwebp cannot take (too large, not 8-bit; search instead), or -1 on
+// failure or cancellation.
+int thinpic_webp_target_size(VipsImage* image, size_t target_bytes, int max_quality, int min_quality,
+                             int effort, int sharp_yuv, ThinpicStripPolicy strip,
+                             uint8_t** out, size_t* out_length);
+
+// The quantizer behind it, shared with the GIF encoder. Pixels are 8-bit
+// with 3 or 4 bands; palette entries pack RGBA little-end first, and every
+// fully transparent pixel packs to 0. thinpic_palette_input makes
+// such an image from any other. thinpic_exact_palette fills palette and one
+// index per pixel when there are at most limit colours, and returns 0 when
+// there are more. thinpic_median_cut returns the size of the palette it
+// builds from the samples (reordered in place), and thinpic_palette_map
+// maps every pixel to it with Floyd-Steinberg error diffusion at dither
+// (0-100) strength, returning -1 when out of memory.
+VipsImage* thinpic_palette_input(VipsImage* image);
+int thinpic_exact_palette(const uint8_t* pixels, size_t count, int bands, int limit,
+                          uint32_t* palette, int* palette_size, uint8_t* indices);
+int thinpic_median_cut(uint32_t* samples, int sample_count, int limit, uint32_t* palette);
+int thinpic_palette_map(const uint8_t* pixels, int width, int height, int bands,
+                        const uint32_t* palette, int palette_size, int dither, uint8_t* indices);
+
+// GIF encoder for FORMAT_GIF (thinpic_gif.c); image is one frame or a strip
+// of page-height frames with "delay" and "loop" metadata. One global
+// palette is sampled from every frame, then frames are mapped and LZW
+// coded on parallel threads. Returns 0 with a buffer for
+// free_compressed_buffer, or -1 on failure.
+typedef struct {
+    int colours;                 // Palette entries, 2-256
+    int dither;                  // Floyd-Steinberg strength, 0-100
+    int interframe;              // Largest channel difference for a pixel to repeat the previous frame; -1 = none
+    int threads;                 // Frames coded at once; 0 = one per core
+} ThinpicGifParams;
+
+int thinpic_gif_save(VipsImage* image, const ThinpicGifParams* params, uint8_t** out, size_t* out_length);
+
+// Truecolour PNG for THINPIC_PNG_DEFLATE_LIBDEFLATE (thinpic_png_deflate.c);
+// level is libdeflate's 0-12. Renders image if it is not in memory. Returns 1
+// with a buffer for free_compressed_buffer, 0 when the image is too large for
+// one IDAT chunk (nothing read; use pngsave), or -1 on failure.
+int thinpic_png_deflate(VipsImage* image, const ThinpicOptions* options, int level,
+                        uint8_t** out, size_t* out_length);
+// Frees the calling thread's kept compressors and scratch; the next encode on
+// it allocates them again, as every encode once did (the microbenchmark's
+// cold case). Threads free theirs on exit without this.
+void thinpic_png_deflate_thread_release(void);
+
+// Perceptual comparison for options->min_ssim and thinpic_compare
+// (thinpic_ssim.c). Luma planes are 8-bit, tightly packed and shrunk by an
+// integer factor chosen from the full size; free them with g_free.
+// thinpic_ssim returns mean SSIM, 1 for identical planes.
+int thinpic_luma_shrink(int width, int height);
+uint8_t* thinpic_luma_plane(VipsImage* image, int shrink, int* width, int* height);
+double thinpic_ssim(const uint8_t* reference, const uint8_t* candidate, int width, int height);
+// thinpic_compare on two planes of one size: PSNR, SSIM and MS-SSIM with
+// the windows split over threads (0 = one per core) and out->width/height set
+void thinpic_compare_planes(const uint8_t* reference, const uint8_t* candidate, int width, int height,
+                            int threads, ThinpicQuality* out);
+
+// Measured quality/size samples of one input, persisted by
+// thinpic_curve_cache.c when thinpic_set_curve_cache_dir is set. Samples are
+// kept sorted by setting: Q for the smart JPEG search, steps below the
+// type's quality for smart_compress_image_with_format.
+#define THINPIC_CURVE_SAMPLES 8
+
+typedef enum {
+    THINPIC_CURVE_SMART_JPEG = 0,
+    THINPIC_CURVE_RATE_STEPS = 1
+} ThinpicCurveKind;
+
+typedef struct {
+    int count;
+    int setting[THINPIC_CURVE_SAMPLES];
+    size_t bytes[THINPIC_CURVE_SAMPLES];
+} ThinpicCurve;
+
+// Hash of the input's first 64 KB and size plus the search parameters; 0
+// when the cache is off or the input cannot be hashed (pipes)
+uint64_t thinpic_curve_key(const ThinpicInput* input, int kind, int format, int variant);
+int thinpic_curve_lookup(uint64_t key, ThinpicCurve* curve);
+void thinpic_curve_store(uint64_t key, const ThinpicCurve* curve);
+// Insert or replace a sample; a full curve drops the one farthest away
+void thinpic_curve_add(ThinpicCurve* curve, int setting, size_t bytes);
+
+// Compressed outputs kept on disk by thinpic_output_cache.c when
+// thinpic_set_output_cache is set, keyed by the whole input and the
+// parameters that shape the output
+typedef struct {
+    uint64_t high;
+    uint64_t low;
+} ThinpicCacheKey;
+
+typedef struct {
+    uint8_t* data;               // Free with free_compressed_buffer
+    size_t length;
+    int width;                   // As stored; 0 when the entry point does not report them
+    int height;
+    int format;
+} ThinpicCachedOutput;
+
+int thinpic_output_cache_enabled(void);
+// Hash every byte of the input plus params; 0 when the cache is off or the
+// input cannot be read twice (pipes)
+int thinpic_output_cache_key(const ThinpicInput* input, const void* params, size_t params_length,
+                             ThinpicCacheKey* key);
+// The cache's 128-bit hash of a buffer alone, cache on or off (the pool
+// matches duplicate buffer jobs by it)
+void thinpic_hash_bytes(const void* data, size_t length, ThinpicCacheKey* key);
+int thinpic_output_cache_lookup(const ThinpicCacheKey* key, ThinpicCachedOutput* out);
+void thinpic_output_cache_store(const ThinpicCacheKey* key, const uint8_t* data, size_t length,
+                                int width, int height, int format);
+
+// Decoded intermediates kept in memory by thinpic_decode_cache.c
+// (thinpic_configure decode_cache_mb): rendered images keyed by the file's
+// identity and mtime plus params, so re-encoding them skips the decode
+void thinpic_decode_cache_set_budget(int64_t max_bytes);
+
+// Disc spill (thinpic_spill.c): thinpic_render_random_access renders image
+// the way vips_image_copy_memory does, into a deleted-on-close temp file in
+// the thinpic_set_spill_dir directory when it is larger than the threshold
+// (0 = never). NULL on failure; a directory that cannot be written falls
+// back to memory; thinpic_spills says whether `bytes` would go to disc. The
+// render drops VIPS_META_SEQUENTIAL, so
+// thinpic_needs_render is 1 only for an image still streamed from a
+// sequential loader, which a stage reading out of order has to render first.
+void thinpic_spill_set_threshold(int64_t bytes);
+VipsImage* thinpic_render_random_access(VipsImage* image);
+int thinpic_needs_render(VipsImage* image);
+int thinpic_spills(int64_t bytes);
+
+// Parallel JPEG decode (thinpic_jpeg_parallel.c): a baseline JPEG of at
+// least 16 MP whose restart intervals end on MCU rows, decoded in strips on
+// up to `threads` threads into one memory image carrying header's metadata.
+// NULL when the input does not qualify or the decode fails; the caller
+// keeps header and decodes through it.
+VipsImage* thinpic_jpeg_parallel_decode(const ThinpicInput* input, VipsImage* header, int threads);
+// Rows [top, top + height) of a restart-marked baseline JPEG of any size:
+// only the intervals covering them are decoded, the same way. The image
+// holds whole intervals; *origin is the source row of its first. NULL when
+// the input does not qualify.
+VipsImage* thinpic_jpeg_region_decode(const ThinpicInput* input, VipsImage* header, int top, int height,
+                                      int threads, int* origin);
+// Region-of-interest decode (thinpic_region.c): the width x height area at
+// left, top of the input header was opened from, decoded alone into a
+// memory image with header's metadata where the format allows it (JPEG
+// with restart intervals, WebP). NULL leaves the crop to the caller.
+VipsImage* thinpic_region_decode(const ThinpicInput* input, VipsImage* header, int left, int top, int width,
+                                 int height, int threads);
+
+// Strip-parallel JPEG encode (thinpic_jpeg_strips.c, thinpic_configure
+// jpeg_strip_encode) of an 8-bit grey or sRGB image of at least 8 MP on up
+// to `threads` threads, into a g_malloc'd buffer. Returns 1 when saved, 0
+// when the image does not qualify (nothing was read), -1 on failure.
+int thinpic_jpeg_strip_save(VipsImage* image, int quality, VipsForeignKeep keep, int threads,
+                            void** buffer, size_t* length);
+int64_t thinpic_decode_cache_budget(void);
+// 0 when the cache is off or path is not a regular file
+int thinpic_decode_cache_key(const char* path, const void* params, size_t params_length,
+                             ThinpicCacheKey* key);
+// New reference to the cached image, or NULL
+VipsImage* thinpic_decode_cache_lookup(const ThinpicCacheKey* key);
+// Keeps a reference to a memory image; ones over the budget are not kept
+void thinpic_decode_cache_store(const ThinpicCacheKey* key, VipsImage* image);
+// Drop every entry (called on shutdown)
+void thinpic_decode_cache_drain(void);
+
+// Watermark overlays (thinpic_overlay.c). thinpic_overlay_get: new reference
+// to the overlay at path in 8-bit sRGB with alpha, scaled to `fraction` of
+// base_width (0 = its own size; shrunk to fit base_height) with its alpha
+// times opacity, from the cache when it was prepared before; NULL when it
+// cannot be read. thinpic_watermark composites options->watermark_path onto
+// every frame of image and takes ownership (returned unchanged without
+// one, NULL on failure). The identity string (path, size, mtime) keys
+// output caches; g_free it.
+VipsImage* thinpic_overlay_get(const char* path, double fraction, int base_width, int base_height,
+                               double opacity);
+VipsImage* thinpic_watermark(VipsImage* image, const ThinpicOptions* options);
+gchar* thinpic_overlay_identity(const char* path);
+void thinpic_overlay_cache_drain(void);
+
+// Convert a prepared image to sRGB (thinpic_colour.c), like vips_copy or
+// vips_colourspace: 0 with a new reference in *out, -1 on failure. Embedded
+// sRGB profiles only relabel; other RGB profiles on 8-bit images use an
+// lcms2 transform cached per profile; gray images are left as they are.
+int thinpic_to_srgb(VipsImage* image, VipsImage** out);
+// Delete the cached transforms (called on shutdown)
+void thinpic_colour_drain(void);
+
+// Metadata written by the pipelines that take no ThinpicOptions
+// (thinpic_configure metadata_policy)
+ThinpicStripPolicy thinpic_metadata_policy(void);
+
+// Motion photo trailer of input (thinpic_motion.c): 1 with motion filled in,
+// 0 when there is none or the input cannot be read at offsets (pipes, pixels)
+int thinpic_motion_find(const ThinpicInput* input, ThinpicMotionPhoto* motion);
+// Appends the trailer to *data (g_malloc'd, grown in place); 0 or -1, when
+// *data is left as it was
+int thinpic_motion_append(const ThinpicInput* input, const ThinpicMotionPhoto* motion, uint8_t** data,
+                          size_t* length);
+
+// Ultra HDR gain map of a JPEG input (thinpic_gainmap.c): 1 with info
+// filled in when the MPF index names a second JPEG with gain metadata, 0
+// otherwise or when the input cannot be read at offsets
+typedef struct {
+    int64_t offset;              // The gain map JPEG within the input
+    int64_t length;
+} ThinpicGainMapInfo;
+
+int thinpic_gain_map_find(const ThinpicInput* input, ThinpicGainMapInfo* info);
+// Rebuilds *data (a JPEG primary encoded at width x height from the source's
+// source_width x source_height, g_free'd and replaced) as Ultra HDR with the
+// gain map turned by orientation (the EXIF value applied to the primary's
+// pixels, 0 or 1 for none) and scaled to match. Returns the gain map's
+// bytes, or -1 with *data left as it was.
+int64_t thinpic_gain_map_attach(const ThinpicInput* input, const ThinpicGainMapInfo* info, int orientation,
+                                int source_width, int source_height, int width, int height, uint8_t** data,
+                                size_t* length);
+
+// Content classes for auto_compress_image (thinpic_classify.c), from colour
+// count, alpha use and neighbour differences on a ~64x64 point sample
+typedef enum {
+    THINPIC_CONTENT_PHOTO = 0,
+    THINPIC_CONTENT_SCREENSHOT = 1,   // Flat fills with hard edges (UI, text)
+    THINPIC_CONTENT_GRAPHIC = 2,      // A palette's worth of colours
+    THINPIC_CONTENT_TRANSPARENT = 3   // Alpha is actually used
+} ThinpicContent;
+
+// *ambiguous (may be NULL) is set when the sample is close to another class
+ThinpicContent thinpic_classify(VipsImage* image, int* ambiguous);
+const char* thinpic_content_name(ThinpicContent content);
+
+// Cooperative cancellation for pool jobs. A worker binds the job's token to
+// its thread; pipelines register their root images with thinpic_cancel_watch
+// and cancelling kills them (vips_image_set_kill), so the running eval stops
+// at the next region request. Search loops also poll thinpic_cancel_requested
+// between encodes. Both are no-ops on threads with no bound token.
+typedef struct ThinpicCancelToken ThinpicCancelToken;
+
+ThinpicCancelToken* thinpic_cancel_token_new(void);
+void thinpic_cancel_token_free(ThinpicCancelToken* token);
+// Bind token to the calling thread; NULL unbinds and releases watched images
+void thinpic_cancel_bind(ThinpicCancelToken* token);
+void thinpic_cancel_request(ThinpicCancelToken* token);
+int thinpic_cancel_is_set(ThinpicCancelToken* token);
+int thinpic_cancel_requested(void);
+// Watches an image only this job holds (a memory render, a private decode)
+void thinpic_cancel_watch(VipsImage* image);
+// For an image the operation cache may share (a loader or thumbnail result):
+// takes its reference and returns a watched pass-through only this job
+// reads, or image itself on a thread with no bound token
+VipsImage* thinpic_cancel_watch_shared(VipsImage* image);
+// A pass-through of in built outside the operation cache, which no other
+// caller can be handed; 0 with *out holding a reference that keeps in alive
+int thinpic_private_image(VipsImage* in, VipsImage** out);
+// Job time limits: thinpic_cancel_arm has a watchdog thread cancel the
+// token once timeout_ms have passed (<= 0 does nothing) unless it is
+// disarmed first; thinpic_cancel_timed_out tells such a cancel from the
+// caller's. Freeing a token disarms it.
+void thinpic_cancel_arm(ThinpicCancelToken* token, int timeout_ms);
+void thinpic_cancel_disarm(ThinpicCancelToken* token);
+int thinpic_cancel_timed_out(ThinpicCancelToken* token);
+
+// Input limits (thinpic_limits.c, thinpic_configure max_input_megapixels,
+// max_input_bands and job_timeout_ms). thinpic_input_allowed checks an
+// opened image's header: 1 within the limits (or none set), 0 with the
+// thread's error set to THINPIC_ERROR_LIMIT; thinpic_input_size_allowed does
+// the same for dimensions a decoder outside libvips reports.
+void thinpic_limits_set(int max_megapixels, int max_bands, int job_timeout_ms);
+int thinpic_input_allowed(VipsImage* image);
+int thinpic_input_size_allowed(int width, int height, int bands);
+int thinpic_job_timeout_ms(void);
+
+// Camera RAW inputs (thinpic_raw.c): the embedded JPEG preview of a DNG,
+// CR2, NEF, ARW, ORF, RW2 or similar file when it is at least half the
+// sensor's size, as a g_malloc'd JPEG carrying the RAW's orientation, and
+// its length; NULL for pixel inputs, ordinary images and small previews.
+uint8_t* thinpic_raw_preview(const ThinpicInput* input, size_t* length);
+
+// Progress reporting (thinpic_set_progress_callback). Pool workers bind the
+// running job id to their thread; pipelines watch their root images, and
+// libvips passes the eval signal of every downstream sink back to the root.
+void thinpic_progress_bind(int64_t job_id);
+void thinpic_progress_watch(VipsImage* image);
+
+// Worker pool admission: jobs whose estimated working set would push the
+// in-flight total past this many bytes wait for running jobs to finish.
+// 0 disables the check.
+void thinpic_pool_set_memory_budget(int64_t bytes);
+// Keep queued background jobs from starting for the next milliseconds
+// (thinpic_memory.c, under critical memory pressure); running jobs finish
+// and interactive ones still start. 0 releases the hold at once.
+void thinpic_pool_hold_background(int64_t milliseconds);
+// The file jobs' output write (thinpic_pool.c): a unique sibling temp file,
+// synced, then renamed over output_path. Returns 0 on success.
+int thinpic_write_output(const uint8_t* data, size_t length, const char* output_path);
+// The same steps for a saver that writes a path itself: thinpic_output_temp
+// creates the unique temp file (mode 0644) and returns its descriptor, or
+// -1, with *temp_path set to its name; thinpic_output_commit syncs and
+// closes fd and renames the temp file over output_path when written is set,
+// else removes it, and frees temp_path. Returns 0 on success.
+int thinpic_output_temp(const char* output_path, char** temp_path);
+int thinpic_output_commit(int fd, char* temp_path, const char* output_path, int written);
+// Platform encoders (thinpic_imageio.c): HEIC through ImageIO on Apple
+// platforms and through MediaCodec on Android 9+. The save calls return 0 on success and 1 when the platform
+// cannot take the image, so the caller falls back to libvips; the target
+// variant also returns -1 if writing the target failed.
+int thinpic_imageio_available(ImageFormat format);
+int thinpic_imageio_save(VipsImage* image, ImageFormat format, int quality, void** buffer, size_t* length);
+int thinpic_imageio_save_target(VipsImage* image, ImageFormat format, int quality, VipsTarget* target);
+// Android hardware HEVC path behind the thinpic_imageio calls (thinpic_mediacodec.c)
+int thinpic_mediacodec_available(ImageFormat format);
+int thinpic_mediacodec_save(VipsImage* image, ImageFormat format, int quality, void** buffer, size_t* length);
+// Platform decoders (thinpic_imagedecoder.c): HEIC, HEIF and AVIF inputs
+// through AImageDecoder on Android 11+, when libvips has no HEIF loader or
+// thinpic_configure platform_decode prefers the platform. decodes tells
+// whether an input would go that way; decode returns the upright sRGB
+// pixels as a memory image, or NULL to leave the input to libvips.
+void thinpic_platform_decode_set(int prefer);
+int thinpic_platform_decodes(const ThinpicInput* input);
+VipsImage* thinpic_platform_decode(const ThinpicInput* input);
+
+// Reversible JPEG to JPEG XL through libjxl, found at runtime
+// (thinpic_jxl.c): jpeg is the whole JPEG file, effort 1-9, threads for
+// libjxl's runner. Returns 0 with a g_malloc'd *out, -1 on failure.
+int thinpic_jxl_transcode(const uint8_t* jpeg, size_t length, int effort, int threads,
+                          uint8_t** out, size_t* out_length);
+
+// Latency budgets (thinpic_budget.c). record feeds one plain
+// thinpic_compress call into the per-format, per-effort throughput and
+// record_decode one image rendered into memory (width x height rendered)
+// into its source format's decode rate; plan
+// rewrites the plan's format, effort and box so the predicted time of a
+// width x height source fits budget_ms, as far as it can.
+typedef struct {
+    ImageFormat format;          // Resolved output format (never FORMAT_AUTO)
+    int effort;
+    int max_width;
+    int max_height;
+    int crop;                    // The box is filled and cropped, so it keeps its shape
+    double predicted_ms;         // Set by plan
+} ThinpicBudgetPlan;
+void thinpic_budget_record(ImageFormat format, int effort, int width, int height, double elapsed_ms);
+void thinpic_budget_record_decode(ImageFormat format, int width, int height, double elapsed_ms);
+void thinpic_budget_plan(int budget_ms, int width, int height, int has_alpha, ThinpicBudgetPlan* plan);
+
+// The pipelines' resize (image_compressor.c): the GPU stage when it takes
+// the image, else vips_resize with the configured resize_quality gap
+int thinpic_resize(VipsImage* image, VipsImage** out, double scale, VipsKernel kernel);
+
+// The pipelines' orientation and render steps (image_compressor.c), for the
+// operation graph: EXIF orientation (0 when none), the image turned upright
+// (0 with a new reference in *out; upright images are only referenced), and
+// a render to memory timed as the decode stage (NULL on failure)
+int thinpic_orientation(VipsImage* image);
+int thinpic_orient_upright(VipsImage* image, VipsImage** out);
+VipsImage* thinpic_decode_to_memory(VipsImage* image);
+
+// thinpic_compress_ops steps start..count-1 applied to image (thinpic_ops.cpp,
+// on the libvips C++ API). Takes ownership of image; returns a new reference
+// to the lazy result, or NULL with the failing step logged.
+VipsImage* thinpic_apply_operations(VipsImage* image, const ThinpicOperation* ops, int start, int count,
+                                    VipsKernel kernel);
+
+// GPU resize stage (thinpic_gpu.c): Lanczos3 downscale of an 8-bit image
+// with 1-4 bands. Returns 0 with *out set, or 1 when the GPU is missing,
+// busy or cannot take the image and the caller should use vips_resize.
+int thinpic_gpu_resize(VipsImage* image, VipsImage** out, double scale);
+// Release the EGL context (shutdown_vips)
+void thinpic_gpu_drain(void);
+
+// Apply a ThinpicPriority to the calling pool worker (thinpic_affinity.c)
+void thinpic_thread_set_priority(int priority);
+// Peak memory the pool charges a job of options on a width x height source
+// of source_format (thinpic_pool.c): the frames the loader and saver hold
+// whole, the render threads' strips, and the in-memory copies of the
+// search and coefficient-domain modes
+int64_t thinpic_pool_working_set(int width, int height, int bands, int source_format,
+                                 const CompressOptions* options);
+// Page cache hints for a path or descriptor input (thinpic_readahead.c):
+// start reading it in the background, or drop its cached pages once done.
+// No-ops where posix_fadvise is missing or the descriptor cannot be advised.
+// thinpic_preallocate reserves length bytes of a new output file in one
+// allocation where the filesystem supports it.
+void thinpic_readahead(const char* path, int fd);
+void thinpic_readahead_drop(const char* path, int fd);
+void thinpic_preallocate(int fd, size_t length);
+// Pool counters for thinpic_get_runtime_stats
+void thinpic_pool_activity(int* workers, int* running, int* queued, int64_t* in_flight);
+
+// Reusable encode output. Search loops encode every candidate into an arena
+// through a custom VipsTarget instead of a fresh vips_*save_buffer
+// allocation; only the winner is copied out for the caller.
+typedef struct {
+    uint8_t* data;
+    size_t length;    // Bytes of encoded output
+    size_t position;  // Write/read cursor; TIFF seeks back to patch headers
+    size_t capacity;
+} EncodeArena;
+
+EncodeArena* thinpic_arena_acquire(void);
+void thinpic_arena_release(EncodeArena* arena);
+// Free every idle arena (called on shutdown)
+void thinpic_arena_drain(void);
+// Reset the arena and return a new target writing into it; unref when done
+VipsTarget* thinpic_arena_target(EncodeArena* arena);
+// g_malloc'd copy of the arena contents, freeable with free_compressed_buffer
+uint8_t* thinpic_arena_copy(const EncodeArena* arena);
+
+// Target-size JPEG search on a JPEG's own DCT coefficients (thinpic_configure
+// coefficient_search): they are read once, and each probe rounds them to the
+// tables of one quality (never finer than the source's) and re-codes only
+// the entropy layer. Bisects min_quality-max_quality for the highest that
+// fits under upper bytes, stopping at a fit that reaches lower; markers
+// follow thinpic_metadata_policy. Returns that quality with its encode in
+// arena, -1 when none fits, or -2 when the input cannot be searched this way
+// (not a path or memory input, CMYK, non-8x8 blocks, subsampled chroma with
+// full_chroma) and the pixel search must run.
+int thinpic_jpeg_requantize_search(const ThinpicInput* input, int min_quality, int max_quality, int full_chroma,
+                                   size_t lower, size_t upper, EncodeArena* arena, int* encodes);
+
+// Write-only target that passes the output to callback in g_malloc'd chunks
+// as it arrives (stream_compress_image_to_callback). *delivered counts the
+// bytes handed over, including the rest flushed on vips_target_end; it must
+// outlive the target. No final NULL call is made here.
+VipsTarget* thinpic_chunk_target(ThinpicChunkCallback callback, int64_t stream_id, int64_t* delivered);
+
+// compress_directory that reports as it goes (thinpic_background.c): total
+// once the inputs are listed and done each time the manifest records an
+// item (both atomic). A nonzero stop, set from another thread, submits
+// nothing more and cancels the pending items, which stay unrecorded for the
+// next run. progress may be NULL.
+typedef struct {
+    int total;
+    int done;
+    int stop;
+} ThinpicDirectoryProgress;
+
+int thinpic_compress_directory_tracked(const char* source, const char* output_dir, const char* manifest_path,
+                                       const CompressOptions* options, ThinpicDirectoryProgress* progress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THINPIC_INTERNAL_H
@@ -0,0 +1,757 @@
+// vips7compat.h would otherwise #define error_exit, a jpeg_error_mgr field
+#define VIPS_DISABLE_COMPAT
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <jpeglib.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Transforms in EXIF orientation order: orientation n is undone by entry n - 1
+typedef enum {
+    TRANSFORM_NONE,
+    TRANSFORM_FLIP_H,
+    TRANSFORM_ROT_180,
+    TRANSFORM_FLIP_V,
+    TRANSFORM_TRANSPOSE,
+    TRANSFORM_ROT_90,
+    TRANSFORM_TRANSVERSE,
+    TRANSFORM_ROT_270
+} LosslessTransform;
+
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TYPE_SHORT 3
+
+// libjpeg reports errors by longjmp back into thinpic_jpeg_lossless or
+// thinpic_jpeg_progressive; the mem destination buffer lives here so the
+// error path can free it
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf escape;
+    unsigned char* out_buffer;
+    size_t out_length;
+} LosslessError;
+
+typedef struct {
+    LosslessTransform transform;
+    JDIMENSION width;           // Output size in pixels
+    JDIMENSION height;
+    JDIMENSION trim_width;      // Source size kept: partial iMCUs on a mirrored
+    JDIMENSION trim_height;     // edge cannot move losslessly and are dropped
+    JDIMENSION crop_mcu_x;      // Crop offset in whole output iMCUs
+    JDIMENSION crop_mcu_y;
+} LosslessGeometry;
+
+static void lossless_error_exit(j_common_ptr cinfo) {
+    LosslessError* error = (LosslessError*)cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(error->escape, 1);
+}
+
+static void lossless_output_message(j_common_ptr cinfo) {
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    THINPIC_LOGW("libjpeg: %s", message);
+}
+
+static int transposes(LosslessTransform transform) {
+    return transform >= TRANSFORM_TRANSPOSE;
+}
+
+// Whether source columns (rows) come out in reverse order
+static int mirrors_x(LosslessTransform transform) {
+    return transform == TRANSFORM_FLIP_H || transform == TRANSFORM_ROT_180 ||
+           transform == TRANSFORM_ROT_270 || transform == TRANSFORM_TRANSVERSE;
+}
+
+static int mirrors_y(LosslessTransform transform) {
+    return transform == TRANSFORM_FLIP_V || transform == TRANSFORM_ROT_180 ||
+           transform == TRANSFORM_ROT_90 || transform == TRANSFORM_TRANSVERSE;
+}
+
+static unsigned int read_exif_u16(const JOCTET* p, int big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static unsigned long read_exif_u32(const JOCTET* p, int big_endian) {
+    return big_endian
+        ? ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | (p[2] << 8) | p[3]
+        : ((unsigned long)p[3] << 24) | ((unsigned long)p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+// Value of the IFD0 orientation entry in a saved EXIF APP1, or NULL. The
+// pointer lets the tag be reset in place once the pixels are upright.
+static JOCTET* find_orientation(jpeg_saved_marker_ptr markers, int* big_endian) {
+    for (jpeg_saved_marker_ptr marker = markers; marker; marker = marker->next) {
+        if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14 ||
+                memcmp(marker->data, "Exif\0\0", 6) != 0) {
+            continue;
+        }
+
+        JOCTET* tiff = marker->data + 6;
+        unsigned long length = marker->data_length - 6;
+        if (memcmp(tiff, "MM", 2) == 0) {
+            *big_endian = 1;
+        } else if (memcmp(tiff, "II", 2) == 0) {
+            *big_endian = 0;
+        } else {
+            return NULL;
+        }
+
+        unsigned long ifd = read_exif_u32(tiff + 4, *big_endian);
+        if (ifd + 2 > length) return NULL;
+        unsigned int entries = read_exif_u16(tiff + ifd, *big_endian);
+        for (unsigned int i = 0; i < entries; i++) {
+            unsigned long entry = ifd + 2 + i * 12;
+            if (entry + 12 > length) return NULL;
+            if (read_exif_u16(tiff + entry, *big_endian) == EXIF_TAG_ORIENTATION &&
+                    read_exif_u16(tiff + entry + 2, *big_endian) == EXIF_TYPE_SHORT) {
+                return tiff + entry + 8;
+            }
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+// Output block (x, y) of a component comes from source block (*sx, *sy);
+// width and height are the component's kept source size in blocks
+static void source_block(LosslessTransform transform, long x, long y, long width, long height,
+                         long* sx, long* sy) {
+    switch (transform) {
+        case TRANSFORM_NONE:       *sx = x;              *sy = y;              break;
+        case TRANSFORM_FLIP_H:     *sx = width - 1 - x;  *sy = y;              break;
+        case TRANSFORM_FLIP_V:     *sx = x;              *sy = height - 1 - y; break;
+        case TRANSFORM_ROT_180:    *sx = width - 1 - x;  *sy = height - 1 - y; break;
+        case TRANSFORM_TRANSPOSE:  *sx = y;              *sy = x;              break;
+        case TRANSFORM_ROT_90:     *sx = y;              *sy = height - 1 - x; break;
+        case TRANSFORM_ROT_270:    *sx = width - 1 - y;  *sy = x;              break;
+        case TRANSFORM_TRANSVERSE: *sx = width - 1 - y;  *sy = height - 1 - x; break;
+    }
+}
+
+// Mirroring a block negates its odd horizontal (or vertical) frequencies;
+// transposing swaps the two frequency axes
+static void transform_block(LosslessTransform transform, const JCOEF* in, JCOEF* out) {
+    int negate_u = transform == TRANSFORM_FLIP_H || transform == TRANSFORM_ROT_180 ||
+                   transform == TRANSFORM_ROT_90 || transform == TRANSFORM_TRANSVERSE;
+    int negate_v = transform == TRANSFORM_FLIP_V || transform == TRANSFORM_ROT_180 ||
+                   transform == TRANSFORM_ROT_270 || transform == TRANSFORM_TRANSVERSE;
+    int transpose = transposes(transform);
+
+    for (int v = 0; v < DCTSIZE; v++) {
+        for (int u = 0; u < DCTSIZE; u++) {
+            JCOEF coefficient = transpose ? in[u * DCTSIZE + v] : in[v * DCTSIZE + u];
+            if ((negate_u && (u & 1)) != (negate_v && (v & 1))) {
+                coefficient = -coefficient;
+            }
+            out[v * DCTSIZE + u] = coefficient;
+        }
+    }
+}
+
+// Output component size in blocks, padded to whole MCUs as libjpeg expects
+static JDIMENSION component_blocks(JDIMENSION pixels, int samp, int max_samp) {
+    long unit = (long)max_samp * DCTSIZE;
+    long blocks = ((long)pixels * samp + unit - 1) / unit;
+    return (JDIMENSION)((blocks + samp - 1) / samp * samp);
+}
+
+// Returns -1 when a mirrored axis is shorter than one iMCU (nothing would
+// be left after trimming)
+static int plan_geometry(j_decompress_ptr src, int orientation, const CompressOptions* options,
+                         LosslessGeometry* geometry) {
+    LosslessTransform transform = orientation >= 2 && orientation <= 8
+        ? (LosslessTransform)(orientation - 1) : TRANSFORM_NONE;
+    JDIMENSION src_mcu_width = src->max_h_samp_factor * DCTSIZE;
+    JDIMENSION src_mcu_height = src->max_v_samp_factor * DCTSIZE;
+
+    geometry->transform = transform;
+    geometry->trim_width = src->image_width;
+    geometry->trim_height = src->image_height;
+    if (mirrors_x(transform)) {
+        geometry->trim_width -= src->image_width % src_mcu_width;
+    }
+    if (mirrors_y(transform)) {
+        geometry->trim_height -= src->image_height % src_mcu_height;
+    }
+    if (geometry->trim_width == 0 || geometry->trim_height == 0) {
+        return -1;
+    }
+
+    JDIMENSION full_width = transposes(transform) ? geometry->trim_height : geometry->trim_width;
+    JDIMENSION full_height = transposes(transform) ? geometry->trim_width : geometry->trim_height;
+    JDIMENSION mcu_width = transposes(transform) ? src_mcu_height : src_mcu_width;
+    JDIMENSION mcu_height = transposes(transform) ? src_mcu_width : src_mcu_height;
+
+    JDIMENSION crop_x = options->crop_x > 0 ? (JDIMENSION)options->crop_x : 0;
+    JDIMENSION crop_y = options->crop_y > 0 ? (JDIMENSION)options->crop_y : 0;
+    if (crop_x >= full_width) crop_x = full_width - 1;
+    if (crop_y >= full_height) crop_y = full_height - 1;
+    geometry->crop_mcu_x = crop_x / mcu_width;
+    geometry->crop_mcu_y = crop_y / mcu_height;
+
+    // Keep the requested area: the size grows by what the offset lost
+    JDIMENSION left = geometry->crop_mcu_x * mcu_width;
+    JDIMENSION top = geometry->crop_mcu_y * mcu_height;
+    geometry->width = full_width - left;
+    geometry->height = full_height - top;
+    if (options->crop_width > 0 && (JDIMENSION)options->crop_width + (crop_x - left) < geometry->width) {
+        geometry->width = (JDIMENSION)options->crop_width + (crop_x - left);
+    }
+    if (options->crop_height > 0 && (JDIMENSION)options->crop_height + (crop_y - top) < geometry->height) {
+        geometry->height = (JDIMENSION)options->crop_height + (crop_y - top);
+    }
+    return 0;
+}
+
+static void transform_component(j_decompress_ptr src, const LosslessGeometry* geometry, int ci,
+                                jvirt_barray_ptr source, jvirt_barray_ptr dest,
+                                JDIMENSION dest_width, JDIMENSION dest_height) {
+    jpeg_component_info* comp = &src->comp_info[ci];
+    LosslessTransform transform = geometry->transform;
+    int out_h_samp = transposes(transform) ? comp->v_samp_factor : comp->h_samp_factor;
+    int out_v_samp = transposes(transform) ? comp->h_samp_factor : comp->v_samp_factor;
+
+    // Mirrored axes count from the trimmed edge; the others keep every block
+    long source_width = mirrors_x(transform)
+        ? (long)geometry->trim_width / (src->max_h_samp_factor * DCTSIZE) * comp->h_samp_factor
+        : (long)comp->width_in_blocks;
+    long source_height = mirrors_y(transform)
+        ? (long)geometry->trim_height / (src->max_v_samp_factor * DCTSIZE) * comp->v_samp_factor
+        : (long)comp->height_in_blocks;
+    long offset_x = (long)geometry->crop_mcu_x * out_h_samp;
+    long offset_y = (long)geometry->crop_mcu_y * out_v_samp;
+
+    for (JDIMENSION y = 0; y < dest_height; y++) {
+        JBLOCKROW out_row = (*src->mem->access_virt_barray)((j_common_ptr)src, dest, y, 1, TRUE)[0];
+        for (JDIMENSION x = 0; x < dest_width; x++) {
+            long sx, sy;
+            source_block(transform, x + offset_x, y + offset_y, source_width, source_height, &sx, &sy);
+            if (sx < 0 || sy < 0 || sx >= (long)comp->width_in_blocks || sy >= (long)comp->height_in_blocks) {
+                // MCU padding past the image edge; decoders never show it
+                memset(out_row[x], 0, sizeof(JBLOCK));
+                continue;
+            }
+            JBLOCKROW in_row = (*src->mem->access_virt_barray)((j_common_ptr)src, source,
+                                                               (JDIMENSION)sy, 1, FALSE)[0];
+            transform_block(transform, in_row[sx], out_row[x]);
+        }
+    }
+}
+
+// Carry over saved APPn/COM markers allowed by policy, except the JFIF and
+// Adobe headers the compressor writes itself. Orientation is already in the
+// coefficients, so EXIF can go like any other marker.
+static void copy_markers(j_decompress_ptr src, j_compress_ptr dst, ThinpicStripPolicy policy) {
+    for (jpeg_saved_marker_ptr marker = src->marker_list; marker; marker = marker->next) {
+        int icc = marker->marker == JPEG_APP0 + 2 && marker->data_length >= 12 &&
+                  memcmp(marker->data, "ICC_PROFILE\0", 12) == 0;
+        if (policy == THINPIC_STRIP_ALL || (policy == THINPIC_STRIP_KEEP_ICC && !icc)) {
+            continue;
+        }
+        if (dst->write_JFIF_header && marker->marker == JPEG_APP0 &&
+                marker->data_length >= 5 && memcmp(marker->data, "JFIF\0", 5) == 0) {
+            continue;
+        }
+        if (dst->write_Adobe_marker && marker->marker == JPEG_APP0 + 14 &&
+                marker->data_length >= 5 && memcmp(marker->data, "Adobe", 5) == 0) {
+            continue;
+        }
+        jpeg_write_marker(dst, marker->marker, marker->data, marker->data_length);
+    }
+}
+
+// progressive: write progressive scans even when the source is baseline
+static CompressedImageResult lossless_transform(const ThinpicInput* input, const CompressOptions* options,
+                                                ThinpicStripPolicy policy, int progressive) {
+    CompressedImageResult result = {NULL, 0, -1};
+    struct jpeg_decompress_struct src;
+    struct jpeg_compress_struct dst;
+    LosslessError error;
+    FILE* volatile file = NULL;
+
+    // Zeroed objects make jpeg_destroy_* safe on every error path
+    memset(&src, 0, sizeof(src));
+    memset(&dst, 0, sizeof(dst));
+    memset(&error, 0, sizeof(error));
+    src.err = jpeg_std_error(&error.pub);
+    dst.err = &error.pub;
+    error.pub.error_exit = lossless_error_exit;
+    error.pub.output_message = lossless_output_message;
+
+    if (setjmp(error.escape)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        if (file) fclose(file);
+        free(error.out_buffer);
+        THINPIC_LOGE("Error: Lossless JPEG transform failed");
+        return result;
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+
+    if (input->data) {
+        jpeg_mem_src(&src, (const unsigned char*)input->data, input->length);
+    } else {
+        int fd = -1;
+        if (input->path) {
+            file = fopen(input->path, "rb");
+        } else if ((fd = dup(input->fd)) >= 0) {
+            lseek(fd, 0, SEEK_SET);  // Pipes ignore this and are read once
+            file = fdopen(fd, "rb");
+        }
+        if (!file) {
+            if (fd >= 0) close(fd);
+            THINPIC_LOGE("Error: Cannot open lossless JPEG input");
+            jpeg_destroy_compress(&dst);
+            jpeg_destroy_decompress(&src);
+            return result;
+        }
+        jpeg_stdio_src(&src, file);
+    }
+
+    jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+    for (int m = 0; m < 16; m++) {
+        jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+    }
+    jpeg_read_header(&src, TRUE);
+    if (src.block_size != DCTSIZE) {
+        // SmartScale (libjpeg 8+) files have no fixed 8x8 grid to move
+        THINPIC_LOGE("Error: Lossless transform needs 8x8 DCT blocks, got %d", src.block_size);
+        longjmp(error.escape, 1);
+    }
+
+    int big_endian = 0;
+    JOCTET* orientation_value = find_orientation(src.marker_list, &big_endian);
+    int orientation = orientation_value ? (int)read_exif_u16(orientation_value, big_endian) : 1;
+    LosslessGeometry geometry;
+    if (plan_geometry(&src, orientation, options, &geometry) != 0) {
+        THINPIC_LOGE("Error: %ux%u is too small to reorient losslessly", src.image_width, src.image_height);
+        longjmp(error.escape, 1);
+    }
+
+    // Destination arrays must be requested before jpeg_read_coefficients
+    // realizes the pool
+    int out_max_h = transposes(geometry.transform) ? src.max_v_samp_factor : src.max_h_samp_factor;
+    int out_max_v = transposes(geometry.transform) ? src.max_h_samp_factor : src.max_v_samp_factor;
+    jvirt_barray_ptr* dest_arrays = (jvirt_barray_ptr*)(*src.mem->alloc_small)(
+        (j_common_ptr)&src, JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * src.num_components);
+    JDIMENSION dest_widths[MAX_COMPONENTS];
+    JDIMENSION dest_heights[MAX_COMPONENTS];
+    for (int ci = 0; ci < src.num_components; ci++) {
+        jpeg_component_info* comp = &src.comp_info[ci];
+        int out_h_samp = transposes(geometry.transform) ? comp->v_samp_factor : comp->h_samp_factor;
+        int out_v_samp = transposes(geometry.transform) ? comp->h_samp_factor : comp->v_samp_factor;
+        dest_widths[ci] = component_blocks(geometry.width, out_h_samp, out_max_h);
+        dest_heights[ci] = component_blocks(geometry.height, out_v_samp, out_max_v);
+        dest_arrays[ci] = (*src.mem->request_virt_barray)((j_common_ptr)&src, JPOOL_IMAGE, FALSE,
+            dest_widths[ci], dest_heights[ci], (JDIMENSION)out_v_samp);
+    }
+
+    jvirt_barray_ptr* source_arrays = jpeg_read_coefficients(&src);
+    for (int ci = 0; ci < src.num_components; ci++) {
+        if (thinpic_cancel_requested()) {
+            THINPIC_LOGI("Lossless transform cancelled");
+            longjmp(error.escape, 1);
+        }
+        transform_component(&src, &geometry, ci, source_arrays[ci], dest_arrays[ci],
+                            dest_widths[ci], dest_heights[ci]);
+    }
+
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.image_width = geometry.width;
+    dst.image_height = geometry.height;
+    if (transposes(geometry.transform)) {
+        for (int ci = 0; ci < dst.num_components; ci++) {
+            int h_samp = dst.comp_info[ci].h_samp_factor;
+            dst.comp_info[ci].h_samp_factor = dst.comp_info[ci].v_samp_factor;
+            dst.comp_info[ci].v_samp_factor = h_samp;
+        }
+        // Quantization steps follow the coefficients they scale
+        for (int qi = 0; qi < NUM_QUANT_TBLS; qi++) {
+            JQUANT_TBL* table = dst.quant_tbl_ptrs[qi];
+            if (!table) continue;
+            for (int v = 0; v < DCTSIZE; v++) {
+                for (int u = v + 1; u < DCTSIZE; u++) {
+                    UINT16 step = table->quantval[v * DCTSIZE + u];
+                    table->quantval[v * DCTSIZE + u] = table->quantval[u * DCTSIZE + v];
+                    table->quantval[u * DCTSIZE + v] = step;
+                }
+            }
+        }
+    }
+    dst.optimize_coding = TRUE;
+    if (src.progressive_mode || progressive) {
+        jpeg_simple_progression(&dst);
+    }
+
+    jpeg_mem_dest(&dst, &error.out_buffer, &error.out_length);
+    jpeg_write_coefficients(&dst, dest_arrays);
+    if (orientation_value && geometry.transform != TRANSFORM_NONE) {
+        // The pixels are upright now; a stale tag would rotate them again
+        orientation_value[0] = big_endian ? 0 : 1;
+        orientation_value[1] = big_endian ? 1 : 0;
+    }
+    copy_markers(&src, &dst, policy);
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+
+    THINPIC_LOGD("Lossless JPEG: orientation %d, %ux%u -> %ux%u, %s, %zu bytes",
+                 orientation, src.image_width, src.image_height, geometry.width, geometry.height,
+                 dst.progressive_mode ? "progressive" : "baseline", error.out_length);
+
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    if (file) fclose(file);
+
+    // Results are released with free_compressed_buffer (g_free)
+    result.data = (uint8_t*)g_malloc(error.out_length);
+    memcpy(result.data, error.out_buffer, error.out_length);
+    result.length = error.out_length;
+    result.success = 1;
+    free(error.out_buffer);
+    return result;
+}
+
+CompressedImageResult thinpic_jpeg_lossless(const ThinpicInput* input, const CompressOptions* options) {
+    return lossless_transform(input, options, thinpic_metadata_policy(), 0);
+}
+
+CompressedImageResult thinpic_jpeg_upright(const ThinpicInput* input) {
+    CompressOptions options;
+    memset(&options, 0, sizeof(options));
+    options.mode = COMPRESS_MODE_LOSSLESS_JPEG;
+    return lossless_transform(input, &options, THINPIC_STRIP_NONE, 0);
+}
+
+CompressedImageResult thinpic_jpeg_optimize(const ThinpicInput* input) {
+    // EXIF goes with the rest of the markers, so the orientation it would
+    // have applied is moved into the blocks
+    CompressOptions options;
+    memset(&options, 0, sizeof(options));
+    options.mode = COMPRESS_MODE_JPEG_OPTIMIZE;
+    return lossless_transform(input, &options, THINPIC_STRIP_ALL, 1);
+}
+
+// THINPIC_SCAN_SCRIPT_PREVIEW. The DC scan carries full precision, so the
+// first scan alone decodes to an exact 1/8-scale image; the first two luma
+// AC coefficients then turn flat blocks into gradients before any chroma
+// detail or fine texture is sent.
+static const jpeg_scan_info preview_scans_ycc[] = {
+    {3, {0, 1, 2}, 0, 0, 0, 0},
+    {1, {0}, 1, 2, 0, 0},
+    {1, {0}, 3, 9, 0, 1},
+    {1, {2}, 1, 63, 0, 1},
+    {1, {1}, 1, 63, 0, 1},
+    {1, {0}, 10, 63, 0, 1},
+    {1, {0}, 3, 63, 1, 0},
+    {1, {2}, 1, 63, 1, 0},
+    {1, {1}, 1, 63, 1, 0},
+};
+
+static const jpeg_scan_info preview_scans_gray[] = {
+    {1, {0}, 0, 0, 0, 0},
+    {1, {0}, 1, 2, 0, 0},
+    {1, {0}, 3, 9, 0, 1},
+    {1, {0}, 10, 63, 0, 1},
+    {1, {0}, 3, 63, 1, 0},
+};
+
+// Point dst at the scan script; libjpeg validates it in jpeg_write_coefficients
+static int set_scan_script(j_compress_ptr dst, ThinpicScanScript script,
+                           const ThinpicScan* scans, int scan_count) {
+    if (script == THINPIC_SCAN_SCRIPT_PREVIEW && dst->num_components == 3) {
+        dst->scan_info = preview_scans_ycc;
+        dst->num_scans = (int)(sizeof(preview_scans_ycc) / sizeof(preview_scans_ycc[0]));
+        return 0;
+    }
+    if (script == THINPIC_SCAN_SCRIPT_PREVIEW && dst->num_components == 1) {
+        dst->scan_info = preview_scans_gray;
+        dst->num_scans = (int)(sizeof(preview_scans_gray) / sizeof(preview_scans_gray[0]));
+        return 0;
+    }
+    if (script != THINPIC_SCAN_SCRIPT_CUSTOM) {
+        // The default, and the preview script for CMYK
+        jpeg_simple_progression(dst);
+        return 0;
+    }
+
+    if (!scans || scan_count < 1) return -1;
+    jpeg_scan_info* info = (jpeg_scan_info*)(*dst->mem->alloc_small)(
+        (j_common_ptr)dst, JPOOL_PERMANENT, sizeof(jpeg_scan_info) * (size_t)scan_count);
+    for (int i = 0; i < scan_count; i++) {
+        if (scans[i].component_count < 1 || scans[i].component_count > MAX_COMPS_IN_SCAN) {
+            THINPIC_LOGE("Error: Scan %d has %d components", i, scans[i].component_count);
+            return -1;
+        }
+        info[i].comps_in_scan = scans[i].component_count;
+        for (int c = 0; c < scans[i].component_count; c++) {
+            info[i].component_index[c] = scans[i].components[c];
+        }
+        info[i].Ss = scans[i].ss;
+        info[i].Se = scans[i].se;
+        info[i].Ah = scans[i].ah;
+        info[i].Al = scans[i].al;
+    }
+    dst->scan_info = info;
+    dst->num_scans = scan_count;
+    return 0;
+}
+
+uint8_t* thinpic_jpeg_progressive(const uint8_t* data, size_t length, ThinpicScanScript script,
+                                  const ThinpicScan* scans, int scan_count, size_t* out_length) {
+    struct jpeg_decompress_struct src;
+    struct jpeg_compress_struct dst;
+    LosslessError error;
+
+    *out_length = 0;
+    memset(&src, 0, sizeof(src));
+    memset(&dst, 0, sizeof(dst));
+    memset(&error, 0, sizeof(error));
+    src.err = jpeg_std_error(&error.pub);
+    dst.err = &error.pub;
+    error.pub.error_exit = lossless_error_exit;
+    error.pub.output_message = lossless_output_message;
+
+    if (setjmp(error.escape)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        free(error.out_buffer);
+        THINPIC_LOGE("Error: Progressive JPEG re-code failed");
+        return NULL;
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+
+    jpeg_mem_src(&src, (const unsigned char*)data, (unsigned long)length);
+    jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+    for (int m = 0; m < 16; m++) {
+        jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+    }
+    jpeg_read_header(&src, TRUE);
+    jvirt_barray_ptr* coefficients = jpeg_read_coefficients(&src);
+
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.optimize_coding = TRUE;
+    if (set_scan_script(&dst, script, scans, scan_count) != 0) {
+        THINPIC_LOGE("Error: Invalid progressive scan script");
+        longjmp(error.escape, 1);
+    }
+
+    jpeg_mem_dest(&dst, &error.out_buffer, &error.out_length);
+    jpeg_write_coefficients(&dst, coefficients);
+    copy_markers(&src, &dst, THINPIC_STRIP_NONE);   // The saver already applied the strip policy
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+
+    THINPIC_LOGD("Progressive JPEG: %d scans, %zu -> %zu bytes", dst.num_scans, length, error.out_length);
+
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+
+    uint8_t* output = (uint8_t*)g_malloc(error.out_length);
+    memcpy(output, error.out_buffer, error.out_length);
+    *out_length = error.out_length;
+    free(error.out_buffer);
+    return output;
+}
+
+// Whether src can be requantized as it stands: 8x8 blocks in YCbCr or
+// grayscale (and no chroma subsampling when full_chroma is asked for)
+static int requantizable(j_decompress_ptr src, int full_chroma) {
+    if (src->block_size != DCTSIZE) return 0;
+    if (src->jpeg_color_space == JCS_GRAYSCALE) return src->num_components == 1;
+    if (src->jpeg_color_space != JCS_YCbCr || src->num_components != 3) return 0;
+    for (int ci = 1; full_chroma && ci < 3; ci++) {
+        if (src->comp_info[ci].h_samp_factor != src->max_h_samp_factor ||
+                src->comp_info[ci].v_samp_factor != src->max_v_samp_factor) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Quantization steps of each component at quality: the standard tables
+// jpeg_set_quality put in dst (luma for the first component, chroma for
+// the rest), never finer than the source's own; a shared slot takes its
+// first component's table. Writes them into dst's slots.
+static void requantized_steps(j_compress_ptr dst, UINT16 source[][DCTSIZE2], int quality,
+                              UINT16 steps[][DCTSIZE2]) {
+    UINT16 standard[2][DCTSIZE2];
+    jpeg_set_quality(dst, quality, TRUE);
+    for (int t = 0; t < 2; t++) memcpy(standard[t], dst->quant_tbl_ptrs[t]->quantval, sizeof(standard[t]));
+    int written = 0;
+    for (int ci = 0; ci < dst->num_components; ci++) {
+        int slot = dst->comp_info[ci].quant_tbl_no;
+        JQUANT_TBL* table = dst->quant_tbl_ptrs[slot];
+        if (!table) table = dst->quant_tbl_ptrs[slot] = jpeg_alloc_quant_table((j_common_ptr)dst);
+        if (!(written & (1 << slot))) {
+            for (int k = 0; k < DCTSIZE2; k++) {
+                UINT16 step = standard[ci == 0 ? 0 : 1][k];
+                table->quantval[k] = step > source[ci][k] ? step : source[ci][k];
+            }
+            written |= 1 << slot;
+        }
+        memcpy(steps[ci], table->quantval, sizeof(steps[ci]));
+    }
+}
+
+// Source blocks of component ci rounded to the new steps, into dest
+static void requantize_component(j_decompress_ptr src, int ci, jvirt_barray_ptr source, jvirt_barray_ptr dest,
+                                 const UINT16* from, const UINT16* to) {
+    jpeg_component_info* comp = &src->comp_info[ci];
+    for (JDIMENSION row = 0; row < comp->height_in_blocks; row++) {
+        JBLOCKARRAY in = (*src->mem->access_virt_barray)((j_common_ptr)src, source, row, 1, FALSE);
+        JBLOCKARRAY out = (*src->mem->access_virt_barray)((j_common_ptr)src, dest, row, 1, TRUE);
+        for (JDIMENSION col = 0; col < comp->width_in_blocks; col++) {
+            const JCOEF* block = in[0][col];
+            JCOEF* requantized = out[0][col];
+            for (int k = 0; k < DCTSIZE2; k++) {
+                if (to[k] == from[k]) {
+                    requantized[k] = block[k];
+                    continue;
+                }
+                // Nearest, with ties toward zero: at a step ratio of 2 every
+                // odd level is a tie, and rounding those up spends bits
+                // on the error the source step already made
+                long scaled = (long)block[k] * from[k];
+                long half = (to[k] - 1) / 2;
+                requantized[k] = (JCOEF)(scaled >= 0 ? (scaled + half) / to[k] : -((-scaled + half) / to[k]));
+            }
+        }
+    }
+}
+
+int thinpic_jpeg_requantize_search(const ThinpicInput* input, int min_quality, int max_quality, int full_chroma,
+                                   size_t lower, size_t upper, EncodeArena* arena, int* encodes) {
+    struct jpeg_decompress_struct src;
+    struct jpeg_compress_struct dst;
+    LosslessError error;
+    FILE* volatile file = NULL;
+    unsigned char* volatile best = NULL;
+    volatile size_t best_length = 0;
+    volatile int best_quality = -1;
+
+    memset(&src, 0, sizeof(src));
+    memset(&dst, 0, sizeof(dst));
+    memset(&error, 0, sizeof(error));
+    src.err = jpeg_std_error(&error.pub);
+    dst.err = &error.pub;
+    error.pub.error_exit = lossless_error_exit;
+    error.pub.output_message = lossless_output_message;
+
+    if (setjmp(error.escape)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        if (file) fclose(file);
+        free(error.out_buffer);
+        free(best);
+        THINPIC_LOGW("Coefficient search failed; searching the decoded pixels instead");
+        return -2;
+    }
+
+    if (input->data) {
+        jpeg_create_decompress(&src);
+        jpeg_mem_src(&src, (const unsigned char*)input->data, input->length);
+    } else {
+        file = input->path ? fopen(input->path, "rb") : NULL;
+        if (!file) return -2;
+        jpeg_create_decompress(&src);
+        jpeg_stdio_src(&src, file);
+    }
+    jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+    for (int m = 0; m < 16; m++) {
+        jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+    }
+    jpeg_read_header(&src, TRUE);
+    if (!requantizable(&src, full_chroma)) {
+        jpeg_destroy_decompress(&src);
+        if (file) fclose(file);
+        return -2;
+    }
+
+    // Requantized blocks go to a second set of arrays, so every probe
+    // starts from the stored coefficients; requested before the pool is
+    // realized
+    jvirt_barray_ptr* dest_arrays = (jvirt_barray_ptr*)(*src.mem->alloc_small)(
+        (j_common_ptr)&src, JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * src.num_components);
+    for (int ci = 0; ci < src.num_components; ci++) {
+        jpeg_component_info* comp = &src.comp_info[ci];
+        dest_arrays[ci] = (*src.mem->request_virt_barray)((j_common_ptr)&src, JPOOL_IMAGE, FALSE,
+            comp->width_in_blocks, comp->height_in_blocks, (JDIMENSION)comp->v_samp_factor);
+    }
+    jvirt_barray_ptr* source_arrays = jpeg_read_coefficients(&src);
+    UINT16 source_steps[MAX_COMPONENTS][DCTSIZE2];
+    for (int ci = 0; ci < src.num_components; ci++) {
+        if (!src.comp_info[ci].quant_table) {
+            THINPIC_LOGW("JPEG component %d has no quantization table", ci);
+            longjmp(error.escape, 1);
+        }
+        memcpy(source_steps[ci], src.comp_info[ci].quant_table->quantval, sizeof(source_steps[ci]));
+    }
+
+    // Highest quality that fits under upper, stopping at the first fit that
+    // also reaches lower; size grows with quality as it does for pixels
+    int low = min_quality;
+    int top = max_quality;
+    while (low <= top) {
+        if (thinpic_cancel_requested()) {
+            THINPIC_LOGI("Coefficient search cancelled");
+            longjmp(error.escape, 1);
+        }
+        int quality = low + (top - low) / 2;
+        (*encodes)++;
+        jpeg_create_compress(&dst);
+        jpeg_copy_critical_parameters(&src, &dst);
+        UINT16 steps[MAX_COMPONENTS][DCTSIZE2];
+        requantized_steps(&dst, source_steps, quality, steps);
+        for (int ci = 0; ci < src.num_components; ci++) {
+            requantize_component(&src, ci, source_arrays[ci], dest_arrays[ci], source_steps[ci], steps[ci]);
+        }
+        dst.optimize_coding = TRUE;
+        if (src.progressive_mode) jpeg_simple_progression(&dst);
+        jpeg_mem_dest(&dst, &error.out_buffer, &error.out_length);
+        jpeg_write_coefficients(&dst, dest_arrays);
+        copy_markers(&src, &dst, thinpic_metadata_policy());
+        jpeg_finish_compress(&dst);
+        jpeg_destroy_compress(&dst);
+
+        unsigned char* encoded = error.out_buffer;
+        size_t length = error.out_length;
+        error.out_buffer = NULL;
+        error.out_length = 0;
+        THINPIC_LOGD("Requantized to quality %d: %zu KB", quality, length / 1024);
+        if (length <= upper) {
+            free(best);
+            best = encoded;
+            best_length = length;
+            best_quality = quality;
+            if (length >= lower) break;
+            low = quality + 1;
+        } else {
+            free(encoded);
+            top = quality - 1;
+        }
+    }
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_decompress(&src);
+    if (file) fclose(file);
+
+    if (best_quality < 0) return -1;
+    VipsTarget* target = thinpic_arena_target(arena);
+    int failed = !target || vips_target_write(target, best, best_length) || vips_target_end(target);
+    if (target) g_object_unref(target);
+    free(best);
+    if (failed || arena->length == 0) {
+        vips_error_clear();
+        return -2;
+    }
+    return best_quality;
+}
@@ -0,0 +1,462 @@
+// Parallel decode of restart-marked JPEGs. jpegload runs libjpeg on one
+// thread, so the full-resolution decode in front of a target-size search is
+// one core's work however many the job was granted: about a second for a
+// 48 MP camera file, three for a 108 MP one. Most camera JPEGs carry a
+// restart interval (DRI), and each interval's entropy-coded data starts
+// again with fresh DC predictors, so a file whose intervals end on MCU row
+// boundaries can be cut into strips that decode on their own. Every strip
+// becomes a small JPEG of its own (the tables, a shorter SOF, its slice of
+// the scan with the restart markers renumbered) decoded by libjpeg straight
+// into its rows of one frame buffer. A strip decodes one interval of
+// context above and below and throws those rows away, so fancy chroma
+// upsampling at its edges sees the real neighbours and the pixels match
+// jpegload's exactly. Progressive and multi-scan files, CMYK, and files
+// without restart markers or with intervals that split an MCU row decode
+// through jpegload as before. The same strips serve a crop of any such
+// file (thinpic_jpeg_region_decode): only the intervals covering its rows
+// are decoded, and the rows above it are never entropy decoded at all.
+
+// vips7compat.h would otherwise #define error_exit, a jpeg_error_mgr field
+#define VIPS_DISABLE_COMPAT
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <jpeglib.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Below this a single decode finishes before the strips would pay back
+#define PARALLEL_MIN_PIXELS (16 * 1000 * 1000)
+// Strips handed out per worker, so a slow strip does not leave cores idle
+#define STRIPS_PER_WORKER 4
+#define MAX_WORKERS 16
+
+// Where the scan of a qualifying file lies and how its intervals map to rows
+typedef struct {
+    const uint8_t* data;
+    int width;
+    int height;
+    int components;
+    int sof_height_offset;      // Of the SOF height field in the prefix
+    uint8_t* prefix;            // SOI, the kept tables, SOF and the SOS header
+    size_t prefix_length;
+    size_t scan_start;          // First entropy-coded byte
+    size_t scan_end;            // The marker after the scan (EOI)
+    int interval_rows;          // Pixel rows per restart interval
+    int intervals;
+    size_t* restarts;           // Offset of the RSTn marker closing interval i
+} ScanLayout;
+
+typedef struct {
+    const ScanLayout* layout;
+    uint8_t* pixels;            // Rows from interval_top(base) down
+    int base;                   // Intervals [base, end) are decoded
+    int end;
+    int strip_intervals;
+    int strips;
+    int next;
+    int failed;
+} DecodeJob;
+
+// libjpeg errors longjmp back into decode_strip; warnings (a truncated
+// interval, a bad restart marker) are what jpegload's fail_on none ignores
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf escape;
+} StripError;
+
+static void strip_error_exit(j_common_ptr cinfo) {
+    longjmp(((StripError*)cinfo->err)->escape, 1);
+}
+
+static void strip_output_message(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+static int read_u16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static int interval_top(const ScanLayout* layout, int interval) {
+    int64_t row = (int64_t)interval * layout->interval_rows;
+    return row < layout->height ? (int)row : layout->height;
+}
+
+// Entropy-coded bytes of intervals [first, last)
+static size_t interval_start(const ScanLayout* layout, int first) {
+    return first == 0 ? layout->scan_start : layout->restarts[first - 1] + 2;
+}
+
+static size_t interval_end(const ScanLayout* layout, int last) {
+    return last == layout->intervals ? layout->scan_end : layout->restarts[last - 1];
+}
+
+// Walk the markers up to the scan. Returns 1 with layout filled when the
+// file is one baseline scan of whole-row restart intervals and at least
+// min_pixels, 0 otherwise.
+static int parse_headers(const uint8_t* data, size_t length, int64_t min_pixels, ScanLayout* layout) {
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8) return 0;
+    layout->prefix = (uint8_t*)malloc(length < 65536 * 4 ? length : 65536 * 4);
+    if (!layout->prefix) return 0;
+    memcpy(layout->prefix, data, 2);
+    layout->prefix_length = 2;
+    layout->sof_height_offset = -1;
+
+    int restart_mcus = 0;
+    int h_max = 1, v_max = 1, scan_components = 0;
+    size_t pos = 2;
+    while (pos + 4 <= length) {
+        if (data[pos] != 0xFF) return 0;
+        int marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        // TEM and stray RSTn carry no length
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+            continue;
+        }
+        size_t segment = 2 + (size_t)read_u16(data + pos + 2);
+        if (pos + segment > length) return 0;
+        // 0xC0 baseline and 0xC1 extended Huffman; everything else (progressive,
+        // lossless, arithmetic) goes to jpegload
+        if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) return 0;
+        if (marker == 0xC0 || marker == 0xC1) {
+            if (segment < 10 || data[pos + 4] != 8) return 0;
+            layout->height = read_u16(data + pos + 5);
+            layout->width = read_u16(data + pos + 7);
+            layout->components = data[pos + 9];
+            if (segment < 10 + 3 * (size_t)layout->components) return 0;
+            for (int c = 0; c < layout->components; c++) {
+                int sampling = data[pos + 11 + c * 3];
+                if ((sampling >> 4) > h_max) h_max = sampling >> 4;
+                if ((sampling & 15) > v_max) v_max = sampling & 15;
+            }
+            layout->sof_height_offset = (int)layout->prefix_length + 5;
+        } else if (marker == 0xDD && segment >= 6) {
+            restart_mcus = read_u16(data + pos + 4);
+        } else if (marker == 0xDA) {
+            scan_components = data[pos + 4];
+            layout->scan_start = pos + segment;
+        } else if (marker == 0xD9) {
+            return 0;
+        }
+        // EXIF, XMP, ICC and comments stay with the header image; JFIF and
+        // Adobe decide the colour transform, so they are kept
+        int kept = !((marker >= 0xE1 && marker <= 0xEF && marker != 0xEE) || marker == 0xFE);
+        if (kept) {
+            if (layout->prefix_length + segment > 65536 * 4) return 0;
+            memcpy(layout->prefix + layout->prefix_length, data + pos, segment);
+            layout->prefix_length += segment;
+        }
+        pos += segment;
+        if (marker == 0xDA) break;
+    }
+    if (layout->sof_height_offset < 0 || layout->scan_start == 0 || restart_mcus == 0) return 0;
+    if (layout->components != 1 && layout->components != 3) return 0;
+    // One interleaved scan; a non-interleaved first scan leaves the others unread
+    if (scan_components != layout->components) return 0;
+    if (layout->width <= 0 || layout->height <= 0 ||
+            (int64_t)layout->width * layout->height < min_pixels) {
+        return 0;
+    }
+
+    // A single-component scan codes one 8x8 block per MCU whatever its sampling
+    int mcu_width = layout->components == 1 ? 8 : 8 * h_max;
+    int mcu_height = layout->components == 1 ? 8 : 8 * v_max;
+    int mcus_per_row = (layout->width + mcu_width - 1) / mcu_width;
+    if (restart_mcus % mcus_per_row != 0) return 0;
+    layout->interval_rows = restart_mcus / mcus_per_row * mcu_height;
+    layout->intervals = (layout->height + layout->interval_rows - 1) / layout->interval_rows;
+    return layout->intervals >= 2;
+}
+
+// Find the restart markers. 0xFF in the entropy-coded data is followed by a
+// stuffed 0x00 or fill 0xFFs; anything else is a marker. Returns 1 when
+// there is exactly one RSTn per interval boundary, in sequence.
+static int find_restarts(const uint8_t* data, size_t length, ScanLayout* layout) {
+    layout->restarts = (size_t*)malloc(sizeof(size_t) * (size_t)layout->intervals);
+    if (!layout->restarts) return 0;
+    int found = 0;
+    size_t pos = layout->scan_start;
+    for (;;) {
+        const uint8_t* next = (const uint8_t*)memchr(data + pos, 0xFF, length - pos);
+        if (!next) return 0;
+        pos = (size_t)(next - data);
+        if (pos + 1 >= length) return 0;
+        int marker = data[pos + 1];
+        if (marker == 0x00) {
+            pos += 2;
+        } else if (marker == 0xFF) {
+            pos++;
+        } else if (marker >= 0xD0 && marker <= 0xD7) {
+            if (found == layout->intervals - 1 || marker != 0xD0 + (found & 7)) return 0;
+            layout->restarts[found++] = pos;
+            pos += 2;
+        } else {
+            layout->scan_end = pos;
+            return found == layout->intervals - 1;
+        }
+    }
+}
+
+// One strip: intervals [first, last) plus one of context on each side.
+// Returns 0 when its rows landed in job->pixels.
+static int decode_strip(const DecodeJob* job, int first, int last) {
+    const ScanLayout* layout = job->layout;
+    int from = first > 0 ? first - 1 : 0;
+    int to = last < layout->intervals ? last + 1 : layout->intervals;
+    int skip = interval_top(layout, first) - interval_top(layout, from);
+    int keep = interval_top(layout, last) - interval_top(layout, first);
+    int rows = interval_top(layout, to) - interval_top(layout, from);
+
+    size_t start = interval_start(layout, from);
+    size_t end = interval_end(layout, to);
+    size_t length = layout->prefix_length + (end - start) + 2;
+    uint8_t* strip = (uint8_t*)malloc(length);
+    if (!strip) return -1;
+    memcpy(strip, layout->prefix, layout->prefix_length);
+    strip[layout->sof_height_offset] = (uint8_t)(rows >> 8);
+    strip[layout->sof_height_offset + 1] = (uint8_t)rows;
+    uint8_t* scan = strip + layout->prefix_length;
+    memcpy(scan, layout->data + start, end - start);
+    // Restart numbers run from RST0 again in every stream
+    for (int i = from; i < to - 1; i++) {
+        scan[layout->restarts[i] - start + 1] = (uint8_t)(0xD0 + ((i - from) & 7));
+    }
+    strip[length - 2] = 0xFF;
+    strip[length - 1] = 0xD9;
+
+    size_t row_bytes = (size_t)layout->width * layout->components;
+    uint8_t* scratch = (uint8_t*)malloc(row_bytes);
+    struct jpeg_decompress_struct cinfo;
+    StripError error;
+    cinfo.err = jpeg_std_error(&error.pub);
+    error.pub.error_exit = strip_error_exit;
+    error.pub.output_message = strip_output_message;
+    // volatile: read after a longjmp out of libjpeg
+    volatile int failed = 1;
+    volatile int created = 0;
+    if (scratch && setjmp(error.escape) == 0) {
+        jpeg_create_decompress(&cinfo);
+        created = 1;
+        jpeg_mem_src(&cinfo, strip, (unsigned long)length);
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = layout->components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+        jpeg_start_decompress(&cinfo);
+        if ((int)cinfo.output_width == layout->width && cinfo.output_components == layout->components) {
+            uint8_t* top = job->pixels + (size_t)(interval_top(layout, first) - interval_top(layout, job->base)) *
+                                         row_bytes;
+            while ((int)cinfo.output_scanline < skip + keep) {
+                int line = (int)cinfo.output_scanline;
+                JSAMPROW row = line >= skip ? top + (size_t)(line - skip) * row_bytes : scratch;
+                jpeg_read_scanlines(&cinfo, &row, 1);
+            }
+            failed = 0;
+        }
+        // The context rows below are not needed
+        jpeg_abort_decompress(&cinfo);
+    }
+    if (created) jpeg_destroy_decompress(&cinfo);
+    free(scratch);
+    free(strip);
+    return failed ? -1 : 0;
+}
+
+static void* strip_worker(void* arg) {
+    DecodeJob* job = (DecodeJob*)arg;
+    for (;;) {
+        if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) break;
+        int s = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (s >= job->strips) break;
+        int first = job->base + s * job->strip_intervals;
+        int last = first + job->strip_intervals;
+        if (last > job->end) last = job->end;
+        if (decode_strip(job, first, last)) __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void free_with_image(VipsImage* image, gpointer data) {
+    (void)image;
+    g_free(data);
+}
+
+// Carry the loader's metadata (EXIF, ICC, orientation, "vips-loader") over
+// to the decoded frame; the sequential mark stays behind
+static void* copy_field(VipsImage* image, const char* field, GValue* value, void* a) {
+    (void)image;
+    if (strcmp(field, VIPS_META_SEQUENTIAL) != 0) vips_image_set((VipsImage*)a, field, value);
+    return NULL;
+}
+
+// The encoded bytes of a path or descriptor input, mapped read-only
+static const uint8_t* map_input(const ThinpicInput* input, size_t* length) {
+    int fd = input->path ? open(input->path, O_RDONLY | O_CLOEXEC) : input->fd;
+    if (fd < 0) return NULL;
+    struct stat file_stat;
+    void* address = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        address = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (input->path) close(fd);
+    if (address == MAP_FAILED) return NULL;
+    *length = (size_t)file_stat.st_size;
+    return (const uint8_t*)address;
+}
+
+static double now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+// Intervals [base, end) decoded on up to threads threads (the caller is
+// one) into pixels; 0 when every strip landed
+static int decode_intervals(const ScanLayout* layout, uint8_t* pixels, int base, int end, int threads,
+                            int* used) {
+    int workers = threads < MAX_WORKERS ? threads : MAX_WORKERS;
+    if (workers < 1) workers = 1;
+    DecodeJob job;
+    memset(&job, 0, sizeof(job));
+    job.layout = layout;
+    job.pixels = pixels;
+    job.base = base;
+    job.end = end;
+    int wanted = workers * STRIPS_PER_WORKER;
+    job.strip_intervals = (end - base + wanted - 1) / wanted;
+    job.strips = (end - base + job.strip_intervals - 1) / job.strip_intervals;
+    job.failed = pixels == NULL;
+    if (workers > job.strips) workers = job.strips;
+
+    pthread_t pool[MAX_WORKERS];
+    int running = 0;
+    if (!job.failed) {
+        for (int i = 1; i < workers; i++) {
+            if (pthread_create(&pool[running], NULL, strip_worker, &job) != 0) break;
+            running++;
+        }
+        // The caller decodes strips too
+        strip_worker(&job);
+        for (int i = 0; i < running; i++) pthread_join(pool[i], NULL);
+    }
+    *used = running + 1;
+    return job.failed || thinpic_cancel_requested();
+}
+
+// The input's bytes and their scan layout; 1 when the file qualifies (see
+// parse_headers) and matches header, with *mapped to unmap after
+static int input_layout(const ThinpicInput* input, VipsImage* header, int64_t min_pixels, ScanLayout* layout,
+                        const uint8_t** mapped, size_t* length) {
+    memset(layout, 0, sizeof(*layout));
+    *mapped = NULL;
+    *length = input->length;
+    const uint8_t* data = (const uint8_t*)input->data;
+    if (!data) {
+        *mapped = map_input(input, length);
+        if (!*mapped) return 0;
+        data = *mapped;
+    }
+    layout->data = data;
+    return parse_headers(data, *length, min_pixels, layout) && find_restarts(data, *length, layout) &&
+           layout->width == vips_image_get_width(header) && layout->height == vips_image_get_height(header) &&
+           layout->components == vips_image_get_bands(header);
+}
+
+static void release_layout(ScanLayout* layout, const uint8_t* mapped, size_t length) {
+    free(layout->prefix);
+    free(layout->restarts);
+    if (mapped) munmap((void*)mapped, length);
+}
+
+// Rows of intervals [base, end) as a memory image with header's metadata
+static VipsImage* rows_image(const ScanLayout* layout, VipsImage* header, uint8_t* pixels, int base, int end) {
+    int rows = interval_top(layout, end) - interval_top(layout, base);
+    size_t frame = (size_t)layout->width * rows * layout->components;
+    VipsImage* image = vips_image_new_from_memory(pixels, frame, layout->width, rows, layout->components,
+                                                  VIPS_FORMAT_UCHAR);
+    if (!image) return NULL;
+    g_signal_connect(image, "postclose", G_CALLBACK(free_with_image), pixels);
+    vips_image_init_fields(image, layout->width, rows, layout->components, VIPS_FORMAT_UCHAR,
+                           VIPS_CODING_NONE, vips_image_get_interpretation(header),
+                           vips_image_get_xres(header), vips_image_get_yres(header));
+    vips_image_map(header, copy_field, image);
+    return image;
+}
+
+VipsImage* thinpic_jpeg_parallel_decode(const ThinpicInput* input, VipsImage* header, int threads) {
+    if (threads < 2 || input->image) return NULL;
+    if ((int64_t)vips_image_get_width(header) * vips_image_get_height(header) < PARALLEL_MIN_PIXELS) return NULL;
+
+    ScanLayout layout;
+    const uint8_t* mapped;
+    size_t length;
+    VipsImage* image = NULL;
+    if (input_layout(input, header, PARALLEL_MIN_PIXELS, &layout, &mapped, &length)) {
+        ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_DECODE);
+        double start = now_ms();
+        size_t frame = (size_t)layout.width * layout.height * layout.components;
+        uint8_t* pixels = (uint8_t*)g_try_malloc(frame);
+        int used = 0;
+        if (!decode_intervals(&layout, pixels, 0, layout.intervals, threads, &used)) {
+            image = rows_image(&layout, header, pixels, 0, layout.intervals);
+        }
+        if (image) {
+            double elapsed = now_ms() - start;
+            thinpic_budget_record_decode(FORMAT_JPEG, layout.width, layout.height, elapsed);
+            THINPIC_LOGD("Parallel JPEG decode: %dx%d on %d threads, %.1f ms", layout.width, layout.height,
+                         used, elapsed);
+        } else {
+            g_free(pixels);
+            vips_error_clear();
+            THINPIC_LOGD("Parallel JPEG decode failed, using jpegload");
+        }
+        thinpic_stage_end(THINPIC_STAGE_DECODE, started);
+    }
+    release_layout(&layout, mapped, length);
+    return image;
+}
+
+VipsImage* thinpic_jpeg_region_decode(const ThinpicInput* input, VipsImage* header, int top, int height,
+                                      int threads, int* origin) {
+    if (input->image || top < 0 || height <= 0) return NULL;
+
+    ScanLayout layout;
+    const uint8_t* mapped;
+    size_t length;
+    VipsImage* image = NULL;
+    if (input_layout(input, header, 0, &layout, &mapped, &length) && top + height <= layout.height) {
+        int base = top / layout.interval_rows;
+        int end = (top + height + layout.interval_rows - 1) / layout.interval_rows;
+        ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_DECODE);
+        double start = now_ms();
+        int rows = interval_top(&layout, end) - interval_top(&layout, base);
+        uint8_t* pixels = (uint8_t*)g_try_malloc((size_t)layout.width * rows * layout.components);
+        int used = 0;
+        if (!decode_intervals(&layout, pixels, base, end, threads, &used)) {
+            image = rows_image(&layout, header, pixels, base, end);
+        }
+        if (image) {
+            *origin = interval_top(&layout, base);
+            THINPIC_LOGD("Region JPEG decode: rows %d-%d of %d (intervals %d-%d of %d) on %d threads, %.1f ms",
+                         *origin, *origin + rows, layout.height, base, end, layout.intervals, used,
+                         now_ms() - start);
+        } else {
+            g_free(pixels);
+            vips_error_clear();
+        }
+        thinpic_stage_end(THINPIC_STAGE_DECODE, started);
+    }
+    release_layout(&layout, mapped, length);
+    return image;
+}
@@ -0,0 +1,300 @@
+// Strip-parallel JPEG encoding (thinpic_configure jpeg_strip_encode). The
+// large and DSLR pipelines render on every libvips thread, but jpegsave
+// codes the result on one: a 6000 px output spends most of its time in the
+// Huffman coder while the other cores wait. With the option on, the image
+// is cut into horizontal strips of whole MCU rows. Each strip is rendered in
+// order, so a sequential source reads straight through, and a wave of them
+// is encoded at once, one libvips jpegsave per thread. Every strip is
+// saved with a restart interval as long as the strip itself. So each one is
+// exactly one interval, starts from fresh DC predictors and ends
+// byte-aligned, which is what the decoder expects right after an RSTn
+// marker. The strips' scans are then joined with RST0..RST7 between them
+// behind the first strip's headers, with its SOF height set to the whole
+// image, into one baseline JPEG. A scan has one set of tables, so the
+// strips use libjpeg's standard Huffman tables instead of optimised ones,
+// typically 3-6% larger. Only the first strip carries the metadata.
+
+#include <pthread.h>
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Output rows per strip before MCU alignment; about 4.5 MB of a 6000 px row
+#define STRIP_ROWS 256
+// Below this one jpegsave finishes before the strips would pay back
+#define STRIP_MIN_PIXELS (8 * 1000 * 1000)
+#define MAX_WORKERS 16
+
+typedef struct {
+    VipsImage* source;          // Metadata for the first strip
+    int width;
+    int rows;
+    int bands;
+    int first;                  // Carries the headers and metadata
+    uint8_t* pixels;
+    size_t size;
+    void* encoded;
+    size_t encoded_length;
+    int failed;
+    const void* params;
+} Strip;
+
+typedef struct {
+    int quality;
+    VipsForeignSubsample subsample;
+    int restart_interval;
+    VipsForeignKeep keep;
+} StripParams;
+
+// Where a strip's scan lies, with the parts of its header the join checks
+typedef struct {
+    size_t sof_height;          // Offset of the SOF height field
+    size_t scan_start;          // First entropy-coded byte
+    size_t scan_end;            // The EOI marker
+    int restart_interval;
+    uint8_t sampling[3];
+    int components;
+} StripLayout;
+
+static void* copy_field(VipsImage* image, const char* field, GValue* value, void* a) {
+    (void)image;
+    vips_image_set((VipsImage*)a, field, value);
+    return NULL;
+}
+
+static void* encode_strip(void* arg) {
+    Strip* strip = (Strip*)arg;
+    const StripParams* params = (const StripParams*)strip->params;
+    VipsImage* image = vips_image_new_from_memory(strip->pixels, strip->size, strip->width, strip->rows,
+                                                  strip->bands, VIPS_FORMAT_UCHAR);
+    if (!image) {
+        strip->failed = 1;
+        return NULL;
+    }
+    vips_image_init_fields(image, strip->width, strip->rows, strip->bands, VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+                           vips_image_get_interpretation(strip->source), vips_image_get_xres(strip->source),
+                           vips_image_get_yres(strip->source));
+    if (strip->first) vips_image_map(strip->source, copy_field, image);
+    strip->failed = vips_jpegsave_buffer(image, &strip->encoded, &strip->encoded_length,
+        "keep", strip->first ? params->keep : VIPS_FOREIGN_KEEP_NONE,
+        "Q", params->quality,
+        "optimize_coding", FALSE,
+        "interlace", FALSE,
+        "subsample_mode", params->subsample,
+        "restart_interval", params->restart_interval,
+        NULL) != 0;
+    g_object_unref(image);
+    return NULL;
+}
+
+static int read_u16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Returns 0 when jpeg is one baseline scan ending in EOI
+static int parse_strip(const uint8_t* jpeg, size_t length, StripLayout* layout) {
+    memset(layout, 0, sizeof(*layout));
+    if (length < 6 || jpeg[0] != 0xFF || jpeg[1] != 0xD8 || jpeg[length - 2] != 0xFF || jpeg[length - 1] != 0xD9) {
+        return -1;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= length) {
+        if (jpeg[pos] != 0xFF) return -1;
+        int marker = jpeg[pos + 1];
+        size_t segment = 2 + (size_t)read_u16(jpeg + pos + 2);
+        if (pos + segment > length) return -1;
+        if (marker == 0xC0) {
+            layout->sof_height = pos + 5;
+            layout->components = jpeg[pos + 9];
+            for (int c = 0; c < layout->components && c < 3; c++) layout->sampling[c] = jpeg[pos + 11 + c * 3];
+        } else if (marker == 0xDD) {
+            layout->restart_interval = read_u16(jpeg + pos + 4);
+        } else if (marker == 0xDA) {
+            layout->scan_start = pos + segment;
+            layout->scan_end = length - 2;
+            return layout->sof_height && layout->scan_start <= layout->scan_end ? 0 : -1;
+        } else if (marker >= 0xC1 && marker <= 0xCF && marker != 0xC4 && marker != 0xCC) {
+            return -1;
+        }
+        pos += segment;
+    }
+    return -1;
+}
+
+static uint32_t tiff_u16(const uint8_t* p, int big_endian) {
+    return big_endian ? (uint32_t)((p[0] << 8) | p[1]) : (uint32_t)((p[1] << 8) | p[0]);
+}
+
+static uint32_t tiff_u32(const uint8_t* p, int big_endian) {
+    return big_endian ? tiff_u16(p, 1) << 16 | tiff_u16(p + 2, 1) : tiff_u16(p + 2, 0) << 16 | tiff_u16(p, 0);
+}
+
+static void put_tiff(uint8_t* p, uint32_t value, int bytes, int big_endian) {
+    for (int i = 0; i < bytes; i++) {
+        int shift = big_endian ? (bytes - 1 - i) * 8 : i * 8;
+        p[i] = (uint8_t)(value >> shift);
+    }
+}
+
+// Entry `tag` of the IFD at offset, NULL when absent
+static uint8_t* find_tag(uint8_t* tiff, size_t length, uint32_t offset, int tag, int big_endian) {
+    if (offset + 2 > length) return NULL;
+    uint32_t entries = tiff_u16(tiff + offset, big_endian);
+    for (uint32_t i = 0; i < entries; i++) {
+        uint8_t* entry = tiff + offset + 2 + i * 12;
+        if ((size_t)(entry + 12 - tiff) > length) return NULL;
+        if ((int)tiff_u16(entry, big_endian) == tag) return entry;
+    }
+    return NULL;
+}
+
+// jpegsave writes the strip's own height into EXIF PixelYDimension; the
+// joined image is taller
+static void patch_exif_height(uint8_t* tiff, size_t length, int height) {
+    if (length < 8 || (tiff[0] != 'I' && tiff[0] != 'M')) return;
+    int big_endian = tiff[0] == 'M';
+    uint8_t* pointer = find_tag(tiff, length, tiff_u32(tiff + 4, big_endian), 0x8769, big_endian);
+    if (!pointer) return;
+    uint8_t* entry = find_tag(tiff, length, tiff_u32(pointer + 8, big_endian), 0xA003, big_endian);
+    if (!entry) return;
+    int type = (int)tiff_u16(entry + 2, big_endian);
+    if (type == 3) put_tiff(entry + 8, (uint32_t)height, 2, big_endian);
+    if (type == 4) put_tiff(entry + 8, (uint32_t)height, 4, big_endian);
+}
+
+static void patch_exif(uint8_t* jpeg, size_t header_length, int height) {
+    size_t pos = 2;
+    while (pos + 4 <= header_length && jpeg[pos] == 0xFF) {
+        size_t segment = 2 + (size_t)read_u16(jpeg + pos + 2);
+        if (jpeg[pos + 1] == 0xE1 && segment > 10 && memcmp(jpeg + pos + 4, "Exif\0\0", 6) == 0) {
+            patch_exif_height(jpeg + pos + 10, segment - 10, height);
+        }
+        pos += segment;
+    }
+}
+
+// Join the encoded strips into one JPEG; NULL when they do not line up
+static uint8_t* join_strips(const Strip* strips, int count, int height, int restart_interval, size_t* length) {
+    StripLayout first;
+    if (parse_strip((const uint8_t*)strips[0].encoded, strips[0].encoded_length, &first) ||
+            first.restart_interval != restart_interval) {
+        return NULL;
+    }
+    size_t total = first.scan_start + 2;
+    for (int i = 0; i < count; i++) {
+        StripLayout layout;
+        if (parse_strip((const uint8_t*)strips[i].encoded, strips[i].encoded_length, &layout) ||
+                layout.restart_interval != restart_interval || layout.components != first.components ||
+                memcmp(layout.sampling, first.sampling, sizeof(first.sampling)) != 0) {
+            return NULL;
+        }
+        total += (layout.scan_end - layout.scan_start) + (i > 0 ? 2 : 0);
+    }
+
+    uint8_t* joined = (uint8_t*)g_try_malloc(total);
+    if (!joined) return NULL;
+    memcpy(joined, strips[0].encoded, first.scan_start);
+    joined[first.sof_height] = (uint8_t)(height >> 8);
+    joined[first.sof_height + 1] = (uint8_t)height;
+    patch_exif(joined, first.scan_start, height);
+    size_t at = first.scan_start;
+    for (int i = 0; i < count; i++) {
+        StripLayout layout;
+        parse_strip((const uint8_t*)strips[i].encoded, strips[i].encoded_length, &layout);
+        if (i > 0) {
+            joined[at++] = 0xFF;
+            joined[at++] = (uint8_t)(0xD0 + ((i - 1) & 7));
+        }
+        size_t scan = layout.scan_end - layout.scan_start;
+        memcpy(joined + at, (const uint8_t*)strips[i].encoded + layout.scan_start, scan);
+        at += scan;
+    }
+    joined[at++] = 0xFF;
+    joined[at++] = 0xD9;
+    *length = at;
+    return joined;
+}
+
+int thinpic_jpeg_strip_save(VipsImage* image, int quality, VipsForeignKeep keep, int threads,
+                            void** buffer, size_t* length) {
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    int bands = vips_image_get_bands(image);
+    if (threads < 2 || (int64_t)width * height < STRIP_MIN_PIXELS || height > 65535 || width > 65535 ||
+            (bands != 1 && bands != 3) || vips_image_get_format(image) != VIPS_FORMAT_UCHAR ||
+            vips_image_get_coding(image) != VIPS_CODING_NONE) {
+        return 0;
+    }
+
+    // jpegsave's automatic choice, made explicit so the MCU size is known:
+    // 4:2:0 below quality 90; a grey scan codes one 8x8 block per MCU
+    StripParams params;
+    params.quality = quality;
+    params.subsample = quality >= 90 ? VIPS_FOREIGN_SUBSAMPLE_OFF : VIPS_FOREIGN_SUBSAMPLE_ON;
+    params.keep = keep;
+    int mcu = bands == 3 && params.subsample == VIPS_FOREIGN_SUBSAMPLE_ON ? 16 : 8;
+    int mcus_per_row = (width + mcu - 1) / mcu;
+    // DRI is 16 bits
+    int max_rows = 65535 / mcus_per_row * mcu;
+    int strip_rows = (STRIP_ROWS + mcu - 1) / mcu * mcu;
+    if (strip_rows > max_rows) strip_rows = max_rows;
+    if (strip_rows < mcu) return 0;
+    params.restart_interval = strip_rows / mcu * mcus_per_row;
+    int count = (height + strip_rows - 1) / strip_rows;
+    if (count < 2) return 0;
+
+    int workers = threads < MAX_WORKERS ? threads : MAX_WORKERS;
+    Strip* strips = g_new0(Strip, count);
+    int failed = 0;
+    for (int wave = 0; wave < count && !failed; wave += workers) {
+        int in_wave = count - wave < workers ? count - wave : workers;
+        // Rendered in order, on libvips' threads
+        for (int i = wave; i < wave + in_wave && !failed; i++) {
+            Strip* strip = &strips[i];
+            strip->source = image;
+            strip->width = width;
+            strip->rows = height - i * strip_rows < strip_rows ? height - i * strip_rows : strip_rows;
+            strip->bands = bands;
+            strip->first = i == 0;
+            strip->params = &params;
+            VipsImage* crop = NULL;
+            if (vips_crop(image, &crop, 0, i * strip_rows, width, strip->rows, NULL)) {
+                failed = 1;
+                break;
+            }
+            strip->pixels = (uint8_t*)vips_image_write_to_memory(crop, &strip->size);
+            g_object_unref(crop);
+            failed = !strip->pixels || thinpic_cancel_requested();
+        }
+        // The coders run off this thread, so the save hook counts none of
+        // them; the whole image is one encode
+        pthread_t pool[MAX_WORKERS];
+        int started[MAX_WORKERS] = {0};
+        for (int i = 0; i < in_wave && !failed; i++) {
+            started[i] = pthread_create(&pool[i], NULL, encode_strip, &strips[wave + i]) == 0;
+            if (!started[i]) encode_strip(&strips[wave + i]);
+        }
+        for (int i = 0; i < in_wave; i++) {
+            if (started[i]) pthread_join(pool[i], NULL);
+            Strip* strip = &strips[wave + i];
+            g_free(strip->pixels);
+            strip->pixels = NULL;
+            if (strip->failed) failed = 1;
+        }
+    }
+
+    uint8_t* joined = NULL;
+    if (!failed) joined = join_strips(strips, count, height, params.restart_interval, length);
+    for (int i = 0; i < count; i++) g_free(strips[i].encoded);
+    g_free(strips);
+    if (!joined) {
+        if (!failed) vips_error("thinpic", "JPEG strips do not line up");
+        return -1;
+    }
+    thinpic_stage_encode();
+    THINPIC_LOGD("Strip JPEG encode: %dx%d in %d strips of %d rows on %d threads", width, height, count,
+                 strip_rows, workers);
+    *buffer = joined;
+    return 1;
+}
@@ -0,0 +1,157 @@
+// Bit-exact JPEG to JPEG XL recompression (ThinpicOptions jxl_lossless_jpeg)
+// through libjxl's JxlEncoderAddJPEGFrame. The JPEG's DCT coefficients are
+// entropy-coded again without a decode to pixels, and the reconstruction
+// data stored alongside lets a JPEG XL decoder give back the original file
+// byte for byte, typically about 20% smaller. The bundled libvips has no
+// libjxl, so the library is looked up at runtime: in the process first (a
+// libvips built with JPEG XL links it), then as libjxl and libjxl_threads
+// shipped with the app. Without libjxl_threads the encoder runs on the
+// calling thread.
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#ifdef __APPLE__
+#define JXL_LIBRARY "libjxl.dylib"
+#define JXL_THREADS_LIBRARY "libjxl_threads.dylib"
+#else
+#define JXL_LIBRARY "libjxl.so"
+#define JXL_THREADS_LIBRARY "libjxl_threads.so"
+#endif
+
+// Constants from <jxl/encode.h>
+#define JXL_ENC_SUCCESS 0
+#define JXL_ENC_NEED_MORE_OUTPUT 2
+#define JXL_ENC_FRAME_SETTING_EFFORT 0
+
+// First output buffer; doubled whenever the encoder asks for more
+#define OUTPUT_CHUNK (256 * 1024)
+
+// JxlParallelRunner; the init and run callbacks are only passed through
+typedef int (*JxlRunner)(void* runner_opaque, void* jpegxl_opaque, void* init, void* func,
+                         uint32_t start_range, uint32_t end_range);
+
+static struct {
+    void* (*encoder_create)(const void* memory_manager);
+    void (*encoder_destroy)(void* encoder);
+    int (*store_jpeg_metadata)(void* encoder, int store);
+    int (*set_parallel_runner)(void* encoder, JxlRunner runner, void* runner_opaque);
+    void* (*frame_settings_create)(void* encoder, const void* source);
+    int (*frame_settings_set_option)(void* settings, int option, int64_t value);
+    int (*add_jpeg_frame)(void* settings, const uint8_t* buffer, size_t size);
+    void (*close_input)(void* encoder);
+    int (*process_output)(void* encoder, uint8_t** next_out, size_t* avail_out);
+    void* (*runner_create)(const void* memory_manager, size_t threads);
+    void (*runner_destroy)(void* runner);
+    JxlRunner runner;
+} jxl;
+
+static pthread_once_t jxl_once = PTHREAD_ONCE_INIT;
+static int jxl_loaded = 0;
+
+// Symbols already in the process win over the library's own
+static void* find_symbol(void* library, const char* name) {
+    void* symbol = dlsym(RTLD_DEFAULT, name);
+    return symbol || !library ? symbol : dlsym(library, name);
+}
+
+static int load_encoder(void* library) {
+#define LOAD(field, symbol) \
+    if (!(*(void**)&jxl.field = find_symbol(library, symbol))) return 0
+    LOAD(encoder_create, "JxlEncoderCreate");
+    LOAD(encoder_destroy, "JxlEncoderDestroy");
+    LOAD(store_jpeg_metadata, "JxlEncoderStoreJPEGMetadata");
+    LOAD(set_parallel_runner, "JxlEncoderSetParallelRunner");
+    LOAD(frame_settings_create, "JxlEncoderFrameSettingsCreate");
+    LOAD(frame_settings_set_option, "JxlEncoderFrameSettingsSetOption");
+    LOAD(add_jpeg_frame, "JxlEncoderAddJPEGFrame");
+    LOAD(close_input, "JxlEncoderCloseInput");
+    LOAD(process_output, "JxlEncoderProcessOutput");
+#undef LOAD
+    return 1;
+}
+
+// All three or none: runner_create stays NULL when any is missing
+static void load_runner(void* library) {
+    void* create = find_symbol(library, "JxlThreadParallelRunnerCreate");
+    *(void**)&jxl.runner_destroy = find_symbol(library, "JxlThreadParallelRunnerDestroy");
+    *(void**)&jxl.runner = find_symbol(library, "JxlThreadParallelRunner");
+    if (create && jxl.runner_destroy && jxl.runner) *(void**)&jxl.runner_create = create;
+}
+
+static void load_libjxl(void) {
+    void* library = dlsym(RTLD_DEFAULT, "JxlEncoderAddJPEGFrame") ? NULL : dlopen(JXL_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    jxl_loaded = load_encoder(library);
+    if (jxl_loaded) {
+        void* threads = dlsym(RTLD_DEFAULT, "JxlThreadParallelRunner") ? NULL
+                        : dlopen(JXL_THREADS_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+        load_runner(threads);
+    }
+    THINPIC_LOGI("libjxl JPEG transcode %s%s", jxl_loaded ? "available" : "missing",
+                 jxl_loaded && !jxl.runner_create ? " (single-threaded)" : "");
+}
+
+int thinpic_jxl_transcode_available(void) {
+    pthread_once(&jxl_once, load_libjxl);
+    return jxl_loaded;
+}
+
+int thinpic_jxl_transcode(const uint8_t* jpeg, size_t length, int effort, int threads,
+                          uint8_t** out, size_t* out_length) {
+    if (!thinpic_jxl_transcode_available()) {
+        THINPIC_LOGE("Error: libjxl is not available for JPEG XL transcoding");
+        return -1;
+    }
+    void* encoder = jxl.encoder_create(NULL);
+    if (!encoder) return -1;
+    void* runner = jxl.runner_create && threads > 1 ? jxl.runner_create(NULL, (size_t)threads) : NULL;
+    int traced = thinpic_trace_begin("thinpic jxl transcode e%d", effort);
+    thinpic_stage_encode();
+
+    // Keeping the JPEG metadata is what makes the result reversible
+    void* settings = NULL;
+    int failed = (runner && jxl.set_parallel_runner(encoder, jxl.runner, runner) != JXL_ENC_SUCCESS) ||
+                 jxl.store_jpeg_metadata(encoder, 1) != JXL_ENC_SUCCESS ||
+                 !(settings = jxl.frame_settings_create(encoder, NULL)) ||
+                 jxl.frame_settings_set_option(settings, JXL_ENC_FRAME_SETTING_EFFORT, effort) != JXL_ENC_SUCCESS ||
+                 jxl.add_jpeg_frame(settings, jpeg, length) != JXL_ENC_SUCCESS;
+    uint8_t* buffer = NULL;
+    size_t used = 0;
+    if (!failed) {
+        jxl.close_input(encoder);
+        size_t capacity = OUTPUT_CHUNK;
+        buffer = (uint8_t*)g_malloc(capacity);
+        int status = JXL_ENC_NEED_MORE_OUTPUT;
+        while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+            if (used == capacity) {
+                capacity *= 2;
+                buffer = (uint8_t*)g_realloc(buffer, capacity);
+            }
+            uint8_t* next = buffer + used;
+            size_t available = capacity - used;
+            status = jxl.process_output(encoder, &next, &available);
+            used = (size_t)(next - buffer);
+        }
+        failed = status != JXL_ENC_SUCCESS || used == 0;
+    }
+
+    jxl.encoder_destroy(encoder);
+    if (runner) jxl.runner_destroy(runner);
+    thinpic_trace_end(traced);
+    if (failed) {
+        // Arithmetic-coded and some unusual JPEGs cannot be carried over
+        THINPIC_LOGE("Error: libjxl could not transcode the JPEG (%zu bytes)", length);
+        g_free(buffer);
+        return -1;
+    }
+    *out = buffer;
+    *out_length = used;
+    THINPIC_LOGD("JPEG XL transcode: %zu -> %zu bytes (effort %d, %d threads)", length, used, effort,
+                 runner ? threads : 1);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// Guard rails against pathological inputs (thinpic_configure
+// max_input_megapixels, max_input_bands and job_timeout_ms). A 30000 x
+// 30000 PNG is a few hundred kilobytes of zeros and 2.7 GB decoded, and a
+// truncated or malformed file that fail_on none lets through can keep a
+// decoder busy for minutes; either one used to hold its pool worker, and in
+// EXECUTION_MODE_SERIAL the whole queue behind it. The pixel and band limits
+// are checked on the header as each input is opened, before libvips has
+// decoded anything, so such a file fails at once with THINPIC_ERROR_LIMIT.
+// The time limit covers what a header cannot show: the pool arms a watchdog
+// per job (thinpic_cancel_arm) that kills its pipeline once it is due.
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+static int max_input_megapixels = 0;    // 0 = unlimited
+static int max_input_bands = 0;
+static int job_timeout = 0;             // ms; 0 = none
+
+void thinpic_limits_set(int max_megapixels, int max_bands, int job_timeout_ms) {
+    if (max_megapixels >= 0) __atomic_store_n(&max_input_megapixels, max_megapixels, __ATOMIC_RELAXED);
+    if (max_bands >= 0) __atomic_store_n(&max_input_bands, max_bands, __ATOMIC_RELAXED);
+    if (job_timeout_ms >= 0) __atomic_store_n(&job_timeout, job_timeout_ms, __ATOMIC_RELAXED);
+}
+
+int thinpic_job_timeout_ms(void) {
+    return __atomic_load_n(&job_timeout, __ATOMIC_RELAXED);
+}
+
+int thinpic_input_size_allowed(int width, int height, int bands) {
+    int max_megapixels = __atomic_load_n(&max_input_megapixels, __ATOMIC_RELAXED);
+    int max_bands = __atomic_load_n(&max_input_bands, __ATOMIC_RELAXED);
+    int64_t pixels = (int64_t)width * height;
+    if (max_megapixels > 0 && pixels > (int64_t)max_megapixels * 1000000) {
+        thinpic_error_code(THINPIC_ERROR_LIMIT);
+        THINPIC_LOGE("Error: Input of %dx%d (%lld MP) is over the %d MP limit", width, height,
+                     (long long)(pixels / 1000000), max_megapixels);
+        return 0;
+    }
+    if (max_bands > 0 && bands > max_bands) {
+        thinpic_error_code(THINPIC_ERROR_LIMIT);
+        THINPIC_LOGE("Error: Input has %d bands, over the limit of %d", bands, max_bands);
+        return 0;
+    }
+    return 1;
+}
+
+int thinpic_input_allowed(VipsImage* image) {
+    if (!image) return 1;
+    // Every loaded frame: an animation is stacked into one tall image
+    return thinpic_input_size_allowed(vips_image_get_width(image), vips_image_get_height(image),
+                                      vips_image_get_bands(image));
+}
@@ -0,0 +1,62 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+
+#include "image_compressor.h"
+#include "thinpic_internal.h"
+#include "thinpic_log.h"
+
+#define LOG_TAG "image_compressor"
+
+static int runtime_log_level = THINPIC_LOG_LEVEL;
+static ThinpicLogSink log_sink = NULL;
+
+void thinpic_set_log_level(ThinpicLogLevel level) {
+    __atomic_store_n(&runtime_log_level, (int)level, __ATOMIC_RELEASE);
+}
+
+void thinpic_set_log_sink(ThinpicLogSink sink) {
+    __atomic_store_n(&log_sink, sink, __ATOMIC_RELEASE);
+}
+
+static void default_sink(int level, const char* message) {
+#ifdef __ANDROID__
+    int priority = ANDROID_LOG_DEBUG;
+    switch (level) {
+        case THINPIC_LOG_LEVEL_ERROR: priority = ANDROID_LOG_ERROR; break;
+        case THINPIC_LOG_LEVEL_WARN: priority = ANDROID_LOG_WARN; break;
+        case THINPIC_LOG_LEVEL_INFO: priority = ANDROID_LOG_INFO; break;
+    }
+    __android_log_write(priority, LOG_TAG, message);
+#else
+    (void)level;
+    fprintf(stderr, "[" LOG_TAG "] %s\n", message);
+#endif
+}
+
+void thinpic_log_write(int level, const char* format, ...) {
+    // Errors are formatted even when filtered out: they are also the
+    // failing job's ThinpicError message
+    int shown = level <= __atomic_load_n(&runtime_log_level, __ATOMIC_ACQUIRE);
+    if (!shown && level != THINPIC_LOG_LEVEL_ERROR) {
+        return;
+    }
+
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (level == THINPIC_LOG_LEVEL_ERROR) thinpic_error_note(message);
+    if (!shown) return;
+
+    ThinpicLogSink sink = __atomic_load_n(&log_sink, __ATOMIC_ACQUIRE);
+    if (sink) {
+        sink(level, message);
+    } else {
+        default_sink(level, message);
+    }
+}
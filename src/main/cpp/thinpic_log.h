@@ -0,0 +1,54 @@
+#ifndef THINPIC_LOG_H
+#define THINPIC_LOG_H
+
+// Internal logging for the native engine.
+//
+// THINPIC_LOG_LEVEL picks, at compile time, the most verbose level that is
+// kept. Calls above it expand to dead code: arguments are still type-checked
+// but never evaluated, so release builds pay nothing for diagnostics.
+// Kept calls go through thinpic_log_write, which filters on the runtime
+// level and hands the message to the installed sink (logcat on Android).
+// Errors are always kept, whatever the level: each one is also recorded as
+// the failing job's ThinpicError message (thinpic_error.c).
+
+#define THINPIC_LOG_LEVEL_NONE 0
+#define THINPIC_LOG_LEVEL_ERROR 1
+#define THINPIC_LOG_LEVEL_WARN 2
+#define THINPIC_LOG_LEVEL_INFO 3
+#define THINPIC_LOG_LEVEL_DEBUG 4
+
+#ifndef THINPIC_LOG_LEVEL
+#ifdef NDEBUG
+#define THINPIC_LOG_LEVEL THINPIC_LOG_LEVEL_ERROR
+#else
+#define THINPIC_LOG_LEVEL THINPIC_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define THINPIC_PRINTF_FORMAT(fmt_index, args_index) __attribute__((format(printf, fmt_index, args_index)))
+#else
+#define THINPIC_PRINTF_FORMAT(fmt_index, args_index)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void thinpic_log_write(int level, const char* format, ...) THINPIC_PRINTF_FORMAT(2, 3);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define THINPIC_LOG_AT(level, ...) \
+    do { \
+        if (THINPIC_LOG_LEVEL >= (level)) thinpic_log_write((level), __VA_ARGS__); \
+    } while (0)
+
+#define THINPIC_LOGE(...) thinpic_log_write(THINPIC_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define THINPIC_LOGW(...) THINPIC_LOG_AT(THINPIC_LOG_LEVEL_WARN, __VA_ARGS__)
+#define THINPIC_LOGI(...) THINPIC_LOG_AT(THINPIC_LOG_LEVEL_INFO, __VA_ARGS__)
+#define THINPIC_LOGD(...) THINPIC_LOG_AT(THINPIC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif // THINPIC_LOG_H
@@ -0,0 +1,423 @@
+// HEIC through the platform's hardware HEVC encoder on Android 9+, the path
+// HeifWriter takes: MediaCodec encodes the frame and MediaMuxer writes the
+// HEIF container. The bundled libvips has no libheif, so this is the only
+// way FORMAT_HEIF works on most devices. Two encoder kinds are used:
+//  - "image/vnd.android.heic", which takes the whole image and tiles it
+//  - "video/hevc", fed one 512x512 tile per frame and muxed as a HEIF grid
+// libmediandk is looked up at runtime because the muxer's HEIF output and
+// AMediaCodec_getInputFormat are API 28.
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#ifdef __ANDROID__
+#include <android/api-level.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define MIME_HEIC "image/vnd.android.heic"
+#define MIME_HEVC "video/hevc"
+
+#define GRID_TILE 512
+
+// Constants from <media/NdkMediaCodec.h> and MediaCodecInfo
+#define CONFIGURE_FLAG_ENCODE 1
+#define BUFFER_FLAG_CODEC_CONFIG 2
+#define BUFFER_FLAG_END_OF_STREAM 4
+#define INFO_OUTPUT_FORMAT_CHANGED -2
+#define COLOR_FORMAT_YUV420_PLANAR 19
+#define COLOR_FORMAT_YUV420_SEMIPLANAR 21
+#define BITRATE_MODE_CQ 0
+#define BITRATE_MODE_VBR 1
+// MediaMuxer.OutputFormat.MUXER_OUTPUT_HEIF; the NDK passes it straight through
+#define MUXER_OUTPUT_HEIF 3
+
+// Give up on an encoder that stops producing output for this long
+#define DEQUEUE_TIMEOUT_US 10000
+#define STALL_LIMIT 500
+
+// Mirrors AMediaCodecBufferInfo
+typedef struct {
+    int32_t offset;
+    int32_t size;
+    int64_t presentation_time_us;
+    uint32_t flags;
+} CodecBufferInfo;
+
+static struct {
+    void* (*codec_create_encoder)(const char* mime);
+    int (*codec_configure)(void* codec, const void* format, void* surface, void* crypto, uint32_t flags);
+    int (*codec_start)(void* codec);
+    int (*codec_stop)(void* codec);
+    int (*codec_delete)(void* codec);
+    void* (*codec_get_input_format)(void* codec);
+    void* (*codec_get_output_format)(void* codec);
+    ssize_t (*codec_dequeue_input)(void* codec, int64_t timeout_us);
+    uint8_t* (*codec_get_input_buffer)(void* codec, size_t index, size_t* size);
+    int (*codec_queue_input)(void* codec, size_t index, long offset, size_t size, uint64_t time_us, uint32_t flags);
+    ssize_t (*codec_dequeue_output)(void* codec, CodecBufferInfo* info, int64_t timeout_us);
+    uint8_t* (*codec_get_output_buffer)(void* codec, size_t index, size_t* size);
+    int (*codec_release_output)(void* codec, size_t index, bool render);
+    void* (*format_new)(void);
+    int (*format_delete)(void* format);
+    void (*format_set_string)(void* format, const char* name, const char* value);
+    void (*format_set_int32)(void* format, const char* name, int32_t value);
+    bool (*format_get_int32)(void* format, const char* name, int32_t* value);
+    void* (*muxer_new)(int fd, int format);
+    int (*muxer_delete)(void* muxer);
+    ssize_t (*muxer_add_track)(void* muxer, const void* format);
+    int (*muxer_start)(void* muxer);
+    int (*muxer_stop)(void* muxer);
+    int (*muxer_write_sample)(void* muxer, size_t track, const uint8_t* data, const CodecBufferInfo* info);
+} media;
+
+static pthread_once_t media_once = PTHREAD_ONCE_INIT;
+static const char* encoder_mime = NULL;     // NULL = no hardware HEIC path
+
+static int load_mediandk(void) {
+    void* library = dlopen("libmediandk.so", RTLD_NOW | RTLD_LOCAL);
+    if (!library) return 0;
+#define LOAD(field, symbol) \
+    if (!(*(void**)&media.field = dlsym(library, symbol))) return 0
+    LOAD(codec_create_encoder, "AMediaCodec_createEncoderByType");
+    LOAD(codec_configure, "AMediaCodec_configure");
+    LOAD(codec_start, "AMediaCodec_start");
+    LOAD(codec_stop, "AMediaCodec_stop");
+    LOAD(codec_delete, "AMediaCodec_delete");
+    LOAD(codec_get_input_format, "AMediaCodec_getInputFormat");
+    LOAD(codec_get_output_format, "AMediaCodec_getOutputFormat");
+    LOAD(codec_dequeue_input, "AMediaCodec_dequeueInputBuffer");
+    LOAD(codec_get_input_buffer, "AMediaCodec_getInputBuffer");
+    LOAD(codec_queue_input, "AMediaCodec_queueInputBuffer");
+    LOAD(codec_dequeue_output, "AMediaCodec_dequeueOutputBuffer");
+    LOAD(codec_get_output_buffer, "AMediaCodec_getOutputBuffer");
+    LOAD(codec_release_output, "AMediaCodec_releaseOutputBuffer");
+    LOAD(format_new, "AMediaFormat_new");
+    LOAD(format_delete, "AMediaFormat_delete");
+    LOAD(format_set_string, "AMediaFormat_setString");
+    LOAD(format_set_int32, "AMediaFormat_setInt32");
+    LOAD(format_get_int32, "AMediaFormat_getInt32");
+    LOAD(muxer_new, "AMediaMuxer_new");
+    LOAD(muxer_delete, "AMediaMuxer_delete");
+    LOAD(muxer_add_track, "AMediaMuxer_addTrack");
+    LOAD(muxer_start, "AMediaMuxer_start");
+    LOAD(muxer_stop, "AMediaMuxer_stop");
+    LOAD(muxer_write_sample, "AMediaMuxer_writeSampleData");
+#undef LOAD
+    return 1;
+}
+
+static int has_encoder(const char* mime) {
+    void* codec = media.codec_create_encoder(mime);
+    if (!codec) return 0;
+    media.codec_delete(codec);
+    return 1;
+}
+
+static void find_hardware_encoder(void) {
+    if (android_get_device_api_level() < 28 || !load_mediandk()) return;
+    if (has_encoder(MIME_HEIC)) {
+        encoder_mime = MIME_HEIC;
+    } else if (has_encoder(MIME_HEVC)) {
+        encoder_mime = MIME_HEVC;
+    }
+    THINPIC_LOGI("MediaCodec HEIC encoder: %s", encoder_mime ? encoder_mime : "none");
+}
+
+int thinpic_mediacodec_available(ImageFormat format) {
+    if (format != FORMAT_HEIF) return 0;
+    pthread_once(&media_once, find_hardware_encoder);
+    return encoder_mime != NULL;
+}
+
+// Layout of one input frame: the full image for the HEIC encoder, a grid
+// tile for HEVC
+typedef struct {
+    const uint8_t* pixels;      // Whole image, packed 1 or 3 bands
+    int bands;
+    int width;
+    int height;
+    int frame_width;
+    int frame_height;
+    int stride;
+    int slice_height;
+    int planar;                 // I420 rather than NV12
+} FrameLayout;
+
+// BT.601 limited range, the default HEVC decoders assume without a colr box.
+// Frame pixels past the image edge repeat the last row or column.
+static void fill_frame(const FrameLayout* layout, int left, int top, uint8_t* frame) {
+    uint8_t* luma = frame;
+    uint8_t* chroma = frame + (size_t)layout->stride * layout->slice_height;
+    size_t chroma_stride = layout->planar ? (size_t)layout->stride / 2 : (size_t)layout->stride;
+    size_t plane = chroma_stride * (size_t)(layout->slice_height / 2);
+    for (int y = 0; y < layout->frame_height; y += 2) {
+        for (int x = 0; x < layout->frame_width; x += 2) {
+            int r_sum = 0, g_sum = 0, b_sum = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                int fy = y + dy < layout->frame_height ? y + dy : y;
+                int sy = top + fy < layout->height ? top + fy : layout->height - 1;
+                for (int dx = 0; dx < 2; dx++) {
+                    int fx = x + dx < layout->frame_width ? x + dx : x;
+                    int sx = left + fx < layout->width ? left + fx : layout->width - 1;
+                    const uint8_t* p = layout->pixels + ((size_t)sy * layout->width + sx) * layout->bands;
+                    int r = p[0];
+                    int g = layout->bands == 3 ? p[1] : r;
+                    int b = layout->bands == 3 ? p[2] : r;
+                    luma[(size_t)fy * layout->stride + fx] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                    r_sum += r;
+                    g_sum += g;
+                    b_sum += b;
+                }
+            }
+            int r = r_sum / 4, g = g_sum / 4, b = b_sum / 4;
+            uint8_t u = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            uint8_t v = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            size_t row = (size_t)(y / 2) * chroma_stride;
+            if (layout->planar) {
+                chroma[row + x / 2] = u;
+                chroma[plane + row + x / 2] = v;
+            } else {
+                chroma[row + x] = u;
+                chroma[row + x + 1] = v;
+            }
+        }
+    }
+}
+
+static void* encoder_format(const char* mime, int width, int height, int grid_cols, int grid_rows,
+                            int frames, int colour_format, int quality, int constant_quality) {
+    void* format = media.format_new();
+    media.format_set_string(format, "mime", mime);
+    media.format_set_int32(format, "width", width);
+    media.format_set_int32(format, "height", height);
+    if (grid_cols * grid_rows > 1 && strcmp(mime, MIME_HEIC) == 0) {
+        media.format_set_int32(format, "tile-width", GRID_TILE);
+        media.format_set_int32(format, "tile-height", GRID_TILE);
+        media.format_set_int32(format, "grid-cols", grid_cols);
+        media.format_set_int32(format, "grid-rows", grid_rows);
+    }
+    media.format_set_int32(format, "color-format", colour_format);
+    media.format_set_int32(format, "frame-rate", frames);
+    media.format_set_int32(format, "i-frame-interval", 0);
+    if (constant_quality) {
+        media.format_set_int32(format, "bitrate-mode", BITRATE_MODE_CQ);
+        media.format_set_int32(format, "quality", quality);
+    } else {
+        // Encoders without constant quality get a bit budget per pixel instead
+        double bits_per_pixel = 0.1 + 1.4 * quality / 100.0;
+        media.format_set_int32(format, "bitrate-mode", BITRATE_MODE_VBR);
+        media.format_set_int32(format, "bitrate", (int32_t)(bits_per_pixel * width * height * frames));
+    }
+    return format;
+}
+
+// Constant quality first, then a bitrate; NV12 first, then I420
+static void* configure_encoder(const char* mime, int width, int height, int grid_cols, int grid_rows,
+                               int frames, int quality, int* colour_format) {
+    static const int colour_formats[] = {COLOR_FORMAT_YUV420_SEMIPLANAR, COLOR_FORMAT_YUV420_PLANAR};
+    for (int constant_quality = 1; constant_quality >= 0; constant_quality--) {
+        for (size_t i = 0; i < sizeof(colour_formats) / sizeof(colour_formats[0]); i++) {
+            void* codec = media.codec_create_encoder(mime);
+            if (!codec) return NULL;
+            void* format = encoder_format(mime, width, height, grid_cols, grid_rows, frames,
+                                          colour_formats[i], quality, constant_quality);
+            int status = media.codec_configure(codec, format, NULL, NULL, CONFIGURE_FLAG_ENCODE);
+            media.format_delete(format);
+            if (status == 0 && media.codec_start(codec) == 0) {
+                *colour_format = colour_formats[i];
+                return codec;
+            }
+            media.codec_delete(codec);
+        }
+    }
+    return NULL;
+}
+
+// Copies the muxer's output out of the memory file into a g_malloc buffer
+static int read_back(int fd, void** buffer, size_t* length) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size <= 0 || lseek(fd, 0, SEEK_SET) != 0) return -1;
+    uint8_t* data = g_malloc((gsize)size);
+    size_t done = 0;
+    while (done < (size_t)size) {
+        ssize_t got = read(fd, data + done, (size_t)size - done);
+        if (got <= 0) {
+            g_free(data);
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    *buffer = data;
+    *length = done;
+    return 0;
+}
+
+// Feeds every frame, then drains the encoder into the muxer until end of stream
+static int run_encoder(void* codec, void* muxer, const FrameLayout* base, int grid_cols, int grid_rows,
+                       int whole_image, int width, int height) {
+    FrameLayout layout = *base;
+    int frames = whole_image ? 1 : grid_cols * grid_rows;
+    int queued = 0, stalls = 0, track = -1;
+    for (;;) {
+        int progressed = 0;
+        if (queued < frames) {
+            ssize_t index = media.codec_dequeue_input(codec, DEQUEUE_TIMEOUT_US);
+            if (index >= 0) {
+                size_t capacity = 0;
+                uint8_t* frame = media.codec_get_input_buffer(codec, (size_t)index, &capacity);
+                size_t needed = (size_t)layout.stride * layout.slice_height * 3 / 2;
+                if (!frame || capacity < needed) return -1;
+                int left = whole_image ? 0 : (queued % grid_cols) * GRID_TILE;
+                int top = whole_image ? 0 : (queued / grid_cols) * GRID_TILE;
+                fill_frame(&layout, left, top, frame);
+                uint32_t flags = queued == frames - 1 ? BUFFER_FLAG_END_OF_STREAM : 0;
+                media.codec_queue_input(codec, (size_t)index, 0, needed, (uint64_t)queued * 1000000 / frames, flags);
+                queued++;
+                progressed = 1;
+            }
+        }
+
+        CodecBufferInfo info;
+        ssize_t index = media.codec_dequeue_output(codec, &info, queued < frames ? 0 : DEQUEUE_TIMEOUT_US);
+        if (index == INFO_OUTPUT_FORMAT_CHANGED) {
+            void* format = media.codec_get_output_format(codec);
+            if (!format) return -1;
+            // A plain HEVC stream becomes a HEIF grid image in the muxer
+            media.format_set_string(format, "mime", MIME_HEIC);
+            media.format_set_int32(format, "width", width);
+            media.format_set_int32(format, "height", height);
+            if (!whole_image) {
+                media.format_set_int32(format, "tile-width", GRID_TILE);
+                media.format_set_int32(format, "tile-height", GRID_TILE);
+                media.format_set_int32(format, "grid-cols", grid_cols);
+                media.format_set_int32(format, "grid-rows", grid_rows);
+            }
+            track = (int)media.muxer_add_track(muxer, format);
+            media.format_delete(format);
+            if (track < 0 || media.muxer_start(muxer) != 0) return -1;
+            progressed = 1;
+        } else if (index >= 0) {
+            size_t capacity = 0;
+            uint8_t* data = media.codec_get_output_buffer(codec, (size_t)index, &capacity);
+            // Parameter sets already travel in the track format
+            if (data && info.size > 0 && !(info.flags & BUFFER_FLAG_CODEC_CONFIG)) {
+                if (track < 0 || media.muxer_write_sample(muxer, (size_t)track, data, &info) != 0) {
+                    media.codec_release_output(codec, (size_t)index, false);
+                    return -1;
+                }
+            }
+            media.codec_release_output(codec, (size_t)index, false);
+            if (info.flags & BUFFER_FLAG_END_OF_STREAM) return track >= 0 ? 0 : -1;
+            progressed = 1;
+        }
+
+        stalls = progressed ? 0 : stalls + 1;
+        if (stalls > STALL_LIMIT) {
+            THINPIC_LOGW("MediaCodec HEIC encoder stalled");
+            return -1;
+        }
+    }
+}
+
+static int encode_pixels(const FrameLayout* base, int quality, void** buffer, size_t* length) {
+    int whole_image = strcmp(encoder_mime, MIME_HEIC) == 0;
+    int grid_cols = (base->width + GRID_TILE - 1) / GRID_TILE;
+    int grid_rows = (base->height + GRID_TILE - 1) / GRID_TILE;
+    int frame_width = whole_image ? base->width : GRID_TILE;
+    int frame_height = whole_image ? base->height : GRID_TILE;
+    int frames = whole_image ? 1 : grid_cols * grid_rows;
+
+    int colour_format = 0;
+    void* codec = configure_encoder(encoder_mime, frame_width, frame_height, grid_cols, grid_rows,
+                                    frames, quality, &colour_format);
+    if (!codec) return -1;
+
+    FrameLayout layout = *base;
+    layout.frame_width = frame_width;
+    layout.frame_height = frame_height;
+    layout.stride = frame_width;
+    layout.slice_height = frame_height;
+    layout.planar = colour_format == COLOR_FORMAT_YUV420_PLANAR;
+    void* input_format = media.codec_get_input_format(codec);
+    if (input_format) {
+        int32_t value = 0;
+        if (media.format_get_int32(input_format, "stride", &value) && value >= frame_width) layout.stride = value;
+        if (media.format_get_int32(input_format, "slice-height", &value) && value >= frame_height) {
+            layout.slice_height = value;
+        }
+        media.format_delete(input_format);
+    }
+    // Chroma planes start on whole rows of the subsampled size
+    layout.stride += layout.stride & 1;
+    layout.slice_height += layout.slice_height & 1;
+
+    int status = -1;
+    int fd = (int)syscall(__NR_memfd_create, "thinpic-heic", 0);
+    void* muxer = fd >= 0 ? media.muxer_new(fd, MUXER_OUTPUT_HEIF) : NULL;
+    if (muxer) {
+        status = run_encoder(codec, muxer, &layout, grid_cols, grid_rows, whole_image, base->width, base->height);
+        if (media.muxer_stop(muxer) != 0) status = -1;
+        media.muxer_delete(muxer);
+        if (status == 0) status = read_back(fd, buffer, length);
+    }
+    if (fd >= 0) close(fd);
+    media.codec_stop(codec);
+    media.codec_delete(codec);
+    return status;
+}
+
+int thinpic_mediacodec_save(VipsImage* image, ImageFormat format, int quality, void** buffer, size_t* length) {
+    if (!thinpic_mediacodec_available(format)) return 1;
+    if (vips_image_get_format(image) != VIPS_FORMAT_UCHAR) return 1;
+    int bands = vips_image_get_bands(image);
+    VipsImage* flat = NULL;
+    if (bands == 2 || bands == 4) {
+        // The hardware path has no alpha plane; keep libheif's alpha when
+        // there is a libheif, else flatten onto the JPEG path's background
+        if (vips_type_find("VipsOperation", "heifsave_buffer")) return 1;
+        if (thinpic_flatten_alpha(image, &flat) != 1) return 1;
+        image = flat;
+        bands--;
+    }
+    if (bands != 1 && bands != 3) {
+        if (flat) g_object_unref(flat);
+        return 1;
+    }
+
+    int traced = thinpic_trace_begin("thinpic mediacodec heic Q%d", quality);
+    thinpic_stage_encode();
+    size_t size = 0;
+    FrameLayout layout = {0};
+    layout.pixels = vips_image_write_to_memory(image, &size);
+    layout.bands = bands;
+    layout.width = vips_image_get_width(image);
+    layout.height = vips_image_get_height(image);
+    int status = layout.pixels ? encode_pixels(&layout, quality < 1 ? 1 : quality > 100 ? 100 : quality,
+                                               buffer, length) : -1;
+    g_free((void*)layout.pixels);
+    if (flat) g_object_unref(flat);
+    thinpic_trace_end(traced);
+    if (status != 0) THINPIC_LOGW("MediaCodec HEIC encode failed; using libvips");
+    return status == 0 ? 0 : 1;
+}
+#else
+int thinpic_mediacodec_available(ImageFormat format) {
+    (void)format;
+    return 0;
+}
+
+int thinpic_mediacodec_save(VipsImage* image, ImageFormat format, int quality, void** buffer, size_t* length) {
+    (void)image;
+    (void)format;
+    (void)quality;
+    (void)buffer;
+    (void)length;
+    return 1;
+}
+#endif
@@ -0,0 +1,77 @@
+// Memory-pressure response (thinpic_on_memory_pressure). The caches here are
+// sized for throughput: idle libvips operations, decoded images kept for the
+// next variant, encode arenas and the GL context hold tens of megabytes
+// between compressions, which is what the low-memory killer weighs when it
+// picks a process. On Android, ThinpicTexturePlugin forwards onTrimMemory and
+// onLowMemory; other platforms call in from Dart. Moderate pressure frees
+// whatever is idle; critical pressure also keeps the pool from starting
+// background jobs for a while, so a batch stops adding decoded images to the
+// heap until the system has recovered. Jobs already running finish.
+
+#include <pthread.h>
+#if defined(__ANDROID__) || defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Background jobs stay queued this long after the last critical signal;
+// Android never reports that pressure is over
+#define BACKGROUND_HOLD_MS 10000
+
+// Return freed pages to the system; the allocators keep them mapped for reuse
+static void trim_heap(void) {
+#if defined(__ANDROID__) && defined(M_PURGE)
+    mallopt(M_PURGE, 0);
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#elif defined(__APPLE__)
+    malloc_zone_pressure_relief(NULL, 0);
+#endif
+}
+
+void thinpic_on_memory_pressure(ThinpicMemoryPressure level) {
+    if (level <= THINPIC_MEMORY_PRESSURE_NORMAL) {
+        thinpic_pool_hold_background(0);
+        THINPIC_LOGI("Memory pressure over, background jobs resume");
+        return;
+    }
+    // Whatever is in use by a running pipeline holds its own reference and
+    // is freed when that pipeline ends
+    thinpic_drop_operation_cache();
+    thinpic_decode_cache_drain();
+    thinpic_overlay_cache_drain();
+    thinpic_arena_drain();
+    if (level >= THINPIC_MEMORY_PRESSURE_CRITICAL) {
+        thinpic_gpu_drain();
+        thinpic_pool_hold_background(BACKGROUND_HOLD_MS);
+    }
+    trim_heap();
+    THINPIC_LOGI("Memory pressure %s: caches dropped%s",
+                 level >= THINPIC_MEMORY_PRESSURE_CRITICAL ? "critical" : "moderate",
+                 level >= THINPIC_MEMORY_PRESSURE_CRITICAL ? ", background jobs held" : "");
+}
+
+#ifdef __ANDROID__
+#include <jni.h>
+
+// ComponentCallbacks2 levels (android.content.ComponentCallbacks2)
+#define TRIM_MEMORY_RUNNING_CRITICAL 15
+#define TRIM_MEMORY_COMPLETE 80
+
+// ThinpicTexturePlugin.nativeMemoryPressure(int): takes the onTrimMemory
+// level, or TRIM_MEMORY_COMPLETE for onLowMemory
+JNIEXPORT void JNICALL
+Java_com_example_thinpic_1flutter_ThinpicTexturePlugin_nativeMemoryPressure(JNIEnv* env, jclass clazz,
+                                                                            jint trim_level) {
+    (void)env;
+    (void)clazz;
+    // RUNNING_CRITICAL is the last warning before foreground processes are
+    // killed; COMPLETE means this process is next
+    int critical = trim_level == TRIM_MEMORY_RUNNING_CRITICAL || trim_level >= TRIM_MEMORY_COMPLETE;
+    thinpic_on_memory_pressure(critical ? THINPIC_MEMORY_PRESSURE_CRITICAL : THINPIC_MEMORY_PRESSURE_MODERATE);
+}
+#endif
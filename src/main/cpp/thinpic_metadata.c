@@ -0,0 +1,377 @@
+// Metadata rewrites without a re-encode (thinpic_rewrite_metadata). Taking
+// location out of a photo before it is shared used to mean a full decode and
+// encode, a second lossy generation and hundreds of milliseconds for what is
+// a few bytes of EXIF. Here the container is walked and only its metadata is
+// touched; every byte of pixel data is copied as it was:
+//  - JPEG: APP1 segments before SOS; EXIF is edited in place, XMP dropped
+//  - PNG: eXIf is edited in place and its CRC redone; XMP iTXt and the
+//    hex-encoded "Raw profile type" text chunks are dropped
+//  - WebP: the EXIF chunk is edited in place; XMP is dropped, with its VP8X
+//    flag and the RIFF size brought along
+// EXIF edits keep the length of the TIFF block, so no offset inside it moves:
+// the GPS entry leaves IFD0 and its IFD and values are zeroed where they lie.
+
+#include <string.h>
+#include <glib.h>
+#include <libdeflate.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define TAG_ORIENTATION 0x0112
+#define TAG_GPS_IFD 0x8825
+#define IFD_ENTRIES_MAX 512         // More than any real IFD; past this the block is malformed
+
+#define VP8X_FLAG_XMP 0x04
+
+static const char xmp_namespace[] = "http://ns.adobe.com/xap/1.0/";
+static const char xmp_extension_namespace[] = "http://ns.adobe.com/xmp/extension/";
+
+static unsigned int read_u16(const uint8_t* p, int big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t read_u32(const uint8_t* p, int big_endian) {
+    return big_endian
+        ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+        : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static void write_u16(uint8_t* p, unsigned int value, int big_endian) {
+    p[big_endian ? 0 : 1] = (uint8_t)(value >> 8);
+    p[big_endian ? 1 : 0] = (uint8_t)value;
+}
+
+static void write_u32_be(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static void write_u32_le(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static int contains(const uint8_t* data, size_t length, const char* needle) {
+    size_t needle_length = strlen(needle);
+    for (size_t i = 0; i + needle_length <= length; i++) {
+        if (data[i] == (uint8_t)needle[0] && memcmp(data + i, needle, needle_length) == 0) return 1;
+    }
+    return 0;
+}
+
+// An XMP packet goes with STRIP_XMP, and with STRIP_GPS when it carries a
+// location (exif:GPSLatitude and friends); editing one is beyond this file
+static int drop_xmp(const uint8_t* packet, size_t length, int edits) {
+    if (edits & THINPIC_METADATA_STRIP_XMP) return 1;
+    return (edits & THINPIC_METADATA_STRIP_GPS) && contains(packet, length, "GPS");
+}
+
+// Bytes taken by `count` values of a TIFF field type; 0 for unknown types
+static size_t field_size(unsigned int type, uint32_t count) {
+    static const uint8_t sizes[13] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+    if (type >= sizeof(sizes)) return 0;
+    return (size_t)sizes[type] * count;
+}
+
+// Edits the TIFF block of an EXIF payload in place; its length never
+// changes. Returns the number of edits made, -1 when the block is malformed.
+static int edit_exif(uint8_t* tiff, size_t length, int edits) {
+    if (length < 8) return -1;
+    int big_endian;
+    if (tiff[0] == 'M' && tiff[1] == 'M') {
+        big_endian = 1;
+    } else if (tiff[0] == 'I' && tiff[1] == 'I') {
+        big_endian = 0;
+    } else {
+        return -1;
+    }
+    uint32_t ifd0 = read_u32(tiff + 4, big_endian);
+    if (ifd0 < 8 || ifd0 > length - 2) return -1;
+    unsigned int count = read_u16(tiff + ifd0, big_endian);
+    if (count > IFD_ENTRIES_MAX || ifd0 + 2 + (size_t)count * 12 + 4 > length) return -1;
+
+    int made = 0;
+    for (unsigned int i = 0; i < count;) {
+        uint8_t* entry = tiff + ifd0 + 2 + (size_t)i * 12;
+        unsigned int tag = read_u16(entry, big_endian);
+
+        if (tag == TAG_ORIENTATION && (edits & THINPIC_METADATA_NORMALIZE_ORIENTATION) &&
+                read_u16(entry + 2, big_endian) == 3) {
+            unsigned int orientation = read_u16(entry + 8, big_endian);
+            if (orientation < 1 || orientation > 8) {
+                write_u16(entry + 8, 1, big_endian);
+                made++;
+            }
+        }
+
+        if (tag == TAG_GPS_IFD && (edits & THINPIC_METADATA_STRIP_GPS)) {
+            // Zero the GPS IFD and the values it points at, where they lie
+            uint32_t gps = read_u32(entry + 8, big_endian);
+            if (gps >= 8 && gps <= length - 2) {
+                unsigned int gps_count = read_u16(tiff + gps, big_endian);
+                size_t gps_end = gps + 2 + (size_t)gps_count * 12 + 4;
+                if (gps_count <= IFD_ENTRIES_MAX && gps_end <= length) {
+                    for (unsigned int j = 0; j < gps_count; j++) {
+                        const uint8_t* field = tiff + gps + 2 + (size_t)j * 12;
+                        size_t size = field_size(read_u16(field + 2, big_endian), read_u32(field + 4, big_endian));
+                        uint32_t offset = read_u32(field + 8, big_endian);
+                        if (size > 4 && offset >= 8 && offset <= length && size <= length - offset) {
+                            memset(tiff + offset, 0, size);
+                        }
+                    }
+                    memset(tiff + gps, 0, gps_end - gps);
+                }
+            }
+            // Then close IFD0 over the entry: the later entries and the
+            // next-IFD offset move up and the freed tail is zeroed
+            size_t tail = (size_t)(count - i - 1) * 12 + 4;
+            memmove(entry, entry + 12, tail);
+            memset(entry + tail, 0, 12);
+            count--;
+            write_u16(tiff + ifd0, count, big_endian);
+            made++;
+            continue;
+        }
+        i++;
+    }
+    return made;
+}
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    int exif_edits;
+    int dropped;                    // XMP packets and text profiles
+} Rewrite;
+
+static void append(Rewrite* out, const uint8_t* data, size_t length) {
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+// Applies an edit_exif result to the rewrite; 0 when the block was malformed
+static int count_exif(Rewrite* out, int made) {
+    if (made < 0) {
+        THINPIC_LOGE("Error: Malformed EXIF block; metadata left as it was");
+        return 0;
+    }
+    out->exif_edits += made;
+    return 1;
+}
+
+static int rewrite_jpeg(const uint8_t* data, size_t length, int edits, Rewrite* out) {
+    size_t offset = 2;
+    append(out, data, 2);
+    int xmp_dropped = 0;
+    while (offset + 4 <= length) {
+        if (data[offset] != 0xFF) return 0;
+        unsigned int marker = data[offset + 1];
+        if (marker == 0xFF) {       // Fill byte
+            offset++;
+            continue;
+        }
+        // Everything from the scan on is copied as it is
+        if (marker == 0xDA || marker == 0xD9) break;
+        size_t segment = 2 + read_u16(data + offset + 2, 1);
+        if (segment < 4 || segment > length - offset) return 0;
+        const uint8_t* payload = data + offset + 4;
+        size_t payload_length = segment - 4;
+
+        if (marker == 0xE1 && payload_length >= sizeof(xmp_namespace) &&
+                memcmp(payload, xmp_namespace, sizeof(xmp_namespace)) == 0) {
+            if (drop_xmp(payload, payload_length, edits)) {
+                xmp_dropped = 1;
+                out->dropped++;
+                offset += segment;
+                continue;
+            }
+        } else if (marker == 0xE1 && payload_length >= sizeof(xmp_extension_namespace) &&
+                memcmp(payload, xmp_extension_namespace, sizeof(xmp_extension_namespace)) == 0) {
+            // Extended XMP is the rest of the main packet; it goes with it
+            if (xmp_dropped || drop_xmp(payload, payload_length, edits)) {
+                out->dropped++;
+                offset += segment;
+                continue;
+            }
+        }
+
+        size_t start = out->length;
+        append(out, data + offset, segment);
+        if (marker == 0xE1 && payload_length > 6 && memcmp(payload, "Exif\0\0", 6) == 0) {
+            if (!count_exif(out, edit_exif(out->data + start + 10, payload_length - 6, edits))) return 0;
+        }
+        offset += segment;
+    }
+    if (offset > length) return 0;
+    append(out, data + offset, length - offset);
+    return 1;
+}
+
+static void png_crc(uint8_t* chunk, size_t data_length) {
+    uint32_t crc = libdeflate_crc32(0, chunk + 4, 4 + data_length);
+    write_u32_be(chunk + 8 + data_length, crc);
+}
+
+// The keyword of a tEXt, zTXt or iTXt chunk, NUL-terminated within it
+static int png_keyword_is(const uint8_t* chunk_data, size_t length, const char* keyword) {
+    size_t keyword_length = strlen(keyword) + 1;
+    return length >= keyword_length && memcmp(chunk_data, keyword, keyword_length) == 0;
+}
+
+static int rewrite_png(const uint8_t* data, size_t length, int edits, Rewrite* out) {
+    size_t offset = 8;
+    append(out, data, 8);
+    while (offset + 12 <= length) {
+        uint32_t data_length = read_u32(data + offset, 1);
+        if (data_length > length - offset - 12) return 0;
+        const uint8_t* type = data + offset + 4;
+        const uint8_t* chunk_data = data + offset + 8;
+        size_t chunk = 12 + (size_t)data_length;
+        int text = memcmp(type, "tEXt", 4) == 0 || memcmp(type, "zTXt", 4) == 0 || memcmp(type, "iTXt", 4) == 0;
+
+        int drop = 0;
+        if (memcmp(type, "iTXt", 4) == 0 && png_keyword_is(chunk_data, data_length, "XML:com.adobe.xmp")) {
+            drop = drop_xmp(chunk_data, data_length, edits);
+        } else if (text && png_keyword_is(chunk_data, data_length, "Raw profile type xmp")) {
+            // Hex-encoded and often compressed, so never searched: the
+            // profile goes whole when it could carry what is asked away
+            drop = (edits & (THINPIC_METADATA_STRIP_XMP | THINPIC_METADATA_STRIP_GPS)) != 0;
+        } else if (text && (png_keyword_is(chunk_data, data_length, "Raw profile type exif") ||
+                            png_keyword_is(chunk_data, data_length, "Raw profile type APP1"))) {
+            drop = (edits & THINPIC_METADATA_STRIP_GPS) != 0;
+        }
+        if (drop) {
+            out->dropped++;
+            offset += chunk;
+            continue;
+        }
+
+        size_t start = out->length;
+        append(out, data + offset, chunk);
+        if (memcmp(type, "eXIf", 4) == 0) {
+            int made = edit_exif(out->data + start + 8, data_length, edits);
+            if (!count_exif(out, made)) return 0;
+            if (made > 0) png_crc(out->data + start, data_length);
+        }
+        offset += chunk;
+        if (memcmp(type, "IEND", 4) == 0) break;
+    }
+    append(out, data + offset, length - offset);
+    return 1;
+}
+
+static int rewrite_webp(const uint8_t* data, size_t length, int edits, Rewrite* out) {
+    size_t offset = 12;
+    append(out, data, 12);
+    size_t vp8x = 0;                // Offset of the VP8X flags in the output
+    int xmp_dropped = 0;
+    while (offset + 8 <= length) {
+        const uint8_t* fourcc = data + offset;
+        uint32_t data_length = read_u32(data + offset + 4, 0);
+        size_t chunk = 8 + (size_t)data_length + (data_length & 1);
+        if (chunk > length - offset) {
+            // A final chunk without its pad byte is taken as it is
+            if (8 + (size_t)data_length > length - offset) return 0;
+            chunk = length - offset;
+        }
+
+        if (memcmp(fourcc, "XMP ", 4) == 0 && drop_xmp(data + offset + 8, data_length, edits)) {
+            xmp_dropped = 1;
+            out->dropped++;
+            offset += chunk;
+            continue;
+        }
+
+        size_t start = out->length;
+        append(out, data + offset, chunk);
+        if (memcmp(fourcc, "VP8X", 4) == 0 && data_length >= 10) vp8x = start + 8;
+        if (memcmp(fourcc, "EXIF", 4) == 0) {
+            // Some writers keep the JPEG APP1 header in the chunk
+            size_t skip = data_length > 6 && memcmp(data + offset + 8, "Exif\0\0", 6) == 0 ? 6 : 0;
+            if (!count_exif(out, edit_exif(out->data + start + 8 + skip, data_length - skip, edits))) return 0;
+        }
+        offset += chunk;
+    }
+    if (offset != length) append(out, data + offset, length - offset);
+
+    if (xmp_dropped && vp8x) out->data[vp8x] &= (uint8_t)~VP8X_FLAG_XMP;
+    write_u32_le(out->data + 4, (uint32_t)(out->length - 8));
+    return 1;
+}
+
+// The rewritten file in a new g_malloc'd buffer, never longer than the
+// input; NULL with the error code set when it is not one of the three
+// containers or is malformed
+static uint8_t* rewrite_metadata(const uint8_t* data, size_t length, int edits, size_t* out_length) {
+    if (edits & ~(THINPIC_METADATA_STRIP_GPS | THINPIC_METADATA_STRIP_XMP |
+                  THINPIC_METADATA_NORMALIZE_ORIENTATION)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Unknown metadata edits 0x%x", edits);
+        return NULL;
+    }
+
+    ImageFormat format = thinpic_sniff_format(data, length);
+    Rewrite out = {g_malloc(length > 0 ? length : 1), 0, 0, 0};
+    int done = 0;
+    switch (format) {
+        case FORMAT_JPEG: done = rewrite_jpeg(data, length, edits, &out); break;
+        case FORMAT_PNG: done = rewrite_png(data, length, edits, &out); break;
+        case FORMAT_WEBP: done = rewrite_webp(data, length, edits, &out); break;
+        default:
+            g_free(out.data);
+            thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+            THINPIC_LOGE("Error: Metadata rewrites take JPEG, PNG and WebP only");
+            return NULL;
+    }
+    if (!done) {
+        g_free(out.data);
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        THINPIC_LOGE("Error: Malformed %s container; metadata left as it was",
+                     format == FORMAT_JPEG ? "JPEG" : format == FORMAT_PNG ? "PNG" : "WebP");
+        return NULL;
+    }
+    THINPIC_LOGD("Metadata rewrite: %zu -> %zu bytes, %d EXIF edits, %d packets dropped", length,
+                 out.length, out.exif_edits, out.dropped);
+    *out_length = out.length;
+    return out.data;
+}
+
+CompressedImageResult thinpic_rewrite_metadata_buffer(const uint8_t* data, size_t length, int edits) {
+    CompressedImageResult result = {NULL, 0, 0};
+    if (!data || length == 0) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: No input for the metadata rewrite");
+        return result;
+    }
+    result.data = rewrite_metadata(data, length, edits, &result.length);
+    result.success = result.data != NULL;
+    return result;
+}
+
+int64_t thinpic_rewrite_metadata(const char* input_path, const char* output_path, int edits) {
+    if (!input_path || !output_path) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Metadata rewrite needs an input and an output path");
+        return -1;
+    }
+    gchar* contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(input_path, &contents, &length, NULL)) {
+        thinpic_error_code(THINPIC_ERROR_IO);
+        THINPIC_LOGE("Error: Cannot read %s", input_path);
+        return -1;
+    }
+    size_t out_length = 0;
+    uint8_t* out = rewrite_metadata((const uint8_t*)contents, length, edits, &out_length);
+    g_free(contents);
+    if (!out) return -1;
+    // Atomic, so the output may be the input itself
+    int failed = thinpic_write_output(out, out_length, output_path);
+    g_free(out);
+    return failed ? -1 : (int64_t)out_length;
+}
@@ -0,0 +1,263 @@
+// Motion photos: a JPEG still with a short MP4 appended after its EOI, as
+// Google Motion Photos (and the older MicroVideo files) and Samsung's
+// motion JPEGs write them. libvips reads the still and stops at the EOI, but
+// anything that treats the file as a whole (the output cache hashing it,
+// the estimate's bits per pixel) paid for megabytes of video that never
+// reach the output. Here the video is found from the file's own index
+// rather than by scanning: the XMP in the first APP1 segments gives its
+// length from the end (GCamera:MicroVideoOffset, or the Container directory
+// item with Semantic MotionPhoto), and a Samsung SEF trailer at the very end
+// lists its blocks. Every offset those formats use counts from the end of
+// the file, so THINPIC_MOTION_VIDEO_KEEP carries the video over by copying
+// the trailer unchanged after the new still; nothing is decoded.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define XMP_NAMESPACE "http://ns.adobe.com/xap/1.0/"
+#define MARKER_LIMIT 64             // APPn segments walked before giving up on the XMP
+#define SEF_DIRECTORY_MAX 4096      // Larger SEF directories are not Samsung's
+#define SEF_MOTION_NAME "MotionPhoto_Data"
+
+// A ThinpicInput read at offsets, without moving a caller's descriptor
+typedef struct {
+    const uint8_t* data;
+    int fd;
+    int owned;
+    int64_t size;
+} MotionReader;
+
+static int reader_open(const ThinpicInput* input, MotionReader* reader) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+    if (input->image) return -1;
+    if (input->data) {
+        reader->data = (const uint8_t*)input->data;
+        reader->size = (int64_t)input->length;
+        return 0;
+    }
+    reader->fd = input->path ? open(input->path, O_RDONLY | O_CLOEXEC) : input->fd;
+    reader->owned = input->path != NULL;
+    struct stat file_stat;
+    // Pipes cannot be read at the end
+    if (reader->fd < 0 || fstat(reader->fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        if (reader->owned && reader->fd >= 0) close(reader->fd);
+        reader->fd = -1;
+        return -1;
+    }
+    reader->size = (int64_t)file_stat.st_size;
+    return 0;
+}
+
+static void reader_close(MotionReader* reader) {
+    if (reader->owned && reader->fd >= 0) close(reader->fd);
+    reader->fd = -1;
+}
+
+// Reads exactly length bytes at offset; 0 or -1
+static int reader_read(const MotionReader* reader, int64_t offset, void* buffer, size_t length) {
+    if (offset < 0 || offset + (int64_t)length > reader->size) return -1;
+    if (reader->data) {
+        memcpy(buffer, reader->data + offset, length);
+        return 0;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t count = pread(reader->fd, (uint8_t*)buffer + done, length - done, (off_t)(offset + done));
+        if (count <= 0) return -1;
+        done += (size_t)count;
+    }
+    return 0;
+}
+
+static uint32_t read_le32(const uint8_t* p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// The XMP packet of the JPEG's APP1 segments, NUL-terminated, or NULL
+static char* read_xmp(const MotionReader* reader) {
+    int64_t offset = 2;
+    for (int n = 0; n < MARKER_LIMIT; n++) {
+        uint8_t marker[4];
+        if (reader_read(reader, offset, marker, sizeof(marker)) || marker[0] != 0xFF) return NULL;
+        // Metadata sits before the first scan
+        if (marker[1] == 0xDA || marker[1] == 0xD9) return NULL;
+        int length = marker[2] << 8 | marker[3];
+        if (length < 2) return NULL;
+        size_t namespace_length = sizeof(XMP_NAMESPACE);
+        if (marker[1] == 0xE1 && (size_t)length - 2 > namespace_length) {
+            char* segment = (char*)g_malloc((size_t)length - 1);
+            if (reader_read(reader, offset + 4, segment, (size_t)length - 2) == 0 &&
+                    memcmp(segment, XMP_NAMESPACE, namespace_length) == 0) {
+                segment[length - 2] = '\0';
+                // The packet alone, after the namespace and its NUL
+                memmove(segment, segment + namespace_length, (size_t)length - 1 - namespace_length);
+                return segment;
+            }
+            g_free(segment);
+        }
+        offset += 2 + length;
+    }
+    return NULL;
+}
+
+// The number after `name` as an attribute (name="123") or element
+// (<name>123</name>), or -1
+static int64_t xmp_number(const char* xmp, const char* from, const char* name) {
+    const char* at = strstr(from ? from : xmp, name);
+    if (!at) return -1;
+    at += strlen(name);
+    while (*at == '=' || *at == '"' || *at == '\'' || *at == '>' || *at == ' ') at++;
+    if (*at < '0' || *at > '9') return -1;
+    return (int64_t)strtoll(at, NULL, 10);
+}
+
+// Video length from the end of the file, as the XMP records it, or -1
+static int64_t xmp_video_length(const char* xmp) {
+    int64_t length = xmp_number(xmp, NULL, "MicroVideoOffset");
+    if (length > 0) return length;
+    // Motion Photo 1.0: the Container item whose Semantic is MotionPhoto,
+    // with its Length among the same element's attributes
+    const char* semantic = strstr(xmp, "Item:Semantic=\"MotionPhoto\"");
+    if (!semantic) return -1;
+    const char* start = semantic;
+    while (start > xmp && *start != '<') start--;
+    const char* end = strchr(semantic, '>');
+    const char* attribute = end ? g_strstr_len(start, end - start, "Item:Length") : NULL;
+    return attribute ? xmp_number(xmp, attribute, "Item:Length") : -1;
+}
+
+// A Google-style motion photo: 1 with motion filled in, or 0
+static int find_google(const MotionReader* reader, ThinpicMotionPhoto* motion) {
+    char* xmp = read_xmp(reader);
+    if (!xmp) return 0;
+    int64_t length = xmp_video_length(xmp);
+    g_free(xmp);
+    if (length <= 8 || length >= reader->size) return 0;
+    int64_t offset = reader->size - length;
+    // An MP4 starts with its ftyp box
+    uint8_t box[8];
+    if (reader_read(reader, offset, box, sizeof(box)) || memcmp(box + 4, "ftyp", 4) != 0) return 0;
+    motion->kind = THINPIC_MOTION_GOOGLE;
+    motion->still_length = offset;
+    motion->trailer_length = length;
+    motion->video_offset = offset;
+    motion->video_length = length;
+    return 1;
+}
+
+// A Samsung SEF trailer with a MotionPhoto_Data block: 1 with motion
+// filled in, or 0
+static int find_samsung(const MotionReader* reader, ThinpicMotionPhoto* motion) {
+    uint8_t tail[8];
+    if (reader->size < 32 || reader_read(reader, reader->size - 8, tail, sizeof(tail)) ||
+            memcmp(tail + 4, "SEFT", 4) != 0) {
+        return 0;
+    }
+    uint32_t directory_size = read_le32(tail);
+    int64_t header = reader->size - 8 - directory_size;
+    if (directory_size < 12 || directory_size > SEF_DIRECTORY_MAX || header <= 0) return 0;
+    uint8_t* directory = (uint8_t*)g_malloc(directory_size);
+    int found = 0;
+    if (reader_read(reader, header, directory, directory_size) == 0 && memcmp(directory, "SEFH", 4) == 0) {
+        uint32_t count = read_le32(directory + 8);
+        int64_t trailer = header;
+        for (uint32_t i = 0; i < count && 12 + (i + 1) * 12 <= directory_size; i++) {
+            const uint8_t* entry = directory + 12 + i * 12;
+            int64_t start = header - (int64_t)read_le32(entry + 4);
+            int64_t length = (int64_t)read_le32(entry + 8);
+            if (start <= 0 || start + length > header) continue;
+            if (start < trailer) trailer = start;
+            // Each block opens with its type and name
+            uint8_t record[8 + sizeof(SEF_MOTION_NAME) - 1];
+            if (length <= (int64_t)sizeof(record) || reader_read(reader, start, record, sizeof(record))) continue;
+            if (read_le32(record + 4) == sizeof(SEF_MOTION_NAME) - 1 &&
+                    memcmp(record + 8, SEF_MOTION_NAME, sizeof(SEF_MOTION_NAME) - 1) == 0) {
+                motion->video_offset = start + (int64_t)sizeof(record);
+                motion->video_length = length - (int64_t)sizeof(record);
+                found = 1;
+            }
+        }
+        if (found) {
+            motion->kind = THINPIC_MOTION_SAMSUNG;
+            motion->still_length = trailer;
+            motion->trailer_length = reader->size - trailer;
+        }
+    }
+    g_free(directory);
+    return found;
+}
+
+int thinpic_motion_find(const ThinpicInput* input, ThinpicMotionPhoto* motion) {
+    memset(motion, 0, sizeof(*motion));
+    MotionReader reader;
+    if (reader_open(input, &reader)) return 0;
+    uint8_t soi[2];
+    int found = 0;
+    if (reader_read(&reader, 0, soi, sizeof(soi)) == 0 && soi[0] == 0xFF && soi[1] == 0xD8) {
+        // Newer Samsung files carry both; the SEF trailer spans the video
+        found = find_samsung(&reader, motion);
+        ThinpicMotionPhoto google;
+        memset(&google, 0, sizeof(google));
+        if (find_google(&reader, &google) && (!found || google.still_length < motion->still_length)) {
+            if (found) {
+                motion->still_length = google.still_length;
+                motion->trailer_length = reader.size - google.still_length;
+            } else {
+                *motion = google;
+            }
+            found = 1;
+        }
+    }
+    reader_close(&reader);
+    if (found) {
+        THINPIC_LOGD("Motion photo (%s): %lld byte still, %lld byte video",
+                     motion->kind == THINPIC_MOTION_SAMSUNG ? "Samsung" : "Google",
+                     (long long)motion->still_length, (long long)motion->video_length);
+    }
+    return found;
+}
+
+int thinpic_motion_append(const ThinpicInput* input, const ThinpicMotionPhoto* motion, uint8_t** data,
+                          size_t* length) {
+    if (motion->trailer_length <= 0) return 0;
+    MotionReader reader;
+    if (reader_open(input, &reader)) return -1;
+    uint8_t* grown = (uint8_t*)g_try_realloc(*data, *length + (size_t)motion->trailer_length);
+    int status = -1;
+    if (grown) {
+        *data = grown;
+        if (reader_read(&reader, motion->still_length, grown + *length, (size_t)motion->trailer_length) == 0) {
+            *length += (size_t)motion->trailer_length;
+            status = 0;
+        }
+    }
+    reader_close(&reader);
+    if (status != 0) THINPIC_LOGW("Could not copy the motion photo video; writing the still alone");
+    return status;
+}
+
+int thinpic_motion_photo_probe(const char* input_path, ThinpicMotionPhoto* out) {
+    if (!input_path || !out) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid thinpic_motion_photo_probe arguments");
+        return -1;
+    }
+    ThinpicInput input;
+    memset(&input, 0, sizeof(input));
+    input.path = input_path;
+    input.fd = -1;
+    if (access(input_path, R_OK) != 0) {
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        THINPIC_LOGE("Error: Cannot read %s", input_path);
+        memset(out, 0, sizeof(*out));
+        return -1;
+    }
+    return thinpic_motion_find(&input, out);
+}
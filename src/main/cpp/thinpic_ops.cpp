@@ -0,0 +1,118 @@
+// The operation graph of thinpic_compress_ops (crop, resize, sharpen,
+// composite, autorotate) on the libvips C++ API. Each step used to be a run
+// of vips_* calls into VipsImage* temporaries with a g_object_unref for each
+// one on every exit, and a missed unref there kept a decoded overlay or an
+// intermediate alive for as long as the process; here every intermediate is
+// a VImage, released by its destructor as soon as the next step holds what
+// it needs, and a failing step throws instead of unwinding by hand. The
+// graph stays lazy: pixels are still decoded once, as the encoder pulls them.
+// Nothing C++ crosses the extern "C" boundary; exceptions stop at
+// thinpic_apply_operations.
+
+#include <exception>
+#include <vips/vips8>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+using vips::VError;
+using vips::VImage;
+
+namespace {
+
+// A C pipeline result taken over: 0 with a new reference in out, else the
+// libvips error thrown
+VImage adopt(int failed, VipsImage* out) {
+    if (failed) throw VError();
+    return VImage(out);
+}
+
+// THINPIC_OP_COMPOSITE: overlay in sRGB with its alpha scaled by opacity
+// (prepared once and cached, thinpic_overlay.c), drawn OVER image; a base
+// without alpha stays without
+VImage composite_overlay(const VImage& image, const ThinpicOperation& op) {
+    if (!op.overlay_path) throw VError("no overlay path");
+    VipsImage* prepared = thinpic_overlay_get(op.overlay_path, 0, 0, 0, op.opacity);
+    if (!prepared) throw VError("unreadable overlay");
+    VImage overlay(prepared);
+
+    VImage composed = image.composite2(overlay, VIPS_BLEND_MODE_OVER,
+        VImage::option()->set("x", op.x)->set("y", op.y));
+    if (image.has_alpha()) return composed;
+    return composed.extract_band(0, VImage::option()->set("n", composed.bands() - 1));
+}
+
+VImage apply(const VImage& image, const ThinpicOperation& op, VipsKernel kernel) {
+    switch (op.type) {
+        case THINPIC_OP_AUTOROTATE: {
+            // Transposing orientations read the source out of order, which a
+            // sequential loader cannot do
+            VImage source = image;
+            if (thinpic_orientation(image.get_image()) >= 5) {
+                VipsImage* memory = thinpic_decode_to_memory(image.get_image());
+                if (!memory) throw VError();
+                source = VImage(memory);
+            }
+            VipsImage* out = nullptr;
+            return adopt(thinpic_orient_upright(source.get_image(), &out), out);
+        }
+
+        case THINPIC_OP_CROP: {
+            int width = image.width();
+            int height = image.height();
+            int left = op.x > 0 ? op.x : 0;
+            int top = op.y > 0 ? op.y : 0;
+            int right = op.width > width - op.x ? width : op.x + op.width;
+            int bottom = op.height > height - op.y ? height : op.y + op.height;
+            if (right <= left || bottom <= top) {
+                THINPIC_LOGE("Error: Crop %dx%d+%d+%d is outside the %dx%d image",
+                             op.width, op.height, op.x, op.y, width, height);
+                throw VError("crop outside the image");
+            }
+            return image.extract_area(left, top, right - left, bottom - top);
+        }
+
+        case THINPIC_OP_RESIZE: {
+            double scale_x = op.width > 0 ? (double)op.width / image.width() : 1.0;
+            double scale_y = op.height > 0 ? (double)op.height / image.height() : 1.0;
+            double scale = scale_x < scale_y ? scale_x : scale_y;
+            if (scale >= 1.0) return image;
+            VipsImage* out = nullptr;
+            return adopt(thinpic_resize(image.get_image(), &out, scale, kernel), out);
+        }
+
+        case THINPIC_OP_SHARPEN:
+            return image.sharpen(VImage::option()->set("sigma", op.sigma > 0 ? op.sigma : 1.0));
+
+        case THINPIC_OP_COMPOSITE:
+            return composite_overlay(image, op);
+
+        default:
+            THINPIC_LOGE("Error: Unknown operation %d", op.type);
+            throw VError("unknown operation");
+    }
+}
+
+}  // namespace
+
+VipsImage* thinpic_apply_operations(VipsImage* image, const ThinpicOperation* ops, int start, int count,
+                                    VipsKernel kernel) {
+    VImage current(image);
+    int i = start;
+    try {
+        for (; i < count; i++) {
+            // The step's result holds what it reads; the previous image's
+            // reference goes with the assignment
+            current = apply(current, ops[i], kernel);
+        }
+    } catch (const VError& e) {
+        THINPIC_LOGE("Error: Operation %d (type %d) failed: %s", i, ops[i].type, e.what());
+        return nullptr;
+    } catch (const std::exception& e) {
+        THINPIC_LOGE("Error: Operation %d (type %d) failed: %s", i, ops[i].type, e.what());
+        return nullptr;
+    }
+    VipsImage* out = current.get_image();
+    g_object_ref(out);
+    return out;
+}
@@ -0,0 +1,381 @@
+// Content-addressed cache of compressed outputs (thinpic_set_output_cache).
+// Each entry is one file named after a 128-bit hash of the whole encoded
+// input and the parameters that shape the output, so re-sharing a photo
+// returns the stored bytes before anything is decoded (a motion photo is
+// keyed on its still alone). The directory is scanned once for the index;
+// entries are written through a temporary file and rename, touched on every
+// hit, and the least recently used go once the total passes the byte budget.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define ENTRY_SUFFIX ".tpo"
+#define ENTRY_MAGIC 0x314F5054u     // "TPO1"
+#define HASH_BLOCK (1024 * 1024)    // Bytes read per pread while hashing a file
+
+typedef struct {
+    uint32_t magic;
+    int32_t width;
+    int32_t height;
+    int32_t format;
+    uint64_t length;
+} EntryHeader;
+
+typedef struct {
+    ThinpicCacheKey key;
+    int64_t bytes;                  // File size, header included
+    int64_t used;                   // Nanoseconds of the last hit or store (file mtime)
+} CacheEntry;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char* cache_dir = NULL;      // NULL = disabled
+static int64_t cache_budget = 0;
+static int cache_loaded = 0;
+static CacheEntry* entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+static int64_t total_bytes = 0;
+static uint64_t temp_counter = 0;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char* entry_path(const char* directory, const ThinpicCacheKey* key) {
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx%016llx" ENTRY_SUFFIX,
+             (unsigned long long)key->high, (unsigned long long)key->low);
+    return g_build_filename(directory, name, NULL);
+}
+
+static void entries_clear(void) {
+    g_free(entries);
+    entries = NULL;
+    entry_count = 0;
+    entry_capacity = 0;
+    total_bytes = 0;
+}
+
+// Called with cache_mutex held
+static CacheEntry* entry_add(void) {
+    if (entry_count == entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : 64;
+        entries = g_renew(CacheEntry, entries, entry_capacity);
+    }
+    return &entries[entry_count++];
+}
+
+// Called with cache_mutex held
+static CacheEntry* entry_find(const ThinpicCacheKey* key) {
+    for (int i = 0; i < entry_count; i++) {
+        if (entries[i].key.high == key->high && entries[i].key.low == key->low) return &entries[i];
+    }
+    return NULL;
+}
+
+// Called with cache_mutex held
+static void entry_remove(CacheEntry* entry, int unlink_file) {
+    if (unlink_file) {
+        char* path = entry_path(cache_dir, &entry->key);
+        unlink(path);
+        g_free(path);
+    }
+    total_bytes -= entry->bytes;
+    *entry = entries[--entry_count];
+}
+
+// Called with cache_mutex held; the directory is the index, with mtimes as
+// the recency order, so nothing else needs persisting
+static void cache_load(void) {
+    if (cache_loaded) return;
+    cache_loaded = 1;
+    entries_clear();
+    DIR* dir = opendir(cache_dir);
+    if (!dir) {
+        THINPIC_LOGW("Output cache directory %s cannot be read", cache_dir);
+        return;
+    }
+    struct dirent* item;
+    while ((item = readdir(dir)) != NULL) {
+        unsigned long long high, low;
+        char suffix[8];
+        if (strlen(item->d_name) != 32 + strlen(ENTRY_SUFFIX) ||
+                sscanf(item->d_name, "%16llx%16llx%7s", &high, &low, suffix) != 3 ||
+                strcmp(suffix, ENTRY_SUFFIX) != 0) {
+            continue;
+        }
+        char* path = g_build_filename(cache_dir, item->d_name, NULL);
+        struct stat file_stat;
+        if (stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+            CacheEntry* entry = entry_add();
+            entry->key.high = high;
+            entry->key.low = low;
+            entry->bytes = (int64_t)file_stat.st_size;
+            entry->used = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+            total_bytes += entry->bytes;
+        }
+        g_free(path);
+    }
+    closedir(dir);
+    THINPIC_LOGI("Output cache: %d entries, %lld bytes", entry_count, (long long)total_bytes);
+}
+
+// Called with cache_mutex held
+static void cache_evict(void) {
+    while (total_bytes > cache_budget && entry_count > 0) {
+        CacheEntry* oldest = &entries[0];
+        for (int i = 1; i < entry_count; i++) {
+            if (entries[i].used < oldest->used) oldest = &entries[i];
+        }
+        entry_remove(oldest, 1);
+    }
+}
+
+void thinpic_set_output_cache(const char* directory, int64_t max_bytes) {
+    pthread_mutex_lock(&cache_mutex);
+    g_free(cache_dir);
+    cache_dir = directory && directory[0] && max_bytes > 0 ? g_strdup(directory) : NULL;
+    cache_budget = max_bytes;
+    cache_loaded = 0;
+    entries_clear();
+    if (cache_dir) {
+        // A smaller budget than last time applies to what is already on disk
+        cache_load();
+        cache_evict();
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+int thinpic_output_cache_enabled(void) {
+    pthread_mutex_lock(&cache_mutex);
+    int enabled = cache_dir != NULL;
+    pthread_mutex_unlock(&cache_mutex);
+    return enabled;
+}
+
+// Two 64-bit lanes over 8-byte words with a final avalanche; not
+// cryptographic, but a false hit needs inputs of equal length colliding in
+// both lanes
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+    uint64_t length;
+    uint8_t tail[8];
+    size_t tail_length;
+} KeyHash;
+
+static void hash_init(KeyHash* hash) {
+    memset(hash, 0, sizeof(*hash));
+    hash->a = 0xCBF29CE484222325ull;
+    hash->b = 0x84222325CBF29CE4ull;
+}
+
+static void hash_word(KeyHash* hash, uint64_t word) {
+    hash->a = (hash->a ^ word) * 0x100000001B3ull;
+    hash->b = (hash->b ^ ((word << 29) | (word >> 35))) * 0x9E3779B97F4A7C15ull;
+}
+
+static void hash_update(KeyHash* hash, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    hash->length += length;
+    while (length > 0 && hash->tail_length > 0) {
+        hash->tail[hash->tail_length++] = *p++;
+        length--;
+        if (hash->tail_length == 8) {
+            uint64_t word;
+            memcpy(&word, hash->tail, 8);
+            hash_word(hash, word);
+            hash->tail_length = 0;
+        }
+    }
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        hash_word(hash, word);
+        p += 8;
+        length -= 8;
+    }
+    memcpy(hash->tail, p, length);
+    hash->tail_length = length;
+}
+
+static uint64_t avalanche(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static void hash_final(KeyHash* hash, ThinpicCacheKey* key) {
+    uint64_t word = 0;
+    memcpy(&word, hash->tail, hash->tail_length);
+    hash_word(hash, word ^ ((uint64_t)hash->tail_length << 56));
+    hash_word(hash, hash->length);
+    key->high = avalanche(hash->a);
+    key->low = avalanche(hash->b ^ key->high);
+}
+
+void thinpic_hash_bytes(const void* data, size_t length, ThinpicCacheKey* key) {
+    KeyHash hash;
+    hash_init(&hash);
+    hash_update(&hash, data, length);
+    hash_final(&hash, key);
+}
+
+// The first `length` bytes of a regular file (-1 for all of it); a pipe
+// cannot be read twice
+static int hash_file(KeyHash* hash, const ThinpicInput* input, int64_t length) {
+    int fd = input->path ? open(input->path, O_RDONLY | O_CLOEXEC) : input->fd;
+    if (fd < 0) return 0;
+    struct stat file_stat;
+    uint8_t* block = NULL;
+    int hashed = 0;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+            (block = (uint8_t*)malloc(HASH_BLOCK)) != NULL) {
+        off_t end = length >= 0 && length < (int64_t)file_stat.st_size ? (off_t)length : file_stat.st_size;
+        // pread leaves a descriptor's offset for the loader
+        off_t offset = 0;
+        ssize_t count = 0;
+        while (offset < end && (count = pread(fd, block, (size_t)MIN((off_t)HASH_BLOCK, end - offset), offset)) > 0) {
+            hash_update(hash, block, (size_t)count);
+            offset += count;
+        }
+        hashed = count >= 0 && offset == end;
+    }
+    free(block);
+    if (input->path) close(fd);
+    return hashed;
+}
+
+int thinpic_output_cache_key(const ThinpicInput* input, const void* params, size_t params_length,
+                             ThinpicCacheKey* key) {
+    memset(key, 0, sizeof(*key));
+    if (!thinpic_output_cache_enabled()) return 0;
+    KeyHash hash;
+    hash_init(&hash);
+    // A motion photo's video never reaches the output (a kept one is copied
+    // from the input after the lookup), so only the still is read
+    ThinpicMotionPhoto motion;
+    int64_t still = thinpic_motion_find(input, &motion) ? motion.still_length : -1;
+    if (input->data) {
+        hash_update(&hash, input->data, still >= 0 ? (size_t)still : input->length);
+    } else if (!hash_file(&hash, input, still)) {
+        return 0;
+    }
+    // Pages share the file's bytes; the first keeps its key from before pages
+    if (input->page > 0) hash_update(&hash, &input->page, sizeof(input->page));
+    hash_update(&hash, params, params_length);
+    hash_final(&hash, key);
+    return 1;
+}
+
+int thinpic_output_cache_lookup(const ThinpicCacheKey* key, ThinpicCachedOutput* out) {
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&cache_mutex);
+    char* path = NULL;
+    if (cache_dir) {
+        cache_load();
+        CacheEntry* entry = entry_find(key);
+        if (entry) {
+            entry->used = now_ns();
+            path = entry_path(cache_dir, key);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (!path) return 0;
+
+    int found = 0;
+    FILE* file = fopen(path, "rb");
+    EntryHeader header;
+    if (file && fread(&header, sizeof(header), 1, file) == 1 && header.magic == ENTRY_MAGIC &&
+            header.length > 0 && header.length <= (uint64_t)cache_budget) {
+        // Callers hand the buffer on, released with free_compressed_buffer
+        out->data = (uint8_t*)g_try_malloc((gsize)header.length);
+        if (out->data && fread(out->data, (size_t)header.length, 1, file) == 1) {
+            out->length = (size_t)header.length;
+            out->width = header.width;
+            out->height = header.height;
+            out->format = header.format;
+            found = 1;
+        } else {
+            g_free(out->data);
+            out->data = NULL;
+        }
+    }
+    if (file) fclose(file);
+    if (found) {
+        // The mtime carries the recency across restarts
+        utimensat(AT_FDCWD, path, NULL, 0);
+    } else {
+        THINPIC_LOGW("Output cache entry %s is unreadable, dropping it", path);
+        pthread_mutex_lock(&cache_mutex);
+        CacheEntry* entry = cache_dir ? entry_find(key) : NULL;
+        if (entry) entry_remove(entry, 1);
+        pthread_mutex_unlock(&cache_mutex);
+    }
+    g_free(path);
+    return found;
+}
+
+void thinpic_output_cache_store(const ThinpicCacheKey* key, const uint8_t* data, size_t length,
+                                int width, int height, int format) {
+    if (!data || length == 0) return;
+    pthread_mutex_lock(&cache_mutex);
+    char* directory = cache_dir && (int64_t)(length + sizeof(EntryHeader)) <= cache_budget
+        ? g_strdup(cache_dir) : NULL;
+    uint64_t serial = ++temp_counter;
+    pthread_mutex_unlock(&cache_mutex);
+    if (!directory) return;
+
+    // Written outside the lock; only the rename publishes the entry
+    char* path = entry_path(directory, key);
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%d-%llu.tmp", (int)getpid(), (unsigned long long)serial);
+    char* temp_path = g_strconcat(path, suffix, NULL);
+    FILE* file = fopen(temp_path, "wb");
+    int written = 0;
+    if (file) {
+        EntryHeader header = {ENTRY_MAGIC, width, height, format, (uint64_t)length};
+        written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, length, 1, file) == 1;
+        written = fclose(file) == 0 && written;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    // The cache may have been moved or turned off meanwhile
+    int current = cache_dir && strcmp(cache_dir, directory) == 0;
+    if (written && current && rename(temp_path, path) == 0) {
+        cache_load();
+        CacheEntry* entry = entry_find(key);
+        if (entry) {
+            total_bytes -= entry->bytes;
+        } else {
+            entry = entry_add();
+            entry->key = *key;
+        }
+        entry->bytes = (int64_t)(length + sizeof(EntryHeader));
+        entry->used = now_ns();
+        total_bytes += entry->bytes;
+        cache_evict();
+    } else {
+        if (current) THINPIC_LOGW("Output cache entry %s could not be written", path);
+        unlink(temp_path);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    g_free(temp_path);
+    g_free(path);
+    g_free(directory);
+}
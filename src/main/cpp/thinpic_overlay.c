@@ -0,0 +1,275 @@
+// Watermarks and overlays (ThinpicOptions version 17, THINPIC_OP_COMPOSITE).
+// Stamping a logo in Dart after compression decoded and encoded every
+// upload a second time; here the overlay is composited onto the resized,
+// upright sRGB image inside the pipeline, before its one encode. The overlay
+// itself is prepared once per size: decoded, converted to sRGB with alpha,
+// scaled to the width it is drawn at and its alpha multiplied by the
+// opacity, then kept as a small memory image. A batch that stamps the same
+// logo onto outputs of the same size reuses one decode for all of them.
+// Entries are keyed by path, the file's size and mtime, width and opacity,
+// so a replaced logo is picked up. thinpic_on_memory_pressure drains them.
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define OVERLAY_CACHE_ENTRIES 4
+// Larger overlays are prepared for each call and not kept
+#define OVERLAY_CACHE_MAX_BYTES (8 * 1024 * 1024)
+
+typedef struct {
+    char* path;
+    int64_t size;
+    int64_t mtime_ns;
+    int natural_width;           // As stored in the file
+    int natural_height;
+    int width;                   // Prepared at
+    double opacity;
+    VipsImage* image;
+    uint64_t used;
+} OverlayEntry;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static OverlayEntry entries[OVERLAY_CACHE_ENTRIES];
+static uint64_t use_clock = 0;
+
+static int same_file(const OverlayEntry* entry, const char* path, int64_t size, int64_t mtime_ns) {
+    return entry->image && entry->size == size && entry->mtime_ns == mtime_ns && strcmp(entry->path, path) == 0;
+}
+
+static void entry_clear(OverlayEntry* entry) {
+    if (entry->image) g_object_unref(entry->image);
+    g_free(entry->path);
+    memset(entry, 0, sizeof(*entry));
+}
+
+void thinpic_overlay_cache_drain(void) {
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < OVERLAY_CACHE_ENTRIES; i++) entry_clear(&entries[i]);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// The step's result in place of image, or NULL when it failed
+static VipsImage* advance(VipsImage* image, int failed, VipsImage* next) {
+    g_object_unref(image);
+    return failed ? NULL : next;
+}
+
+// Takes ownership of the opened overlay; 8-bit sRGB with alpha, `width`
+// wide and the alpha scaled by opacity, rendered to memory
+static VipsImage* prepare_overlay(VipsImage* image, int width, double opacity) {
+    VipsImage* next = NULL;
+    image = advance(image, thinpic_to_srgb(image, &next), next);
+    // thinpic_to_srgb leaves grey as it is; the logo is drawn in colour
+    if (image) image = advance(image, vips_colourspace(image, &next, VIPS_INTERPRETATION_sRGB, NULL), next);
+    if (image && !vips_image_hasalpha(image)) {
+        image = advance(image, vips_bandjoin_const1(image, &next, 255.0, NULL), next);
+    }
+    if (image && width != vips_image_get_width(image)) {
+        double scale = (double)width / vips_image_get_width(image);
+        image = advance(image, thinpic_resize(image, &next, scale, VIPS_KERNEL_LANCZOS3), next);
+    }
+    if (image && opacity < 1.0) {
+        double a[4] = {1.0, 1.0, 1.0, opacity};
+        double b[4] = {0.0, 0.0, 0.0, 0.0};
+        image = advance(image, vips_linear(image, &next, a, b, 4, NULL), next);
+    }
+    if (image) image = advance(image, vips_cast(image, &next, VIPS_FORMAT_UCHAR, NULL), next);
+    if (image) {
+        VipsImage* memory = vips_image_copy_memory(image);
+        g_object_unref(image);
+        image = memory;
+    }
+    return image;
+}
+
+VipsImage* thinpic_overlay_get(const char* path, double fraction, int base_width, int base_height,
+                               double opacity) {
+    struct stat file_stat;
+    if (!path || stat(path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        THINPIC_LOGE("Error: Cannot read overlay: %s", path ? path : "(null)");
+        return NULL;
+    }
+    int64_t size = (int64_t)file_stat.st_size;
+    int64_t mtime_ns = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+    opacity = opacity < 0 ? 0 : opacity > 1 ? 1 : opacity;
+
+    // Any size of the same file gives its natural size without a header read
+    int natural_width = 0;
+    int natural_height = 0;
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < OVERLAY_CACHE_ENTRIES && !natural_width; i++) {
+        if (same_file(&entries[i], path, size, mtime_ns)) {
+            natural_width = entries[i].natural_width;
+            natural_height = entries[i].natural_height;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    VipsImage* opened = NULL;
+    if (!natural_width) {
+        opened = vips_image_new_from_file(path, "access", VIPS_ACCESS_SEQUENTIAL, NULL);
+        if (!opened) {
+            thinpic_error_code(THINPIC_ERROR_DECODE);
+            THINPIC_LOGE("Error: Cannot decode overlay: %s", path);
+            return NULL;
+        }
+        natural_width = vips_image_get_width(opened);
+        natural_height = vips_image_get_height(opened);
+    }
+
+    // A fraction of the base's width, shrunk further if it would overflow
+    // the base's height
+    int width = natural_width;
+    if (fraction > 0 && base_width > 0 && base_height > 0) {
+        double scale = base_width * fraction / natural_width;
+        if (natural_height * scale > base_height) scale = (double)base_height / natural_height;
+        width = (int)lround(natural_width * scale);
+        if (width < 1) width = 1;
+    }
+
+    VipsImage* overlay = NULL;
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < OVERLAY_CACHE_ENTRIES; i++) {
+        OverlayEntry* entry = &entries[i];
+        if (same_file(entry, path, size, mtime_ns) && entry->width == width && entry->opacity == opacity) {
+            entry->used = ++use_clock;
+            overlay = entry->image;
+            g_object_ref(overlay);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (overlay) {
+        if (opened) g_object_unref(opened);
+        return overlay;
+    }
+
+    if (!opened) opened = vips_image_new_from_file(path, "access", VIPS_ACCESS_SEQUENTIAL, NULL);
+    overlay = opened ? prepare_overlay(opened, width, opacity) : NULL;
+    if (!overlay) {
+        thinpic_error_code(THINPIC_ERROR_DECODE);
+        THINPIC_LOGE("Error: Cannot decode overlay: %s", path);
+        return NULL;
+    }
+    THINPIC_LOGD("Overlay %s prepared at %dx%d, opacity %.2f", path, vips_image_get_width(overlay),
+                 vips_image_get_height(overlay), opacity);
+    if ((int64_t)VIPS_IMAGE_SIZEOF_IMAGE(overlay) > OVERLAY_CACHE_MAX_BYTES) return overlay;
+
+    pthread_mutex_lock(&cache_mutex);
+    OverlayEntry* slot = &entries[0];
+    for (int i = 0; i < OVERLAY_CACHE_ENTRIES; i++) {
+        if (!entries[i].image) {
+            slot = &entries[i];
+            break;
+        }
+        if (entries[i].used < slot->used) slot = &entries[i];
+    }
+    entry_clear(slot);
+    slot->path = g_strdup(path);
+    slot->size = size;
+    slot->mtime_ns = mtime_ns;
+    slot->natural_width = natural_width;
+    slot->natural_height = natural_height;
+    slot->width = width;
+    slot->opacity = opacity;
+    slot->image = overlay;
+    g_object_ref(overlay);
+    slot->used = ++use_clock;
+    pthread_mutex_unlock(&cache_mutex);
+    return overlay;
+}
+
+gchar* thinpic_overlay_identity(const char* path) {
+    struct stat file_stat;
+    if (!path || stat(path, &file_stat) != 0) return NULL;
+    return g_strdup_printf("%s:%lld:%lld.%09ld", path, (long long)file_stat.st_size,
+                           (long long)file_stat.st_mtim.tv_sec, (long)file_stat.st_mtim.tv_nsec);
+}
+
+// Offset of an overlay `size` long inside `extent` with `margin` kept from
+// the edge it sits against: -1 for the start, 0 centred, 1 for the end
+static int place(int extent, int size, int margin, int side) {
+    if (side < 0) return margin;
+    if (side > 0) return extent - size - margin;
+    return (extent - size) / 2;
+}
+
+VipsImage* thinpic_watermark(VipsImage* image, const ThinpicOptions* options) {
+    if (!image || !options->watermark_path) return image;
+    int width = vips_image_get_width(image);
+    int page_height = vips_image_get_page_height(image);
+    int pages = vips_image_get_height(image) / page_height;
+    VipsImage* overlay = thinpic_overlay_get(options->watermark_path, options->watermark_width, width,
+                                             page_height, options->watermark_opacity);
+    if (!overlay) {
+        g_object_unref(image);
+        return NULL;
+    }
+
+    int horizontal = 0;
+    int vertical = 0;
+    switch (options->watermark_gravity) {
+        case THINPIC_GRAVITY_NORTH: vertical = -1; break;
+        case THINPIC_GRAVITY_EAST: horizontal = 1; break;
+        case THINPIC_GRAVITY_SOUTH: vertical = 1; break;
+        case THINPIC_GRAVITY_WEST: horizontal = -1; break;
+        case THINPIC_GRAVITY_NORTH_EAST: horizontal = 1; vertical = -1; break;
+        case THINPIC_GRAVITY_SOUTH_EAST: horizontal = 1; vertical = 1; break;
+        case THINPIC_GRAVITY_SOUTH_WEST: horizontal = -1; vertical = 1; break;
+        case THINPIC_GRAVITY_NORTH_WEST: horizontal = -1; vertical = -1; break;
+        default: break;
+    }
+    int x = place(width, vips_image_get_width(overlay), options->watermark_margin, horizontal);
+    int y = place(page_height, vips_image_get_height(overlay), options->watermark_margin, vertical);
+
+    // An animation strip gets the overlay once per frame, in one composite
+    VipsImage** in = g_new(VipsImage*, pages + 1);
+    int* modes = g_new(int, pages);
+    int* xs = g_new(int, pages);
+    int* ys = g_new(int, pages);
+    in[0] = image;
+    for (int i = 0; i < pages; i++) {
+        in[i + 1] = overlay;
+        modes[i] = VIPS_BLEND_MODE_OVER;
+        xs[i] = x;
+        ys[i] = y + i * page_height;
+    }
+    VipsArrayInt* x_array = vips_array_int_new(xs, pages);
+    VipsArrayInt* y_array = vips_array_int_new(ys, pages);
+    VipsImage* composed = NULL;
+    ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_COLOUR);
+    int failed = vips_composite(in, &composed, pages + 1, modes, "x", x_array, "y", y_array, NULL);
+    vips_area_unref(VIPS_AREA(x_array));
+    vips_area_unref(VIPS_AREA(y_array));
+    g_free(ys);
+    g_free(xs);
+    g_free(modes);
+    g_free(in);
+    g_object_unref(overlay);
+
+    // Back to the base's bands and format: the blend adds alpha and works in float
+    VipsImage* out = NULL;
+    if (!failed && !vips_image_hasalpha(image)) {
+        VipsImage* opaque = NULL;
+        failed = vips_extract_band(composed, &opaque, 0, "n", vips_image_get_bands(composed) - 1, NULL);
+        g_object_unref(composed);
+        composed = failed ? NULL : opaque;
+    }
+    if (!failed) {
+        failed = vips_cast(composed, &out, vips_image_get_format(image), NULL);
+        g_object_unref(composed);
+    }
+    thinpic_stage_end(THINPIC_STAGE_COLOUR, started);
+    g_object_unref(image);
+    if (failed) {
+        thinpic_error_code(THINPIC_ERROR_PROCESS);
+        THINPIC_LOGE("Error: Failed to composite the watermark");
+        return NULL;
+    }
+    return out;
+}
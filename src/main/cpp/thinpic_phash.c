@@ -0,0 +1,445 @@
+// Perceptual hash of what is encoded (ThinpicOptions perceptual_hash), for
+// near-duplicate detection. The hash is a 64-bit difference hash (dHash):
+// the image's luma averaged over a 9x8 grid, one bit per horizontal
+// neighbour pair saying whether brightness falls to the right. Resizing,
+// re-encoding and mild colour changes leave most bits alone, so burst shots
+// and re-saved copies land a few bits apart. It is taken from the resized
+// image on its way to the encoder: a pass-through node in front of the
+// saver sees every strip the saver pulls, so there is no second decode,
+// and an image already rendered into memory is read directly. A DCT hash
+// (pHash) would need the whole 32x32 thumbnail before it could start; the
+// grid sums fold in strip by strip. The same node can also average the
+// image into a small colour grid, the tiny intermediate placeholders
+// (thinpic_placeholder.c) are computed from, and into a luma plane of up
+// to 512 cells on the long side for blur and exposure scores
+// (thinpic_analysis.c), and the centre of the image, cropped to a model
+// input's aspect, into an RGB plane of at most that input's size
+// (thinpic_tensor.c).
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define HASH_COLUMNS 9
+#define HASH_ROWS 8
+// Rows summed on the worker before the shared grids are locked
+#define ROW_BATCH 16
+// Tensor plane column of a pixel outside the centre crop
+#define OUTSIDE_CROP 0xFFFF
+
+struct ThinpicHashTap {
+    int refs;
+    GMutex lock;
+    int width;
+    int height;
+    int bands;
+    int sixteen_bit;
+    int hash;                    // Luma grid wanted
+    int grid_width;              // Colour grid, 0 x 0 when not wanted
+    int grid_height;
+    int plane_width;             // Luma plane, 0 x 0 when not wanted
+    int plane_height;
+    uint8_t* column_cell;        // Hash grid column of each x
+    uint8_t* grid_cell;          // Colour grid column of each x
+    uint16_t* plane_cell;        // Luma plane column of each x
+    uint32_t* plane_column_pixels;
+    uint32_t* plane_row_pixels;
+    uint64_t* plane_sums;
+    int tensor_width;            // RGB plane of the centre crop, 0 x 0 when not wanted
+    int tensor_height;
+    int crop_top;                // Rows of the crop in the image
+    int crop_height;
+    uint16_t* tensor_cell;       // Tensor plane column of each x, or OUTSIDE_CROP
+    uint32_t* tensor_column_pixels;
+    uint32_t* tensor_row_pixels;
+    uint64_t* tensor_sums;
+    uint8_t* rows_seen;          // A region pulled twice is counted once
+    int seen;
+    uint32_t column_pixels[HASH_COLUMNS];
+    uint32_t row_pixels[HASH_ROWS];
+    uint64_t sums[HASH_ROWS * HASH_COLUMNS];
+    uint32_t grid_column_pixels[THINPIC_GRID_MAX];
+    uint32_t grid_row_pixels[THINPIC_GRID_MAX];
+    uint64_t grid_sums[THINPIC_GRID_MAX * THINPIC_GRID_MAX * 4];
+};
+
+static void tap_unref(ThinpicHashTap* tap) {
+    if (__atomic_sub_fetch(&tap->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    g_mutex_clear(&tap->lock);
+    g_free(tap->column_cell);
+    g_free(tap->grid_cell);
+    g_free(tap->plane_cell);
+    g_free(tap->plane_column_pixels);
+    g_free(tap->plane_row_pixels);
+    g_free(tap->plane_sums);
+    g_free(tap->tensor_cell);
+    g_free(tap->tensor_column_pixels);
+    g_free(tap->tensor_row_pixels);
+    g_free(tap->tensor_sums);
+    g_free(tap->rows_seen);
+    g_free(tap);
+}
+
+// The long side gets `cells` cells, the short side keeps the aspect; never
+// more cells than pixels
+static void grid_shape(int width, int height, int cells, int* grid_width, int* grid_height) {
+    int landscape = width >= height;
+    int short_cells = (int)((double)cells * (landscape ? height : width) / (landscape ? width : height) + 0.5);
+    short_cells = short_cells < 1 ? 1 : short_cells;
+    *grid_width = landscape ? cells : short_cells;
+    *grid_height = landscape ? short_cells : cells;
+    *grid_width = *grid_width > width ? width : *grid_width;
+    *grid_height = *grid_height > height ? height : *grid_height;
+}
+
+// The centre crop of the image at the tensor's aspect, summed into at most
+// tensor_width x tensor_height cells; never more cells than crop pixels
+static void tensor_shape(ThinpicHashTap* tap, int tensor_width, int tensor_height) {
+    int crop_width = tap->width;
+    int crop_height = tap->height;
+    if ((int64_t)tap->width * tensor_height > (int64_t)tap->height * tensor_width) {
+        crop_width = (int)((double)tap->height * tensor_width / tensor_height + 0.5);
+    } else {
+        crop_height = (int)((double)tap->width * tensor_height / tensor_width + 0.5);
+    }
+    crop_width = crop_width < 1 ? 1 : crop_width;
+    crop_height = crop_height < 1 ? 1 : crop_height;
+    int crop_left = (tap->width - crop_width) / 2;
+    tap->crop_top = (tap->height - crop_height) / 2;
+    tap->crop_height = crop_height;
+    tap->tensor_width = tensor_width < crop_width ? tensor_width : crop_width;
+    tap->tensor_height = tensor_height < crop_height ? tensor_height : crop_height;
+    tap->tensor_cell = g_new(uint16_t, tap->width);
+    tap->tensor_column_pixels = g_new0(uint32_t, tap->tensor_width);
+    tap->tensor_row_pixels = g_new0(uint32_t, tap->tensor_height);
+    tap->tensor_sums = g_new0(uint64_t, (size_t)tap->tensor_width * tap->tensor_height * 3);
+    for (int x = 0; x < tap->width; x++) {
+        int inside = x >= crop_left && x < crop_left + crop_width;
+        tap->tensor_cell[x] = inside ? (uint16_t)((int64_t)(x - crop_left) * tap->tensor_width / crop_width)
+                                     : OUTSIDE_CROP;
+        if (inside) tap->tensor_column_pixels[tap->tensor_cell[x]]++;
+    }
+    for (int y = 0; y < crop_height; y++) {
+        tap->tensor_row_pixels[(int64_t)y * tap->tensor_height / crop_height]++;
+    }
+}
+
+static ThinpicHashTap* tap_new(VipsImage* image, int hash, int grid, int plane, int tensor_width,
+                               int tensor_height) {
+    int tensor = tensor_width > 0 && tensor_height > 0;
+    VipsBandFormat format = vips_image_get_format(image);
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    // Too small for the hash can still make a colour grid
+    hash = hash && width >= HASH_COLUMNS && height >= HASH_ROWS;
+    if ((format != VIPS_FORMAT_UCHAR && format != VIPS_FORMAT_USHORT) || (!hash && !grid && !plane && !tensor)) {
+        return NULL;
+    }
+    ThinpicHashTap* tap = g_new0(ThinpicHashTap, 1);
+    tap->refs = 1;
+    g_mutex_init(&tap->lock);
+    tap->width = width;
+    tap->height = height;
+    tap->bands = vips_image_get_bands(image);
+    tap->sixteen_bit = format == VIPS_FORMAT_USHORT;
+    tap->hash = hash;
+    tap->rows_seen = (uint8_t*)g_malloc0((size_t)height);
+    if (hash) {
+        tap->column_cell = (uint8_t*)g_malloc((size_t)width);
+        for (int x = 0; x < width; x++) {
+            tap->column_cell[x] = (uint8_t)((int64_t)x * HASH_COLUMNS / width);
+            tap->column_pixels[tap->column_cell[x]]++;
+        }
+        for (int y = 0; y < height; y++) {
+            tap->row_pixels[(int64_t)y * HASH_ROWS / height]++;
+        }
+    }
+    if (grid) {
+        grid_shape(width, height, grid > THINPIC_GRID_MAX ? THINPIC_GRID_MAX : grid,
+                   &tap->grid_width, &tap->grid_height);
+        tap->grid_cell = (uint8_t*)g_malloc((size_t)width);
+        for (int x = 0; x < width; x++) {
+            tap->grid_cell[x] = (uint8_t)((int64_t)x * tap->grid_width / width);
+            tap->grid_column_pixels[tap->grid_cell[x]]++;
+        }
+        for (int y = 0; y < height; y++) {
+            tap->grid_row_pixels[(int64_t)y * tap->grid_height / height]++;
+        }
+    }
+    if (plane) {
+        grid_shape(width, height, plane > THINPIC_PLANE_MAX ? THINPIC_PLANE_MAX : plane,
+                   &tap->plane_width, &tap->plane_height);
+        tap->plane_cell = g_new(uint16_t, width);
+        tap->plane_column_pixels = g_new0(uint32_t, tap->plane_width);
+        tap->plane_row_pixels = g_new0(uint32_t, tap->plane_height);
+        tap->plane_sums = g_new0(uint64_t, (size_t)tap->plane_width * tap->plane_height);
+        for (int x = 0; x < width; x++) {
+            tap->plane_cell[x] = (uint16_t)((int64_t)x * tap->plane_width / width);
+            tap->plane_column_pixels[tap->plane_cell[x]]++;
+        }
+        for (int y = 0; y < height; y++) {
+            tap->plane_row_pixels[(int64_t)y * tap->plane_height / height]++;
+        }
+    }
+    if (tensor) tensor_shape(tap, tensor_width, tensor_height);
+    return tap;
+}
+
+// One row summed per grid column: luma for the hash and the plane, RGBA for
+// the colour grid and RGB for the tensor (grey is spread over RGB, a missing
+// alpha counts as opaque)
+#define SUM_ROW(type, shift) { \
+    const type* p = (const type*)row; \
+    for (int x = 0; x < tap->width; x++, p += bands) { \
+        unsigned r = p[0] >> shift; \
+        unsigned g = bands >= 3 ? p[1] >> shift : r; \
+        unsigned b = bands >= 3 ? p[2] >> shift : r; \
+        unsigned y = (77u * r + 150u * g + 29u * b) >> 8; \
+        if (luma) luma[tap->column_cell[x]] += y; \
+        if (plane) plane[tap->plane_cell[x]] += y; \
+        if (rgba) { \
+            uint32_t* cell = rgba + tap->grid_cell[x] * 4; \
+            cell[0] += r; \
+            cell[1] += g; \
+            cell[2] += b; \
+            cell[3] += bands == 2 || bands == 4 ? p[bands - 1] >> shift : 255u; \
+        } \
+        if (rgb && tap->tensor_cell[x] != OUTSIDE_CROP) { \
+            uint32_t* cell = rgb + tap->tensor_cell[x] * 3; \
+            cell[0] += r; \
+            cell[1] += g; \
+            cell[2] += b; \
+        } \
+    } \
+}
+
+static void sum_row(const ThinpicHashTap* tap, const uint8_t* row, uint32_t* luma, uint32_t* rgba,
+                    uint32_t* plane, uint32_t* rgb) {
+    int bands = tap->bands;
+    if (tap->sixteen_bit) {
+        SUM_ROW(uint16_t, 8)
+    } else {
+        SUM_ROW(uint8_t, 0)
+    }
+}
+
+#undef SUM_ROW
+
+// Full-width rows from top; stride is the byte distance between rows
+static void accumulate(ThinpicHashTap* tap, const uint8_t* first, size_t stride, int top, int rows) {
+    uint32_t luma[ROW_BATCH][HASH_COLUMNS];
+    uint32_t rgba[ROW_BATCH][THINPIC_GRID_MAX * 4];
+    uint32_t plane[ROW_BATCH][THINPIC_PLANE_MAX];
+    // Up to THINPIC_TENSOR_MAX cells a row: too large for the stack
+    size_t rgb_row = (size_t)tap->tensor_width * 3;
+    uint32_t* rgb = rgb_row ? g_new(uint32_t, ROW_BATCH * rgb_row) : NULL;
+    for (int start = 0; start < rows; start += ROW_BATCH) {
+        int count = rows - start < ROW_BATCH ? rows - start : ROW_BATCH;
+        memset(luma, 0, sizeof(luma));
+        memset(rgba, 0, sizeof(rgba));
+        if (tap->plane_width) memset(plane, 0, sizeof(plane));
+        if (rgb) memset(rgb, 0, sizeof(uint32_t) * ROW_BATCH * rgb_row);
+        for (int r = 0; r < count; r++) {
+            int crop_row = top + start + r - tap->crop_top;
+            int cropped = rgb && crop_row >= 0 && crop_row < tap->crop_height;
+            sum_row(tap, first + (size_t)(start + r) * stride, tap->hash ? luma[r] : NULL,
+                    tap->grid_width ? rgba[r] : NULL, tap->plane_width ? plane[r] : NULL,
+                    cropped ? rgb + r * rgb_row : NULL);
+        }
+        g_mutex_lock(&tap->lock);
+        for (int r = 0; r < count; r++) {
+            int y = top + start + r;
+            if (tap->rows_seen[y]) continue;
+            tap->rows_seen[y] = 1;
+            tap->seen++;
+            if (tap->hash) {
+                uint64_t* cells = tap->sums + (int64_t)y * HASH_ROWS / tap->height * HASH_COLUMNS;
+                for (int c = 0; c < HASH_COLUMNS; c++) cells[c] += luma[r][c];
+            }
+            if (tap->grid_width) {
+                uint64_t* cells = tap->grid_sums + (int64_t)y * tap->grid_height / tap->height * tap->grid_width * 4;
+                for (int c = 0; c < tap->grid_width * 4; c++) cells[c] += rgba[r][c];
+            }
+            if (tap->plane_width) {
+                uint64_t* cells = tap->plane_sums + (int64_t)y * tap->plane_height / tap->height * tap->plane_width;
+                for (int c = 0; c < tap->plane_width; c++) cells[c] += plane[r][c];
+            }
+            int crop_row = y - tap->crop_top;
+            if (rgb && crop_row >= 0 && crop_row < tap->crop_height) {
+                uint64_t* cells = tap->tensor_sums +
+                                  (int64_t)crop_row * tap->tensor_height / tap->crop_height * rgb_row;
+                for (size_t c = 0; c < rgb_row; c++) cells[c] += rgb[r * rgb_row + c];
+            }
+        }
+        g_mutex_unlock(&tap->lock);
+    }
+    g_free(rgb);
+}
+
+static int tap_generate(VipsRegion* out_region, void* seq, void* a, void* b, gboolean* stop) {
+    VipsRegion* in_region = (VipsRegion*)seq;
+    ThinpicHashTap* tap = (ThinpicHashTap*)b;
+    VipsRect* rect = &out_region->valid;
+    (void)a;
+    (void)stop;
+    if (vips_region_prepare(in_region, rect) ||
+            vips_region_region(out_region, in_region, rect, rect->left, rect->top)) {
+        return -1;
+    }
+    // Strip savers pull whole rows; tiles are passed through unhashed
+    if (rect->left == 0 && rect->width == tap->width) {
+        accumulate(tap, VIPS_REGION_ADDR(in_region, 0, rect->top), VIPS_REGION_LSKIP(in_region),
+                   rect->top, rect->height);
+    }
+    return 0;
+}
+
+// The image's reference: it may outlive the encode in libvips' caches
+static void tap_closed(VipsImage* image, void* data) {
+    (void)image;
+    tap_unref((ThinpicHashTap*)data);
+}
+
+ThinpicHashTap* thinpic_hash_tap(VipsImage* image, int hash, int grid, int plane, int tensor_width,
+                                 int tensor_height, VipsImage** out) {
+    *out = NULL;
+    ThinpicHashTap* tap = tap_new(image, hash, grid, plane, tensor_width, tensor_height);
+    if (!tap) return NULL;
+    if (image->data) {
+        accumulate(tap, (const uint8_t*)image->data, VIPS_IMAGE_SIZEOF_LINE(image), 0, tap->height);
+        g_object_ref(image);
+        *out = image;
+        return tap;
+    }
+
+    VipsImage* tapped = vips_image_new();
+    if (vips_image_pipelinev(tapped, VIPS_DEMAND_STYLE_THINSTRIP, image, NULL) ||
+            vips_image_generate(tapped, vips_start_one, tap_generate, vips_stop_one, image, tap)) {
+        g_object_unref(tapped);
+        tap_unref(tap);
+        return NULL;
+    }
+    tap->refs++;
+    g_signal_connect(tapped, "close", G_CALLBACK(tap_closed), tap);
+    // Keep the input alive as long as the output reads from it
+    g_object_ref(image);
+    vips_object_local(tapped, image);
+    *out = tapped;
+    return tap;
+}
+
+static uint64_t grid_hash(const ThinpicHashTap* tap) {
+    double means[HASH_ROWS * HASH_COLUMNS];
+    for (int r = 0; r < HASH_ROWS; r++) {
+        for (int c = 0; c < HASH_COLUMNS; c++) {
+            means[r * HASH_COLUMNS + c] = (double)tap->sums[r * HASH_COLUMNS + c] /
+                                          ((double)tap->row_pixels[r] * tap->column_pixels[c]);
+        }
+    }
+    uint64_t bits = 0;
+    for (int r = 0; r < HASH_ROWS; r++) {
+        for (int c = 0; c < HASH_COLUMNS - 1; c++) {
+            bits = (bits << 1) | (means[r * HASH_COLUMNS + c] > means[r * HASH_COLUMNS + c + 1]);
+        }
+    }
+    return bits;
+}
+
+static void colour_grid(const ThinpicHashTap* tap, ThinpicColourGrid* grid) {
+    grid->width = tap->grid_width;
+    grid->height = tap->grid_height;
+    for (int r = 0; r < tap->grid_height; r++) {
+        for (int c = 0; c < tap->grid_width; c++) {
+            double pixels = (double)tap->grid_row_pixels[r] * tap->grid_column_pixels[c];
+            int cell = (r * tap->grid_width + c) * 4;
+            for (int band = 0; band < 4; band++) {
+                grid->rgba[cell + band] = (uint8_t)(tap->grid_sums[cell + band] / pixels + 0.5);
+            }
+        }
+    }
+}
+
+static void luma_plane(const ThinpicHashTap* tap, ThinpicLumaPlane* plane) {
+    plane->width = tap->plane_width;
+    plane->height = tap->plane_height;
+    plane->luma = g_new(float, (size_t)tap->plane_width * tap->plane_height);
+    for (int r = 0; r < tap->plane_height; r++) {
+        for (int c = 0; c < tap->plane_width; c++) {
+            int cell = r * tap->plane_width + c;
+            plane->luma[cell] = (float)((double)tap->plane_sums[cell] /
+                                        ((double)tap->plane_row_pixels[r] * tap->plane_column_pixels[c]));
+        }
+    }
+}
+
+static void rgb_plane(const ThinpicHashTap* tap, ThinpicRgbPlane* plane) {
+    plane->width = tap->tensor_width;
+    plane->height = tap->tensor_height;
+    plane->rgb = g_new(float, (size_t)tap->tensor_width * tap->tensor_height * 3);
+    for (int r = 0; r < tap->tensor_height; r++) {
+        for (int c = 0; c < tap->tensor_width; c++) {
+            double pixels = (double)tap->tensor_row_pixels[r] * tap->tensor_column_pixels[c];
+            int cell = (r * tap->tensor_width + c) * 3;
+            for (int band = 0; band < 3; band++) {
+                plane->rgb[cell + band] = (float)(tap->tensor_sums[cell + band] / pixels);
+            }
+        }
+    }
+}
+
+int thinpic_hash_tap_finish(ThinpicHashTap* tap, uint64_t* hash, ThinpicColourGrid* grid, ThinpicLumaPlane* plane,
+                            ThinpicRgbPlane* tensor) {
+    if (!tap) return 0;
+    g_mutex_lock(&tap->lock);
+    int complete = tap->seen == tap->height;
+    int hashed = complete && tap->hash;
+    if (hashed) *hash = grid_hash(tap);
+    if (complete && tap->grid_width) colour_grid(tap, grid);
+    if (complete && tap->plane_width) luma_plane(tap, plane);
+    if (complete && tap->tensor_width) rgb_plane(tap, tensor);
+    int seen = tap->seen;
+    int height = tap->height;
+    g_mutex_unlock(&tap->lock);
+    tap_unref(tap);
+    if (!complete) {
+        THINPIC_LOGD("Perceptual hash and analysis skipped: %d of %d rows seen", seen, height);
+    }
+    return hashed;
+}
+
+int thinpic_hash_distance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+static int group_root(int* parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+int thinpic_group_near_duplicates(const uint64_t* hashes, int count, int max_distance, int* groups) {
+    if (!hashes || !groups || count < 0 || max_distance < 0) {
+        THINPIC_LOGE("Error: Invalid thinpic_group_near_duplicates arguments");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) groups[i] = i;
+    // Union-find over every pair: the smaller index is always the root
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            if (thinpic_hash_distance(hashes[i], hashes[j]) > max_distance) continue;
+            int a = group_root(groups, i);
+            int b = group_root(groups, j);
+            if (a < b) groups[b] = a;
+            else if (b < a) groups[a] = b;
+        }
+    }
+    int group_count = 0;
+    for (int i = 0; i < count; i++) {
+        groups[i] = group_root(groups, i);
+        if (groups[i] == i) group_count++;
+    }
+    return group_count;
+}
@@ -0,0 +1,221 @@
+// Loading placeholders (ThinpicOptions placeholder) from the colour grid the
+// hash tap averages out of the encoder's strips, so a feed gets its BlurHash
+// or ThumbHash without decoding the compressed file again. Both are DCT
+// sketches of a tiny image, and 32 cells on the long side are more than
+// either reads: BlurHash keeps 4x3 components, ThumbHash at most 7 per axis.
+// The encoders follow the reference implementations (Wolt's blurhash and
+// Evan Wallace's thumbhash) so the strings decode with any of their ports.
+
+#include <math.h>
+#include <string.h>
+
+#include "thinpic_internal.h"
+
+#define BLURHASH_LONG_COMPONENTS 4
+#define BLURHASH_SHORT_COMPONENTS 3
+// ThumbHash header, alpha byte and AC nibbles, at most
+#define THUMBHASH_MAX_BYTES 32
+// Largest AC count of one ThumbHash channel (7x7 luma triangle)
+#define THUMBHASH_MAX_AC 32
+
+static const char base83[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#$%*+,-.:;=?@[]^_{|}~";
+static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Math.round, which both references use: halves go up, also when negative
+static int js_round(double value) {
+    return (int)floor(value + 0.5);
+}
+
+static double srgb_to_linear(int value) {
+    double v = value / 255.0;
+    return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+static int linear_to_srgb(double value) {
+    double v = value < 0 ? 0 : value > 1 ? 1 : value;
+    return v <= 0.0031308 ? (int)(v * 12.92 * 255 + 0.5) : (int)((1.055 * pow(v, 1 / 2.4) - 0.055) * 255 + 0.5);
+}
+
+static double sign_pow(double value, double exponent) {
+    return copysign(pow(fabs(value), exponent), value);
+}
+
+static char* encode83(int value, int length, char* p) {
+    int divisor = 1;
+    for (int i = 1; i < length; i++) divisor *= 83;
+    for (int i = 0; i < length; i++, divisor /= 83) {
+        *p++ = base83[(value / divisor) % 83];
+    }
+    return p;
+}
+
+int thinpic_blurhash(const ThinpicColourGrid* grid, char* out, size_t size) {
+    int w = grid->width;
+    int h = grid->height;
+    int x_components = w >= h ? BLURHASH_LONG_COMPONENTS : BLURHASH_SHORT_COMPONENTS;
+    int y_components = w >= h ? BLURHASH_SHORT_COMPONENTS : BLURHASH_LONG_COMPONENTS;
+    int components = x_components * y_components;
+    if (size < (size_t)(6 + 2 * (components - 1) + 1)) return -1;
+
+    double linear[THINPIC_GRID_MAX * THINPIC_GRID_MAX * 3];
+    for (int i = 0; i < w * h; i++) {
+        for (int band = 0; band < 3; band++) linear[i * 3 + band] = srgb_to_linear(grid->rgba[i * 4 + band]);
+    }
+    double factors[BLURHASH_LONG_COMPONENTS * BLURHASH_LONG_COMPONENTS][3];
+    for (int j = 0; j < y_components; j++) {
+        for (int i = 0; i < x_components; i++) {
+            double normalisation = i == 0 && j == 0 ? 1 : 2;
+            double sum[3] = {0, 0, 0};
+            for (int y = 0; y < h; y++) {
+                double fy = cos(G_PI * j * y / h);
+                for (int x = 0; x < w; x++) {
+                    double basis = normalisation * cos(G_PI * i * x / w) * fy;
+                    const double* pixel = linear + (y * w + x) * 3;
+                    sum[0] += basis * pixel[0];
+                    sum[1] += basis * pixel[1];
+                    sum[2] += basis * pixel[2];
+                }
+            }
+            double* factor = factors[j * x_components + i];
+            for (int band = 0; band < 3; band++) factor[band] = sum[band] / (w * h);
+        }
+    }
+
+    char* p = encode83((x_components - 1) + (y_components - 1) * 9, 1, out);
+    double maximum = 0;
+    for (int i = 1; i < components; i++) {
+        for (int band = 0; band < 3; band++) maximum = fmax(maximum, fabs(factors[i][band]));
+    }
+    int quantised_maximum = (int)floor(maximum * 166 - 0.5);
+    quantised_maximum = quantised_maximum < 0 ? 0 : quantised_maximum > 82 ? 82 : quantised_maximum;
+    double maximum_value = (quantised_maximum + 1) / 166.0;
+    p = encode83(quantised_maximum, 1, p);
+    p = encode83((linear_to_srgb(factors[0][0]) << 16) + (linear_to_srgb(factors[0][1]) << 8) +
+                 linear_to_srgb(factors[0][2]), 4, p);
+    for (int i = 1; i < components; i++) {
+        int quantised[3];
+        for (int band = 0; band < 3; band++) {
+            int q = (int)floor(sign_pow(factors[i][band] / maximum_value, 0.5) * 9 + 9.5);
+            quantised[band] = q < 0 ? 0 : q > 18 ? 18 : q;
+        }
+        p = encode83(quantised[0] * 19 * 19 + quantised[1] * 19 + quantised[2], 2, p);
+    }
+    *p = '\0';
+    return 0;
+}
+
+// DCT of one channel with the AC terms normalised to 0-1 around 0.5
+static int thumbhash_channel(const double* channel, int w, int h, int nx, int ny,
+                             double* dc, double* ac, double* scale) {
+    int count = 0;
+    double fx[THINPIC_GRID_MAX];
+    *dc = 0;
+    *scale = 0;
+    for (int cy = 0; cy < ny; cy++) {
+        for (int cx = 0; cx * ny < nx * (ny - cy); cx++) {
+            double f = 0;
+            for (int x = 0; x < w; x++) fx[x] = cos(G_PI / w * cx * (x + 0.5));
+            for (int y = 0; y < h; y++) {
+                double fy = cos(G_PI / h * cy * (y + 0.5));
+                for (int x = 0; x < w; x++) f += channel[x + y * w] * fx[x] * fy;
+            }
+            f /= w * h;
+            if (cx || cy) {
+                ac[count++] = f;
+                *scale = fmax(*scale, fabs(f));
+            } else {
+                *dc = f;
+            }
+        }
+    }
+    if (*scale > 0) {
+        for (int i = 0; i < count; i++) ac[i] = 0.5 + 0.5 / *scale * ac[i];
+    }
+    return count;
+}
+
+int thinpic_thumbhash(const ThinpicColourGrid* grid, char* out, size_t size) {
+    int w = grid->width;
+    int h = grid->height;
+    const uint8_t* rgba = grid->rgba;
+    double average[3] = {0, 0, 0};
+    double alpha_sum = 0;
+    for (int i = 0; i < w * h; i++) {
+        double alpha = rgba[i * 4 + 3] / 255.0;
+        for (int band = 0; band < 3; band++) average[band] += alpha / 255.0 * rgba[i * 4 + band];
+        alpha_sum += alpha;
+    }
+    if (alpha_sum > 0) {
+        for (int band = 0; band < 3; band++) average[band] /= alpha_sum;
+    }
+
+    // LPQA: luminance, yellow-blue, red-green and alpha, composited atop the average
+    int has_alpha = alpha_sum < w * h;
+    int luma_limit = has_alpha ? 5 : 7;
+    int long_side = w > h ? w : h;
+    int lx = js_round((double)luma_limit * w / long_side);
+    int ly = js_round((double)luma_limit * h / long_side);
+    lx = lx < 1 ? 1 : lx;
+    ly = ly < 1 ? 1 : ly;
+    double l[THINPIC_GRID_MAX * THINPIC_GRID_MAX];
+    double p[THINPIC_GRID_MAX * THINPIC_GRID_MAX];
+    double q[THINPIC_GRID_MAX * THINPIC_GRID_MAX];
+    double a[THINPIC_GRID_MAX * THINPIC_GRID_MAX];
+    for (int i = 0; i < w * h; i++) {
+        double alpha = rgba[i * 4 + 3] / 255.0;
+        double r = average[0] * (1 - alpha) + alpha / 255.0 * rgba[i * 4];
+        double g = average[1] * (1 - alpha) + alpha / 255.0 * rgba[i * 4 + 1];
+        double b = average[2] * (1 - alpha) + alpha / 255.0 * rgba[i * 4 + 2];
+        l[i] = (r + g + b) / 3;
+        p[i] = (r + g) / 2 - b;
+        q[i] = r - g;
+        a[i] = alpha;
+    }
+
+    double l_dc, p_dc, q_dc, a_dc = 0;
+    double l_scale, p_scale, q_scale, a_scale = 0;
+    double l_ac[THUMBHASH_MAX_AC], p_ac[THUMBHASH_MAX_AC], q_ac[THUMBHASH_MAX_AC], a_ac[THUMBHASH_MAX_AC];
+    int l_count = thumbhash_channel(l, w, h, lx > 3 ? lx : 3, ly > 3 ? ly : 3, &l_dc, l_ac, &l_scale);
+    int p_count = thumbhash_channel(p, w, h, 3, 3, &p_dc, p_ac, &p_scale);
+    int q_count = thumbhash_channel(q, w, h, 3, 3, &q_dc, q_ac, &q_scale);
+    int a_count = has_alpha ? thumbhash_channel(a, w, h, 5, 5, &a_dc, a_ac, &a_scale) : 0;
+
+    int landscape = w > h;
+    uint32_t header24 = (uint32_t)js_round(63 * l_dc) | ((uint32_t)js_round(31.5 + 31.5 * p_dc) << 6) |
+                        ((uint32_t)js_round(31.5 + 31.5 * q_dc) << 12) | ((uint32_t)js_round(31 * l_scale) << 18) |
+                        ((uint32_t)has_alpha << 23);
+    uint32_t header16 = (uint32_t)(landscape ? ly : lx) | ((uint32_t)js_round(63 * p_scale) << 3) |
+                        ((uint32_t)js_round(63 * q_scale) << 9) | ((uint32_t)landscape << 15);
+    uint8_t hash[THUMBHASH_MAX_BYTES] = {0};
+    hash[0] = header24 & 255;
+    hash[1] = (header24 >> 8) & 255;
+    hash[2] = header24 >> 16;
+    hash[3] = header16 & 255;
+    hash[4] = header16 >> 8;
+    int ac_start = has_alpha ? 6 : 5;
+    if (has_alpha) hash[5] = (uint8_t)(js_round(15 * a_dc) | (js_round(15 * a_scale) << 4));
+    const double* channels[4] = {l_ac, p_ac, q_ac, a_ac};
+    int counts[4] = {l_count, p_count, q_count, a_count};
+    int ac_index = 0;
+    for (int c = 0; c < 4; c++) {
+        for (int i = 0; i < counts[c]; i++, ac_index++) {
+            hash[ac_start + (ac_index >> 1)] |= (uint8_t)(js_round(15 * channels[c][i]) << ((ac_index & 1) << 2));
+        }
+    }
+    int length = ac_start + (ac_index + 1) / 2;
+
+    // Standard base64 with padding, the usual text form of a ThumbHash
+    if (size < (size_t)((length + 2) / 3 * 4 + 1)) return -1;
+    char* text = out;
+    for (int i = 0; i < length; i += 3) {
+        uint32_t chunk = (uint32_t)hash[i] << 16 | (i + 1 < length ? (uint32_t)hash[i + 1] << 8 : 0) |
+                         (i + 2 < length ? hash[i + 2] : 0);
+        *text++ = base64[(chunk >> 18) & 63];
+        *text++ = base64[(chunk >> 12) & 63];
+        *text++ = i + 1 < length ? base64[(chunk >> 6) & 63] : '=';
+        *text++ = i + 2 < length ? base64[chunk & 63] : '=';
+    }
+    *text = '\0';
+    return 0;
+}
@@ -0,0 +1,440 @@
+// Indexed PNG output for thinpic_compress. This libvips is built without
+// libimagequant/quantizr, so pngsave ignores "palette"; the palette is built
+// here (exact for low-colour images, median cut otherwise) and the file is
+// written with libspng directly.
+
+#include <stdlib.h>
+#include <string.h>
+#include <spng.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define PALETTE_MAX 256
+#define COLOUR_SLOT_BITS 10         // Exact-colour hash: 1024 slots for at most 257 colours
+#define QUANT_SAMPLES 65536         // Pixels median cut works from
+#define CACHE_BITS 19               // Nearest-colour cache: 5 bits of R, G, B and 4 of alpha
+
+// RGBA packed little-end first. Every fully transparent pixel is the same
+// colour, whatever RGB it happens to carry.
+static uint32_t pixel_key(const uint8_t* p, int bands) {
+    if (bands == 4 && p[3] == 0) return 0;
+    uint32_t alpha = bands == 4 ? p[3] : 0xFF;
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | alpha << 24;
+}
+
+static int key_channel(uint32_t key, int channel) {
+    return (key >> (channel * 8)) & 0xFF;
+}
+
+typedef struct {
+    uint32_t keys[1 << COLOUR_SLOT_BITS];
+    int16_t index[1 << COLOUR_SLOT_BITS];   // -1 = empty slot
+    int count;
+} ColourTable;
+
+static uint32_t colour_slot(uint32_t key) {
+    return (key * 2654435761u) >> (32 - COLOUR_SLOT_BITS);
+}
+
+// Index of key, adding it while the table holds fewer than limit colours;
+// -1 once the image has more
+static int colour_index(ColourTable* table, uint32_t key, int limit) {
+    uint32_t slot = colour_slot(key);
+    for (;;) {
+        if (table->index[slot] < 0) {
+            if (table->count >= limit) return -1;
+            table->keys[slot] = key;
+            table->index[slot] = (int16_t)table->count;
+            return table->count++;
+        }
+        if (table->keys[slot] == key) return table->index[slot];
+        slot = (slot + 1) & ((1 << COLOUR_SLOT_BITS) - 1);
+    }
+}
+
+// Every pixel's palette index when the image has at most limit colours;
+// 0 (and nothing filled) when it has more
+int thinpic_exact_palette(const uint8_t* pixels, size_t count, int bands, int limit,
+                          uint32_t* palette, int* palette_size, uint8_t* indices) {
+    ColourTable* table = (ColourTable*)malloc(sizeof(ColourTable));
+    if (!table) return 0;
+    memset(table->index, 0xFF, sizeof(table->index));
+    table->count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        int index = colour_index(table, pixel_key(pixels + i * bands, bands), limit);
+        if (index < 0) {
+            free(table);
+            return 0;
+        }
+        indices[i] = (uint8_t)index;
+    }
+    for (int slot = 0; slot < (1 << COLOUR_SLOT_BITS); slot++) {
+        if (table->index[slot] >= 0) palette[table->index[slot]] = table->keys[slot];
+    }
+    *palette_size = table->count;
+    free(table);
+    return 1;
+}
+
+// Median cut over a pixel sample
+
+typedef struct {
+    int start;
+    int end;        // Exclusive
+    int channel;    // Widest channel
+    int range;
+} ColourBox;
+
+// One comparator per channel: qsort has no context argument, and a shared
+// "current channel" would race between concurrent calls
+#define CHANNEL_COMPARATOR(channel) \
+    static int compare_channel_##channel(const void* a, const void* b) { \
+        return key_channel(*(const uint32_t*)a, channel) - key_channel(*(const uint32_t*)b, channel); \
+    }
+CHANNEL_COMPARATOR(0)
+CHANNEL_COMPARATOR(1)
+CHANNEL_COMPARATOR(2)
+CHANNEL_COMPARATOR(3)
+
+static int (*const channel_comparators[4])(const void*, const void*) = {
+    compare_channel_0, compare_channel_1, compare_channel_2, compare_channel_3
+};
+
+static void measure_box(const uint32_t* samples, ColourBox* box) {
+    int low[4] = {255, 255, 255, 255};
+    int high[4] = {0, 0, 0, 0};
+    for (int i = box->start; i < box->end; i++) {
+        for (int c = 0; c < 4; c++) {
+            int value = key_channel(samples[i], c);
+            if (value < low[c]) low[c] = value;
+            if (value > high[c]) high[c] = value;
+        }
+    }
+    box->channel = 0;
+    box->range = -1;
+    for (int c = 0; c < 4; c++) {
+        if (high[c] - low[c] > box->range) {
+            box->range = high[c] - low[c];
+            box->channel = c;
+        }
+    }
+}
+
+int thinpic_median_cut(uint32_t* samples, int sample_count, int limit, uint32_t* palette) {
+    ColourBox boxes[PALETTE_MAX];
+    int box_count = 1;
+    boxes[0].start = 0;
+    boxes[0].end = sample_count;
+    measure_box(samples, &boxes[0]);
+
+    while (box_count < limit) {
+        // Split where the most pixels span the widest range
+        int best = -1;
+        double best_score = 0;
+        for (int b = 0; b < box_count; b++) {
+            double score = (double)boxes[b].range * (boxes[b].end - boxes[b].start);
+            if (boxes[b].end - boxes[b].start > 1 && boxes[b].range > 0 && score > best_score) {
+                best_score = score;
+                best = b;
+            }
+        }
+        if (best < 0) break;
+
+        ColourBox* box = &boxes[best];
+        qsort(samples + box->start, (size_t)(box->end - box->start), sizeof(uint32_t),
+              channel_comparators[box->channel]);
+        int median = box->start + (box->end - box->start) / 2;
+        boxes[box_count].start = median;
+        boxes[box_count].end = box->end;
+        box->end = median;
+        measure_box(samples, box);
+        measure_box(samples, &boxes[box_count]);
+        box_count++;
+    }
+
+    for (int b = 0; b < box_count; b++) {
+        double sum[4] = {0, 0, 0, 0};
+        for (int i = boxes[b].start; i < boxes[b].end; i++) {
+            for (int c = 0; c < 4; c++) sum[c] += key_channel(samples[i], c);
+        }
+        double n = boxes[b].end - boxes[b].start;
+        uint32_t colour = 0;
+        for (int c = 0; c < 4; c++) {
+            colour |= (uint32_t)(sum[c] / n + 0.5) << (c * 8);
+        }
+        palette[b] = colour;
+    }
+    return box_count;
+}
+
+static int nearest_colour(const uint32_t* palette, int palette_size, const int* rgba) {
+    int best = 0;
+    long best_distance = -1;
+    for (int i = 0; i < palette_size; i++) {
+        long distance = 0;
+        for (int c = 0; c < 4; c++) {
+            long d = rgba[c] - key_channel(palette[i], c);
+            distance += d * d;
+        }
+        if (best_distance < 0 || distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Map every pixel to the palette, spreading the error Floyd-Steinberg style
+// at dither / 100 strength. Nearest colours are cached per 5/5/5/4-bit cell.
+int thinpic_palette_map(const uint8_t* pixels, int width, int height, int bands,
+                        const uint32_t* palette, int palette_size, int dither, uint8_t* indices) {
+    int16_t* cache = (int16_t*)malloc(sizeof(int16_t) << CACHE_BITS);
+    int* errors = (int*)calloc((size_t)(width + 2) * 4 * 2, sizeof(int));
+    if (!cache || !errors) {
+        free(cache);
+        free(errors);
+        return -1;
+    }
+    memset(cache, 0xFF, sizeof(int16_t) << CACHE_BITS);
+    int transparent = -1;
+    for (int i = 0; i < palette_size; i++) {
+        if (palette[i] == 0) transparent = i;
+    }
+
+    for (int y = 0; y < height; y++) {
+        // Errors are kept in 1/16ths; this row's carried error, the next row's incoming
+        int* current = errors + (y & 1) * (width + 2) * 4;
+        int* next = errors + ((y + 1) & 1) * (width + 2) * 4;
+        memset(next, 0, sizeof(int) * (width + 2) * 4);
+        for (int x = 0; x < width; x++) {
+            const uint8_t* p = pixels + ((size_t)y * width + x) * bands;
+            size_t i = (size_t)y * width + x;
+            if (bands == 4 && p[3] == 0 && transparent >= 0) {
+                indices[i] = (uint8_t)transparent;
+                continue;
+            }
+
+            int rgba[4];
+            for (int c = 0; c < 4; c++) {
+                int value = c < 3 ? p[c] : (bands == 4 ? p[3] : 255);
+                value += current[(x + 1) * 4 + c] * dither / 1600;
+                rgba[c] = value < 0 ? 0 : (value > 255 ? 255 : value);
+            }
+            uint32_t cell = (uint32_t)(rgba[0] >> 3) | (uint32_t)(rgba[1] >> 3) << 5 |
+                            (uint32_t)(rgba[2] >> 3) << 10 | (uint32_t)(rgba[3] >> 4) << 15;
+            if (cache[cell] < 0) cache[cell] = (int16_t)nearest_colour(palette, palette_size, rgba);
+            int index = cache[cell];
+            indices[i] = (uint8_t)index;
+
+            if (dither <= 0) continue;
+            for (int c = 0; c < 4; c++) {
+                int error = rgba[c] - key_channel(palette[index], c);
+                current[(x + 2) * 4 + c] += error * 7;
+                next[x * 4 + c] += error * 3;
+                next[(x + 1) * 4 + c] += error * 5;
+                next[(x + 2) * 4 + c] += error;
+            }
+        }
+    }
+    free(cache);
+    free(errors);
+    return 0;
+}
+
+// Smallest PNG index depth that holds size entries
+static int index_depth(int size) {
+    if (size <= 2) return 1;
+    if (size <= 4) return 2;
+    if (size <= 16) return 4;
+    return 8;
+}
+
+static void set_metadata(spng_ctx* ctx, VipsImage* image, ThinpicStripPolicy strip) {
+    const void* data = NULL;
+    size_t length = 0;
+    if (strip != THINPIC_STRIP_ALL && vips_image_get_typeof(image, VIPS_META_ICC_NAME) &&
+            vips_image_get_blob(image, VIPS_META_ICC_NAME, &data, &length) == 0) {
+        struct spng_iccp iccp;
+        memset(&iccp, 0, sizeof(iccp));
+        strcpy(iccp.profile_name, "icc");
+        iccp.profile = (char*)data;
+        iccp.profile_len = length;
+        if (spng_set_iccp(ctx, &iccp)) THINPIC_LOGD("Palette PNG: ICC profile not written");
+    }
+    // libvips keeps the JPEG APP1 "Exif\0\0" prefix; eXIf holds the TIFF data alone
+    if (strip == THINPIC_STRIP_NONE && vips_image_get_typeof(image, VIPS_META_EXIF_NAME) &&
+            vips_image_get_blob(image, VIPS_META_EXIF_NAME, &data, &length) == 0) {
+        if (length > 6 && memcmp(data, "Exif\0\0", 6) == 0) {
+            data = (const uint8_t*)data + 6;
+            length -= 6;
+        }
+        struct spng_exif exif = {length, (char*)data};
+        if (spng_set_exif(ctx, &exif)) THINPIC_LOGD("Palette PNG: EXIF not written");
+    }
+}
+
+static int write_indexed_png(VipsImage* image, const ThinpicOptions* options, int compression,
+                             const uint32_t* colours, int palette_size, const uint8_t* indices,
+                             int width, int height, uint8_t** out, size_t* out_length) {
+    // Translucent entries first, so tRNS stops at the last of them
+    int order[PALETTE_MAX];
+    int remap[PALETTE_MAX];
+    int entries = 0;
+    for (int opaque = 0; opaque < 2; opaque++) {
+        for (int i = 0; i < palette_size; i++) {
+            if ((key_channel(colours[i], 3) == 255) != opaque) continue;
+            remap[i] = entries;
+            order[entries++] = i;
+        }
+    }
+    int trns_entries = 0;
+    struct spng_plte plte;
+    struct spng_trns trns;
+    memset(&plte, 0, sizeof(plte));
+    memset(&trns, 0, sizeof(trns));
+    plte.n_entries = (uint32_t)palette_size;
+    for (int e = 0; e < palette_size; e++) {
+        uint32_t colour = colours[order[e]];
+        plte.entries[e].red = (uint8_t)key_channel(colour, 0);
+        plte.entries[e].green = (uint8_t)key_channel(colour, 1);
+        plte.entries[e].blue = (uint8_t)key_channel(colour, 2);
+        trns.type3_alpha[e] = (uint8_t)key_channel(colour, 3);
+        if (trns.type3_alpha[e] != 255) trns_entries = e + 1;
+    }
+    trns.n_type3_entries = (uint32_t)trns_entries;
+
+    int depth = index_depth(palette_size);
+    if (options->png_bitdepth > depth) depth = options->png_bitdepth;
+    size_t row_bytes = ((size_t)width * depth + 7) / 8;
+    uint8_t* packed = (uint8_t*)calloc(row_bytes, (size_t)height);
+    if (!packed) return -1;
+    for (int y = 0; y < height; y++) {
+        uint8_t* row = packed + (size_t)y * row_bytes;
+        const uint8_t* source = indices + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            int bit = x * depth;
+            row[bit / 8] |= (uint8_t)(remap[source[x]] << (8 - depth - bit % 8));
+        }
+    }
+
+    spng_ctx* ctx = spng_ctx_new(SPNG_CTX_ENCODER);
+    if (!ctx) {
+        free(packed);
+        return -1;
+    }
+    struct spng_ihdr ihdr = {(uint32_t)width, (uint32_t)height, (uint8_t)depth, SPNG_COLOR_TYPE_INDEXED, 0, 0,
+                             options->progressive ? SPNG_INTERLACE_ADAM7 : SPNG_INTERLACE_NONE};
+    spng_set_option(ctx, SPNG_ENCODE_TO_BUFFER, 1);
+    spng_set_option(ctx, SPNG_IMG_COMPRESSION_LEVEL, compression);
+    int error = spng_set_ihdr(ctx, &ihdr);
+    if (!error) error = spng_set_plte(ctx, &plte);
+    if (!error && trns_entries > 0) error = spng_set_trns(ctx, &trns);
+    if (!error) {
+        set_metadata(ctx, image, options->strip);
+        error = spng_encode_image(ctx, packed, row_bytes * height, SPNG_FMT_PNG, SPNG_ENCODE_FINALIZE);
+    }
+    free(packed);
+
+    size_t length = 0;
+    void* png = error ? NULL : spng_get_png_buffer(ctx, &length, &error);
+    spng_ctx_free(ctx);
+    if (!png) {
+        THINPIC_LOGE("Error: Palette PNG encode failed: %s", spng_strerror(error));
+        return -1;
+    }
+
+    // Results are released with free_compressed_buffer (g_free)
+    *out = (uint8_t*)g_malloc(length);
+    memcpy(*out, png, length);
+    *out_length = length;
+    free(png);
+    THINPIC_LOGD("Palette PNG: %d colours, %d-bit, %zu bytes", palette_size, depth, length);
+    return 0;
+}
+
+// 8-bit sRGB with or without alpha
+VipsImage* thinpic_palette_input(VipsImage* image) {
+    VipsImage* current = image;
+    g_object_ref(current);
+    if (vips_image_get_bands(current) < 3) {
+        VipsImage* srgb = NULL;
+        int failed = vips_colourspace(current, &srgb, VIPS_INTERPRETATION_sRGB, NULL);
+        g_object_unref(current);
+        if (failed) return NULL;
+        current = srgb;
+    }
+    if (vips_image_get_bands(current) > 4) {
+        VipsImage* extracted = NULL;
+        int failed = vips_extract_band(current, &extracted, 0, "n", 4, NULL);
+        g_object_unref(current);
+        if (failed) return NULL;
+        current = extracted;
+    }
+    if (vips_image_get_format(current) != VIPS_FORMAT_UCHAR) {
+        VipsImage* cast = NULL;
+        int failed = vips_cast_uchar(current, &cast, NULL);
+        g_object_unref(current);
+        if (failed) return NULL;
+        current = cast;
+    }
+    return current;
+}
+
+int thinpic_png_palette(VipsImage* image, const ThinpicOptions* options, int compression,
+                        uint8_t** out, size_t* out_length) {
+    *out = NULL;
+    *out_length = 0;
+    VipsImage* input = thinpic_palette_input(image);
+    if (!input) return -1;
+
+    int width = vips_image_get_width(input);
+    int height = vips_image_get_height(input);
+    int bands = vips_image_get_bands(input);
+    size_t size = 0;
+    uint8_t* pixels = (uint8_t*)vips_image_write_to_memory(input, &size);
+    g_object_unref(input);
+    if (!pixels) return -1;
+
+    size_t count = (size_t)width * height;
+    int limit = options->png_bitdepth > 0 ? 1 << options->png_bitdepth : PALETTE_MAX;
+    uint32_t palette[PALETTE_MAX];
+    int palette_size = 0;
+    uint8_t* indices = (uint8_t*)malloc(count);
+    if (!indices) {
+        g_free(pixels);
+        return -1;
+    }
+
+    int status = 0;
+    if (thinpic_exact_palette(pixels, count, bands, limit, palette, &palette_size, indices)) {
+        THINPIC_LOGD("Palette PNG: exact palette of %d colours", palette_size);
+        status = 1;
+    } else if (options->png_palette == THINPIC_PNG_PALETTE_ON) {
+        int sample_count = count < QUANT_SAMPLES ? (int)count : QUANT_SAMPLES;
+        uint32_t* samples = (uint32_t*)malloc(sizeof(uint32_t) * sample_count);
+        if (samples) {
+            // An even spread over rows and columns (the stride is not a
+            // multiple of the width unless the image is tiny)
+            double stride = (double)count / sample_count;
+            for (int i = 0; i < sample_count; i++) {
+                samples[i] = pixel_key(pixels + (size_t)(i * stride) * bands, bands);
+            }
+            palette_size = thinpic_median_cut(samples, sample_count, limit, palette);
+            free(samples);
+            status = thinpic_palette_map(pixels, width, height, bands, palette, palette_size,
+                                         options->dither, indices) == 0 ? 1 : -1;
+        } else {
+            status = -1;
+        }
+    }
+    g_free(pixels);
+
+    if (status == 1 && write_indexed_png(image, options, compression, palette, palette_size, indices,
+                                         width, height, out, out_length) != 0) {
+        status = -1;
+    }
+    free(indices);
+    return status;
+}
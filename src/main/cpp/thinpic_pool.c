@@ -0,0 +1,1350 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Upper bound on pool workers; each libvips pipeline is itself threaded,
+// sized by the job's thread grant
+#define MAX_POOL_WORKERS 8
+
+// Scanlines a streaming job is assumed to hold when estimating its memory
+#define STREAM_ESTIMATE_ROWS 256
+
+// Size classes for queue order, in decoded pixels: phone photos, large
+// photos, DSLR frames, and panoramas above that
+#define SIZE_CLASS_SMALL (4 * 1000 * 1000)
+#define SIZE_CLASS_MEDIUM (16 * 1000 * 1000)
+#define SIZE_CLASS_LARGE (48 * 1000 * 1000)
+
+// Times a queued job may be passed by smaller ones of its priority before
+// it keeps its place (aging), so a panorama still starts in a busy batch
+#define MAX_OVERTAKEN 16
+
+// Queued jobs looked at behind a head that does not fit the memory budget
+#define PACK_WINDOW 32
+
+// Queued file inputs read ahead (thinpic_readahead) when a job starts
+#define READ_AHEAD_JOBS 4
+
+// compress_batch items queued beyond one per worker before the caller's
+// thread stops probing headers and waits for one to finish
+#define BATCH_QUEUE_AHEAD 8
+
+// Clients whose running jobs are counted for fair scheduling; jobs of more
+// clients than this at once start in queue order
+#define MAX_TRACKED_CLIENTS 32
+
+// Shared state of one compress_batch or compress_pages call
+typedef struct {
+    CompressedImageResult* out;
+    int remaining;
+} BatchContext;
+
+// The input of a submitted job as it was at submission, for coalescing:
+// the same regular file (by device and inode, unchanged since) or bytes
+// of the same length, compared in full when everything else matches.
+// Pipes are never matched.
+typedef struct {
+    int matchable;
+    int64_t device;
+    int64_t inode;
+    int64_t size;
+    int64_t mtime_ns;
+    ThinpicCacheKey content;     // Hash of a buffer job's bytes
+} JobIdentity;
+
+typedef struct Job {
+    int64_t id;
+    char* input_path;
+    uint8_t* input_data;        // Owned copy of the caller's bytes for buffer jobs
+    size_t input_length;
+    int input_fd;               // Owned duplicate of the caller's descriptor, or -1
+    char* output_path;          // Set for file jobs; the result then carries no data
+    CompressOptions options;
+    JobStatus status;
+    CompressedImageResult result;
+    CompressionStats stats;
+    ThinpicError error;         // Why a FAILED or CANCELLED job did not finish
+    struct Job* next_in_table;  // All jobs not yet claimed by poll/wait
+    struct Job* next_in_queue;  // Pending jobs, interactive ones first, each class in submission order
+    BatchContext* batch;        // Set for batch items, which never enter the table
+    int batch_index;
+    int64_t estimated_bytes;    // Working-set estimate charged against memory_budget
+    int64_t pixels;             // Decoded size from the header, for queue order and thread grant
+    int size_class;             // 0 (small) to 3 (panorama); smaller classes queue first
+    int overtaken;              // Smaller jobs queued ahead of this one so far
+    int read_ahead;             // Its input was read ahead while queued
+    ThinpicCancelToken* cancel; // Bound to the worker thread while the job runs
+    ThinpicJobCallback on_finished; // thinpic_watch_job; called once, outside pool_mutex
+    // A job submitted while an identical one (same input, options and
+    // output) is pending or running never enters the queue: it follows
+    // that leader and gets a copy of its outcome, so the encoder runs once
+    JobIdentity identity;
+    struct Job* leader;         // The job this one follows, until it finishes
+    struct Job* followers;      // Duplicates waiting on this job
+    struct Job* next_follower;
+    int abandoned;              // Cancelled while running for followers; reports CANCELLED itself
+} Job;
+
+// A completion callback to run once pool_mutex is released
+typedef struct {
+    ThinpicJobCallback callback;
+    int64_t id;
+    int status;
+} FinishNotice;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_finished = PTHREAD_COND_INITIALIZER;
+
+static pthread_t pool_workers[MAX_POOL_WORKERS];
+static int pool_worker_count = 0;
+static int pool_stopping = 0;
+
+static Job* job_table = NULL;
+static Job* queue_head = NULL;
+static Job* queue_tail = NULL;
+static int64_t next_job_id = 1;
+
+// Admission control (thinpic_configure); both guarded by pool_mutex
+static int64_t memory_budget = 0;
+static int64_t in_flight_bytes = 0;
+static int running_jobs = 0;
+static int running_background = 0;
+// Thread budget (thinpic_threads.c): online cores, and the libvips threads
+// granted to running jobs out of it. Guarded by pool_mutex.
+static int pool_cpu_count = 1;
+static int granted_threads = 0;
+// thinpic_pool_hold_background: CLOCK_MONOTONIC ms until which background
+// jobs stay queued; 0 = not held. Guarded by pool_mutex.
+static int64_t background_hold_until = 0;
+// Running jobs per pool client (CompressOptions.client), for clients that
+// have any; guarded by pool_mutex
+typedef struct {
+    int client;
+    int running;
+} ClientLoad;
+static ClientLoad client_loads[MAX_TRACKED_CLIENTS];
+static int client_load_count = 0;
+static int next_client_id = 1;
+
+// Write an encoded buffer to output_path via a sibling temp file and rename,
+// so readers never see a partial image. The temp name is unique per write
+// (mkstemp), so jobs racing to the same destination never share one, and
+// the data is synced before the rename publishes it; the last rename wins.
+// The file is allocated at its final size before the write. Returns 0 on
+// success.
+int thinpic_output_temp(const char* output_path, char** temp_path) {
+    size_t path_length = strlen(output_path);
+    *temp_path = (char*)malloc(path_length + 13);
+    if (!*temp_path) return -1;
+    memcpy(*temp_path, output_path, path_length);
+    memcpy(*temp_path + path_length, ".part.XXXXXX", 13);
+
+    int fd = mkstemp(*temp_path);
+    if (fd < 0) {
+        thinpic_error_code(THINPIC_ERROR_IO);
+        THINPIC_LOGE("Error: Cannot create output file: %s", *temp_path);
+        free(*temp_path);
+        *temp_path = NULL;
+        return -1;
+    }
+    // mkstemp creates 0600; reading umask would race other threads' creates
+    fchmod(fd, 0644);
+    return fd;
+}
+
+int thinpic_output_commit(int fd, char* temp_path, const char* output_path, int written) {
+    // fsync covers whatever wrote through another descriptor (a libvips saver)
+    int synced = written ? fsync(fd) : -1;
+    int closed = close(fd);
+    int failed = synced != 0 || closed != 0 || rename(temp_path, output_path) != 0;
+    if (failed) {
+        if (written) {
+            thinpic_error_code(THINPIC_ERROR_IO);
+            THINPIC_LOGE("Error: Failed to write output file: %s", output_path);
+        }
+        unlink(temp_path);
+    }
+    free(temp_path);
+    return failed ? -1 : 0;
+}
+
+static int write_buffer_to_file(const uint8_t* data, size_t length, const char* output_path) {
+    char* temp_path = NULL;
+    int fd = thinpic_output_temp(output_path, &temp_path);
+    if (fd < 0) return -1;
+    // The size is known: one extent instead of growing write by write
+    thinpic_preallocate(fd, length);
+
+    size_t written = 0;
+    while (written < length) {
+        ssize_t count = write(fd, data + written, length - written);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) break;
+        written += (size_t)count;
+    }
+    if (written != length) {
+        thinpic_error_code(THINPIC_ERROR_IO);
+        THINPIC_LOGE("Error: Failed to write output file: %s", output_path);
+    }
+    return thinpic_output_commit(fd, temp_path, output_path, written == length);
+}
+
+// Run options and, for file jobs, move the encoded bytes to disk. A file
+// result has data NULL and length set to the number of bytes written.
+static CompressedImageResult run_job(const ThinpicInput* input, const char* output_path, const CompressOptions* options,
+                                     CompressionStats* stats) {
+    CompressedImageResult result = thinpic_compress_input(input, options, stats);
+    if (!output_path || result.success != 1) {
+        return result;
+    }
+
+    int write_failed = write_buffer_to_file(result.data, result.length, output_path);
+    free_compressed_buffer(result.data);
+    result.data = NULL;
+    if (write_failed) {
+        result.length = 0;
+        result.success = -1;
+    }
+    return result;
+}
+
+// Whether a loader decodes the whole frame before the pipeline reads a
+// pixel, rather than strips on demand
+static int decodes_whole_frame(int format) {
+    return format == FORMAT_WEBP || format == FORMAT_HEIF || format == FORMAT_AVIF || format == FORMAT_JXL ||
+           format == FORMAT_GIF || format == FORMAT_JP2K;
+}
+
+// Whether a saver holds the whole output frame; the others stream strips
+static int encodes_whole_frame(int format) {
+    return decodes_whole_frame(format);
+}
+
+int64_t thinpic_pool_working_set(int width, int height, int bands, int source_format,
+                                 const CompressOptions* options) {
+    int64_t pixel_bytes = bands > 3 ? bands : 3;
+    int64_t frame = (int64_t)width * height * pixel_bytes;
+    // Tiles and line buffers of the render threads
+    int64_t strips = (int64_t)width * pixel_bytes * STREAM_ESTIMATE_ROWS;
+    switch (options->mode) {
+        case COMPRESS_MODE_SMART:
+        case COMPRESS_MODE_AUTO:
+            // The decoded copy the search encodes from, and a candidate
+            return frame * 2;
+        case COMPRESS_MODE_LOSSLESS_JPEG:
+        case COMPRESS_MODE_JPEG_OPTIMIZE:
+            // Source and destination coefficient arrays, 2 bytes per coefficient
+            return frame * 4;
+        default:
+            break;
+    }
+
+    // The sized modes fit a box and never upscale
+    double scale = 1.0;
+    int sized = options->mode == COMPRESS_MODE_STANDARD || options->mode == COMPRESS_MODE_THUMBNAIL;
+    if (sized && options->target_width > 0 && options->target_width < width) {
+        scale = (double)options->target_width / width;
+    }
+    if (sized && options->target_height > 0 && options->target_height < height) {
+        scale = fmin(scale, (double)options->target_height / height);
+    }
+    double output_area = scale * scale;
+    // JPEG and WebP shrink while decoding, JPEG to the power of two above
+    // the box: at most twice the output's side
+    double decoded_area = 1.0;
+    if (scale < 0.5 && (source_format == FORMAT_JPEG || source_format == FORMAT_WEBP)) {
+        decoded_area = source_format == FORMAT_WEBP ? output_area : output_area * 4;
+    }
+
+    int output_format = options->format == FORMAT_AUTO ? source_format : (int)options->format;
+    int64_t bytes = strips;
+    if (decodes_whole_frame(source_format)) bytes += (int64_t)(frame * decoded_area);
+    if (encodes_whole_frame(output_format)) bytes += (int64_t)(frame * output_area);
+    return bytes;
+}
+
+// Decoded size, size class and working set of a job from one header probe.
+// Buffer and descriptor inputs are not probed: their decoded size is taken
+// as 8x encoded and, for a buffer, the format is sniffed.
+static void job_measure(Job* job, const ThinpicInput* input) {
+    ImageHeader header = {0};
+    if (input->path) {
+        header = probe_image_header(input->path);
+    } else {
+        int64_t length = (int64_t)input->length;
+        struct stat file_stat;
+        if (!input->data) length = fstat(input->fd, &file_stat) == 0 ? (int64_t)file_stat.st_size : 0;
+        int side = (int)sqrt(length * 8 / 3.0);
+        header.width = side;
+        header.height = side;
+        header.bands = 3;
+        header.format = input->data ? thinpic_sniff_format(input->data, input->length) : FORMAT_AUTO;
+        header.success = length > 0;
+    }
+    if (header.success != 1) return;
+    job->pixels = (int64_t)header.width * header.height;
+    job->size_class = job->pixels < SIZE_CLASS_SMALL ? 0 : job->pixels < SIZE_CLASS_MEDIUM ? 1
+                    : job->pixels < SIZE_CLASS_LARGE ? 2 : 3;
+    job->estimated_bytes = thinpic_pool_working_set(header.width, header.height, header.bands, header.format,
+                                                    &job->options);
+}
+
+// Threads for a job about to run: its size against what is left of the
+// budget, kept back for the jobs queued behind it that idle workers could
+// start. Thermal throttling shrinks the budget as it caps the jobs. Called
+// with pool_mutex held.
+static int take_thread_grant(int64_t pixels, int thermal_level) {
+    int budget = thinpic_thermal_worker_cap(thermal_level, pool_cpu_count);
+    int idle = pool_worker_count - running_jobs;
+    int contenders = 0;
+    for (Job* job = queue_head; job && contenders < idle; job = job->next_in_queue) contenders++;
+    int grant = thinpic_thread_grant(pixels, budget - granted_threads, contenders);
+    granted_threads += grant;
+    return grant;
+}
+
+static ThinpicInput job_input(const Job* job) {
+    ThinpicInput input = {.path = job->input_path, .data = job->input_data, .length = job->input_length,
+                          .fd = job->input_fd};
+    return input;
+}
+
+static int64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Milliseconds left on the background hold, 0 once it has run out. Called
+// with pool_mutex held.
+static int64_t background_hold_remaining() {
+    if (background_hold_until == 0) return 0;
+    int64_t remaining = background_hold_until - monotonic_ms();
+    if (remaining > 0) return remaining;
+    background_hold_until = 0;
+    return 0;
+}
+
+// Whether a queued job may start now: 1 when it may, 0 when the background
+// hold or the thermal job cap stops it, -1 when only memory does. An idle
+// pool always admits so that a single oversized image still runs. Called
+// with pool_mutex held.
+static int can_start(const Job* job) {
+    if (!job) return 0;
+    // Interactive jobs queue ahead of background ones, so a held background
+    // job at the head has only background jobs behind it
+    if (job->options.priority == THINPIC_PRIORITY_BACKGROUND && background_hold_remaining() > 0) return 0;
+    int cap = thinpic_thermal_worker_cap(thinpic_thermal_level(), pool_worker_count);
+    if (running_jobs >= cap) return 0;
+    // Background work never takes the last worker, so an interactive job
+    // submitted mid-batch starts at once
+    if (job->options.priority == THINPIC_PRIORITY_BACKGROUND && cap > 1 && running_background >= cap - 1) {
+        return 0;
+    }
+    if (memory_budget <= 0 || in_flight_bytes == 0) return 1;
+    return in_flight_bytes + job->estimated_bytes <= memory_budget ? 1 : -1;
+}
+
+static int client_running(int client) {
+    for (int i = 0; i < client_load_count; i++) {
+        if (client_loads[i].client == client) return client_loads[i].running;
+    }
+    return 0;
+}
+
+// Count a job of client starting (delta 1) or finishing (-1); a client
+// drops out of the table once nothing of it runs
+static void client_load_add(int client, int delta) {
+    for (int i = 0; i < client_load_count; i++) {
+        if (client_loads[i].client != client) continue;
+        client_loads[i].running += delta;
+        if (client_loads[i].running <= 0) client_loads[i] = client_loads[--client_load_count];
+        return;
+    }
+    if (delta > 0 && client_load_count < MAX_TRACKED_CLIENTS) {
+        client_loads[client_load_count++] = (ClientLoad){client, delta};
+    }
+}
+
+// The queue head, or the first job of its priority from the client with the
+// fewest jobs running: each client's jobs keep their order, and the clients
+// take turns at the workers. Called with pool_mutex held.
+static Job* fair_head() {
+    Job* head = queue_head;
+    if (!head || client_load_count == 0) return head;
+    int fewest = client_running(head->options.client);
+    for (Job* job = head->next_in_queue; job && fewest > 0 && job->options.priority == head->options.priority;
+            job = job->next_in_queue) {
+        int running = client_running(job->options.client);
+        if (running < fewest) {
+            head = job;
+            fewest = running;
+        }
+    }
+    return head;
+}
+
+// The job to start next: the fair head when it may start, else the first of
+// the next PACK_WINDOW queued jobs that fits the memory left, so small
+// images pack around a large one that is waiting for memory. Once the head
+// has been passed MAX_OVERTAKEN times nothing more goes around it, and it
+// runs as soon as the others have drained. Called with pool_mutex held.
+static Job* next_to_start() {
+    Job* head = fair_head();
+    int status = can_start(head);
+    if (status >= 0) return status ? head : NULL;
+    if (head->overtaken >= MAX_OVERTAKEN) return NULL;
+    int scanned = 0;
+    for (Job* job = head->next_in_queue; job && scanned < PACK_WINDOW; job = job->next_in_queue, scanned++) {
+        status = can_start(job);
+        if (status == 0) return NULL;
+        if (status > 0) {
+            for (Job* passed = head; passed != job; passed = passed->next_in_queue) passed->overtaken++;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void job_identify(Job* job) {
+    struct stat file_stat;
+    if (job->input_data) {
+        job->identity.matchable = 1;
+        job->identity.size = (int64_t)job->input_length;
+        // Here, before pool_mutex: find_leader compares hashes under it
+        thinpic_hash_bytes(job->input_data, job->input_length, &job->identity.content);
+        return;
+    }
+    int found = job->input_path ? stat(job->input_path, &file_stat) == 0 : fstat(job->input_fd, &file_stat) == 0;
+    if (!found || !S_ISREG(file_stat.st_mode)) return;
+    job->identity.matchable = 1;
+    job->identity.device = (int64_t)file_stat.st_dev;
+    job->identity.inode = (int64_t)file_stat.st_ino;
+    job->identity.size = (int64_t)file_stat.st_size;
+    job->identity.mtime_ns = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+}
+
+// Options that produce the same output; priority and client only place a
+// job in the queue
+static int same_output_options(const CompressOptions* a, const CompressOptions* b) {
+    CompressOptions left = *a;
+    CompressOptions right = *b;
+    left.priority = right.priority = 0;
+    left.client = right.client = 0;
+    return memcmp(&left, &right, sizeof(left)) == 0;
+}
+
+// A pending or running job that job duplicates, for it to follow; NULL when
+// there is none. Called with pool_mutex held.
+static Job* find_leader(const Job* job) {
+    if (!job->identity.matchable) return NULL;
+    for (Job* other = job_table; other; other = other->next_in_table) {
+        if (other == job || other->leader || other->abandoned || !other->identity.matchable ||
+                (other->status != JOB_STATUS_PENDING && other->status != JOB_STATUS_RUNNING) ||
+                thinpic_cancel_is_set(other->cancel)) {
+            continue;
+        }
+        const JobIdentity* a = &job->identity;
+        const JobIdentity* b = &other->identity;
+        if ((job->input_data != NULL) != (other->input_data != NULL) || a->device != b->device ||
+                a->inode != b->inode || a->size != b->size || a->mtime_ns != b->mtime_ns ||
+                a->content.high != b->content.high || a->content.low != b->content.low) {
+            continue;
+        }
+        if ((job->output_path != NULL) != (other->output_path != NULL) ||
+                (job->output_path && strcmp(job->output_path, other->output_path) != 0)) {
+            continue;
+        }
+        if (!same_output_options(&job->options, &other->options)) continue;
+        // Bytes compared only once the hashes match, which all but a duplicate miss
+        if (job->input_data && memcmp(job->input_data, other->input_data, job->input_length) != 0) continue;
+        return other;
+    }
+    return NULL;
+}
+
+static Job* new_job() {
+    Job* job = (Job*)calloc(1, sizeof(Job));
+    if (!job) return NULL;
+    job->input_fd = -1;
+    job->cancel = thinpic_cancel_token_new();
+    return job;
+}
+
+static void free_job(Job* job) {
+    free(job->input_path);
+    free(job->input_data);
+    if (job->input_fd >= 0) close(job->input_fd);
+    free(job->output_path);
+    thinpic_cancel_token_free(job->cancel);
+    free(job);
+}
+
+// Run the job's completion callback, if any, with pool_mutex released; the
+// job may be claimed and freed meanwhile. Called with pool_mutex held.
+static void notify_finished(Job* job) {
+    ThinpicJobCallback callback = job->on_finished;
+    if (!callback) return;
+    job->on_finished = NULL;
+    int64_t id = job->id;
+    int status = job->status;
+    pthread_mutex_unlock(&pool_mutex);
+    callback(id, status);
+    pthread_mutex_lock(&pool_mutex);
+}
+
+// Give a finished leader's outcome to each of its followers, each with its
+// own copy of the bytes, and detach them. Their callbacks are returned in a
+// malloc'd array (*count entries) for notify_all, or NULL. Called with
+// pool_mutex held.
+static FinishNotice* share_result(Job* job, int* count) {
+    *count = 0;
+    int followers = 0;
+    for (Job* follower = job->followers; follower; follower = follower->next_follower) followers++;
+    FinishNotice* notices = followers > 0 ? (FinishNotice*)malloc(sizeof(FinishNotice) * followers) : NULL;
+    Job* follower = job->followers;
+    job->followers = NULL;
+    while (follower) {
+        Job* next = follower->next_follower;
+        follower->leader = NULL;
+        follower->next_follower = NULL;
+        follower->result = job->result;
+        follower->stats = job->stats;
+        // Nothing was encoded for it
+        follower->stats.encode_attempts = 0;
+        follower->error = job->error;
+        follower->status = job->status;
+        if (job->result.data) {
+            follower->result.data = (uint8_t*)g_try_malloc(job->result.length);
+            if (follower->result.data) {
+                memcpy(follower->result.data, job->result.data, job->result.length);
+            } else {
+                follower->result.length = 0;
+                follower->result.success = -1;
+                follower->status = JOB_STATUS_FAILED;
+                follower->error.code = THINPIC_ERROR_FAILED;
+                snprintf(follower->error.message, sizeof(follower->error.message), "Out of memory");
+            }
+        }
+        if (follower->on_finished && notices) {
+            notices[*count].callback = follower->on_finished;
+            notices[*count].id = follower->id;
+            notices[*count].status = follower->status;
+            (*count)++;
+            follower->on_finished = NULL;
+        }
+        follower = next;
+    }
+    return notices;
+}
+
+// Run and free share_result's callbacks, with pool_mutex released. Called
+// with pool_mutex held.
+static void notify_all(FinishNotice* notices, int count) {
+    if (!notices) return;
+    pthread_mutex_unlock(&pool_mutex);
+    for (int i = 0; i < count; i++) notices[i].callback(notices[i].id, notices[i].status);
+    pthread_mutex_lock(&pool_mutex);
+    free(notices);
+}
+
+static void cancelled_error(ThinpicError* error) {
+    error->code = THINPIC_ERROR_CANCELLED;
+    snprintf(error->message, sizeof(error->message), "Cancelled");
+}
+
+static void timeout_error(ThinpicError* error, int timeout_ms) {
+    error->code = THINPIC_ERROR_TIMEOUT;
+    snprintf(error->message, sizeof(error->message), "Stopped after the %d ms job time limit", timeout_ms);
+}
+
+// Sleep until work is signalled or, with a background job held at the head
+// of the queue, until the hold runs out. Called with pool_mutex held.
+static void wait_for_work() {
+    int64_t remaining = queue_head ? background_hold_remaining() : 0;
+    if (remaining <= 0) {
+        pthread_cond_wait(&work_available, &pool_mutex);
+        return;
+    }
+    // The condition variable times out against the realtime clock
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += remaining / 1000;
+    deadline.tv_nsec += (remaining % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&work_available, &pool_mutex, &deadline);
+}
+
+// Claim up to READ_AHEAD_JOBS queued file inputs not yet read ahead, as
+// copies that outlive a cancelled job; returns how many. Called with
+// pool_mutex held.
+static int claim_read_ahead(char** paths, int* fds) {
+    int count = 0;
+    for (Job* job = queue_head; job && count < READ_AHEAD_JOBS; job = job->next_in_queue) {
+        if (job->read_ahead || (!job->input_path && job->input_fd < 0)) continue;
+        job->read_ahead = 1;
+        paths[count] = job->input_path ? strdup(job->input_path) : NULL;
+        fds[count] = job->input_path ? -1 : dup(job->input_fd);
+        if (paths[count] || fds[count] >= 0) count++;
+    }
+    return count;
+}
+
+static void read_ahead(char** paths, int* fds, int count) {
+    for (int i = 0; i < count; i++) {
+        thinpic_readahead(paths[i], fds[i]);
+        free(paths[i]);
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+// Unlink a pending job from the queue; must be called with pool_mutex held
+static void dequeue_job(Job* job) {
+    Job* previous = NULL;
+    for (Job* queued = queue_head; queued; previous = queued, queued = queued->next_in_queue) {
+        if (queued != job) continue;
+        if (previous) {
+            previous->next_in_queue = job->next_in_queue;
+        } else {
+            queue_head = job->next_in_queue;
+        }
+        if (queue_tail == job) queue_tail = previous;
+        job->next_in_queue = NULL;
+        return;
+    }
+}
+
+static void* pool_worker_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_mutex);
+    for (;;) {
+        Job* job = NULL;
+        while (!pool_stopping && !(job = next_to_start())) {
+            wait_for_work();
+        }
+        if (pool_stopping) break;
+
+        dequeue_job(job);
+        job->status = JOB_STATUS_RUNNING;
+        for (Job* follower = job->followers; follower; follower = follower->next_follower) {
+            follower->status = JOB_STATUS_RUNNING;
+        }
+        int64_t charged = job->estimated_bytes;
+        in_flight_bytes += charged;
+        running_jobs++;
+        client_load_add(job->options.client, 1);
+        int background = job->options.priority == THINPIC_PRIORITY_BACKGROUND;
+        running_background += background;
+        int thermal_level = thinpic_thermal_level();
+        int threads = take_thread_grant(job->pixels, thermal_level);
+        // Part of a batch: read ahead for it, or jobs waiting behind it
+        int batched = job->read_ahead || queue_head != NULL;
+        char* ahead_paths[READ_AHEAD_JOBS];
+        int ahead_fds[READ_AHEAD_JOBS];
+        int ahead = claim_read_ahead(ahead_paths, ahead_fds);
+        pthread_mutex_unlock(&pool_mutex);
+        read_ahead(ahead_paths, ahead_fds, ahead);
+
+        ThinpicInput input = job_input(job);
+        CompressionStats stats = {0};
+        THINPIC_LOGD("Job %lld: %d libvips threads for %lld pixels", (long long)job->id, threads,
+                     (long long)job->pixels);
+        thinpic_cancel_bind(job->cancel);
+        thinpic_progress_bind(job->id);
+        thinpic_thermal_bind(thermal_level);
+        thinpic_threads_bind(threads);
+        thinpic_thread_set_priority(job->options.priority);
+        int timeout_ms = thinpic_job_timeout_ms();
+        thinpic_cancel_arm(job->cancel, timeout_ms);
+        CompressedImageResult result = run_job(&input, job->output_path, &job->options, &stats);
+        thinpic_cancel_disarm(job->cancel);
+        ThinpicError error = {THINPIC_ERROR_NONE, ""};
+        if (result.success != 1) thinpic_error_take(&error);
+        thinpic_threads_bind(0);
+        thinpic_thermal_bind(0);
+        thinpic_progress_bind(0);
+        thinpic_cancel_bind(NULL);
+        // A batch's originals are read once; keep them from evicting the app's files
+        if (batched) thinpic_readahead_drop(job->input_path, job->input_fd);
+
+        pthread_mutex_lock(&pool_mutex);
+        in_flight_bytes -= charged;
+        running_jobs--;
+        client_load_add(job->options.client, -1);
+        running_background -= background;
+        granted_threads -= threads;
+        if (charged > 0 || thermal_level > 0 || background) {
+            // Memory or a background slot freed up, or the device may have
+            // cooled; a waiting job may fit now
+            pthread_cond_broadcast(&work_available);
+        }
+        if (job->batch) {
+            job->batch->out[job->batch_index] = result;
+            job->batch->remaining--;
+            free_job(job);
+            job = NULL;
+        } else {
+            job->stats = stats;
+            // A job that finished as its deadline passed keeps its result
+            int timed_out = thinpic_cancel_timed_out(job->cancel);
+            if (timed_out && result.success != 1) {
+                // A failure, not a cancel: nobody asked for it
+                if (result.data) free_compressed_buffer(result.data);
+                job->result.success = -1;
+                job->status = JOB_STATUS_FAILED;
+                timeout_error(&job->error, timeout_ms);
+            } else if (!timed_out && thinpic_cancel_is_set(job->cancel)) {
+                // Whatever the pipeline managed before the kill is discarded
+                if (result.data) free_compressed_buffer(result.data);
+                job->result.success = -1;
+                job->status = JOB_STATUS_CANCELLED;
+                cancelled_error(&job->error);
+            } else {
+                job->result = result;
+                job->status = result.success == 1 ? JOB_STATUS_DONE : JOB_STATUS_FAILED;
+                job->error = error;
+            }
+        }
+        int notice_count = 0;
+        FinishNotice* notices = job ? share_result(job, &notice_count) : NULL;
+        if (job && job->abandoned) {
+            // It ran on for its followers only
+            if (job->result.data) free_compressed_buffer(job->result.data);
+            job->result.data = NULL;
+            job->result.success = -1;
+            job->status = JOB_STATUS_CANCELLED;
+            cancelled_error(&job->error);
+        }
+        pthread_cond_broadcast(&job_finished);
+        if (job) notify_finished(job);
+        notify_all(notices, notice_count);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+// Start the workers on first use; must be called with pool_mutex held
+static int ensure_pool_started() {
+    if (pool_worker_count > 0) return 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = cpus > 0 ? (int)cpus : 1;
+    pool_cpu_count = wanted;
+    if (wanted > MAX_POOL_WORKERS) wanted = MAX_POOL_WORKERS;
+
+    pool_stopping = 0;
+    for (int i = 0; i < wanted; i++) {
+        if (pthread_create(&pool_workers[pool_worker_count], NULL, pool_worker_main, NULL) != 0) {
+            THINPIC_LOGE("Error: Failed to start pool worker %d", i);
+            break;
+        }
+        pool_worker_count++;
+    }
+
+    THINPIC_LOGI("Worker pool started with %d threads", pool_worker_count);
+    return pool_worker_count > 0;
+}
+
+// Remove a job from the table; must be called with pool_mutex held
+static Job* take_job(int64_t job_id) {
+    Job** link = &job_table;
+    while (*link) {
+        if ((*link)->id == job_id) {
+            Job* job = *link;
+            *link = job->next_in_table;
+            return job;
+        }
+        link = &(*link)->next_in_table;
+    }
+    return NULL;
+}
+
+static int job_status_final(JobStatus status) {
+    return status == JOB_STATUS_DONE || status == JOB_STATUS_FAILED || status == JOB_STATUS_CANCELLED;
+}
+
+static Job* find_job(int64_t job_id) {
+    for (Job* job = job_table; job; job = job->next_in_table) {
+        if (job->id == job_id) return job;
+    }
+    return NULL;
+}
+
+// Whether a queued job gives way to a new one: background jobs to every
+// interactive one, and within a priority larger size classes to smaller ones
+// until they have aged
+static int gives_way(const Job* queued, const Job* job) {
+    int interactive = job->options.priority != THINPIC_PRIORITY_BACKGROUND;
+    if (queued->options.priority != job->options.priority) {
+        return interactive && queued->options.priority == THINPIC_PRIORITY_BACKGROUND;
+    }
+    return queued->size_class > job->size_class && queued->overtaken < MAX_OVERTAKEN;
+}
+
+// Add a job to the pending queue, after the last one that does not give way
+// to it, so jobs of the same priority and size class keep submission order;
+// must be called with pool_mutex held
+static void enqueue_job(Job* job) {
+    Job* previous = NULL;
+    for (Job* queued = queue_head; queued; queued = queued->next_in_queue) {
+        if (!gives_way(queued, job)) previous = queued;
+    }
+    Job* next = previous ? previous->next_in_queue : queue_head;
+    for (Job* queued = next; queued; queued = queued->next_in_queue) {
+        if (queued->options.priority == job->options.priority) queued->overtaken++;
+    }
+    job->next_in_queue = next;
+    if (previous) {
+        previous->next_in_queue = job;
+    } else {
+        queue_head = job;
+    }
+    if (!next) queue_tail = job;
+}
+
+// Hand a pending leader's place in the queue to its first follower, which
+// leads the others from then on; must be called with pool_mutex held
+static void promote_follower(Job* job) {
+    Job* heir = job->followers;
+    heir->leader = NULL;
+    heir->followers = heir->next_follower;
+    heir->next_follower = NULL;
+    for (Job* follower = heir->followers; follower; follower = follower->next_follower) {
+        follower->leader = heir;
+    }
+    job->followers = NULL;
+    heir->next_in_queue = job;
+    if (queue_head == job) {
+        queue_head = heir;
+    } else {
+        Job* previous = queue_head;
+        while (previous->next_in_queue != job) previous = previous->next_in_queue;
+        previous->next_in_queue = heir;
+    }
+}
+
+// Queue a job that already owns its input; frees it if the pool is unavailable
+static int64_t submit_job(Job* job, const char* output_path, const CompressOptions* options) {
+    if (output_path) job->output_path = strdup(output_path);
+    if (output_path && !job->output_path) {
+        free_job(job);
+        return -1;
+    }
+    job->options = *options;
+    job->status = JOB_STATUS_PENDING;
+    job->result.success = -1;
+    ThinpicInput input = job_input(job);
+    job_measure(job, &input);
+    job_identify(job);
+
+    pthread_mutex_lock(&pool_mutex);
+    if (!ensure_pool_started()) {
+        pthread_mutex_unlock(&pool_mutex);
+        free_job(job);
+        return -1;
+    }
+
+    job->id = next_job_id++;
+    Job* leader = find_leader(job);
+    job->next_in_table = job_table;
+    job_table = job;
+    int64_t id = job->id;
+    if (leader) {
+        job->leader = leader;
+        job->status = leader->status;
+        job->next_follower = leader->followers;
+        leader->followers = job;
+        pthread_mutex_unlock(&pool_mutex);
+        THINPIC_LOGD("Job %lld coalesced with job %lld", (long long)id, (long long)leader->id);
+        return id;
+    }
+    enqueue_job(job);
+
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&pool_mutex);
+    return id;
+}
+
+static int64_t submit_path_job(const char* input_path, const char* output_path, const CompressOptions* options) {
+    if (!input_path || strlen(input_path) == 0 || !options) {
+        THINPIC_LOGE("Error: Invalid job arguments");
+        return -1;
+    }
+
+    Job* job = new_job();
+    if (!job) return -1;
+    job->input_path = strdup(input_path);
+    if (!job->input_path) {
+        free_job(job);
+        return -1;
+    }
+    return submit_job(job, output_path, options);
+}
+
+int64_t thinpic_submit_job(const char* input_path, const CompressOptions* options) {
+    return submit_path_job(input_path, NULL, options);
+}
+
+int64_t thinpic_submit_file_job(const char* input_path, const char* output_path, const CompressOptions* options) {
+    if (!output_path || strlen(output_path) == 0) {
+        THINPIC_LOGE("Error: Invalid output path");
+        return -1;
+    }
+    return submit_path_job(input_path, output_path, options);
+}
+
+int thinpic_submit_file_jobs(const char* const* input_paths, const char* const* output_paths, int count,
+                             const CompressOptions* options, int options_count, int64_t* job_ids) {
+    if (!input_paths || !output_paths || count < 0 || !options || !job_ids ||
+        (options_count != 1 && options_count != count)) {
+        THINPIC_LOGE("Error: Invalid batch job arguments");
+        return -1;
+    }
+    int submitted = 0;
+    for (int i = 0; i < count; i++) {
+        const CompressOptions* item_options = options_count == 1 ? options : options + i;
+        job_ids[i] = thinpic_submit_file_job(input_paths[i], output_paths[i], item_options);
+        if (job_ids[i] >= 0) submitted++;
+    }
+    return submitted;
+}
+
+int64_t thinpic_submit_buffer_job(const uint8_t* data, size_t length, const CompressOptions* options) {
+    if (!data || length == 0 || !options) {
+        THINPIC_LOGE("Error: Invalid job arguments");
+        return -1;
+    }
+
+    // Copy so the caller may release its buffer as soon as this returns
+    Job* job = new_job();
+    if (!job) return -1;
+    job->input_data = (uint8_t*)malloc(length);
+    if (!job->input_data) {
+        free_job(job);
+        return -1;
+    }
+    memcpy(job->input_data, data, length);
+    job->input_length = length;
+    return submit_job(job, NULL, options);
+}
+
+int64_t thinpic_submit_fd_job(int fd, const CompressOptions* options) {
+    if (fd < 0 || !options) {
+        THINPIC_LOGE("Error: Invalid job arguments");
+        return -1;
+    }
+
+    // A duplicate keeps the file open after the caller closes its descriptor
+    Job* job = new_job();
+    if (!job) return -1;
+    job->input_fd = dup(fd);
+    if (job->input_fd < 0) {
+        THINPIC_LOGE("Error: Cannot duplicate descriptor %d", fd);
+        free_job(job);
+        return -1;
+    }
+    return submit_job(job, NULL, options);
+}
+
+JobStatus thinpic_poll_job_ex(int64_t job_id, CompressedImageResultEx* out) {
+    pthread_mutex_lock(&pool_mutex);
+    Job* job = find_job(job_id);
+    if (!job) {
+        pthread_mutex_unlock(&pool_mutex);
+        return JOB_STATUS_UNKNOWN;
+    }
+
+    JobStatus status = job->status;
+    if (job_status_final(status)) {
+        take_job(job_id);
+        pthread_mutex_unlock(&pool_mutex);
+        if (out) {
+            out->result = job->result;
+            out->stats = job->stats;
+            out->error = job->error;
+        } else if (job->result.data) {
+            free_compressed_buffer(job->result.data);
+        }
+        free_job(job);
+        return status;
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+    return status;
+}
+
+int thinpic_cancel_job(int64_t job_id) {
+    pthread_mutex_lock(&pool_mutex);
+    Job* job = find_job(job_id);
+    if (!job || job_status_final(job->status)) {
+        pthread_mutex_unlock(&pool_mutex);
+        return -1;
+    }
+
+    if (job->leader) {
+        // Only this copy goes; the leader runs on for the rest
+        Job** link = &job->leader->followers;
+        while (*link != job) link = &(*link)->next_follower;
+        *link = job->next_follower;
+        job->leader = NULL;
+        job->next_follower = NULL;
+        job->status = JOB_STATUS_CANCELLED;
+        cancelled_error(&job->error);
+        pthread_cond_broadcast(&job_finished);
+        notify_finished(job);
+    } else if (job->status == JOB_STATUS_PENDING) {
+        if (job->followers) promote_follower(job);
+        dequeue_job(job);
+        job->status = JOB_STATUS_CANCELLED;
+        cancelled_error(&job->error);
+        pthread_cond_broadcast(&job_finished);
+        notify_finished(job);
+    } else if (job->followers) {
+        // Killing the pipeline would fail its followers too
+        job->abandoned = 1;
+    } else {
+        // The worker reports CANCELLED once the killed pipeline unwinds
+        thinpic_cancel_request(job->cancel);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    THINPIC_LOGD("Job %lld cancelled", (long long)job_id);
+    return 0;
+}
+
+int thinpic_watch_job(int64_t job_id, ThinpicJobCallback callback) {
+    pthread_mutex_lock(&pool_mutex);
+    Job* job = find_job(job_id);
+    if (!job) {
+        pthread_mutex_unlock(&pool_mutex);
+        return -1;
+    }
+    job->on_finished = callback;
+    if (job_status_final(job->status)) notify_finished(job);
+    pthread_mutex_unlock(&pool_mutex);
+    return 0;
+}
+
+JobStatus thinpic_wait_job_ex(int64_t job_id, CompressedImageResultEx* out) {
+    pthread_mutex_lock(&pool_mutex);
+    Job* job = find_job(job_id);
+    while (job && !job_status_final(job->status)) {
+        pthread_cond_wait(&job_finished, &pool_mutex);
+        job = find_job(job_id);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (!job) return JOB_STATUS_UNKNOWN;
+    return thinpic_poll_job_ex(job_id, out);
+}
+
+// The plain forms only differ in dropping the stats
+static JobStatus strip_stats(JobStatus status, const CompressedImageResultEx* ex, CompressedImageResult* out) {
+    if (!job_status_final(status)) return status;
+    if (out) {
+        *out = ex->result;
+    } else if (ex->result.data) {
+        free_compressed_buffer(ex->result.data);
+    }
+    return status;
+}
+
+JobStatus thinpic_poll_job(int64_t job_id, CompressedImageResult* out) {
+    CompressedImageResultEx ex = {.result.success = -1};
+    return strip_stats(thinpic_poll_job_ex(job_id, &ex), &ex, out);
+}
+
+JobStatus thinpic_wait_job(int64_t job_id, CompressedImageResult* out) {
+    CompressedImageResultEx ex = {.result.success = -1};
+    return strip_stats(thinpic_wait_job_ex(job_id, &ex), &ex, out);
+}
+
+// Wait, with pool_mutex held, until every queued item of a batch has
+// finished; releases the lock and returns how many of out's `count` succeeded
+static int finish_batch(BatchContext* batch, int count, const char* what) {
+    while (batch->remaining > 0) {
+        pthread_cond_wait(&job_finished, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    int succeeded = 0;
+    for (int i = 0; i < count; i++) {
+        if (batch->out[i].success == 1) succeeded++;
+    }
+    THINPIC_LOGI("Batch finished: %d/%d %s succeeded", succeeded, count, what);
+    return succeeded;
+}
+
+// Queue a chain of batch jobs (linked through next_in_queue) and block
+// until every one has finished. Returns how many of out's `count` succeeded,
+// or -1 when the pool cannot start.
+static int run_batch(Job* first, BatchContext* batch, int count, const char* what) {
+    pthread_mutex_lock(&pool_mutex);
+    if (!ensure_pool_started()) {
+        pthread_mutex_unlock(&pool_mutex);
+        while (first) {
+            Job* next = first->next_in_queue;
+            free_job(first);
+            first = next;
+        }
+        return -1;
+    }
+
+    while (first) {
+        Job* next = first->next_in_queue;
+        first->next_in_queue = NULL;
+        enqueue_job(first);
+        batch->remaining++;
+        first = next;
+    }
+
+    THINPIC_LOGD("Batch of %d %s queued on %d workers", batch->remaining, what, pool_worker_count);
+    pthread_cond_broadcast(&work_available);
+    return finish_batch(batch, count, what);
+}
+
+int compress_batch(const char** input_paths, int count, const CompressOptions* options, CompressedImageResult* out) {
+    if (!input_paths || count <= 0 || !options || !out) {
+        THINPIC_LOGE("Error: Invalid batch arguments");
+        return -1;
+    }
+
+    BatchContext batch = {out, 0};
+    CompressedImageResult failed = {NULL, 0, -1};
+    pthread_mutex_lock(&pool_mutex);
+    int started = ensure_pool_started();
+    pthread_mutex_unlock(&pool_mutex);
+    if (!started) return -1;
+
+    // Each item is queued as soon as its header is probed, so the workers
+    // decode and encode the first images while this thread parses the next
+    // ones and read-ahead fetches those after them. The queue between the
+    // two stages holds at most BATCH_QUEUE_AHEAD items more than there are
+    // workers; size classes reorder within that window only.
+    for (int i = 0; i < count; i++) {
+        out[i] = failed;
+        if (!input_paths[i] || strlen(input_paths[i]) == 0) continue;
+
+        Job* job = new_job();
+        if (job) job->input_path = strdup(input_paths[i]);
+        if (!job || !job->input_path) {
+            if (job) free_job(job);
+            continue;
+        }
+        job->options = *options;
+        job->status = JOB_STATUS_PENDING;
+        job->batch = &batch;
+        job->batch_index = i;
+        ThinpicInput input = {.path = input_paths[i], .fd = -1};
+        job_measure(job, &input);
+
+        pthread_mutex_lock(&pool_mutex);
+        while (!pool_stopping && pool_worker_count > 0 &&
+               batch.remaining >= pool_worker_count + BATCH_QUEUE_AHEAD) {
+            pthread_cond_wait(&job_finished, &pool_mutex);
+        }
+        if (pool_stopping || pool_worker_count == 0) {
+            // Shut down meanwhile; nothing would run it
+            pthread_mutex_unlock(&pool_mutex);
+            free_job(job);
+            continue;
+        }
+        enqueue_job(job);
+        batch.remaining++;
+        pthread_cond_signal(&work_available);
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    THINPIC_LOGD("Last of %d images queued on %d workers", count, pool_worker_count);
+    return finish_batch(&batch, count, "images");
+}
+
+int compress_pages(const char* input_path, int first_page, int count, const CompressOptions* options,
+                   CompressedImageResult* out) {
+    if (!input_path || strlen(input_path) == 0 || first_page < 0 || count <= 0 || !options || !out) {
+        THINPIC_LOGE("Error: Invalid compress_pages arguments");
+        return -1;
+    }
+
+    BatchContext batch = {out, 0};
+    CompressedImageResult failed = {NULL, 0, -1};
+
+    // One job per page, each opening only its own page, so the pool's memory
+    // budget holds the document to as many decoded pages as it admits. The
+    // header probe reads the first page; the others are charged the same.
+    Job* first = NULL;
+    Job** link = &first;
+    for (int i = 0; i < count; i++) {
+        out[i] = failed;
+        Job* job = new_job();
+        if (job) job->input_path = strdup(input_path);
+        if (!job || !job->input_path) {
+            if (job) free_job(job);
+            continue;
+        }
+        job->options = *options;
+        job->options.page = first_page + i;
+        job->status = JOB_STATUS_PENDING;
+        job->batch = &batch;
+        job->batch_index = i;
+        if (!first) {
+            ThinpicInput input = {.path = input_path, .fd = -1};
+            job_measure(job, &input);
+        } else {
+            job->pixels = first->pixels;
+            job->size_class = first->size_class;
+            job->estimated_bytes = first->estimated_bytes;
+        }
+        *link = job;
+        link = &job->next_in_queue;
+    }
+    return run_batch(first, &batch, count, "pages");
+}
+
+int thinpic_write_output(const uint8_t* data, size_t length, const char* output_path) {
+    return write_buffer_to_file(data, length, output_path);
+}
+
+int64_t compress_to_file(const char* input_path, const char* output_path, const CompressOptions* options) {
+    if (!input_path || strlen(input_path) == 0 || !output_path || strlen(output_path) == 0 || !options) {
+        THINPIC_LOGE("Error: Invalid compress_to_file arguments");
+        return -1;
+    }
+
+    ThinpicInput input = {.path = input_path, .fd = -1};
+    CompressedImageResult result = run_job(&input, output_path, options, NULL);
+    if (result.success != 1) {
+        return -1;
+    }
+    THINPIC_LOGI("Wrote %zu bytes to %s", result.length, output_path);
+    return (int64_t)result.length;
+}
+
+CompressedImageResultEx compress_with_stats(const char* input_path, const CompressOptions* options) {
+    CompressedImageResultEx out = {.result.success = -1};
+    if (!input_path || strlen(input_path) == 0 || !options) {
+        THINPIC_LOGE("Error: Invalid compress_with_stats arguments");
+        return out;
+    }
+
+    ThinpicInput input = {.path = input_path, .fd = -1};
+    out.result = run_job(&input, NULL, options, &out.stats);
+    if (out.result.success != 1) thinpic_error_take(&out.error);
+    return out;
+}
+
+CompressedImageResultEx compress_with_profile(const char* input_path, const CompressOptions* options,
+                                              ThinpicProfile* profile) {
+    CompressedImageResultEx out = {.result.success = -1};
+    if (!input_path || strlen(input_path) == 0 || !options || !profile) {
+        THINPIC_LOGE("Error: Invalid compress_with_profile arguments");
+        return out;
+    }
+
+    ThinpicInput input = {.path = input_path, .fd = -1};
+    thinpic_profile_begin(profile);
+    out.result = run_job(&input, NULL, options, &out.stats);
+    thinpic_profile_end();
+    if (out.result.success != 1) thinpic_error_take(&out.error);
+    return out;
+}
+
+void thinpic_pool_set_memory_budget(int64_t bytes) {
+    pthread_mutex_lock(&pool_mutex);
+    memory_budget = bytes > 0 ? bytes : 0;
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void thinpic_pool_hold_background(int64_t milliseconds) {
+    pthread_mutex_lock(&pool_mutex);
+    background_hold_until = milliseconds > 0 ? monotonic_ms() + milliseconds : 0;
+    // Released jobs start now; held ones are looked at again by the workers'
+    // timed wait
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void thinpic_pool_activity(int* workers, int* running, int* queued, int64_t* in_flight) {
+    pthread_mutex_lock(&pool_mutex);
+    int pending = 0;
+    for (Job* job = queue_head; job; job = job->next_in_queue) pending++;
+    *workers = pool_worker_count;
+    *running = running_jobs;
+    *queued = pending;
+    *in_flight = in_flight_bytes;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+int thinpic_pool_client() {
+    pthread_mutex_lock(&pool_mutex);
+    int client = next_client_id++;
+    pthread_mutex_unlock(&pool_mutex);
+    return client;
+}
+
+int thinpic_pool_size() {
+    pthread_mutex_lock(&pool_mutex);
+    int count = pool_worker_count;
+    pthread_mutex_unlock(&pool_mutex);
+    return count;
+}
+
+void thinpic_shutdown_pool() {
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_worker_count == 0) {
+        pthread_mutex_unlock(&pool_mutex);
+        return;
+    }
+    pool_stopping = 1;
+    pthread_cond_broadcast(&work_available);
+    int count = pool_worker_count;
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (int i = 0; i < count; i++) {
+        pthread_join(pool_workers[i], NULL);
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    pool_worker_count = 0;
+    // Queued batch items never ran; release their waiting compress_batch call
+    for (Job* job = queue_head; job;) {
+        Job* next = job->next_in_queue;
+        if (job->batch) {
+            job->batch->remaining--;
+            free_job(job);
+        }
+        job = next;
+    }
+    // Jobs still queued never ran; finished but unclaimed jobs own a buffer
+    while (job_table) {
+        Job* job = job_table;
+        job_table = job->next_in_table;
+        if (job->result.data) {
+            free_compressed_buffer(job->result.data);
+        }
+        // Unlinked already, so a watcher's poll finds nothing to claim
+        if (!job_status_final(job->status)) job->status = JOB_STATUS_CANCELLED;
+        notify_finished(job);
+        free_job(job);
+    }
+    queue_head = queue_tail = NULL;
+    pthread_cond_broadcast(&job_finished);
+    pthread_mutex_unlock(&pool_mutex);
+    THINPIC_LOGI("Worker pool stopped");
+}
@@ -0,0 +1,127 @@
+// Tuning presets (thinpic_presets_load). The caps and quality ladders of
+// the CompressMode functions used to be literals, so trying other values
+// meant shipping a release. Now an app loads a table from its remote
+// config (the Dart side parses the JSON) and rolls values out by
+// experiment arm. The table is copied in once. A job resolves its preset
+// id against it when it starts and keeps the merged values in a
+// thread-local for the whole dispatch, so reloading mid-batch never
+// changes a running job and the hot path does no lookups beyond that one.
+
+#include <pthread.h>
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+static const ThinpicTuning builtin_tuning = {0, 6000, 8000, {85, 95, 60, 30}, 85, 40};
+
+static pthread_mutex_t presets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThinpicPreset presets[THINPIC_PRESET_MAX];
+static int preset_count = 0;
+static int default_preset = 0;
+
+static __thread ThinpicTuning bound_tuning;
+static __thread int bound = 0;
+
+static int valid_quality(int quality) {
+    return quality >= 0 && quality <= 100;
+}
+
+static int valid_preset(const ThinpicPreset* preset) {
+    if (preset->id == 0 || preset->max_dimension < 0 || preset->minimal_max_dimension < 0 ||
+            !valid_quality(preset->search_start_quality) || !valid_quality(preset->search_end_quality)) {
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!valid_quality(preset->smart_quality[i])) return 0;
+    }
+    // A search needs a range to go down through
+    int start = preset->search_start_quality ? preset->search_start_quality : builtin_tuning.search_start_quality;
+    int end = preset->search_end_quality ? preset->search_end_quality : builtin_tuning.search_end_quality;
+    return end <= start && memchr(preset->name, '\0', sizeof(preset->name)) != NULL;
+}
+
+int thinpic_presets_load(const ThinpicPreset* table, int count, int default_id) {
+    if (count < 0 || count > THINPIC_PRESET_MAX || (count > 0 && !table)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Invalid preset table (%d entries, at most %d)", count, THINPIC_PRESET_MAX);
+        return -1;
+    }
+    int default_found = default_id == 0;
+    for (int i = 0; i < count; i++) {
+        int duplicate = 0;
+        for (int j = 0; j < i; j++) duplicate |= table[j].id == table[i].id;
+        if (duplicate || !valid_preset(&table[i])) {
+            thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+            THINPIC_LOGE("Error: Invalid preset %d (entry %d)", table[i].id, i);
+            return -1;
+        }
+        default_found |= table[i].id == default_id;
+    }
+    if (!default_found) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Default preset %d is not in the table", default_id);
+        return -1;
+    }
+    pthread_mutex_lock(&presets_mutex);
+    if (count > 0) memcpy(presets, table, sizeof(ThinpicPreset) * (size_t)count);
+    preset_count = count;
+    default_preset = default_id;
+    pthread_mutex_unlock(&presets_mutex);
+    THINPIC_LOGI("Presets loaded: %d, default %d", count, default_id);
+    return count;
+}
+
+int thinpic_preset_id(const char* name) {
+    if (!name) return 0;
+    int id = 0;
+    pthread_mutex_lock(&presets_mutex);
+    for (int i = 0; i < preset_count && !id; i++) {
+        if (strcmp(presets[i].name, name) == 0) id = presets[i].id;
+    }
+    pthread_mutex_unlock(&presets_mutex);
+    return id;
+}
+
+// The built-in values with those `preset` sets laid over them
+static void merge(const ThinpicPreset* preset, ThinpicTuning* out) {
+    *out = builtin_tuning;
+    out->preset = preset->id;
+    if (preset->max_dimension) out->max_dimension = preset->max_dimension;
+    if (preset->minimal_max_dimension) out->minimal_max_dimension = preset->minimal_max_dimension;
+    for (int i = 0; i < 4; i++) {
+        if (preset->smart_quality[i]) out->smart_quality[i] = preset->smart_quality[i];
+    }
+    if (preset->search_start_quality) out->search_start_quality = preset->search_start_quality;
+    if (preset->search_end_quality) out->search_end_quality = preset->search_end_quality;
+}
+
+static void resolve(int id, ThinpicTuning* out) {
+    *out = builtin_tuning;
+    pthread_mutex_lock(&presets_mutex);
+    int wanted = id ? id : default_preset;
+    int found = wanted == 0;
+    for (int i = 0; i < preset_count && !found; i++) {
+        if (presets[i].id == wanted) {
+            merge(&presets[i], out);
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&presets_mutex);
+    // An arm the config no longer carries runs on the built-in values
+    if (!found) THINPIC_LOGW("Preset %d is not loaded; using the built-in values", wanted);
+}
+
+void thinpic_tuning_bind(int preset) {
+    resolve(preset, &bound_tuning);
+    bound = 1;
+}
+
+void thinpic_tuning_unbind(void) {
+    bound = 0;
+}
+
+const ThinpicTuning* thinpic_tuning(void) {
+    if (!bound) resolve(0, &bound_tuning);
+    return &bound_tuning;
+}
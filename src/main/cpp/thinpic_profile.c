@@ -0,0 +1,192 @@
+// Operation-level profiling (compress_with_profile). Stage timings say which
+// phase of a job is slow; this says which libvips operation. While a
+// profile is active, the postbuild hook counts every operation built and
+// swaps its output image's generate function for one that times each call.
+// The time a generate spends waiting on its inputs' generates, on the same
+// thread, is taken off, so each operation is charged only for its own pixel
+// code, as vips_profile does per thread. libvips keeps no per-job identity
+// on its worker threads, so the profile is process-wide: profiled jobs run
+// one at a time, and anything else compressing meanwhile is counted too.
+// When the job ends the original generate functions go back, so images that
+// outlive it cost nothing from then on.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Generates nested deeper than this on one thread are charged to the
+// outermost timed one
+#define MAX_DEPTH 64
+
+typedef struct {
+    VipsGenerateFn generate;     // The operation's own
+    int op;                      // Slot in the active profile
+} WrappedImage;
+
+// Profiled jobs one at a time; held for the whole job
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+// The wrapped images and the active profile's figures
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable* wrapped = NULL;
+static ThinpicProfile* active = NULL;
+static pthread_t profile_threads[THINPIC_PROFILE_MAX_THREADS];
+static int profiling = 0;
+
+static __thread int depth = 0;
+static __thread int64_t child_us[MAX_DEPTH];
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Slot for operation `name`, the last one standing in for the rest once
+// the table is full. Called with profile_mutex held.
+static int op_slot(const char* name) {
+    for (int i = 0; i < active->op_count; i++) {
+        if (strcmp(active->ops[i].name, name) == 0) return i;
+    }
+    if (active->op_count == THINPIC_PROFILE_MAX_OPS) return THINPIC_PROFILE_MAX_OPS - 1;
+    int slot = active->op_count++;
+    g_strlcpy(active->ops[slot].name, slot == THINPIC_PROFILE_MAX_OPS - 1 ? "(other)" : name,
+              sizeof(active->ops[slot].name));
+    return slot;
+}
+
+// Called with profile_mutex held
+static void add_thread_time(int64_t elapsed) {
+    pthread_t self = pthread_self();
+    for (int i = 0; i < active->thread_count; i++) {
+        if (pthread_equal(profile_threads[i], self)) {
+            active->thread_busy_us[i] += elapsed;
+            return;
+        }
+    }
+    if (active->thread_count == THINPIC_PROFILE_MAX_THREADS) return;
+    profile_threads[active->thread_count] = self;
+    active->thread_busy_us[active->thread_count++] = elapsed;
+}
+
+static int timed_generate(VipsRegion* out, void* seq, void* a, void* b, gboolean* stop) {
+    pthread_mutex_lock(&profile_mutex);
+    WrappedImage* entry = wrapped ? g_hash_table_lookup(wrapped, out->im) : NULL;
+    VipsGenerateFn generate = entry ? entry->generate : NULL;
+    int op = entry ? entry->op : -1;
+    int timed = active && depth < MAX_DEPTH;
+    pthread_mutex_unlock(&profile_mutex);
+    // Always found: entries outlive the image's last generate
+    if (!generate) return -1;
+    if (!timed) return generate(out, seq, a, b, stop);
+
+    int64_t started = now_us();
+    child_us[depth++] = 0;
+    int result = generate(out, seq, a, b, stop);
+    depth--;
+    int64_t elapsed = now_us() - started;
+    if (depth > 0) child_us[depth - 1] += elapsed;
+
+    pthread_mutex_lock(&profile_mutex);
+    // The job may have ended while this region was computed
+    if (active) {
+        ThinpicProfileOp* stats = &active->ops[op];
+        stats->time_us += elapsed - child_us[depth];
+        stats->regions++;
+        stats->pixels += (int64_t)out->valid.width * out->valid.height;
+        if (depth == 0) add_thread_time(elapsed);
+    }
+    pthread_mutex_unlock(&profile_mutex);
+    return result;
+}
+
+static void forget_image(gpointer data, GObject* image) {
+    (void)data;
+    pthread_mutex_lock(&profile_mutex);
+    g_hash_table_remove(wrapped, image);
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+// Called with profile_mutex held
+static void wrap_image(VipsImage* image, int op) {
+    WrappedImage* entry = g_hash_table_lookup(wrapped, image);
+    if (entry) {
+        // Wrapped by an earlier profile and restored since
+        entry->op = op;
+        image->generate_fn = timed_generate;
+        return;
+    }
+    // Memory and file images compute nothing
+    if (!image->generate_fn || image->generate_fn == timed_generate) return;
+    entry = g_new(WrappedImage, 1);
+    entry->generate = image->generate_fn;
+    entry->op = op;
+    g_hash_table_insert(wrapped, image, entry);
+    g_object_weak_ref(G_OBJECT(image), forget_image, NULL);
+    image->generate_fn = timed_generate;
+}
+
+gboolean thinpic_profile_postbuild(GSignalInvocationHint* hint, guint count, const GValue* params, gpointer data) {
+    (void)hint;
+    (void)data;
+    if (!__atomic_load_n(&profiling, __ATOMIC_ACQUIRE) || count == 0) return TRUE;
+    GObject* object = g_value_get_object(&params[0]);
+    if (!VIPS_IS_OPERATION(object)) return TRUE;
+
+    VipsImage* out = NULL;
+    GParamSpec* spec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), "out");
+    if (spec && G_PARAM_SPEC_VALUE_TYPE(spec) == VIPS_TYPE_IMAGE) g_object_get(object, "out", &out, NULL);
+
+    pthread_mutex_lock(&profile_mutex);
+    if (active) {
+        int op = op_slot(VIPS_OBJECT_GET_CLASS(object)->nickname);
+        active->ops[op].calls++;
+        if (out) wrap_image(out, op);
+    }
+    pthread_mutex_unlock(&profile_mutex);
+    if (out) g_object_unref(out);
+    return TRUE;
+}
+
+void thinpic_profile_begin(ThinpicProfile* profile) {
+    pthread_mutex_lock(&job_mutex);
+    memset(profile, 0, sizeof(*profile));
+    // Operations the cache would hand back are never built again, so
+    // nothing would count them
+    vips_cache_drop_all();
+    pthread_mutex_lock(&profile_mutex);
+    if (!wrapped) wrapped = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    active = profile;
+    pthread_mutex_unlock(&profile_mutex);
+    __atomic_store_n(&profiling, 1, __ATOMIC_RELEASE);
+}
+
+static int by_time(const void* a, const void* b) {
+    int64_t left = ((const ThinpicProfileOp*)a)->time_us;
+    int64_t right = ((const ThinpicProfileOp*)b)->time_us;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void thinpic_profile_end(void) {
+    __atomic_store_n(&profiling, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&profile_mutex);
+    ThinpicProfile* profile = active;
+    active = NULL;
+    // Back to the operations' own generates; an entry stays until its
+    // image goes, for a region that read the wrapper just before
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, wrapped);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        ((VipsImage*)key)->generate_fn = ((WrappedImage*)value)->generate;
+    }
+    pthread_mutex_unlock(&profile_mutex);
+    qsort(profile->ops, (size_t)profile->op_count, sizeof(profile->ops[0]), by_time);
+    THINPIC_LOGD("Profile: %d operations on %d threads; slowest %s (%lld us)", profile->op_count,
+                 profile->thread_count, profile->op_count ? profile->ops[0].name : "-",
+                 profile->op_count ? (long long)profile->ops[0].time_us : 0LL);
+    pthread_mutex_unlock(&job_mutex);
+}
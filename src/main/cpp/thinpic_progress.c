@@ -0,0 +1,113 @@
+#include <vips/vips.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "image_compressor.h"
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Images below this many pixels finish too fast for progress to matter,
+// so they never get the eval signal enabled
+#define PROGRESS_MIN_PIXELS (4 * 1024 * 1024)
+#define DEFAULT_PROGRESS_INTERVAL_MS 100
+// Roots watched per job (loaded image and shrink-on-load thumbnail)
+#define MAX_PROGRESS_WATCHES 4
+
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThinpicProgressCallback progress_callback = NULL;
+static int progress_interval_ms = DEFAULT_PROGRESS_INTERVAL_MS;
+
+// Job running on this thread; 0 for direct (non-pool) calls, which are
+// never watched
+static __thread int64_t current_job_id = 0;
+
+// Handlers connected for the current job. Images can outlive the job in the
+// operation cache, so they are disconnected when the job ends; the watch
+// holds a reference until then so the image cannot go away underneath it.
+typedef struct {
+    VipsImage* image;
+    gulong handler;
+} ProgressWatch;
+
+static __thread ProgressWatch watches[MAX_PROGRESS_WATCHES];
+static __thread int watch_count = 0;
+
+// Per watched image; freed when the signal handler is disconnected
+typedef struct {
+    ThinpicProgressCallback callback;
+    int64_t job_id;
+    int interval_ms;
+    double last_report_ms;
+    int last_percent;
+} ProgressState;
+
+static double progress_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void thinpic_set_progress_callback(ThinpicProgressCallback callback, int min_interval_ms) {
+    pthread_mutex_lock(&progress_mutex);
+    progress_callback = callback;
+    progress_interval_ms = min_interval_ms > 0 ? min_interval_ms : DEFAULT_PROGRESS_INTERVAL_MS;
+    pthread_mutex_unlock(&progress_mutex);
+}
+
+void thinpic_progress_bind(int64_t job_id) {
+    if (job_id == 0) {
+        for (int i = 0; i < watch_count; i++) {
+            g_signal_handler_disconnect(watches[i].image, watches[i].handler);
+            vips_image_set_progress(watches[i].image, FALSE);
+            g_object_unref(watches[i].image);
+        }
+        watch_count = 0;
+    }
+    current_job_id = job_id;
+}
+
+// "eval" handler; libvips raises it on the root for every downstream sink.
+// Throttled per image, except that completion is always reported.
+static void progress_eval(VipsImage* image, VipsProgress* progress, gpointer user_data) {
+    (void)image;
+    ProgressState* state = (ProgressState*)user_data;
+    int percent = progress->percent;
+    if (percent == state->last_percent) return;
+
+    double now = progress_now_ms();
+    if (percent < 100 && now - state->last_report_ms < state->interval_ms) return;
+
+    state->last_report_ms = now;
+    state->last_percent = percent;
+    state->callback(state->job_id, percent);
+}
+
+static void progress_state_free(gpointer data, GClosure* closure) {
+    (void)closure;
+    g_free(data);
+}
+
+void thinpic_progress_watch(VipsImage* image) {
+    if (!image || current_job_id == 0 || watch_count >= MAX_PROGRESS_WATCHES) return;
+
+    pthread_mutex_lock(&progress_mutex);
+    ThinpicProgressCallback callback = progress_callback;
+    int interval_ms = progress_interval_ms;
+    pthread_mutex_unlock(&progress_mutex);
+    if (!callback) return;
+
+    int64_t pixels = (int64_t)vips_image_get_width(image) * vips_image_get_height(image);
+    if (pixels < PROGRESS_MIN_PIXELS) return;
+
+    ProgressState* state = g_new0(ProgressState, 1);
+    state->callback = callback;
+    state->job_id = current_job_id;
+    state->interval_ms = interval_ms;
+    state->last_percent = -1;
+    watches[watch_count].image = image;
+    g_object_ref(image);
+    watches[watch_count].handler = g_signal_connect_data(image, "eval", G_CALLBACK(progress_eval),
+                                                         state, progress_state_free, 0);
+    watch_count++;
+    vips_image_set_progress(image, TRUE);
+}
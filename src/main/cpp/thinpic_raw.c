@@ -0,0 +1,323 @@
+// Embedded previews of camera RAW files. DNG, CR2, NEF, ARW, PEF and ORF
+// files are TIFF containers. Their sensor data is CFA mosaic or lossless
+// JPEG, which tiffload either rejects or opens as the small thumbnail in
+// IFD0, and a real demosaic would take seconds. But cameras also store a
+// JPEG of the developed picture, usually at full size, in IFD0 (CR2), in
+// a SubIFD (DNG, NEF) or behind JPEGInterchangeFormat (ARW, PEF). The IFDs
+// are walked with a few small reads, the largest such JPEG is chosen, and
+// when it covers at least half of the sensor's long side it takes the
+// RAW's place as the pipeline input. From there it is a normal JPEG with
+// shrink-on-load and every other fast path. The RAW's orientation lives in
+// its IFD0 rather than in the preview, so it is written into the copy as a
+// minimal EXIF segment. Files that are not RAW, or whose previews are too
+// small, are left to libvips as before.
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define MAX_IFDS 32                 // Directories visited per file
+#define MAX_ENTRIES 1024            // Entries read per directory
+#define MAX_SUB_IFDS 8              // SubIFD offsets followed per directory
+#define SOF_SEARCH_BYTES 65536      // Marker bytes read when a preview's SOF is looked for
+#define PREVIEW_MIN_SIDE 1024       // Below this the preview is a thumbnail, not a picture
+#define PREVIEW_MAX_BYTES (256u << 20)
+
+#define TAG_SUBFILE_TYPE 0x00FE
+#define TAG_WIDTH 0x0100
+#define TAG_HEIGHT 0x0101
+#define TAG_COMPRESSION 0x0103
+#define TAG_PHOTOMETRIC 0x0106
+#define TAG_STRIP_OFFSETS 0x0111
+#define TAG_ORIENTATION 0x0112
+#define TAG_STRIP_BYTES 0x0117
+#define TAG_SUB_IFDS 0x014A
+#define TAG_JPEG_OFFSET 0x0201
+#define TAG_JPEG_LENGTH 0x0202
+#define TAG_JPEG_FROM_RAW 0x002E    // Panasonic RW2: the JPEG is the tag's value
+#define TAG_DNG_VERSION 0xC612
+
+// Byte source: memory when the input has it, else preads of a descriptor
+typedef struct {
+    const uint8_t* data;
+    int fd;
+    uint64_t length;
+    int big_endian;
+} RawReader;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+    int width;
+    int height;
+} Preview;
+
+typedef struct {
+    int raw;                        // Evidence that this is a RAW, not an ordinary TIFF
+    int orientation;
+    int sensor_side;                // Longest side any directory declares
+    Preview best;
+    uint32_t visited[MAX_IFDS];
+    int visited_count;
+} RawScan;
+
+static int read_at(const RawReader* reader, uint64_t offset, void* buffer, size_t length) {
+    if (offset > reader->length || length > reader->length - offset) return 0;
+    if (reader->data) {
+        memcpy(buffer, reader->data + offset, length);
+        return 1;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t got = pread(reader->fd, (uint8_t*)buffer + done, length - done, (off_t)(offset + done));
+        if (got <= 0) return 0;
+        done += (size_t)got;
+    }
+    return 1;
+}
+
+static unsigned int get_u16(const RawReader* reader, const uint8_t* p) {
+    return reader->big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t get_u32(const RawReader* reader, const uint8_t* p) {
+    return reader->big_endian
+        ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+        : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+// First value of a SHORT or LONG entry
+static uint32_t entry_value(const RawReader* reader, const uint8_t* entry) {
+    unsigned int type = get_u16(reader, entry + 2);
+    if (type == 3) return get_u16(reader, entry + 8);
+    if (type == 4 || type == 13) return get_u32(reader, entry + 8);
+    return 0;
+}
+
+static uint32_t entry_count(const RawReader* reader, const uint8_t* entry) {
+    return get_u32(reader, entry + 4);
+}
+
+// Dimensions from the SOF of a JPEG at offset; 0 for lossless JPEG (the
+// sensor data of CR2 and DNG) and anything that is not a JPEG at all
+static int preview_dimensions(const RawReader* reader, Preview* preview) {
+    size_t length = preview->length < SOF_SEARCH_BYTES ? (size_t)preview->length : SOF_SEARCH_BYTES;
+    uint8_t* head = g_malloc(length);
+    int found = 0;
+    if (length >= 4 && read_at(reader, preview->offset, head, length) && head[0] == 0xFF && head[1] == 0xD8) {
+        size_t offset = 2;
+        while (offset + 4 <= length) {
+            if (head[offset] != 0xFF) break;
+            int marker = head[offset + 1];
+            if (marker == 0xFF) {
+                offset++;
+                continue;
+            }
+            size_t segment = ((size_t)head[offset + 2] << 8) | head[offset + 3];
+            if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                // SOF3, 7, 11, 15: lossless
+                if ((marker & 3) == 3 || offset + 9 > length) break;
+                preview->height = (head[offset + 5] << 8) | head[offset + 6];
+                preview->width = (head[offset + 7] << 8) | head[offset + 8];
+                found = preview->width > 0 && preview->height > 0;
+                break;
+            }
+            if (marker == 0xDA || segment < 2) break;
+            offset += 2 + segment;
+        }
+    }
+    g_free(head);
+    return found;
+}
+
+static void consider(const RawReader* reader, RawScan* scan, uint64_t offset, uint64_t length) {
+    Preview preview = {offset, length, 0, 0};
+    if (length < 4 || length > PREVIEW_MAX_BYTES || !preview_dimensions(reader, &preview)) return;
+    if ((int64_t)preview.width * preview.height > (int64_t)scan->best.width * scan->best.height) {
+        scan->best = preview;
+    }
+}
+
+// Raw encodings no ordinary TIFF writer uses: Nikon, Sony, Pentax, Kodak
+static int raw_compression(uint32_t compression) {
+    return compression == 32767 || compression == 32769 || compression == 32770 || compression == 34713 ||
+           compression == 65000 || compression == 65535 || compression == 34892;
+}
+
+static void scan_ifd(const RawReader* reader, RawScan* scan, uint32_t ifd, int depth) {
+    while (ifd && scan->visited_count < MAX_IFDS) {
+        for (int i = 0; i < scan->visited_count; i++) {
+            if (scan->visited[i] == ifd) return;   // A loop in a damaged file
+        }
+        scan->visited[scan->visited_count++] = ifd;
+
+        uint8_t count_bytes[2];
+        if (!read_at(reader, ifd, count_bytes, 2)) return;
+        unsigned int entries = get_u16(reader, count_bytes);
+        if (entries == 0 || entries > MAX_ENTRIES) return;
+        size_t table_length = (size_t)entries * 12 + 4;
+        uint8_t* table = g_malloc(table_length);
+        if (!read_at(reader, (uint64_t)ifd + 2, table, table_length)) {
+            g_free(table);
+            return;
+        }
+
+        int width = 0, height = 0, strips = 0;
+        uint32_t strip_offset = 0, strip_bytes = 0, jpeg_offset = 0, jpeg_length = 0;
+        uint32_t compression = 0;
+        uint32_t sub_ifds[MAX_SUB_IFDS];
+        int sub_count = 0;
+        for (unsigned int i = 0; i < entries; i++) {
+            const uint8_t* entry = table + i * 12;
+            unsigned int tag = get_u16(reader, entry);
+            uint32_t value = entry_value(reader, entry);
+            switch (tag) {
+                case TAG_WIDTH: width = (int)value; break;
+                case TAG_HEIGHT: height = (int)value; break;
+                case TAG_COMPRESSION: compression = value; break;
+                case TAG_PHOTOMETRIC:
+                    // CFA and LinearRaw: sensor data
+                    if (value == 32803 || value == 34892) scan->raw = 1;
+                    break;
+                case TAG_STRIP_OFFSETS:
+                    strips = (int)entry_count(reader, entry);
+                    strip_offset = value;
+                    break;
+                case TAG_STRIP_BYTES: strip_bytes = value; break;
+                case TAG_JPEG_OFFSET: jpeg_offset = value; break;
+                case TAG_JPEG_LENGTH: jpeg_length = value; break;
+                case TAG_ORIENTATION:
+                    if (depth == 0 && scan->visited_count == 1 && value >= 1 && value <= 8) {
+                        scan->orientation = (int)value;
+                    }
+                    break;
+                case TAG_DNG_VERSION: scan->raw = 1; break;
+                case TAG_JPEG_FROM_RAW:
+                    consider(reader, scan, get_u32(reader, entry + 8), entry_count(reader, entry));
+                    scan->raw = 1;
+                    break;
+                case TAG_SUB_IFDS: {
+                    uint32_t count = entry_count(reader, entry);
+                    if (count > MAX_SUB_IFDS) count = MAX_SUB_IFDS;
+                    if (count == 1) {
+                        sub_ifds[sub_count++] = value;
+                    } else if (count > 1) {
+                        uint8_t offsets[MAX_SUB_IFDS * 4];
+                        if (read_at(reader, get_u32(reader, entry + 8), offsets, count * 4)) {
+                            for (uint32_t s = 0; s < count; s++) sub_ifds[sub_count++] = get_u32(reader, offsets + s * 4);
+                        }
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        uint32_t next = get_u32(reader, table + entries * 12);
+        g_free(table);
+
+        if (raw_compression(compression)) scan->raw = 1;
+        int side = width > height ? width : height;
+        if (side > scan->sensor_side) scan->sensor_side = side;
+        // Old-style (6) or new-style (7) JPEG in one strip is a whole picture;
+        // tiled and multi-strip JPEG TIFFs are ordinary images
+        if ((compression == 6 || compression == 7) && strips == 1) consider(reader, scan, strip_offset, strip_bytes);
+        if (jpeg_offset && jpeg_length) consider(reader, scan, jpeg_offset, jpeg_length);
+        if (depth < 2) {
+            for (int s = 0; s < sub_count; s++) scan_ifd(reader, scan, sub_ifds[s], depth + 1);
+        }
+        // Only IFD0 heads a chain worth following
+        ifd = depth == 0 ? next : 0;
+    }
+}
+
+static int has_exif(const uint8_t* jpeg, size_t length) {
+    size_t offset = 2;
+    while (offset + 10 <= length && jpeg[offset] == 0xFF) {
+        int marker = jpeg[offset + 1];
+        size_t segment = ((size_t)jpeg[offset + 2] << 8) | jpeg[offset + 3];
+        if (marker == 0xE1 && segment >= 8 && memcmp(jpeg + offset + 4, "Exif\0\0", 6) == 0) return 1;
+        if (marker < 0xE0 || marker > 0xEF || segment < 2) return 0;
+        offset += 2 + segment;
+    }
+    return 0;
+}
+
+// The preview, with an APP1 carrying only the orientation after its SOI
+// when the RAW is rotated and the preview has no EXIF of its own
+static uint8_t* copy_preview(const RawReader* reader, const Preview* preview, int orientation, size_t* length) {
+    static const uint8_t app1[] = {
+        0xFF, 0xE1, 0x00, 0x22, 'E', 'x', 'i', 'f', 0, 0,
+        'M', 'M', 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08,       // Big-endian TIFF, IFD0 at 8
+        0x00, 0x01,                                         // One entry
+        0x01, 0x12, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01,     // Orientation, SHORT, 1
+        0x00, 0x00, 0x00, 0x00,                             // Value, patched below
+        0x00, 0x00, 0x00, 0x00                              // No IFD1
+    };
+    size_t size = (size_t)preview->length;
+    uint8_t* jpeg = g_malloc(size + sizeof(app1));
+    if (!read_at(reader, preview->offset, jpeg, size)) {
+        g_free(jpeg);
+        return NULL;
+    }
+    *length = size;
+    if (orientation <= 1 || has_exif(jpeg, size)) return jpeg;
+    memmove(jpeg + 2 + sizeof(app1), jpeg + 2, size - 2);
+    memcpy(jpeg + 2, app1, sizeof(app1));
+    jpeg[2 + 29] = (uint8_t)orientation;
+    *length = size + sizeof(app1);
+    return jpeg;
+}
+
+uint8_t* thinpic_raw_preview(const ThinpicInput* input, size_t* length) {
+    if (!input || input->image) return NULL;
+    RawReader reader = {input->data, -1, input->length, 0};
+    int opened = -1;
+    if (!input->data) {
+        if (input->path) {
+            opened = open(input->path, O_RDONLY | O_CLOEXEC);
+            if (opened < 0) return NULL;
+        }
+        reader.fd = opened >= 0 ? opened : input->fd;
+        struct stat file_stat;
+        if (reader.fd < 0 || fstat(reader.fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            if (opened >= 0) close(opened);
+            return NULL;
+        }
+        reader.length = (uint64_t)file_stat.st_size;
+    }
+
+    uint8_t* jpeg = NULL;
+    uint8_t header[16];
+    if (read_at(&reader, 0, header, sizeof(header)) &&
+            (memcmp(header, "II", 2) == 0 || memcmp(header, "MM", 2) == 0)) {
+        reader.big_endian = header[0] == 'M';
+        unsigned int magic = get_u16(&reader, header + 2);
+        // TIFF, Olympus ORF ("RO", "RS") and Panasonic RW2 (0x55)
+        if (magic == 42 || magic == 0x4F52 || magic == 0x5352 || magic == 0x55) {
+            RawScan scan;
+            memset(&scan, 0, sizeof(scan));
+            scan.raw = magic != 42 || memcmp(header + 8, "CR", 2) == 0;
+            scan_ifd(&reader, &scan, get_u32(&reader, header + 4), 0);
+            int side = scan.best.width > scan.best.height ? scan.best.width : scan.best.height;
+            if (scan.raw && side >= PREVIEW_MIN_SIDE && side * 2 >= scan.sensor_side) {
+                jpeg = copy_preview(&reader, &scan.best, scan.orientation, length);
+                if (jpeg) {
+                    THINPIC_LOGD("RAW input: embedded %dx%d JPEG preview (%llu bytes, sensor %d px, orientation %d)",
+                                 scan.best.width, scan.best.height, (unsigned long long)scan.best.length,
+                                 scan.sensor_side, scan.orientation);
+                }
+            } else if (scan.raw) {
+                THINPIC_LOGD("RAW input: largest preview %dx%d is too small for sensor %d px",
+                             scan.best.width, scan.best.height, scan.sensor_side);
+            }
+        }
+    }
+    if (opened >= 0) close(opened);
+    return jpeg;
+}
@@ -0,0 +1,74 @@
+// Page cache hints for pool inputs. On an SD card or a slow provider the
+// decoder of each queued image used to start by waiting on the first reads
+// of its file; the pool now asks the kernel to read the next few queued
+// inputs in the background (POSIX_FADV_WILLNEED) while the current ones
+// encode. Once such a batch input has been compressed its pages are dropped
+// (POSIX_FADV_DONTNEED), so a few thousand originals streamed through the
+// pool do not push the app's own files out of the cache. Both are hints: a
+// descriptor the kernel cannot advise, such as a pipe or a FUSE provider,
+// is read as before. Outputs get the matching write-side hint: the encoded
+// size is known before the first byte goes out, so the file is allocated
+// in one piece (fallocate) instead of extent by extent as it grows, which
+// keeps the originals and outputs of a big batch from fragmenting f2fs and
+// ext4.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#ifdef POSIX_FADV_WILLNEED
+static void advise(const char* path, int fd, int advice) {
+    int opened = -1;
+    if (fd < 0 && path) {
+        opened = open(path, O_RDONLY | O_CLOEXEC);
+        if (opened < 0) return;
+        fd = opened;
+    }
+    if (fd < 0) return;
+    // The whole file; a failure (ESPIPE for pipes) leaves the reads as they were
+    int failed = posix_fadvise(fd, 0, 0, advice);
+    if (failed) THINPIC_LOGD("posix_fadvise(%d) failed: %d", advice, failed);
+    if (opened >= 0) close(opened);
+}
+
+void thinpic_readahead(const char* path, int fd) {
+    advise(path, fd, POSIX_FADV_WILLNEED);
+}
+
+void thinpic_readahead_drop(const char* path, int fd) {
+    advise(path, fd, POSIX_FADV_DONTNEED);
+}
+#endif
+
+#if defined(__linux__) || defined(__ANDROID__)
+void thinpic_preallocate(int fd, size_t length) {
+    if (length == 0) return;
+    // fallocate, not posix_fallocate: glibc emulates the latter by writing
+    // zeros, which would write the file twice on filesystems without it
+    if (fallocate(fd, 0, 0, (off_t)length) != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        THINPIC_LOGD("fallocate(%zu) failed: %d", length, errno);
+    }
+}
+#else
+void thinpic_preallocate(int fd, size_t length) {
+    (void)fd;
+    (void)length;
+}
+#endif
+
+#ifndef POSIX_FADV_WILLNEED
+// No posix_fadvise (Apple platforms)
+void thinpic_readahead(const char* path, int fd) {
+    (void)path;
+    (void)fd;
+}
+
+void thinpic_readahead_drop(const char* path, int fd) {
+    (void)path;
+    (void)fd;
+}
+#endif
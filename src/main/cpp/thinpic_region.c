@@ -0,0 +1,133 @@
+// Region-of-interest decode for a leading crop in thinpic_compress_ops.
+// The crop used to be an extract_area over the sequential load, so cutting
+// a 1000 px square out of a 100 MP photo still decoded every row above it
+// and streamed the full width of every row through it. Here the region is
+// pushed down to the decoder where the format allows it:
+//  - JPEG with whole-row restart intervals: only the intervals covering the
+//    crop's rows are decoded, on the job's threads (thinpic_jpeg_parallel.c)
+//  - WebP: libwebp's crop-on-decode stops at the crop's bottom and converts
+//    and stores only its pixels
+// Tiled and striped TIFF need no help from here: opened for random access
+// (image_compressor.c), tiffload reads only the tiles the crop touches.
+// Other inputs, and crops too large to gain much, keep the sequential path.
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <webp/decode.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+static void free_with_image(VipsImage* image, gpointer data) {
+    (void)image;
+    g_free(data);
+}
+
+// Carry EXIF, ICC, orientation and "vips-loader" over from the header
+static void* copy_field(VipsImage* image, const char* field, GValue* value, void* a) {
+    (void)image;
+    if (strcmp(field, VIPS_META_SEQUENTIAL) != 0) vips_image_set((VipsImage*)a, field, value);
+    return NULL;
+}
+
+// The encoded bytes of a path or descriptor input, mapped read-only
+static const uint8_t* map_input(const ThinpicInput* input, size_t* length) {
+    int fd = input->path ? open(input->path, O_RDONLY | O_CLOEXEC) : input->fd;
+    if (fd < 0) return NULL;
+    struct stat file_stat;
+    void* address = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        address = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (input->path) close(fd);
+    if (address == MAP_FAILED) return NULL;
+    *length = (size_t)file_stat.st_size;
+    return (const uint8_t*)address;
+}
+
+static VipsImage* webp_region(const ThinpicInput* input, VipsImage* header, int left, int top, int width,
+                              int height, int threads) {
+    size_t length = input->length;
+    const uint8_t* data = (const uint8_t*)input->data;
+    const uint8_t* mapped = NULL;
+    if (!data) {
+        mapped = map_input(input, &length);
+        if (!mapped) return NULL;
+        data = mapped;
+    }
+
+    VipsImage* image = NULL;
+    WebPDecoderConfig config;
+    int bands = vips_image_get_bands(header);
+    if (WebPInitDecoderConfig(&config) && WebPGetFeatures(data, length, &config.input) == VP8_STATUS_OK &&
+            !config.input.has_animation && config.input.width == vips_image_get_width(header) &&
+            config.input.height == vips_image_get_height(header) && bands == (config.input.has_alpha ? 4 : 3)) {
+        size_t stride = (size_t)width * bands;
+        uint8_t* pixels = g_try_malloc(stride * height);
+        if (pixels) {
+            config.options.use_cropping = 1;
+            config.options.crop_left = left;
+            config.options.crop_top = top;
+            config.options.crop_width = width;
+            config.options.crop_height = height;
+            config.options.use_threads = threads > 1;
+            config.output.colorspace = bands == 4 ? MODE_RGBA : MODE_RGB;
+            config.output.is_external_memory = 1;
+            config.output.u.RGBA.rgba = pixels;
+            config.output.u.RGBA.stride = (int)stride;
+            config.output.u.RGBA.size = stride * height;
+            ThinpicStageMark started = thinpic_stage_begin(THINPIC_STAGE_DECODE);
+            VP8StatusCode status = WebPDecode(data, length, &config);
+            thinpic_stage_end(THINPIC_STAGE_DECODE, started);
+            WebPFreeDecBuffer(&config.output);
+            if (status == VP8_STATUS_OK && !thinpic_cancel_requested()) {
+                image = vips_image_new_from_memory(pixels, stride * height, width, height, bands,
+                                                   VIPS_FORMAT_UCHAR);
+            }
+            if (image) {
+                g_signal_connect(image, "postclose", G_CALLBACK(free_with_image), pixels);
+                vips_image_init_fields(image, width, height, bands, VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+                                       VIPS_INTERPRETATION_sRGB, vips_image_get_xres(header),
+                                       vips_image_get_yres(header));
+                vips_image_map(header, copy_field, image);
+            } else {
+                g_free(pixels);
+                vips_error_clear();
+            }
+        }
+    }
+    if (mapped) munmap((void*)mapped, length);
+    return image;
+}
+
+VipsImage* thinpic_region_decode(const ThinpicInput* input, VipsImage* header, int left, int top, int width,
+                                 int height, int threads) {
+    const char* loader = NULL;
+    if (input->image || !vips_image_get_typeof(header, VIPS_META_LOADER) ||
+            vips_image_get_string(header, VIPS_META_LOADER, &loader) != 0) {
+        return NULL;
+    }
+    // A region is stored whole; one that would spill gains nothing over streaming
+    if (thinpic_spills((int64_t)width * height * vips_image_get_bands(header))) return NULL;
+
+    VipsImage* region = NULL;
+    if (strncmp(loader, "jpegload", 8) == 0) {
+        int origin = 0;
+        VipsImage* rows = thinpic_jpeg_region_decode(input, header, top, height, threads, &origin);
+        if (rows) {
+            if (vips_extract_area(rows, &region, left, top - origin, width, height, NULL)) region = NULL;
+            g_object_unref(rows);
+        }
+    } else if (strncmp(loader, "webpload", 8) == 0) {
+        region = webp_region(input, header, left, top, width, height, threads);
+    }
+    if (region) {
+        THINPIC_LOGD("Region decode (%s): %dx%d+%d+%d of %dx%d", loader, width, height, left, top,
+                     vips_image_get_width(header), vips_image_get_height(header));
+    }
+    vips_error_clear();
+    return region;
+}
@@ -0,0 +1,89 @@
+// Content-adaptive bit allocation for the target-size searches
+// (thinpic_configure adaptive_quality). Neither encoder takes a quality per
+// region: baseline JPEG has one quantization table per component, and
+// libwebp assigns its four segments from its own analysis with no way to
+// pass a map in. What both do is spend bits on detail, so the flat, least
+// salient regions (sky, walls, bokeh) are low-passed before the search; the
+// encoder then spends little there, WebP's analysis puts those macroblocks
+// in its coarse segments, and the size target is met at a higher quality
+// for faces, text and edges. The map is Sobel edge strength on a
+// MAP_SIZE thumbnail, widened and softened so transitions do not show, and
+// scaled back up as the blend between the image and its blurred copy.
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define MAP_SIZE 256              // Longer side of the thumbnail the map is computed on
+#define EDGE_FLAT 6               // Sobel response at and below which a region is flat
+#define EDGE_DETAIL 36            // Response from which it is kept as it is
+#define PREFILTER_SIGMA 1.2       // Gaussian applied to the flat regions
+
+static void unref_all(VipsImage** images, int count) {
+    for (int i = 0; i < count; i++) {
+        if (images[i]) g_object_unref(images[i]);
+    }
+}
+
+// Blend mask at the image's size: 255 keeps a pixel, 0 takes the blurred one
+static int saliency_mask(VipsImage* colour, VipsImage** out, double* kept) {
+    int width = vips_image_get_width(colour);
+    int height = vips_image_get_height(colour);
+    double scale = (double)MAP_SIZE / (width > height ? width : height);
+    VipsImage* t[7] = {NULL};
+    int failed = vips_resize(colour, &t[0], scale, "kernel", VIPS_KERNEL_LINEAR, NULL) ||
+                 vips_colourspace(t[0], &t[1], VIPS_INTERPRETATION_B_W, NULL) ||
+                 vips_sobel(t[1], &t[2], NULL) ||
+                 // Response to 0-255 between flat and detail
+                 vips_linear1(t[2], &t[3], 255.0 / (EDGE_DETAIL - EDGE_FLAT),
+                              -255.0 * EDGE_FLAT / (EDGE_DETAIL - EDGE_FLAT), "uchar", TRUE, NULL) ||
+                 // Text strokes and eyes are thin: a region counts as salient
+                 // when anything within two map pixels is
+                 vips_rank(t[3], &t[4], 5, 5, 24, NULL) ||
+                 vips_gaussblur(t[4], &t[5], 2.0, NULL) ||
+                 vips_avg(t[5], kept, NULL);
+    if (!failed) {
+        int map_width = vips_image_get_width(t[5]);
+        int map_height = vips_image_get_height(t[5]);
+        failed = vips_resize(t[5], &t[6], (double)width / map_width,
+                             "vscale", (double)height / map_height,
+                             "kernel", VIPS_KERNEL_LINEAR,
+                             NULL) ||
+                 // Rounding in the resize can leave a pixel more or less
+                 vips_embed(t[6], out, 0, 0, width, height, "extend", VIPS_EXTEND_COPY, NULL);
+    }
+    unref_all(t, 7);
+    *kept /= 255.0;
+    return failed ? -1 : 0;
+}
+
+int thinpic_saliency_prefilter(VipsImage* image, VipsImage** out) {
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    int bands = vips_image_get_bands(image);
+    if ((width > height ? width : height) <= MAP_SIZE || vips_image_get_format(image) != VIPS_FORMAT_UCHAR ||
+            (bands != 3 && bands != 4)) {
+        return 0;
+    }
+
+    // Alpha is left alone; only colour is blended
+    VipsImage* t[5] = {NULL};
+    double kept = 0;
+    int failed = vips_extract_band(image, &t[0], 0, "n", 3, NULL) ||
+                 saliency_mask(t[0], &t[1], &kept) ||
+                 vips_gaussblur(t[0], &t[2], PREFILTER_SIGMA, NULL) ||
+                 vips_cast_uchar(t[2], &t[3], NULL) ||
+                 vips_ifthenelse(t[1], t[0], t[3], &t[4], "blend", TRUE, NULL);
+    if (!failed && bands == 4) {
+        VipsImage* alpha = NULL;
+        failed = vips_extract_band(image, &alpha, 3, NULL) ||
+                 vips_bandjoin2(t[4], alpha, out, NULL);
+        if (alpha) g_object_unref(alpha);
+    } else if (!failed) {
+        *out = t[4];
+        t[4] = NULL;
+    }
+    unref_all(t, 5);
+    if (failed) return -1;
+    THINPIC_LOGD("Saliency: %dx%d, %.0f%% kept sharp", width, height, kept * 100);
+    return 1;
+}
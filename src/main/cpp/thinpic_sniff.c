@@ -0,0 +1,83 @@
+// Container sniffing from the first bytes of an encoded image. FORMAT_AUTO
+// used to follow the file extension, so a HEIC saved as .jpg or a
+// content-provider path with no extension got the JPEG saver and the failure
+// and retry paths that come with it. The signatures here are checked in
+// memory on SNIFF_BYTES read once, without libvips (vips_foreign_find_load
+// asks every loader in turn and most of them open the file again), and the
+// same answer names the loader the pipeline opens the file with.
+
+#include <string.h>
+#include <unistd.h>
+
+#include "thinpic_internal.h"
+
+static int brand_is(const uint8_t* brand, const char* name) {
+    return memcmp(brand, name, 4) == 0;
+}
+
+// ISO base media files: HEIF and AVIF share the container and differ in the
+// brands of their leading ftyp box
+static ImageFormat sniff_ftyp(const uint8_t* head, size_t length) {
+    size_t box = ((size_t)head[0] << 24) | ((size_t)head[1] << 16) | ((size_t)head[2] << 8) | head[3];
+    if (box < 16 || box > length) box = length;
+    const uint8_t* major = head + 8;
+    if (brand_is(major, "avif") || brand_is(major, "avis")) return FORMAT_AVIF;
+    if (brand_is(major, "heic") || brand_is(major, "heix") || brand_is(major, "hevc") ||
+            brand_is(major, "hevx") || brand_is(major, "heim") || brand_is(major, "heis")) {
+        return FORMAT_HEIF;
+    }
+    if (!brand_is(major, "mif1") && !brand_is(major, "msf1")) return FORMAT_AUTO;
+    // Generic image brand: the compatible brands after the minor version
+    for (size_t offset = 16; offset + 4 <= box; offset += 4) {
+        if (brand_is(head + offset, "avif") || brand_is(head + offset, "avis")) return FORMAT_AVIF;
+    }
+    return FORMAT_HEIF;
+}
+
+ImageFormat thinpic_sniff_format(const uint8_t* head, size_t length) {
+    static const uint8_t png[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    static const uint8_t jp2[12] = {0, 0, 0, 0x0C, 'j', 'P', ' ', ' ', 0x0D, 0x0A, 0x87, 0x0A};
+    static const uint8_t jxl[12] = {0, 0, 0, 0x0C, 'J', 'X', 'L', ' ', 0x0D, 0x0A, 0x87, 0x0A};
+    if (!head || length < 4) return FORMAT_AUTO;
+
+    if (head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) return FORMAT_JPEG;
+    if (length >= 8 && memcmp(head, png, 8) == 0) return FORMAT_PNG;
+    if (length >= 6 && (memcmp(head, "GIF87a", 6) == 0 || memcmp(head, "GIF89a", 6) == 0)) return FORMAT_GIF;
+    if (length >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WEBP", 4) == 0) return FORMAT_WEBP;
+    // Classic and BigTIFF, either byte order
+    if ((head[0] == 'I' && head[1] == 'I' && (head[2] == 42 || head[2] == 43) && head[3] == 0) ||
+            (head[0] == 'M' && head[1] == 'M' && head[2] == 0 && (head[3] == 42 || head[3] == 43))) {
+        return FORMAT_TIFF;
+    }
+    if (length >= 12 && memcmp(head + 4, "ftyp", 4) == 0) return sniff_ftyp(head, length);
+    if (length >= 12 && memcmp(head, jp2, 12) == 0) return FORMAT_JP2K;
+    if (head[0] == 0xFF && head[1] == 0x4F && head[2] == 0xFF && head[3] == 0x51) return FORMAT_JP2K;
+    if (length >= 12 && memcmp(head, jxl, 12) == 0) return FORMAT_JXL;
+    if (head[0] == 0xFF && head[1] == 0x0A) return FORMAT_JXL;
+    return FORMAT_AUTO;
+}
+
+ImageFormat thinpic_sniff_descriptor(int fd) {
+    uint8_t head[SNIFF_BYTES];
+    // pread leaves the descriptor's offset alone; pipes fail with ESPIPE
+    ssize_t got = pread(fd, head, sizeof(head), 0);
+    return got > 0 ? thinpic_sniff_format(head, (size_t)got) : FORMAT_AUTO;
+}
+
+const char* thinpic_sniffed_loader(ImageFormat format) {
+    const char* loader;
+    switch (format) {
+        case FORMAT_JPEG: loader = "jpegload"; break;
+        case FORMAT_PNG: loader = "pngload"; break;
+        case FORMAT_WEBP: loader = "webpload"; break;
+        case FORMAT_TIFF: loader = "tiffload"; break;
+        case FORMAT_HEIF:
+        case FORMAT_AVIF: loader = "heifload"; break;
+        case FORMAT_JP2K: loader = "jp2kload"; break;
+        case FORMAT_JXL: loader = "jxlload"; break;
+        case FORMAT_GIF: loader = "gifload"; break;
+        default: return NULL;
+    }
+    // Loaders left out of this libvips build fall back to its own search
+    return vips_type_find("VipsOperation", loader) ? loader : NULL;
+}
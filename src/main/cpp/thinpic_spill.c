@@ -0,0 +1,82 @@
+// Disc spill for large intermediates (thinpic_configure disc_threshold_mb,
+// thinpic_set_spill_dir). The searches, rotations and palette and SSIM
+// passes render their image once for random access, and that render used to
+// be a heap block of the whole frame: a 100 MP scan is 300 MB the low-memory
+// killer counts against the app. Above the threshold the render goes to an
+// uncompressed libvips temp file instead, which libvips maps back in; its
+// pages belong to the page cache, so the kernel writes them out and reads
+// them back under pressure rather than killing the process. The file is
+// deleted when the image is released. Either way the render no longer
+// carries the loader's sequential mark, which is how the stages that read
+// out of order (thinpic_random_access) tell a lazily streamed source from
+// one they can address freely.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+static int64_t spill_threshold = 0;     // Bytes; 0 = always memory
+
+// libvips names its temp files under $TMPDIR (/tmp without it) on every
+// call, so the directory is set there; call before jobs run, as setenv
+// races getenv on other threads
+void thinpic_set_spill_dir(const char* directory) {
+    if (directory && directory[0]) {
+        setenv("TMPDIR", directory, 1);
+    } else {
+        unsetenv("TMPDIR");
+    }
+    THINPIC_LOGI("Spill directory %s", directory && directory[0] ? directory : "(system)");
+}
+
+void thinpic_spill_set_threshold(int64_t bytes) {
+    __atomic_store_n(&spill_threshold, bytes > 0 ? bytes : 0, __ATOMIC_RELAXED);
+}
+
+// vips_image_copy_memory keeps every field of its source, the loader's
+// "vips-sequential" included
+static VipsImage* addressable(VipsImage* rendered) {
+    if (rendered) vips_image_remove(rendered, VIPS_META_SEQUENTIAL);
+    return rendered;
+}
+
+static VipsImage* render(VipsImage* image) {
+    int64_t bytes = (int64_t)VIPS_IMAGE_SIZEOF_IMAGE(image);
+    if (!thinpic_spills(bytes)) return vips_image_copy_memory(image);
+
+    // The file is only created once the render starts, too late to fall
+    // back on a sequential input; an unwritable directory costs memory, not
+    // the job
+    const char* directory = getenv("TMPDIR");
+    if (!directory) directory = "/tmp";
+    if (access(directory, W_OK) != 0) {
+        THINPIC_LOGW("Cannot spill to %s, rendering into memory", directory);
+        return vips_image_copy_memory(image);
+    }
+    // Deleted when the last reference goes
+    VipsImage* disc = vips_image_new_temp_file("%s.v");
+    if (!disc) return NULL;
+    if (vips_image_write(image, disc)) {
+        g_object_unref(disc);
+        return NULL;
+    }
+    THINPIC_LOGD("Spilled %dx%d (%lld MB) to disc", vips_image_get_width(disc), vips_image_get_height(disc),
+                 (long long)(bytes >> 20));
+    return disc;
+}
+
+int thinpic_spills(int64_t bytes) {
+    int64_t threshold = __atomic_load_n(&spill_threshold, __ATOMIC_RELAXED);
+    return threshold > 0 && bytes > threshold;
+}
+
+VipsImage* thinpic_render_random_access(VipsImage* image) {
+    return addressable(render(image));
+}
+
+int thinpic_needs_render(VipsImage* image) {
+    // Memory, mapped files and images built from them no longer carry it
+    return image && vips_image_is_sequential(image);
+}
@@ -0,0 +1,505 @@
+// Perceptual quality check for the min_ssim search in thinpic_compress, and
+// the PSNR, SSIM and MS-SSIM scores of thinpic_compare. SSIM is computed on
+// a downscaled luminance plane, over 8x8 windows placed every 4 pixels
+// (uniform weights rather than the paper's 11x11 Gaussian); the per-window
+// sums use NEON on arm64, and the ARMv8.2 dot product instructions on cores
+// that report them at runtime; SSE2 on x86_64, and AVX2 where the CPU has it
+// (ChromeOS and emulators). thinpic_compare splits the windows into bands
+// of rows over its threads and takes the squared errors for PSNR in the same
+// pass; MS-SSIM repeats it on planes halved four times.
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+// Compilers whose arm_neon.h declares vdotq_u32 for target("...+dotprod")
+// functions in an otherwise armv8-a build
+#if (defined(__clang__) && __clang_major__ >= 16) || (!defined(__clang__) && __GNUC__ >= 10)
+#define SSIM_DOTPROD 1
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+#endif
+#elif defined(__x86_64__)
+// SSE2 is part of x86_64; AVX2 is taken at runtime where the CPU has it
+#include <immintrin.h>
+#define SSIM_AVX2 1
+#endif
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define WINDOW 8
+#define WINDOW_STEP 4
+#define SSIM_MAX_PIXELS (1024 * 1024)   // Luma planes are box-shrunk to about this
+#define BAND_ROWS 64                    // Rows per unit of work, a multiple of WINDOW_STEP
+#define MAX_WORKERS 16
+#define MS_SSIM_SCALES 5
+// Identical planes score this rather than infinity, so scores can be averaged
+#define PSNR_IDENTICAL 100.0
+
+typedef struct {
+    uint32_t a;     // Sum of reference samples
+    uint32_t b;     // Sum of candidate samples
+    uint32_t aa;    // Sums of squares and products
+    uint32_t bb;
+    uint32_t ab;
+} WindowSums;
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static void window_sums(const uint8_t* a, const uint8_t* b, int stride, WindowSums* sums) {
+    uint16x8_t sum_a = vdupq_n_u16(0);
+    uint16x8_t sum_b = vdupq_n_u16(0);
+    uint32x4_t sum_aa = vdupq_n_u32(0);
+    uint32x4_t sum_bb = vdupq_n_u32(0);
+    uint32x4_t sum_ab = vdupq_n_u32(0);
+    for (int y = 0; y < WINDOW; y++) {
+        uint8x8_t row_a = vld1_u8(a + (size_t)y * stride);
+        uint8x8_t row_b = vld1_u8(b + (size_t)y * stride);
+        sum_a = vaddw_u8(sum_a, row_a);
+        sum_b = vaddw_u8(sum_b, row_b);
+        sum_aa = vpadalq_u16(sum_aa, vmull_u8(row_a, row_a));
+        sum_bb = vpadalq_u16(sum_bb, vmull_u8(row_b, row_b));
+        sum_ab = vpadalq_u16(sum_ab, vmull_u8(row_a, row_b));
+    }
+    sums->a = vaddvq_u32(vpaddlq_u16(sum_a));
+    sums->b = vaddvq_u32(vpaddlq_u16(sum_b));
+    sums->aa = vaddvq_u32(sum_aa);
+    sums->bb = vaddvq_u32(sum_bb);
+    sums->ab = vaddvq_u32(sum_ab);
+}
+
+#ifdef SSIM_DOTPROD
+// Two window rows per 16-lane UDOT; summing against ones gives the plain sums
+__attribute__((target("arch=armv8.2-a+dotprod")))
+static void window_sums_dotprod(const uint8_t* a, const uint8_t* b, int stride, WindowSums* sums) {
+    const uint8x16_t ones = vdupq_n_u8(1);
+    uint32x4_t sum_a = vdupq_n_u32(0);
+    uint32x4_t sum_b = vdupq_n_u32(0);
+    uint32x4_t sum_aa = vdupq_n_u32(0);
+    uint32x4_t sum_bb = vdupq_n_u32(0);
+    uint32x4_t sum_ab = vdupq_n_u32(0);
+    for (int y = 0; y < WINDOW; y += 2) {
+        uint8x16_t rows_a = vcombine_u8(vld1_u8(a + (size_t)y * stride), vld1_u8(a + (size_t)(y + 1) * stride));
+        uint8x16_t rows_b = vcombine_u8(vld1_u8(b + (size_t)y * stride), vld1_u8(b + (size_t)(y + 1) * stride));
+        sum_a = vdotq_u32(sum_a, rows_a, ones);
+        sum_b = vdotq_u32(sum_b, rows_b, ones);
+        sum_aa = vdotq_u32(sum_aa, rows_a, rows_a);
+        sum_bb = vdotq_u32(sum_bb, rows_b, rows_b);
+        sum_ab = vdotq_u32(sum_ab, rows_a, rows_b);
+    }
+    sums->a = vaddvq_u32(sum_a);
+    sums->b = vaddvq_u32(sum_b);
+    sums->aa = vaddvq_u32(sum_aa);
+    sums->bb = vaddvq_u32(sum_bb);
+    sums->ab = vaddvq_u32(sum_ab);
+}
+#endif
+#elif defined(__x86_64__)
+static uint32_t sum_epi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+static void window_sums(const uint8_t* a, const uint8_t* b, int stride, WindowSums* sums) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sad_a = zero;
+    __m128i sad_b = zero;
+    __m128i sum_aa = zero;
+    __m128i sum_bb = zero;
+    __m128i sum_ab = zero;
+    for (int y = 0; y < WINDOW; y++) {
+        __m128i row_a = _mm_loadl_epi64((const __m128i*)(a + (size_t)y * stride));
+        __m128i row_b = _mm_loadl_epi64((const __m128i*)(b + (size_t)y * stride));
+        // SAD against zero sums the 8 bytes into the low lane
+        sad_a = _mm_add_epi64(sad_a, _mm_sad_epu8(row_a, zero));
+        sad_b = _mm_add_epi64(sad_b, _mm_sad_epu8(row_b, zero));
+        __m128i wide_a = _mm_unpacklo_epi8(row_a, zero);
+        __m128i wide_b = _mm_unpacklo_epi8(row_b, zero);
+        sum_aa = _mm_add_epi32(sum_aa, _mm_madd_epi16(wide_a, wide_a));
+        sum_bb = _mm_add_epi32(sum_bb, _mm_madd_epi16(wide_b, wide_b));
+        sum_ab = _mm_add_epi32(sum_ab, _mm_madd_epi16(wide_a, wide_b));
+    }
+    sums->a = (uint32_t)_mm_cvtsi128_si32(sad_a);
+    sums->b = (uint32_t)_mm_cvtsi128_si32(sad_b);
+    sums->aa = sum_epi32(sum_aa);
+    sums->bb = sum_epi32(sum_bb);
+    sums->ab = sum_epi32(sum_ab);
+}
+
+// Two window rows per 256-bit register, as the dot product variant on arm64
+__attribute__((target("avx2")))
+static void window_sums_avx2(const uint8_t* a, const uint8_t* b, int stride, WindowSums* sums) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sad_a = zero;
+    __m128i sad_b = zero;
+    __m256i sum_aa = _mm256_setzero_si256();
+    __m256i sum_bb = _mm256_setzero_si256();
+    __m256i sum_ab = _mm256_setzero_si256();
+    for (int y = 0; y < WINDOW; y += 2) {
+        __m128i rows_a = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(a + (size_t)y * stride)),
+                                            _mm_loadl_epi64((const __m128i*)(a + (size_t)(y + 1) * stride)));
+        __m128i rows_b = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(b + (size_t)y * stride)),
+                                            _mm_loadl_epi64((const __m128i*)(b + (size_t)(y + 1) * stride)));
+        sad_a = _mm_add_epi64(sad_a, _mm_sad_epu8(rows_a, zero));
+        sad_b = _mm_add_epi64(sad_b, _mm_sad_epu8(rows_b, zero));
+        __m256i wide_a = _mm256_cvtepu8_epi16(rows_a);
+        __m256i wide_b = _mm256_cvtepu8_epi16(rows_b);
+        sum_aa = _mm256_add_epi32(sum_aa, _mm256_madd_epi16(wide_a, wide_a));
+        sum_bb = _mm256_add_epi32(sum_bb, _mm256_madd_epi16(wide_b, wide_b));
+        sum_ab = _mm256_add_epi32(sum_ab, _mm256_madd_epi16(wide_a, wide_b));
+    }
+    // Each SAD lane holds one row's half of the total
+    sums->a = (uint32_t)(_mm_cvtsi128_si32(sad_a) + _mm_extract_epi16(sad_a, 4));
+    sums->b = (uint32_t)(_mm_cvtsi128_si32(sad_b) + _mm_extract_epi16(sad_b, 4));
+    sums->aa = sum_epi32(_mm_add_epi32(_mm256_castsi256_si128(sum_aa), _mm256_extracti128_si256(sum_aa, 1)));
+    sums->bb = sum_epi32(_mm_add_epi32(_mm256_castsi256_si128(sum_bb), _mm256_extracti128_si256(sum_bb, 1)));
+    sums->ab = sum_epi32(_mm_add_epi32(_mm256_castsi256_si128(sum_ab), _mm256_extracti128_si256(sum_ab, 1)));
+}
+#else
+static void window_sums(const uint8_t* a, const uint8_t* b, int stride, WindowSums* sums) {
+    memset(sums, 0, sizeof(*sums));
+    for (int y = 0; y < WINDOW; y++) {
+        const uint8_t* row_a = a + (size_t)y * stride;
+        const uint8_t* row_b = b + (size_t)y * stride;
+        for (int x = 0; x < WINDOW; x++) {
+            uint32_t pa = row_a[x];
+            uint32_t pb = row_b[x];
+            sums->a += pa;
+            sums->b += pb;
+            sums->aa += pa * pa;
+            sums->bb += pb * pb;
+            sums->ab += pa * pb;
+        }
+    }
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static uint64_t row_sse(const uint8_t* a, const uint8_t* b, int width) {
+    uint64_t sse = 0;
+    int x = 0;
+    while (x + 16 <= width) {
+        // Flushed before a lane can pass 2^32: 4 squares of up to 255^2 per step
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (int steps = 0; steps < 4096 && x + 16 <= width; steps++, x += 16) {
+            uint8x16_t d = vabdq_u8(vld1q_u8(a + x), vld1q_u8(b + x));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+            acc = vpadalq_u16(acc, vmull_high_u8(d, d));
+        }
+        sse += vaddlvq_u32(acc);
+    }
+    for (; x < width; x++) {
+        int d = a[x] - b[x];
+        sse += (uint64_t)(d * d);
+    }
+    return sse;
+}
+
+// One output row of a 2x2 box halving, rounded
+static void halve_row(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(top + 2 * x)), vpaddlq_u8(vld1q_u8(bottom + 2 * x)));
+        vst1_u8(out + x, vrshrn_n_u16(sum, 2));
+    }
+    for (; x < width; x++) {
+        out[x] = (uint8_t)((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2);
+    }
+}
+#else
+#if defined(__x86_64__)
+static uint64_t row_sse(const uint8_t* a, const uint8_t* b, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sse = 0;
+    int x = 0;
+    while (x + 16 <= width) {
+        // Flushed before a lane can pass 2^32: 4 squares of up to 255^2 per step
+        __m128i acc = zero;
+        for (int steps = 0; steps < 4096 && x + 16 <= width; steps++, x += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i low = _mm_unpacklo_epi8(d, zero);
+            __m128i high = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+        }
+        sse += (uint64_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 4)) +
+               (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)) +
+               (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 12));
+    }
+    for (; x < width; x++) {
+        int d = a[x] - b[x];
+        sse += (uint64_t)(d * d);
+    }
+    return sse;
+}
+#else
+static uint64_t row_sse(const uint8_t* a, const uint8_t* b, int width) {
+    uint64_t sse = 0;
+    for (int x = 0; x < width; x++) {
+        int d = a[x] - b[x];
+        sse += (uint64_t)(d * d);
+    }
+    return sse;
+}
+#endif
+
+static void halve_row(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int width) {
+    for (int x = 0; x < width; x++) {
+        out[x] = (uint8_t)((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2);
+    }
+}
+#endif
+
+typedef void (*WindowSumsFn)(const uint8_t* a, const uint8_t* b, int stride, WindowSums* sums);
+
+static WindowSumsFn select_window_sums() {
+#ifdef SSIM_DOTPROD
+    if (getauxval(AT_HWCAP) & HWCAP_ASIMDDP) return window_sums_dotprod;
+#endif
+#ifdef SSIM_AVX2
+    if (__builtin_cpu_supports("avx2")) return window_sums_avx2;
+#endif
+    return window_sums;
+}
+
+// Two planes scored in bands of BAND_ROWS rows: each band takes the SSIM
+// and contrast-structure terms of the windows whose top row lies in it and,
+// when asked, the squared errors of its rows. The floating-point terms are
+// kept per band and added in band order, so a score near a search's floor
+// does not round differently with the number of threads.
+typedef struct {
+    const uint8_t* reference;
+    const uint8_t* candidate;
+    int width;
+    int height;
+    int sse;
+    WindowSumsFn sums_of;
+    int band_count;
+    int next_band;
+    pthread_mutex_t lock;
+    double* band_ssim;
+    double* band_cs;
+    int64_t windows;
+    uint64_t sse_total;
+} ScoreJob;
+
+static void score_band(const ScoreJob* job, int band, double* ssim_total, double* cs_total, int64_t* windows,
+                       uint64_t* sse_total) {
+    // (K1 L)^2 and (K2 L)^2 for 8-bit samples, scaled by the window's
+    // 64 * 64 so the sums need no division
+    const double n = WINDOW * WINDOW;
+    const double c1 = 6.5025 * n * n;
+    const double c2 = 58.5225 * n * n;
+    int width = job->width;
+    int top = band * BAND_ROWS;
+    int bottom = top + BAND_ROWS < job->height ? top + BAND_ROWS : job->height;
+    for (int y = top; y < bottom && y + WINDOW <= job->height; y += WINDOW_STEP) {
+        for (int x = 0; x + WINDOW <= width; x += WINDOW_STEP) {
+            size_t offset = (size_t)y * width + x;
+            WindowSums sums;
+            job->sums_of(job->reference + offset, job->candidate + offset, width, &sums);
+            double ab = (double)sums.a * sums.b;
+            double aa = (double)sums.a * sums.a;
+            double bb = (double)sums.b * sums.b;
+            double covariance = n * sums.ab - ab;
+            double variances = n * sums.aa - aa + n * sums.bb - bb;
+            double cs = (2 * covariance + c2) / (variances + c2);
+            *ssim_total += (2 * ab + c1) / (aa + bb + c1) * cs;
+            *cs_total += cs;
+            (*windows)++;
+        }
+    }
+    if (!job->sse) return;
+    for (int y = top; y < bottom; y++) {
+        size_t offset = (size_t)y * width;
+        *sse_total += row_sse(job->reference + offset, job->candidate + offset, width);
+    }
+}
+
+static void* score_worker(void* data) {
+    ScoreJob* job = (ScoreJob*)data;
+    int64_t windows = 0;
+    uint64_t sse_total = 0;
+    for (;;) {
+        int band = __atomic_fetch_add(&job->next_band, 1, __ATOMIC_RELAXED);
+        if (band >= job->band_count) break;
+        score_band(job, band, &job->band_ssim[band], &job->band_cs[band], &windows, &sse_total);
+    }
+    pthread_mutex_lock(&job->lock);
+    job->windows += windows;
+    job->sse_total += sse_total;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+typedef struct {
+    double ssim;
+    double cs;                   // Mean contrast-structure term, for MS-SSIM
+    double mse;                  // When asked for
+} PlaneScores;
+
+static void score_planes(const uint8_t* reference, const uint8_t* candidate, int width, int height, int threads,
+                         int sse, PlaneScores* out) {
+    ScoreJob job;
+    memset(&job, 0, sizeof(job));
+    job.reference = reference;
+    job.candidate = candidate;
+    job.width = width;
+    job.height = height;
+    job.sse = sse;
+    job.sums_of = select_window_sums();
+    job.band_count = (height + BAND_ROWS - 1) / BAND_ROWS;
+    job.band_ssim = g_new0(double, job.band_count > 0 ? job.band_count : 1);
+    job.band_cs = g_new0(double, job.band_count > 0 ? job.band_count : 1);
+    pthread_mutex_init(&job.lock, NULL);
+
+    int workers = threads < job.band_count ? threads : job.band_count;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    pthread_t pool[MAX_WORKERS];
+    int started = 0;
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&pool[started], NULL, score_worker, &job) != 0) break;
+        started++;
+    }
+    // The caller scores bands too, and all of them without a spare thread
+    score_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+
+    double ssim_total = 0;
+    double cs_total = 0;
+    for (int band = 0; band < job.band_count; band++) {
+        ssim_total += job.band_ssim[band];
+        cs_total += job.band_cs[band];
+    }
+    g_free(job.band_ssim);
+    g_free(job.band_cs);
+    if (job.windows > 0) {
+        out->ssim = ssim_total / job.windows;
+        out->cs = cs_total / job.windows;
+    } else {
+        // Smaller than one window
+        out->ssim = memcmp(reference, candidate, (size_t)width * height) == 0 ? 1.0 : 0.0;
+        out->cs = out->ssim;
+    }
+    out->mse = sse ? (double)job.sse_total / ((double)width * height) : 0;
+}
+
+double thinpic_ssim(const uint8_t* reference, const uint8_t* candidate, int width, int height) {
+    PlaneScores scores;
+    score_planes(reference, candidate, width, height, 1, 0, &scores);
+    return scores.ssim;
+}
+
+// plane halved by a 2x2 box into a new g_malloc'd plane; odd edges dropped
+static uint8_t* halve_plane(const uint8_t* plane, int width, int height, int* out_width, int* out_height) {
+    int half_width = width / 2;
+    int half_height = height / 2;
+    uint8_t* half = (uint8_t*)g_malloc((size_t)half_width * half_height);
+    for (int y = 0; y < half_height; y++) {
+        const uint8_t* top = plane + (size_t)(2 * y) * width;
+        halve_row(top, top + width, half + (size_t)y * half_width, half_width);
+    }
+    *out_width = half_width;
+    *out_height = half_height;
+    return half;
+}
+
+void thinpic_compare_planes(const uint8_t* reference, const uint8_t* candidate, int width, int height,
+                            int threads, ThinpicQuality* out) {
+    // Wang, Simoncelli and Bovik's weights for five scales
+    static const double weights[MS_SSIM_SCALES] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+    if (threads < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    PlaneScores scales[MS_SSIM_SCALES];
+    score_planes(reference, candidate, width, height, threads, 1, &scales[0]);
+    out->ssim = scales[0].ssim;
+    out->psnr = scales[0].mse > 0 ? 10 * log10(255.0 * 255.0 / scales[0].mse) : PSNR_IDENTICAL;
+    if (out->psnr > PSNR_IDENTICAL) out->psnr = PSNR_IDENTICAL;
+    out->width = width;
+    out->height = height;
+
+    // Coarser scales while a window still fits; planes too small for all
+    // five share the weights of the scales they have
+    int count = 1;
+    const uint8_t* a = reference;
+    const uint8_t* b = candidate;
+    uint8_t* halved_a = NULL;
+    uint8_t* halved_b = NULL;
+    int w = width;
+    int h = height;
+    while (count < MS_SSIM_SCALES && w / 2 >= WINDOW && h / 2 >= WINDOW) {
+        int half_width = 0;
+        int half_height = 0;
+        uint8_t* next_a = halve_plane(a, w, h, &half_width, &half_height);
+        uint8_t* next_b = halve_plane(b, w, h, &half_width, &half_height);
+        g_free(halved_a);
+        g_free(halved_b);
+        a = halved_a = next_a;
+        b = halved_b = next_b;
+        w = half_width;
+        h = half_height;
+        score_planes(a, b, w, h, threads, 0, &scales[count++]);
+    }
+    g_free(halved_a);
+    g_free(halved_b);
+
+    double weight_total = 0;
+    for (int i = 0; i < count; i++) weight_total += weights[i];
+    // Contrast-structure at the finer scales, the full index at the coarsest
+    double ms_ssim = 1;
+    for (int i = 0; i < count; i++) {
+        double term = i == count - 1 ? scales[i].ssim : scales[i].cs;
+        ms_ssim *= pow(term > 0 ? term : 0, weights[i] / weight_total);
+    }
+    out->ms_ssim = ms_ssim;
+}
+
+int thinpic_luma_shrink(int width, int height) {
+    int shrink = 1;
+    while ((double)(width / shrink) * (height / shrink) > SSIM_MAX_PIXELS) shrink++;
+    return shrink;
+}
+
+uint8_t* thinpic_luma_plane(VipsImage* image, int shrink, int* width, int* height) {
+    VipsImage* current = image;
+    g_object_ref(current);
+    // sRGB to B_W goes through linear light: gamma-encoded luminance
+    if (vips_image_get_interpretation(current) != VIPS_INTERPRETATION_B_W) {
+        VipsImage* gray = NULL;
+        int failed = vips_colourspace(current, &gray, VIPS_INTERPRETATION_B_W, NULL);
+        g_object_unref(current);
+        if (failed) return NULL;
+        current = gray;
+    }
+    VipsImage* steps[3] = {NULL, NULL, NULL};
+    int failed = vips_extract_band(current, &steps[0], 0, NULL) ||
+                 (shrink > 1 ? vips_shrink(steps[0], &steps[1], shrink, shrink, NULL)
+                             : vips_copy(steps[0], &steps[1], NULL)) ||
+                 vips_cast_uchar(steps[1], &steps[2], NULL);
+    g_object_unref(current);
+    for (int i = 0; i < 2; i++) {
+        if (steps[i]) g_object_unref(steps[i]);
+    }
+    if (failed) {
+        if (steps[2]) g_object_unref(steps[2]);
+        return NULL;
+    }
+
+    *width = vips_image_get_width(steps[2]);
+    *height = vips_image_get_height(steps[2]);
+    size_t size = 0;
+    uint8_t* plane = (uint8_t*)vips_image_write_to_memory(steps[2], &size);
+    g_object_unref(steps[2]);
+    return plane;
+}
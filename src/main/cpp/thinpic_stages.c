@@ -0,0 +1,79 @@
+// Per-stage timing for CompressionStats. thinpic_compress_input binds the
+// caller's stats to its thread; the shared pipeline helpers add the wall time
+// of their stage, and whatever is left of the job's time is the encoder's.
+// Each stage is also a trace section when tracing is on.
+
+#include <string.h>
+#include <time.h>
+
+#include "thinpic_internal.h"
+
+// Stats of the compression running on this thread; NULL when nobody asked
+static __thread CompressionStats* current_stats = NULL;
+static __thread int source_width = 0;
+static __thread int source_height = 0;
+
+static int64_t stage_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void thinpic_stages_bind(CompressionStats* stats) {
+    current_stats = stats;
+    source_width = 0;
+    source_height = 0;
+    if (stats) {
+        stats->open_us = 0;
+        stats->decode_us = 0;
+        stats->resize_us = 0;
+        stats->colour_us = 0;
+        stats->encode_us = 0;
+        stats->copy_us = 0;
+        stats->quality = -1;
+        stats->format = -1;
+        stats->width = 0;
+        stats->height = 0;
+        stats->encode_attempts = 0;
+    }
+}
+
+static const char* stage_names[] = {"thinpic open", "thinpic decode", "thinpic resize", "thinpic colour", "thinpic copy"};
+
+ThinpicStageMark thinpic_stage_begin(ThinpicStage stage) {
+    ThinpicStageMark mark = {current_stats ? stage_now_us() : 0, thinpic_trace_begin("%s", stage_names[stage])};
+    return mark;
+}
+
+void thinpic_stage_end(ThinpicStage stage, ThinpicStageMark mark) {
+    thinpic_trace_end(mark.traced);
+    if (!current_stats || mark.started == 0) return;
+    int64_t elapsed = stage_now_us() - mark.started;
+    switch (stage) {
+        case THINPIC_STAGE_OPEN: current_stats->open_us += elapsed; break;
+        case THINPIC_STAGE_DECODE: current_stats->decode_us += elapsed; break;
+        case THINPIC_STAGE_RESIZE: current_stats->resize_us += elapsed; break;
+        case THINPIC_STAGE_COLOUR: current_stats->colour_us += elapsed; break;
+        case THINPIC_STAGE_COPY: current_stats->copy_us += elapsed; break;
+    }
+}
+
+void thinpic_stage_quality(int quality) {
+    if (current_stats) current_stats->quality = quality;
+}
+
+void thinpic_stage_encode(void) {
+    if (current_stats) current_stats->encode_attempts++;
+}
+
+void thinpic_stage_source(int width, int height) {
+    if (current_stats && source_width == 0) {
+        source_width = width;
+        source_height = height;
+    }
+}
+
+void thinpic_stage_source_size(int* width, int* height) {
+    *width = source_width;
+    *height = source_height;
+}
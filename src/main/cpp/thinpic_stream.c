@@ -0,0 +1,197 @@
+// Compressing while downloading (thinpic_stream_new). Dart posts each chunk
+// of a response as it arrives, and the decoder of a sequential format (JPEG,
+// PNG, baseline WebP, GIF) works on the rows those bytes hold instead of
+// waiting for the whole file. The chunks go into a ring buffer. A pump
+// thread drains it into one end of a socket pair, and the pipeline reads the
+// other end as a THINPIC_SOURCE_FD. Loaders already handle a descriptor that
+// can be read only once: nothing is sniffed or rewound, and no second decode
+// at a reduced size is tried. The writer never blocks on the decoder. The
+// ring grows instead when the network is faster, and the socket's own buffer
+// holds the decoder back when it is faster. A socket rather than a pipe,
+// because a send to a reader that has given up fails with EPIPE instead of
+// raising SIGPIPE.
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define STREAM_DEFAULT_CAPACITY (256 * 1024)
+// Bytes the pump moves per send, copied out so a growing ring can be
+// reallocated meanwhile
+#define PUMP_CHUNK (64 * 1024)
+
+struct ThinpicStream {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t* ring;
+    size_t capacity;
+    size_t head;                 // Next byte the pump sends
+    size_t used;
+    int finished;                // thinpic_stream_finish: no more writes
+    int aborted;                 // Pending bytes dropped, the pump stops
+    int read_fd;                 // The pipeline's end
+    int write_fd;                // The pump's end; closed once drained
+    pthread_t pump;
+};
+
+// Largest run of pending bytes that fits in `chunk`, taken out of the ring
+static size_t take_chunk(ThinpicStream* stream, uint8_t* chunk) {
+    size_t length = stream->used < PUMP_CHUNK ? stream->used : PUMP_CHUNK;
+    size_t first = stream->capacity - stream->head;
+    if (first > length) first = length;
+    memcpy(chunk, stream->ring + stream->head, first);
+    memcpy(chunk + first, stream->ring, length - first);
+    stream->head = (stream->head + length) % stream->capacity;
+    stream->used -= length;
+    return length;
+}
+
+static int send_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+static void* pump_main(void* arg) {
+    ThinpicStream* stream = arg;
+    uint8_t* chunk = g_malloc(PUMP_CHUNK);
+    pthread_mutex_lock(&stream->mutex);
+    for (;;) {
+        while (!stream->used && !stream->finished && !stream->aborted) {
+            pthread_cond_wait(&stream->cond, &stream->mutex);
+        }
+        // Drained after the last write, or given up
+        if (stream->aborted || !stream->used) break;
+        size_t length = take_chunk(stream, chunk);
+        pthread_mutex_unlock(&stream->mutex);
+        int failed = send_all(stream->write_fd, chunk, length);
+        pthread_mutex_lock(&stream->mutex);
+        if (failed) {
+            // The reader has closed or stopped reading; the rest has nowhere to go
+            THINPIC_LOGD("Stream reader gone: %s", strerror(errno));
+            stream->aborted = 1;
+            stream->used = 0;
+        }
+    }
+    // End of file for the decoder
+    close(stream->write_fd);
+    stream->write_fd = -1;
+    pthread_mutex_unlock(&stream->mutex);
+    g_free(chunk);
+    return NULL;
+}
+
+ThinpicStream* thinpic_stream_new(size_t capacity) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        thinpic_error_code(THINPIC_ERROR_FAILED);
+        THINPIC_LOGE("Error: Cannot create a stream socket: %s", strerror(errno));
+        return NULL;
+    }
+    // One direction only: the decoder never writes back
+    shutdown(fds[0], SHUT_WR);
+    shutdown(fds[1], SHUT_RD);
+
+    ThinpicStream* stream = g_new0(ThinpicStream, 1);
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    stream->capacity = capacity > 0 ? capacity : STREAM_DEFAULT_CAPACITY;
+    stream->ring = g_malloc(stream->capacity);
+    stream->read_fd = fds[0];
+    stream->write_fd = fds[1];
+    if (pthread_create(&stream->pump, NULL, pump_main, stream) != 0) {
+        THINPIC_LOGE("Error: Failed to start the stream pump");
+        thinpic_error_code(THINPIC_ERROR_FAILED);
+        close(fds[0]);
+        close(fds[1]);
+        pthread_cond_destroy(&stream->cond);
+        pthread_mutex_destroy(&stream->mutex);
+        g_free(stream->ring);
+        g_free(stream);
+        return NULL;
+    }
+    THINPIC_LOGD("Stream opened on fd %d, %zu byte ring", stream->read_fd, stream->capacity);
+    return stream;
+}
+
+int thinpic_stream_fd(const ThinpicStream* stream) {
+    return stream ? stream->read_fd : -1;
+}
+
+// Room for `length` more pending bytes; the ring doubles and is unwrapped
+// to start at 0
+static void reserve(ThinpicStream* stream, size_t length) {
+    if (stream->used + length <= stream->capacity) return;
+    size_t capacity = stream->capacity;
+    while (capacity < stream->used + length) capacity *= 2;
+    uint8_t* ring = g_malloc(capacity);
+    size_t first = stream->capacity - stream->head;
+    if (first > stream->used) first = stream->used;
+    memcpy(ring, stream->ring + stream->head, first);
+    memcpy(ring + first, stream->ring, stream->used - first);
+    g_free(stream->ring);
+    stream->ring = ring;
+    stream->capacity = capacity;
+    stream->head = 0;
+}
+
+int thinpic_stream_write(ThinpicStream* stream, const uint8_t* data, size_t length) {
+    if (!stream || (!data && length > 0)) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        return -1;
+    }
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->finished || stream->aborted) {
+        pthread_mutex_unlock(&stream->mutex);
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        THINPIC_LOGE("Error: Write to a stream that has ended");
+        return -1;
+    }
+    reserve(stream, length);
+    size_t tail = (stream->head + stream->used) % stream->capacity;
+    size_t first = stream->capacity - tail;
+    if (first > length) first = length;
+    memcpy(stream->ring + tail, data, first);
+    memcpy(stream->ring, data + first, length - first);
+    stream->used += length;
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    return 0;
+}
+
+void thinpic_stream_finish(ThinpicStream* stream, int failed) {
+    if (!stream) return;
+    pthread_mutex_lock(&stream->mutex);
+    stream->finished = 1;
+    if (failed) {
+        stream->aborted = 1;
+        stream->used = 0;
+    }
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+void thinpic_stream_free(ThinpicStream* stream) {
+    if (!stream) return;
+    thinpic_stream_finish(stream, 1);
+    // A pump blocked in send on a reader that stopped early gets EPIPE
+    shutdown(stream->read_fd, SHUT_RD);
+    pthread_join(stream->pump, NULL);
+    close(stream->read_fd);
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->mutex);
+    g_free(stream->ring);
+    g_free(stream);
+}
@@ -0,0 +1,148 @@
+// Channel order and alpha for raw 8-bit pixels: BGR(A) to RGB(A), 4-byte
+// pixels to RGB for JPEG, and premultiplied colour (Flutter rawRgba,
+// Android Bitmaps) back to straight alpha. THINPIC_SOURCE_PIXELS used to do
+// this as one vips_extract_band per channel, a bandjoin and
+// vips_unpremultiply, which works in float and needs a cast back to uchar;
+// here each row is one pass, 16 pixels at a time on arm64 (vld4/vst4 and a
+// float divide that rounds like the scalar loop), so every build produces
+// the same bytes.
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "thinpic_internal.h"
+
+#define SWIZZLE_SWAP 1
+#define SWIZZLE_PREMULTIPLIED 2
+
+// c * 255 / alpha to nearest; colour above alpha (not valid premultiplied
+// data) saturates at 255, and zero alpha leaves black
+static inline uint8_t unpremultiply(int c, int alpha) {
+    if (alpha == 0) return 0;
+    if (c > alpha) c = alpha;
+    return (uint8_t)((c * 255 + alpha / 2) / alpha);
+}
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+// unpremultiply on 8 lanes. The numerator stays under 2^16, so its quotient
+// as a correctly rounded float can only reach the next integer when the
+// division is exact, and truncating gives the scalar result.
+static inline uint8x8_t unpremultiply8(uint8x8_t c, uint8x8_t alpha) {
+    uint16x8_t numerator = vmlal_u8(vmovl_u8(vshr_n_u8(alpha, 1)), vmin_u8(c, alpha), vdup_n_u8(255));
+    uint16x8_t divisor = vmovl_u8(alpha);
+    float32x4_t low = vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(numerator))),
+                                vcvtq_f32_u32(vmovl_u16(vget_low_u16(divisor))));
+    float32x4_t high = vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(numerator))),
+                                 vcvtq_f32_u32(vmovl_u16(vget_high_u16(divisor))));
+    uint8x8_t quotient = vmovn_u16(vcombine_u16(vmovn_u32(vcvtq_u32_f32(low)), vmovn_u32(vcvtq_u32_f32(high))));
+    // 0 / 0 lanes
+    return vbic_u8(quotient, vceq_u8(alpha, vdup_n_u8(0)));
+}
+
+static inline uint8x16_t unpremultiply16(uint8x16_t c, uint8x16_t alpha) {
+    return vcombine_u8(unpremultiply8(vget_low_u8(c), vget_low_u8(alpha)),
+                       unpremultiply8(vget_high_u8(c), vget_high_u8(alpha)));
+}
+#endif
+
+void thinpic_swizzle_rgb(const uint8_t* in, uint8_t* out, int width, int bands, int swap) {
+    int x = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    if (bands == 4) {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x4_t p = vld4q_u8(in + x * 4);
+            uint8x16x3_t q = {{swap ? p.val[2] : p.val[0], p.val[1], swap ? p.val[0] : p.val[2]}};
+            vst3q_u8(out + x * 3, q);
+        }
+    } else if (swap) {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x3_t p = vld3q_u8(in + x * 3);
+            uint8x16_t red = p.val[2];
+            p.val[2] = p.val[0];
+            p.val[0] = red;
+            vst3q_u8(out + x * 3, p);
+        }
+    }
+#endif
+    int red = swap ? 2 : 0;
+    for (; x < width; x++) {
+        const uint8_t* p = in + x * bands;
+        out[x * 3] = p[red];
+        out[x * 3 + 1] = p[1];
+        out[x * 3 + 2] = p[2 - red];
+    }
+}
+
+void thinpic_swizzle_rgba(const uint8_t* in, uint8_t* out, int width, int bands, int swap, int premultiplied) {
+    int x = 0;
+    premultiplied = premultiplied && (bands == 2 || bands == 4);
+    if (bands == 2) swap = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    if (bands == 4) {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x4_t p = vld4q_u8(in + x * 4);
+            if (swap) {
+                uint8x16_t red = p.val[2];
+                p.val[2] = p.val[0];
+                p.val[0] = red;
+            }
+            if (premultiplied) {
+                for (int c = 0; c < 3; c++) p.val[c] = unpremultiply16(p.val[c], p.val[3]);
+            }
+            vst4q_u8(out + x * 4, p);
+        }
+    } else if (bands == 3 && swap) {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x3_t p = vld3q_u8(in + x * 3);
+            uint8x16_t red = p.val[2];
+            p.val[2] = p.val[0];
+            p.val[0] = red;
+            vst3q_u8(out + x * 3, p);
+        }
+    } else if (bands == 2 && premultiplied) {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x2_t p = vld2q_u8(in + x * 2);
+            p.val[0] = unpremultiply16(p.val[0], p.val[1]);
+            vst2q_u8(out + x * 2, p);
+        }
+    }
+#endif
+    int red = swap ? 2 : 0;
+    int colours = bands == 2 ? 1 : 3;
+    for (; x < width; x++) {
+        const uint8_t* p = in + x * bands;
+        uint8_t* q = out + x * bands;
+        uint8_t pixel[4] = {p[0], p[1], bands > 2 ? p[2] : 0, bands > 3 ? p[3] : 0};
+        if (colours == 3) {
+            pixel[0] = p[red];
+            pixel[2] = p[2 - red];
+        }
+        if (premultiplied) {
+            for (int c = 0; c < colours; c++) pixel[c] = unpremultiply(pixel[c], pixel[bands - 1]);
+        }
+        for (int c = 0; c < bands; c++) q[c] = pixel[c];
+    }
+}
+
+static int swizzle_generate(VipsRegion* out_region, void* seq, void* a, void* b, gboolean* stop) {
+    VipsRegion* in_region = (VipsRegion*)seq;
+    int flags = (int)(intptr_t)b;
+    VipsRect* rect = &out_region->valid;
+    int bands = out_region->im->Bands;
+    (void)a;
+    (void)stop;
+    if (vips_region_prepare(in_region, rect)) return -1;
+    for (int y = 0; y < rect->height; y++) {
+        thinpic_swizzle_rgba(VIPS_REGION_ADDR(in_region, rect->left, rect->top + y),
+                             VIPS_REGION_ADDR(out_region, rect->left, rect->top + y), rect->width, bands,
+                             flags & SWIZZLE_SWAP, flags & SWIZZLE_PREMULTIPLIED);
+    }
+    return 0;
+}
+
+int thinpic_swizzle_image(VipsImage* image, VipsImage** out, int swap, int premultiplied) {
+    int flags = (swap ? SWIZZLE_SWAP : 0) | (premultiplied ? SWIZZLE_PREMULTIPLIED : 0);
+    return thinpic_pipe_image(image, out, VIPS_FORMAT_UCHAR, vips_image_get_interpretation(image),
+                              swizzle_generate, (void*)(intptr_t)flags);
+}
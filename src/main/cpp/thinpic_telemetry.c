@@ -0,0 +1,64 @@
+// Per-job telemetry ring (thinpic_drain_stats). Writers claim a sequence
+// number with one atomic add and publish their slot seqlock-style: the
+// slot's state is odd while the record is copied in and even once it is
+// complete, so workers never wait on each other or on the drainer. Only
+// drainers take a mutex, to agree on where the last drain stopped.
+
+#include <pthread.h>
+
+#include "thinpic_internal.h"
+
+typedef struct {
+    uint64_t state;                 // 2 * sequence + 1 while writing, + 2 once written
+    ThinpicTelemetryRecord record;
+} TelemetrySlot;
+
+static TelemetrySlot ring[THINPIC_TELEMETRY_RECORDS];
+static uint64_t next_sequence = 0;
+static int armed = 0;
+
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t drained = 0;        // Next sequence to hand out
+
+int thinpic_telemetry_armed(void) {
+    return __atomic_load_n(&armed, __ATOMIC_ACQUIRE);
+}
+
+void thinpic_telemetry_record(const ThinpicTelemetryRecord* record) {
+    uint64_t sequence = __atomic_fetch_add(&next_sequence, 1, __ATOMIC_RELAXED);
+    TelemetrySlot* slot = &ring[sequence % THINPIC_TELEMETRY_RECORDS];
+    __atomic_store_n(&slot->state, 2 * sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->record = *record;
+    slot->record.sequence = (int64_t)sequence;
+    __atomic_store_n(&slot->state, 2 * sequence + 2, __ATOMIC_RELEASE);
+}
+
+int thinpic_drain_stats(ThinpicTelemetryRecord* out, int max) {
+    __atomic_store_n(&armed, 1, __ATOMIC_RELEASE);
+    if (!out || max <= 0) return 0;
+
+    pthread_mutex_lock(&drain_mutex);
+    uint64_t head = __atomic_load_n(&next_sequence, __ATOMIC_ACQUIRE);
+    // Anything a full ring behind the newest claim is gone
+    if (head - drained > THINPIC_TELEMETRY_RECORDS) drained = head - THINPIC_TELEMETRY_RECORDS;
+    int count = 0;
+    while (drained < head && count < max) {
+        TelemetrySlot* slot = &ring[drained % THINPIC_TELEMETRY_RECORDS];
+        uint64_t written = 2 * drained + 2;
+        uint64_t before = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        // Claimed but not finished yet: the next drain picks it up
+        if (before < written) break;
+        if (before == written) {
+            ThinpicTelemetryRecord copy = slot->record;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->state, __ATOMIC_RELAXED) == written) {
+                out[count++] = copy;
+            }
+        }
+        // A later state means a newer record already took the slot
+        drained++;
+    }
+    pthread_mutex_unlock(&drain_mutex);
+    return count;
+}
@@ -0,0 +1,95 @@
+// Model input tensors (ThinpicOptions tensor_width x tensor_height) from the
+// RGB plane the hash tap averages out of the encoder's strips. An app that
+// classifies every upload used to decode the file again in Dart or TFLite
+// and resize it there; the tap already sees the resized pixels on their way
+// to the encoder, so it box-averages the centre crop of that image straight
+// into the tensor's cells. Area averaging is what a downscale to a model's
+// input should be (no aliasing from point sampling), and the encoded image
+// is usually far larger than the tensor. When the crop has fewer pixels
+// than the tensor on a side, the plane keeps the crop's own size and is
+// stretched here bilinearly, with pixel centres aligned as TFLite's and
+// PyTorch's resize do by default (align_corners off).
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Source position and weight of each output column or row; plane cells are
+// centred on (i + 0.5) * size / output - 0.5
+static void resample_axis(int size, int output, int* low, int* high, float* weight) {
+    for (int i = 0; i < output; i++) {
+        double at = (i + 0.5) * size / output - 0.5;
+        if (at < 0) at = 0;
+        int base = (int)at;
+        if (base > size - 1) base = size - 1;
+        low[i] = base;
+        high[i] = base + 1 < size ? base + 1 : base;
+        weight[i] = (float)(at - base);
+    }
+}
+
+// The plane's mean of one channel at output cell (x, y), 0-255
+static float sample(const ThinpicRgbPlane* plane, const int* low_x, const int* high_x, const float* weight_x,
+                    const int* low_y, const int* high_y, const float* weight_y, int x, int y, int band) {
+    const float* top = plane->rgb + (size_t)low_y[y] * plane->width * 3;
+    const float* bottom = plane->rgb + (size_t)high_y[y] * plane->width * 3;
+    float upper = top[low_x[x] * 3 + band] + (top[high_x[x] * 3 + band] - top[low_x[x] * 3 + band]) * weight_x[x];
+    float lower = bottom[low_x[x] * 3 + band] +
+                  (bottom[high_x[x] * 3 + band] - bottom[low_x[x] * 3 + band]) * weight_x[x];
+    return upper + (lower - upper) * weight_y[y];
+}
+
+int thinpic_tensor_fill(const ThinpicRgbPlane* plane, const ThinpicOptions* options, ThinpicResult* out) {
+    int width = options->tensor_width;
+    int height = options->tensor_height;
+    int floats = options->tensor_type == THINPIC_TENSOR_FLOAT32;
+    size_t length = (size_t)width * height * 3 * (floats ? sizeof(float) : 1);
+    uint8_t* tensor = (uint8_t*)g_try_malloc(length);
+    int* low_x = g_new(int, width);
+    int* high_x = g_new(int, width);
+    float* weight_x = g_new(float, width);
+    int* low_y = g_new(int, height);
+    int* high_y = g_new(int, height);
+    float* weight_y = g_new(float, height);
+    if (tensor) {
+        resample_axis(plane->width, width, low_x, high_x, weight_x);
+        resample_axis(plane->height, height, low_y, high_y, weight_y);
+        // Folded so each float element is one multiply-add from 0-255
+        float scale[3];
+        float offset[3];
+        for (int band = 0; band < 3; band++) {
+            double std = options->tensor_std[band] > 0 ? options->tensor_std[band] : 1.0;
+            scale[band] = (float)(1.0 / (255.0 * std));
+            offset[band] = (float)(-options->tensor_mean[band] / std);
+        }
+        float* values = (float*)tensor;
+        size_t element = 0;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int band = 0; band < 3; band++, element++) {
+                    float value = sample(plane, low_x, high_x, weight_x, low_y, high_y, weight_y, x, y, band);
+                    if (floats) {
+                        values[element] = value * scale[band] + offset[band];
+                    } else {
+                        int rounded = (int)(value + 0.5f);
+                        tensor[element] = (uint8_t)(rounded > 255 ? 255 : rounded);
+                    }
+                }
+            }
+        }
+        out->tensor = tensor;
+        out->tensor_length = length;
+        THINPIC_LOGD("Tensor %dx%dx3 (%s) from a %dx%d plane", width, height, floats ? "float32" : "uint8",
+                     plane->width, plane->height);
+    } else {
+        THINPIC_LOGW("No memory for a %zu byte tensor", length);
+    }
+    g_free(low_x);
+    g_free(high_x);
+    g_free(weight_x);
+    g_free(low_y);
+    g_free(high_y);
+    g_free(weight_y);
+    return tensor ? 0 : -1;
+}
@@ -0,0 +1,95 @@
+// Previews drawn straight into a Flutter texture. The Android plugin class
+// (ThinpicTexturePlugin) registers a SurfaceTexture with Flutter's
+// TextureRegistry and passes its Surface here; the image is decoded as in
+// thinpic_decode_rgba and its rows are copied into the window's buffer, so
+// the pixels go from the decoder to the compositor without passing through
+// the Dart heap or a ui.Image upload. Other platforms get -1.
+
+#include <string.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#ifdef __ANDROID__
+#include <jni.h>
+#include <android/native_window.h>
+#include <android/native_window_jni.h>
+
+int thinpic_render_to_window(const ThinpicSource* source, void* window, int max_width, int max_height,
+                             int* width, int* height) {
+    if (width) *width = 0;
+    if (height) *height = 0;
+    if (!window) {
+        thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+        return -1;
+    }
+    ThinpicPixels pixels;
+    if (thinpic_decode_rgba(source, max_width, max_height, &pixels) != 0) return -1;
+
+    ANativeWindow* target = (ANativeWindow*)window;
+    int status = -1;
+    ANativeWindow_Buffer buffer;
+    if (ANativeWindow_setBuffersGeometry(target, pixels.width, pixels.height,
+                                         WINDOW_FORMAT_RGBA_8888) != 0 ||
+            ANativeWindow_lock(target, &buffer, NULL) != 0) {
+        THINPIC_LOGE("Texture: cannot lock a %dx%d window buffer", pixels.width, pixels.height);
+        thinpic_error_code(THINPIC_ERROR_IO);
+    } else {
+        // The buffer may be larger than asked for and its stride is in pixels
+        int rows = pixels.height < buffer.height ? pixels.height : buffer.height;
+        int columns = pixels.width < buffer.width ? pixels.width : buffer.width;
+        uint8_t* bits = (uint8_t*)buffer.bits;
+        for (int y = 0; y < rows; y++) {
+            memcpy(bits + (size_t)y * buffer.stride * 4, pixels.data + (size_t)y * pixels.stride,
+                   (size_t)columns * 4);
+        }
+        ANativeWindow_unlockAndPost(target);
+        if (width) *width = pixels.width;
+        if (height) *height = pixels.height;
+        status = 0;
+    }
+    g_free(pixels.data);
+    return status;
+}
+
+// ThinpicTexturePlugin.nativeRender(Surface, String, int, int, int[]): fills
+// size with the drawn width and height; returns 0, or -1 on failure
+JNIEXPORT jint JNICALL
+Java_com_example_thinpic_1flutter_ThinpicTexturePlugin_nativeRender(JNIEnv* env, jclass clazz,
+                                                                    jobject surface, jstring path,
+                                                                    jint max_width, jint max_height,
+                                                                    jintArray size) {
+    (void)clazz;
+    if (!surface || !path) return -1;
+    ANativeWindow* window = ANativeWindow_fromSurface(env, surface);
+    if (!window) return -1;
+    const char* input_path = (*env)->GetStringUTFChars(env, path, NULL);
+    if (!input_path) {
+        ANativeWindow_release(window);
+        return -1;
+    }
+    ThinpicSource source;
+    memset(&source, 0, sizeof(source));
+    source.type = THINPIC_SOURCE_PATH;
+    source.path = input_path;
+    int drawn[2] = {0, 0};
+    int status = thinpic_render_to_window(&source, window, max_width, max_height, &drawn[0], &drawn[1]);
+    (*env)->ReleaseStringUTFChars(env, path, input_path);
+    ANativeWindow_release(window);
+    if (status == 0 && size && (*env)->GetArrayLength(env, size) >= 2) {
+        jint values[2] = {drawn[0], drawn[1]};
+        (*env)->SetIntArrayRegion(env, size, 0, 2, values);
+    }
+    return status;
+}
+
+#else
+int thinpic_render_to_window(const ThinpicSource* source, void* window, int max_width, int max_height,
+                             int* width, int* height) {
+    (void)source; (void)window; (void)max_width; (void)max_height;
+    if (width) *width = 0;
+    if (height) *height = 0;
+    thinpic_error_code(THINPIC_ERROR_INVALID_ARGUMENT);
+    return -1;
+}
+#endif
@@ -0,0 +1,136 @@
+// Thermal- and power-aware pool scheduling (thinpic_configure
+// thermal_scaling). The pool asks how many jobs may run at once before
+// starting each one, and each worker binds the current throttle level so the
+// encoders lower their effort. AThermal is API 30 and looked up in
+// libandroid at runtime; without it only the power-save hint applies.
+
+#include <pthread.h>
+#ifdef __ANDROID__
+#include <dlfcn.h>
+#include <time.h>
+#endif
+
+#include "thinpic_internal.h"
+#include "thinpic_log.h"
+
+// AThermalStatus values from <android/thermal.h>
+#define THERMAL_STATUS_MODERATE 2
+#define THERMAL_STATUS_SEVERE 3
+#define THERMAL_STATUS_CRITICAL 4
+
+// AThermal_getCurrentThermalStatus is a binder call; re-read at most this often
+#define THERMAL_POLL_MS 1000
+
+static int scaling_enabled = 0;
+static int power_save = 0;
+static int thermal_status = -1;         // Last status read; -1 = unavailable
+static int effort_pinned = 0;           // thinpic_configure deterministic
+
+// Throttle level of the pool job on this thread, for thinpic_thermal_effort
+static __thread int bound_level = 0;
+
+#ifdef __ANDROID__
+typedef void* (*ThermalAcquireManager)(void);
+typedef int (*ThermalGetCurrentStatus)(void* manager);
+
+static pthread_once_t thermal_once = PTHREAD_ONCE_INIT;
+static void* thermal_manager = NULL;
+static ThermalGetCurrentStatus thermal_get_status = NULL;
+static int64_t thermal_read_ms = 0;
+static pthread_mutex_t thermal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void load_athermal(void) {
+    void* library = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (!library) return;
+    ThermalAcquireManager acquire = (ThermalAcquireManager)dlsym(library, "AThermal_acquireManager");
+    ThermalGetCurrentStatus get_status = (ThermalGetCurrentStatus)dlsym(library, "AThermal_getCurrentThermalStatus");
+    if (!acquire || !get_status) return;
+    // Kept for the life of the process
+    thermal_manager = acquire();
+    if (thermal_manager) thermal_get_status = get_status;
+}
+
+static int64_t thermal_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+void thinpic_thermal_enable(int enabled) {
+#ifdef __ANDROID__
+    if (enabled) pthread_once(&thermal_once, load_athermal);
+#endif
+    __atomic_store_n(&scaling_enabled, enabled ? 1 : 0, __ATOMIC_RELEASE);
+    THINPIC_LOGI("Thermal scaling %s", enabled ? "on" : "off");
+}
+
+void thinpic_set_power_save(int enabled) {
+    __atomic_store_n(&power_save, enabled ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+int thinpic_thermal_status() {
+    if (!__atomic_load_n(&scaling_enabled, __ATOMIC_ACQUIRE)) return -1;
+#ifdef __ANDROID__
+    if (!thermal_get_status) return -1;
+    int64_t now = thermal_now_ms();
+    // Whoever refreshes does the binder call; everyone else takes the last value
+    if (now - __atomic_load_n(&thermal_read_ms, __ATOMIC_RELAXED) >= THERMAL_POLL_MS &&
+        pthread_mutex_trylock(&thermal_mutex) == 0) {
+        int status = thermal_get_status(thermal_manager);
+        int previous = __atomic_exchange_n(&thermal_status, status, __ATOMIC_RELEASE);
+        __atomic_store_n(&thermal_read_ms, now, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&thermal_mutex);
+        if (status != previous) THINPIC_LOGI("Thermal status %d", status);
+    }
+#endif
+    return __atomic_load_n(&thermal_status, __ATOMIC_ACQUIRE);
+}
+
+int thinpic_thermal_level() {
+    if (!__atomic_load_n(&scaling_enabled, __ATOMIC_ACQUIRE)) return 0;
+    int status = thinpic_thermal_status();
+    int level = 0;
+    if (status >= THERMAL_STATUS_CRITICAL) {
+        level = 3;
+    } else if (status >= THERMAL_STATUS_SEVERE) {
+        level = 2;
+    } else if (status >= THERMAL_STATUS_MODERATE) {
+        level = 1;
+    }
+    // Power saver alone slows things as much as a warm device
+    if (level == 0 && __atomic_load_n(&power_save, __ATOMIC_ACQUIRE)) level = 1;
+    return level;
+}
+
+int thinpic_thermal_worker_cap(int level, int workers) {
+    int cap = workers;
+    switch (level) {
+        case 0: break;
+        case 1: cap = (workers + 1) / 2; break;
+        case 2: cap = (workers + 3) / 4; break;
+        default: cap = 1; break;
+    }
+    return cap > 0 ? cap : 1;
+}
+
+void thinpic_thermal_bind(int level) {
+    bound_level = level;
+}
+
+void thinpic_thermal_pin_effort(int pinned) {
+    __atomic_store_n(&effort_pinned, pinned ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+int thinpic_thermal_effort(int effort, int floor) {
+    // Fewer jobs at once still cool the device; a lower effort would change the bytes
+    if (__atomic_load_n(&effort_pinned, __ATOMIC_RELAXED)) return effort;
+    int scaled = effort;
+    if (bound_level == 1) {
+        scaled = effort * 2 / 3;
+    } else if (bound_level >= 2) {
+        scaled = effort / 3;
+    }
+    if (scaled < floor) scaled = floor;
+    return scaled < effort ? scaled : effort;
+}
@@ -0,0 +1,55 @@
+// One thread budget shared by pool jobs and the libvips threads inside them.
+// Every libvips sink starts vips_concurrency_get() threads, by default one
+// per core, so eight workers each saving a photo ran eight times as many
+// render threads as there are cores, all fighting for the same caches.
+// Now the pool grants each job a share of the cores when it starts, sized
+// by the job's pixels and by how many other jobs are waiting: a lone DSLR
+// frame gets every core for its pipeline, a batch of phone photos runs one
+// thread per job. The grant is bound on the worker like the thermal level
+// and reaches libvips as the "concurrency" of each pipeline root, which
+// every image built from it inherits; CompressOptions.threads still wins.
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+// Pixels one libvips render thread keeps busy; below this a second thread
+// costs more in start-up and tile handoff than it saves
+#define PIXELS_PER_THREAD (2 * 1000 * 1000)
+
+// Threads granted to the pool job on this thread; 0 = none bound
+static __thread int bound_threads = 0;
+
+int thinpic_thread_grant(int64_t pixels, int free_threads, int contenders) {
+    if (free_threads < 1) return 1;
+    // Leave each job that could start behind this one a thread of its own
+    int share = free_threads / (contenders > 0 ? contenders + 1 : 1);
+    int wanted = pixels > 0 ? (int)((pixels + PIXELS_PER_THREAD - 1) / PIXELS_PER_THREAD) : 1;
+    // threads_per_image stays the ceiling
+    int ceiling = vips_concurrency_get();
+    int grant = wanted < share ? wanted : share;
+    if (ceiling > 0 && grant > ceiling) grant = ceiling;
+    return grant > 0 ? grant : 1;
+}
+
+void thinpic_threads_bind(int threads) {
+    bound_threads = threads > 0 ? threads : 0;
+}
+
+int thinpic_threads_bound() {
+    return bound_threads;
+}
+
+VipsImage* thinpic_threads_limit(VipsImage* image) {
+    if (!image || bound_threads <= 0) return image;
+    // Loader results can be shared through the operation cache, and so can
+    // a vips_copy of them, so the limit goes on a private pass-through
+    // rather than on an image other jobs may hold
+    VipsImage* limited = NULL;
+    if (thinpic_private_image(image, &limited)) {
+        vips_error_clear();
+        return image;
+    }
+    g_object_unref(image);
+    vips_image_set_int(limited, VIPS_META_CONCURRENCY, bound_threads);
+    return limited;
+}
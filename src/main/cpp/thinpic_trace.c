@@ -0,0 +1,74 @@
+// ATrace sections for Perfetto and systrace (thinpic_set_tracing). The
+// ATrace entry points are API 23 and the plugin supports API 21, so they are
+// looked up in libandroid at runtime; without them, and off Android, every
+// call is a no-op. Sections are only emitted while a trace is recording.
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#ifdef __ANDROID__
+#include <dlfcn.h>
+#include <stdbool.h>
+#endif
+
+#include "thinpic_internal.h"
+
+#define TRACE_NAME_MAX 128
+
+static int tracing_enabled = 0;
+
+#ifdef __ANDROID__
+typedef void (*TraceBeginSection)(const char* name);
+typedef void (*TraceEndSection)(void);
+typedef bool (*TraceIsEnabled)(void);
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static TraceBeginSection trace_begin_section = NULL;
+static TraceEndSection trace_end_section = NULL;
+static TraceIsEnabled trace_is_enabled = NULL;
+
+static void load_atrace(void) {
+    void* library = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (!library) return;
+    trace_begin_section = (TraceBeginSection)dlsym(library, "ATrace_beginSection");
+    trace_end_section = (TraceEndSection)dlsym(library, "ATrace_endSection");
+    trace_is_enabled = (TraceIsEnabled)dlsym(library, "ATrace_isEnabled");
+    if (!trace_begin_section || !trace_end_section || !trace_is_enabled) {
+        trace_begin_section = NULL;
+        trace_end_section = NULL;
+        trace_is_enabled = NULL;
+    }
+}
+#endif
+
+void thinpic_set_tracing(int enabled) {
+#ifdef __ANDROID__
+    if (enabled) pthread_once(&trace_once, load_atrace);
+#endif
+    __atomic_store_n(&tracing_enabled, enabled ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+int thinpic_trace_begin(const char* format, ...) {
+    if (!__atomic_load_n(&tracing_enabled, __ATOMIC_ACQUIRE)) return 0;
+#ifdef __ANDROID__
+    if (!trace_begin_section || !trace_is_enabled()) return 0;
+    char name[TRACE_NAME_MAX];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(name, sizeof(name), format, args);
+    va_end(args);
+    trace_begin_section(name);
+    return 1;
+#else
+    (void)format;
+    return 0;
+#endif
+}
+
+void thinpic_trace_end(int traced) {
+#ifdef __ANDROID__
+    if (traced) trace_end_section();
+#else
+    (void)traced;
+#endif
+}
@@ -0,0 +1,143 @@
+// Target-size WebP through libwebp's own rate control, for
+// smart_compress_image_with_format. The generic search re-runs the whole
+// encoder, colour conversion and analysis included, for every candidate
+// quality; libwebp can aim at a byte count itself (WebPConfig target_size):
+// it converts and analyses the picture once, then bisects its quantizer
+// over up to RATE_PASSES token passes, each of which only re-quantizes and
+// counts the bits, and entropy-codes the final one. The result is one
+// encoder call instead of up to eighteen. Metadata follows the strip
+// policy as webpsave does, added as RIFF chunks with libwebpmux.
+
+#include <string.h>
+#include <webp/encode.h>
+#include <webp/mux.h>
+
+#include "thinpic_log.h"
+#include "thinpic_internal.h"
+
+#define RATE_PASSES 10              // libwebp's most; passes stop once the size converges
+#define EXIF_HEADER "Exif\0\0"      // libvips keeps the APP1 prefix, the WebP chunk has none
+#define EXIF_HEADER_LENGTH 6
+
+static int cancel_hook(int percent, const WebPPicture* picture) {
+    (void)percent;
+    (void)picture;
+    return !thinpic_cancel_requested();
+}
+
+static int add_chunk(WebPMux* mux, VipsImage* image, const char* field, const char* fourcc) {
+    const void* data = NULL;
+    size_t length = 0;
+    if (!vips_image_get_typeof(image, field) || vips_image_get_blob(image, field, &data, &length) || !length) {
+        return 0;
+    }
+    if (strcmp(fourcc, "EXIF") == 0 && length > EXIF_HEADER_LENGTH &&
+            memcmp(data, EXIF_HEADER, EXIF_HEADER_LENGTH) == 0) {
+        data = (const uint8_t*)data + EXIF_HEADER_LENGTH;
+        length -= EXIF_HEADER_LENGTH;
+    }
+    WebPData chunk = {(const uint8_t*)data, length};
+    return WebPMuxSetChunk(mux, fourcc, &chunk, 1) == WEBP_MUX_OK ? 1 : -1;
+}
+
+// The bitstream with the ICC profile, EXIF and XMP the policy keeps; the
+// plain bitstream when there are none
+static int add_metadata(VipsImage* image, ThinpicStripPolicy strip, WebPMemoryWriter* writer) {
+    if (strip == THINPIC_STRIP_ALL) return 0;
+    WebPData bitstream = {writer->mem, writer->size};
+    WebPMux* mux = WebPMuxCreate(&bitstream, 0);
+    if (!mux) return -1;
+    int added = 0;
+    int status = add_chunk(mux, image, VIPS_META_ICC_NAME, "ICCP");
+    added |= status > 0;
+    if (status >= 0 && strip == THINPIC_STRIP_NONE) {
+        status = add_chunk(mux, image, VIPS_META_EXIF_NAME, "EXIF");
+        added |= status > 0;
+    }
+    if (status >= 0 && strip == THINPIC_STRIP_NONE) {
+        status = add_chunk(mux, image, VIPS_META_XMP_NAME, "XMP ");
+        added |= status > 0;
+    }
+    WebPData assembled = {NULL, 0};
+    if (status >= 0 && added && WebPMuxAssemble(mux, &assembled) != WEBP_MUX_OK) status = -1;
+    WebPMuxDelete(mux);
+    if (status < 0) return -1;
+    if (added) {
+        WebPMemoryWriterClear(writer);
+        writer->mem = (uint8_t*)assembled.bytes;
+        writer->size = assembled.size;
+        writer->max_size = assembled.size;
+    }
+    return 0;
+}
+
+int thinpic_webp_target_size(VipsImage* image, size_t target_bytes, int max_quality, int min_quality,
+                             int effort, int sharp_yuv, ThinpicStripPolicy strip,
+                             uint8_t** out, size_t* out_length) {
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    // target_size is an int; the generic search covers what libwebp cannot take
+    if (width > WEBP_MAX_DIMENSION || height > WEBP_MAX_DIMENSION || target_bytes == 0 ||
+            target_bytes > INT32_MAX || vips_image_get_format(image) != VIPS_FORMAT_UCHAR) {
+        return 0;
+    }
+
+    WebPConfig config;
+    if (!WebPConfigInit(&config)) return 0;
+    config.quality = (float)max_quality;
+    config.qmin = min_quality;
+    config.qmax = max_quality;
+    config.target_size = (int)target_bytes;
+    config.pass = RATE_PASSES;
+    config.method = effort < 0 ? 4 : effort > 6 ? 6 : effort;
+    config.use_sharp_yuv = sharp_yuv;
+    if (!WebPValidateConfig(&config)) return 0;
+
+    VipsImage* input = thinpic_palette_input(image);
+    if (!input) return -1;
+    int bands = vips_image_get_bands(input);
+    size_t size = 0;
+    uint8_t* pixels = (uint8_t*)vips_image_write_to_memory(input, &size);
+    if (!pixels) {
+        g_object_unref(input);
+        return -1;
+    }
+
+    WebPPicture picture;
+    WebPMemoryWriter writer;
+    WebPPictureInit(&picture);
+    WebPMemoryWriterInit(&writer);
+    picture.width = width;
+    picture.height = height;
+    // The encoder works in YUV; sharp YUV converts from ARGB itself
+    picture.use_argb = sharp_yuv;
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+    picture.progress_hook = cancel_hook;
+    int imported = bands == 4 ? WebPPictureImportRGBA(&picture, pixels, width * 4)
+                              : WebPPictureImportRGB(&picture, pixels, width * 3);
+    g_free(pixels);
+    int encoded = imported && WebPEncode(&config, &picture);
+    WebPEncodingError error = picture.error_code;
+    WebPPictureFree(&picture);
+    if (!encoded || add_metadata(input, strip, &writer)) {
+        // A cancelled job is reported by the pool
+        if (error == VP8_ENC_ERROR_USER_ABORT) {
+            THINPIC_LOGD("WebP rate control cancelled");
+        } else {
+            THINPIC_LOGE("Error: WebP rate control encode failed (%d)", error);
+        }
+        WebPMemoryWriterClear(&writer);
+        g_object_unref(input);
+        return -1;
+    }
+    g_object_unref(input);
+
+    // Results are released with free_compressed_buffer (g_free)
+    *out = (uint8_t*)g_malloc(writer.size);
+    memcpy(*out, writer.mem, writer.size);
+    *out_length = writer.size;
+    WebPMemoryWriterClear(&writer);
+    THINPIC_LOGD("WebP rate control: %dx%d, target %zu bytes, wrote %zu", width, height, target_bytes, *out_length);
+    return 1;
+}